@@ -0,0 +1,484 @@
+//--------------------------------------------------------------------------------------
+// File: Animation.cpp
+//
+// Skeletal animation runtime
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "Animation.h"
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// SSE helpers, keys are four 16 bit values so one 64 bit load gets a whole key
+	//--------------------------------------------------------------------------------------
+	static inline __m128 AnimLoadSnorm(const SHORT* p)
+	{
+		__m128i v = _mm_loadl_epi64((const __m128i*)p);
+		v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f/32767.0f));
+	}
+
+	static inline __m128 AnimLoadUnorm(const WORD* p)
+	{
+		__m128i v = _mm_loadl_epi64((const __m128i*)p);
+		v = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+		return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f/65535.0f));
+	}
+
+	// Dot product of four floats in every lane
+	static inline __m128 AnimDot4(__m128 a, __m128 b)
+	{
+		__m128 m = _mm_mul_ps(a, b);
+		m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2,3,0,1)));
+		return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1,0,3,2)));
+	}
+
+	static inline __m128 AnimLerp(__m128 a, __m128 b, __m128 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	// out = a*b for row vector matrices, out may be either input
+	static inline void AnimMultiply(D3DXMATRIX& out, const D3DXMATRIX& a, const D3DXMATRIX& b)
+	{
+		__m128 b0 = _mm_loadu_ps(b.m[0]);
+		__m128 b1 = _mm_loadu_ps(b.m[1]);
+		__m128 b2 = _mm_loadu_ps(b.m[2]);
+		__m128 b3 = _mm_loadu_ps(b.m[3]);
+		for(int r=0; r<4; r++)
+		{
+			__m128 row = _mm_loadu_ps(a.m[r]);
+			__m128 sum = _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(0,0,0,0)), b0);
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(1,1,1,1)), b1));
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(2,2,2,2)), b2));
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(3,3,3,3)), b3));
+			_mm_storeu_ps(out.m[r], sum);
+		}
+	}
+
+	// Scale, then rotate, then translate, the same as D3DXMatrixTransformation
+	static inline void AnimCompose(D3DXMATRIX& out, const float* q, const float* t, const float* s)
+	{
+		float xx = q[0]*q[0], yy = q[1]*q[1], zz = q[2]*q[2];
+		float xy = q[0]*q[1], xz = q[0]*q[2], yz = q[1]*q[2];
+		float xw = q[0]*q[3], yw = q[1]*q[3], zw = q[2]*q[3];
+		out._11 = s[0]*(1-2*(yy+zz)); out._12 = s[0]*2*(xy+zw);     out._13 = s[0]*2*(xz-yw);     out._14 = 0;
+		out._21 = s[1]*2*(xy-zw);     out._22 = s[1]*(1-2*(xx+zz)); out._23 = s[1]*2*(yz+xw);     out._24 = 0;
+		out._31 = s[2]*2*(xz+yw);     out._32 = s[2]*2*(yz-xw);     out._33 = s[2]*(1-2*(xx+yy)); out._34 = 0;
+		out._41 = t[0];               out._42 = t[1];               out._43 = t[2];               out._44 = 1;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Clips
+	//--------------------------------------------------------------------------------------
+	void AnimationClip::Release()
+	{
+		Tracks.Release();
+		RotKeys.Release();
+		PosKeys.Release();
+		ScaleKeys.Release();
+	}
+
+	UINT AnimationClip::GetMemoryUsage()
+	{
+		return Tracks.Size()*sizeof(AnimTrack) + (RotKeys.Size()+PosKeys.Size()+ScaleKeys.Size())*sizeof(WORD);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Skeleton
+	//--------------------------------------------------------------------------------------
+	Skeleton::Skeleton()
+	{
+		m_MaxVertInfluences = 0;
+	}
+
+	void Skeleton::Release()
+	{
+		for(int i=0; i<m_Clips.Size(); i++)
+			m_Clips[i].Release();
+		m_Clips.Release();
+		m_Parents.Release();
+		m_Bind.Release();
+		m_BoneNodes.Release();
+		m_BoneOffsets.Release();
+		m_MaxVertInfluences = 0;
+	}
+
+	UINT Skeleton::GetMemoryUsage()
+	{
+		UINT size = m_Parents.Size()*(sizeof(DWORD)+sizeof(AnimSRT)) + m_BoneNodes.Size()*(sizeof(DWORD)+sizeof(D3DXMATRIX));
+		for(int i=0; i<m_Clips.Size(); i++)
+			size += m_Clips[i].GetMemoryUsage();
+		return size;
+	}
+
+	int Skeleton::FindClip(const char* szName)
+	{
+		for(int i=0; i<m_Clips.Size(); i++)
+			if(m_Clips[i].Name==szName)
+				return i;
+		return -1;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sets the nodes and bones
+	//--------------------------------------------------------------------------------------
+	void Skeleton::SetHierarchy(const DWORD* pParents, const AnimSRT* pBind, int numNodes, const DWORD* pBoneNodes, const D3DXMATRIX* pOffsets, int numBones)
+	{
+		m_Parents.FromArray(const_cast<DWORD*>(pParents), numNodes);
+		m_Bind.FromArray(const_cast<AnimSRT*>(pBind), numNodes);
+		m_BoneNodes.FromArray(const_cast<DWORD*>(pBoneNodes), numBones);
+		m_BoneOffsets.FromArray(const_cast<D3DXMATRIX*>(pOffsets), numBones);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Compresses a clip.  Rotations are flipped where needed so each key is in the same
+	// hemisphere as the one before it, which lets sampling lerp keys without a check.
+	//--------------------------------------------------------------------------------------
+	int Skeleton::AddClip(const char* szName, float duration, const AnimSRT* pSamples, int numFrames)
+	{
+		int numNodes = m_Parents.Size();
+		AnimationClip clip;
+		clip.Name = szName;
+		clip.Duration = duration;
+		clip.NumFrames = numFrames;
+		clip.Tracks.Allocate(numNodes);
+
+		// Ranges and which parts never change
+		int numRot = 0, numPos = 0, numScale = 0;
+		for(int n=0; n<numNodes; n++)
+		{
+			const AnimSRT* pNode = pSamples + n*numFrames;
+			AnimTrack& track = clip.Tracks[n];
+			D3DXVECTOR3 posMax = pNode[0].Pos, scaleMax = pNode[0].Scale;
+			D3DXVECTOR3 posMin = posMax, scaleMin = scaleMax;
+			D3DXQUATERNION rot0;
+			D3DXQuaternionNormalize(&rot0, &pNode[0].Rot);
+			bool bConstRot = true;
+			for(int f=1; f<numFrames; f++)
+			{
+				D3DXVec3Minimize(&posMin, &posMin, &pNode[f].Pos);
+				D3DXVec3Maximize(&posMax, &posMax, &pNode[f].Pos);
+				D3DXVec3Minimize(&scaleMin, &scaleMin, &pNode[f].Scale);
+				D3DXVec3Maximize(&scaleMax, &scaleMax, &pNode[f].Scale);
+				D3DXQUATERNION rot;
+				D3DXQuaternionNormalize(&rot, &pNode[f].Rot);
+				if(fabsf(D3DXQuaternionDot(&rot, &rot0)) < 1.0f-1e-7f)
+					bConstRot = false;
+			}
+			D3DXVECTOR3 posRange = posMax-posMin, scaleRange = scaleMax-scaleMin;
+			track.Flags = 0;
+			if(bConstRot)
+				track.Flags |= ANIM_CONST_ROT;
+			if(max(max(posRange.x, posRange.y), posRange.z)==0)
+				track.Flags |= ANIM_CONST_POS;
+			if(max(max(scaleRange.x, scaleRange.y), scaleRange.z)==0)
+				track.Flags |= ANIM_CONST_SCALE;
+			track.PosMin = D3DXVECTOR4(posMin.x, posMin.y, posMin.z, 0);
+			track.PosRange = D3DXVECTOR4(posRange.x, posRange.y, posRange.z, 0);
+			track.ScaleMin = D3DXVECTOR4(scaleMin.x, scaleMin.y, scaleMin.z, 0);
+			track.ScaleRange = D3DXVECTOR4(scaleRange.x, scaleRange.y, scaleRange.z, 0);
+			track.RotKey = numRot;
+			track.PosKey = numPos;
+			track.ScaleKey = numScale;
+			numRot += (track.Flags & ANIM_CONST_ROT) ? 1 : numFrames;
+			numPos += (track.Flags & ANIM_CONST_POS) ? 1 : numFrames;
+			numScale += (track.Flags & ANIM_CONST_SCALE) ? 1 : numFrames;
+		}
+
+		// Keys
+		clip.RotKeys.Allocate(numRot*4);
+		clip.PosKeys.Allocate(numPos*4);
+		clip.ScaleKeys.Allocate(numScale*4);
+		for(int n=0; n<numNodes; n++)
+		{
+			const AnimSRT* pNode = pSamples + n*numFrames;
+			const AnimTrack& track = clip.Tracks[n];
+			D3DXQUATERNION prev(0,0,0,1);
+			int count = (track.Flags & ANIM_CONST_ROT) ? 1 : numFrames;
+			for(int f=0; f<count; f++)
+			{
+				D3DXQUATERNION rot;
+				D3DXQuaternionNormalize(&rot, &pNode[f].Rot);
+				if(f>0 && D3DXQuaternionDot(&rot, &prev)<0)
+					rot = -rot;
+				prev = rot;
+				SHORT* pKey = &clip.RotKeys[(track.RotKey+f)*4];
+				for(int c=0; c<4; c++)
+					pKey[c] = (SHORT)floorf(max(-1.0f, min(1.0f, (&rot.x)[c]))*32767.0f + 0.5f);
+			}
+
+			count = (track.Flags & ANIM_CONST_POS) ? 1 : numFrames;
+			for(int f=0; f<count; f++)
+			{
+				WORD* pKey = &clip.PosKeys[(track.PosKey+f)*4];
+				for(int c=0; c<3; c++)
+				{
+					float range = (&track.PosRange.x)[c];
+					pKey[c] = range>0 ? (WORD)floorf(((&pNode[f].Pos.x)[c]-(&track.PosMin.x)[c])/range*65535.0f + 0.5f) : 0;
+				}
+				pKey[3] = 0;
+			}
+
+			count = (track.Flags & ANIM_CONST_SCALE) ? 1 : numFrames;
+			for(int f=0; f<count; f++)
+			{
+				WORD* pKey = &clip.ScaleKeys[(track.ScaleKey+f)*4];
+				for(int c=0; c<3; c++)
+				{
+					float range = (&track.ScaleRange.x)[c];
+					pKey[c] = range>0 ? (WORD)floorf(((&pNode[f].Scale.x)[c]-(&track.ScaleMin.x)[c])/range*65535.0f + 0.5f) : 0;
+				}
+				pKey[3] = 0;
+			}
+		}
+
+		m_Clips.Add(clip);
+		return m_Clips.Size()-1;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds a frame, its siblings and everything under them, each node after its parent
+	//--------------------------------------------------------------------------------------
+	static void AnimFlatten(D3DXFRAME* pFrame, DWORD parent, Array<D3DXFRAME*>& frames, Array<DWORD>& parents)
+	{
+		for(; pFrame; pFrame=pFrame->pFrameSibling)
+		{
+			DWORD index = frames.Size();
+			frames.Add(pFrame);
+			parents.Add(parent);
+			AnimFlatten(pFrame->pFrameFirstChild, index, frames, parents);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Builds from a D3DX hierarchy.  Each animation set is sampled through GetSRT, which
+	// works for every kind of set, and nodes a set does not animate hold their bind pose.
+	//--------------------------------------------------------------------------------------
+	bool Skeleton::Build(D3DXFRAME* pRoot, ID3DXSkinInfo* pSkinInfo, ID3DXAnimationController* pAnimCtrl)
+	{
+		Release();
+		Array<D3DXFRAME*> frames;
+		Array<DWORD> parents;
+		AnimFlatten(pRoot, ANIM_ROOT, frames, parents);
+		int numNodes = frames.Size();
+
+		// Bind pose
+		Array<AnimSRT> bind;
+		bind.Allocate(numNodes);
+		for(int i=0; i<numNodes; i++)
+			D3DXMatrixDecompose(&bind[i].Scale, &bind[i].Rot, &bind[i].Pos, &frames[i]->TransformationMatrix);
+
+		// Bones are matched to frames by name
+		int numBones = pSkinInfo->GetNumBones();
+		Array<DWORD> boneNodes;
+		Array<D3DXMATRIX> offsets;
+		boneNodes.Allocate(numBones);
+		offsets.Allocate(numBones);
+		bool bFound = true;
+		for(int b=0; b<numBones; b++)
+		{
+			const char* szBone = pSkinInfo->GetBoneName(b);
+			boneNodes[b] = ANIM_ROOT;
+			for(int i=0; i<numNodes && boneNodes[b]==ANIM_ROOT; i++)
+				if(frames[i]->Name && szBone && strcmp(frames[i]->Name, szBone)==0)
+					boneNodes[b] = i;
+			if(boneNodes[b]==ANIM_ROOT)
+			{
+				Log::Print("<!> Skeleton::Build() bone %s has no frame", szBone ? szBone : "");
+				bFound = false;
+				break;
+			}
+			offsets[b] = *pSkinInfo->GetBoneOffsetMatrix(b);
+		}
+		if(bFound)
+		{
+			SetHierarchy(parents, bind, numNodes, boneNodes, offsets, numBones);
+			pSkinInfo->GetMaxVertexInfluences(&m_MaxVertInfluences);
+
+			// Resample the animation sets
+			UINT numSets = pAnimCtrl ? pAnimCtrl->GetNumAnimationSets() : 0;
+			for(UINT a=0; a<numSets; a++)
+			{
+				ID3DXAnimationSet* pSet = NULL;
+				if(FAILED(pAnimCtrl->GetAnimationSet(a, &pSet)))
+					continue;
+				float duration = (float)pSet->GetPeriod();
+				int numFrames = max(2, (int)ceilf(duration*ANIM_SAMPLE_RATE)+1);
+				Array<AnimSRT> samples;
+				samples.Allocate(numNodes*numFrames);
+				for(int i=0; i<numNodes; i++)
+				{
+					UINT animIndex;
+					bool bAnimated = frames[i]->Name && SUCCEEDED(pSet->GetAnimationIndexByName(frames[i]->Name, &animIndex));
+					for(int f=0; f<numFrames; f++)
+					{
+						AnimSRT& srt = samples[i*numFrames+f];
+						if(bAnimated)
+							pSet->GetSRT((double)duration*f/(numFrames-1), animIndex, &srt.Scale, &srt.Rot, &srt.Pos);
+						else
+							srt = bind[i];
+					}
+				}
+				AddClip(pSet->GetName(), duration, samples, numFrames);
+				samples.Release();
+				pSet->Release();
+			}
+			Log::Print("Skeleton::Build() %d nodes, %d bones, %d clips, %dKB", numNodes, numBones, m_Clips.Size(), GetMemoryUsage()/1024);
+		}
+
+		frames.Release();
+		parents.Release();
+		bind.Release();
+		boneNodes.Release();
+		offsets.Release();
+		return bFound;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Moves a layer along its clip
+	//--------------------------------------------------------------------------------------
+	void Skeleton::AdvanceLayer(AnimLayer& layer, float elapsed)
+	{
+		if(layer.Clip<0 || layer.Clip>=m_Clips.Size())
+			return;
+		float duration = m_Clips[layer.Clip].Duration;
+		layer.Time += elapsed*layer.Speed;
+		if(duration<=0)
+			layer.Time = 0;
+		else if(layer.bLoop)
+		{
+			layer.Time = fmodf(layer.Time, duration);
+			if(layer.Time<0)
+				layer.Time += duration;
+		}
+		else
+			layer.Time = max(0.0f, min(layer.Time, duration));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Poses the skeleton.  Each node blends the keys of every layer around its time with
+	// the bind pose for any weight left, then goes into model space through its parent,
+	// which is always done already.
+	//--------------------------------------------------------------------------------------
+	void Skeleton::ComputePose(const AnimLayer* pLayers, int numLayers, D3DXMATRIX* pModel, D3DXMATRIX* pFinal)
+	{
+		// Frames and weights of the layers playing
+		const AnimationClip* pClips[ANIM_MAX_LAYERS];
+		const AnimTrack* pTracks[ANIM_MAX_LAYERS];
+		int frame0[ANIM_MAX_LAYERS], frame1[ANIM_MAX_LAYERS];
+		__m128 vFrac[ANIM_MAX_LAYERS], vWeight[ANIM_MAX_LAYERS];
+		int numActive = 0;
+		float rest = 1.0f;
+		for(int l=0; l<numLayers && numActive<ANIM_MAX_LAYERS; l++)
+		{
+			const AnimLayer& layer = pLayers[l];
+			if(layer.Clip<0 || layer.Clip>=m_Clips.Size() || layer.Weight<=0)
+				continue;
+			const AnimationClip& clip = m_Clips[layer.Clip];
+			float frame = clip.Duration>0 ? layer.Time*(clip.NumFrames-1)/clip.Duration : 0;
+			frame = max(0.0f, min(frame, (float)(clip.NumFrames-1)));
+			int f0 = min((int)frame, clip.NumFrames-2);
+			pClips[numActive] = &clip;
+			pTracks[numActive] = clip.Tracks;
+			frame0[numActive] = f0;
+			frame1[numActive] = f0+1;
+			vFrac[numActive] = _mm_set1_ps(frame-f0);
+			vWeight[numActive] = _mm_set1_ps(layer.Weight);
+			rest -= layer.Weight;
+			numActive++;
+		}
+		const __m128 vRest = _mm_set1_ps(max(rest, 0.0f));
+		const __m128 vZero = _mm_setzero_ps();
+		const __m128 vSign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+		const DWORD* pParents = m_Parents;
+		const AnimSRT* pBind = m_Bind;
+		const int numNodes = m_Parents.Size();
+		for(int i=0; i<numNodes; i++)
+		{
+			__m128 q = vZero, t = vZero, s = vZero;
+			for(int l=0; l<numActive; l++)
+			{
+				const AnimationClip& clip = *pClips[l];
+				const AnimTrack& track = pTracks[l][i];
+				const SHORT* pRot = clip.RotKeys;
+				const WORD* pPos = clip.PosKeys;
+				const WORD* pScale = clip.ScaleKeys;
+				int r0 = track.RotKey, r1 = track.RotKey;
+				if(!(track.Flags & ANIM_CONST_ROT))
+				{
+					r0 += frame0[l];
+					r1 += frame1[l];
+				}
+				int p0 = track.PosKey, p1 = track.PosKey;
+				if(!(track.Flags & ANIM_CONST_POS))
+				{
+					p0 += frame0[l];
+					p1 += frame1[l];
+				}
+				int s0 = track.ScaleKey, s1 = track.ScaleKey;
+				if(!(track.Flags & ANIM_CONST_SCALE))
+				{
+					s0 += frame0[l];
+					s1 += frame1[l];
+				}
+				__m128 lq = AnimLerp(AnimLoadSnorm(pRot+r0*4), AnimLoadSnorm(pRot+r1*4), vFrac[l]);
+				__m128 lt = AnimLerp(AnimLoadUnorm(pPos+p0*4), AnimLoadUnorm(pPos+p1*4), vFrac[l]);
+				__m128 ls = AnimLerp(AnimLoadUnorm(pScale+s0*4), AnimLoadUnorm(pScale+s1*4), vFrac[l]);
+				lt = _mm_add_ps(_mm_loadu_ps(&track.PosMin.x), _mm_mul_ps(lt, _mm_loadu_ps(&track.PosRange.x)));
+				ls = _mm_add_ps(_mm_loadu_ps(&track.ScaleMin.x), _mm_mul_ps(ls, _mm_loadu_ps(&track.ScaleRange.x)));
+
+				// Rotations are added in the hemisphere of what is there already
+				lq = _mm_xor_ps(lq, _mm_and_ps(_mm_cmplt_ps(AnimDot4(q, lq), vZero), vSign));
+				q = _mm_add_ps(q, _mm_mul_ps(lq, vWeight[l]));
+				t = _mm_add_ps(t, _mm_mul_ps(lt, vWeight[l]));
+				s = _mm_add_ps(s, _mm_mul_ps(ls, vWeight[l]));
+			}
+			if(rest>0)
+			{
+				const AnimSRT& bind = pBind[i];
+				__m128 lq = _mm_loadu_ps(&bind.Rot.x);
+				lq = _mm_xor_ps(lq, _mm_and_ps(_mm_cmplt_ps(AnimDot4(q, lq), vZero), vSign));
+				q = _mm_add_ps(q, _mm_mul_ps(lq, vRest));
+				t = _mm_add_ps(t, _mm_mul_ps(_mm_set_ps(0, bind.Pos.z, bind.Pos.y, bind.Pos.x), vRest));
+				s = _mm_add_ps(s, _mm_mul_ps(_mm_set_ps(0, bind.Scale.z, bind.Scale.y, bind.Scale.x), vRest));
+			}
+			q = _mm_div_ps(q, _mm_sqrt_ps(AnimDot4(q, q)));
+
+			float fq[4], ft[4], fs[4];
+			_mm_storeu_ps(fq, q);
+			_mm_storeu_ps(ft, t);
+			_mm_storeu_ps(fs, s);
+			if(pParents[i]==ANIM_ROOT)
+				AnimCompose(pModel[i], fq, ft, fs);
+			else
+			{
+				D3DXMATRIX local;
+				AnimCompose(local, fq, ft, fs);
+				AnimMultiply(pModel[i], local, pModel[pParents[i]]);
+			}
+		}
+
+		// Bone matrices
+		const DWORD* pBoneNodes = m_BoneNodes;
+		const D3DXMATRIX* pOffsets = m_BoneOffsets;
+		for(int b=0; b<m_BoneNodes.Size(); b++)
+			AnimMultiply(pFinal[b], pOffsets[b], pModel[pBoneNodes[b]]);
+	}
+}
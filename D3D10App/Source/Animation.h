@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+// File: Animation.h
+//
+// Skeletal animation runtime.  The D3DX frame hierarchy is flattened into arrays with
+// every node after its parent, so a pose is one loop instead of a recursion.  Clips are
+// resampled at a fixed rate and compressed, rotations as snorm16 quaternions and
+// translations and scales as 16 bit fractions of their range, with parts that never
+// change kept as a single key.  Sampling and blending run four floats at a time in SSE.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+#include "MString.h"
+
+namespace Core
+{
+
+// Frames a second clips are resampled at
+#define ANIM_SAMPLE_RATE 30.0f
+
+// Clips an object can blend at once
+#define ANIM_MAX_LAYERS 2
+
+// Characters in each thread pool band
+#define ANIM_JOB_BAND 8
+
+// Parent of a root node
+#define ANIM_ROOT 0xffffffff
+
+// Track parts that keep a single key
+#define ANIM_CONST_ROT		1
+#define ANIM_CONST_POS		2
+#define ANIM_CONST_SCALE	4
+
+	// A local transform, used to hand uncompressed poses to the skeleton
+	struct AnimSRT
+	{
+		D3DXQUATERNION	Rot;
+		D3DXVECTOR3		Pos;
+		D3DXVECTOR3		Scale;
+	};
+
+	// Where the keys of one node are in a clip and how to decode them.  The ranges
+	// have a zero fourth component so they load straight into SSE registers.
+	struct AnimTrack
+	{
+		D3DXVECTOR4		PosMin, PosRange;		// pos = PosMin + q*PosRange
+		D3DXVECTOR4		ScaleMin, ScaleRange;	// scale = ScaleMin + q*ScaleRange
+		int				RotKey;					// First key of each part, four shorts a key
+		int				PosKey;
+		int				ScaleKey;
+		DWORD			Flags;					// ANIM_CONST_ values
+	};
+
+	// A compressed clip, each node has a track
+	struct AnimationClip
+	{
+		String			Name;
+		float			Duration;		// Seconds
+		int				NumFrames;		// Frames at ANIM_SAMPLE_RATE, the last is at Duration
+		Array<AnimTrack> Tracks;
+		Array<SHORT>	RotKeys;
+		Array<WORD>		PosKeys;
+		Array<WORD>		ScaleKeys;
+
+		void Release();
+		UINT GetMemoryUsage();
+	};
+
+	// A clip playing on an object
+	struct AnimLayer
+	{
+		int		Clip;		// -1 when the layer is off
+		float	Time;		// Seconds into the clip
+		float	Speed;		// Playback rate
+		float	Weight;		// Blend weight, the weights of all layers add up to one at most
+		bool	bLoop;		// Wraps at the end of the clip, otherwise holds the last frame
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Bone hierarchy and clips of a skinned mesh, shared by all the objects using it
+	//--------------------------------------------------------------------------------------
+	class Skeleton
+	{
+	public:
+		Skeleton();
+
+		// Frees everything
+		void Release();
+
+		// Flattens a loaded D3DX hierarchy and resamples every animation set of its controller
+		bool Build(D3DXFRAME* pRoot, ID3DXSkinInfo* pSkinInfo, ID3DXAnimationController* pAnimCtrl);
+
+		// Sets the nodes, parents come before their children and are ANIM_ROOT for a root.
+		// Bones are the skinning matrices, each on a node with an offset from the bind pose.
+		void SetHierarchy(const DWORD* pParents, const AnimSRT* pBind, int numNodes, const DWORD* pBoneNodes, const D3DXMATRIX* pOffsets, int numBones);
+
+		// Compresses a clip from numFrames samples of each node, node after node
+		int AddClip(const char* szName, float duration, const AnimSRT* pSamples, int numFrames);
+
+		// Samples and blends the layers into model space node matrices and the bone
+		// matrices the shaders skin with.  Weight the layers leave is the bind pose.
+		void ComputePose(const AnimLayer* pLayers, int numLayers, D3DXMATRIX* pModel, D3DXMATRIX* pFinal);
+
+		// Moves a layer along its clip
+		void AdvanceLayer(AnimLayer& layer, float elapsed);
+
+		inline bool IsBuilt(){ return m_Parents.Size()>0; }
+		inline int GetNumNodes(){ return m_Parents.Size(); }
+		inline int GetNumBones(){ return m_BoneNodes.Size(); }
+		inline int GetNumClips(){ return m_Clips.Size(); }
+		inline AnimationClip& GetClip(int i){ return m_Clips[i]; }
+		inline DWORD GetMaxVertInfluences(){ return m_MaxVertInfluences; }
+		inline void SetMaxVertInfluences(DWORD num){ m_MaxVertInfluences = num; }
+		UINT GetMemoryUsage();
+
+		// Index of a clip, -1 if there is none with the name
+		int FindClip(const char* szName);
+
+	private:
+		Array<DWORD>			m_Parents;			// Parent of each node
+		Array<AnimSRT>			m_Bind;				// Local transform of each node when not animated
+		Array<DWORD>			m_BoneNodes;		// Node of each bone
+		Array<D3DXMATRIX>		m_BoneOffsets;		// Bind pose to bone space
+		Array<AnimationClip>	m_Clips;			// Animations
+		DWORD					m_MaxVertInfluences;// Bones per vertex
+	};
+
+}
@@ -0,0 +1,252 @@
+//--------------------------------------------------------------------------------------
+// File: BlendPyramid.cpp
+//
+// CPU blendmap mip chain
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "BlendPyramid.h"
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	BlendPyramid::BlendPyramid()
+	{
+		m_Size = 0;
+		m_NumLevels = 0;
+		m_pData = NULL;
+		m_pLevels = NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Allocates the levels in one block
+	//--------------------------------------------------------------------------------------
+	bool BlendPyramid::Create(int size, int levels)
+	{
+		Release();
+		if(!Math::IsPowerOf2(size) || (size>>(levels-1))==0)
+		{
+			Log::Print("BlendPyramid::Create() needs a power of two size with %d levels", levels);
+			return false;
+		}
+
+		int texels = 0;
+		for(int i=0; i<levels; i++)
+			texels += (size>>i)*(size>>i);
+		m_pData = new BlendTexel[texels];
+		m_pLevels = new BlendTexel*[levels];
+		for(int i=0, offset=0; i<levels; i++)
+		{
+			m_pLevels[i] = m_pData + offset;
+			offset += (size>>i)*(size>>i);
+		}
+		memset(m_pData, 0, texels*sizeof(BlendTexel));
+		m_Size = size;
+		m_NumLevels = levels;
+		return true;
+	}
+
+	void BlendPyramid::Release()
+	{
+		SAFE_DELETE_ARRAY(m_pData);
+		SAFE_DELETE_ARRAY(m_pLevels);
+		m_Size = m_NumLevels = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Combines a 2x2 block.  Weights are summed per layer id so a mip keeps the layers
+	// that cover the most of the block, rather than averaging the ids themselves.
+	//--------------------------------------------------------------------------------------
+	BlendTexel BlendPyramid::Reduce(const BlendTexel& a, const BlendTexel& b, const BlendTexel& c, const BlendTexel& d)
+	{
+		const BlendTexel* pIn[4] = { &a, &b, &c, &d };
+		BlendTexel out;
+
+		// Same layers everywhere, the weights can just be averaged
+		bool same = true;
+		for(int i=1; i<4; i++)
+			same = same && pIn[i]->data[0]==a.data[0] && pIn[i]->data[1]==a.data[1];
+		if(same)
+		{
+			for(int i=0; i<4; i++)
+				out.data[i] = (UCHAR)((a.data[i] + b.data[i] + c.data[i] + d.data[i] + 2) >> 2);
+			return out;
+		}
+
+		// Total the weight of each layer
+		UCHAR ids[8];
+		int weights[8];
+		int numIds = 0;
+		for(int i=0; i<4; i++)
+		for(int j=0; j<2; j++)
+		{
+			UCHAR id = pIn[i]->data[j];
+			int k = 0;
+			while(k<numIds && ids[k]!=id)
+				k++;
+			if(k==numIds)
+			{
+				ids[numIds] = id;
+				weights[numIds++] = 0;
+			}
+			weights[k] += pIn[i]->data[j+2];
+		}
+
+		// Keep the two heaviest
+		int best = 0;
+		for(int k=1; k<numIds; k++)
+			if(weights[k] > weights[best])
+				best = k;
+		int second = -1;
+		for(int k=0; k<numIds; k++)
+			if(k!=best && (second<0 || weights[k] > weights[second]))
+				second = k;
+
+		out.data[0] = ids[best];
+		out.data[2] = (UCHAR)Math::Min((weights[best]+2) >> 2, 255);
+		if(second<0)
+		{
+			out.data[1] = ids[best];
+			out.data[3] = 0;
+		}
+		else
+		{
+			out.data[1] = ids[second];
+			out.data[3] = (UCHAR)Math::Min((weights[second]+2) >> 2, 255);
+		}
+		return out;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Downsamples four texels at a time, blocks with mixed layers fall back to Reduce()
+	//--------------------------------------------------------------------------------------
+	void BlendPyramid::Downsample(const BlendTexel* pSrc, int srcPitch, BlendTexel* pDest, int destPitch, int width, int height)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i round = _mm_set1_epi16(2);
+		for(int y=0; y<height; y++)
+		{
+			const BlendTexel* r0 = pSrc + 2*y*srcPitch;
+			const BlendTexel* r1 = r0 + srcPitch;
+			BlendTexel* pOut = pDest + y*destPitch;
+
+			int x = 0;
+			for(; x+4<=width; x+=4)
+			{
+				__m128 a0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(r0 + 2*x)));
+				__m128 a1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(r0 + 2*x + 4)));
+				__m128 b0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(r1 + 2*x)));
+				__m128 b1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(r1 + 2*x + 4)));
+
+				// Split into the left and right texel of each block
+				__m128i ae = _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2,0,2,0)));
+				__m128i ao = _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3,1,3,1)));
+				__m128i be = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2,0,2,0)));
+				__m128i bo = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3,1,3,1)));
+
+				// The id bytes must match across each block
+				__m128i same = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(ae, ao), _mm_cmpeq_epi8(ae, be)), _mm_cmpeq_epi8(ae, bo));
+				int mask = _mm_movemask_epi8(same) & 0x3333;
+
+				// Rounded average of every byte, matching ids average to themselves
+				__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(ae, zero), _mm_unpacklo_epi8(ao, zero)),
+										   _mm_add_epi16(_mm_unpacklo_epi8(be, zero), _mm_unpacklo_epi8(bo, zero)));
+				__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(ae, zero), _mm_unpackhi_epi8(ao, zero)),
+										   _mm_add_epi16(_mm_unpackhi_epi8(be, zero), _mm_unpackhi_epi8(bo, zero)));
+				lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 2);
+				hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 2);
+				_mm_storeu_si128((__m128i*)(pOut + x), _mm_packus_epi16(lo, hi));
+
+				// Redo the blocks that mix layers
+				if(mask!=0x3333)
+				{
+					for(int i=0; i<4; i++)
+						if(((mask>>(4*i))&3)!=3)
+						{
+							int s = 2*(x+i);
+							pOut[x+i] = Reduce(r0[s], r0[s+1], r1[s], r1[s+1]);
+						}
+				}
+			}
+
+			// Leftovers
+			for(; x<width; x++)
+				pOut[x] = Reduce(r0[2*x], r0[2*x+1], r1[2*x], r1[2*x+1]);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Downsamples bands of rows in parallel
+	//--------------------------------------------------------------------------------------
+	struct DownsampleData
+	{
+		const BlendTexel*	pSrc;
+		int					srcPitch;
+		BlendTexel*			pDest;
+		int					destPitch;
+		int					width;
+	};
+
+	static void DownsampleJob(int start, int end, void* pData)
+	{
+		DownsampleData& d = *(DownsampleData*)pData;
+		BlendPyramid::Downsample(d.pSrc + 2*start*d.srcPitch, d.srcPitch, d.pDest + start*d.destPitch, d.destPitch, d.width, end-start);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Rebuilds the mips under a rect of the top level
+	//--------------------------------------------------------------------------------------
+	void BlendPyramid::BuildMips(const RECT& dirty, RECT* pRects)
+	{
+		RECT r;
+		r.left = Math::Max((int)dirty.left, 0);
+		r.top = Math::Max((int)dirty.top, 0);
+		r.right = Math::Min((int)dirty.right, m_Size);
+		r.bottom = Math::Min((int)dirty.bottom, m_Size);
+		pRects[0] = r;
+		for(int i=1; i<m_NumLevels; i++)
+		{
+			// Every texel whose block overlaps the rect changes
+			r.left /= 2;
+			r.top /= 2;
+			r.right = (r.right+1)/2;
+			r.bottom = (r.bottom+1)/2;
+			pRects[i] = r;
+			if(r.left>=r.right || r.top>=r.bottom)
+				continue;
+
+			int srcPitch = m_Size>>(i-1);
+			int destPitch = m_Size>>i;
+			DownsampleData d;
+			d.pSrc = m_pLevels[i-1] + 2*r.top*srcPitch + 2*r.left;
+			d.srcPitch = srcPitch;
+			d.pDest = m_pLevels[i] + r.top*destPitch + r.left;
+			d.destPitch = destPitch;
+			d.width = r.right-r.left;
+			g_ThreadPool.ParallelFor(r.bottom-r.top, DownsampleJob, &d, 64);
+		}
+	}
+
+	void BlendPyramid::BuildMips()
+	{
+		RECT full = { 0, 0, m_Size, m_Size };
+		RECT* pRects = new RECT[m_NumLevels];
+		BuildMips(full, pRects);
+		delete[] pRects;
+	}
+
+}
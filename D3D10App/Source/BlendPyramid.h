@@ -0,0 +1,64 @@
+//--------------------------------------------------------------------------------------
+// File: BlendPyramid.h
+//
+// CPU copy of the terrain layer blendmap and its mip chain.  Painting edits the top
+// level and only the mips under the brush are rebuilt, so the same texels can then be
+// uploaded to the clipmap base texture.  Nothing here touches D3D.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "QMath.h"
+
+namespace Core
+{
+
+	// Blendmap texel mapping, two layer ids followed by their weights
+	struct BlendTexel
+	{
+		UCHAR data[4];
+	};
+
+
+	class BlendPyramid
+	{
+	public:
+		BlendPyramid();
+		~BlendPyramid(){ Release(); }
+
+		// Allocates a size*size top level and its mips, size must be a power of two
+		bool Create(int size, int levels);
+		void Release();
+
+		// Rebuilds every mip from the top level
+		void BuildMips();
+
+		// Rebuilds the mips under a rect of the top level.  pRects receives the rect
+		// touched in each level, including the top one, so it needs GetLevels() entries.
+		void BuildMips(const RECT& dirty, RECT* pRects);
+
+		// Builds width*height texels, each from a 2x2 block of the source.  Texels whose
+		// blocks share both layer ids have their weights averaged, mixed blocks keep the
+		// two layers with the most total weight.  Pitches are in texels.
+		static void Downsample(const BlendTexel* pSrc, int srcPitch, BlendTexel* pDest, int destPitch, int width, int height);
+
+		// Reference version of Downsample for a single texel
+		static BlendTexel Reduce(const BlendTexel& a, const BlendTexel& b, const BlendTexel& c, const BlendTexel& d);
+
+		// Properties
+		inline int GetSize(){ return m_Size; }
+		inline int GetLevels(){ return m_NumLevels; }
+		inline int GetLevelSize(int level){ return m_Size>>level; }
+		inline BlendTexel* GetLevel(int level){ return m_pLevels[level]; }
+		inline BlendTexel& GetTexel(int level, int x, int y){ return m_pLevels[level][y*(m_Size>>level) + x]; }
+
+	private:
+		int				m_Size;
+		int				m_NumLevels;
+		BlendTexel*		m_pData;
+		BlendTexel**	m_pLevels;
+	};
+
+}
@@ -15,13 +15,28 @@
 namespace Core
 {
 	//--------------------------------------------------------------------------------------
-	// Creates a clipmap system for an existing texture
+	// Constructor
 	//--------------------------------------------------------------------------------------
-	bool Clipmap::Create(int resolution, int clipResolution, int levels, DXGI_FORMAT format)
+	Clipmap::Clipmap()
+	{
+		m_BaseTexture = NULL;
+		m_pTiles = NULL;
+		m_pScratch = NULL;
+		m_TrimXSide = NULL;
+		m_TrimZSide = NULL;
+		m_ClipmapOffsets = NULL;
+		m_FlagForUpdate = false;
+		m_Size = m_ClipmapSize = m_ClipmapLevels = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Allocates the trim arrays and the clipmap textures
+	//--------------------------------------------------------------------------------------
+	bool Clipmap::CreateLevels(int clipResolution, int levels, DXGI_FORMAT format)
 	{
 		m_ClipmapLevels = levels;
 		m_ClipmapSize = clipResolution;
-		m_Size = resolution;
 
 		// Setup the trim positioning arrays
 		m_TrimXSide = new BYTE[m_ClipmapLevels];
@@ -31,15 +46,31 @@ namespace Core
 
 		// Cached clipmap positions
 		m_ClipmapOffsets = new D3DXVECTOR2[m_ClipmapLevels-1];
+		m_Regions.Create(m_ClipmapSize, m_ClipmapLevels-1);
 
 		// Create the clipmap textures
 		DXGI_FORMAT* formats = new DXGI_FORMAT[m_ClipmapLevels-1];
 		for(int i=0; i<m_ClipmapLevels-1; i++)
 			formats[i] = format;
 		HRESULT hr = m_Clipmaps.CreateArray(m_ClipmapSize, m_ClipmapSize, formats, m_ClipmapLevels-1, 1, NULL);
+		delete[] formats;
 		if(FAILED(hr))
+		{
 			Log::D3D10Error(hr);
-		delete[] formats;
+			return false;
+		}
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Creates a clipmap system for an existing texture
+	//--------------------------------------------------------------------------------------
+	bool Clipmap::Create(int resolution, int clipResolution, int levels, DXGI_FORMAT format)
+	{
+		m_Size = resolution;
+		if(!CreateLevels(clipResolution, levels, format))
+			return false;
 
 		// Create the base texture
 		D3D10_TEXTURE2D_DESC td;
@@ -61,28 +92,74 @@ namespace Core
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Creates a clipmap system that streams from a tile cache
+	//--------------------------------------------------------------------------------------
+	bool Clipmap::CreateStreaming(TileCache* pTiles, int clipResolution, int levels)
+	{
+		// The tiles must hold a mip for every clip level
+		if(pTiles->GetLevels() < levels-1)
+		{
+			Log::Print("Clipmap tiles are missing levels");
+			return false;
+		}
+
+		m_pTiles = pTiles;
+		m_Size = pTiles->GetSize();
+		if(!CreateLevels(clipResolution, levels, pTiles->GetFormat()))
+			return false;
+
+		// Enough room to update a full level at once
+		m_pScratch = new BYTE[clipResolution*clipResolution*pTiles->GetTexelSize()];
+		return true;
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Frees all mem
 	//--------------------------------------------------------------------------------------
 	void Clipmap::Release()
 	{
-		m_BaseTexture->Release();
+		SAFE_RELEASE(m_BaseTexture);
 		m_Clipmaps.Release();
-		delete[] m_ClipmapOffsets;
-		delete[] m_TrimXSide;
-		delete[] m_TrimZSide;
+		SAFE_DELETE_ARRAY(m_ClipmapOffsets);
+		SAFE_DELETE_ARRAY(m_TrimXSide);
+		SAFE_DELETE_ARRAY(m_TrimZSide);
+		SAFE_DELETE_ARRAY(m_pScratch);
+		m_Regions.Release();
+		m_Updates.Release();
+		m_pTiles = NULL;
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Marks the texels built from a rect of the base texture as dirty
+	//--------------------------------------------------------------------------------------
+	void Clipmap::Invalidate(const RECT& r)
+	{
+		// Allow for the neighbours the mips are filtered from
+		int half = m_Size/2;
+		for(int i=0, size=1; i<m_ClipmapLevels-1; i++, size*=2)
+		{
+			m_Regions.Invalidate(i, Math::FloorDiv(r.left-half, size)-1, Math::FloorDiv(r.top-half, size)-1,
+				Math::FloorDiv(r.right-half, size)+2, Math::FloorDiv(r.bottom-half, size)+2);
+		}
+	}
+
 
 	//--------------------------------------------------------------------------------------
 	// Update the clipmaps
 	//--------------------------------------------------------------------------------------
-	void Clipmap::Update(D3DXVECTOR3 center)
+	int Clipmap::Update(D3DXVECTOR3 center)
 	{
 		// Update each level
 		float size = 1.0f;
 		D3DXVECTOR3 camPos(floorf(center.x), 0, floorf(center.z));
+		int texels = 0;
+
+		// Keep the tiles around the camera resident
+		if(m_pTiles)
+			m_pTiles->Prefetch((int)camPos.x + m_Size/2, (int)camPos.z + m_Size/2, m_ClipmapSize/2+1);
 		for(int i=0; i<m_ClipmapLevels-1; i++, size*=2)
 		{
 			// Calculate the new position
@@ -101,68 +178,64 @@ namespace Core
 			m_ClipmapOffsets[i].y = (camPos.z)+(G2 - modY);
 
 			// Compute the trim locations
-			bool update = false;	
-			if(G2 - modX > G)
-			{
-				if(m_TrimXSide[i]==0)
-					update = true;
-				m_TrimXSide[i] = 1;
-			}
-			else
-			{
-				if(m_TrimXSide[i]==1)
-					update = true;
-				m_TrimXSide[i] = 0;
-			}
-
-			if(G2 - modY > G)
-			{
-				if(m_TrimZSide[i]==0)
-					update = true;
-				m_TrimZSide[i] = 1;
-			}
-			else
-			{
-				if(m_TrimZSide[i]==1)
-					update = true;
-				m_TrimZSide[i] = 0;
-			}
-
-			if(!update && !m_FlagForUpdate)
+			m_TrimXSide[i] = (G2 - modX > G) ? 1 : 0;
+			m_TrimZSide[i] = (G2 - modY > G) ? 1 : 0;
+
+			// Slide the window, this matches the heights in Terrain::UpdateClipmaps()
+			if(m_FlagForUpdate)
+				m_Regions.Invalidate(i);
+			m_Regions.SetOrigin(i, (int)m_ClipmapOffsets[i].x/G - 1 - (N-1)/2, (int)m_ClipmapOffsets[i].y/G - 1 - (N-1)/2);
+			if(!m_Regions.IsDirty(i))
 				continue;
+			m_Updates.Clear();
+			texels += m_Regions.Flush(i, m_Updates);
 
 			// The mip-level 'i' in the base texture corresponds to the clip-level.
-			// Copy the required regions
-
-			// Compute the region to copy
-			float scaledSize = (float)m_Size / size;
-			D3DXVECTOR2 texMin = D3DXVECTOR2(-0.5f*m_ClipmapSize*size, -0.5f*m_ClipmapSize*size) + m_ClipmapOffsets[i];
-			if(i>0)
-				texMin -= D3DXVECTOR2(0, 1);
-			texMin /= (float)m_Size;
-			texMin += D3DXVECTOR2(0.5f, 0.5f);
-			texMin *= scaledSize;
-			D3DXVECTOR2 texMax = texMin + D3DXVECTOR2(m_ClipmapSize, m_ClipmapSize);
-			UINT dX=0, dY=0;
-			if(texMin.x<0)
-				dX = -texMin.x+1;
-			if(texMin.y<0)
-				dY = -texMin.y+1;
-
-			Math::Clamp(texMin, 0.0f, scaledSize);			
-			Math::Clamp(texMax, 0.0f, scaledSize);
-
-			// Clamp
-			D3D10_BOX sourceRegion;
-			sourceRegion.left = texMin.x;
-			sourceRegion.right = texMax.x;
-			sourceRegion.top = texMin.y;
-			sourceRegion.bottom = texMax.y;
-			sourceRegion.front = 0;
-			sourceRegion.back = 1;
-
-			g_pd3dDevice->CopySubresourceRegion(m_Clipmaps.GetTex()[i], 0, dX, dY, 0, m_BaseTexture, D3D10CalcSubresource(i, 0, m_ClipmapLevels), &sourceRegion);
+			// Grid texel k is texel k+center of the mip.
+			int scaledSize = m_Size / G;
+			int center = scaledSize/2;
+			for(int u=0; u<m_Updates.Size(); u++)
+			{
+				const ClipmapUpdate& up = m_Updates[u];
+				if(m_pTiles)
+				{
+					// Read the region out of the tiles and upload it, the edges are clamped
+					int pitch = up.Width*m_pTiles->GetTexelSize();
+					m_pTiles->ReadRegion(i, up.GridX+center, up.GridY+center, up.Width, up.Height, m_pScratch, pitch);
+					D3D10_BOX destRegion;
+					destRegion.left = up.TexX;
+					destRegion.right = up.TexX+up.Width;
+					destRegion.top = up.TexY;
+					destRegion.bottom = up.TexY+up.Height;
+					destRegion.front = 0;
+					destRegion.back = 1;
+					g_pd3dDevice->UpdateSubresource(m_Clipmaps.GetTex()[i], 0, &destRegion, m_pScratch, pitch, 0);
+					continue;
+				}
+
+				// Clip the copy to the texture, texels outside the terrain are never seen
+				int x0 = up.GridX+center;
+				int y0 = up.GridY+center;
+				int x1 = Math::Min(x0+up.Width, scaledSize);
+				int y1 = Math::Min(y0+up.Height, scaledSize);
+				int dX = up.TexX + Math::Max(-x0, 0);
+				int dY = up.TexY + Math::Max(-y0, 0);
+				x0 = Math::Max(x0, 0);
+				y0 = Math::Max(y0, 0);
+				if(x0>=x1 || y0>=y1)
+					continue;
+
+				D3D10_BOX sourceRegion;
+				sourceRegion.left = x0;
+				sourceRegion.right = x1;
+				sourceRegion.top = y0;
+				sourceRegion.bottom = y1;
+				sourceRegion.front = 0;
+				sourceRegion.back = 1;
+				g_pd3dDevice->CopySubresourceRegion(m_Clipmaps.GetTex()[i], 0, dX, dY, 0, m_BaseTexture, D3D10CalcSubresource(i, 0, m_ClipmapLevels), &sourceRegion);
+			}
 		}
 		m_FlagForUpdate = false;
+		return texels;
 	}
 }
\ No newline at end of file
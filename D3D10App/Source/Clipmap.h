@@ -9,16 +9,23 @@
 #pragma once
 
 #include "RenderSurface.h"
+#include "TileCache.h"
+#include "ClipmapRegions.h"
 
 namespace Core
 {
 	class Clipmap
 	{
 	public:
+		Clipmap();
 
 		// Creates a clipmap system for an existing texture
 		bool Create(int resolution, int clipResolution, int levels, DXGI_FORMAT format);
 
+		// Creates a clipmap system that streams its levels from a tile cache
+		// instead of keeping the full texture in memory
+		bool CreateStreaming(TileCache* pTiles, int clipResolution, int levels);
+
 		// Get the textures
 		inline RenderSurface& GetClipmaps(){ return m_Clipmaps; }
 		inline ID3D10Texture2D* GetBaseTexture(){ return m_BaseTexture; }
@@ -28,15 +35,23 @@ namespace Core
 		// Forces an update
 		inline void ForceUpdate(){ m_FlagForUpdate=true; }
 
-		// Update the clipmaps
-		void Update(D3DXVECTOR3 center);
+		// Marks the texels built from a rect of the base texture as dirty
+		void Invalidate(const RECT& r);
+
+		// Update the clipmaps, returns the number of texels refreshed
+		int Update(D3DXVECTOR3 center);
 
 		// Frees all mem
 		void Release();
 
 	private:
 
+		// Allocates the trim arrays and the clipmap textures
+		bool CreateLevels(int clipResolution, int levels, DXGI_FORMAT format);
+
 		ID3D10Texture2D*	m_BaseTexture;		// Local CPU copy of the full texture
+		TileCache*			m_pTiles;			// Tile source when streaming
+		BYTE*				m_pScratch;			// Staging memory for streamed regions
 
 		int					m_Size;				// Total texture size
 		int					m_ClipmapSize;		// Dimension of each clipmap (N)
@@ -49,6 +64,10 @@ namespace Core
 		BYTE*			m_TrimXSide;
 		BYTE*			m_TrimZSide;
 		D3DXVECTOR2*	m_ClipmapOffsets;
+
+		// Toroidal update tracking
+		ClipmapRegions			m_Regions;
+		Array<ClipmapUpdate>	m_Updates;
 	};
 
 }
\ No newline at end of file
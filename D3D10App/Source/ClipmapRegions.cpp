@@ -0,0 +1,237 @@
+//--------------------------------------------------------------------------------------
+// File: ClipmapRegions.cpp
+//
+// Dirty region tracking for toroidal clipmaps
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ClipmapRegions.h"
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ClipmapRegions::ClipmapRegions()
+	{
+		m_Size = 0;
+		m_NumLevels = 0;
+		m_Levels = NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Setup for a clipmap of size*size texels per level
+	//--------------------------------------------------------------------------------------
+	void ClipmapRegions::Create(int size, int levels)
+	{
+		Release();
+		m_Size = size;
+		m_NumLevels = levels;
+		m_Levels = new Level[levels];
+		for(int i=0; i<levels; i++)
+		{
+			m_Levels[i].OriginX = m_Levels[i].OriginY = 0;
+			m_Levels[i].Valid = false;
+			m_Levels[i].NumDirty = 0;
+		}
+	}
+
+	void ClipmapRegions::Release()
+	{
+		SAFE_DELETE_ARRAY(m_Levels);
+		m_NumLevels = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds a rect to a level, clipped to its window
+	//--------------------------------------------------------------------------------------
+	void ClipmapRegions::AddDirty(Level& level, Rect r)
+	{
+		r.x0 = Math::Max(r.x0, level.OriginX);
+		r.y0 = Math::Max(r.y0, level.OriginY);
+		r.x1 = Math::Min(r.x1, level.OriginX+m_Size);
+		r.y1 = Math::Min(r.y1, level.OriginY+m_Size);
+		if(r.x0>=r.x1 || r.y0>=r.y1)
+			return;
+
+		// Drop rects this one covers, and skip it if it is already covered
+		for(int i=0; i<level.NumDirty; )
+		{
+			Rect& d = level.Dirty[i];
+			if(d.x0<=r.x0 && d.y0<=r.y0 && d.x1>=r.x1 && d.y1>=r.y1)
+				return;
+			if(r.x0<=d.x0 && r.y0<=d.y0 && r.x1>=d.x1 && r.y1>=d.y1)
+				level.Dirty[i] = level.Dirty[--level.NumDirty];
+			else
+				i++;
+		}
+
+		// Too many separate rects, merge everything into one
+		if(level.NumDirty==CLIPMAP_MAX_DIRTY)
+		{
+			for(int i=0; i<level.NumDirty; i++)
+			{
+				r.x0 = Math::Min(r.x0, level.Dirty[i].x0);
+				r.y0 = Math::Min(r.y0, level.Dirty[i].y0);
+				r.x1 = Math::Max(r.x1, level.Dirty[i].x1);
+				r.y1 = Math::Max(r.y1, level.Dirty[i].y1);
+			}
+			level.NumDirty = 0;
+		}
+		level.Dirty[level.NumDirty++] = r;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Moves a level, the texels that scroll into view become dirty
+	//--------------------------------------------------------------------------------------
+	void ClipmapRegions::SetOrigin(int level, int x, int y)
+	{
+		Level& l = m_Levels[level];
+		int dx = x - l.OriginX;
+		int dy = y - l.OriginY;
+		if(l.Valid && dx==0 && dy==0)
+			return;
+
+		// Jumped too far, everything is new
+		if(!l.Valid || abs(dx)>=m_Size || abs(dy)>=m_Size)
+		{
+			l.OriginX = x;
+			l.OriginY = y;
+			l.Valid = true;
+			l.NumDirty = 0;
+			Invalidate(level);
+			return;
+		}
+
+		// Keep the old dirty rects that are still in view
+		Rect old[CLIPMAP_MAX_DIRTY];
+		int numOld = l.NumDirty;
+		memcpy(old, l.Dirty, numOld*sizeof(Rect));
+		l.OriginX = x;
+		l.OriginY = y;
+		l.NumDirty = 0;
+		for(int i=0; i<numOld; i++)
+			AddDirty(l, old[i]);
+
+		// The exposed columns span the full height
+		Rect r;
+		int keepX0 = x, keepX1 = x+m_Size;
+		if(dx!=0)
+		{
+			r.y0 = y;
+			r.y1 = y+m_Size;
+			if(dx>0)
+			{
+				r.x0 = x+m_Size-dx;
+				r.x1 = x+m_Size;
+				keepX1 = r.x0;
+			}
+			else
+			{
+				r.x0 = x;
+				r.x1 = x-dx;
+				keepX0 = r.x1;
+			}
+			AddDirty(l, r);
+		}
+
+		// The exposed rows only cover the columns that weren't already added,
+		// together they form an L
+		if(dy!=0)
+		{
+			r.x0 = keepX0;
+			r.x1 = keepX1;
+			if(dy>0)
+			{
+				r.y0 = y+m_Size-dy;
+				r.y1 = y+m_Size;
+			}
+			else
+			{
+				r.y0 = y;
+				r.y1 = y-dy;
+			}
+			AddDirty(l, r);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Marks texels dirty
+	//--------------------------------------------------------------------------------------
+	void ClipmapRegions::Invalidate(int level, int x0, int y0, int x1, int y1)
+	{
+		// Levels that haven't been placed yet get fully updated anyway
+		Level& l = m_Levels[level];
+		if(!l.Valid)
+			return;
+		Rect r = { x0, y0, x1, y1 };
+		AddDirty(l, r);
+	}
+
+	void ClipmapRegions::Invalidate(int level)
+	{
+		Level& l = m_Levels[level];
+		if(!l.Valid)
+			return;
+		l.NumDirty = 1;
+		l.Dirty[0].x0 = l.OriginX;
+		l.Dirty[0].y0 = l.OriginY;
+		l.Dirty[0].x1 = l.OriginX+m_Size;
+		l.Dirty[0].y1 = l.OriginY+m_Size;
+	}
+
+	void ClipmapRegions::InvalidateAll()
+	{
+		for(int i=0; i<m_NumLevels; i++)
+			Invalidate(i);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Returns the dirty regions split at the wrap edges
+	//--------------------------------------------------------------------------------------
+	int ClipmapRegions::Flush(int level, Array<ClipmapUpdate>& updates)
+	{
+		Level& l = m_Levels[level];
+		int texels = 0;
+		for(int i=0; i<l.NumDirty; i++)
+		{
+			const Rect& r = l.Dirty[i];
+
+			// A rect never spans more than the texture, so it wraps at most once per axis
+			int tx = Wrap(r.x0);
+			int ty = Wrap(r.y0);
+			int w[2], h[2];
+			w[0] = Math::Min(r.x1-r.x0, m_Size-tx);
+			w[1] = (r.x1-r.x0) - w[0];
+			h[0] = Math::Min(r.y1-r.y0, m_Size-ty);
+			h[1] = (r.y1-r.y0) - h[0];
+			for(int y=0; y<2; y++)
+			for(int x=0; x<2; x++)
+			{
+				if(w[x]==0 || h[y]==0)
+					continue;
+				ClipmapUpdate u;
+				u.GridX = r.x0 + (x ? w[0] : 0);
+				u.GridY = r.y0 + (y ? h[0] : 0);
+				u.TexX = x ? 0 : tx;
+				u.TexY = y ? 0 : ty;
+				u.Width = w[x];
+				u.Height = h[y];
+				updates.Add(u);
+				texels += u.Width*u.Height;
+			}
+		}
+		l.NumDirty = 0;
+		return texels;
+	}
+
+}
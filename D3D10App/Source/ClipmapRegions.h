@@ -0,0 +1,87 @@
+//--------------------------------------------------------------------------------------
+// File: ClipmapRegions.h
+//
+// Dirty region tracking for toroidal clipmaps.  Each level is a window of the level's
+// texel grid, stored wrapped around the texture so that moving the window only
+// exposes thin strips along its edges.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+#include "QMath.h"
+
+namespace Core
+{
+
+// Dirty rects kept per level before they are merged together
+#define CLIPMAP_MAX_DIRTY 8
+
+	// A block of texels to refresh
+	struct ClipmapUpdate
+	{
+		int GridX, GridY;		// Grid position of the first texel
+		int TexX, TexY;			// Where that texel lives in the wrapped texture
+		int Width, Height;
+	};
+
+
+	class ClipmapRegions
+	{
+	public:
+		ClipmapRegions();
+		~ClipmapRegions(){ Release(); }
+
+		// Setup for a clipmap of size*size texels per level
+		void Create(int size, int levels);
+		void Release();
+
+		// Moves a level so its first texel sits at grid position x,y.
+		// Texels that scroll into view are marked dirty.
+		void SetOrigin(int level, int x, int y);
+
+		// Marks texels dirty, coordinates are in the level's grid with max exclusive
+		void Invalidate(int level, int x0, int y0, int x1, int y1);
+
+		// Marks whole levels dirty
+		void Invalidate(int level);
+		void InvalidateAll();
+
+		// Appends the dirty regions of a level, split at the wrap edges, then clears
+		// them.  Returns the number of texels to update.
+		int Flush(int level, Array<ClipmapUpdate>& updates);
+
+		// Properties
+		inline bool IsDirty(int level){ return m_Levels[level].NumDirty>0; }
+		inline int GetOriginX(int level){ return m_Levels[level].OriginX; }
+		inline int GetOriginY(int level){ return m_Levels[level].OriginY; }
+
+		// Texture position of a grid coordinate
+		inline int Wrap(int k){ int t = k % m_Size; return t<0 ? t+m_Size : t; }
+
+	private:
+
+		struct Rect
+		{
+			int x0, y0, x1, y1;
+		};
+
+		struct Level
+		{
+			int		OriginX, OriginY;
+			bool	Valid;
+			Rect	Dirty[CLIPMAP_MAX_DIRTY];
+			int		NumDirty;
+		};
+
+		// Adds a rect to a level, clipped to its window
+		void AddDirty(Level& level, Rect r);
+
+		int		m_Size;
+		int		m_NumLevels;
+		Level*	m_Levels;
+	};
+
+}
@@ -392,13 +392,8 @@ namespace Core
 			if(pMesh)
 			{
 				if(pMesh->IsSkinned())
-				{
 					Device::Effect->AnimMatricesVariable->SetMatrixArray((float*)pMesh->GetAnimMatrices(), 0, pMesh->GetNumAnimMatrices());
 
-					// Set the input layout
-					Device::SetInputLayout( SkinnedVertex::pInputLayout );
-				}
-
 				// Render each submesh
 				if(m_DebugRenderMeshList[i].bWireframe && m_DebugRenderMode==DEBUG_SELECT)
 					for(int k=0; k<pMesh->GetNumSubMesh(); k++)
@@ -413,6 +408,7 @@ namespace Core
 							Device::Effect->MaterialDiffuseVariable->SetFloatVector((float*)m_DebugRenderMeshList[i].color[0]);
 
 						// Render the wireframe
+						Device::SetVertexFormat(*pMesh->GetSubMesh(k));
 						if(pMesh->IsSkinned())
 							Device::Effect->Pass[PASS_WIREFRAME_ANIM]->Apply(0);
 						else
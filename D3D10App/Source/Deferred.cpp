@@ -35,14 +35,10 @@ namespace Core
 		Device::Effect->OldWorldMatrixVariable->SetMatrix( (float*)mesh.pWorldMatrixPrev );
 
 		if(mesh.isSkinned)
-		{
 			Device::Effect->AnimMatricesVariable->SetMatrixArray((float*)((D3DXMATRIX*)*mesh.pAnimMatrices), 0, mesh.pAnimMatrices->Size());
 
-			// Set the input layout
-			Device::SetInputLayout( SkinnedVertex::pInputLayout );
-		}
-		else
-			Device::SetInputLayout( Vertex::pInputLayout );
+		// Set the input layout
+		Device::SetVertexFormat(mesh);
 
 		// Set the material
 		Device::SetMaterial(*mesh.pMaterial);
@@ -244,15 +240,8 @@ namespace Core
 		//
 		// Pass the matrix pallete to the shader (for skinned meshes)
 		if(m_pFocusMesh->IsSkinned())
-		{
 			Device::Effect->AnimMatricesVariable->SetMatrixArray((float*)m_pFocusMesh->GetAnimMatrices(), 0, m_pFocusMesh->GetNumAnimMatrices());
 
-			// Set the input layout
-			Device::SetInputLayout( SkinnedVertex::pInputLayout );
-		}
-		else
-			Device::SetInputLayout( Vertex::pInputLayout );
-
 		// Build the correct world matrix, using the camera view angles to rotate the mesh
 		m_pFocusMesh->SetRot( -m_Camera.GetXDeg(), -m_Camera.GetYDeg(), 0);
 
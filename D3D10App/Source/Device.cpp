@@ -17,6 +17,7 @@ namespace Core
 	Material* Device::Material;
 	Light* Device::Light;
 	ID3D10InputLayout* Device::InputLayout;
+	const VertexQuantization* Device::Quantization;
 	D3D10_PRIMITIVE_TOPOLOGY Device::Topology;
 	RenderSurface* Device::Cubemap;
 	Effect* Device::Effect;
@@ -47,6 +48,47 @@ namespace Core
 		Device::InputLayout = pInputLayout;
 
 		g_pd3dDevice->IASetInputLayout(pInputLayout);
+
+		// Only the compact layouts are decoded
+		if(pInputLayout!=CompactVertex::pInputLayout && pInputLayout!=CompactSkinnedVertex::pInputLayout)
+			SetQuantization(NULL);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sets how the shaders decode compact vertices, NULL for full vertices.  Like the
+	// other effect variables it takes effect at the next pass Apply.
+	//--------------------------------------------------------------------------------------
+	void Device::SetQuantization(const VertexQuantization* pQuant, bool bForce)
+	{
+		// State check
+		if(pQuant == Device::Quantization && !bForce)
+			return;
+		Device::Quantization = pQuant;
+
+		D3DXVECTOR4 vScale(0,0,0,0), vOffset(0,0,0,0);
+		if(pQuant)
+		{
+			vScale = D3DXVECTOR4(pQuant->Scale, 1);
+			vOffset = D3DXVECTOR4(pQuant->Offset, 0);
+		}
+		Effect->PosScaleVariable->SetFloatVector((float*)vScale);
+		Effect->PosOffsetVariable->SetFloatVector((float*)vOffset);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sets the input layout and decoding for a submesh's vertex buffer
+	//--------------------------------------------------------------------------------------
+	void Device::SetVertexFormat(const SubMesh& mesh)
+	{
+		if(mesh.pQuantization)
+		{
+			SetInputLayout(mesh.isSkinned ? CompactSkinnedVertex::pInputLayout : CompactVertex::pInputLayout);
+			SetQuantization(mesh.pQuantization);
+		}
+		else
+			SetInputLayout(mesh.isSkinned ? SkinnedVertex::pInputLayout : Vertex::pInputLayout);
 	}
 
 
@@ -153,21 +195,25 @@ namespace Core
 
 
 	//--------------------------------------------------------------------------------------
-	// Draw a submesh
+	// Draw a submesh at a level of detail, -1 uses the level set on the submesh
 	//--------------------------------------------------------------------------------------
-	void Device::DrawSubmesh(SubMesh& mesh)
+	void Device::DrawSubmesh(SubMesh& mesh, int lod)
 	{
+		// Evicted meshes have no buffers until they stream back in
+		if(!mesh.pVertexBuffer || !mesh.pIndexBuffer)
+			return;
+
 		// Set buffers
 		static const UINT offset=0;
-		if(mesh.isSkinned)
-			SetVertexBuffer(mesh.pVertexBuffer, SkinnedVertex::size);
-		else
-			SetVertexBuffer(mesh.pVertexBuffer, Vertex::size);
+		SetVertexBuffer(mesh.pVertexBuffer, GetVertexStride(mesh));
 		SetIndexBuffer(mesh.pIndexBuffer, DXGI_FORMAT_R32_UINT);
 
 		// Draw to screen
-		g_pd3dDevice->DrawIndexed( mesh.numIndices, mesh.startIndex, 0 );
-		Device::FrameStats.PolysDrawn += mesh.numIndices/3;
+		INT startIndex, numIndices;
+		mesh.GetLOD(lod<0 ? mesh.lod : lod, startIndex, numIndices);
+		g_pd3dDevice->DrawIndexed( numIndices, startIndex, 0 );
+		Device::FrameStats.PolysDrawn += numIndices/3;
+		Device::FrameStats.PolysSaved += (mesh.numIndices-numIndices)/3;
 		Device::FrameStats.DrawCalls++;
 	}
 
@@ -176,12 +222,12 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Device::DrawSubmeshInstanced(SubMesh& mesh, int numInstances)
 	{
+		if(!mesh.pVertexBuffer || !mesh.pIndexBuffer)
+			return;
+
 		// Set buffers
 		static const UINT offset=0;
-		if(mesh.isSkinned)
-			SetVertexBuffer(mesh.pVertexBuffer, SkinnedVertex::size);
-		else
-			SetVertexBuffer(mesh.pVertexBuffer, Vertex::size);
+		SetVertexBuffer(mesh.pVertexBuffer, GetVertexStride(mesh));
 		SetIndexBuffer(mesh.pIndexBuffer, DXGI_FORMAT_R32_UINT);
 
 		// Draw to screen
@@ -194,6 +240,10 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Device::DrawSubmeshPos(SubMesh& mesh)
 	{
+		// Compact meshes have no position buffer
+		if(!mesh.pPosVertexBuffer)
+			return;
+
 		// Set buffers
 		static const UINT offset=0;
 		SetVertexBuffer(mesh.pPosVertexBuffer, PosVertex::size);
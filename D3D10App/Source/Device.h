@@ -29,16 +29,18 @@ namespace Core
 		int DrawCalls;
 		int LightChanges;
 		int PolysDrawn;
+		int PolysSaved;
 		int PolysProcessed;
 		float ElapsedTime;
 		int ProcessedMessages;
+		int ClipmapTexelsUpdated;
 		int FPS;
 		FrameStatData(){
-			MaterialChanges=IBChanges=VBChanges=DrawCalls=FPS=LightChanges=PolysProcessed=PolysDrawn=ProcessedMessages=0;
+			MaterialChanges=IBChanges=VBChanges=DrawCalls=FPS=LightChanges=PolysProcessed=PolysDrawn=PolysSaved=ProcessedMessages=ClipmapTexelsUpdated=0;
 		}
 
 		inline void Reset(){
-			MaterialChanges=IBChanges=VBChanges=DrawCalls=LightChanges=PolysProcessed=PolysDrawn=ProcessedMessages=0;
+			MaterialChanges=IBChanges=VBChanges=DrawCalls=LightChanges=PolysProcessed=PolysDrawn=PolysSaved=ProcessedMessages=ClipmapTexelsUpdated=0;
 		}
 	};
 	
@@ -53,6 +55,7 @@ namespace Core
 		static Core::Material* Material;
 		static Core::Light* Light;
 		static ID3D10InputLayout* InputLayout;
+		static const VertexQuantization* Quantization;
 		static D3D10_PRIMITIVE_TOPOLOGY Topology;
 		static RenderSurface* Cubemap;
 		static RenderSurface* ShadowMap;
@@ -67,6 +70,7 @@ namespace Core
 			Material = NULL;
 			Light = NULL;
 			InputLayout = NULL;
+			SetQuantization(NULL, true);
 			Cubemap = NULL;
 			Topology = D3D10_PRIMITIVE_TOPOLOGY_UNDEFINED;
 			VertexBuffer = NULL;
@@ -128,6 +132,8 @@ namespace Core
 		//--------------------------------------------------------------------------------------
 		static void SetEffect(Core::Effect& effect);
 		static void SetInputLayout(ID3D10InputLayout* pInputLayout);
+		static void SetQuantization(const VertexQuantization* pQuant, bool bForce=false);
+		static void SetVertexFormat(const SubMesh& mesh);
 		static void SetMaterial(Core::Material& pMat);
 		static void SetLight( Core::Light& light);
 		static void SetVertexBuffer(ID3D10Buffer* pVB, UINT stride);
@@ -140,10 +146,17 @@ namespace Core
 		//--------------------------------------------------------------------------------------
 		// Draw a submesh
 		//--------------------------------------------------------------------------------------
-		static void DrawSubmesh(SubMesh& mesh);
+		static void DrawSubmesh(SubMesh& mesh, int lod=-1);
 		static void DrawSubmeshInstanced(SubMesh& mesh, int numInstances);
 		static void DrawSubmeshPos(SubMesh& mesh);
 
+		// Vertex size in the submesh's buffer
+		static inline UINT GetVertexStride(const SubMesh& mesh){
+			if(mesh.pQuantization)
+				return mesh.isSkinned ? CompactSkinnedVertex::size : CompactVertex::size;
+			return mesh.isSkinned ? SkinnedVertex::size : Vertex::size;
+		}
+
 	private:
 
 		static ID3D10RenderTargetView* m_pCachedRTV;
@@ -140,9 +140,6 @@ namespace Core
 		Pass[PASS_EDITOR_GRID] = Technique[TECH_HONUA]->GetPassByName( "Grid" );
 #endif
 
-		// Instancing
-		InstanceConstantBuffer = m_pEffect->GetConstantBufferByName("cbInstanceData")->AsConstantBuffer();
-		
 		// Gbuffer vars
 		GBufferVariable = m_pEffect->GetVariableByName( "g_txGBuffer" )->AsShaderResource(); 
 
@@ -183,6 +180,7 @@ namespace Core
 		// Terrain
 		ClipmapOffsetVariable = m_pEffect->GetVariableByName("g_ClipmapOffset")->AsVector();
 		ClipmapFixVariable = m_pEffect->GetVariableByName("g_ClipmapFix")->AsVector();
+		ClipmapMorphVariable = m_pEffect->GetVariableByName("g_ClipmapMorph")->AsVector();
 		ClipmapScaleVariable = m_pEffect->GetVariableByName( "g_ClipmapScale" )->AsScalar(); 
 		ClipmapSizeVariable = m_pEffect->GetVariableByName( "g_ClipmapSize" )->AsScalar(); 
 		HeightmapSizeVariable = m_pEffect->GetVariableByName( "g_HeightmapSize" )->AsScalar(); 
@@ -250,6 +248,8 @@ namespace Core
 		// Transforms and camera variables
 		WorldMatrixVariable = m_pEffect->GetVariableByName( "g_mWorld" )->AsMatrix(); 
 		OldWorldMatrixVariable = m_pEffect->GetVariableByName( "g_mOldWorld" )->AsMatrix(); 
+		PosScaleVariable = m_pEffect->GetVariableByName( "g_vPosScale" )->AsVector(); 
+		PosOffsetVariable = m_pEffect->GetVariableByName( "g_vPosOffset" )->AsVector(); 
 		ViewProjectionVariable = m_pEffect->GetVariableByName( "g_mViewProjection" )->AsMatrix(); 
 		OldViewProjectionVariable = m_pEffect->GetVariableByName( "g_mOldViewProjection" )->AsMatrix(); 
 		ShadowOrthoProjectionVariable = m_pEffect->GetVariableByName( "g_mShadowOrtho" )->AsMatrix(); 
@@ -310,6 +310,27 @@ namespace Core
 			Log::D3D10Error(hr); 		
 			return hr;
 		}
+
+		// Compact formats, the same passes decode them
+		SAFE_RELEASE(CompactVertex::pInputLayout);
+		Pass[ PASS_GBUFFER ]->GetDesc( &PassDesc );
+		hr = g_pd3dDevice->CreateInputLayout( CompactVertex::Desc, 3, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &CompactVertex::pInputLayout );
+		if( FAILED(hr) )
+		{
+			Log::FatalError("Failed to create compact input layout");
+			Log::D3D10Error(hr); 		
+			return hr;
+		}
+		SAFE_RELEASE(CompactSkinnedVertex::pInputLayout);
+		Pass[ PASS_GBUFFER_ANIM ]->GetDesc( &PassDesc );
+		hr = g_pd3dDevice->CreateInputLayout( CompactSkinnedVertex::Desc, 5, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &CompactSkinnedVertex::pInputLayout );
+		if( FAILED(hr) )
+		{
+			Log::FatalError("Failed to create compact input layout");
+			Log::D3D10Error(hr); 		
+			return hr;
+		}
+
 		SAFE_RELEASE(PosVertex::pInputLayout);
 		Pass[ PASS_GBUFFER_TERRAIN ]->GetDesc( &PassDesc );
 		hr = g_pd3dDevice->CreateInputLayout( PosVertex::Desc, 1, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &PosVertex::pInputLayout );
@@ -319,6 +340,15 @@ namespace Core
 			Log::D3D10Error(hr); 		
 			return hr;
 		}
+		SAFE_RELEASE(InstanceVertex::pInputLayout);
+		Pass[ PASS_INSTANCED ]->GetDesc( &PassDesc );
+		hr = g_pd3dDevice->CreateInputLayout( InstanceVertex::Desc, 7, PassDesc.pIAInputSignature, PassDesc.IAInputSignatureSize, &InstanceVertex::pInputLayout );
+		if( FAILED(hr) )
+		{
+			Log::FatalError("Failed to create instanced input layout");
+			Log::D3D10Error(hr); 		
+			return hr;
+		}
 
 		return S_OK;
 	}
@@ -332,7 +362,10 @@ namespace Core
 		SAFE_RELEASE(m_pEffect);
 		SAFE_RELEASE(Vertex::pInputLayout);
 		SAFE_RELEASE(SkinnedVertex::pInputLayout);
+		SAFE_RELEASE(CompactVertex::pInputLayout);
+		SAFE_RELEASE(CompactSkinnedVertex::pInputLayout);
 		SAFE_RELEASE(PosVertex::pInputLayout);
+		SAFE_RELEASE(InstanceVertex::pInputLayout);
 	}
 
 
@@ -401,8 +434,6 @@ namespace Core
 		VALIDATE(NormalMapVariable, "NormalMapVariable");
 		VALIDATE(RefractionMapVariable, "RefractionMapVariable");
 
-		VALIDATE(InstanceConstantBuffer, "InstanceConstantBuffer");	
-		
 		VALIDATE(OldWorldMatrixVariable, "OldWorldMatrixVariable");		
 		
 		VALIDATE(TerrainTextureFlagVariable, "TerrainTextureFlagVariable");
@@ -410,6 +441,7 @@ namespace Core
 		VALIDATE(TerrainNormalmapVariable, "TerrainNormalmapVariable");
 		VALIDATE(TerrainTextureVariable, "TerrainTextureVariable");
 		VALIDATE(ClipmapFixVariable, "ClipmapFixVariable");
+		VALIDATE(ClipmapMorphVariable, "ClipmapMorphVariable");
 		VALIDATE(ClipmapSizeVariable, "ClipmapSizeVariable");
 		VALIDATE(HeightmapSizeVariable, "HeightmapSizeVariable");
 		VALIDATE(HeightmapScaleVariable, "HeightmapScaleVariable");
@@ -493,6 +525,8 @@ namespace Core
 		VALIDATE(ViewProjectionVariable, "ViewProjectionVariable");
 		VALIDATE(OldViewProjectionVariable, "OldViewProjectionVariable");
 		VALIDATE(WorldMatrixVariable, "WorldMatrixVariable");
+		VALIDATE(PosScaleVariable, "PosScaleVariable");
+		VALIDATE(PosOffsetVariable, "PosOffsetVariable");
 		VALIDATE(TerrainWidgetTexCoordVariable, "TerrainWidgetPositionVariable");
 		VALIDATE(TerrainWidgetRayVariable, "TerrainWidgetPositionVariable");
 		VALIDATE(TerrainWidgetRadiusVariable, "TerrainWidgetRadiusVariable");
@@ -149,9 +149,6 @@ namespace Core
 		ID3D10EffectVectorVariable*			AmbientVariable;
 		ID3D10EffectShaderResourceVariable* RandomVariable;
 
-		// Instancing
-		ID3D10EffectConstantBuffer*			InstanceConstantBuffer;
-		
 		// HDR
 		ID3D10EffectShaderResourceVariable* HDRVariable;
 		ID3D10EffectShaderResourceVariable* HDRBloomVariable;
@@ -194,6 +191,7 @@ namespace Core
 		ID3D10EffectVectorVariable*			ClipmapOffsetVariable;
 		ID3D10EffectScalarVariable*			ClipmapScaleVariable;
 		ID3D10EffectVectorVariable*			ClipmapFixVariable;
+		ID3D10EffectVectorVariable*			ClipmapMorphVariable;
 		ID3D10EffectScalarVariable*			ClipmapSizeVariable;
 		ID3D10EffectScalarVariable*			HeightmapSizeVariable;
 		ID3D10EffectScalarVariable*			HeightmapScaleVariable;
@@ -243,6 +241,8 @@ namespace Core
 		// Transforms and camera variables
 		ID3D10EffectMatrixVariable*         WorldMatrixVariable;
 		ID3D10EffectMatrixVariable*         OldWorldMatrixVariable;
+		ID3D10EffectVectorVariable*			PosScaleVariable;
+		ID3D10EffectVectorVariable*			PosOffsetVariable;
 		ID3D10EffectMatrixVariable*         ViewProjectionVariable;
 		ID3D10EffectMatrixVariable*         OldViewProjectionVariable;
 		ID3D10EffectMatrixVariable*         ShadowOrthoProjectionVariable;
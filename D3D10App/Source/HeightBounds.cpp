@@ -0,0 +1,265 @@
+//--------------------------------------------------------------------------------------
+// File: HeightBounds.cpp
+//
+// Min/max pyramid over the terrain heights
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "HeightBounds.h"
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	HeightBounds::HeightBounds()
+	{
+		m_Size = 0;
+		m_CellSize = 0;
+		m_CellShift = 0;
+		m_Cells = 0;
+		m_NumLevels = 0;
+		m_pData = NULL;
+		m_pLevels = NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Scans rows of first level cells
+	//--------------------------------------------------------------------------------------
+	struct CellRangeData
+	{
+		const D3DXFLOAT16*	pHeights;
+		int					size;
+		int					cellSize;
+		int					cells;
+		int					x0, x1;		// Cell columns to scan
+		int					y0;			// First cell row
+		void*				pRanges;	// First level of the pyramid
+	};
+
+	static void CellRangeJob(int start, int end, void* pData)
+	{
+		CellRangeData& d = *(CellRangeData*)pData;
+		float* pRow = new float[d.size];
+		float* pMin = new float[d.cells];
+		float* pMax = new float[d.cells];
+		for(int cy=d.y0+start; cy<d.y0+end; cy++)
+		{
+			for(int cx=d.x0; cx<d.x1; cx++)
+			{
+				pMin[cx] = FLT_MAX;
+				pMax[cx] = -FLT_MAX;
+			}
+
+			// Convert a row at a time, then fold it into the cells it crosses
+			int rowEnd = Math::Min((cy+1)*d.cellSize, d.size);
+			int colStart = d.x0*d.cellSize;
+			int colEnd = Math::Min(d.x1*d.cellSize, d.size);
+			for(int row=cy*d.cellSize; row<rowEnd; row++)
+			{
+				D3DXFloat16To32Array(pRow + colStart, d.pHeights + row*d.size + colStart, colEnd-colStart);
+				for(int cx=d.x0; cx<d.x1; cx++)
+				{
+					float mn = pMin[cx], mx = pMax[cx];
+					int cellEnd = Math::Min((cx+1)*d.cellSize, d.size);
+					for(int col=cx*d.cellSize; col<cellEnd; col++)
+					{
+						mn = Math::Min(mn, pRow[col]);
+						mx = Math::Max(mx, pRow[col]);
+					}
+					pMin[cx] = mn;
+					pMax[cx] = mx;
+				}
+			}
+
+			float* pRanges = (float*)d.pRanges + 2*cy*d.cells;
+			for(int cx=d.x0; cx<d.x1; cx++)
+			{
+				pRanges[2*cx] = pMin[cx];
+				pRanges[2*cx+1] = pMax[cx];
+			}
+		}
+		delete[] pRow;
+		delete[] pMin;
+		delete[] pMax;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sizes the levels and builds every one from the heights
+	//--------------------------------------------------------------------------------------
+	bool HeightBounds::Allocate(int size, int cellSize)
+	{
+		Release();
+		if(size<=0 || !Math::IsPowerOf2(cellSize))
+		{
+			Log::Print("HeightBounds needs a heightfield and a power of two cell size");
+			return false;
+		}
+
+		m_Size = size;
+		m_CellSize = cellSize;
+		m_CellShift = 0;
+		while((1<<m_CellShift) < cellSize)
+			m_CellShift++;
+		m_Cells = (size+cellSize-1)/cellSize;
+
+		// Levels go up until a single entry covers everything
+		m_NumLevels = 1;
+		while(GetLevelSize(m_NumLevels-1) > 1)
+			m_NumLevels++;
+		int entries = 0;
+		for(int i=0; i<m_NumLevels; i++)
+			entries += GetLevelSize(i)*GetLevelSize(i);
+		m_pData = new Range[entries];
+		m_pLevels = new Range*[m_NumLevels];
+		for(int i=0, offset=0; i<m_NumLevels; i++)
+		{
+			m_pLevels[i] = m_pData + offset;
+			offset += GetLevelSize(i)*GetLevelSize(i);
+		}
+		return true;
+	}
+
+	bool HeightBounds::Create(const D3DXFLOAT16* pHeights, int size, int cellSize)
+	{
+		if(!pHeights || !Allocate(size, cellSize))
+			return false;
+		RECT full = { 0, 0, size, size };
+		Update(pHeights, full);
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Builds every level from ranges that were worked out elsewhere, such as the pyramid
+	// in a terrain file
+	//--------------------------------------------------------------------------------------
+	bool HeightBounds::CreateFromRanges(const float* pRanges, int size, int cellSize)
+	{
+		if(!pRanges || !Allocate(size, cellSize))
+			return false;
+		memcpy(m_pLevels[0], pRanges, m_Cells*m_Cells*sizeof(Range));
+		for(int i=1; i<m_NumLevels; i++)
+			Reduce(i, 0, 0, GetLevelSize(i), GetLevelSize(i));
+		return true;
+	}
+
+	void HeightBounds::Release()
+	{
+		SAFE_DELETE_ARRAY(m_pData);
+		SAFE_DELETE_ARRAY(m_pLevels);
+		m_Size = m_Cells = m_NumLevels = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Refreshes a rect of cells in a level from the level below
+	//--------------------------------------------------------------------------------------
+	void HeightBounds::Reduce(int level, int x0, int y0, int x1, int y1)
+	{
+		int size = GetLevelSize(level);
+		int srcSize = GetLevelSize(level-1);
+		const Range* pSrc = m_pLevels[level-1];
+		Range* pDest = m_pLevels[level];
+		for(int y=y0; y<y1; y++)
+			for(int x=x0; x<x1; x++)
+			{
+				// Children past the edge of an odd sized level don't exist
+				int sx1 = Math::Min(2*x+2, srcSize);
+				int sy1 = Math::Min(2*y+2, srcSize);
+				Range r = pSrc[2*y*srcSize + 2*x];
+				for(int sy=2*y; sy<sy1; sy++)
+					for(int sx=2*x; sx<sx1; sx++)
+					{
+						r.Min = Math::Min(r.Min, pSrc[sy*srcSize + sx].Min);
+						r.Max = Math::Max(r.Max, pSrc[sy*srcSize + sx].Max);
+					}
+				pDest[y*size + x] = r;
+			}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Rescans the cells under a rect and rebuilds their parents
+	//--------------------------------------------------------------------------------------
+	void HeightBounds::Update(const D3DXFLOAT16* pHeights, const RECT& dirty)
+	{
+		if(!m_pData)
+			return;
+
+		// Cells touched by the rect
+		int x0 = Math::Max((int)dirty.left, 0) >> m_CellShift;
+		int y0 = Math::Max((int)dirty.top, 0) >> m_CellShift;
+		int x1 = ((Math::Min((int)dirty.right, m_Size)-1) >> m_CellShift) + 1;
+		int y1 = ((Math::Min((int)dirty.bottom, m_Size)-1) >> m_CellShift) + 1;
+		if(x0>=x1 || y0>=y1)
+			return;
+
+		CellRangeData d;
+		d.pHeights = pHeights;
+		d.size = m_Size;
+		d.cellSize = m_CellSize;
+		d.cells = m_Cells;
+		d.x0 = x0;
+		d.x1 = x1;
+		d.y0 = y0;
+		d.pRanges = m_pLevels[0];
+		g_ThreadPool.ParallelFor(y1-y0, CellRangeJob, &d, 4);
+
+		// The parents are few enough to do here
+		for(int i=1; i<m_NumLevels; i++)
+		{
+			x0 /= 2;
+			y0 /= 2;
+			x1 = (x1+1)/2;
+			y1 = (y1+1)/2;
+			Reduce(i, x0, y0, x1, y1);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Height range under a rect of texels
+	//--------------------------------------------------------------------------------------
+	bool HeightBounds::GetRange(int x0, int y0, int x1, int y1, float& minHeight, float& maxHeight)
+	{
+		x0 = Math::Max(x0, 0);
+		y0 = Math::Max(y0, 0);
+		x1 = Math::Min(x1, m_Size);
+		y1 = Math::Min(y1, m_Size);
+		if(!m_pData || x0>=x1 || y0>=y1)
+			return false;
+
+		// Climb until the rect spans a few entries per side
+		int level = 0;
+		int shift = m_CellShift;
+		x1--;
+		y1--;
+		while(level<m_NumLevels-1 && Math::Max((x1>>shift)-(x0>>shift), (y1>>shift)-(y0>>shift)) > 3)
+		{
+			level++;
+			shift++;
+		}
+
+		int size = GetLevelSize(level);
+		const Range* pLevel = m_pLevels[level];
+		minHeight = FLT_MAX;
+		maxHeight = -FLT_MAX;
+		for(int y=y0>>shift; y<=y1>>shift; y++)
+			for(int x=x0>>shift; x<=x1>>shift; x++)
+			{
+				minHeight = Math::Min(minHeight, pLevel[y*size + x].Min);
+				maxHeight = Math::Max(maxHeight, pLevel[y*size + x].Max);
+			}
+		return true;
+	}
+
+}
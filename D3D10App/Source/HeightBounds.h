@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// File: HeightBounds.h
+//
+// Min/max pyramid over the terrain heights.  The first level holds the height range of
+// each cell of texels and every level above it covers 2x2 cells of the one below, so the
+// range under any rect can be found by looking at a handful of entries.  The terrain
+// uses it to give each clipmap block a tight box for culling and LOD selection.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "QMath.h"
+
+namespace Core
+{
+
+// Texels per side of a first level cell, a power of two
+#define HEIGHT_BOUNDS_CELL	16
+
+	class HeightBounds
+	{
+	public:
+		HeightBounds();
+		~HeightBounds(){ Release(); }
+
+		// Builds the pyramid over a size*size heightfield
+		bool Create(const D3DXFLOAT16* pHeights, int size, int cellSize=HEIGHT_BOUNDS_CELL);
+
+		// Builds the pyramid from the height range of each first level cell, a min/max
+		// pair per cell in rows
+		bool CreateFromRanges(const float* pRanges, int size, int cellSize=HEIGHT_BOUNDS_CELL);
+		void Release();
+
+		// Recomputes the cells over a rect of texels, and their parents
+		void Update(const D3DXFLOAT16* pHeights, const RECT& dirty);
+
+		// Height range over the texels in [x0,x1)x[y0,y1).  The rect is clipped to the
+		// heightfield, returns false if nothing is left.
+		bool GetRange(int x0, int y0, int x1, int y1, float& minHeight, float& maxHeight);
+
+		// Properties
+		inline bool IsCreated(){ return m_pData!=NULL; }
+		inline int GetLevels(){ return m_NumLevels; }
+		inline int GetLevelSize(int level){ return ((m_Cells-1)>>level) + 1; }
+
+	private:
+
+		// Sets up the levels for a heightfield
+		bool Allocate(int size, int cellSize);
+
+		// Refreshes a rect of cells in a level from the level below
+		void Reduce(int level, int x0, int y0, int x1, int y1);
+
+		struct Range
+		{
+			float Min;
+			float Max;
+		};
+
+		int		m_Size;
+		int		m_CellSize;
+		int		m_CellShift;
+		int		m_Cells;			// Cells per side in the first level
+		int		m_NumLevels;
+		Range*	m_pData;
+		Range**	m_pLevels;
+	};
+
+}
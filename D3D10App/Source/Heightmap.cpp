@@ -0,0 +1,714 @@
+//-----------------------------------------------------------------------------
+// File: Heightmap.cpp
+//
+// Desc: Support for generating terrain heightmaps
+//-----------------------------------------------------------------------------
+#pragma unmanaged
+#include "stdafx.h"
+#include "Heightmap.h"
+#include "ThreadPool.h"
+
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	// Number of iterations a tile is stepped before it has to sync with its neighbors
+#define LIQUID_BLOCK_STEPS 8
+
+	// Width and height of each tile of the liquid simulation.  A tile and its halo
+	// on both timesteps is about 160KB.
+#define LIQUID_TILE_SIZE 128
+
+
+	//-----------------------------------------------------------------------------
+	// Small xorshift generator.  Each row gets its own stream so the
+	// result does not depend on how rows are split between threads.
+	//-----------------------------------------------------------------------------
+	struct HeightmapRandom
+	{
+		UINT state;
+
+		HeightmapRandom(UINT seed, UINT stream)
+		{
+			state = seed ^ (stream * 0x9E3779B9);
+			if(state==0)
+				state = 0x6C078965;
+			Next();
+		}
+
+		inline UINT Next()
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+
+		// Returns a value in [0,1)
+		inline float NextFloat()
+		{
+			return (float)(Next() >> 8) * (1.0f / 16777216.0f);
+		}
+	};
+
+
+	//-----------------------------------------------------------------------------
+	// Fills one row of the liquid surface with its initial random heights
+	//-----------------------------------------------------------------------------
+	static void SeedLiquidRow(float* pRow, int y, int w, int h, UINT seed)
+	{
+		if(y==0 || y==h-1)
+		{
+			memset(pRow, 0, w*sizeof(float));
+			return;
+		}
+		HeightmapRandom rng(seed, y);
+		pRow[0] = 0;
+		for(int x=1; x<w-1; x++)
+			pRow[x] = rng.NextFloat() * (500 - -500) + -500;
+		pRow[w-1] = 0;
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Steps the wave equation over the texels [x0, x1) x [y0, y1) of a surface
+	// with the given row pitch.  pOld holds step k-1 and receives step k+1,
+	// pNew holds step k.
+	//-----------------------------------------------------------------------------
+	static void StepLiquidRect(float* pOld, const float* pNew, int pitch, int x0, int x1, int y0, int y1, float coefA, float coefB, float coefC)
+	{
+		const __m128 vA = _mm_set1_ps(coefA);
+		const __m128 vB = _mm_set1_ps(coefB);
+		const __m128 vC = _mm_set1_ps(coefC);
+
+		for(int y=y0; y<y1; y++)
+		{
+			float* o = pOld + y*pitch;
+			const float* n = pNew + y*pitch;
+			const float* up = n - pitch;
+			const float* dn = n + pitch;
+
+			// Four texels at a time.  The operations are ordered exactly like
+			// the scalar loop so both paths give identical results.
+			int x = x0;
+			for(; x+4<=x1; x+=4)
+			{
+				__m128 nb = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_loadu_ps(n+x+1), _mm_loadu_ps(n+x-1)), _mm_loadu_ps(dn+x)), _mm_loadu_ps(up+x));
+				__m128 r = _mm_add_ps(_mm_mul_ps(vA, _mm_loadu_ps(n+x)), _mm_mul_ps(vB, _mm_loadu_ps(o+x)));
+				_mm_storeu_ps(o+x, _mm_add_ps(r, _mm_mul_ps(vC, nb)));
+			}
+			for(; x<x1; x++)
+				o[x] = coefA*n[x] + coefB*o[x] + coefC*(n[x+1] + n[x-1] + dn[x] + up[x]);
+		}
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Shared state for the parallel liquid simulation
+	//-----------------------------------------------------------------------------
+	struct LiquidSimData
+	{
+		int		w, h;
+		float	coefA, coefB, coefC;
+		UINT	seed;
+		float*	pSurface[2];	// The two most recent timesteps, read during a block
+		float*	pTarget[2];		// Where the tiles write them back, swapped after a block
+		int		curBuf;			// Buffer holding the newest timestep at the start of a block
+		int		steps;			// Iterations to run in the current block
+		int		tilesX, tilesY;
+		float*	pScratch;		// One working tile per job, allocated once
+		int		scratchSize;	// Floats in each job's working tile
+		volatile long nextScratch;
+		bool	trackExtents;	// Gather min/max during the write back
+		float*	pTileMin;
+		float*	pTileMax;
+		float	minH, maxH;
+		unsigned char* pImg;
+	};
+
+
+	//-----------------------------------------------------------------------------
+	// Parallel seeding of the surface
+	//-----------------------------------------------------------------------------
+	static void SeedLiquidJob(int start, int end, void* pData)
+	{
+		LiquidSimData& sim = *(LiquidSimData*)pData;
+		for(int y=start; y<end; y++)
+		{
+			SeedLiquidRow(sim.pSurface[0] + y*sim.w, y, sim.w, sim.h, sim.seed);
+			memcpy(sim.pSurface[1] + y*sim.w, sim.pSurface[0] + y*sim.w, sim.w*sizeof(float));
+		}
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Steps a set of tiles through one temporal block.  Each tile gathers itself
+	// plus a halo as wide as the block from the current surfaces, steps it in a
+	// working copy small enough to stay in cache and writes the texels it owns
+	// to the target surfaces, so no tile sees another's writes.
+	//-----------------------------------------------------------------------------
+	static void StepLiquidTileJob(int start, int end, void* pData)
+	{
+		LiquidSimData& sim = *(LiquidSimData*)pData;
+		const int w = sim.w;
+		const int h = sim.h;
+		const int K = LIQUID_BLOCK_STEPS;
+
+		// The working tile for this job
+		float* pLocal[2];
+		pLocal[0] = sim.pScratch + (size_t)(InterlockedIncrement(&sim.nextScratch)-1)*sim.scratchSize;
+		pLocal[1] = pLocal[0] + sim.scratchSize/2;
+
+		for(int t=start; t<end; t++)
+		{
+			// Owned texels and the halo around them
+			int x0 = (t % sim.tilesX) * LIQUID_TILE_SIZE;
+			int y0 = (t / sim.tilesX) * LIQUID_TILE_SIZE;
+			int x1 = Math::Min(x0+LIQUID_TILE_SIZE, w);
+			int y1 = Math::Min(y0+LIQUID_TILE_SIZE, h);
+			int ax = Math::Max(x0-K, 0);
+			int ay = Math::Max(y0-K, 0);
+			int ex = Math::Min(x1+K, w);
+			int ey = Math::Min(y1+K, h);
+			const int pitch = ex-ax;
+
+			for(int p=0; p<2; p++)
+				for(int y=ay; y<ey; y++)
+					memcpy(pLocal[p] + (y-ay)*pitch, sim.pSurface[p] + (size_t)y*w + ax, pitch*sizeof(float));
+
+			// Step the tile.  Each iteration the valid region shrinks by a texel on
+			// each side, except at the edges of the map where the border is fixed.
+			int lx=ax, hx=ex, ly=ay, hy=ey;
+			int cur = sim.curBuf;
+			for(int s=0; s<sim.steps; s++)
+			{
+				int ux0 = Math::Max(lx+1, 1);
+				int ux1 = Math::Min(hx-1, w-1);
+				int uy0 = Math::Max(ly+1, 1);
+				int uy1 = Math::Min(hy-1, h-1);
+				StepLiquidRect(pLocal[1-cur], pLocal[cur], pitch, ux0-ax, ux1-ax, uy0-ay, uy1-ay, sim.coefA, sim.coefB, sim.coefC);
+				cur = 1-cur;
+				if(lx>0) lx++;
+				if(hx<w) hx--;
+				if(ly>0) ly++;
+				if(hy<h) hy--;
+			}
+
+			// Write the owned texels back
+			for(int p=0; p<2; p++)
+				for(int y=y0; y<y1; y++)
+					memcpy(sim.pTarget[p] + (size_t)y*w + x0, pLocal[p] + (y-ay)*pitch + (x0-ax), (x1-x0)*sizeof(float));
+
+			// Track the extents while the data is still in cache
+			if(sim.trackExtents)
+			{
+				const int count = x1-x0;
+				const float* pRow = pLocal[cur] + (y0-ay)*pitch + (x0-ax);
+				__m128 vMin = _mm_set1_ps(pRow[0]);
+				__m128 vMax = vMin;
+				float fMin = pRow[0];
+				float fMax = pRow[0];
+				for(int y=y0; y<y1; y++, pRow+=pitch)
+				{
+					int i=0;
+					for(; i+4<=count; i+=4)
+					{
+						__m128 v = _mm_loadu_ps(pRow+i);
+						vMin = _mm_min_ps(vMin, v);
+						vMax = _mm_max_ps(vMax, v);
+					}
+					for(; i<count; i++)
+					{
+						fMin = Math::Min(fMin, pRow[i]);
+						fMax = Math::Max(fMax, pRow[i]);
+					}
+				}
+				float mins[4], maxs[4];
+				_mm_storeu_ps(mins, vMin);
+				_mm_storeu_ps(maxs, vMax);
+				sim.pTileMin[t] = Math::Min(fMin, Math::Min(Math::Min(mins[0], mins[1]), Math::Min(mins[2], mins[3])));
+				sim.pTileMax[t] = Math::Max(fMax, Math::Max(Math::Max(maxs[0], maxs[1]), Math::Max(maxs[2], maxs[3])));
+			}
+		}
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Normalizes the final surface and quantizes it into the output image
+	//-----------------------------------------------------------------------------
+	static void QuantizeLiquidJob(int start, int end, void* pData)
+	{
+		LiquidSimData& sim = *(LiquidSimData*)pData;
+		const float* pSrc = sim.pSurface[sim.curBuf];
+		const float range = sim.maxH - sim.minH;
+		if(range<=0)
+		{
+			memset(sim.pImg + start*sim.w, 0, (end-start)*sim.w);
+			return;
+		}
+
+		const __m128 vMin = _mm_set1_ps(sim.minH);
+		const __m128 vRange = _mm_set1_ps(range);
+		const __m128 v255 = _mm_set1_ps(255.0f);
+		const int first = start*sim.w;
+		const int last = end*sim.w;
+		int i = first;
+		for(; i+8<=last; i+=8)
+		{
+			__m128 a = _mm_mul_ps(_mm_div_ps(_mm_sub_ps(_mm_loadu_ps(pSrc+i), vMin), vRange), v255);
+			__m128 b = _mm_mul_ps(_mm_div_ps(_mm_sub_ps(_mm_loadu_ps(pSrc+i+4), vMin), vRange), v255);
+			__m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+			_mm_storel_epi64((__m128i*)(sim.pImg+i), _mm_packus_epi16(packed, packed));
+		}
+		for(; i<last; i++)
+			sim.pImg[i] = (unsigned char)(((pSrc[i] - sim.minH) / range) * 255);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Name: GenerateLiquidHeightmap()
+	// Desc: Genterates a heightmap based on fluid simulation
+	//-----------------------------------------------------------------------------
+	unsigned char* GenerateLiquidHeightmap(int w, int h, int num, float d, float t, float mu, float c, UINT seed)
+	{
+		if(w<=0 || h<=0)
+			return NULL;
+
+		LiquidSimData sim;
+		sim.w = w;
+		sim.h = h;
+		sim.seed = seed;
+
+		// Compute the coef values
+		sim.coefA = (4 - (8*c*c*t*t) / (d*d)) / (mu*t + 2);
+		sim.coefB = (mu*t - 2) / (mu*t + 2);
+		sim.coefC = ((2*c*c*t*t) / (d*d)) / (mu*t + 2);
+
+		// Setup the surfaces, the tiles read one pair and write the other
+		const size_t surfaceSize = (size_t)w*h;
+		float* pSurfaces = (float*)_aligned_malloc(surfaceSize*4*sizeof(float), 16);
+		sim.pSurface[0] = pSurfaces;
+		sim.pSurface[1] = pSurfaces + surfaceSize;
+		sim.pTarget[0] = pSurfaces + surfaceSize*2;
+		sim.pTarget[1] = pSurfaces + surfaceSize*3;
+		g_ThreadPool.ParallelFor(h, SeedLiquidJob, &sim, 64);
+
+		// Split the map into tiles, every job gets a working tile with room for the halo
+		const int K = LIQUID_BLOCK_STEPS;
+		sim.tilesX = (w + LIQUID_TILE_SIZE - 1) / LIQUID_TILE_SIZE;
+		sim.tilesY = (h + LIQUID_TILE_SIZE - 1) / LIQUID_TILE_SIZE;
+		const int numTiles = sim.tilesX*sim.tilesY;
+		sim.scratchSize = 2*Math::Min(LIQUID_TILE_SIZE+2*K, w)*Math::Min(LIQUID_TILE_SIZE+2*K, h);
+		sim.pScratch = (float*)_aligned_malloc((size_t)(g_ThreadPool.GetNumThreads()+1)*sim.scratchSize*sizeof(float), 16);
+		sim.pTileMin = new float[numTiles];
+		sim.pTileMax = new float[numTiles];
+
+		// Iterate in blocks of K steps.  A tile only has to see its neighbors
+		// once per block instead of once per step.  Always run at least one block
+		// so the extents get gathered.
+		sim.curBuf = 0;
+		int remaining = num;
+		do
+		{
+			sim.steps = Math::Min(remaining, K);
+			remaining -= sim.steps;
+			sim.trackExtents = (remaining==0);
+			sim.nextScratch = 0;
+
+			g_ThreadPool.ParallelFor(numTiles, StepLiquidTileJob, &sim);
+
+			Swap(sim.pSurface[0], sim.pTarget[0]);
+			Swap(sim.pSurface[1], sim.pTarget[1]);
+			if(sim.steps & 1)
+				sim.curBuf = 1-sim.curBuf;
+		}
+		while(remaining>0);
+
+		// Reduce the tile extents
+		sim.minH = sim.pTileMin[0];
+		sim.maxH = sim.pTileMax[0];
+		for(int i=1; i<numTiles; i++)
+		{
+			sim.minH = Math::Min(sim.minH, sim.pTileMin[i]);
+			sim.maxH = Math::Max(sim.maxH, sim.pTileMax[i]);
+		}
+
+		// Normalize and quantize into the greyscale image in one pass
+		sim.pImg = new unsigned char[w*h];
+		g_ThreadPool.ParallelFor(h, QuantizeLiquidJob, &sim, 64);
+
+		// deallocate memory
+		_aligned_free(pSurfaces);
+		_aligned_free(sim.pScratch);
+		delete[] sim.pTileMin;
+		delete[] sim.pTileMax;
+
+		return sim.pImg;
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Name: GenerateLiquidHeightmapReference()
+	// Desc: Genterates a heightmap based on fluid simulation
+	//-----------------------------------------------------------------------------
+	unsigned char* GenerateLiquidHeightmapReference(int w, int h, int num, float d, float t, float mu, float c, UINT seed)
+	{
+		if(w<=0 || h<=0)
+			return NULL;
+
+		// The equation coefficients
+		float coefA, coefB, coefC;
+
+		// Setup the surface
+		float* pSurface[2];
+		pSurface[0] = new float[w*h];
+		pSurface[1] = new float[w*h];
+
+		// Compute the coef values
+		coefA = (4 - (8*c*c*t*t) / (d*d)) / (mu*t + 2);
+		coefB = (mu*t - 2) / (mu*t + 2);
+		coefC = ((2*c*c*t*t) / (d*d)) / (mu*t + 2);
+
+		// Initialize the heights to random values
+		for (int y = 0; y < h; y++) {
+			SeedLiquidRow(pSurface[0] + y*w, y, w, h, seed);
+			memcpy(pSurface[1] + y*w, pSurface[0] + y*w, w*sizeof(float));
+		}
+
+		int iCurBuf = 0;
+		int iInd;
+
+		float* pOld, * pNew;
+
+		// Iterate over the heightmap, applying the fluid simulation equation.
+		// Although it requires knowledge of the two previous timesteps, it only
+		// accesses one pixel of the k-1 timestep, so using a simple trick we only
+		// need to store the heightmap twice, not three times, and we can avoid
+		// a memcpy() every iteration.
+		for (int i = 0; i < num; i++) {
+			pOld = pSurface[1-iCurBuf];
+			pNew = pSurface[iCurBuf];
+
+			for (int y = 1; y < h-1; y++) {
+				for (int x = 1; x < w-1; x++) {
+					iInd = x+y*w;
+
+					pOld[iInd] = coefA*pNew[iInd] + coefB*pOld[iInd] +
+								 coefC*(pNew[iInd+1] + pNew[iInd-1] + pNew[iInd+w] + pNew[iInd-w]);
+				}
+			}
+
+			iCurBuf = 1-iCurBuf;
+		}
+
+		float fMinH=pSurface[iCurBuf][0], fMaxH=pSurface[iCurBuf][0];
+
+		// find the minimum and maximum heights
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				if (pSurface[iCurBuf][x+y*w] > fMaxH)
+					fMaxH = pSurface[iCurBuf][x+y*w];
+				else if (pSurface[iCurBuf][x+y*w] < fMinH)
+					fMinH = pSurface[iCurBuf][x+y*w];
+			}
+		}
+
+		// allocate memory for the greyscale image
+		unsigned char* pImg = new unsigned char[w*h];
+
+		// normalize the surface and put it into the range [0...255]
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++)
+			{
+				if(fMaxH > fMinH)
+					pImg[x+y*w] = (unsigned char)(((pSurface[iCurBuf][x+y*w] - fMinH) / (fMaxH - fMinH)) * 255);
+				else
+					pImg[x+y*w] = 0;
+			}
+		}
+
+
+		// deallocate memory
+		delete[] pSurface[0];
+		delete[] pSurface[1];
+
+		return pImg;
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Shared state for normal map generation
+	//-----------------------------------------------------------------------------
+	struct NormalMapData
+	{
+		const float*		pHeight;		// Float heights, or...
+		const D3DXFLOAT16*	pHalfHeight;	// ...half float heights
+		int					w, h;
+		float				hs;				// Grid spacing
+		RECT				region;			// Texels to generate
+		PackedNormal*		pPacked;		// Packed output, or...
+		D3DXVECTOR3*		pVector;		// ...full precision output
+	};
+
+
+	//-----------------------------------------------------------------------------
+	// Sobel gradient for four neighboring texels starting at x.  Rows are the
+	// heights above, at and below the texels.  Returns the unnormalized normal.
+	//-----------------------------------------------------------------------------
+	static inline void SobelNormal4(const float* r0, const float* r1, const float* r2, int x, const __m128& vHs,
+		__m128& nx, __m128& ny, __m128& nz)
+	{
+		const __m128 vTwo = _mm_set1_ps(2.0f);
+		const __m128 vNegEighth = _mm_set1_ps(-0.125f);
+
+		__m128 l0 = _mm_loadu_ps(r0+x-1), c0 = _mm_loadu_ps(r0+x), h0 = _mm_loadu_ps(r0+x+1);
+		__m128 l1 = _mm_loadu_ps(r1+x-1),                          h1 = _mm_loadu_ps(r1+x+1);
+		__m128 l2 = _mm_loadu_ps(r2+x-1), c2 = _mm_loadu_ps(r2+x), h2 = _mm_loadu_ps(r2+x+1);
+
+		// Horizontal and vertical gradients
+		__m128 gx = _mm_sub_ps(_mm_add_ps(_mm_add_ps(h0, h2), _mm_mul_ps(vTwo, h1)),
+							   _mm_add_ps(_mm_add_ps(l0, l2), _mm_mul_ps(vTwo, l1)));
+		__m128 gz = _mm_sub_ps(_mm_add_ps(_mm_add_ps(l2, h2), _mm_mul_ps(vTwo, c2)),
+							   _mm_add_ps(_mm_add_ps(l0, h0), _mm_mul_ps(vTwo, c0)));
+		nx = _mm_mul_ps(gx, vNegEighth);
+		ny = vHs;
+		nz = _mm_mul_ps(gz, vNegEighth);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Scalar version of SobelNormal4(), clamps at the map edges
+	//-----------------------------------------------------------------------------
+	static inline D3DXVECTOR3 SobelNormal(const float* r0, const float* r1, const float* r2, int x, int w, float hs)
+	{
+		int xl = x>0 ? x-1 : 0;
+		int xh = x<w-1 ? x+1 : w-1;
+		float gx = (r0[xh] + r2[xh] + 2*r1[xh]) - (r0[xl] + r2[xl] + 2*r1[xl]);
+		float gz = (r2[xl] + r2[xh] + 2*r2[x]) - (r0[xl] + r0[xh] + 2*r0[x]);
+		return D3DXVECTOR3(gx*-0.125f, hs, gz*-0.125f);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Octahedral encodes four normals and stores them, the SSE version of the
+	// y axis EncodeNormal() in VertexCompress.  Zero vectors store 0,0.
+	//-----------------------------------------------------------------------------
+	static inline void StorePackedNormal4(PackedNormal* pOut, __m128 nx, __m128 ny, __m128 nz)
+	{
+		const __m128 vSignMask = _mm_set1_ps(-0.0f);
+		const __m128 vOne = _mm_set1_ps(1.0f);
+		const __m128 vScale = _mm_set1_ps(32767.0f);
+
+		// Project onto the octahedron
+		__m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(vSignMask, nx), _mm_andnot_ps(vSignMask, ny)), _mm_andnot_ps(vSignMask, nz));
+		__m128 inv = _mm_and_ps(_mm_cmpgt_ps(l1, _mm_setzero_ps()), _mm_div_ps(vOne, l1));
+		__m128 px = _mm_mul_ps(nx, inv);
+		__m128 pz = _mm_mul_ps(nz, inv);
+
+		// Fold the lower hemisphere over the diagonals
+		__m128 lower = _mm_cmplt_ps(ny, _mm_setzero_ps());
+		__m128 fx = _mm_or_ps(_mm_sub_ps(vOne, _mm_andnot_ps(vSignMask, pz)), _mm_and_ps(vSignMask, px));
+		__m128 fz = _mm_or_ps(_mm_sub_ps(vOne, _mm_andnot_ps(vSignMask, px)), _mm_and_ps(vSignMask, pz));
+		px = _mm_or_ps(_mm_and_ps(lower, fx), _mm_andnot_ps(lower, px));
+		pz = _mm_or_ps(_mm_and_ps(lower, fz), _mm_andnot_ps(lower, pz));
+
+		// Quantize to snorm16 and interleave
+		__m128i ix = _mm_cvtps_epi32(_mm_mul_ps(px, vScale));
+		__m128i iz = _mm_cvtps_epi32(_mm_mul_ps(pz, vScale));
+		__m128i packed = _mm_or_si128(_mm_and_si128(ix, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(iz, 16));
+		_mm_storeu_si128((__m128i*)pOut, packed);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Normalizes four normals and stores them
+	//-----------------------------------------------------------------------------
+	static inline void StoreVectorNormal4(D3DXVECTOR3* pOut, __m128 nx, __m128 ny, __m128 nz)
+	{
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), len);
+		float x[4], y[4], z[4];
+		_mm_storeu_ps(x, _mm_mul_ps(nx, inv));
+		_mm_storeu_ps(y, _mm_mul_ps(ny, inv));
+		_mm_storeu_ps(z, _mm_mul_ps(nz, inv));
+		for(int i=0; i<4; i++)
+			pOut[i] = D3DXVECTOR3(x[i], y[i], z[i]);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Generates the normals for a range of rows in the region
+	//-----------------------------------------------------------------------------
+	static void NormalMapJob(int start, int end, void* pData)
+	{
+		NormalMapData& nm = *(NormalMapData*)pData;
+		const int w = nm.w;
+		const int h = nm.h;
+		const int left = nm.region.left;
+		const int right = nm.region.right;
+		const __m128 vHs = _mm_set1_ps(nm.hs);
+
+		// Half float rows are converted into a rolling window of three rows
+		// covering the region plus one texel on each side
+		const int cl = Math::Max(left-1, 0);
+		const int cr = Math::Min(right+1, w);
+		float* pWindow = NULL;
+		int windowRow[3] = { -1, -1, -1 };
+		if(nm.pHalfHeight)
+			pWindow = new float[3*(cr-cl)];
+
+		for(int y=nm.region.top+start; y<nm.region.top+end; y++)
+		{
+			// Fetch the three source rows, clamped at the map edges
+			const float* rows[3];
+			for(int i=0; i<3; i++)
+			{
+				int ry = y-1+i;
+				Math::Clamp(ry, 0, h-1);
+				if(nm.pHeight)
+					rows[i] = nm.pHeight + (size_t)ry*w;
+				else
+				{
+					int slot = ry % 3;
+					if(windowRow[slot]!=ry)
+					{
+						D3DXFloat16To32Array(pWindow + slot*(cr-cl), nm.pHalfHeight + (size_t)ry*w + cl, cr-cl);
+						windowRow[slot] = ry;
+					}
+					rows[i] = pWindow + slot*(cr-cl) - cl;
+				}
+			}
+
+			// The edge texels are clamped, everything else goes four at a time
+			int x = left;
+			int simdStart = Math::Max(left, 1);
+			int simdEnd = Math::Min(right, w-1);
+			for(; x<simdStart; x++)
+			{
+				D3DXVECTOR3 n = SobelNormal(rows[0], rows[1], rows[2], x, w, nm.hs);
+				if(nm.pPacked)
+					nm.pPacked[y*w+x] = EncodeNormal(n);
+				else
+					D3DXVec3Normalize(&nm.pVector[y*w+x], &n);
+			}
+			for(; x+4<=simdEnd; x+=4)
+			{
+				__m128 nx, ny, nz;
+				SobelNormal4(rows[0], rows[1], rows[2], x, vHs, nx, ny, nz);
+				if(nm.pPacked)
+					StorePackedNormal4(&nm.pPacked[y*w+x], nx, ny, nz);
+				else
+					StoreVectorNormal4(&nm.pVector[y*w+x], nx, ny, nz);
+			}
+			for(; x<right; x++)
+			{
+				D3DXVECTOR3 n = SobelNormal(rows[0], rows[1], rows[2], x, w, nm.hs);
+				if(nm.pPacked)
+					nm.pPacked[y*w+x] = EncodeNormal(n);
+				else
+					D3DXVec3Normalize(&nm.pVector[y*w+x], &n);
+			}
+		}
+
+		SAFE_DELETE_ARRAY(pWindow);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Runs the normal map job over a region
+	//-----------------------------------------------------------------------------
+	static void RunNormalMapJob(NormalMapData& nm, const RECT& region)
+	{
+		nm.region.left = Math::Max((int)region.left, 0);
+		nm.region.top = Math::Max((int)region.top, 0);
+		nm.region.right = Math::Min((int)region.right, nm.w);
+		nm.region.bottom = Math::Min((int)region.bottom, nm.h);
+		if(nm.region.right<=nm.region.left || nm.region.bottom<=nm.region.top)
+			return;
+		g_ThreadPool.ParallelFor(nm.region.bottom-nm.region.top, NormalMapJob, &nm, 16);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Name: GenerateNormalMap()
+	// Desc: Genterates a normal map based on a height map
+	//-----------------------------------------------------------------------------
+	D3DXVECTOR3* GenerateNormalMap(float* pHeight, int w, int h, float hs)
+	{
+		NormalMapData nm;
+		memset(&nm, 0, sizeof(nm));
+		nm.pHeight = pHeight;
+		nm.w = w;
+		nm.h = h;
+		nm.hs = hs;
+		nm.pVector = new D3DXVECTOR3[w*h];
+		RECT region = { 0, 0, w, h };
+		RunNormalMapJob(nm, region);
+		return nm.pVector;
+	}
+
+	D3DXVECTOR3* GenerateNormalMap(D3DXFLOAT16* pHeight, int w, int h, float hs)
+	{
+		NormalMapData nm;
+		memset(&nm, 0, sizeof(nm));
+		nm.pHalfHeight = pHeight;
+		nm.w = w;
+		nm.h = h;
+		nm.hs = hs;
+		nm.pVector = new D3DXVECTOR3[w*h];
+		RECT region = { 0, 0, w, h };
+		RunNormalMapJob(nm, region);
+		return nm.pVector;
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Name: GenerateNormalMap()
+	// Desc: Fills a packed normal map from a height map
+	//-----------------------------------------------------------------------------
+	void GenerateNormalMap(const float* pHeight, int w, int h, float hs, PackedNormal* pOut)
+	{
+		RECT region = { 0, 0, w, h };
+		UpdateNormalMap(pHeight, w, h, hs, pOut, region);
+	}
+
+	void GenerateNormalMap(const D3DXFLOAT16* pHeight, int w, int h, float hs, PackedNormal* pOut)
+	{
+		RECT region = { 0, 0, w, h };
+		UpdateNormalMap(pHeight, w, h, hs, pOut, region);
+	}
+
+
+	//-----------------------------------------------------------------------------
+	// Name: UpdateNormalMap()
+	// Desc: Regenerates the packed normals for a changed region of the height
+	//		 map.  The kernel reaches one texel out, so the region is grown by one.
+	//-----------------------------------------------------------------------------
+	void UpdateNormalMap(const float* pHeight, int w, int h, float hs, PackedNormal* pOut, const RECT& dirty)
+	{
+		NormalMapData nm;
+		memset(&nm, 0, sizeof(nm));
+		nm.pHeight = pHeight;
+		nm.w = w;
+		nm.h = h;
+		nm.hs = hs;
+		nm.pPacked = pOut;
+		RECT region = { dirty.left-1, dirty.top-1, dirty.right+1, dirty.bottom+1 };
+		RunNormalMapJob(nm, region);
+	}
+
+	void UpdateNormalMap(const D3DXFLOAT16* pHeight, int w, int h, float hs, PackedNormal* pOut, const RECT& dirty)
+	{
+		NormalMapData nm;
+		memset(&nm, 0, sizeof(nm));
+		nm.pHalfHeight = pHeight;
+		nm.w = w;
+		nm.h = h;
+		nm.hs = hs;
+		nm.pPacked = pOut;
+		RECT region = { dirty.left-1, dirty.top-1, dirty.right+1, dirty.bottom+1 };
+		RunNormalMapJob(nm, region);
+	}
+
+}
@@ -7,221 +7,76 @@
 #pragma once
 
 #include "QMath.h"
+#include "VertexCompress.h"
 
 namespace Core
 {
 
-
 	//-----------------------------------------------------------------------------
 	// Name: GenerateLiquidHeightmap()
-	// Desc: Genterates a heightmap based on fluid simulation
+	// Desc: Genterates a heightmap based on fluid simulation.  The grid is split
+	//		 into square tiles that are stepped several iterations at a time on
+	//		 the thread pool, so each tile stays in cache between iterations.
+	//		 The same seed always gives the same heightmap.  Returns NULL for an
+	//		 empty map.
 	// **MODIFIED FROM Francis Woodhouse's ARTICLE ON GAMEDEV.NET**
 	// http://www.gamedev.net/reference/articles/article2001.asp
 	//-----------------------------------------------------------------------------
-	unsigned char* GenerateLiquidHeightmap(int w, int h, int num,float d,float t,float mu,float c)
-	{
-		// The equation coefficients
-		float coefA, coefB, coefC;
-		
-		// Setup the surface
-		float* pSurface[2];
-		pSurface[0] = new float[w*h];
-		pSurface[1] = new float[w*h];
-
-		// Compute the coef values
-		coefA = (4 - (8*c*c*t*t) / (d*d)) / (mu*t + 2);
-		coefB = (mu*t - 2) / (mu*t + 2);
-		coefC = ((2*c*c*t*t) / (d*d)) / (mu*t + 2);
-
-		// Initialize the heights to random values
-		for (int y = 0; y < h; y++) {
-			for (int x = 0; x < w; x++) {
-				if (x == 0 || x == (w-1) || y == 0 || y == (h-1))
-					pSurface[0][x+y*w] = pSurface[1][x+y*w] = 0;
-				else
-					pSurface[0][x+y*w] = pSurface[1][x+y*w] = ((float)rand() / RAND_MAX) * (500 - -500) + -500;
-			}
-		}
-
-		int iCurBuf = 0;
-		int iInd;
-
-		float* pOld, * pNew;
-
-		// Iterate over the heightmap, applying the fluid simulation equation.
-		// Although it requires knowledge of the two previous timesteps, it only
-		// accesses one pixel of the k-1 timestep, so using a simple trick we only
-		// need to store the heightmap twice, not three times, and we can avoid
-		// a memcpy() every iteration.
-		for (int i = 0; i < num; i++) {
-			pOld = pSurface[1-iCurBuf];
-			pNew = pSurface[iCurBuf];
-
-			for (int y = 1; y < h-1; y++) {
-				for (int x = 1; x < w-1; x++) {
-					iInd = x+y*w;
-
-					pOld[iInd] = coefA*pNew[iInd] + coefB*pOld[iInd] +
-								 coefC*(pNew[iInd+1] + pNew[iInd-1] + pNew[iInd+w] + pNew[iInd-w]);
-				}
-			}
-
-			iCurBuf = 1-iCurBuf;
-		}
-
-		float fMinH=pSurface[iCurBuf][0], fMaxH=pSurface[iCurBuf][0];
-
-		// find the minimum and maximum heights
-		for (int y = 0; y < h; y++) {
-			for (int x = 0; x < w; x++) {
-				if (pSurface[iCurBuf][x+y*w] > fMaxH)
-					fMaxH = pSurface[iCurBuf][x+y*w];
-				else if (pSurface[iCurBuf][x+y*w] < fMinH)
-					fMinH = pSurface[iCurBuf][x+y*w];
-			}
-		}
-
-		// normalize the surface
-		for (int y = 0; y < h; y++) {
-			for (int x = 0; x < w; x++)
-				pSurface[iCurBuf][x+y*w] = (pSurface[iCurBuf][x+y*w] - fMinH) / (fMaxH - fMinH);
-		}
-
-		// allocate memory for the greyscale image
-		unsigned char* pImg = new unsigned char[w*h];
-
-		// put the normalized heightmap into the range [0...255] and into the greyscale image
-		for (int y = 0; y < h; y++) {
-			for (int x = 0; x < w; x++)
-				pImg[x+y*w] = (unsigned char)(pSurface[iCurBuf][x+y*w] * 255);
-		}
-
-
-		// deallocate memory
-		delete[] pSurface[0];
-		delete[] pSurface[1];
-
-		return pImg;
-	}
+	unsigned char* GenerateLiquidHeightmap(int w, int h, int num, float d, float t, float mu, float c, UINT seed=0);
 
+	//-----------------------------------------------------------------------------
+	// Name: GenerateLiquidHeightmapReference()
+	// Desc: Single threaded scalar version of GenerateLiquidHeightmap(), kept
+	//		 around for the self tests
+	//-----------------------------------------------------------------------------
+	unsigned char* GenerateLiquidHeightmapReference(int w, int h, int num, float d, float t, float mu, float c, UINT seed=0);
 
 	//-----------------------------------------------------------------------------
-	// Name: GenerateNormalMap()
-	// Desc: Genterates a normal map based on a height map
+	// Name: PackedNormal
+	// Desc: Unit normal stored as an octahedral projection in two snorm16 values,
+	//		 packed by the VertexCompress codec.  Y is the hemisphere axis, so
+	//		 terrain normals never need the fold.
 	//-----------------------------------------------------------------------------
-	D3DXVECTOR3* GenerateNormalMap(float* pHeight, int w, int h, float hs)
+	struct PackedNormal
 	{
-		// Allocate the normal map and vertex weight arrays
-		D3DXVECTOR3* pNormal = new D3DXVECTOR3[w*h];
-		int* num = new int[w*h];
-		for(int i=0; i<w+h; i++)
-		{
-			num[i] = 0;
-			pNormal[i] = D3DXVECTOR3();
-		}
-
-		// Vars
-		D3DXVECTOR3 tri[3];
-		D3DXVECTOR3 normal;
+		SHORT x;
+		SHORT z;
+	};
 
-		// For each quad in the heightmap get the average normal for each vertex
-		for(int x=0; x<w-1; x++)
-			for(int y=0; y<h-1; y++)
-			{
-				// Get the normal from the first tri in the quad
-				tri[0] = D3DXVECTOR3(x*hs,pHeight[y*w+x],y*hs);
-				tri[1] = D3DXVECTOR3((x+1)*hs,pHeight[y*w+x+1],y*hs);
-				tri[2] = D3DXVECTOR3((x+1)*hs,pHeight[(y+1)*w+x+1],(y+1)*hs);
-				Math::GetNormalFromTri(tri,normal);
-				pNormal[y*w+x]+=normal;
-				num[y*w+x]++;
-				pNormal[y*w+x+1]+=normal;
-				num[y*w+x+1]++;
-				pNormal[(y+1)*w+x+1]+=normal;
-				num[(y+1)*w+x+1]++;
-
-				// Get the normal from the second quad
-				tri[0] = D3DXVECTOR3((x+1)*hs,pHeight[(y+1)*w+x+1],(y+1)*hs);
-				tri[1] = D3DXVECTOR3(x*hs,pHeight[(y+1)*w+x],(y+1)*hs);
-				tri[2] = D3DXVECTOR3(x*hs,pHeight[y*w+x],y*hs);
-				Math::GetNormalFromTri(tri,normal);
-				pNormal[(y+1)*w+x+1]+=normal;
-				num[(y+1)*w+x+1]++;
-				pNormal[(y+1)*w+x]+=normal;
-				num[(y+1)*w+x]++;
-				pNormal[y*w+x]+=normal;
-				num[y*w+x]++;
-			}
-
-		// Divide the normals my the vertex weight
-		for(int i=0; i<w+h; i++)
-		{
-			normal = pNormal[i] / (float)num[i];
-			D3DXVec3Normalize(&pNormal[i],&normal);
-		}
-		SAFE_DELETE_ARRAY(num);
+	// Packs a (not necessarily normalized) vector, a zero vector packs to 0,0
+	inline PackedNormal EncodeNormal(const D3DXVECTOR3& n)
+	{
+		PackedNormal p;
+		EncodeNormal(n, &p.x, 1);
+		return p;
+	}
 
-		return pNormal;
+	// Unpacks into a unit vector
+	inline D3DXVECTOR3 DecodeNormal(const PackedNormal& p)
+	{
+		return DecodeNormal(&p.x, 1);
 	}
 
 
 	//-----------------------------------------------------------------------------
 	// Name: GenerateNormalMap()
-	// Desc: Genterates a normal map based on a height map
+	// Desc: Genterates a normal map based on a height map.  Normals come from a
+	//		 Sobel filter over the heights, hs is the grid spacing.  Rows are
+	//		 processed in parallel on the thread pool.
 	//-----------------------------------------------------------------------------
-	D3DXVECTOR3* GenerateNormalMap(D3DXFLOAT16* pHeight, int w, int h, float hs)
-	{
-		// Allocate the normal map and vertex weight arrays
-		D3DXVECTOR3* pNormal = new D3DXVECTOR3[w*h];
-		int* num = new int[w*h];
-		for(int i=0; i<w+h; i++)
-		{
-			num[i] = 0;
-			pNormal[i] = D3DXVECTOR3();
-		}
-
-		// Vars
-		D3DXVECTOR3 tri[3];
-		D3DXVECTOR3 normal;
-
-		// For each quad in the heightmap get the average normal for each vertex
-		for(int x=0; x<w-1; x++)
-			for(int y=0; y<h-1; y++)
-			{
-				// Get the normal from the first tri in the quad
-				tri[0] = D3DXVECTOR3(x*hs,pHeight[y*w+x],y*hs);
-				tri[1] = D3DXVECTOR3((x+1)*hs,pHeight[y*w+x+1],y*hs);
-				tri[2] = D3DXVECTOR3((x+1)*hs,pHeight[(y+1)*w+x+1],(y+1)*hs);
-				Math::GetNormalFromTri(tri,normal);
-				pNormal[y*w+x]+=normal;
-				num[y*w+x]++;
-				pNormal[y*w+x+1]+=normal;
-				num[y*w+x+1]++;
-				pNormal[(y+1)*w+x+1]+=normal;
-				num[(y+1)*w+x+1]++;
+	D3DXVECTOR3* GenerateNormalMap(float* pHeight, int w, int h, float hs);
+	D3DXVECTOR3* GenerateNormalMap(D3DXFLOAT16* pHeight, int w, int h, float hs);
 
-				// Get the normal from the second quad
-				tri[0] = D3DXVECTOR3((x+1)*hs,pHeight[(y+1)*w+x+1],(y+1)*hs);
-				tri[1] = D3DXVECTOR3(x*hs,pHeight[(y+1)*w+x],(y+1)*hs);
-				tri[2] = D3DXVECTOR3(x*hs,pHeight[y*w+x],y*hs);
-				Math::GetNormalFromTri(tri,normal);
-				pNormal[(y+1)*w+x+1]+=normal;
-				num[(y+1)*w+x+1]++;
-				pNormal[(y+1)*w+x]+=normal;
-				num[(y+1)*w+x]++;
-				pNormal[y*w+x]+=normal;
-				num[y*w+x]++;
-			}
+	// Packed versions, pOut must hold w*h normals
+	void GenerateNormalMap(const float* pHeight, int w, int h, float hs, PackedNormal* pOut);
+	void GenerateNormalMap(const D3DXFLOAT16* pHeight, int w, int h, float hs, PackedNormal* pOut);
 
-			// Divide the normals my the vertex weight
-			for(int i=0; i<w+h; i++)
-			{
-				normal = pNormal[i] / (float)num[i];
-				D3DXVec3Normalize(&pNormal[i],&normal);
-			}
-			SAFE_DELETE_ARRAY(num);
-
-			return pNormal;
-	}
+	//-----------------------------------------------------------------------------
+	// Name: UpdateNormalMap()
+	// Desc: Regenerates only the normals affected by a change to the heights in
+	//		 the dirty rectangle, such as after a sculpt stroke
+	//-----------------------------------------------------------------------------
+	void UpdateNormalMap(const float* pHeight, int w, int h, float hs, PackedNormal* pOut, const RECT& dirty);
+	void UpdateNormalMap(const D3DXFLOAT16* pHeight, int w, int h, float hs, PackedNormal* pOut, const RECT& dirty);
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,154 @@
+//--------------------------------------------------------------------------------------
+// File: InstanceBuffer.cpp
+//
+// Dynamic ring buffer for per-instance vertex data
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "QMath.h"
+#include "InstanceBuffer.h"
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	InstanceBuffer::InstanceBuffer()
+	{
+		m_pBuffer = NULL;
+		m_Stride = 0;
+		m_Capacity = 0;
+		m_Position = 0;
+		m_bMapped = false;
+		m_bDiscard = true;
+		m_LastMap = D3D10_MAP_WRITE_DISCARD;
+		m_Discards = 0;
+		m_Grows = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Creates the buffer
+	//--------------------------------------------------------------------------------------
+	bool InstanceBuffer::Create(UINT stride, int capacity)
+	{
+		Release();
+
+		D3D10_BUFFER_DESC bd;
+		bd.Usage = D3D10_USAGE_DYNAMIC;
+		bd.ByteWidth = stride*capacity;
+		bd.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+		bd.CPUAccessFlags = D3D10_CPU_ACCESS_WRITE;
+		bd.MiscFlags = 0;
+		if(FAILED(g_pd3dDevice->CreateBuffer(&bd, NULL, &m_pBuffer)))
+		{
+			Log::Print("InstanceBuffer::Create() failed to create a buffer for %d instances", capacity);
+			m_pBuffer = NULL;
+			return false;
+		}
+		m_Stride = stride;
+		m_Capacity = capacity;
+
+		// The first map discards
+		m_Position = 0;
+		m_bDiscard = true;
+		return true;
+	}
+
+	void InstanceBuffer::Release()
+	{
+		if(m_bMapped)
+			Unmap();
+		SAFE_RELEASE(m_pBuffer);
+		m_Capacity = m_Position = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reserves a batch of instances at the end of the ring
+	//--------------------------------------------------------------------------------------
+	void* InstanceBuffer::Map(int count, int& first)
+	{
+		if(count<=0 || m_bMapped || !m_Stride)
+			return NULL;
+
+		// Grow to fit the batch, with room for the next few frames
+		if(count>m_Capacity && !Grow(count))
+			return NULL;
+
+		// Batches written this frame may still be in use, so only the space past them is
+		// safe to write without a discard
+		D3D10_MAP mapType = D3D10_MAP_WRITE_NO_OVERWRITE;
+		if(m_bDiscard || m_Position+count > m_Capacity)
+		{
+			mapType = D3D10_MAP_WRITE_DISCARD;
+			m_Position = 0;
+			m_bDiscard = false;
+			m_Discards++;
+		}
+
+		BYTE* pData;
+		if(FAILED(m_pBuffer->Map(mapType, 0, (void**)&pData)))
+			return NULL;
+		m_bMapped = true;
+		m_LastMap = mapType;
+		first = m_Position;
+		m_Position += count;
+		return pData + first*m_Stride;
+	}
+
+	// Draws may still be queued with the batches in the old buffer, so they are copied
+	// into the new one at the same place and the next batch goes after them
+	bool InstanceBuffer::Grow(int count)
+	{
+		ID3D10Buffer* pOld = m_pBuffer;
+		int oldCapacity = m_Capacity;
+		int kept = m_bDiscard ? 0 : m_Position;
+		int capacity = Math::Max(kept+count, m_Capacity*2);
+		Log::Print("InstanceBuffer::Map() growing to %d instances", capacity);
+
+		m_pBuffer = NULL;
+		if(!Create(m_Stride, capacity))
+		{
+			m_pBuffer = pOld;
+			m_Capacity = oldCapacity;
+			m_Position = kept;
+			m_bDiscard = kept==0;
+			return false;
+		}
+		if(kept>0)
+		{
+			D3D10_BOX box = { 0, 0, 0, kept*m_Stride, 1, 1 };
+			g_pd3dDevice->CopySubresourceRegion(m_pBuffer, 0, 0, 0, 0, pOld, 0, &box);
+			m_Position = kept;
+			m_bDiscard = false;
+		}
+		SAFE_RELEASE(pOld);
+		m_Grows++;
+		return true;
+	}
+
+	void InstanceBuffer::Unmap()
+	{
+		if(!m_bMapped)
+			return;
+		m_pBuffer->Unmap();
+		m_bMapped = false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Binds the buffer to an input slot
+	//--------------------------------------------------------------------------------------
+	void InstanceBuffer::Bind(UINT slot)
+	{
+		UINT offset = 0;
+		g_pd3dDevice->IASetVertexBuffers(slot, 1, &m_pBuffer, &m_Stride, &offset);
+	}
+
+}
@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// File: InstanceBuffer.h
+//
+// Dynamic ring buffer for per-instance vertex data.  Each batch of instances is
+// appended after the last one and mapped with no-overwrite, so the GPU can keep
+// reading earlier batches while the CPU writes.  The buffer is only discarded when a
+// batch doesn't fit in the space left, and grows if a batch is bigger than the buffer.
+// Growing copies the batches already written, so their first instances stay valid.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+namespace Core
+{
+
+	class InstanceBuffer
+	{
+	public:
+		InstanceBuffer();
+		~InstanceBuffer(){ Release(); }
+
+		// Creates the buffer with room for capacity instances of stride bytes
+		bool Create(UINT stride, int capacity);
+		void Release();
+
+		// Reserves count instances and maps them for writing.  first is set to the
+		// instance index to draw them from.  Returns NULL if nothing could be mapped.
+		// The buffer may be replaced when it grows, so bind it after mapping.
+		void* Map(int count, int& first);
+		void Unmap();
+
+		// Binds the buffer to an input slot
+		void Bind(UINT slot);
+
+		// Properties
+		inline ID3D10Buffer* GetBuffer(){ return m_pBuffer; }
+		inline int GetCapacity(){ return m_Capacity; }
+		inline int GetMemoryUsage(){ return m_Capacity*m_Stride; }
+		inline int GetDiscards(){ return m_Discards; }
+		inline int GetGrows(){ return m_Grows; }
+		inline D3D10_MAP GetLastMapType(){ return m_LastMap; }
+
+	private:
+
+		// Swaps in a buffer with room for count more instances past the ones written
+		bool Grow(int count);
+
+		ID3D10Buffer*	m_pBuffer;
+		UINT			m_Stride;
+		int				m_Capacity;		// Instances the buffer holds
+		int				m_Position;		// Next free instance
+		bool			m_bMapped;
+		bool			m_bDiscard;		// The next map discards, nothing written is kept
+		D3D10_MAP		m_LastMap;
+		int				m_Discards;		// Times the ring wrapped, for stats
+		int				m_Grows;
+	};
+
+}
@@ -52,27 +52,27 @@ namespace Core
 	{
 		va_list arg_list;
 		va_start(arg_list, err);
-		m_pErrLog = fopen("log.txt","a");
-		fprintf(m_pErrLog,"ERROR> ");
-		vfprintf(m_pErrLog,err,arg_list);
-		fprintf(m_pErrLog,"\n");
-		fclose(m_pErrLog);
+		FILE* pLog = fopen("log.txt","a");
+		fprintf(pLog,"ERROR> ");
+		vfprintf(pLog,err,arg_list);
+		fprintf(pLog,"\n");
+		fclose(pLog);
 		va_end(arg_list);
 	}
 
 	//--------------------------------------------------------------------------------------
-	// Prints a string to the log file
+	// Prints a string to the log file, the handle is local so loader threads can log
 	//--------------------------------------------------------------------------------------
 	void Log::Print(const char* str, ...)
 	{
 		va_list arg_list;
 		va_start(arg_list, str);
 
-		m_pErrLog = fopen("log.txt","a");
+		FILE* pLog = fopen("log.txt","a");
 		
-		vfprintf(m_pErrLog,str,arg_list);
-		fprintf(m_pErrLog,"\n");
-		fclose(m_pErrLog);
+		vfprintf(pLog,str,arg_list);
+		fprintf(pLog,"\n");
+		fclose(pLog);
 		va_end(arg_list);
 	}
 
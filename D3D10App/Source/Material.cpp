@@ -79,6 +79,49 @@ namespace Core
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Streams a texture in
+	//--------------------------------------------------------------------------------------
+	Texture* Material::LoadTextureAsync(const char* file, TEX_TYPE type, float priority)
+	{
+		// Clear any old texture
+		ClearTexture(type);
+
+		// The texture is there at once but may only be the placeholder
+		pTex[type] = g_Textures.LoadAsync(file, priority);
+		if(pTex[type])
+		{
+			pTexFlag[type] = TRUE;
+			pTexSRV[type] = pTex[type]->GetResource();
+			return pTex[type];
+		}
+		pTexFlag[type] = FALSE;
+		pTexSRV[type] = NULL;
+		return NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Ranks the textures still streaming
+	//--------------------------------------------------------------------------------------
+	void Material::PrioritizeTextures(float priority)
+	{
+		for(int i=0; i<TEX_SIZE; i++)
+			if(pTex[i] && !pTex[i]->IsResident())
+				g_Textures.SetPriority(pTex[i], priority);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Marks the textures used this frame
+	//--------------------------------------------------------------------------------------
+	void Material::TouchTextures(float priority)
+	{
+		for(int i=0; i<TEX_SIZE; i++)
+			g_Textures.Touch(pTex[i], priority);
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Load a texture set from the game pack
 	//--------------------------------------------------------------------------------------
@@ -237,6 +280,44 @@ namespace Core
 			m_Materials[i]->ID = i;
 	}
 
+	//-----------------------------------------------------------------------------
+	// Swaps the placeholder for textures that have finished streaming.  Only SRVs
+	// still on the placeholder change, anything set by hand is left alone.
+	//-----------------------------------------------------------------------------
+	void MaterialManager::RefreshTextures()
+	{
+		ID3D10ShaderResourceView* pPlaceholder = Texture::GetPlaceholder();
+		if(!pPlaceholder)
+			return;
+		for(int i=-1; i<m_Materials.Size(); i++)
+		{
+			Material* pMat = i<0 ? &m_Default : m_Materials[i];
+			for(int t=0; t<TEX_SIZE; t++)
+			{
+				Texture* pTex = pMat->pTex[t];
+				if(pTex && pMat->pTexSRV[t]==pPlaceholder && pTex->IsResident() && pTex->GetResource())
+					pMat->pTexSRV[t] = pTex->GetResource();
+			}
+		}
+	}
+
+	//--------------------------------------------------------------------------------------
+	// Points materials using a texture that was replaced at the new one, before the old
+	// one is freed
+	//--------------------------------------------------------------------------------------
+	void MaterialManager::ReplaceTextureSRV(ID3D10ShaderResourceView* pOld, ID3D10ShaderResourceView* pNew)
+	{
+		if(!pOld || pOld==pNew)
+			return;
+		for(int i=-1; i<m_Materials.Size(); i++)
+		{
+			Material* pMat = i<0 ? &m_Default : m_Materials[i];
+			for(int t=0; t<TEX_SIZE; t++)
+				if(pMat->pTexSRV[t]==pOld)
+					pMat->pTexSRV[t] = pNew;
+		}
+	}
+
 	//-----------------------------------------------------------------------------
 	// Delete all materials
 	//-----------------------------------------------------------------------------
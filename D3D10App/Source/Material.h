@@ -183,6 +183,15 @@ namespace Core
 		
 		// Texture loading
 		Texture* LoadTexture(const char* file, TEX_TYPE type);
+
+		// Streams a texture in, the placeholder is bound until it is resident
+		Texture* LoadTextureAsync(const char* file, TEX_TYPE type, float priority=STREAM_PRIORITY_DEFAULT);
+
+		// Ranks the textures still streaming
+		void PrioritizeTextures(float priority);
+
+		// Marks the textures used this frame for the residency manager
+		void TouchTextures(float priority);
 		
 		// Load a texture set from the game pack
 		bool LoadTextureSet(const char* file);
@@ -218,6 +227,12 @@ namespace Core
 			Material* Get( const char* name );
 			void Release();
 
+			// Binds textures that have finished streaming in place of the placeholder
+			void RefreshTextures();
+
+			// Rebinds a texture that was replaced on the device
+			void ReplaceTextureSRV(ID3D10ShaderResourceView* pOld, ID3D10ShaderResourceView* pNew);
+
 	protected:
 
 			Array<Material*>	m_Materials;
@@ -18,6 +18,8 @@
 #include "Log.h"
 #include "Mesh.h"
 #include "AllocateHierarchy.h"
+#include "ThreadPool.h"
+#include <float.h>
 
 #include <iostream>
 #include <fstream>
@@ -36,6 +38,12 @@ namespace Core
 	// Material loading flag
 	bool BaseMesh::bLoadMaterials = true;
 
+	// Mesh cache flag
+	bool BaseMesh::bCacheMeshes = true;
+
+	// Compact vertex flag
+	bool BaseMesh::bCompactVertices = false;
+
 	// The global model manager
 	ResourceManager<BaseMesh> g_Meshes;
 
@@ -50,6 +58,16 @@ namespace Core
 		m_pIndexBuffer = NULL;
 		m_pPosVertexBuffer = NULL;
 		m_bSkinned = false;
+		m_NumLods = 0;
+		memset(m_LodError, 0, sizeof(m_LodError));
+		m_bCompact = false;
+		memset(&m_Quantization, 0, sizeof(m_Quantization));
+		memset(&m_CompressionStats, 0, sizeof(m_CompressionStats));
+		m_StreamBytes = 0;
+		m_bStreamCache = false;
+		m_bStreamedBVH = false;
+		m_DeviceBytes = 0;
+		m_bEvicted = false;
 	}
 
 
@@ -73,12 +91,20 @@ namespace Core
 		m_pVerts.Release();
 		m_pPosVerts.Release();
 		m_pIndices.Release();
+		m_pLodIndices.Release();
+		m_NumLods = 0;
+		m_bCompact = false;
+		m_BVH.Release();
+		m_Skeleton.Release();
 		m_pMaterials.Release();
+		ReleaseStreamData();
 
 		// Release the buffers
 		SAFE_RELEASE(m_pVertexBuffer);
 		SAFE_RELEASE(m_pPosVertexBuffer);
 		SAFE_RELEASE(m_pIndexBuffer);
+		m_DeviceBytes = 0;
+		m_bEvicted = false;
 		BaseMesh();
 	}
 
@@ -86,63 +112,103 @@ namespace Core
 	// Updates the geo buffer
 	//--------------------------------------------------------------------------------------
 	HRESULT BaseMesh::FillBuffers()
+	{
+		// The reduced levels follow the full mesh in the index buffer
+		Array<DWORD> indices;
+		const DWORD* pIndices = m_pIndices;
+		int numIndices = m_pIndices.Size();
+		if(m_pLodIndices.Size())
+		{
+			indices.Allocate(numIndices + m_pLodIndices.Size());
+			memcpy((DWORD*)indices, (DWORD*)m_pIndices, numIndices*sizeof(DWORD));
+			memcpy((DWORD*)indices + numIndices, (DWORD*)m_pLodIndices, m_pLodIndices.Size()*sizeof(DWORD));
+			pIndices = indices;
+			numIndices = indices.Size();
+		}
+
+		// Fill the position buffers
+		HRESULT hr;
+		if(m_bSkinned)
+		{
+			m_pPosVerts.Allocate(m_pSkinnedVerts.Size());
+			for(int i=0; i<m_pSkinnedVerts.Size(); i++)
+				m_pPosVerts[i].pos = m_pSkinnedVerts[i].pos;
+			hr = CreateBuffers(m_pSkinnedVerts, sizeof(SkinnedVertex), m_pSkinnedVerts.Size(), m_pPosVerts, pIndices, numIndices);
+		}
+		else
+		{
+			m_pPosVerts.Allocate(m_pVerts.Size());
+			for(int i=0; i<m_pVerts.Size(); i++)
+				m_pPosVerts[i].pos = m_pVerts[i].pos;
+			hr = CreateBuffers(m_pVerts, sizeof(Vertex), m_pVerts.Size(), m_pPosVerts, pIndices, numIndices);
+		}
+		indices.Release();
+		return hr;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Creates the geo buffers from streams, there is one position for each vertex
+	//--------------------------------------------------------------------------------------
+	HRESULT BaseMesh::CreateBuffers(const void* pVerts, UINT vertexSize, int numVerts, const PosVertex* pPosVerts, const DWORD* pIndices, int numIndices)
 	{
 		HRESULT hr;
 
 		// Release the buffers
 		SAFE_RELEASE(m_pVertexBuffer);
+		SAFE_RELEASE(m_pPosVertexBuffer);
 		SAFE_RELEASE(m_pIndexBuffer);
+
+		// Compact vertices go up in place of the full ones
+		Array<BYTE> compact;
+		m_bCompact = bCompactVertices && numVerts>0;
+		if(m_bCompact)
+			pVerts = CompressVertexBuffer(pVerts, vertexSize, numVerts, compact);
 		
 		// Fill the vertex buffer
 		D3D10_BUFFER_DESC bd;
 		D3D10_SUBRESOURCE_DATA InitData;
-		if(m_bSkinned)
-		{
-			bd.Usage = D3D10_USAGE_IMMUTABLE;
-			bd.ByteWidth = sizeof( SkinnedVertex ) * m_pSkinnedVerts.Size();
-			bd.BindFlags = D3D10_BIND_VERTEX_BUFFER;
-			bd.CPUAccessFlags = 0;
-			bd.MiscFlags = 0;
-			InitData.pSysMem = (SkinnedVertex*)m_pSkinnedVerts;
-			hr = g_pd3dDevice->CreateBuffer( &bd, &InitData, &m_pVertexBuffer );
-		}
-		else
-		{
-			bd.Usage = D3D10_USAGE_IMMUTABLE;
-			bd.ByteWidth = sizeof( Vertex ) * m_pVerts.Size();
-			bd.BindFlags = D3D10_BIND_VERTEX_BUFFER;
-			bd.CPUAccessFlags = 0;
-			bd.MiscFlags = 0;
-			InitData.pSysMem = (Vertex*)m_pVerts;
-			hr = g_pd3dDevice->CreateBuffer( &bd, &InitData, &m_pVertexBuffer );
-		}
+		bd.Usage = D3D10_USAGE_IMMUTABLE;
+		bd.ByteWidth = vertexSize * numVerts;
+		bd.BindFlags = D3D10_BIND_VERTEX_BUFFER;
+		bd.CPUAccessFlags = 0;
+		bd.MiscFlags = 0;
+		InitData.pSysMem = pVerts;
+		hr = g_pd3dDevice->CreateBuffer( &bd, &InitData, &m_pVertexBuffer );
+		compact.Release();
 		if( FAILED(hr) )  
 			return hr;
 
-		// Fill the position buffers
-		m_pPosVerts.Allocate(m_pVerts.Size());
-		for(int i=0; i<m_pVerts.Size(); i++)
-			m_pPosVerts[i].pos = m_pVerts[i].pos;
-		bd.ByteWidth = sizeof( PosVertex ) * m_pPosVerts.Size();
-		InitData.pSysMem = (PosVertex*)m_pPosVerts;
-		hr = g_pd3dDevice->CreateBuffer( &bd, &InitData, &m_pPosVertexBuffer );
-		if( FAILED(hr) )  
-			return hr;
+		// Fill the position buffers, nothing draws them for compact meshes
+		if(!m_bCompact)
+		{
+			bd.ByteWidth = sizeof( PosVertex ) * numVerts;
+			InitData.pSysMem = pPosVerts;
+			hr = g_pd3dDevice->CreateBuffer( &bd, &InitData, &m_pPosVertexBuffer );
+			if( FAILED(hr) )  
+				return hr;
+		}
+		else
+			m_pPosVerts.Release();
 
 		// Update the submeshes
 		for(int i=0; i<m_pSubMesh.Size(); i++)
+		{
 			m_pSubMesh[i].pPosVertexBuffer = m_pPosVertexBuffer;
+			m_pSubMesh[i].pQuantization = m_bCompact ? &m_Quantization : NULL;
+		}
 
 		// Fill the index buffer
 		bd.Usage = D3D10_USAGE_IMMUTABLE;
-		bd.ByteWidth = sizeof( DWORD ) * m_pIndices.Size();;
+		bd.ByteWidth = sizeof( DWORD ) * numIndices;
 		bd.BindFlags = D3D10_BIND_INDEX_BUFFER;
 		bd.CPUAccessFlags = 0;
 		bd.MiscFlags = 0;
-		InitData.pSysMem = (DWORD*)m_pIndices;
+		InitData.pSysMem = pIndices;
 		hr = g_pd3dDevice->CreateBuffer( &bd, &InitData, &m_pIndexBuffer );
 		if( FAILED(hr) )
 			return hr;
+		m_DeviceBytes = vertexSize*numVerts + (m_bCompact ? 0 : sizeof(PosVertex)*numVerts) + sizeof(DWORD)*numIndices;
 
 		// Set the buffers for the submesh array
 		for(int i=0; i<m_pSubMesh.Size(); i++)
@@ -151,12 +217,61 @@ namespace Core
 			m_pSubMesh[i].pIndexBuffer = m_pIndexBuffer;
 		}
 
+		// Picking tree over the CPU copy, which compact meshes have already decoded.
+		// Streamed meshes that are not compact had it built on the loader thread.
+		if(!m_bStreamedBVH || m_bCompact)
+		{
+			if(m_bSkinned)
+				m_BVH.Build(m_pSkinnedVerts, sizeof(SkinnedVertex), m_pSkinnedVerts.Size(), m_pIndices, m_pIndices.Size());
+			else
+				m_BVH.Build(m_pVerts, sizeof(Vertex), m_pVerts.Size(), m_pIndices, m_pIndices.Size());
+		}
+		m_bStreamedBVH = false;
+
 		return S_OK;
 	}
 
 
 
 
+	//--------------------------------------------------------------------------------------
+	// Compresses vertices for the vertex buffer.  The bounds are those of the whole mesh
+	// since submeshes share vertices.  The CPU copy is replaced with the decoded vertices
+	// so picking and bounds see what the GPU draws.
+	//--------------------------------------------------------------------------------------
+	const void* BaseMesh::CompressVertexBuffer(const void* pVerts, UINT& vertexSize, int numVerts, Array<BYTE>& compact)
+	{
+		ComputeQuantization(pVerts, vertexSize, numVerts, m_Quantization);
+		if(vertexSize==sizeof(SkinnedVertex))
+		{
+			Array<SkinnedVertex> decoded;
+			decoded.Allocate(numVerts);
+			compact.Allocate(numVerts*sizeof(CompactSkinnedVertex));
+			CompressVertices((const SkinnedVertex*)pVerts, numVerts, m_Quantization, (CompactSkinnedVertex*)(BYTE*)compact);
+			DecompressVertices((const CompactSkinnedVertex*)(BYTE*)compact, numVerts, m_Quantization, decoded);
+			MeasureCompression((const SkinnedVertex*)pVerts, decoded, numVerts, m_CompressionStats);
+			m_pSkinnedVerts.TakeArray(decoded, numVerts);
+			vertexSize = sizeof(CompactSkinnedVertex);
+		}
+		else
+		{
+			Array<Vertex> decoded;
+			decoded.Allocate(numVerts);
+			compact.Allocate(numVerts*sizeof(CompactVertex));
+			CompressVertices((const Vertex*)pVerts, numVerts, m_Quantization, (CompactVertex*)(BYTE*)compact);
+			DecompressVertices((const CompactVertex*)(BYTE*)compact, numVerts, m_Quantization, decoded);
+			MeasureCompression((const Vertex*)pVerts, decoded, numVerts, m_CompressionStats);
+			m_pVerts.TakeArray(decoded, numVerts);
+			vertexSize = sizeof(CompactVertex);
+		}
+
+		Log::Print("BaseMesh::CompressVertexBuffer(%s) %d verts, %dKB to %dKB, error pos %f uv %f normal %f deg weight %f",
+			m_szName.c_str(), numVerts, m_CompressionStats.FullSize/1024, m_CompressionStats.CompactSize/1024,
+			m_CompressionStats.PosError, m_CompressionStats.UVError, m_CompressionStats.NormalError, m_CompressionStats.WeightError);
+		return compact;
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Centers the mesh about the origin
 	//--------------------------------------------------------------------------------------
@@ -178,6 +293,145 @@ namespace Core
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Each submesh is simplified on its own, from its previous level into the same place
+	// in the next
+	//--------------------------------------------------------------------------------------
+	struct SimplifyLevelData
+	{
+		const void*		pVerts;
+		UINT			Stride;
+		int				NumVerts;
+		SubMesh*		pSubMesh;
+		const DWORD*	pPrev;			// Previous level, laid out like the full mesh
+		DWORD*			pNext;
+		int*			pCounts;		// Indices of each submesh in both
+		float*			pErrors;		// Error of each submesh so far
+		float			MaxError;
+	};
+
+	static void SimplifyLevelJob(int start, int end, void* pData)
+	{
+		SimplifyLevelData& d = *(SimplifyLevelData*)pData;
+		for(int s=start; s<end; s++)
+		{
+			int offset = d.pSubMesh[s].startIndex;
+			int count = d.pCounts[s];
+			int target = (int)(count*MESH_LOD_RATIO)/3*3;
+			float error;
+			d.pCounts[s] = SimplifyMesh(d.pVerts, d.Stride, d.NumVerts, d.pPrev+offset, count, d.pNext+offset, target, d.MaxError, &error);
+			d.pErrors[s] += error;
+			if(d.pCounts[s]<count)
+				OptimizeVertexCache(d.pNext+offset, d.pCounts[s], d.NumVerts);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Builds the reduced levels of detail.  Each level simplifies the one before it until
+	// a level stops getting smaller, and the error of a level is the sum of the levels
+	// that made it, as a part of the bounding radius.
+	//--------------------------------------------------------------------------------------
+	void BaseMesh::GenerateLODs()
+	{
+		m_pLodIndices.Release();
+		m_NumLods = 0;
+		for(int i=0; i<m_pSubMesh.Size(); i++)
+			m_pSubMesh[i].numLods = m_pSubMesh[i].lod = 0;
+		int numIndices = m_pIndices.Size();
+		if(numIndices/3 < MESH_LOD_MIN_FACES)
+			return;
+
+		// Positions are the first member of both vertex types
+		SimplifyLevelData d;
+		if(m_bSkinned)
+		{
+			d.pVerts = (SkinnedVertex*)m_pSkinnedVerts;
+			d.Stride = sizeof(SkinnedVertex);
+			d.NumVerts = m_pSkinnedVerts.Size();
+		}
+		else
+		{
+			d.pVerts = (Vertex*)m_pVerts;
+			d.Stride = sizeof(Vertex);
+			d.NumVerts = m_pVerts.Size();
+		}
+
+		// Bounding radius, the same way MeshObject finds it
+		D3DXVECTOR3 vMin(FLT_MAX, FLT_MAX, FLT_MAX), vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int i=0; i<d.NumVerts; i++)
+		{
+			const D3DXVECTOR3& pos = *(const D3DXVECTOR3*)((const BYTE*)d.pVerts + i*d.Stride);
+			vMin = Math::MinVector(vMin, pos);
+			vMax = Math::MaxVector(vMax, pos);
+		}
+		float radius = D3DXVec3Length(&((vMax-vMin)*0.5f));
+		if(radius<=0)
+			return;
+
+		int numSubMesh = m_pSubMesh.Size();
+		DWORD* pPrev = new DWORD[numIndices];
+		DWORD* pNext = new DWORD[numIndices];
+		int* pCounts = new int[numSubMesh];
+		float* pErrors = new float[numSubMesh];
+		memcpy(pPrev, (DWORD*)m_pIndices, numIndices*sizeof(DWORD));
+		for(int i=0; i<numSubMesh; i++)
+		{
+			pCounts[i] = m_pSubMesh[i].numIndices;
+			pErrors[i] = 0;
+		}
+		d.pSubMesh = m_pSubMesh;
+		d.pCounts = pCounts;
+		d.pErrors = pErrors;
+		d.MaxError = radius*MESH_LOD_MAX_ERROR;
+
+		// Levels are kept while they drop at least a tenth of the one before
+		DWORD* pLodIndices = new DWORD[numIndices*MAX_MESH_LODS];
+		int numLodIndices = 0;
+		int prevTotal = numIndices;
+		while(m_NumLods<MAX_MESH_LODS)
+		{
+			d.pPrev = pPrev;
+			d.pNext = pNext;
+			g_ThreadPool.ParallelFor(numSubMesh, SimplifyLevelJob, &d, 1);
+
+			int total = 0;
+			float error = 0;
+			for(int i=0; i<numSubMesh; i++)
+			{
+				total += pCounts[i];
+				error = max(error, pErrors[i]);
+			}
+			if(total > prevTotal*9/10)
+				break;
+
+			for(int i=0; i<numSubMesh; i++)
+			{
+				SubMeshLOD& lod = m_pSubMesh[i].lods[m_NumLods];
+				lod.startIndex = numIndices + numLodIndices;
+				lod.numIndices = pCounts[i];
+				memcpy(pLodIndices+numLodIndices, pNext+m_pSubMesh[i].startIndex, pCounts[i]*sizeof(DWORD));
+				numLodIndices += pCounts[i];
+				m_pSubMesh[i].numLods = m_NumLods+1;
+			}
+			m_LodError[m_NumLods++] = error/radius;
+			prevTotal = total;
+			DWORD* pTemp = pPrev;
+			pPrev = pNext;
+			pNext = pTemp;
+		}
+		if(numLodIndices)
+			m_pLodIndices.FromArray(pLodIndices, numLodIndices);
+		Log::Print("BaseMesh generated %d levels of detail, %d faces to %d", m_NumLods, numIndices/3, prevTotal/3);
+
+		delete[] pPrev;
+		delete[] pNext;
+		delete[] pCounts;
+		delete[] pErrors;
+		delete[] pLodIndices;
+	}
+
+
 
 	//--------------------------------------------------------------------------------------
 	// Loads a model file
@@ -190,6 +444,13 @@ namespace Core
 		if(m_bLoaded)
 			Release();
 
+		// Set when a .x mesh should be cooked into the cache once it is done
+		bool bCook = false;
+		ULONGLONG sourceHash = 0, sourceSize = 0;
+		String szCache;
+		Array<MeshFileMaterial> materials;
+		Array<DWORD> attribIds;
+
 		// Load the mesh
 		if( (file[strlen(file)-2] == 's' || file[strlen(file)-2] == 'S') &&
 			(file[strlen(file)-1] == 'x' || file[strlen(file)-1] == 'X') )
@@ -221,8 +482,20 @@ namespace Core
 			else
 				szFile = g_szDirectory + file;
 
-			if(!LoadX(szFile))
+			// Use the cache if it was cooked from this file
+			bCook = bCacheMeshes && MeshFile::HashFile(szFile, sourceHash, sourceSize);
+			szCache = szFile + MESH_CACHE_EXTENSION;
+			if(bCook && LoadCache(szCache, sourceHash, sourceSize))
+			{
+				m_szName = file;
+				Log::Print("Model Loaded from cache - \"%s\"",m_szName.c_str());
+				return (m_bLoaded=true);
+			}
+
+			if(!LoadX(szFile, &materials, &attribIds))
 			{
+				materials.Release();
+				attribIds.Release();
 				MessageBoxA(NULL, file, "Failed to load model!", MB_OK);
 				Release();
 				return false;
@@ -261,12 +534,20 @@ namespace Core
 		
 		// Center the mesh
 		CenterMesh();
+
+		// Build the levels of detail
+		GenerateLODs();
+
+		// Cook the cache while the vertices are at full precision, compact meshes
+		// replace them with the decoded ones when the buffers are filled
+		if(bCook)
+			WriteCache(szCache, sourceHash, sourceSize, materials, attribIds);
+		materials.Release();
+		attribIds.Release();
 		
 		// Fill the mesh buffers
 		if(FAILED(FillBuffers()))
-		{
 			return false;
-		}
 
 		// Store the filename
 		m_szName = file;
@@ -278,9 +559,10 @@ namespace Core
 	}
 
 	//--------------------------------------------------------------------------------------
-	// Creates a Core Engine mesh from a DirectX mesh
+	// Creates a Core Engine mesh from a DirectX mesh, pAttribIds gets the material
+	// index of each submesh
 	//--------------------------------------------------------------------------------------
-	bool BaseMesh::FromXMesh(LPD3DXMESH pMesh)
+	bool BaseMesh::FromXMesh(LPD3DXMESH pMesh, Array<DWORD>* pAttribIds)
 	{
 		if(!pMesh)
 			return false;
@@ -316,10 +598,6 @@ namespace Core
 			B_RETURN( pMesh->CloneMesh(D3DXMESH_SYSTEMMEM|D3DXMESH_32BIT,vertexDecl,g_pd3dDevice9,&pCoreMesh) );
 		}
 
-		// Generate adjacency
-		DWORD* pAdjacency = new DWORD[pCoreMesh->GetNumFaces()*3];
-		B_RETURN(pCoreMesh->GenerateAdjacency(1e-6f,pAdjacency));
-
 		// Compute the mesh normals
 		/*LPD3DXMESH pTempMesh = 0;
 		B_RETURN( D3DXComputeTangentFrameEx(pCoreMesh, D3DDECLUSAGE_TEXCOORD,0, 
@@ -333,65 +611,67 @@ namespace Core
 		pTempMesh = NULL;*/
 
 		
-		// Optimize the mesh
-		B_RETURN( pCoreMesh->OptimizeInplace(D3DXMESHOPT_VERTEXCACHE|D3DXMESHOPT_ATTRSORT,
-			pAdjacency,NULL,NULL,NULL) );
+		// Copy this mesh over into the Core Engine mesh format
+		void* pVerts = NULL;
+		UINT stride;
+		int numVerts = pCoreMesh->GetNumVertices();
+		int numFaces = pCoreMesh->GetNumFaces();
+		pCoreMesh->LockVertexBuffer(D3DLOCK_READONLY, &pVerts);
+		if(m_bSkinned)
+		{
+			m_pSkinnedVerts.FromArray((SkinnedVertex*)pVerts, numVerts);
+			pVerts = (SkinnedVertex*)m_pSkinnedVerts;
+			stride = sizeof(SkinnedVertex);
+		}
+		else
+		{
+			m_pVerts.FromArray((Vertex*)pVerts, numVerts);
+			pVerts = (Vertex*)m_pVerts;
+			stride = sizeof(Vertex);
+		}
+		pCoreMesh->UnlockVertexBuffer();
 
-		// Free the objects that are not needed
-		SAFE_DELETE_ARRAY(pAdjacency);
+		DWORD* pIndices = NULL;
+		pCoreMesh->LockIndexBuffer(D3DLOCK_READONLY,(void**)&pIndices);
+		m_pIndices.FromArray(pIndices, numFaces*3);
+		pCoreMesh->UnlockIndexBuffer();
 
-		// Finally copy this mesh over into the Core Engine mesh format
-		{
-			// Copy the vertices
-			if(m_bSkinned)
-			{
-				SkinnedVertex* pVerts = NULL;
-				pCoreMesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVerts);
-				m_pSkinnedVerts.FromArray(pVerts, pCoreMesh->GetNumVertices());
-				pCoreMesh->UnlockVertexBuffer();
-			}
-			else
-			{
-				Vertex* pVerts = NULL;
-				pCoreMesh->LockVertexBuffer(D3DLOCK_READONLY, (void**)&pVerts);
-				m_pVerts.FromArray(pVerts, pCoreMesh->GetNumVertices());
-				pCoreMesh->UnlockVertexBuffer();
-			}
+		DWORD* pAttribs = NULL;
+		Array<DWORD> attribs;
+		pCoreMesh->LockAttributeBuffer(D3DLOCK_READONLY, &pAttribs);
+		attribs.FromArray(pAttribs, numFaces);
+		pCoreMesh->UnlockAttributeBuffer();
 
-			// Copy the indices
-			DWORD* pIndices = NULL;
-			pCoreMesh->LockIndexBuffer(D3DLOCK_READONLY,(void**)&pIndices);
-			m_pIndices.FromArray(pIndices,pCoreMesh->GetNumFaces()*3);
-			pCoreMesh->UnlockIndexBuffer();
-
-			// Get the submesh data
-			DWORD iNumMesh;
-			pCoreMesh->GetAttributeTable(NULL,&iNumMesh);
-			D3DXATTRIBUTERANGE* pAttr = new D3DXATTRIBUTERANGE[iNumMesh];
-			pCoreMesh->GetAttributeTable(pAttr,0);
-			
-			// Make sure there is a material list
-			if(m_pMaterials.Size()==0)
-			{
-				m_pMaterials.Allocate(1);
-				m_pMaterials[0] = g_Materials.GetDefault();
-			}
-			
-			// Create the submeshes
-			m_pSubMesh.Allocate(iNumMesh);
-			for(DWORD i=0; i<iNumMesh; i++)
-			{
-				m_pSubMesh[i].pMaterial = m_pMaterials[pAttr[i].AttribId];
-				m_pSubMesh[i].startIndex = pAttr[i].FaceStart*3;
-				m_pSubMesh[i].numIndices = pAttr[i].FaceCount*3;
-				m_pSubMesh[i].name = String("SubMesh")+((int)i+1);
-				m_pSubMesh[i].isSkinned = m_bSkinned;
-			}
+		// Optimize the mesh, sorted by attribute and ordered for the vertex cache
+		Array<MeshAttributeRange> ranges;
+		MeshCacheStats before, after;
+		OptimizeMesh(pVerts, stride, numVerts, m_pIndices, numFaces, attribs, ranges, &before, &after);
+		Log::Print("BaseMesh optimized %d faces, ACMR %.3f to %.3f, ATVR %.3f to %.3f", numFaces, before.ACMR, after.ACMR, before.ATVR, after.ATVR);
+		attribs.Release();
 
-			// Free mem
-			SAFE_DELETE_ARRAY(pAttr);
+		// Make sure there is a material list
+		if(m_pMaterials.Size()==0)
+		{
+			m_pMaterials.Allocate(1);
+			m_pMaterials[0] = g_Materials.GetDefault();
 		}
 		
+		// Create the submeshes
+		m_pSubMesh.Allocate(ranges.Size());
+		if(pAttribIds)
+			pAttribIds->Allocate(ranges.Size());
+		for(int i=0; i<ranges.Size(); i++)
+		{
+			if(pAttribIds)
+				(*pAttribIds)[i] = ranges[i].Attrib;
+			m_pSubMesh[i].pMaterial = m_pMaterials[ranges[i].Attrib];
+			m_pSubMesh[i].startIndex = ranges[i].StartIndex;
+			m_pSubMesh[i].numIndices = ranges[i].NumIndices;
+			m_pSubMesh[i].name = String("SubMesh")+(i+1);
+			m_pSubMesh[i].isSkinned = m_bSkinned;
+		}
+		ranges.Release();
+		
 		SAFE_RELEASE(pCoreMesh);
 
 		return true;
@@ -399,11 +679,72 @@ namespace Core
 
 
 
+	//--------------------------------------------------------------------------------------
+	// Creates a material from what the mesh asked for
+	//--------------------------------------------------------------------------------------
+	Material* BaseMesh::CreateMaterial(const MeshFileMaterial& info, const String& szDir, int index, bool bAsync)
+	{
+		if(!bLoadMaterials)
+			return g_Materials.GetDefault();
+
+		// Create and setup a new material from the mesh info
+		Material* pMat = g_Materials.Add( String("XMat") + index );
+		pMat->SetDiffuse( info.Diffuse );
+		pMat->SetSurfaceParam1(info.Power);
+		if(pMat->GetSurfaceParam1()<2)
+			pMat->SetSurfaceParam1(4);
+		if(pMat->GetSurfaceParam1()>50)
+			pMat->SetSurfaceParam1(50);
+		
+		// Try loading the texture
+		if(info.Texture[0] && bAsync)
+		{
+			// Stream from the first place the file is
+			String szPaths[3] = { szDir + info.Texture, szDir.GetPreviousDirectory() + info.Texture, String("..\\") + info.Texture };
+			int path = 0;
+			while(path<2 && GetFileAttributesA(szPaths[path].c_str())==INVALID_FILE_ATTRIBUTES)
+				path++;
+			pMat->LoadTextureAsync(szPaths[path], TEX_DIFFUSE1);
+		}
+		else if(info.Texture[0])
+		{
+			if(!pMat->LoadTexture(szDir + info.Texture, TEX_DIFFUSE1))
+			if(!pMat->LoadTexture(szDir.GetPreviousDirectory() + info.Texture, TEX_DIFFUSE1))
+				pMat->LoadTexture(String("..\\") + info.Texture, TEX_DIFFUSE1);
+		}
+		return pMat;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Creates the materials of a cooked mesh and hands them to the submeshes, a mesh
+	// without any uses the default
+	//--------------------------------------------------------------------------------------
+	void BaseMesh::CreateMaterials(const MeshFileMaterial* pInfo, int numMaterials, const String& szDir, Array<DWORD>& attribIds, bool bAsync)
+	{
+		if(numMaterials==0)
+		{
+			m_pMaterials.Allocate(1);
+			m_pMaterials[0] = g_Materials.GetDefault();
+		}
+		else
+		{
+			m_pMaterials.Allocate(numMaterials);
+			for(int i=0; i<numMaterials; i++)
+				m_pMaterials[i] = CreateMaterial(pInfo[i], szDir, i, bAsync);
+		}
+		for(int i=0; i<m_pSubMesh.Size(); i++)
+			m_pSubMesh[i].pMaterial = m_pMaterials[attribIds[i]];
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Loads a DirectX BaseMesh (.X)
 	//  Since Direct3D10 does not support .x loading, a nullref d3d9device is used
+	//  The materials as the file has them and the material of each submesh can be
+	//  kept for the cache
 	//--------------------------------------------------------------------------------------
-	bool BaseMesh::LoadX(const char* file)
+	bool BaseMesh::LoadX(const char* file, Array<MeshFileMaterial>* pMaterialInfo, Array<DWORD>* pAttribIds)
 	{
 		// TODO:
 		//		Use effects from the mesh
@@ -428,35 +769,23 @@ namespace Core
 		D3DXMATERIAL* pMaterials = (D3DXMATERIAL*)pMaterialBuffer->GetBufferPointer();
 		int iNumMaterials = dwNumMaterials;
 		m_pMaterials.Allocate(iNumMaterials);
+		if(pMaterialInfo)
+			pMaterialInfo->Allocate(iNumMaterials);
 		String szDir = String(file).GetDirectory();
 		for(int i=0; i<iNumMaterials; i++)
 		{ 
-			if(bLoadMaterials)
-			{
-				// Create and setup a new material from the mesh info
-				Material* pMat = g_Materials.Add( String("XMat") + i );
-				pMat->SetDiffuse( D3DXVECTOR4( pMaterials[i].MatD3D.Diffuse.r,
-								  pMaterials[i].MatD3D.Diffuse.g,
-								  pMaterials[i].MatD3D.Diffuse.b,
-								  pMaterials[i].MatD3D.Diffuse.a  ));
-				pMat->SetSurfaceParam1(pMaterials[i].MatD3D.Power);
-				if(pMat->GetSurfaceParam1()<2)
-					pMat->SetSurfaceParam1(4);
-				if(pMat->GetSurfaceParam1()>50)
-					pMat->SetSurfaceParam1(50);
-				
-				// Try loading the texture
-				if(pMaterials[i].pTextureFilename)
-				{
-					if(!pMat->LoadTexture(szDir + pMaterials[i].pTextureFilename, TEX_DIFFUSE1))
-					if(!pMat->LoadTexture(szDir.GetPreviousDirectory() + pMaterials[i].pTextureFilename, TEX_DIFFUSE1))
-						pMat->LoadTexture(String("..\\") + pMaterials[i].pTextureFilename, TEX_DIFFUSE1);
-				}
-				
-				m_pMaterials[i] = pMat;
-			}
-			else
-				m_pMaterials[i] = g_Materials.GetDefault();
+			MeshFileMaterial info;
+			memset(&info, 0, sizeof(MeshFileMaterial));
+			info.Diffuse = D3DXVECTOR4( pMaterials[i].MatD3D.Diffuse.r,
+										pMaterials[i].MatD3D.Diffuse.g,
+										pMaterials[i].MatD3D.Diffuse.b,
+										pMaterials[i].MatD3D.Diffuse.a );
+			info.Power = pMaterials[i].MatD3D.Power;
+			if(pMaterials[i].pTextureFilename)
+				strncpy(info.Texture, pMaterials[i].pTextureFilename, MESH_FILE_NAME-1);
+			m_pMaterials[i] = CreateMaterial(info, szDir, i);
+			if(pMaterialInfo)
+				(*pMaterialInfo)[i] = info;
 		}
 
 		// Release mem
@@ -464,7 +793,7 @@ namespace Core
 			
 		
 		// Now convert to Core Engine Format
-		if(!FromXMesh(pMesh))
+		if(!FromXMesh(pMesh, pAttribIds))
 		{
 			Log::Print("<!>BaseMesh Conversion Failed!!");
 			SAFE_RELEASE(pMesh);
@@ -475,6 +804,259 @@ namespace Core
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Loads a cooked mesh.  The buffers are created straight from the mapped streams and
+	// only the vertices and indices are copied out for picking and bounds.
+	//--------------------------------------------------------------------------------------
+	bool BaseMesh::LoadCache(const char* file, ULONGLONG sourceHash, ULONGLONG sourceSize)
+	{
+		MeshFile cache;
+		if(!cache.Open(file, sourceHash, sourceSize))
+			return false;
+		const MeshFileHeader& header = cache.GetHeader();
+
+		// Submeshes and the CPU copy, then the materials they use
+		Array<DWORD> attribIds;
+		ReadCache(cache, attribIds);
+		CreateMaterials(cache.GetMaterials(), header.NumMaterials, String(file).GetDirectory(), attribIds);
+		attribIds.Release();
+
+		// Geometry, the levels of detail follow the full mesh in the index stream
+		if(FAILED(CreateBuffers(cache.GetVerts(), sizeof(Vertex), header.NumVerts, cache.GetPosVerts(), cache.GetIndices(), header.NumIndices+header.NumLodIndices)))
+		{
+			Log::Print("<!> BaseMesh::LoadCache(%s) failed to create the buffers", file);
+			Release();
+			return false;
+		}
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Copies the submeshes, levels and CPU geometry out of a cooked mesh.  Nothing here
+	// touches a device so loader threads use it too.
+	//--------------------------------------------------------------------------------------
+	void BaseMesh::ReadCache(MeshFile& cache, Array<DWORD>& attribIds)
+	{
+		const MeshFileHeader& header = cache.GetHeader();
+
+		// Submeshes, the material of each is kept for when they are created
+		m_pSubMesh.Allocate(header.NumSubMeshes);
+		attribIds.Allocate(header.NumSubMeshes);
+		for(DWORD i=0; i<header.NumSubMeshes; i++)
+		{
+			const MeshFileSubMesh& sub = cache.GetSubMeshes()[i];
+			attribIds[i] = sub.Material;
+			m_pSubMesh[i].pMaterial = NULL;
+			m_pSubMesh[i].startIndex = sub.StartIndex;
+			m_pSubMesh[i].numIndices = sub.NumIndices;
+			m_pSubMesh[i].name = String("SubMesh")+((int)i+1);
+			m_pSubMesh[i].isSkinned = false;
+			m_pSubMesh[i].numLods = header.NumLods;
+			for(DWORD l=0; l<header.NumLods; l++)
+			{
+				const MeshFileLOD& lod = cache.GetLods()[i*header.NumLods+l];
+				m_pSubMesh[i].lods[l].startIndex = lod.StartIndex;
+				m_pSubMesh[i].lods[l].numIndices = lod.NumIndices;
+			}
+		}
+		m_NumLods = header.NumLods;
+		memcpy(m_LodError, header.LodError, sizeof(m_LodError));
+
+		// Geometry, the levels of detail follow the full mesh in the index stream
+		m_pVerts.FromArray(const_cast<Vertex*>(cache.GetVerts()), header.NumVerts);
+		m_pIndices.FromArray(const_cast<DWORD*>(cache.GetIndices()), header.NumIndices);
+		if(header.NumLodIndices)
+			m_pLodIndices.FromArray(const_cast<DWORD*>(cache.GetIndices())+header.NumIndices, header.NumLodIndices);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reads a mesh on a loader thread.  Only .x meshes with a cache stream, the
+	// rest need D3DX on the main thread and load in StreamUpload.
+	//--------------------------------------------------------------------------------------
+	bool BaseMesh::StreamDecode(const char* file)
+	{
+		m_bStreamCache = false;
+		m_StreamBytes = 0;
+
+		// Evicted, the CPU copy is still here
+		if(m_bEvicted)
+		{
+			m_StreamBytes = m_DeviceBytes;
+			return true;
+		}
+
+		int len = (int)strlen(file);
+		if(len<2)
+			return true;
+
+		// Get the full file path
+		String szFile;
+		if( (file[0]=='c'||file[0]=='C') && file[1]==':' )
+			szFile = file;
+		else
+			szFile = g_szDirectory + file;
+
+		// Loaded on the main thread, the file size stands in for the upload
+		WIN32_FILE_ATTRIBUTE_DATA attribs;
+		if(GetFileAttributesExA(szFile.c_str(), GetFileExInfoStandard, &attribs))
+			m_StreamBytes = attribs.nFileSizeLow;
+		bool bX = (file[len-1]=='x' || file[len-1]=='X') && file[len-2]!='s' && file[len-2]!='S';
+		ULONGLONG sourceHash, sourceSize;
+		if(!bX || !bCacheMeshes || !MeshFile::HashFile(szFile, sourceHash, sourceSize))
+			return true;
+		MeshFile cache;
+		if(!cache.Open(szFile + MESH_CACHE_EXTENSION, sourceHash, sourceSize))
+			return true;
+		const MeshFileHeader& header = cache.GetHeader();
+
+		// Everything the upload needs, so the file can be closed
+		ReadCache(cache, m_StreamAttribs);
+		m_StreamMaterials.FromArray(const_cast<MeshFileMaterial*>(cache.GetMaterials()), header.NumMaterials);
+		m_pPosVerts.FromArray(const_cast<PosVertex*>(cache.GetPosVerts()), header.NumVerts);
+		m_StreamIndices.FromArray(const_cast<DWORD*>(cache.GetIndices()), header.NumIndices+header.NumLodIndices);
+		m_StreamBytes = header.NumVerts*(sizeof(Vertex)+sizeof(PosVertex)) + m_StreamIndices.Size()*sizeof(DWORD);
+
+		// Compact meshes change the vertices on upload, the tree waits for that
+		if(!bCompactVertices)
+			m_bStreamedBVH = m_BVH.Build(m_pVerts, sizeof(Vertex), m_pVerts.Size(), m_pIndices, m_pIndices.Size());
+		m_bStreamCache = true;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Creates the materials and buffers of a streamed mesh, or loads it if it could not
+	// be read on the loader
+	//--------------------------------------------------------------------------------------
+	bool BaseMesh::StreamUpload(const char* file)
+	{
+		// Evicted, the buffers go back up without redoing the picking tree
+		if(m_bEvicted)
+		{
+			m_bEvicted = false;
+			m_bStreamedBVH = true;
+			return SUCCEEDED(FillBuffers());
+		}
+
+		if(!m_bStreamCache)
+			return Load(file);
+		m_bStreamCache = false;
+
+		// Textures stream in behind the mesh
+		String szFile;
+		if( (file[0]=='c'||file[0]=='C') && file[1]==':' )
+			szFile = file;
+		else
+			szFile = g_szDirectory + file;
+		CreateMaterials(m_StreamMaterials, m_StreamMaterials.Size(), szFile.GetDirectory(), m_StreamAttribs, true);
+		HRESULT hr = CreateBuffers(m_pVerts, sizeof(Vertex), m_pVerts.Size(), m_pPosVerts, m_StreamIndices, m_StreamIndices.Size());
+		ReleaseStreamData();
+		if(FAILED(hr))
+		{
+			Log::Print("<!> BaseMesh::StreamUpload(%s) failed to create the buffers", file);
+			Release();
+			return false;
+		}
+		m_szName = file;
+		Log::Print("Model Streamed from cache - \"%s\"",m_szName.c_str());
+		return (m_bLoaded=true);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Frees the buffers, objects drawing the mesh pick up the change with UpdateSubMeshes
+	//--------------------------------------------------------------------------------------
+	void BaseMesh::Evict()
+	{
+		if(!m_bLoaded || !m_pVertexBuffer)
+			return;
+		SAFE_RELEASE(m_pVertexBuffer);
+		SAFE_RELEASE(m_pPosVertexBuffer);
+		SAFE_RELEASE(m_pIndexBuffer);
+		for(int i=0; i<m_pSubMesh.Size(); i++)
+		{
+			m_pSubMesh[i].pVertexBuffer = NULL;
+			m_pSubMesh[i].pPosVertexBuffer = NULL;
+			m_pSubMesh[i].pIndexBuffer = NULL;
+		}
+		m_bEvicted = true;
+		m_bResident = false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Frees what a loader read for the upload
+	//--------------------------------------------------------------------------------------
+	void BaseMesh::ReleaseStreamData()
+	{
+		m_StreamMaterials.Release();
+		m_StreamAttribs.Release();
+		m_StreamIndices.Release();
+		m_bStreamCache = false;
+		m_bStreamedBVH = false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Cooks the loaded mesh into the cache
+	//--------------------------------------------------------------------------------------
+	void BaseMesh::WriteCache(const char* file, ULONGLONG sourceHash, ULONGLONG sourceSize, Array<MeshFileMaterial>& materials, Array<DWORD>& attribIds)
+	{
+		// Materials are referred to by index, a mesh without any uses the default
+		Array<MeshFileSubMesh> subMeshes;
+		subMeshes.Allocate(m_pSubMesh.Size());
+		for(int i=0; i<m_pSubMesh.Size(); i++)
+		{
+			if(attribIds[i]>=(DWORD)max(materials.Size(), 1))
+			{
+				Log::Print("<!> BaseMesh::WriteCache(%s) submesh %d has no material", file, i);
+				subMeshes.Release();
+				return;
+			}
+			memset(&subMeshes[i], 0, sizeof(MeshFileSubMesh));
+			subMeshes[i].StartIndex = m_pSubMesh[i].startIndex;
+			subMeshes[i].NumIndices = m_pSubMesh[i].numIndices;
+			subMeshes[i].Material = attribIds[i];
+		}
+
+		// Levels of each submesh in turn
+		Array<MeshFileLOD> lods;
+		if(m_NumLods)
+		{
+			lods.Allocate(m_pSubMesh.Size()*m_NumLods);
+			for(int i=0; i<m_pSubMesh.Size(); i++)
+				for(int l=0; l<m_NumLods; l++)
+				{
+					lods[i*m_NumLods+l].StartIndex = m_pSubMesh[i].lods[l].startIndex;
+					lods[i*m_NumLods+l].NumIndices = m_pSubMesh[i].lods[l].numIndices;
+				}
+		}
+
+		MeshFileDesc desc;
+		desc.SourceHash = sourceHash;
+		desc.SourceSize = sourceSize;
+		desc.pVerts = m_pVerts;
+		desc.NumVerts = m_pVerts.Size();
+		desc.pIndices = m_pIndices;
+		desc.NumIndices = m_pIndices.Size();
+		desc.pSubMeshes = subMeshes;
+		desc.NumSubMeshes = subMeshes.Size();
+		desc.pMaterials = materials;
+		desc.NumMaterials = materials.Size();
+		desc.pLodIndices = m_pLodIndices;
+		desc.NumLodIndices = m_pLodIndices.Size();
+		desc.pLods = lods;
+		desc.NumLods = m_NumLods;
+		memcpy(desc.LodError, m_LodError, sizeof(desc.LodError));
+		if(MeshFile::Write(file, desc))
+			Log::Print("Mesh cache written - \"%s\"", file);
+		subMeshes.Release();
+		lods.Release();
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Finds the node that contains mesh data
 	//--------------------------------------------------------------------------------------
@@ -503,13 +1085,8 @@ namespace Core
 	////--------------------------------------------------------------------------------------
 	bool BaseMesh::LoadSkinnedX(const char* file)
 	{
-		D3DXFRAME*					m_pRootFrame;			// Bone hierarchy
-		bool					    m_bSkinnedMesh;			// True if skinning
-		DWORD						m_MaxVertInfluences;	// Max number of bones per vertex
-		ID3DXAnimationController*	m_pAnimCtrl;			// Animation controller
-		Array<D3DXMATRIX>			m_FinalTransforms;		// Matrix transforms
-		float						m_FrameTime;			// Timer for animation
-		D3DXMESHCONTAINER_DERIVED*	m_pMeshContainer;		// The mesh contatiner
+		D3DXFRAME*					pRootFrame;		// Bone hierarchy
+		ID3DXAnimationController*	pAnimCtrl;		// Animation controller
 		
 		// Load in the mesh from the file
 		AllocateHierarchy allocMeshHierarchy;
@@ -518,8 +1095,8 @@ namespace Core
 			g_pd3dDevice9, 
 			&allocMeshHierarchy, 
 			0,
-			&m_pRootFrame,	
-			&m_pAnimCtrl );
+			&pRootFrame,	
+			&pAnimCtrl );
 		if(FAILED(hr))
 		{
 			MessageBoxA(NULL, "Couldn't load animation data", "Load Fail", MB_OK);
@@ -527,64 +1104,46 @@ namespace Core
 		}
 
 		// Find the mesh node	
-		D3DXFRAME* f = FindNodeWithMesh(m_pRootFrame);
-		m_pMeshContainer = (D3DXMESHCONTAINER_DERIVED*)f->pMeshContainer;
-		m_pMeshContainer->pSkinInfo->GetMaxVertexInfluences(&m_MaxVertInfluences);
-
-		// Build the vertex/index buffers
-		m_bSkinned = true;
-		if(FromXMesh(m_pMeshContainer->MeshData.pMesh))
+		bool bLoaded = false;
+		D3DXFRAME* f = FindNodeWithMesh(pRootFrame);
+		if(f)
 		{
-			for(int i=0; i<m_pSkinnedVerts.Size(); i++)
-				Log::Print("%d %d %d %d,,,,%f %f %f %f", m_pSkinnedVerts[i].indices[0],
-														 m_pSkinnedVerts[i].indices[1],
-														 m_pSkinnedVerts[i].indices[2],
-														 m_pSkinnedVerts[i].indices[3],
-														 m_pSkinnedVerts[i].weights.x,
-														 m_pSkinnedVerts[i].weights.y,
-														 m_pSkinnedVerts[i].weights.z,
-														 m_pSkinnedVerts[i].weights.w );
-			return true;
-		}	
-		return false;
+			// Build the vertex/index buffers and take the bones and clips, the
+			// objects animate off the skeleton so the hierarchy is not kept
+			D3DXMESHCONTAINER_DERIVED* pMeshContainer = (D3DXMESHCONTAINER_DERIVED*)f->pMeshContainer;
+			m_bSkinned = true;
+			bLoaded = m_Skeleton.Build(pRootFrame, pMeshContainer->pSkinInfo, pAnimCtrl) &&
+					  FromXMesh(pMeshContainer->MeshData.pMesh);
+		}
+		else
+			Log::Print("<!> BaseMesh::LoadSkinnedX(%s) has no mesh in its hierarchy", file);
+		D3DXFrameDestroy(pRootFrame, &allocMeshHierarchy);
+		SAFE_RELEASE(pAnimCtrl);
+		return bLoaded;
 	}
 
 
 	//--------------------------------------------------------------------------------------
 	// Cleans the mesh by removing duplicate verts
 	//--------------------------------------------------------------------------------------
-	void BaseMesh::Clean()
+	void BaseMesh::Clean(float tolerance, DWORD flags)
 	{
-		bool flag=true;
-		while(flag)
+		int numVerts = m_pVerts.Size();
+		if(numVerts==0)
+			return;
+
+		DWORD* pRemap = new DWORD[numVerts];
+		int numKept = WeldVertices(m_pVerts, numVerts, pRemap, tolerance, flags);
+		if(numKept<numVerts)
 		{
-			flag=false;
-			for(int i=0; i<m_pVerts.Size(); i++)
-			{
-				for(int j=0; j<m_pVerts.Size(); j++)
-				{
-					if(i==j) continue;
-					if( (fabs(m_pVerts[i].pos.x-m_pVerts[j].pos.x)<0.001f) &&
-						(fabs(m_pVerts[i].pos.y-m_pVerts[j].pos.y)<0.001f) &&
-						(fabs(m_pVerts[i].pos.z-m_pVerts[j].pos.z)<0.001f) )
-					{
-						m_pVerts.Remove(j);
-						for(int k=0; k<m_pIndices.Size(); k++)
-						{
-							if(m_pIndices[k]==(UINT)j)
-								m_pIndices[k]=(UINT)i;
-							else
-								if(m_pIndices[k]>(UINT)j)
-									m_pIndices[k]--;
-						}
-						flag=true;
-						break;
-					}
-				}
-				if(flag==true)
-					break;
-			}
+			CompactVertices(m_pVerts, numVerts, pRemap);
+			Vertex* pVerts = new Vertex[numKept];
+			memcpy(pVerts, (Vertex*)m_pVerts, numKept*sizeof(Vertex));
+			m_pVerts.TakeArray(pVerts, numKept);
+			RemapIndices(m_pIndices, m_pIndices.Size(), pRemap);
+			RemapIndices(m_pLodIndices, m_pLodIndices.Size(), pRemap);
 		}
+		delete[] pRemap;
 	}
 
 
@@ -18,6 +18,12 @@
 #include "Array.cpp"
 #include "SubMesh.h"
 #include "QMath.h"
+#include "MeshWeld.h"
+#include "MeshFile.h"
+#include "MeshOptimize.h"
+#include "MeshSimplify.h"
+#include "MeshBVH.h"
+#include "Animation.h"
 
 namespace Core
 {
@@ -77,9 +83,29 @@ namespace Core
 			// Updates the geo buffers
 			HRESULT FillBuffers();
 
+			// Creates the geo buffers straight from vertex, position and index streams
+			HRESULT CreateBuffers(const void* pVerts, UINT vertexSize, int numVerts, const PosVertex* pPosVerts, const DWORD* pIndices, int numIndices);
+
 			// Centers the mesh about the origin
 			void CenterMesh();
 
+			// Builds the reduced levels of detail, FillBuffers puts them in the index buffer
+			void GenerateLODs();
+
+			// Compact vertex buffer, the stats say what compressing it cost and saved
+			inline bool IsCompact(){ return m_bCompact; }
+			inline const VertexCompressionStats& GetCompressionStats(){ return m_CompressionStats; }
+
+			// Picking tree over the full mesh in the bind pose, triangles are those of GetIndices()
+			inline MeshBVH& GetBVH(){ return m_BVH; }
+
+			// Bones and clips of a skinned mesh
+			inline Skeleton& GetSkeleton(){ return m_Skeleton; }
+
+			// Levels of detail, the error is a part of the bounding radius and grows with the level
+			inline int GetNumLODs(){ return m_NumLods; }
+			inline float GetLODError(int level){ return level<=0 ? 0 : m_LodError[min(level, m_NumLods)-1]; }
+
 			// BaseMesh data
 			inline Vertex* GetVerts(){ return m_pVerts; }
 			inline SkinnedVertex* GetSkinnedVerts(){ return m_pSkinnedVerts; }
@@ -91,8 +117,9 @@ namespace Core
 			// Get an array with the default materials
 			inline Array<Material*>& GetDefaultMaterials(){ return m_pMaterials; }
 
-			// Cleans the mesh by removing duplicate verts
-			void Clean();
+			// Cleans the mesh by removing duplicate verts, flags are WELD_FLAG values
+			// for what else has to match
+			void Clean(float tolerance=WELD_TOLERANCE, DWORD flags=0);
 
 			// Swap tex coords
 			void FlipUV();
@@ -101,6 +128,24 @@ namespace Core
 			// (used for loading scenes)
 			static bool bLoadMaterials;
 
+			// Set to FALSE to always load .x meshes through D3DX and not write caches
+			static bool bCacheMeshes;
+
+			// Set to TRUE to upload compact vertices, see VertexCompress.h
+			static bool bCompactVertices;
+
+			// Streaming, cooked .x meshes are read on a loader thread and anything
+			// else loads in the upload step since D3DX needs the main thread
+			bool StreamDecode(const char* file);
+			inline UINT GetStreamBytes(){ return m_StreamBytes; }
+			bool StreamUpload(const char* file);
+
+			// Residency, eviction frees the buffers and keeps the CPU copy for picking,
+			// which goes back up when the mesh streams in again
+			inline int GetResidencyGroup(){ return RESIDENCY_MESH; }
+			inline UINT GetResidentBytes(){ return m_pVertexBuffer ? m_DeviceBytes : 0; }
+			void Evict();
+
 	protected:
 			ID3D10Buffer*               m_pVertexBuffer;
 			ID3D10Buffer*               m_pPosVertexBuffer;
@@ -110,18 +155,40 @@ namespace Core
 			Array<Vertex>				m_pVerts;			// Vertex array
 			Array<PosVertex>			m_pPosVerts;		// Vertex array (positions only for faster shadow rendering)
 			Array<DWORD>				m_pIndices;			// Index array
+			Array<DWORD>				m_pLodIndices;		// Indices of the reduced levels, after m_pIndices in the buffer
+			float						m_LodError[MAX_MESH_LODS];	// Error of each level
+			int							m_NumLods;			// Number of reduced levels
+			VertexQuantization			m_Quantization;		// Decoding of the compact vertex buffer
+			VertexCompressionStats		m_CompressionStats;	// What compressing the vertices cost
+			bool						m_bCompact;			// True if the vertex buffer is compact
+			MeshBVH						m_BVH;				// Picking tree
 			bool						m_bLoaded;			// Is it loaded?
+			UINT						m_DeviceBytes;		// Size of the buffers
+			bool						m_bEvicted;			// Buffers freed by the residency manager
+
+			//---------------------------------------
+			// Filled by a loader thread for the upload
+			Array<MeshFileMaterial>		m_StreamMaterials;	// Materials as the cache has them
+			Array<DWORD>				m_StreamAttribs;	// Material of each submesh
+			Array<DWORD>				m_StreamIndices;	// Full index stream with the levels
+			UINT						m_StreamBytes;		// Buffer bytes to upload
+			bool						m_bStreamCache;		// False to load in the upload step
+			bool						m_bStreamedBVH;		// The loader built the picking tree
 
 			//---------------------------------------
 			// Skinned mesh stuff
 			Array<SkinnedVertex>		m_pSkinnedVerts;		// Skinned Vertex array
 			bool						m_bSkinned;				// True if a skinned mesh
+			Skeleton					m_Skeleton;				// Bone hierarchy and animations
 
 			// Finds the node that contains mesh data
 			D3DXFRAME* FindNodeWithMesh(D3DXFRAME* frame);
 
 			// Update the frame matrices
 			void UpdateFrameMatrices( LPD3DXFRAME pFrameBase, LPD3DXMATRIX pParentMatrix );
+
+			// Compresses vertices for upload and decodes them back into the CPU copy
+			const void* CompressVertexBuffer(const void* pVerts, UINT& vertexSize, int numVerts, Array<BYTE>& compact);
 				
 			// 3ds vertex
 			struct Vertex3DS
@@ -132,8 +199,16 @@ namespace Core
 
 			// Loads the model
 			bool Load(const char* file);
-			bool FromXMesh(LPD3DXMESH pMesh);
-			bool LoadX(const char* file);
+			bool FromXMesh(LPD3DXMESH pMesh, Array<DWORD>* pAttribIds=NULL);
+			bool LoadX(const char* file, Array<MeshFileMaterial>* pMaterialInfo=NULL, Array<DWORD>* pAttribIds=NULL);
+			Material* CreateMaterial(const MeshFileMaterial& info, const String& szDir, int index, bool bAsync=false);
+			void CreateMaterials(const MeshFileMaterial* pInfo, int numMaterials, const String& szDir, Array<DWORD>& attribIds, bool bAsync=false);
+
+			// Binary cache for .x meshes
+			bool LoadCache(const char* file, ULONGLONG sourceHash, ULONGLONG sourceSize);
+			void ReadCache(MeshFile& cache, Array<DWORD>& attribIds);
+			void ReleaseStreamData();
+			void WriteCache(const char* file, ULONGLONG sourceHash, ULONGLONG sourceSize, Array<MeshFileMaterial>& materials, Array<DWORD>& attribIds);
 			bool LoadSkinnedX(const char* file);
 
 
@@ -0,0 +1,497 @@
+//--------------------------------------------------------------------------------------
+// File: MeshBVH.cpp
+//
+// Bounding volume hierarchy over the triangles of a mesh for ray picking
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "MeshBVH.h"
+#include "ThreadPool.h"
+#include <xmmintrin.h>
+#include <float.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Box helpers
+	//--------------------------------------------------------------------------------------
+	static inline const D3DXVECTOR3& BVHPos(const void* pVerts, UINT stride, DWORD i)
+	{
+		return *(const D3DXVECTOR3*)((const BYTE*)pVerts + i*stride);
+	}
+
+	static inline void BVHGrow(D3DXVECTOR3& vMin, D3DXVECTOR3& vMax, const D3DXVECTOR3& p)
+	{
+		if(p.x<vMin.x) vMin.x = p.x;
+		if(p.y<vMin.y) vMin.y = p.y;
+		if(p.z<vMin.z) vMin.z = p.z;
+		if(p.x>vMax.x) vMax.x = p.x;
+		if(p.y>vMax.y) vMax.y = p.y;
+		if(p.z>vMax.z) vMax.z = p.z;
+	}
+
+	static inline float BVHArea(const D3DXVECTOR3& vMin, const D3DXVECTOR3& vMax)
+	{
+		D3DXVECTOR3 d = vMax-vMin;
+		if(d.x<0 || d.y<0 || d.z<0)
+			return 0;
+		return d.x*d.y + d.y*d.z + d.z*d.x;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Build
+	//--------------------------------------------------------------------------------------
+	MeshBVH::MeshBVH()
+	{
+	}
+
+	void MeshBVH::Release()
+	{
+		m_Nodes.Release();
+		m_TriVerts.Release();
+		m_TriIds.Release();
+	}
+
+	// Bin of a split candidate
+	struct BVHBin
+	{
+		D3DXVECTOR3	vMin, vMax;
+		int			Count;
+	};
+
+	// Range of triangles still to be made into a node
+	struct BVHTask
+	{
+		int First, Count;
+	};
+
+	bool MeshBVH::Build(const void* pVerts, UINT stride, int numVerts, const DWORD* pIndices, int numIndices)
+	{
+		Release();
+		int numTris = numIndices/3;
+		if(numTris==0)
+			return false;
+
+		// Triangle bounds and centroids
+		D3DXVECTOR3* pTriMin = new D3DXVECTOR3[numTris];
+		D3DXVECTOR3* pTriMax = new D3DXVECTOR3[numTris];
+		D3DXVECTOR3* pCenter = new D3DXVECTOR3[numTris];
+		int* pOrder = new int[numTris];
+		for(int i=0; i<numTris; i++)
+		{
+			pTriMin[i] = pTriMax[i] = BVHPos(pVerts, stride, pIndices[i*3]);
+			BVHGrow(pTriMin[i], pTriMax[i], BVHPos(pVerts, stride, pIndices[i*3+1]));
+			BVHGrow(pTriMin[i], pTriMax[i], BVHPos(pVerts, stride, pIndices[i*3+2]));
+			pCenter[i] = (pTriMin[i]+pTriMax[i])*0.5f;
+			pOrder[i] = i;
+		}
+
+		// Nodes are made depth first from a stack, so the left child of a node always
+		// follows it and the right child follows the whole left subtree
+		MeshBVHNode* pNodes = new MeshBVHNode[numTris*2];
+		int* pEnd = new int[numTris*2];
+		BVHTask* pStack = new BVHTask[numTris+1];
+		int numNodes = 0, stackSize = 0;
+		pStack[stackSize].First = 0;
+		pStack[stackSize++].Count = numTris;
+		BVHBin bins[MESH_BVH_BINS];
+		while(stackSize>0)
+		{
+			BVHTask task = pStack[--stackSize];
+			MeshBVHNode& node = pNodes[numNodes++];
+			node.Data = 0;
+			node.Parent = -1;
+
+			// Node and centroid bounds
+			D3DXVECTOR3 cMin(FLT_MAX, FLT_MAX, FLT_MAX), cMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			node.vMin = cMin;
+			node.vMax = cMax;
+			for(int i=task.First; i<task.First+task.Count; i++)
+			{
+				int t = pOrder[i];
+				BVHGrow(node.vMin, node.vMax, pTriMin[t]);
+				BVHGrow(node.vMin, node.vMax, pTriMax[t]);
+				BVHGrow(cMin, cMax, pCenter[t]);
+			}
+
+			// Cheapest split, costs are surface area times triangles
+			float bestCost = FLT_MAX;
+			int bestAxis = -1, bestBin = 0;
+			if(task.Count>1)
+			{
+				for(int axis=0; axis<3; axis++)
+				{
+					float lo = (&cMin.x)[axis];
+					float extent = (&cMax.x)[axis] - lo;
+					if(extent<=0)
+						continue;
+					float binScale = MESH_BVH_BINS/extent;
+					for(int b=0; b<MESH_BVH_BINS; b++)
+					{
+						bins[b].vMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+						bins[b].vMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+						bins[b].Count = 0;
+					}
+					for(int i=task.First; i<task.First+task.Count; i++)
+					{
+						int t = pOrder[i];
+						int b = min((int)(((&pCenter[t].x)[axis]-lo)*binScale), MESH_BVH_BINS-1);
+						bins[b].Count++;
+						BVHGrow(bins[b].vMin, bins[b].vMax, pTriMin[t]);
+						BVHGrow(bins[b].vMin, bins[b].vMax, pTriMax[t]);
+					}
+
+					// Sweep from the right storing the cost of each right side, then from the left
+					float rightCost[MESH_BVH_BINS];
+					D3DXVECTOR3 vMin = bins[MESH_BVH_BINS-1].vMin, vMax = bins[MESH_BVH_BINS-1].vMax;
+					int count = bins[MESH_BVH_BINS-1].Count;
+					for(int b=MESH_BVH_BINS-1; b>0; b--)
+					{
+						if(b<MESH_BVH_BINS-1)
+						{
+							BVHGrow(vMin, vMax, bins[b].vMin);
+							BVHGrow(vMin, vMax, bins[b].vMax);
+							count += bins[b].Count;
+						}
+						rightCost[b] = count ? BVHArea(vMin, vMax)*count : 0;
+					}
+					vMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+					vMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+					count = 0;
+					for(int b=0; b<MESH_BVH_BINS-1; b++)
+					{
+						BVHGrow(vMin, vMax, bins[b].vMin);
+						BVHGrow(vMin, vMax, bins[b].vMax);
+						count += bins[b].Count;
+						if(count==0 || count==task.Count)
+							continue;
+						float cost = BVHArea(vMin, vMax)*count + rightCost[b+1];
+						if(cost<bestCost)
+						{
+							bestCost = cost;
+							bestAxis = axis;
+							bestBin = b;
+						}
+					}
+				}
+			}
+
+			// Small nodes stay leaves unless a split is cheaper than testing them all,
+			// where traversing a node costs about as much as a triangle
+			float nodeArea = BVHArea(node.vMin, node.vMax);
+			if(task.Count==1 || (task.Count<=MESH_BVH_LEAF_TRIS && (bestAxis<0 || nodeArea + bestCost >= nodeArea*task.Count)))
+			{
+				node.Data = task.First*8 + task.Count;
+				continue;
+			}
+
+			// Split, in the middle when all the centroids are in one place
+			int mid = task.First + task.Count/2;
+			if(bestAxis>=0)
+			{
+				node.Data = bestAxis*8;
+				float lo = (&cMin.x)[bestAxis];
+				float binScale = MESH_BVH_BINS/((&cMax.x)[bestAxis] - lo);
+				int left = task.First, right = task.First+task.Count-1;
+				while(left<=right)
+				{
+					int b = min((int)(((&pCenter[pOrder[left]].x)[bestAxis]-lo)*binScale), MESH_BVH_BINS-1);
+					if(b<=bestBin)
+						left++;
+					else
+					{
+						int t = pOrder[left];
+						pOrder[left] = pOrder[right];
+						pOrder[right--] = t;
+					}
+				}
+				if(left>task.First && left<task.First+task.Count)
+					mid = left;
+			}
+
+			// Right goes on first so the left is made next
+			pStack[stackSize].First = mid;
+			pStack[stackSize++].Count = task.First+task.Count-mid;
+			pStack[stackSize].First = task.First;
+			pStack[stackSize++].Count = mid-task.First;
+		}
+
+		// Links, the node after a subtree is known for both children of a node once
+		// everything after it is done and the right child starts where the left ends
+		for(int i=numNodes-1; i>=0; i--)
+		{
+			if(pNodes[i].IsLeaf())
+				pEnd[i] = i+1;
+			else
+			{
+				int right = pEnd[i+1];
+				pEnd[i] = pEnd[right];
+				pNodes[i].Data |= right*32;
+				pNodes[i+1].Parent = i;
+				pNodes[right].Parent = i;
+			}
+		}
+
+		// Triangles in leaf order
+		m_Nodes.FromArray(pNodes, numNodes);
+		m_TriVerts.Allocate(numTris*3);
+		m_TriIds.Allocate(numTris);
+		for(int i=0; i<numTris; i++)
+		{
+			int t = pOrder[i];
+			m_TriIds[i] = t;
+			m_TriVerts[i*3] = pIndices[t*3];
+			m_TriVerts[i*3+1] = pIndices[t*3+1];
+			m_TriVerts[i*3+2] = pIndices[t*3+2];
+		}
+
+		delete[] pTriMin;
+		delete[] pTriMax;
+		delete[] pCenter;
+		delete[] pOrder;
+		delete[] pNodes;
+		delete[] pEnd;
+		delete[] pStack;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Takes the layout of another tree
+	//--------------------------------------------------------------------------------------
+	void MeshBVH::CopyFrom(MeshBVH& bvh)
+	{
+		Release();
+		m_Nodes.FromArray(bvh.m_Nodes, bvh.m_Nodes.Size());
+		m_TriVerts.FromArray(bvh.m_TriVerts, bvh.m_TriVerts.Size());
+		m_TriIds.FromArray(bvh.m_TriIds, bvh.m_TriIds.Size());
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Refits the boxes, children follow their parent so going backwards does them first
+	//--------------------------------------------------------------------------------------
+	void MeshBVH::Refit(const void* pVerts, UINT stride)
+	{
+		for(int i=m_Nodes.Size()-1; i>=0; i--)
+		{
+			MeshBVHNode& node = m_Nodes[i];
+			if(node.IsLeaf())
+			{
+				const DWORD* pTri = &m_TriVerts[node.FirstTri()*3];
+				node.vMin = node.vMax = BVHPos(pVerts, stride, pTri[0]);
+				for(int k=1; k<node.NumTris()*3; k++)
+					BVHGrow(node.vMin, node.vMax, BVHPos(pVerts, stride, pTri[k]));
+			}
+			else
+			{
+				const MeshBVHNode& left = m_Nodes[i+1];
+				const MeshBVHNode& right = m_Nodes[node.Right()];
+				node.vMin = left.vMin;
+				node.vMax = left.vMax;
+				BVHGrow(node.vMin, node.vMax, right.vMin);
+				BVHGrow(node.vMin, node.vMax, right.vMax);
+			}
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Slab test of one ray against a node, the bounds and the ray each fill an SSE
+	// register and the fourth lane is left out of the min and max
+	//--------------------------------------------------------------------------------------
+	static inline bool RayHitsNode(const MeshBVHNode& node, const __m128& vOrig, const __m128& vInvDir, float tMax)
+	{
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.vMin.x), vOrig), vInvDir);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.vMax.x), vOrig), vInvDir);
+		__m128 tNear = _mm_min_ps(t1, t2);
+		__m128 tFar = _mm_max_ps(t1, t2);
+		tNear = _mm_max_ss(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1,1,1,1)));
+		tNear = _mm_max_ss(tNear, _mm_movehl_ps(tNear, tNear));
+		tNear = _mm_max_ss(tNear, _mm_setzero_ps());
+		tFar = _mm_min_ss(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1,1,1,1)));
+		tFar = _mm_min_ss(tFar, _mm_movehl_ps(tFar, tFar));
+		tFar = _mm_min_ss(tFar, _mm_set_ss(tMax));
+		return _mm_comile_ss(tNear, tFar)!=0;
+	}
+
+	//--------------------------------------------------------------------------------------
+	// Two sided ray triangle test (Moller and Trumbore)
+	//--------------------------------------------------------------------------------------
+	static inline bool RayHitsTri(const D3DXVECTOR3& orig, const D3DXVECTOR3& dir, const D3DXVECTOR3& p0,
+		const D3DXVECTOR3& p1, const D3DXVECTOR3& p2, float& t, float& u, float& v)
+	{
+		D3DXVECTOR3 e1 = p1-p0, e2 = p2-p0;
+		D3DXVECTOR3 p(dir.y*e2.z - dir.z*e2.y, dir.z*e2.x - dir.x*e2.z, dir.x*e2.y - dir.y*e2.x);
+		float det = e1.x*p.x + e1.y*p.y + e1.z*p.z;
+		if(det==0)
+			return false;
+		float invDet = 1.0f/det;
+		D3DXVECTOR3 s = orig-p0;
+		u = (s.x*p.x + s.y*p.y + s.z*p.z)*invDet;
+		if(u<0 || u>1)
+			return false;
+		D3DXVECTOR3 q(s.y*e1.z - s.z*e1.y, s.z*e1.x - s.x*e1.z, s.x*e1.y - s.y*e1.x);
+		v = (dir.x*q.x + dir.y*q.y + dir.z*q.z)*invDet;
+		if(v<0 || u+v>1)
+			return false;
+		t = (e2.x*q.x + e2.y*q.y + e2.z*q.z)*invDet;
+		return true;
+	}
+
+	// Reciprocal that keeps axis aligned rays finite
+	static inline float SafeInverse(float d)
+	{
+		if(fabsf(d)<1e-30f)
+			d = d<0 ? -1e-30f : 1e-30f;
+		return 1.0f/d;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Tests the triangles of a leaf, keeping the closest hit
+	//--------------------------------------------------------------------------------------
+	static inline void RayHitsLeaf(const MeshBVHNode& node, const DWORD* pTriVerts, const void* pVerts, UINT stride,
+		const D3DXVECTOR3& orig, const D3DXVECTOR3& dir, MeshRayHit& hit, int& best)
+	{
+		int last = node.FirstTri()+node.NumTris();
+		for(int k=node.FirstTri(); k<last; k++)
+		{
+			float t, u, v;
+			const DWORD* pTri = pTriVerts + k*3;
+			if(RayHitsTri(orig, dir, BVHPos(pVerts, stride, pTri[0]), BVHPos(pVerts, stride, pTri[1]),
+				BVHPos(pVerts, stride, pTri[2]), t, u, v) && t>0 && t<hit.t)
+			{
+				hit.t = t;
+				hit.u = u;
+				hit.v = v;
+				best = k;
+			}
+		}
+	}
+
+	// Where the walk came from
+	enum BVH_WALK
+	{
+		BVH_FROM_PARENT,
+		BVH_FROM_SIBLING,
+		BVH_FROM_CHILD,
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Walks the tree for the closest hit.  Coming down from a parent the near child is
+	// tested and then its sibling, and going back up from the far child passes the
+	// parent without testing it again.  The near child is the one on the side of the
+	// split the ray points away from.
+	//--------------------------------------------------------------------------------------
+	bool MeshBVH::Intersect(const void* pVerts, UINT stride, const D3DXVECTOR3& orig, const D3DXVECTOR3& dir, float maxT, MeshRayHit& hit)
+	{
+		hit.t = maxT;
+		hit.u = hit.v = 0;
+		hit.Tri = hit.SubMesh = -1;
+		if(m_Nodes.Size()==0)
+			return false;
+
+		const __m128 vOrig = _mm_set_ps(0, orig.z, orig.y, orig.x);
+		const __m128 vInvDir = _mm_set_ps(0, SafeInverse(dir.z), SafeInverse(dir.y), SafeInverse(dir.x));
+		const MeshBVHNode* pNodes = m_Nodes;
+		const DWORD* pTriVerts = m_TriVerts;
+		const bool bNegative[3] = { dir.x<0, dir.y<0, dir.z<0 };
+		int best = -1;
+
+		if(!RayHitsNode(pNodes[0], vOrig, vInvDir, hit.t))
+			return false;
+		if(pNodes[0].IsLeaf())
+			RayHitsLeaf(pNodes[0], pTriVerts, pVerts, stride, orig, dir, hit, best);
+		else
+		{
+			int current = bNegative[pNodes[0].Axis()] ? pNodes[0].Right() : 1;
+			BVH_WALK state = BVH_FROM_PARENT;
+			while(true)
+			{
+				const MeshBVHNode& node = pNodes[current];
+				const int parent = node.Parent;
+				if(state==BVH_FROM_CHILD)
+				{
+					// On to the far child once the near one is done, otherwise keep going up
+					if(current==0)
+						break;
+					const int nearChild = bNegative[pNodes[parent].Axis()] ? pNodes[parent].Right() : parent+1;
+					if(current==nearChild)
+					{
+						current = (current==parent+1) ? pNodes[parent].Right() : parent+1;
+						state = BVH_FROM_SIBLING;
+					}
+					else
+						current = parent;
+					continue;
+				}
+
+				// Down into the near child of a hit, past a miss or a leaf to the sibling,
+				// or back up once the far child is done
+				bool bHit = RayHitsNode(node, vOrig, vInvDir, hit.t);
+				if(bHit && !node.IsLeaf())
+				{
+					current = bNegative[node.Axis()] ? node.Right() : current+1;
+					state = BVH_FROM_PARENT;
+					continue;
+				}
+				if(bHit)
+					RayHitsLeaf(node, pTriVerts, pVerts, stride, orig, dir, hit, best);
+				if(state==BVH_FROM_PARENT)
+				{
+					current = (current==parent+1) ? pNodes[parent].Right() : parent+1;
+					state = BVH_FROM_SIBLING;
+				}
+				else
+				{
+					current = parent;
+					state = BVH_FROM_CHILD;
+				}
+			}
+		}
+		if(best<0)
+			return false;
+		hit.Tri = m_TriIds[best];
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Batches of rays
+	//--------------------------------------------------------------------------------------
+	struct BVHRayBatch
+	{
+		MeshBVH*			pBVH;
+		const void*			pVerts;
+		UINT				Stride;
+		const D3DXVECTOR3*	pOrig;
+		const D3DXVECTOR3*	pDir;
+		float				MaxT;
+		MeshRayHit*			pHits;
+	};
+
+	static void BVHRayJob(int start, int end, void* pData)
+	{
+		BVHRayBatch& batch = *(BVHRayBatch*)pData;
+		for(int i=start; i<end; i++)
+			batch.pBVH->Intersect(batch.pVerts, batch.Stride, batch.pOrig[i], batch.pDir[i], batch.MaxT, batch.pHits[i]);
+	}
+
+	int MeshBVH::IntersectBatch(const void* pVerts, UINT stride, const D3DXVECTOR3* pOrig, const D3DXVECTOR3* pDir, int numRays, float maxT, MeshRayHit* pHits)
+	{
+		BVHRayBatch batch = { this, pVerts, stride, pOrig, pDir, maxT, pHits };
+		g_ThreadPool.ParallelFor(numRays, BVHRayJob, &batch, MESH_BVH_RAY_BAND);
+		int numHits = 0;
+		for(int i=0; i<numRays; i++)
+			if(pHits[i].Tri>=0)
+				numHits++;
+		return numHits;
+	}
+}
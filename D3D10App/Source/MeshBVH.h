@@ -0,0 +1,93 @@
+//--------------------------------------------------------------------------------------
+// File: MeshBVH.h
+//
+// Bounding volume hierarchy over the triangles of a mesh for ray picking.  It is built
+// with the surface area heuristic over binned centroids.  Rays walk it without a stack
+// by following parent links (Hapala, Davidovic, Wald, Havran and Slusallek, "Efficient
+// Stack-less BVH Traversal for Ray Tracing"), still visiting the nearer child first.
+// Skinned meshes keep a copy whose boxes are refit to the current pose instead of
+// building a new tree.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+
+namespace Core
+{
+
+// Most triangles in a leaf, the node packs the count in three bits
+#define MESH_BVH_LEAF_TRIS 4
+
+// Centroid bins tried along each axis for a split
+#define MESH_BVH_BINS 16
+
+// Batches with at least this many rays for each band go to the thread pool
+#define MESH_BVH_RAY_BAND 64
+
+	// A node, 32 bytes so the bounds load straight into SSE registers.  Nodes are
+	// stored depth first, so the left child follows its parent.
+	struct MeshBVHNode
+	{
+		D3DXVECTOR3	vMin;
+		int			Parent;		// -1 for the root
+		D3DXVECTOR3	vMax;
+		int			Data;		// Leaf: first triangle*8 + count, inner: right child*32 + split axis*8
+
+		inline bool IsLeaf() const { return (Data&7)!=0; }
+		inline int FirstTri() const { return Data>>3; }
+		inline int NumTris() const { return Data&7; }
+		inline int Right() const { return Data>>5; }
+		inline int Axis() const { return (Data>>3)&3; }
+	};
+
+	// The closest hit of a ray
+	struct MeshRayHit
+	{
+		float	t;			// Distance along the ray direction
+		float	u, v;		// Barycentric coords of the hit
+		int		Tri;		// Triangle in the source index list, -1 for a miss
+		int		SubMesh;	// Filled in by RayIntersectMesh, -1 here
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Triangle BVH, positions are the first three floats of each vertex
+	//--------------------------------------------------------------------------------------
+	class MeshBVH
+	{
+	public:
+		MeshBVH();
+
+		// Frees the tree
+		void Release();
+
+		// Builds the tree over a triangle list
+		bool Build(const void* pVerts, UINT stride, int numVerts, const DWORD* pIndices, int numIndices);
+
+		// Takes the layout of another tree, to be refit to other positions
+		void CopyFrom(MeshBVH& bvh);
+
+		// Recomputes the boxes bottom up for moved vertices, the tree stays the same
+		void Refit(const void* pVerts, UINT stride);
+
+		// Closest hit with t in (0, maxT), returns false for a miss
+		bool Intersect(const void* pVerts, UINT stride, const D3DXVECTOR3& orig, const D3DXVECTOR3& dir, float maxT, MeshRayHit& hit);
+
+		// Traces a batch of rays on the thread pool, returns the number that hit
+		int IntersectBatch(const void* pVerts, UINT stride, const D3DXVECTOR3* pOrig, const D3DXVECTOR3* pDir, int numRays, float maxT, MeshRayHit* pHits);
+
+		inline bool IsBuilt(){ return m_Nodes.Size()>0; }
+		inline int GetNumNodes(){ return m_Nodes.Size(); }
+		inline int GetNumTris(){ return m_TriIds.Size(); }
+		inline UINT GetMemoryUsage(){ return m_Nodes.Size()*sizeof(MeshBVHNode) + m_TriIds.Size()*sizeof(DWORD)*4; }
+
+	private:
+		Array<MeshBVHNode>	m_Nodes;		// Depth first, the root is first
+		Array<DWORD>		m_TriVerts;		// Vertex indices of the triangles in leaf order
+		Array<DWORD>		m_TriIds;		// Source triangle of each
+	};
+
+}
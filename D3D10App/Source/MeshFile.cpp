@@ -0,0 +1,275 @@
+//--------------------------------------------------------------------------------------
+// File: MeshFile.cpp
+//
+// Binary mesh cache
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "MeshFile.h"
+#include <float.h>
+
+namespace Core
+{
+
+// Tables and streams start on this boundary
+#define MESH_FILE_ALIGN 16
+
+	static inline UINT AlignOffset(UINT offset){ return (offset + MESH_FILE_ALIGN-1) & ~(MESH_FILE_ALIGN-1); }
+
+	// FNV-1a
+	static const ULONGLONG FNV_OFFSET = 14695981039346656037ull;
+	static const ULONGLONG FNV_PRIME = 1099511628211ull;
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	MeshFile::MeshFile()
+	{
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+		m_pView = NULL;
+		m_pHeader = NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Hashes a source file
+	//--------------------------------------------------------------------------------------
+	bool MeshFile::HashFile(const char* szFile, ULONGLONG& hash, ULONGLONG& size)
+	{
+		FILE* fp = fopen(szFile, "rb");
+		if(!fp)
+			return false;
+
+		static const int bufferSize = 65536;
+		BYTE* pBuffer = new BYTE[bufferSize];
+		hash = FNV_OFFSET;
+		size = 0;
+		size_t bytes;
+		while((bytes = fread(pBuffer, 1, bufferSize, fp)) > 0)
+		{
+			for(size_t i=0; i<bytes; i++)
+				hash = (hash ^ pBuffer[i]) * FNV_PRIME;
+			size += bytes;
+		}
+		bool ok = (ferror(fp)==0);
+		fclose(fp);
+		delete[] pBuffer;
+		return ok;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Writes padding up to an offset and then the data
+	//--------------------------------------------------------------------------------------
+	static void WriteAt(FILE* fp, UINT& pos, UINT offset, const void* pData, UINT bytes)
+	{
+		static const BYTE pad[MESH_FILE_ALIGN] = { 0 };
+		fwrite(pad, offset-pos, 1, fp);
+		fwrite(pData, bytes, 1, fp);
+		pos = offset + bytes;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Builds the position stream and bounds and writes the file
+	//--------------------------------------------------------------------------------------
+	bool MeshFile::Write(const char* szFile, const MeshFileDesc& desc)
+	{
+		// Only write what Open will take back
+		for(int i=0; i<desc.NumIndices; i++)
+			if(desc.pIndices[i]>=(DWORD)desc.NumVerts)
+			{
+				Log::Print("MeshFile::Write() index %d is past the vertices> %s", i, szFile);
+				return false;
+			}
+		for(int s=0; s<desc.NumSubMeshes; s++)
+			if(desc.pSubMeshes[s].StartIndex+desc.pSubMeshes[s].NumIndices>(DWORD)desc.NumIndices ||
+				desc.pSubMeshes[s].Material>=(DWORD)max(desc.NumMaterials, 1))
+			{
+				Log::Print("MeshFile::Write() submesh %d is out of range> %s", s, szFile);
+				return false;
+			}
+		int totalIndices = desc.NumIndices + desc.NumLodIndices;
+		if(desc.NumLods<0 || desc.NumLods>MESH_FILE_MAX_LODS)
+		{
+			Log::Print("MeshFile::Write() too many levels of detail> %s", szFile);
+			return false;
+		}
+		for(int i=0; i<desc.NumLodIndices; i++)
+			if(desc.pLodIndices[i]>=(DWORD)desc.NumVerts)
+			{
+				Log::Print("MeshFile::Write() level of detail index %d is past the vertices> %s", i, szFile);
+				return false;
+			}
+		for(int l=0; l<desc.NumSubMeshes*desc.NumLods; l++)
+			if(desc.pLods[l].StartIndex+desc.pLods[l].NumIndices>(DWORD)totalIndices)
+			{
+				Log::Print("MeshFile::Write() level of detail %d is out of range> %s", l, szFile);
+				return false;
+			}
+
+		MeshFileHeader header;
+		memset(&header, 0, sizeof(MeshFileHeader));
+		header.Magic = MESH_FILE_MAGIC;
+		header.Version = MESH_FILE_VERSION;
+		header.SourceHash = desc.SourceHash;
+		header.SourceSize = desc.SourceSize;
+		header.NumVerts = desc.NumVerts;
+		header.NumIndices = desc.NumIndices;
+		header.NumSubMeshes = desc.NumSubMeshes;
+		header.NumMaterials = desc.NumMaterials;
+		header.NumLods = desc.NumLods;
+		header.NumLodIndices = desc.NumLodIndices;
+		memcpy(header.LodError, desc.LodError, sizeof(header.LodError));
+		header.SubMeshOffset = AlignOffset(sizeof(MeshFileHeader));
+		header.MaterialOffset = AlignOffset(header.SubMeshOffset + desc.NumSubMeshes*sizeof(MeshFileSubMesh));
+		header.VertexOffset = AlignOffset(header.MaterialOffset + desc.NumMaterials*sizeof(MeshFileMaterial));
+		header.PosOffset = AlignOffset(header.VertexOffset + desc.NumVerts*sizeof(Vertex));
+		header.IndexOffset = AlignOffset(header.PosOffset + desc.NumVerts*sizeof(PosVertex));
+		header.LodOffset = AlignOffset(header.IndexOffset + totalIndices*sizeof(DWORD));
+
+		// Positions and bounds
+		PosVertex* pPos = new PosVertex[desc.NumVerts];
+		header.BoundMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+		header.BoundMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int i=0; i<desc.NumVerts; i++)
+		{
+			pPos[i].pos = desc.pVerts[i].pos;
+			pPos[i].pad = 0;
+			D3DXVec3Minimize(&header.BoundMin, &header.BoundMin, &pPos[i].pos);
+			D3DXVec3Maximize(&header.BoundMax, &header.BoundMax, &pPos[i].pos);
+		}
+		MeshFileSubMesh* pSubMeshes = new MeshFileSubMesh[desc.NumSubMeshes];
+		for(int s=0; s<desc.NumSubMeshes; s++)
+		{
+			MeshFileSubMesh& sub = pSubMeshes[s];
+			sub = desc.pSubMeshes[s];
+			sub.BoundMin = D3DXVECTOR3(FLT_MAX, FLT_MAX, FLT_MAX);
+			sub.BoundMax = D3DXVECTOR3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for(DWORD i=sub.StartIndex; i<sub.StartIndex+sub.NumIndices; i++)
+			{
+				D3DXVec3Minimize(&sub.BoundMin, &sub.BoundMin, &pPos[desc.pIndices[i]].pos);
+				D3DXVec3Maximize(&sub.BoundMax, &sub.BoundMax, &pPos[desc.pIndices[i]].pos);
+			}
+		}
+
+		// Write it all out in order, padding up to each offset
+		bool ok = false;
+		FILE* fp = fopen(szFile, "wb");
+		if(fp)
+		{
+			UINT pos = 0;
+			WriteAt(fp, pos, 0, &header, sizeof(MeshFileHeader));
+			WriteAt(fp, pos, header.SubMeshOffset, pSubMeshes, desc.NumSubMeshes*sizeof(MeshFileSubMesh));
+			WriteAt(fp, pos, header.MaterialOffset, desc.pMaterials, desc.NumMaterials*sizeof(MeshFileMaterial));
+			WriteAt(fp, pos, header.VertexOffset, desc.pVerts, desc.NumVerts*sizeof(Vertex));
+			WriteAt(fp, pos, header.PosOffset, pPos, desc.NumVerts*sizeof(PosVertex));
+			WriteAt(fp, pos, header.IndexOffset, desc.pIndices, desc.NumIndices*sizeof(DWORD));
+			WriteAt(fp, pos, pos, desc.pLodIndices, desc.NumLodIndices*sizeof(DWORD));
+			WriteAt(fp, pos, header.LodOffset, desc.pLods, desc.NumSubMeshes*desc.NumLods*sizeof(MeshFileLOD));
+			ok = (ferror(fp)==0);
+			fclose(fp);
+		}
+		if(!ok)
+			Log::Print("MeshFile::Write() failed writing> %s", szFile);
+
+		delete[] pPos;
+		delete[] pSubMeshes;
+		return ok;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Maps the whole file and checks it against the source and itself
+	//--------------------------------------------------------------------------------------
+	bool MeshFile::Open(const char* szFile, ULONGLONG sourceHash, ULONGLONG sourceSize)
+	{
+		Close();
+
+		m_hFile = CreateFileA(szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if(m_hFile==INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(m_hFile, &size) || size.QuadPart<(LONGLONG)sizeof(MeshFileHeader))
+		{
+			Close();
+			return false;
+		}
+		ULONGLONG fileSize = size.QuadPart;
+
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(m_hMapping)
+			m_pView = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if(!m_pView)
+		{
+			Log::Print("Mesh cache failed to map> %s", szFile);
+			Close();
+			return false;
+		}
+
+		// A different source is a stale cache, not an error
+		m_pHeader = (const MeshFileHeader*)m_pView;
+		const MeshFileHeader& h = *m_pHeader;
+		if(h.Magic!=MESH_FILE_MAGIC || h.Version!=MESH_FILE_VERSION || h.SourceHash!=sourceHash || h.SourceSize!=sourceSize)
+		{
+			Close();
+			return false;
+		}
+
+		// Tables and streams inside the file, then every reference inside its table.  Sizes
+		// are worked out in 64 bits, a damaged count must not wrap around to a small one.
+		ULONGLONG totalIndices = (ULONGLONG)h.NumIndices + h.NumLodIndices;
+		ULONGLONG numLodEntries = (ULONGLONG)h.NumSubMeshes*h.NumLods;
+		bool valid = h.NumVerts>0 && h.NumIndices%3==0 && h.NumLodIndices%3==0 && h.NumLods<=MESH_FILE_MAX_LODS &&
+			(ULONGLONG)h.SubMeshOffset + (ULONGLONG)h.NumSubMeshes*sizeof(MeshFileSubMesh) <= fileSize &&
+			(ULONGLONG)h.MaterialOffset + (ULONGLONG)h.NumMaterials*sizeof(MeshFileMaterial) <= fileSize &&
+			(ULONGLONG)h.VertexOffset + (ULONGLONG)h.NumVerts*sizeof(Vertex) <= fileSize &&
+			(ULONGLONG)h.PosOffset + (ULONGLONG)h.NumVerts*sizeof(PosVertex) <= fileSize &&
+			(ULONGLONG)h.IndexOffset + totalIndices*sizeof(DWORD) <= fileSize &&
+			(ULONGLONG)h.LodOffset + numLodEntries*sizeof(MeshFileLOD) <= fileSize;
+		for(DWORD i=0; i<h.NumSubMeshes && valid; i++)
+		{
+			const MeshFileSubMesh& sub = GetSubMeshes()[i];
+			valid = sub.StartIndex<=h.NumIndices && sub.NumIndices<=h.NumIndices-sub.StartIndex && sub.Material<max(h.NumMaterials, (DWORD)1);
+		}
+		for(ULONGLONG i=0; i<numLodEntries && valid; i++)
+		{
+			const MeshFileLOD& lod = GetLods()[i];
+			valid = lod.StartIndex<=totalIndices && lod.NumIndices<=totalIndices-lod.StartIndex;
+		}
+		const DWORD* pIndices = valid ? GetIndices() : NULL;
+		for(ULONGLONG i=0; i<totalIndices && valid; i++)
+			valid = pIndices[i]<h.NumVerts;
+		if(!valid)
+		{
+			Log::Print("Invalid mesh cache> %s", szFile);
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Unmaps and closes the file
+	//--------------------------------------------------------------------------------------
+	void MeshFile::Close()
+	{
+		if(m_pView)
+			UnmapViewOfFile(m_pView);
+		if(m_hMapping)
+			CloseHandle(m_hMapping);
+		if(m_hFile!=INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+		m_pView = NULL;
+		m_pHeader = NULL;
+	}
+}
@@ -0,0 +1,135 @@
+//--------------------------------------------------------------------------------------
+// File: MeshFile.h
+//
+// Binary mesh cache.  The first load of a mesh goes through D3DX as before, and the
+// result, already optimized and centered, is written next to the source with the
+// submesh table, material references, bounds, levels of detail and the vertex,
+// position and index streams the buffers are created from.  Later loads map the file and hand the
+// streams straight to the device.  The cache keeps a hash of the source file, so an
+// edited mesh is cooked again.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Vertex.h"
+
+namespace Core
+{
+
+#define MESH_FILE_MAGIC		0x314D4350	// "PCM1"
+#define MESH_FILE_VERSION	3
+#define MESH_FILE_NAME		128
+#define MESH_FILE_MAX_LODS	4
+
+// Added to the source name for the cache
+#define MESH_CACHE_EXTENSION ".cache"
+
+	// Header at the start of the file, streams and tables start on 16 bytes
+	struct MeshFileHeader
+	{
+		DWORD		Magic;
+		DWORD		Version;
+		ULONGLONG	SourceHash;		// FNV-1a of the source file
+		ULONGLONG	SourceSize;
+		DWORD		NumVerts;
+		DWORD		NumIndices;
+		DWORD		NumSubMeshes;
+		DWORD		NumMaterials;
+		DWORD		NumLods;		// Reduced levels of each submesh
+		DWORD		NumLodIndices;	// Indices of the levels, after the full mesh
+		float		LodError[MESH_FILE_MAX_LODS];	// Error of each level as a part of the mesh radius
+		D3DXVECTOR3	BoundMin;
+		D3DXVECTOR3	BoundMax;
+		DWORD		SubMeshOffset;	// MeshFileSubMesh table
+		DWORD		MaterialOffset;	// MeshFileMaterial table
+		DWORD		VertexOffset;	// Vertex stream
+		DWORD		PosOffset;		// PosVertex stream
+		DWORD		IndexOffset;	// DWORD indices
+		DWORD		LodOffset;		// MeshFileLOD table, the levels of each submesh in turn
+	};
+
+	// A submesh and its bounds
+	struct MeshFileSubMesh
+	{
+		DWORD		StartIndex;
+		DWORD		NumIndices;
+		DWORD		Material;		// Index into the material table, 0 if it is empty
+		D3DXVECTOR3	BoundMin;
+		D3DXVECTOR3	BoundMax;
+	};
+
+	// A reduced level of a submesh, in the whole index stream
+	struct MeshFileLOD
+	{
+		DWORD		StartIndex;
+		DWORD		NumIndices;
+	};
+
+	// What the mesh asked for in a material, materials are still made at load
+	struct MeshFileMaterial
+	{
+		D3DXVECTOR4	Diffuse;
+		float		Power;
+		char		Texture[MESH_FILE_NAME];	// Empty if none, as named in the source
+	};
+
+	// Everything needed to write a file
+	struct MeshFileDesc
+	{
+		ULONGLONG				SourceHash;
+		ULONGLONG				SourceSize;
+		const Vertex*			pVerts;
+		int						NumVerts;
+		const DWORD*			pIndices;
+		int						NumIndices;
+		const MeshFileSubMesh*	pSubMeshes;		// Bounds are filled in by Write
+		int						NumSubMeshes;
+		const MeshFileMaterial*	pMaterials;
+		int						NumMaterials;
+		const DWORD*			pLodIndices;	// Written after pIndices
+		int						NumLodIndices;
+		const MeshFileLOD*		pLods;			// NumLods for each submesh
+		int						NumLods;
+		float					LodError[MESH_FILE_MAX_LODS];
+		MeshFileDesc(){ memset(this, 0, sizeof(MeshFileDesc)); }
+	};
+
+
+	class MeshFile
+	{
+	public:
+		MeshFile();
+		~MeshFile(){ Close(); }
+
+		// Builds the position stream and bounds and writes the file
+		static bool Write(const char* szFile, const MeshFileDesc& desc);
+
+		// Hashes a source file with FNV-1a
+		static bool HashFile(const char* szFile, ULONGLONG& hash, ULONGLONG& size);
+
+		// Maps a file and checks its tables.  Fails quietly if the file is missing or was
+		// cooked from a different source.
+		bool Open(const char* szFile, ULONGLONG sourceHash, ULONGLONG sourceSize);
+		void Close();
+
+		// Properties, the pointers are into the mapping and valid until Close
+		inline bool IsOpen(){ return m_pView!=NULL; }
+		inline const MeshFileHeader& GetHeader(){ return *m_pHeader; }
+		inline const MeshFileSubMesh* GetSubMeshes(){ return (const MeshFileSubMesh*)(m_pView + m_pHeader->SubMeshOffset); }
+		inline const MeshFileMaterial* GetMaterials(){ return (const MeshFileMaterial*)(m_pView + m_pHeader->MaterialOffset); }
+		inline const Vertex* GetVerts(){ return (const Vertex*)(m_pView + m_pHeader->VertexOffset); }
+		inline const PosVertex* GetPosVerts(){ return (const PosVertex*)(m_pView + m_pHeader->PosOffset); }
+		inline const DWORD* GetIndices(){ return (const DWORD*)(m_pView + m_pHeader->IndexOffset); }
+		inline const MeshFileLOD* GetLods(){ return (const MeshFileLOD*)(m_pView + m_pHeader->LodOffset); }
+
+	private:
+
+		HANDLE					m_hFile;
+		HANDLE					m_hMapping;
+		const BYTE*				m_pView;
+		const MeshFileHeader*	m_pHeader;
+	};
+
+}
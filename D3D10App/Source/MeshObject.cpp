@@ -10,8 +10,8 @@
 #include "stdafx.h"
 #include "MeshObject.h"
 #include "Log.h"
-#include "AllocateHierarchy.h"
 #include "Mesh.h"
+#include "ThreadPool.h"
 
 namespace Core
 {
@@ -25,12 +25,20 @@ namespace Core
 		m_vRot = D3DXVECTOR3(0.0f,0.0f,0.0f);
 		m_vPos = D3DXVECTOR3(0.0f,0.0f,0.0f);
 		m_vScale = D3DXVECTOR3(1,1,1);
-		m_pRootFrame = NULL;
-		m_pAnimCtrl = NULL;
+		m_pSkeleton = NULL;
 		m_FrameTime = 0;
 		m_bSkinnedMesh = false;
+		m_MaxVertInfluences = 0;
+		m_bAnimating = false;
+		m_bPoseDirty = false;
+		m_FadeTime = m_FadeDuration = 0;
+		for(int i=0; i<ANIM_MAX_LAYERS; i++)
+			m_AnimLayers[i].Clip = -1;
+		m_PoseVersion = 1;
+		m_PickVersion = 0;
 		m_bCubeMap = false;
 		m_bHide = false;
+		m_bPending = false;
 		isUpdating=false;
 	}
 
@@ -47,6 +55,7 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void MeshObject::Release()
 	{
+		m_bPending = false;
 		if(m_pMesh)
 		{
 			// Release the materials
@@ -56,14 +65,14 @@ namespace Core
 			m_pSubMesh.Release();
 
 			// Skinned mesh data
-			if( m_pRootFrame )
-			{
-				AllocateHierarchy allocMeshHierarchy;
-				D3DXFrameDestroy(m_pRootFrame, &allocMeshHierarchy);
-				m_pRootFrame = NULL;
-			}
-			SAFE_RELEASE(m_pAnimCtrl);
+			m_pSkeleton = NULL;
+			m_bSkinnedMesh = false;
+			m_bAnimating = false;
 			m_FinalTransforms.Release();
+			m_ModelTransforms.Release();
+			m_PoseBVH.Release();
+			m_PosePositions.Release();
+			m_PickVersion = 0;
 			
 			// Deref the model pointer
 			g_Meshes.Deref(m_pMesh);
@@ -96,10 +105,92 @@ namespace Core
 
 		// Position the model
 		m_vPos = D3DXVECTOR3(0, 0, 0);
+		SetupFromMesh();
+		m_szName = GetFileFromPath(RemoveFileExtension(String(m_pMesh->GetName())));
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Streams an object model in
+	//--------------------------------------------------------------------------------------
+	bool MeshObject::LoadAsync(const char* file, float priority)
+	{
+		// Reset the object
+		if(m_pMesh)
+			Release();
+
+		// The mesh may only be a placeholder
+		m_pMesh = g_Meshes.LoadAsync(file, priority);
+		if(!m_pMesh)
+		{
+			Log::Print("<!>Invalid Model file!! (%s)",file);
+			return false;
+		}
+		m_vPos = D3DXVECTOR3(0, 0, 0);
+		m_szName = GetFileFromPath(RemoveFileExtension(String(file)));
+		m_bPending = true;
+		FinishLoad();
+		return true;
+	}
 
+
+	//--------------------------------------------------------------------------------------
+	// Sets the object up once its mesh is resident, returns true when it is ready
+	//--------------------------------------------------------------------------------------
+	bool MeshObject::FinishLoad()
+	{
+		if(!m_bPending)
+			return m_pMesh!=NULL;
+		if(!m_pMesh->IsResident())
+			return false;
+		m_bPending = false;
+		if(m_pMesh->GetNumSubMesh()==0)
+			Log::Print("<!> MeshObject %s streamed in empty", m_szName.c_str());
+		SetupFromMesh();
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Marks the mesh and its textures used this frame
+	//--------------------------------------------------------------------------------------
+	void MeshObject::TouchResources(const D3DXVECTOR3& vEye)
+	{
+		if(m_bPending || !m_pMesh)
+			return;
+		D3DXVECTOR3 vDist = m_vPos - vEye;
+		float dist = max(D3DXVec3Length(&vDist) - m_Radius, 0.0f);
+		g_Meshes.Touch(m_pMesh, dist);
+		for(int i=0; i<m_pSubMesh.Size(); i++)
+			if(m_pSubMesh[i].pMaterial)
+				m_pSubMesh[i].pMaterial->TouchTextures(dist);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// The submeshes hold copies of the mesh buffers, which change when the residency
+	// manager evicts the mesh and when it streams back in
+	//--------------------------------------------------------------------------------------
+	bool MeshObject::SyncBuffers()
+	{
+		if(m_bPending || !m_pMesh || !m_pSubMesh.Size())
+			return false;
+		if(m_pSubMesh[0].pVertexBuffer==m_pMesh->GetSubMesh(0)->pVertexBuffer)
+			return false;
+		UpdateSubMeshes();
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sets up the submeshes, materials and bounds over a loaded mesh
+	//--------------------------------------------------------------------------------------
+	void MeshObject::SetupFromMesh()
+	{
 		// Get the animation data
 		if(m_pMesh->m_bSkinned)
-			CloneAnimationData(const_cast<char*>(file));
+			SetupAnimation();
 
 		// Setup the initial world matrix
 		D3DXMatrixTranslation(&m_matT,m_vPos.x,m_vPos.y,m_vPos.z);
@@ -123,188 +214,200 @@ namespace Core
 			m_pSubMesh[i].isSkinned = IsSkinned();
 			m_pSubMesh[i].pAnimMatrices = &m_FinalTransforms;
 		}
-		m_szName = GetFileFromPath(RemoveFileExtension(String(m_pMesh->GetName())));
-
 
 		// Compute the mesh bounds
 		ComputeBounds();
-
-		return true;
 	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Get the animation data
+	// Sets the object up to animate off the skeleton of its mesh, in the bind pose
 	//--------------------------------------------------------------------------------------
-	void MeshObject::CloneAnimationData(char* file)
+	void MeshObject::SetupAnimation()
 	{
-		// Load in the mesh from the file
-		AllocateHierarchy allocMeshHierarchy;
-		HRESULT hr = D3DXLoadMeshHierarchyFromXA(   file, 
-													D3DXMESH_SYSTEMMEM,
-													g_pd3dDevice9, 
-													&allocMeshHierarchy, 
-													0,
-													&m_pRootFrame,	
-													&m_pAnimCtrl );
-		if(FAILED(hr))
-		{
-			MessageBoxA(NULL, "Couldn't load animation data", "Load Fail", MB_OK);
+		Skeleton& skeleton = m_pMesh->GetSkeleton();
+		if(!skeleton.IsBuilt())
 			return;
-		}
-
-
-		// Now setup the bones
-		SetupBoneMatrixPointers( m_pRootFrame );
-
-		// Find the mesh node	
-		D3DXFRAME* f = FindNodeWithMesh(m_pRootFrame);
-		m_pMeshContainer = (D3DXMESHCONTAINER_DERIVED*)f->pMeshContainer;
-		m_pMeshContainer->pSkinInfo->GetMaxVertexInfluences(&m_MaxVertInfluences);
-
-		// Setup the matrices
-		m_FinalTransforms.Allocate(m_pMeshContainer->pSkinInfo->GetNumBones());
-		SAFE_RELEASE(m_pMeshContainer->pOrigMesh);
-		SAFE_RELEASE(m_pMeshContainer->MeshData.pMesh);
-
+		m_pSkeleton = &skeleton;
+		m_MaxVertInfluences = skeleton.GetMaxVertInfluences();
+		m_FinalTransforms.Allocate(skeleton.GetNumBones());
+		m_ModelTransforms.Allocate(skeleton.GetNumNodes());
 		m_bSkinnedMesh = true;
+
 		AnimationPause();
+		m_bPoseDirty = true;
+		PoseAnimation();
 	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Update the frame matrices
+	// Plays a clip on the first layer.  With a fade time the clip playing moves to the
+	// second layer and fades out while the new one fades in.
 	//--------------------------------------------------------------------------------------
-	void MeshObject::UpdateFrameMatrices( LPD3DXFRAME pFrameBase, LPD3DXMATRIX pParentMatrix )
+	void MeshObject::AnimationPlay(int index, float fadeTime)
 	{
-		D3DXFRAME_DERIVED *pFrame = (D3DXFRAME_DERIVED*)pFrameBase;
-
-		if (pParentMatrix != NULL)
-			D3DXMatrixMultiply(&pFrame->CombinedTransformationMatrix, &pFrame->TransformationMatrix, pParentMatrix);
-		else
-			pFrame->CombinedTransformationMatrix = pFrame->TransformationMatrix;
-
-		if (pFrame->pFrameSibling != NULL)
-		{
-			UpdateFrameMatrices(pFrame->pFrameSibling, pParentMatrix);
-		}
-
-		if (pFrame->pFrameFirstChild != NULL)
+		if(!m_pSkeleton || index<0 || index>=m_pSkeleton->GetNumClips())
+			return;
+		AnimLayer& layer = m_AnimLayers[0];
+		if(layer.Clip!=index)
 		{
-			UpdateFrameMatrices(pFrame->pFrameFirstChild, &pFrame->CombinedTransformationMatrix);
+			if(fadeTime>0 && layer.Clip>=0 && m_bAnimating)
+			{
+				m_AnimLayers[1] = layer;
+				m_FadeTime = 0;
+				m_FadeDuration = fadeTime;
+				layer.Weight = 0;
+			}
+			else
+			{
+				m_AnimLayers[1].Clip = -1;
+				m_FadeDuration = 0;
+				layer.Weight = 1;
+			}
+			layer.Clip = index;
+			layer.Time = 0;
 		}
+		layer.Speed = 1;
+		layer.bLoop = true;
+		m_bAnimating = true;
+		m_bPoseDirty = true;
 	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Finds the node that contains mesh data
+	// Stops the layers, the pose is held and the clips start over when played again
 	//--------------------------------------------------------------------------------------
-	D3DXFRAME* MeshObject::FindNodeWithMesh(D3DXFRAME* frame)
+	void MeshObject::AnimationPause()
 	{
-		// In this demo we stipulate that the input .X file contains only one
-		// mesh.  So search for that one and only mesh.
-
-		if( frame->pMeshContainer )
-			if( frame->pMeshContainer->MeshData.pMesh != 0 )
-				return frame;
-
-		D3DXFRAME* f = 0;
-		if(frame->pFrameSibling)
-			if( f = FindNodeWithMesh(frame->pFrameSibling) )	
-				return f;
-
-		if(frame->pFrameFirstChild)
-			if( f = FindNodeWithMesh(frame->pFrameFirstChild) )
-				return f;
-
-		return 0;
+		for(int i=0; i<ANIM_MAX_LAYERS; i++)
+		{
+			m_AnimLayers[i].Clip = -1;
+			m_AnimLayers[i].Time = 0;
+			m_AnimLayers[i].Speed = 1;
+			m_AnimLayers[i].Weight = 0;
+			m_AnimLayers[i].bLoop = true;
+		}
+		m_FadeTime = m_FadeDuration = 0;
+		m_bAnimating = false;
 	}
 
+
 	//--------------------------------------------------------------------------------------
-	// Called to setup the pointers for a given bone to its transformation matrix
+	// Moves the layers along their clips and the cross fade between them
 	//--------------------------------------------------------------------------------------
-	HRESULT MeshObject::SetupBoneMatrixPointersOnMesh( LPD3DXMESHCONTAINER pMeshContainerBase )
+	void MeshObject::AdvanceAnimation(float elapsed)
 	{
-		UINT iBone, cBones;
-		D3DXFRAME_DERIVED *pFrame;
-
-		D3DXMESHCONTAINER_DERIVED *pMeshContainer = (D3DXMESHCONTAINER_DERIVED*)pMeshContainerBase;
-
-		// if there is a skinmesh, then setup the bone matrices
-		if (pMeshContainer->pSkinInfo != NULL)
+		if(!m_pSkeleton || !m_bAnimating)
+			return;
+		for(int i=0; i<ANIM_MAX_LAYERS; i++)
+			if(m_AnimLayers[i].Clip>=0)
+				m_pSkeleton->AdvanceLayer(m_AnimLayers[i], elapsed);
+		if(m_FadeDuration>0)
 		{
-			cBones = pMeshContainer->pSkinInfo->GetNumBones();
-
-			pMeshContainer->ppBoneMatrixPtrs = new D3DXMATRIX*[cBones];
-			if (pMeshContainer->ppBoneMatrixPtrs == NULL)
-				return E_OUTOFMEMORY;
-
-			for (iBone = 0; iBone < cBones; iBone++)
+			m_FadeTime += elapsed;
+			float fade = min(m_FadeTime/m_FadeDuration, 1.0f);
+			m_AnimLayers[0].Weight = fade;
+			m_AnimLayers[1].Weight = 1.0f-fade;
+			if(fade>=1.0f)
 			{
-				pFrame = (D3DXFRAME_DERIVED*)D3DXFrameFind( m_pRootFrame, pMeshContainer->pSkinInfo->GetBoneName(iBone) );
-				if (pFrame == NULL)
-					return E_FAIL;
-
-				pMeshContainer->ppBoneMatrixPtrs[iBone] = &pFrame->CombinedTransformationMatrix;
+				m_AnimLayers[1].Clip = -1;
+				m_FadeDuration = 0;
 			}
 		}
-
-		return S_OK;
+		m_bPoseDirty = true;
 	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Called to setup the pointers for a given bone to its transformation matrix
+	// Builds the bone matrices for the current layers if they have moved
 	//--------------------------------------------------------------------------------------
-	HRESULT MeshObject::SetupBoneMatrixPointers( LPD3DXFRAME pFrame )
+	void MeshObject::PoseAnimation()
 	{
-		HRESULT hr;
-
-		if (pFrame->pMeshContainer != NULL)
-		{
-			hr = SetupBoneMatrixPointersOnMesh(pFrame->pMeshContainer);
-			if (FAILED(hr))
-				return hr;
-		}
-
-		if (pFrame->pFrameSibling != NULL)
-		{
-			hr = SetupBoneMatrixPointers(pFrame->pFrameSibling);
-			if (FAILED(hr))
-				return hr;
-		}
-
-		if (pFrame->pFrameFirstChild != NULL)
-		{
-			hr = SetupBoneMatrixPointers(pFrame->pFrameFirstChild);
-			if (FAILED(hr))
-				return hr;
-		}
-
-		return S_OK;
+		if(!m_pSkeleton || !m_bPoseDirty)
+			return;
+		m_pSkeleton->ComputePose(m_AnimLayers, ANIM_MAX_LAYERS, m_ModelTransforms, m_FinalTransforms);
+		m_bPoseDirty = false;
+		m_PoseVersion++;
 	}
 
 
-
 	//--------------------------------------------------------------------------------------
 	// Update the animation cycle and matrices
 	//--------------------------------------------------------------------------------------
 	void MeshObject::UpdateAnimation()
 	{
-		// Update the animation
 		float time = (timeGetTime()*0.001f);
-		m_pAnimCtrl->AdvanceTime(time - m_FrameTime, NULL);
+		float elapsed = m_FrameTime>0 ? time-m_FrameTime : 0;
 		m_FrameTime = time;
+		AdvanceAnimation(elapsed);
+		PoseAnimation();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Poses a band of objects
+	//--------------------------------------------------------------------------------------
+	static void AnimationJob(int start, int end, void* pData)
+	{
+		MeshObject** ppObjects = (MeshObject**)pData;
+		for(int i=start; i<end; i++)
+			ppObjects[i]->PoseAnimation();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Advances a set of objects on the calling thread, the fades and clip times are
+	// cheap, and poses them in bands on the thread pool
+	//--------------------------------------------------------------------------------------
+	void MeshObject::UpdateAnimations(MeshObject** ppObjects, int numObjects, float elapsed)
+	{
+		if(numObjects<=0)
+			return;
+		for(int i=0; i<numObjects; i++)
+			ppObjects[i]->AdvanceAnimation(elapsed);
+		g_ThreadPool.ParallelFor(numObjects, AnimationJob, ppObjects, ANIM_JOB_BAND);
+	}
+
 
-		// Now that the frames are updated to the current pose, recurse
-		// down the tree and generate a frame's combined-transform.
-		D3DXMATRIX identity;
-		D3DXMatrixIdentity(&identity);
-		UpdateFrameMatrices(m_pRootFrame, &identity);
+	//--------------------------------------------------------------------------------------
+	// Gets the picking tree.  Skinned meshes skin every vertex once for the pose and refit
+	// a copy of the mesh tree to them, which keeps its layout but not its quality for
+	// poses far from the bind pose.
+	//--------------------------------------------------------------------------------------
+	MeshBVH& MeshObject::GetPickingBVH(const void** ppVerts, UINT* pStride)
+	{
+		if(!m_bSkinnedMesh)
+		{
+			*ppVerts = m_pMesh->GetVerts();
+			*pStride = sizeof(Vertex);
+			return m_pMesh->GetBVH();
+		}
 
-		// Add the offset-transform
-		for(int i = 0; i<m_FinalTransforms.Size(); i++)
-			D3DXMatrixMultiply(&m_FinalTransforms[i], &m_pMeshContainer->pBoneOffsetMatrices[i], m_pMeshContainer->ppBoneMatrixPtrs[i]);
+		if(m_PickVersion!=m_PoseVersion)
+		{
+			int numVerts = m_pMesh->GetNumVerts();
+			const SkinnedVertex* pVerts = m_pMesh->GetSkinnedVerts();
+			const D3DXMATRIX* pMatrices = m_FinalTransforms;
+			if(m_PosePositions.Size()!=numVerts)
+				m_PosePositions.Allocate(numVerts);
+			for(int i=0; i<numVerts; i++)
+			{
+				D3DXVECTOR3 pos(0,0,0), bonePos;
+				for(DWORD k=0; k<m_MaxVertInfluences; k++)
+				{
+					D3DXVec3TransformCoord(&bonePos, &pVerts[i].pos, &pMatrices[pVerts[i].indices[k]]);
+					pos += pVerts[i].weights[k] * bonePos;
+				}
+				m_PosePositions[i] = pos;
+			}
+			if(m_PoseBVH.GetNumNodes()!=m_pMesh->GetBVH().GetNumNodes())
+				m_PoseBVH.CopyFrom(m_pMesh->GetBVH());
+			m_PoseBVH.Refit(m_PosePositions, sizeof(D3DXVECTOR3));
+			m_PickVersion = m_PoseVersion;
+		}
+		*ppVerts = (D3DXVECTOR3*)m_PosePositions;
+		*pStride = sizeof(D3DXVECTOR3);
+		return m_PoseBVH;
 	}
 
 
@@ -318,6 +421,9 @@ namespace Core
 			m_pSubMesh[i].pIndexBuffer = m_pMesh->GetSubMesh(i)->pIndexBuffer;
 			m_pSubMesh[i].pVertexBuffer = m_pMesh->GetSubMesh(i)->pVertexBuffer;
 			m_pSubMesh[i].pPosVertexBuffer = m_pMesh->GetSubMesh(i)->pPosVertexBuffer;
+			m_pSubMesh[i].pQuantization = m_pMesh->GetSubMesh(i)->pQuantization;
+			m_pSubMesh[i].numLods = m_pMesh->GetSubMesh(i)->numLods;
+			memcpy(m_pSubMesh[i].lods, m_pMesh->GetSubMesh(i)->lods, sizeof(m_pSubMesh[i].lods));
 		}
 	}
 
@@ -394,6 +500,26 @@ namespace Core
 
 	
 
+	//--------------------------------------------------------------------------------------
+	// Picks a level of detail from the projected size of the bounding sphere
+	//--------------------------------------------------------------------------------------
+	int MeshObject::ComputeLOD(const D3DXVECTOR3& eye, float pixelScale, float pixelError)
+	{
+		int numLods = m_pMesh->GetNumLODs();
+		float distance = D3DXVec3Length(&(eye-m_vPos)) - m_Radius;
+		if(numLods==0 || distance<=0)
+			return 0;
+
+		// Pixels the radius covers, the level errors are a part of it
+		float pixelRadius = m_Radius*pixelScale/distance;
+		int level = 0;
+		while(level<numLods && m_pMesh->GetLODError(level+1)*pixelRadius<=pixelError)
+			level++;
+		return level;
+	}
+
+
+
 	//--------------------------------------------------------------------------------------
 	// Checks for an intersection with a an AABB
 	//--------------------------------------------------------------------------------------
@@ -413,90 +539,116 @@ namespace Core
 
 
 
+	//--------------------------------------------------------------------------------------
+	// Finds the submesh a triangle of the mesh index list is in
+	//--------------------------------------------------------------------------------------
+	static int FindSubMesh( MeshObject* pMesh, int tri )
+	{
+		int index = tri*3;
+		for(int i=0; i<pMesh->GetNumSubMesh(); i++)
+		{
+			SubMesh* pSubMesh = pMesh->GetSubMesh(i);
+			if(index>=pSubMesh->startIndex && index<pSubMesh->startIndex+pSubMesh->numIndices)
+				return i;
+		}
+		return -1;
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Checks for a ray-triangle intersection with a model,
-	//    and gets the distance to the triangle as well as 
-	//    the barycentric hit coordinates
-	//--------------------------------------------------------------------------------------	
+	//    and gets the distance to the triangle as well as
+	//    the barycentric hit coordinates.  The ray goes into
+	//    object space as a whole, so the distance is the same.
+	//--------------------------------------------------------------------------------------
 	bool RayIntersectMesh( MeshObject* pMesh, D3DXVECTOR3 &orig, D3DXVECTOR3 &dir,
 						   float *t, float *u, float *v, int *mesh, float maxD)
 	{
 		if(!pMesh)
 			return 0;
-		if(!pMesh->GetMesh())
+		if(!pMesh->GetMesh() || !pMesh->GetMesh()->GetBVH().IsBuilt())
 			return 0;
 
-		// First perform a bounding box test to see if its worth checking per polygon
+		// First perform a bounding box test to see if its worth posing the mesh
 		if(!D3DXBoxBoundProbe(&(pMesh->GetPos()-pMesh->GetBoundSize()), &(pMesh->GetPos()+pMesh->GetBoundSize()), &orig, &dir))
 			return false;
 
-		D3DXVECTOR3 tri[3],vPos;
-		bool ret = false;
-		float dist,D=maxD,U,V;
-		for(int i=0; i<pMesh->GetNumSubMesh(); i++)
+		D3DXMATRIX matInv;
+		if(!D3DXMatrixInverse(&matInv, NULL, &pMesh->GetWorldMatrix()))
+			return false;
+		D3DXVECTOR3 localOrig, localDir;
+		D3DXVec3TransformCoord(&localOrig, &orig, &matInv);
+		D3DXVec3TransformNormal(&localDir, &dir, &matInv);
+
+		const void* pVerts;
+		UINT stride;
+		MeshRayHit hit;
+		MeshBVH& bvh = pMesh->GetPickingBVH(&pVerts, &stride);
+		if(!bvh.Intersect(pVerts, stride, localOrig, localDir, maxD, hit))
+			return false;
+		int subMesh = FindSubMesh(pMesh, hit.Tri);
+		if(subMesh<0)
+			return false;
+
+		*t = hit.t;
+		*u = hit.u;
+		*v = hit.v;
+		*mesh = subMesh;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Checks a batch of rays against a model, the mesh is posed once for all of them
+	//--------------------------------------------------------------------------------------
+	int RayIntersectMeshBatch( MeshObject* pMesh, const D3DXVECTOR3* pOrig, const D3DXVECTOR3* pDir, int numRays,
+							   MeshRayHit* pHits, float maxD)
+	{
+		for(int i=0; i<numRays; i++)
 		{
-			for(int e=pMesh->GetSubMesh(i)->startIndex; 
-				e<pMesh->GetSubMesh(i)->startIndex + pMesh->GetSubMesh(i)->numIndices; e+=3)
-			{
-				// Get verts from a cloth
-				/*if(pMesh->IsCloth())
-				{
-					NxVec3 npos;
-					npos = pMesh->GetClothVerts()[pMesh->GetMesh()->GetIndices()[e]];
-					tri[0] = D3DXVECTOR3(npos.x, npos.y, npos.z);
-					npos = pMesh->GetClothVerts()[pMesh->GetMesh()->GetIndices()[e+1]];
-					tri[1] = D3DXVECTOR3(npos.x, npos.y, npos.z);
-					npos = pMesh->GetClothVerts()[pMesh->GetMesh()->GetIndices()[e+2]];
-					tri[2] = D3DXVECTOR3(npos.x, npos.y, npos.z);
-				}
-				else*/
-				{
-					// Skinned meshes
-					if(pMesh->IsSkinned())
-					{
-						// Must perform skinning in software here for accurate picking
-						D3DXVECTOR3 tri2[3];
-						SkinnedVertex verts[3];
-						verts[0] = pMesh->GetMesh()->GetSkinnedVerts()[ pMesh->GetMesh()->GetIndices()[e] ];
-						verts[1] = pMesh->GetMesh()->GetSkinnedVerts()[ pMesh->GetMesh()->GetIndices()[e+1] ];
-						verts[2] = pMesh->GetMesh()->GetSkinnedVerts()[ pMesh->GetMesh()->GetIndices()[e+2] ];
-						tri[0] = tri[1] = tri[2] = D3DXVECTOR3(0,0,0);
-						for(DWORD k=0; k<pMesh->GetNumBonesPerVertex(); k++)
-						for(int j=0; j<3; j++)
-						{
-							D3DXVec3TransformCoord(&tri2[j], &verts[j].pos,&pMesh->GetAnimMatrices()[verts[j].indices[k]]);
-							tri[j] += verts[j].weights[k] * tri2[j];
-						}
-
-						// Now take the world matrix into account
-						tri2[0] = tri[0];
-						tri2[1] = tri[1];
-						tri2[2] = tri[2];
-						D3DXVec3TransformCoord(&tri[0], &tri2[0], &pMesh->GetWorldMatrix());
-						D3DXVec3TransformCoord(&tri[1], &tri2[1], &pMesh->GetWorldMatrix());
-						D3DXVec3TransformCoord(&tri[2], &tri2[2], &pMesh->GetWorldMatrix());
-					}
-					// Just grab the verts from a normal mesh
-					else
-					{
-						D3DXVec3TransformCoord(&tri[0], &pMesh->GetMesh()->GetVerts()[ pMesh->GetMesh()->GetIndices()[e] ].pos, &pMesh->GetWorldMatrix());
-						D3DXVec3TransformCoord(&tri[1], &pMesh->GetMesh()->GetVerts()[ pMesh->GetMesh()->GetIndices()[e+1] ].pos, &pMesh->GetWorldMatrix());
-						D3DXVec3TransformCoord(&tri[2], &pMesh->GetMesh()->GetVerts()[ pMesh->GetMesh()->GetIndices()[e+2] ].pos, &pMesh->GetWorldMatrix());
-					}
-					
-				}
-				if(D3DXIntersectTri(&tri[0],&tri[1],&tri[2],&orig,&dir,&U,&V,&dist) && (dist>0&&dist<maxD) && dist<D)
-				{
-					D=dist;
-					*t = D;
-					*u = U;
-					*v = V;
-					*mesh = i;
-					ret = true;
-				}
-			}
+			pHits[i].t = maxD;
+			pHits[i].u = pHits[i].v = 0;
+			pHits[i].Tri = pHits[i].SubMesh = -1;
+		}
+		if(!pMesh || !pMesh->GetMesh() || !pMesh->GetMesh()->GetBVH().IsBuilt() || numRays<=0)
+			return 0;
+
+		// Nothing to pose for if every ray misses the bounds
+		D3DXVECTOR3 vMin = pMesh->GetPos()-pMesh->GetBoundSize();
+		D3DXVECTOR3 vMax = pMesh->GetPos()+pMesh->GetBoundSize();
+		bool bProbe = false;
+		for(int i=0; i<numRays && !bProbe; i++)
+			bProbe = D3DXBoxBoundProbe(&vMin, &vMax, &pOrig[i], &pDir[i])!=FALSE;
+		if(!bProbe)
+			return 0;
+
+		// Rays in object space, origins then directions
+		D3DXMATRIX matInv;
+		if(!D3DXMatrixInverse(&matInv, NULL, &pMesh->GetWorldMatrix()))
+			return 0;
+		Array<D3DXVECTOR3> rays;
+		rays.Allocate(numRays*2);
+		D3DXVec3TransformCoordArray(rays, sizeof(D3DXVECTOR3), pOrig, sizeof(D3DXVECTOR3), &matInv, numRays);
+		D3DXVec3TransformNormalArray((D3DXVECTOR3*)rays+numRays, sizeof(D3DXVECTOR3), pDir, sizeof(D3DXVECTOR3), &matInv, numRays);
+
+		const void* pVerts;
+		UINT stride;
+		MeshBVH& bvh = pMesh->GetPickingBVH(&pVerts, &stride);
+		bvh.IntersectBatch(pVerts, stride, rays, (D3DXVECTOR3*)rays+numRays, numRays, maxD, pHits);
+		rays.Release();
+
+		int numHits = 0;
+		for(int i=0; i<numRays; i++)
+		{
+			if(pHits[i].Tri<0)
+				continue;
+			pHits[i].SubMesh = FindSubMesh(pMesh, pHits[i].Tri);
+			if(pHits[i].SubMesh<0)
+				pHits[i].Tri = -1;
+			else
+				numHits++;
 		}
-		return ret;
+		return numHits;
 	}
 
 }
\ No newline at end of file
@@ -31,6 +31,21 @@ namespace Core
 			// Loads the mesh from a file
 			bool Load(const char* file);
 
+			// Streams the mesh in, the object stays empty until FinishLoad sets it
+			// up once the mesh is resident.  Lower priorities load sooner.
+			bool LoadAsync(const char* file, float priority=STREAM_PRIORITY_DEFAULT);
+			bool FinishLoad();
+
+			// Waiting on the streamer
+			inline bool IsPending(){ return m_bPending; }
+
+			// Marks the mesh and its textures used this frame for the residency manager,
+			// nearer objects rank first if they have to stream back in
+			void TouchResources(const D3DXVECTOR3& vEye);
+
+			// Picks up buffers the mesh freed or got back, true if they changed
+			bool SyncBuffers();
+
 			// Get the parent mesh
 			inline BaseMesh* GetMesh(){ return m_pMesh; }
 
@@ -176,15 +191,32 @@ namespace Core
 			// Compute the mesh bounds
 			void ComputeBounds();
 
+			// Coarsest level of detail whose error covers no more than pixelError pixels
+			// when seen from eye, pixelScale is the pixels a unit covers a unit away
+			int ComputeLOD(const D3DXVECTOR3& eye, float pixelScale, float pixelError);
+
+			// Sets the level of detail the submeshes draw at
+			inline void SetLOD(int level){ for(int i=0; i<m_pSubMesh.Size(); i++) m_pSubMesh[i].lod = level; }
+
 			// Gets the number of faces
 			inline int GetNumFaces(){ return m_pMesh->GetNumFaces(); }
 
 			// Update the submeshes
 			void UpdateSubMeshes();
 
-			// Update the animation cycle and matrices
+			// Update the animation cycle and matrices from the system timer, for objects
+			// the renderer does not animate
 			void UpdateAnimation();
 
+			// Moves the layers along by elapsed seconds
+			void AdvanceAnimation(float elapsed);
+
+			// Builds the bone matrices for the current layers
+			void PoseAnimation();
+
+			// Advances a set of objects and poses them on the thread pool
+			static void UpdateAnimations(MeshObject** ppObjects, int numObjects, float elapsed);
+
 			
 
 			// Skinned?
@@ -197,32 +229,24 @@ namespace Core
 			// The number of bones per vertex
 			inline DWORD GetNumBonesPerVertex(){ return m_MaxVertInfluences; }
 
+			// Picking tree and the object space positions it is over, skinned meshes are
+			// skinned and refit when the pose has changed since the last call
+			MeshBVH& GetPickingBVH(const void** ppVerts, UINT* pStride);
+
 			// Number of animations
-			inline int GetNumAnimations(){ if(m_pAnimCtrl) return m_pAnimCtrl->GetNumAnimationSets(); return 0; }
+			inline int GetNumAnimations(){ if(m_pSkeleton) return m_pSkeleton->GetNumClips(); return 0; }
 
 			// Animation names
-			inline char* GetAnimationName(int index){
-				ID3DXAnimationSet* pAnimSet;
-				m_pAnimCtrl->GetAnimationSet(index, &pAnimSet);
-				return (char*)pAnimSet->GetName();
-			}
+			inline char* GetAnimationName(int index){ return (char*)m_pSkeleton->GetClip(index).Name.c_str(); }
 			
-			// Enable an animation track
-			inline void AnimationPlay(int index){
-				ID3DXAnimationSet* pAnimSet;
-				m_pAnimCtrl->GetAnimationSet(index, &pAnimSet);
-				m_pAnimCtrl->SetTrackAnimationSet(0, pAnimSet);
-				m_pAnimCtrl->SetTrackEnable(0, TRUE);
-			}
+			// Plays an animation, fading out the one playing over fadeTime seconds
+			void AnimationPlay(int index, float fadeTime=0);
 
-			// Disable all animation tracks
-			inline void AnimationPause(){ 
-				for(UINT i=0; i<m_pAnimCtrl->GetMaxNumTracks(); i++)
-				{
-					m_pAnimCtrl->SetTrackEnable(i, FALSE);
-					m_pAnimCtrl->SetTrackPosition(i, 0);
-				}
-			}
+			// Stops all the animation layers
+			void AnimationPause();
+
+			// The layers, for setting speeds, weights and looping
+			inline AnimLayer& GetAnimationLayer(int i){ return m_AnimLayers[i]; }
 
 			// Is it using cube mapping
 			inline bool IsCubeMapped(){ return m_bCubeMap; }
@@ -243,30 +267,32 @@ namespace Core
 			String					m_szName;			  // BaseMesh name
 			bool					m_bCubeMap;		      // True for cube mapping
 			bool					m_bHide;			  // Will not render if true
+			bool					m_bPending;			  // Set up once the mesh streams in
 
 			// Animation
-			D3DXFRAME*					m_pRootFrame;			// Bone hierarchy
+			Skeleton*					m_pSkeleton;			// Bones and clips of the mesh
 			bool					    m_bSkinnedMesh;			// True if skinning
 			DWORD						m_MaxVertInfluences;	// Max number of bones per vertex
-			ID3DXAnimationController*	m_pAnimCtrl;			// Animation controller
+			AnimLayer					m_AnimLayers[ANIM_MAX_LAYERS];	// Clips playing, the second fades out
+			float						m_FadeTime;				// Seconds into the cross fade
+			float						m_FadeDuration;			// Length of the cross fade, 0 if none
+			bool						m_bAnimating;			// False while paused
+			bool						m_bPoseDirty;			// Layers moved since the last pose
+			Array<D3DXMATRIX>			m_ModelTransforms;		// Model space node matrices
 			Array<D3DXMATRIX>			m_FinalTransforms;		// Matrix transforms
 			float						m_FrameTime;			// Timer for animation
-			D3DXMESHCONTAINER_DERIVED*	m_pMeshContainer;		// The mesh contatiner
-
-			// Get the animation data
-			void CloneAnimationData(char* file);
+			UINT						m_PoseVersion;			// Changes with each animation update
 
-			// Finds the node that contains mesh data
-			D3DXFRAME* FindNodeWithMesh(D3DXFRAME* frame);
+			// Picking in the current pose
+			MeshBVH						m_PoseBVH;				// Mesh tree refit to the pose
+			Array<D3DXVECTOR3>			m_PosePositions;		// Skinned positions
+			UINT						m_PickVersion;			// Pose the tree was refit to
 
-			// Called to setup the pointers for a given bone to its transformation matrix
-			HRESULT SetupBoneMatrixPointers( LPD3DXFRAME pFrame );
+			// Sets up the layers and matrices over the mesh skeleton
+			void SetupAnimation();
 
-			// Called to setup the pointers for a given bone to its transformation matrix
-			HRESULT SetupBoneMatrixPointersOnMesh( LPD3DXMESHCONTAINER pMeshContainerBase );
-
-			// Update the frame matrices
-			void UpdateFrameMatrices( LPD3DXFRAME pFrameBase, LPD3DXMATRIX pParentMatrix );
+			// Sets up the submeshes, materials and bounds over a loaded mesh
+			void SetupFromMesh();
 	};
 
 	//--------------------------------------------------------------------------------------
@@ -276,4 +302,11 @@ namespace Core
 	//--------------------------------------------------------------------------------------	
 	bool RayIntersectMesh( MeshObject* pMesh, D3DXVECTOR3 &orig, D3DXVECTOR3 &dir,
 						  float *t, float *u, float *v, int *mesh, float maxD = 1000.0f);
+
+	//--------------------------------------------------------------------------------------
+	// Checks a batch of rays against a model on the thread pool, skinned meshes are posed
+	// once for the whole batch.  Misses have a Tri of -1, returns the number of hits.
+	//--------------------------------------------------------------------------------------
+	int RayIntersectMeshBatch( MeshObject* pMesh, const D3DXVECTOR3* pOrig, const D3DXVECTOR3* pDir, int numRays,
+							   MeshRayHit* pHits, float maxD = 1000.0f);
 }
\ No newline at end of file
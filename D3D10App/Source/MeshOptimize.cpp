@@ -0,0 +1,431 @@
+//--------------------------------------------------------------------------------------
+// File: MeshOptimize.cpp
+//
+// Triangle and vertex ordering for meshes
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ThreadPool.h"
+#include "MeshOptimize.h"
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// FIFO cache test, a vertex is in the cache if fewer than cacheSize misses came
+	// after its own.  Returns 1 for a miss.
+	//--------------------------------------------------------------------------------------
+	static inline int CacheMiss(DWORD v, UINT* pTimestamps, UINT& time, int cacheSize)
+	{
+		if(time - pTimestamps[v] > (UINT)cacheSize)
+		{
+			pTimestamps[v] = time++;
+			return 1;
+		}
+		return 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Simulates a FIFO post transform cache
+	//--------------------------------------------------------------------------------------
+	void ComputeCacheStats(const DWORD* pIndices, int numIndices, int numVerts, MeshCacheStats& stats, int cacheSize)
+	{
+		stats.ACMR = stats.ATVR = 0;
+		if(numIndices<3 || numVerts<=0)
+			return;
+
+		UINT* pTimestamps = new UINT[numVerts];
+		bool* pUsed = new bool[numVerts];
+		memset(pTimestamps, 0, numVerts*sizeof(UINT));
+		memset(pUsed, 0, numVerts*sizeof(bool));
+		UINT time = cacheSize+1;
+		int misses = 0, used = 0;
+		for(int i=0; i<numIndices; i++)
+		{
+			misses += CacheMiss(pIndices[i], pTimestamps, time, cacheSize);
+			if(!pUsed[pIndices[i]])
+			{
+				pUsed[pIndices[i]] = true;
+				used++;
+			}
+		}
+		stats.ACMR = (float)misses / (numIndices/3);
+		stats.ATVR = (float)misses / used;
+		delete[] pTimestamps;
+		delete[] pUsed;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Groups triangles by attribute with a counting sort
+	//--------------------------------------------------------------------------------------
+	void SortByAttribute(DWORD* pIndices, int numFaces, const DWORD* pAttribs, Array<MeshAttributeRange>& ranges)
+	{
+		ranges.Clear();
+		if(numFaces<=0)
+			return;
+
+		DWORD maxAttrib = 0;
+		for(int i=0; i<numFaces; i++)
+			maxAttrib = max(maxAttrib, pAttribs[i]);
+		DWORD* pStart = new DWORD[maxAttrib+2];
+		memset(pStart, 0, (maxAttrib+2)*sizeof(DWORD));
+		for(int i=0; i<numFaces; i++)
+			pStart[pAttribs[i]+1]++;
+		for(DWORD a=0; a<=maxAttrib; a++)
+		{
+			if(pStart[a+1])
+			{
+				MeshAttributeRange range;
+				range.Attrib = a;
+				range.StartIndex = pStart[a]*3;
+				range.NumIndices = pStart[a+1]*3;
+				ranges.Add(range);
+			}
+			pStart[a+1] += pStart[a];
+		}
+
+		DWORD* pSorted = new DWORD[numFaces*3];
+		for(int i=0; i<numFaces; i++)
+		{
+			DWORD f = pStart[pAttribs[i]]++;
+			pSorted[f*3] = pIndices[i*3];
+			pSorted[f*3+1] = pIndices[i*3+1];
+			pSorted[f*3+2] = pIndices[i*3+2];
+		}
+		memcpy(pIndices, pSorted, numFaces*3*sizeof(DWORD));
+		delete[] pSorted;
+		delete[] pStart;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Tipsify.  Fans are made around a vertex at a time, and the next vertex is the one
+	// from the last fan that will still be in the cache after its own fan, or if there
+	// is none, one from a recent triangle, or the next one in order with triangles left.
+	// A new cluster starts whenever the cache is no help in choosing.
+	//--------------------------------------------------------------------------------------
+	void OptimizeVertexCache(DWORD* pIndices, int numIndices, int numVerts, Array<DWORD>* pClusters, int cacheSize)
+	{
+		if(pClusters)
+			pClusters->Clear();
+		int numFaces = numIndices/3;
+		if(numFaces<=0)
+			return;
+
+		// Triangles around each vertex
+		int* pLive = new int[numVerts];
+		int* pOffset = new int[numVerts+1];
+		memset(pLive, 0, numVerts*sizeof(int));
+		for(int i=0; i<numFaces*3; i++)
+			pLive[pIndices[i]]++;
+		pOffset[0] = 0;
+		for(int v=0; v<numVerts; v++)
+			pOffset[v+1] = pOffset[v] + pLive[v];
+		int* pFill = new int[numVerts];
+		memcpy(pFill, pOffset, numVerts*sizeof(int));
+		int* pAdjacency = new int[numFaces*3];
+		for(int i=0; i<numFaces*3; i++)
+			pAdjacency[pFill[pIndices[i]]++] = i/3;
+		delete[] pFill;
+
+		UINT* pTimestamps = new UINT[numVerts];
+		memset(pTimestamps, 0, numVerts*sizeof(UINT));
+		bool* pEmitted = new bool[numFaces];
+		memset(pEmitted, 0, numFaces*sizeof(bool));
+		DWORD* pDeadEnd = new DWORD[numFaces*3];
+		int deadEnd = 0;
+		DWORD* pOutput = new DWORD[numFaces*3];
+		int numOutput = 0;
+		int candidates[3*64];
+
+		UINT time = cacheSize+1;
+		int scan = 0;
+		int fan = pIndices[0];
+		if(pClusters)
+			pClusters->Add(0);
+		while(fan>=0)
+		{
+			// Emit the fan
+			int numCandidates = 0;
+			for(int k=pOffset[fan]; k<pOffset[fan+1]; k++)
+			{
+				int t = pAdjacency[k];
+				if(pEmitted[t])
+					continue;
+				pEmitted[t] = true;
+				for(int c=0; c<3; c++)
+				{
+					DWORD v = pIndices[t*3+c];
+					pOutput[numOutput++] = v;
+					pDeadEnd[deadEnd++] = v;
+					if(numCandidates<3*64)
+						candidates[numCandidates++] = v;
+					pLive[v]--;
+					CacheMiss(v, pTimestamps, time, cacheSize);
+				}
+			}
+
+			// The candidate that will be in the cache longest after its fan
+			int next = -1, best = -1;
+			for(int c=0; c<numCandidates; c++)
+			{
+				int v = candidates[c];
+				if(pLive[v]<=0)
+					continue;
+				int priority = 0;
+				int age = time - pTimestamps[v];
+				if(age + 2*pLive[v] <= cacheSize)
+					priority = age;
+				if(priority>best)
+				{
+					best = priority;
+					next = v;
+				}
+			}
+
+			// Dead end, go back through recent triangles and then in order
+			if(next<0)
+			{
+				while(deadEnd>0 && next<0)
+				{
+					DWORD v = pDeadEnd[--deadEnd];
+					if(pLive[v]>0)
+						next = v;
+				}
+				while(next<0 && scan<numVerts)
+				{
+					if(pLive[scan]>0)
+						next = scan;
+					else
+						scan++;
+				}
+				if(next>=0 && pClusters && numOutput<numFaces*3)
+					pClusters->Add(numOutput/3);
+			}
+			fan = next;
+		}
+
+		memcpy(pIndices, pOutput, numFaces*3*sizeof(DWORD));
+		delete[] pLive;
+		delete[] pOffset;
+		delete[] pAdjacency;
+		delete[] pTimestamps;
+		delete[] pEmitted;
+		delete[] pDeadEnd;
+		delete[] pOutput;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Cluster order for the overdraw sort
+	//--------------------------------------------------------------------------------------
+	struct OverdrawCluster
+	{
+		float	Key;
+		DWORD	Start, End;
+	};
+
+	static int CompareOverdrawCluster(const void* pA, const void* pB)
+	{
+		const OverdrawCluster& a = *(const OverdrawCluster*)pA;
+		const OverdrawCluster& b = *(const OverdrawCluster*)pB;
+		if(a.Key!=b.Key)
+			return a.Key>b.Key ? -1 : 1;
+		return a.Start<b.Start ? -1 : (a.Start>b.Start);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Splits the clusters where the cache allows, then sorts them by how much they face
+	// away from the center of the mesh
+	//--------------------------------------------------------------------------------------
+	void OptimizeOverdraw(DWORD* pIndices, int numIndices, const void* pVerts, UINT stride, Array<DWORD>& clusters)
+	{
+		int numFaces = numIndices/3;
+		if(numFaces<=0 || clusters.Size()==0)
+			return;
+		#define OVERDRAW_POS(v) (*(const D3DXVECTOR3*)((const BYTE*)pVerts + (v)*stride))
+
+		// Cache timestamps for the vertices the range uses
+		DWORD maxVert = 0;
+		for(int i=0; i<numIndices; i++)
+			maxVert = max(maxVert, pIndices[i]);
+		UINT* pTimestamps = new UINT[maxVert+1];
+		memset(pTimestamps, 0, (maxVert+1)*sizeof(UINT));
+		UINT time = MESH_CACHE_SIZE+1;
+
+		// Soft boundaries, a cluster is cut where its own miss rate so far is close to
+		// the rate of the whole thing
+		Array<DWORD> splits;
+		for(int c=0; c<clusters.Size(); c++)
+		{
+			DWORD start = clusters[c];
+			DWORD end = c+1<clusters.Size() ? clusters[c+1] : numFaces;
+			int misses = 0;
+			for(DWORD f=start; f<end; f++)
+				for(int k=0; k<3; k++)
+					misses += CacheMiss(pIndices[f*3+k], pTimestamps, time, MESH_CACHE_SIZE);
+			float threshold = MESH_OVERDRAW_THRESHOLD * misses / (end-start);
+
+			time += MESH_CACHE_SIZE+1;
+			misses = 0;
+			splits.Add(start);
+			DWORD clusterStart = start;
+			for(DWORD f=start; f<end; f++)
+			{
+				for(int k=0; k<3; k++)
+					misses += CacheMiss(pIndices[f*3+k], pTimestamps, time, MESH_CACHE_SIZE);
+				if(f+1<end && misses <= threshold*(f+1-clusterStart))
+				{
+					splits.Add(f+1);
+					clusterStart = f+1;
+					misses = 0;
+					time += MESH_CACHE_SIZE+1;
+				}
+			}
+			time += MESH_CACHE_SIZE+1;
+		}
+		delete[] pTimestamps;
+
+		// Area weighted center and normal of each cluster and of the mesh
+		OverdrawCluster* pClusters = new OverdrawCluster[splits.Size()];
+		D3DXVECTOR3* pCenters = new D3DXVECTOR3[splits.Size()];
+		D3DXVECTOR3* pNormals = new D3DXVECTOR3[splits.Size()];
+		D3DXVECTOR3 meshCenter(0, 0, 0);
+		float meshArea = 0;
+		for(int c=0; c<splits.Size(); c++)
+		{
+			OverdrawCluster& cluster = pClusters[c];
+			cluster.Start = splits[c];
+			cluster.End = c+1<splits.Size() ? splits[c+1] : numFaces;
+			D3DXVECTOR3 center(0, 0, 0), normal(0, 0, 0);
+			float area = 0;
+			for(DWORD f=cluster.Start; f<cluster.End; f++)
+			{
+				const D3DXVECTOR3& p0 = OVERDRAW_POS(pIndices[f*3]);
+				const D3DXVECTOR3& p1 = OVERDRAW_POS(pIndices[f*3+1]);
+				const D3DXVECTOR3& p2 = OVERDRAW_POS(pIndices[f*3+2]);
+				D3DXVECTOR3 e1 = p1-p0, e2 = p2-p0, n;
+				D3DXVec3Cross(&n, &e1, &e2);
+				float a = D3DXVec3Length(&n);
+				center += (p0+p1+p2) * (a/3);
+				normal += n;
+				area += a;
+			}
+			meshCenter += center;
+			meshArea += area;
+			pCenters[c] = area>0 ? center/area : OVERDRAW_POS(pIndices[cluster.Start*3]);
+			pNormals[c] = normal;
+		}
+		if(meshArea>0)
+			meshCenter = meshCenter/meshArea;
+		for(int c=0; c<splits.Size(); c++)
+		{
+			float length = D3DXVec3Length(&pNormals[c]);
+			D3DXVECTOR3 offset = pCenters[c]-meshCenter;
+			pClusters[c].Key = length>0 ? D3DXVec3Dot(&offset, &pNormals[c])/length : 0;
+		}
+		qsort(pClusters, splits.Size(), sizeof(OverdrawCluster), CompareOverdrawCluster);
+
+		// Write the clusters back out in order
+		DWORD* pSorted = new DWORD[numFaces*3];
+		DWORD face = 0;
+		for(int c=0; c<splits.Size(); c++)
+		{
+			DWORD count = pClusters[c].End-pClusters[c].Start;
+			memcpy(pSorted + face*3, pIndices + pClusters[c].Start*3, count*3*sizeof(DWORD));
+			face += count;
+		}
+		memcpy(pIndices, pSorted, numFaces*3*sizeof(DWORD));
+		#undef OVERDRAW_POS
+
+		delete[] pSorted;
+		delete[] pClusters;
+		delete[] pCenters;
+		delete[] pNormals;
+		splits.Release();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Puts the vertices in the order they are first used
+	//--------------------------------------------------------------------------------------
+	void OptimizeVertexFetch(void* pVerts, UINT stride, int numVerts, DWORD* pIndices, int numIndices)
+	{
+		DWORD* pRemap = new DWORD[numVerts];
+		memset(pRemap, 0xff, numVerts*sizeof(DWORD));
+		DWORD next = 0;
+		for(int i=0; i<numIndices; i++)
+		{
+			DWORD& r = pRemap[pIndices[i]];
+			if(r==(DWORD)-1)
+				r = next++;
+			pIndices[i] = r;
+		}
+		for(int v=0; v<numVerts; v++)
+			if(pRemap[v]==(DWORD)-1)
+				pRemap[v] = next++;
+
+		BYTE* pSorted = new BYTE[numVerts*stride];
+		for(int v=0; v<numVerts; v++)
+			memcpy(pSorted + pRemap[v]*stride, (BYTE*)pVerts + v*stride, stride);
+		memcpy(pVerts, pSorted, numVerts*stride);
+		delete[] pSorted;
+		delete[] pRemap;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Attribute ranges are independent, so each is optimized on its own
+	//--------------------------------------------------------------------------------------
+	struct OptimizeRangeData
+	{
+		const void*			pVerts;
+		UINT				Stride;
+		int					NumVerts;
+		DWORD*				pIndices;
+		MeshAttributeRange*	pRanges;
+	};
+
+	static void OptimizeRangeJob(int start, int end, void* pData)
+	{
+		OptimizeRangeData& d = *(OptimizeRangeData*)pData;
+		Array<DWORD> clusters;
+		for(int r=start; r<end; r++)
+		{
+			DWORD* pIndices = d.pIndices + d.pRanges[r].StartIndex;
+			OptimizeVertexCache(pIndices, d.pRanges[r].NumIndices, d.NumVerts, &clusters);
+			OptimizeOverdraw(pIndices, d.pRanges[r].NumIndices, d.pVerts, d.Stride, clusters);
+		}
+		clusters.Release();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// All of it
+	//--------------------------------------------------------------------------------------
+	void OptimizeMesh(void* pVerts, UINT stride, int numVerts, DWORD* pIndices, int numFaces, const DWORD* pAttribs,
+		Array<MeshAttributeRange>& ranges, MeshCacheStats* pBefore, MeshCacheStats* pAfter)
+	{
+		SortByAttribute(pIndices, numFaces, pAttribs, ranges);
+		if(pBefore)
+			ComputeCacheStats(pIndices, numFaces*3, numVerts, *pBefore);
+
+		OptimizeRangeData d;
+		d.pVerts = pVerts;
+		d.Stride = stride;
+		d.NumVerts = numVerts;
+		d.pIndices = pIndices;
+		d.pRanges = ranges;
+		g_ThreadPool.ParallelFor(ranges.Size(), OptimizeRangeJob, &d, 1);
+
+		OptimizeVertexFetch(pVerts, stride, numVerts, pIndices, numFaces*3);
+		if(pAfter)
+			ComputeCacheStats(pIndices, numFaces*3, numVerts, *pAfter);
+	}
+}
@@ -0,0 +1,80 @@
+//--------------------------------------------------------------------------------------
+// File: MeshOptimize.h
+//
+// Triangle and vertex ordering for meshes, in place of ID3DXMesh::OptimizeInplace.
+// Triangles are grouped by attribute, each group is reordered for the post transform
+// cache with Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw"), the clusters it leaves are split where the cache
+// allows and sorted to draw outward facing parts first, and the vertices are put in
+// the order they are first used.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+
+namespace Core
+{
+
+// Post transform cache size the ordering is made for
+#define MESH_CACHE_SIZE 16
+
+// Clusters are split where their miss rate so far is within this of the whole cluster,
+// higher makes more and smaller clusters for the overdraw sort
+#define MESH_OVERDRAW_THRESHOLD 1.05f
+
+	// Cache behaviour of an index buffer
+	struct MeshCacheStats
+	{
+		float	ACMR;		// Average cache misses per triangle, 0.5 is the best for a grid
+		float	ATVR;		// Average transforms per vertex used, 1 is the best
+	};
+
+	// A run of triangles with the same attribute
+	struct MeshAttributeRange
+	{
+		DWORD	Attrib;
+		DWORD	StartIndex;
+		DWORD	NumIndices;
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Simulates a FIFO post transform cache
+	//--------------------------------------------------------------------------------------
+	void ComputeCacheStats(const DWORD* pIndices, int numIndices, int numVerts, MeshCacheStats& stats, int cacheSize=MESH_CACHE_SIZE);
+
+	//--------------------------------------------------------------------------------------
+	// Groups triangles by attribute in order of attribute, keeping their order within a
+	// group.  ranges gets one entry for each attribute in use.
+	//--------------------------------------------------------------------------------------
+	void SortByAttribute(DWORD* pIndices, int numFaces, const DWORD* pAttribs, Array<MeshAttributeRange>& ranges);
+
+	//--------------------------------------------------------------------------------------
+	// Reorders triangles for the vertex cache.  pClusters, if given, gets the first
+	// triangle of each cluster, relative to pIndices.
+	//--------------------------------------------------------------------------------------
+	void OptimizeVertexCache(DWORD* pIndices, int numIndices, int numVerts, Array<DWORD>* pClusters=NULL, int cacheSize=MESH_CACHE_SIZE);
+
+	//--------------------------------------------------------------------------------------
+	// Sorts the clusters from OptimizeVertexCache so the ones facing away from the center
+	// are drawn first.  Positions are the first three floats of each vertex.
+	//--------------------------------------------------------------------------------------
+	void OptimizeOverdraw(DWORD* pIndices, int numIndices, const void* pVerts, UINT stride, Array<DWORD>& clusters);
+
+	//--------------------------------------------------------------------------------------
+	// Puts the vertices in the order the indices first use them and rewrites the indices,
+	// unused vertices go to the end
+	//--------------------------------------------------------------------------------------
+	void OptimizeVertexFetch(void* pVerts, UINT stride, int numVerts, DWORD* pIndices, int numIndices);
+
+	//--------------------------------------------------------------------------------------
+	// All of the above.  Attribute ranges are done in parallel and the cache stats for
+	// the attribute sorted input and the output are returned if asked for.
+	//--------------------------------------------------------------------------------------
+	void OptimizeMesh(void* pVerts, UINT stride, int numVerts, DWORD* pIndices, int numFaces, const DWORD* pAttribs,
+		Array<MeshAttributeRange>& ranges, MeshCacheStats* pBefore=NULL, MeshCacheStats* pAfter=NULL);
+
+}
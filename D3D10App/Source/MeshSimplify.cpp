@@ -0,0 +1,337 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSimplify.cpp
+//
+// Mesh simplification for levels of detail
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "MeshSimplify.h"
+
+namespace Core
+{
+
+// Collapses are made in passes over the mesh, each only touching a vertex once
+#define SIMPLIFY_MAX_PASSES 48
+
+// Triangles may turn by up to about 75 degrees in a collapse
+#define SIMPLIFY_MIN_COS 0.25f
+
+// Vertices with more neighbours than this are left alone
+#define SIMPLIFY_MAX_FAN 128
+
+	#define SIMPLIFY_POS(v) (*(const D3DXVECTOR3*)((const BYTE*)pVerts + (v)*stride))
+
+
+	//--------------------------------------------------------------------------------------
+	// Sum of squared distances to a set of planes, weighted by area
+	//--------------------------------------------------------------------------------------
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2, c, w;
+
+		inline void Add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02;
+			a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c; w += q.w;
+		}
+
+		// Mean squared distance at a point
+		inline double Error(const D3DXVECTOR3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double e = a00*x*x + a11*y*y + a22*z*z + 2*(a01*x*y + a02*x*z + a12*y*z) + 2*(b0*x + b1*y + b2*z) + c;
+			return w>0 && e>0 ? e/w : 0;
+		}
+	};
+
+	static void AddPlane(Quadric& q, double nx, double ny, double nz, double d, double w)
+	{
+		q.a00 += nx*nx*w; q.a01 += nx*ny*w; q.a02 += nx*nz*w;
+		q.a11 += ny*ny*w; q.a12 += ny*nz*w; q.a22 += nz*nz*w;
+		q.b0 += nx*d*w; q.b1 += ny*d*w; q.b2 += nz*d*w;
+		q.c += d*d*w; q.w += w;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// A collapse of vertex A onto vertex B
+	//--------------------------------------------------------------------------------------
+	struct Collapse
+	{
+		double	Cost;
+		DWORD	A, B;
+	};
+
+	static int CompareCollapse(const void* pA, const void* pB)
+	{
+		const Collapse& a = *(const Collapse*)pA;
+		const Collapse& b = *(const Collapse*)pB;
+		if(a.Cost!=b.Cost)
+			return a.Cost<b.Cost ? -1 : 1;
+		if(a.A!=b.A)
+			return a.A<b.A ? -1 : 1;
+		return a.B<b.B ? -1 : (a.B>b.B);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Marks vertices that share their position with another vertex
+	//--------------------------------------------------------------------------------------
+	static void FindSeams(const void* pVerts, UINT stride, int numVerts, bool* pSeam)
+	{
+		UINT tableSize = 1024;
+		while(tableSize < (UINT)numVerts*2)
+			tableSize <<= 1;
+		int* pTable = new int[tableSize];
+		memset(pTable, 0xff, tableSize*sizeof(int));
+		memset(pSeam, 0, numVerts*sizeof(bool));
+		for(int v=0; v<numVerts; v++)
+		{
+			const UINT* p = (const UINT*)&SIMPLIFY_POS(v);
+			UINT h = (p[0]*73856093u ^ p[1]*19349663u ^ p[2]*83492791u) & (tableSize-1);
+			while(pTable[h]>=0)
+			{
+				if(memcmp(&SIMPLIFY_POS(pTable[h]), p, sizeof(D3DXVECTOR3))==0)
+				{
+					pSeam[v] = pSeam[pTable[h]] = true;
+					break;
+				}
+				h = (h+1) & (tableSize-1);
+			}
+			if(pTable[h]<0)
+				pTable[h] = v;
+		}
+		delete[] pTable;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Triangles around each vertex
+	//--------------------------------------------------------------------------------------
+	static void BuildFans(const DWORD* pIndices, int numIndices, int numVerts, int* pOffset, int* pFans)
+	{
+		memset(pOffset, 0, (numVerts+1)*sizeof(int));
+		for(int i=0; i<numIndices; i++)
+			pOffset[pIndices[i]+1]++;
+		for(int v=0; v<numVerts; v++)
+			pOffset[v+1] += pOffset[v];
+		for(int i=0; i<numIndices; i++)
+			pFans[pOffset[pIndices[i]]++] = i/3;
+		for(int v=numVerts; v>0; v--)
+			pOffset[v] = pOffset[v-1];
+		pOffset[0] = 0;
+	}
+
+	// Neighbours of a vertex, false if there are too many
+	static bool GetNeighbours(DWORD v, const DWORD* pIndices, const int* pOffset, const int* pFans, DWORD* pOut, int& count)
+	{
+		count = 0;
+		for(int k=pOffset[v]; k<pOffset[v+1]; k++)
+			for(int c=0; c<3; c++)
+			{
+				DWORD n = pIndices[pFans[k]*3+c];
+				if(n==v)
+					continue;
+				int i = 0;
+				while(i<count && pOut[i]!=n)
+					i++;
+				if(i==count)
+				{
+					if(count==SIMPLIFY_MAX_FAN)
+						return false;
+					pOut[count++] = n;
+				}
+			}
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Simplifies a triangle list
+	//--------------------------------------------------------------------------------------
+	int SimplifyMesh(const void* pVerts, UINT stride, int numVerts, const DWORD* pIndices, int numIndices,
+		DWORD* pOut, int targetIndices, float maxError, float* pError)
+	{
+		memcpy(pOut, pIndices, numIndices*sizeof(DWORD));
+		if(pError)
+			*pError = 0;
+		if(numIndices<=targetIndices)
+			return numIndices;
+
+		int* pOffset = new int[numVerts+1];
+		int* pFans = new int[numIndices];
+		BuildFans(pOut, numIndices, numVerts, pOffset, pFans);
+
+		// Plane quadrics
+		Quadric* pQuadrics = new Quadric[numVerts];
+		memset(pQuadrics, 0, numVerts*sizeof(Quadric));
+		for(int t=0; t<numIndices/3; t++)
+		{
+			const D3DXVECTOR3& p0 = SIMPLIFY_POS(pOut[t*3]);
+			const D3DXVECTOR3& p1 = SIMPLIFY_POS(pOut[t*3+1]);
+			const D3DXVECTOR3& p2 = SIMPLIFY_POS(pOut[t*3+2]);
+			D3DXVECTOR3 e1 = p1-p0, e2 = p2-p0, n;
+			D3DXVec3Cross(&n, &e1, &e2);
+			double length = D3DXVec3Length(&n);
+			if(length<=0)
+				continue;
+			double nx = n.x/length, ny = n.y/length, nz = n.z/length;
+			double d = -(nx*p0.x + ny*p0.y + nz*p0.z);
+			for(int c=0; c<3; c++)
+				AddPlane(pQuadrics[pOut[t*3+c]], nx, ny, nz, d, length*0.5);
+		}
+
+		// Seams and borders stay.  An edge is inside the mesh if some triangle around
+		// its first vertex has it the other way around.
+		bool* pLocked = new bool[numVerts];
+		FindSeams(pVerts, stride, numVerts, pLocked);
+		for(int v=0; v<numVerts; v++)
+		{
+			if(pLocked[v])
+				continue;
+			for(int k=pOffset[v]; k<pOffset[v+1] && !pLocked[v]; k++)
+			{
+				const DWORD* pTri = pOut + pFans[k]*3;
+				int c = pTri[0]==(DWORD)v ? 0 : (pTri[1]==(DWORD)v ? 1 : 2);
+				DWORD next = pTri[(c+1)%3];
+				bool found = false;
+				for(int j=pOffset[v]; j<pOffset[v+1] && !found; j++)
+				{
+					const DWORD* pOther = pOut + pFans[j]*3;
+					int o = pOther[0]==(DWORD)v ? 0 : (pOther[1]==(DWORD)v ? 1 : 2);
+					found = (pOther[(o+2)%3]==next);
+				}
+				if(!found)
+					pLocked[v] = true;
+			}
+		}
+
+		bool* pDirty = new bool[numVerts];
+		Collapse* pCollapses = new Collapse[numIndices*2];
+		DWORD neighboursA[SIMPLIFY_MAX_FAN], neighboursB[SIMPLIFY_MAX_FAN];
+		double maxCost = (double)maxError*maxError;
+		double worst = 0;
+		int count = numIndices;
+
+		for(int pass=0; pass<SIMPLIFY_MAX_PASSES && count>targetIndices; pass++)
+		{
+			if(pass>0)
+				BuildFans(pOut, count, numVerts, pOffset, pFans);
+
+			// Every edge both ways
+			int numCollapses = 0;
+			for(int i=0; i<count; i++)
+			{
+				DWORD a = pOut[i];
+				DWORD b = pOut[i%3==2 ? i-2 : i+1];
+				for(int dir=0; dir<2; dir++)
+				{
+					if(!pLocked[a])
+					{
+						Quadric q = pQuadrics[a];
+						q.Add(pQuadrics[b]);
+						Collapse& c = pCollapses[numCollapses++];
+						c.Cost = q.Error(SIMPLIFY_POS(b));
+						c.A = a;
+						c.B = b;
+					}
+					DWORD t = a; a = b; b = t;
+				}
+			}
+			qsort(pCollapses, numCollapses, sizeof(Collapse), CompareCollapse);
+
+			// Cheapest first, each vertex is only touched once per pass
+			memset(pDirty, 0, numVerts*sizeof(bool));
+			int estimate = count, collapsed = 0;
+			for(int i=0; i<numCollapses && estimate>targetIndices; i++)
+			{
+				const Collapse& c = pCollapses[i];
+				if(c.Cost>maxCost)
+					break;
+				if(pDirty[c.A] || pDirty[c.B])
+					continue;
+
+				// The only neighbours A and B share are across the triangles they share
+				int numA, numB, shared = 0, common = 0;
+				if(!GetNeighbours(c.A, pOut, pOffset, pFans, neighboursA, numA) ||
+					!GetNeighbours(c.B, pOut, pOffset, pFans, neighboursB, numB))
+					continue;
+				for(int x=0; x<numA; x++)
+					for(int y=0; y<numB; y++)
+						common += (neighboursA[x]==neighboursB[y]);
+
+				// Triangles that stay must not flip
+				bool flipped = false;
+				const D3DXVECTOR3& target = SIMPLIFY_POS(c.B);
+				for(int k=pOffset[c.A]; k<pOffset[c.A+1] && !flipped; k++)
+				{
+					const DWORD* pTri = pOut + pFans[k]*3;
+					if(pTri[0]==c.B || pTri[1]==c.B || pTri[2]==c.B)
+					{
+						shared++;
+						continue;
+					}
+					D3DXVECTOR3 p[3], q[3];
+					for(int v=0; v<3; v++)
+					{
+						p[v] = SIMPLIFY_POS(pTri[v]);
+						q[v] = pTri[v]==c.A ? target : p[v];
+					}
+					D3DXVECTOR3 e1 = p[1]-p[0], e2 = p[2]-p[0], n0, n1;
+					D3DXVec3Cross(&n0, &e1, &e2);
+					e1 = q[1]-q[0];
+					e2 = q[2]-q[0];
+					D3DXVec3Cross(&n1, &e1, &e2);
+					flipped = D3DXVec3Dot(&n0, &n1) <= SIMPLIFY_MIN_COS*D3DXVec3Length(&n0)*D3DXVec3Length(&n1);
+				}
+				if(flipped || common>shared)
+					continue;
+
+				// Collapse
+				for(int k=pOffset[c.A]; k<pOffset[c.A+1]; k++)
+					for(int v=0; v<3; v++)
+						pDirty[pOut[pFans[k]*3+v]] = true;
+				pQuadrics[c.B].Add(pQuadrics[c.A]);
+				for(int k=pOffset[c.A]; k<pOffset[c.A+1]; k++)
+					for(int v=0; v<3; v++)
+						if(pOut[pFans[k]*3+v]==c.A)
+							pOut[pFans[k]*3+v] = c.B;
+				estimate -= shared*3;
+				worst = max(worst, c.Cost);
+				collapsed++;
+			}
+			if(collapsed==0)
+				break;
+
+			// Drop the triangles that collapsed
+			int kept = 0;
+			for(int t=0; t<count; t+=3)
+				if(pOut[t]!=pOut[t+1] && pOut[t]!=pOut[t+2] && pOut[t+1]!=pOut[t+2])
+				{
+					pOut[kept] = pOut[t];
+					pOut[kept+1] = pOut[t+1];
+					pOut[kept+2] = pOut[t+2];
+					kept += 3;
+				}
+			count = kept;
+		}
+
+		if(pError)
+			*pError = (float)sqrt(worst);
+		delete[] pOffset;
+		delete[] pFans;
+		delete[] pQuadrics;
+		delete[] pLocked;
+		delete[] pDirty;
+		delete[] pCollapses;
+		return count;
+	}
+
+	#undef SIMPLIFY_POS
+}
@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSimplify.h
+//
+// Mesh simplification for levels of detail.  Edges are collapsed in order of their
+// quadric error (Garland and Heckbert), always moving one vertex onto a neighbour, so
+// every level draws from the vertex buffer of the full mesh and only needs its own
+// indices.  Vertices on open borders and on seams, where vertices share a position
+// but not their UVs or normals, are never moved, so submeshes keep meeting and
+// textures keep lining up.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+namespace Core
+{
+
+// Part of the triangles each level keeps of the one before it
+#define MESH_LOD_RATIO 0.5f
+
+// Meshes with fewer faces get no levels
+#define MESH_LOD_MIN_FACES 256
+
+// Largest error a level may have, as a part of the mesh radius
+#define MESH_LOD_MAX_ERROR 0.05f
+
+
+	//--------------------------------------------------------------------------------------
+	// Simplifies a triangle list to about targetIndices indices and returns how many there
+	// are in pOut, which must hold numIndices.  Collapses costing more than maxError, in
+	// object units, are not made.  pError gets the largest error of the collapses made.
+	// Positions are the first three floats of each vertex.
+	//--------------------------------------------------------------------------------------
+	int SimplifyMesh(const void* pVerts, UINT stride, int numVerts, const DWORD* pIndices, int numIndices,
+		DWORD* pOut, int targetIndices, float maxError, float* pError=NULL);
+
+}
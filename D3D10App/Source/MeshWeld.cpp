@@ -0,0 +1,185 @@
+//--------------------------------------------------------------------------------------
+// File: MeshWeld.cpp
+//
+// Vertex welding with a spatial hash
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ThreadPool.h"
+#include "MeshWeld.h"
+
+namespace Core
+{
+
+	// Cells past this are clamped, far away vertices share cells but still weld right
+	static const double WELD_CELL_LIMIT = 1073741823.0;
+
+	// Cells are this many times the tolerance, so along each axis a vertex can only reach
+	// the neighbour on the side it is closer to, and only if it is near that side
+	static const double WELD_CELL_SCALE = 2.5;
+
+	// Cell of a vertex, the hash of the cell and which neighbours it can reach, -1, 0 or 1
+	// along each axis
+	struct WeldCell
+	{
+		int		x, y, z;
+		UINT	Hash;
+		char	dx, dy, dz;
+	};
+
+	static inline UINT HashCell(int x, int y, int z)
+	{
+		return ((UINT)x*73856093u) ^ ((UINT)y*19349663u) ^ ((UINT)z*83492791u);
+	}
+
+	static inline int CellCoord(float v, double invCell, double reach, char& side)
+	{
+		double f = v*invCell;
+		double c = floor(f);
+		f -= c;
+		side = f<reach ? -1 : (1.0-f<reach ? 1 : 0);
+		return (int)max(-WELD_CELL_LIMIT, min(WELD_CELL_LIMIT, c));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Computes the cells in parallel
+	//--------------------------------------------------------------------------------------
+	struct WeldCellData
+	{
+		const Vertex*	pVerts;
+		WeldCell*		pCells;
+		double			InvCell;
+		double			Reach;		// Tolerance over the cell size, with a little margin
+	};
+
+	static void WeldCellJob(int start, int end, void* pData)
+	{
+		WeldCellData& d = *(WeldCellData*)pData;
+		for(int i=start; i<end; i++)
+		{
+			WeldCell& c = d.pCells[i];
+			c.x = CellCoord(d.pVerts[i].pos.x, d.InvCell, d.Reach, c.dx);
+			c.y = CellCoord(d.pVerts[i].pos.y, d.InvCell, d.Reach, c.dy);
+			c.z = CellCoord(d.pVerts[i].pos.z, d.InvCell, d.Reach, c.dz);
+			c.Hash = HashCell(c.x, c.y, c.z);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// True if two vertices weld
+	//--------------------------------------------------------------------------------------
+	static inline bool VertsMatch(const Vertex& a, const Vertex& b, float tolerance, DWORD flags)
+	{
+		if( fabs(a.pos.x-b.pos.x)>=tolerance || fabs(a.pos.y-b.pos.y)>=tolerance || fabs(a.pos.z-b.pos.z)>=tolerance )
+			return false;
+		if( (flags & WELD_UV) && (fabs(a.tu-b.tu)>=WELD_UV_TOLERANCE || fabs(a.tv-b.tv)>=WELD_UV_TOLERANCE) )
+			return false;
+		if( (flags & WELD_NORMAL) && D3DXVec3Dot(&a.normal, &b.normal)<WELD_NORMAL_COS )
+			return false;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Finds duplicate vertices.  Kept vertices are chained into a hash table by cell,
+	// and each new vertex takes the lowest kept index it matches in its cell and the
+	// up to seven neighbours it can reach.
+	//--------------------------------------------------------------------------------------
+	int WeldVertices(const Vertex* pVerts, int numVerts, DWORD* pRemap, float tolerance, DWORD flags)
+	{
+		if(numVerts<=0)
+			return 0;
+
+		WeldCell* pCells = new WeldCell[numVerts];
+		WeldCellData cells;
+		cells.pVerts = pVerts;
+		cells.pCells = pCells;
+		cells.InvCell = 1.0/(tolerance*WELD_CELL_SCALE);
+		cells.Reach = 1.00001/WELD_CELL_SCALE;
+		g_ThreadPool.ParallelFor(numVerts, WeldCellJob, &cells, 4096);
+
+		// At least twice as many buckets as vertices
+		UINT tableSize = 1024;
+		while(tableSize < (UINT)numVerts*2)
+			tableSize <<= 1;
+		UINT mask = tableSize-1;
+		int* pHead = new int[tableSize];
+		int* pNext = new int[numVerts];
+		memset(pHead, 0xff, tableSize*sizeof(int));
+
+		int numKept = 0;
+		for(int i=0; i<numVerts; i++)
+		{
+			const WeldCell& c = pCells[i];
+			int match = -1;
+			for(int z=0; z<=(c.dz!=0); z++)
+				for(int y=0; y<=(c.dy!=0); y++)
+					for(int x=0; x<=(c.dx!=0); x++)
+					{
+						// Chains may hold other cells, the test sorts it out
+						UINT h = (x|y|z) ? HashCell(c.x+x*c.dx, c.y+y*c.dy, c.z+z*c.dz) : c.Hash;
+						for(int k=pHead[h & mask]; k>=0; k=pNext[k])
+							if((match<0 || k<match) && VertsMatch(pVerts[k], pVerts[i], tolerance, flags))
+								match = k;
+					}
+
+			if(match>=0)
+				pRemap[i] = pRemap[match];
+			else
+			{
+				pRemap[i] = numKept++;
+				UINT h = c.Hash & mask;
+				pNext[i] = pHead[h];
+				pHead[h] = i;
+			}
+		}
+
+		delete[] pCells;
+		delete[] pHead;
+		delete[] pNext;
+		return numKept;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Moves the kept vertices down in place
+	//--------------------------------------------------------------------------------------
+	int CompactVertices(Vertex* pVerts, int numVerts, const DWORD* pRemap)
+	{
+		int numKept = 0;
+		for(int i=0; i<numVerts; i++)
+			if(pRemap[i]==(DWORD)numKept)
+				pVerts[numKept++] = pVerts[i];
+		return numKept;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Rewrites an index buffer through the remap table
+	//--------------------------------------------------------------------------------------
+	struct RemapIndicesData
+	{
+		DWORD*			pIndices;
+		const DWORD*	pRemap;
+	};
+
+	static void RemapIndicesJob(int start, int end, void* pData)
+	{
+		RemapIndicesData& d = *(RemapIndicesData*)pData;
+		for(int i=start; i<end; i++)
+			d.pIndices[i] = d.pRemap[d.pIndices[i]];
+	}
+
+	void RemapIndices(DWORD* pIndices, int numIndices, const DWORD* pRemap)
+	{
+		RemapIndicesData d;
+		d.pIndices = pIndices;
+		d.pRemap = pRemap;
+		g_ThreadPool.ParallelFor(numIndices, RemapIndicesJob, &d, 16384);
+	}
+}
@@ -0,0 +1,51 @@
+//--------------------------------------------------------------------------------------
+// File: MeshWeld.h
+//
+// Vertex welding with a spatial hash.  Positions are quantized to cells a little over
+// twice the tolerance, so any vertex close enough to another is in its cell or one of
+// the few neighbours on the sides it is near.  Vertices are visited in order and each
+// one goes to the first kept vertex it matches, or is kept itself, which gives the same
+// result as the old pairwise loop in one pass.  UVs and normals can be made to match
+// as well, so seams and hard edges survive.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Vertex.h"
+
+namespace Core
+{
+
+// Default tolerances, the position tolerance is per axis
+#define WELD_TOLERANCE 0.001f
+#define WELD_UV_TOLERANCE 0.0001f
+#define WELD_NORMAL_COS 0.9998f		// About one degree
+
+	// What else has to match besides the position
+	enum WELD_FLAG
+	{
+		WELD_UV = 1<<0,
+		WELD_NORMAL = 1<<1,
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Finds duplicate vertices.  pRemap gets the new index of each vertex and the number
+	// of vertices left is returned.  Kept vertices keep their order, so vertex i is kept
+	// if pRemap[i] is the number kept before it.
+	//--------------------------------------------------------------------------------------
+	int WeldVertices(const Vertex* pVerts, int numVerts, DWORD* pRemap, float tolerance=WELD_TOLERANCE, DWORD flags=0);
+
+	//--------------------------------------------------------------------------------------
+	// Moves the kept vertices down in place and returns how many there are
+	//--------------------------------------------------------------------------------------
+	int CompactVertices(Vertex* pVerts, int numVerts, const DWORD* pRemap);
+
+	//--------------------------------------------------------------------------------------
+	// Rewrites an index buffer through the remap table
+	//--------------------------------------------------------------------------------------
+	void RemapIndices(DWORD* pIndices, int numIndices, const DWORD* pRemap);
+
+}
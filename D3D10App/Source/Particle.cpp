@@ -10,189 +10,583 @@
 #include "stdafx.h"
 #include "Particle.h"
 #include "Device.h"
+#include "ThreadPool.h"
 
 namespace Core
 {
 	//--------------------------------------------------------------------------------------
 	// Creates new emitter
 	//--------------------------------------------------------------------------------------
-	void ParticleEmitter::Create(char* texFile, int maxParticles, int emitFrequency, float particleLife, Effect& effect, Camera& camera)
+	void ParticleEmitter::Create(const ParticleEmitterDesc& desc, Effect& effect, Camera& camera)
 	{
-		// Zero out the instance buffer
-		memset(m_instanceData,0,INTERNAL_MAX_BUFFERS*INTERNAL_MAX_INSTANCES*sizeof(InstanceData));
-		
-		// Create the particle memory block
-		m_Particles.Allocate(maxParticles);
-		for(int i=0; i<maxParticles; i++)
-			m_Pool.Push(&m_Particles[i]);
-		
-		
+		// Create the particle streams, the instances live in the renderer's shared buffer
+		m_Desc = desc;
+		m_Store.Create(desc.MaxParticles);
+		m_Program.Compile(desc);
+		m_Time = 0;
+		m_SpawnCount = 0;
+
 		// Setup
 		m_pEffect = &effect;
 		m_pCamera = &camera;
-		m_Texture = g_Textures.Load(texFile);
-		m_EmitFrequency = emitFrequency;
-		m_Lifetime = particleLife;
+		m_Texture = desc.Texture[0] ? g_Textures.Load(desc.Texture) : NULL;
+		m_Lifetime = desc.Lifetime;
+		SetDepthSort(desc.DepthSort, desc.SortGroup);
 
+		m_IsActive = true;
+	}
+
+	// The old test spray, as a description
+	void ParticleEmitter::Create(char* texFile, int maxParticles, int emitFrequency, float particleLife, Effect& effect, Camera& camera)
+	{
+		ParticleEmitterDesc desc;
+		strncpy(desc.Texture, texFile, sizeof(desc.Texture)-1);
+		desc.Texture[sizeof(desc.Texture)-1] = 0;
+		desc.MaxParticles = maxParticles;
+		desc.Lifetime = particleLife;
+		desc.Rate.Set(D3DXVECTOR4(emitFrequency*60.0f, 0, 0, 0));
+		desc.ConeAngle = D3DXToRadian(25.0f);
+		desc.MinSpeed = 0.5f;
+		desc.MaxSpeed = 3.5f;
+		Create(desc, effect, camera);
+	}
 
 
-		// Create a	resource with the input	matrices
-		D3D10_BUFFER_DESC bufferDesc =
+	//--------------------------------------------------------------------------------------
+	// Spawns a particle
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::SpawnParticle(D3DXVECTOR3& pos, D3DXVECTOR3& vel, D3DXVECTOR4& color)
+	{
+		D3DXVECTOR4 newVel;
+		D3DXVec3Transform(&newVel, &vel, &m_matRotation);
+		m_Store.Add(pos+m_Position, D3DXVECTOR3(newVel.x, newVel.y, newVel.z), color, m_Desc.Size.Evaluate(0).x);
+	}
+
+	// Spawns particles in the description's sphere, heading out through its cone
+	void ParticleEmitter::Spawn(int count)
+	{
+		count = Math::Min(count, m_Store.GetCapacity()-m_Store.GetCount());
+		if(count<=0)
+			return;
+
+		// Basis around the cone axis, turned with the emitter
+		D3DXVECTOR3 axis, tangent, bitangent;
+		D3DXVec3TransformNormal(&axis, &m_Desc.ConeAxis, &m_matRotation);
+		D3DXVec3Normalize(&axis, &axis);
+		D3DXVECTOR3 side = fabsf(axis.y)<0.99f ? D3DXVECTOR3(0, 1, 0) : D3DXVECTOR3(1, 0, 0);
+		D3DXVec3Cross(&tangent, &axis, &side);
+		D3DXVec3Normalize(&tangent, &tangent);
+		D3DXVec3Cross(&bitangent, &axis, &tangent);
+
+		const float cosAngle = cosf(m_Desc.ConeAngle);
+		const D3DXVECTOR4 c = m_Desc.Color.Evaluate(0);
+		const D3DXVECTOR4 color(c.x*m_Color.x, c.y*m_Color.y, c.z*m_Color.z, c.w*m_Color.w);
+		const float size = m_Desc.Size.Evaluate(0).x;
+		for(int i=0; i<count; i++)
 		{
-			INTERNAL_MAX_INSTANCES * sizeof( InstanceData ),
-			D3D10_USAGE_DEFAULT,
-			D3D10_BIND_CONSTANT_BUFFER,
-			0,
-			0
-		};
+			// Uniform over the cap of the cone
+			float cosTheta = 1.0f - Random()*(1.0f-cosAngle);
+			float sinTheta = sqrtf(Math::Max(1.0f-cosTheta*cosTheta, 0.0f));
+			float phi = Random()*2.0f*D3DX_PI;
+			D3DXVECTOR3 dir = axis*cosTheta + (tangent*cosf(phi) + bitangent*sinf(phi))*sinTheta;
+			float speed = Math::Lerp(m_Desc.MinSpeed, m_Desc.MaxSpeed, Random());
+
+			D3DXVECTOR3 pos = m_Position;
+			if(m_Desc.SpawnRadius>0)
+			{
+				D3DXVECTOR3 offset;
+				do
+				{
+					offset = D3DXVECTOR3(Random()*2-1, Random()*2-1, Random()*2-1);
+				} while(D3DXVec3LengthSq(&offset)>1.0f);
+				pos += offset*m_Desc.SpawnRadius;
+			}
+			m_Store.Add(pos, dir*speed, color, size);
+		}
+	}
 
-		// Make a series of small buffers to be used for constants based instancing.
-		for(int i=0;i<INTERNAL_MAX_BUFFERS;i++)
-			g_pd3dDevice->CreateBuffer( &bufferDesc, NULL, &m_pInstanceDataBuffer[i] );
 
-		m_IsActive = true;
+	//--------------------------------------------------------------------------------------
+	// Forces
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::AddGravity(const D3DXVECTOR3& acceleration)
+	{
+		ParticleForce f;
+		f.Type = PARTICLE_FORCE_GRAVITY;
+		f.Vector = acceleration;
+		f.Params = D3DXVECTOR3(0, 0, 0);
+		m_Program.AddForce(f);
+	}
+
+	void ParticleEmitter::AddDrag(float damping)
+	{
+		ParticleForce f;
+		f.Type = PARTICLE_FORCE_DRAG;
+		f.Vector = D3DXVECTOR3(0, 0, 0);
+		f.Params = D3DXVECTOR3(damping, 0, 0);
+		m_Program.AddForce(f);
+	}
+
+	void ParticleEmitter::AddVortex(const D3DXVECTOR3& center, float spin, float pull, float lift)
+	{
+		ParticleForce f;
+		f.Type = PARTICLE_FORCE_VORTEX;
+		f.Vector = center;
+		f.Params = D3DXVECTOR3(spin, pull, lift);
+		m_Program.AddForce(f);
+	}
+
+	void ParticleEmitter::AddCurlNoise(float frequency, float strength, float scrollSpeed)
+	{
+		ParticleForce f;
+		f.Type = PARTICLE_FORCE_CURL_NOISE;
+		f.Vector = D3DXVECTOR3(0, 0, 0);
+		f.Params = D3DXVECTOR3(frequency, strength, scrollSpeed);
+		m_Program.AddForce(f);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Spawns the new particles and grabs the camera basis for the billboards
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::BeginUpdate(float elapsedTime)
+	{
+		m_Time += elapsedTime;
+		m_Frame.ElapsedTime = elapsedTime;
+		m_Frame.Step = g_TimeScale;
+		m_Frame.Time = m_Time;
+		m_Frame.InvLifetime = 1.0f/m_Lifetime;
+		m_Frame.Origin = m_Position;
+		m_Frame.Tint = m_Color;
+
+		// The columns of the view matrix are the camera axes
+		const D3DXMATRIX& mView = m_pCamera->GetViewMatrix();
+		m_BillboardRight = D3DXVECTOR3(mView._11, mView._21, mView._31);
+		m_BillboardUp = D3DXVECTOR3(mView._12, mView._22, mView._32);
+		m_BillboardLook = D3DXVECTOR3(mView._13, mView._23, mView._33);
+		m_Eye = -(mView._41*m_BillboardRight + mView._42*m_BillboardUp + mView._43*m_BillboardLook);
+
+		// Spawn from the rate curve, the fraction of a particle left carries over
+		float t = m_Time;
+		if(m_Desc.RateLoop>0)
+			t = fmodf(t, m_Desc.RateLoop);
+		m_SpawnCount += m_Desc.Rate.Evaluate(t).x*elapsedTime;
+		int count = (int)m_SpawnCount;
+		m_SpawnCount -= count;
+		Spawn(count);
 	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Encode a world matrix into the instance buffer
+	// Runs the program, the callback and the integration over a run of particles
 	//--------------------------------------------------------------------------------------
-	void ParticleEmitter::SetWorldMatrix(int instance, D3DXMATRIX &mWorld)
+	void ParticleEmitter::Simulate(int start, int end)
 	{
-		m_instanceData[instance].world1 = D3DXVECTOR4(mWorld._11,mWorld._12,mWorld._13,mWorld._41);
-		m_instanceData[instance].world2 = D3DXVECTOR4(mWorld._21,mWorld._22,mWorld._23,mWorld._42);
-		m_instanceData[instance].world3 = D3DXVECTOR4(mWorld._31,mWorld._32,mWorld._33,mWorld._43);
+		ParticleSpan span = m_Store.GetSpan(start, end);
+		m_Program.Run(span, m_Frame);
+
+		// Run the simulation callback function
+		if(m_Callback)
+			(*m_Callback)(span, m_Frame.ElapsedTime, m_pCallbackData);
+
+		// Move and age
+		ParticleIntegrate(span, m_Frame.ElapsedTime, m_Frame.Step);
 	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Encode a color into the instance buffer
+	// Depth sorting
 	//--------------------------------------------------------------------------------------
-	void ParticleEmitter::SetColor(int instance, D3DXVECTOR4& color)
+	void ParticleEmitter::SetDepthSort(bool enable, int group)
 	{
-		m_instanceData[instance].color = color;
+		m_bDepthSort = enable;
+		m_SortGroup = group;
+		if(!enable)
+		{
+			m_Sorter.Release();
+			SAFE_DELETE_ARRAY(m_pSortKeys);
+			SAFE_DELETE_ARRAY(m_pSortOrder);
+			SAFE_DELETE_ARRAY(m_pSortScratch);
+		}
 	}
 
+	int ParticleEmitter::GetSortMemoryUsage()
+	{
+		if(!m_pSortKeys)
+			return 0;
+		return m_Store.GetCapacity()*(sizeof(USHORT)+sizeof(int)+sizeof(float)) + m_Sorter.GetMemoryUsage();
+	}
+
+	// Sorts the store back to front, so the particles start next frame nearly in order
+	void ParticleEmitter::SortParticles()
+	{
+		if(!m_pSortKeys)
+		{
+			m_pSortKeys = new USHORT[m_Store.GetCapacity()];
+			m_pSortOrder = new int[m_Store.GetCapacity()];
+			m_pSortScratch = new float[m_Store.GetCapacity()];
+		}
+
+		int count = m_Store.GetCount();
+		ParticleSpan span = m_Store.GetSpan();
+		ParticleDepthKeys(span, m_Eye, m_BillboardLook, m_pCamera->GetNearZ(), m_pCamera->GetFarZ(), m_pSortKeys);
+		m_Sorter.Sort(m_pSortKeys, count, m_pSortOrder);
+
+		// Most frames nothing moves far enough to change the order
+		for(int i=0; i<count; i++)
+			if(m_pSortOrder[i]!=i)
+			{
+				m_Store.Reorder(m_pSortOrder, m_pSortScratch);
+				break;
+			}
+	}
 
 
 	//--------------------------------------------------------------------------------------
-	// Spawns a particle
+	// Writes the instance data for a run of particles.  Every billboard shares the
+	// camera's rotation, so only the scale, translation and color change per particle.
 	//--------------------------------------------------------------------------------------
-	void ParticleEmitter::SpawnParticle(D3DXVECTOR3& pos, D3DXVECTOR3& vel, D3DXVECTOR4& color)
+	void ParticleEmitter::PackInstances(int start, int end, InstanceVertex* pDest)
 	{
-		if(!m_Pool.IsEmpty() && m_ActiveParticles.Length()<INTERNAL_MAX_INSTANCES*INTERNAL_MAX_BUFFERS)
+		const float* px = m_Store.GetStream(PARTICLE_POS_X);
+		const float* py = m_Store.GetStream(PARTICLE_POS_Y);
+		const float* pz = m_Store.GetStream(PARTICLE_POS_Z);
+		const float* pr = m_Store.GetStream(PARTICLE_COLOR_R);
+		const float* pg = m_Store.GetStream(PARTICLE_COLOR_G);
+		const float* pb = m_Store.GetStream(PARTICLE_COLOR_B);
+		const float* pa = m_Store.GetStream(PARTICLE_COLOR_A);
+		const float* ps = m_Store.GetStream(PARTICLE_SIZE);
+		const D3DXVECTOR3& r = m_BillboardRight;
+		const D3DXVECTOR3& u = m_BillboardUp;
+		const D3DXVECTOR3& l = m_BillboardLook;
+		for(int i=start; i<end; i++)
 		{
-			Particle* p = m_Pool.Pop();
-			p->Position = pos+m_Position;
-			D3DXVECTOR4 newVel;
-			D3DXVec3Transform(&newVel, &vel, &m_matRotation);
-			p->Velocity.x = newVel.x; p->Velocity.y = newVel.y; p->Velocity.z = newVel.z;
-			p->Age = 0;
-			p->Color = color;
-			m_ActiveParticles.Add(p);
+			InstanceVertex& inst = pDest[i-start];
+			const float s = ps[i];
+			inst.world1 = D3DXVECTOR4(r.x*s, r.y*s, r.z*s, px[i]);
+			inst.world2 = D3DXVECTOR4(u.x*s, u.y*s, u.z*s, py[i]);
+			inst.world3 = D3DXVECTOR4(l.x*s, l.y*s, l.z*s, pz[i]);
+			inst.color = D3DXVECTOR4(pr[i], pg[i], pb[i], pa[i]);
 		}
 	}
 
+
 	//--------------------------------------------------------------------------------------
-	// Updates the system
+	// Thread pool jobs, each item is a run of particles from one emitter
 	//--------------------------------------------------------------------------------------
-	void ParticleEmitter::Update(float elapsedTime)
+	struct ParticleJob
+	{
+		ParticleEmitter*	pEmitter;
+		int					start;
+		int					end;
+		InstanceVertex*		pDest;		// Where the run's instances go when packing
+	};
+
+	void ParticleEmitter::SimulateJob(int start, int end, void* pData)
+	{
+		ParticleJob* pJobs = (ParticleJob*)pData;
+		for(int i=start; i<end; i++)
+			pJobs[i].pEmitter->Simulate(pJobs[i].start, pJobs[i].end);
+	}
+
+	void ParticleEmitter::PackJob(int start, int end, void* pData)
 	{
-		if(!m_Callback)
+		ParticleJob* pJobs = (ParticleJob*)pData;
+		for(int i=start; i<end; i++)
+			pJobs[i].pEmitter->PackInstances(pJobs[i].start, pJobs[i].end, pJobs[i].pDest);
+	}
+
+	// Items are whole emitters here, the compaction moves particles across the store.
+	// Sorted stores keep their order so the next sort has little to do.
+	void ParticleEmitter::RemoveExpiredJob(int start, int end, void* pData)
+	{
+		ParticleEmitter** ppEmitters = (ParticleEmitter**)pData;
+		for(int i=start; i<end; i++)
 		{
-			MessageBoxA(NULL, "You must provide a particle simulation callback function.  Use ParticleEmitter::SetCallback()", "Fatal Error", MB_OK);
-			PostQuitMessage(-1);
-			return;
+			ParticleEmitter* p = ppEmitters[i];
+			p->m_Store.RemoveOlderThan(p->m_Lifetime, p->m_bDepthSort);
+			p->m_NumInstances = p->m_Store.GetCount();
 		}
-		if(!m_IsActive)
-			return;
-		
-		// Create the billboard matrix
-		// Billboard matrix
-		D3DXMATRIX mWorld, mR, mT;
-		D3DXMatrixRotationYawPitchRoll(&mR, m_pCamera->GetYDeg(), m_pCamera->GetXDeg(), 0);
+	}
 
-		// Set the texture
-		ID3D10ShaderResourceView* pSRV[] = {
-			m_Texture->GetResource(),
-			NULL,
-			NULL,
-			m_Texture->GetResource(),
-			NULL,
-			NULL,
-		};
-		BOOL pFlag[] = {true, false, false, true, false, false, };
-		m_pEffect->MaterialTextureFlagVariable->SetBoolArray(pFlag, 0, 6);
-		m_pEffect->MaterialTextureVariable->SetResourceArray(pSRV, 0, 6);
-		m_pEffect->MaterialDiffuseVariable->SetFloatVector((float*)&D3DXVECTOR4(1, 1, 1, 1));
+	void ParticleEmitter::SortJob(int start, int end, void* pData)
+	{
+		ParticleEmitter** ppEmitters = (ParticleEmitter**)pData;
+		for(int i=start; i<end; i++)
+			ppEmitters[i]->SortParticles();
+	}
 
-		// PURELY FOR TESTING, SHOULD BE SCRIPTED LATER
-		for(int i=0; i<m_EmitFrequency*g_TimeScale; i++)
-			SpawnParticle(D3DXVECTOR3(0,0,0), D3DXVECTOR3(rand()%50-rand()%50, rand()%350, rand()%50-rand()%50) / 100.0f, m_Color);
-		
-		// Update each particle
-		m_ActiveParticles.Itterate();
-		Particle* p;
-		int index=0;
-		while( (p=m_ActiveParticles.GetCurrent()) != NULL)
+	// Splits the live particles of the emitters into jobs
+	static void BuildParticleJobs(Array<ParticleEmitter*>& emitters, Array<ParticleJob>& jobs)
+	{
+		jobs.Clear();
+		for(int i=0; i<emitters.Size(); i++)
 		{
-			// Run the simulation callback function
-			(*m_Callback)(*p, elapsedTime);
+			int count = emitters[i]->GetNumParticles();
+			for(int start=0; start<count; start+=PARTICLE_JOB_SIZE)
+			{
+				ParticleJob job;
+				job.pEmitter = emitters[i];
+				job.start = start;
+				job.end = Math::Min(start+PARTICLE_JOB_SIZE, count);
+				job.pDest = NULL;
+				jobs.Add(job);
+			}
+		}
+	}
+
 
-			// Process and render
-			if(p->Age>m_Lifetime)
+	//--------------------------------------------------------------------------------------
+	// Merges the sorted emitters of a group.  Each draw takes as many particles from one
+	// emitter as come before the next particle of any other, so the draws together go
+	// back to front.  Clouds that are mixed right through each other would take a draw
+	// for every few particles, so past PARTICLE_MAX_GROUP_DRAWS the emitters are drawn
+	// whole instead, ordered by their middle particle.
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::MergeSortGroup(Array<ParticleEmitter*>& group, Array<ParticleDraw>& draws)
+	{
+		static Array<ParticleDraw> runs;
+		runs.Clear();
+		for(int i=0; i<group.Size(); i++)
+			group[i]->m_SortHead = 0;
+
+		while(runs.Size()<=PARTICLE_MAX_GROUP_DRAWS)
+		{
+			// The emitter with the farthest particle left goes next, ties go to the
+			// first emitter so the result doesn't flicker
+			int next = -1;
+			for(int i=0; i<group.Size(); i++)
+				if(group[i]->m_SortHead<group[i]->m_NumInstances && (next<0 || group[i]->GetSortHeadKey() < group[next]->GetSortHeadKey()))
+					next = i;
+			if(next<0)
+				break;
+
+			// It can draw up to the next particle of any other emitter
+			int limit = 65536;
+			for(int i=0; i<group.Size(); i++)
+				if(i!=next && group[i]->m_SortHead<group[i]->m_NumInstances)
+					limit = Math::Min(limit, group[i]->GetSortHeadKey() + (i>next ? 1 : 0));
+
+			// Binary search for the first key at or past the limit
+			ParticleEmitter* p = group[next];
+			const USHORT* pKeys = p->m_pSortKeys;
+			int lo = p->m_SortHead+1, hi = p->m_NumInstances;
+			while(lo<hi)
 			{
-				m_ActiveParticles.RemoveCurrent();
-				m_Pool.Push(p);
+				int mid = (lo+hi)/2;
+				if(pKeys[mid]<limit)
+					lo = mid+1;
+				else
+					hi = mid;
 			}
-			else
-			{	
-				// Draw the particle
-				D3DXMatrixTranslation(&mT, p->Position.x, p->Position.y, p->Position.z);
-				D3DXMatrixMultiply(&mWorld, &mR, &mT);
-				SetWorldMatrix(index, mWorld);
-				SetColor(index, p->Color);
-				m_ActiveParticles.StepForward();
-				index++;
-			}			
+
+			ParticleDraw draw;
+			draw.pEmitter = p;
+			draw.Start = p->m_SortHead;
+			draw.Count = lo-p->m_SortHead;
+			draw.FirstInstance = 0;
+			runs.Add(draw);
+			p->m_SortHead = lo;
 		}
 
-		// Fill the buffers
-		unsigned int buffersUsed = (m_ActiveParticles.Length() / INTERNAL_MAX_INSTANCES)+1;
-		for(unsigned int buffer = 0;buffer < buffersUsed ; buffer++)
+		if(runs.Size()<=PARTICLE_MAX_GROUP_DRAWS)
 		{
+			for(int i=0; i<runs.Size(); i++)
+				draws.Add(runs[i]);
+			return;
+		}
 
-			D3D10_BUFFER_DESC bDesc;
-			m_pInstanceDataBuffer[buffer]->GetDesc(&bDesc);
-			assert(bDesc.ByteWidth == INTERNAL_MAX_INSTANCES*sizeof(InstanceData));
+		// Too mixed, draw the emitters whole from the farthest in.  Groups are small so
+		// a selection sort on the middle keys is plenty.
+		for(int i=0; i<group.Size(); i++)
+			group[i]->m_SortHead = group[i]->m_NumInstances/2;
+		for(int i=0; i<group.Size(); i++)
+		{
+			int next = i;
+			for(int j=i+1; j<group.Size(); j++)
+				if(group[j]->GetSortHeadKey() < group[next]->GetSortHeadKey())
+					next = j;
+			ParticleEmitter* p = group[next];
+			group[next] = group[i];
+			group[i] = p;
 
-			g_pd3dDevice->UpdateSubresource(m_pInstanceDataBuffer[buffer],D3D10CalcSubresource(0,0,1),NULL,(void*)((byte*)m_instanceData + buffer*bDesc.ByteWidth),0,0);
+			ParticleDraw draw;
+			draw.pEmitter = p;
+			draw.Start = 0;
+			draw.Count = p->m_NumInstances;
+			draw.FirstInstance = 0;
+			draws.Add(draw);
 		}
+	}
 
 
-		ID3D10Buffer *pEffectConstantBuffer = NULL;
-		m_pEffect->InstanceConstantBuffer->GetConstantBuffer(&pEffectConstantBuffer);
+	//--------------------------------------------------------------------------------------
+	// Runs a stage's jobs on the thread pool, or in order on this thread
+	//--------------------------------------------------------------------------------------
+	static inline void RunParticleJobs(int count, PARALLEL_FUNC func, void* pData, bool bParallel)
+	{
+		if(bParallel)
+			g_ThreadPool.ParallelFor(count, func, pData);
+		else if(count>0)
+			func(0, count, pData);
+	}
+
 
-		// Draw the instances
-		for(unsigned int buffer = 0;buffer < buffersUsed ; buffer++)
+	//--------------------------------------------------------------------------------------
+	// Updates every active emitter on the thread pool
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::UpdateEmitters(Array<ParticleEmitter*>& emitters, InstanceBuffer& instances, Array<ParticleDraw>& draws, float elapsedTime)
+	{
+		int total = SimulateEmitters(emitters, draws, elapsedTime);
+		if(total==0)
+			return;
+
+		// Every draw gets a slice of one mapped batch, and the jobs write their
+		// instances straight into it
+		int first;
+		InstanceVertex* pInstances = (InstanceVertex*)instances.Map(total, first);
+		if(!pInstances)
 		{
-			int numInstances = INTERNAL_MAX_INSTANCES;
-			if(buffer == buffersUsed - 1)       // restrict drawing all instances in the final buffer to get an exact count
-				numInstances = m_ActiveParticles.Length() % INTERNAL_MAX_INSTANCES;
-
-			D3D10_BUFFER_DESC srcDesc;
-			D3D10_BUFFER_DESC dstDesc;
-			m_pInstanceDataBuffer[buffer]->GetDesc(&srcDesc);
-			pEffectConstantBuffer->GetDesc(&dstDesc);
-			g_pd3dDevice->CopyResource(pEffectConstantBuffer,m_pInstanceDataBuffer[buffer]);
-
-			// Draw
-			m_pEffect->Pass[PASS_INSTANCED]->Apply(0);
-			g_pd3dDevice->DrawInstanced(6,numInstances,0,0);
-			Device::FrameStats.DrawCalls++;
+			draws.Clear();
+			return;
 		}
-		Device::FrameStats.PolysDrawn += 2*m_ActiveParticles.Length();
-		SAFE_RELEASE(pEffectConstantBuffer);
+		PackEmitters(draws, pInstances);
+		instances.Unmap();
+		for(int i=0; i<draws.Size(); i++)
+			draws[i].FirstInstance += first;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Spawns, simulates and sorts the active emitters and lays out their draws
+	//--------------------------------------------------------------------------------------
+	int ParticleEmitter::SimulateEmitters(Array<ParticleEmitter*>& emitters, Array<ParticleDraw>& draws, float elapsedTime, bool bParallel)
+	{
+		static Array<ParticleEmitter*> active;
+		static Array<ParticleEmitter*> sorted;
+		static Array<ParticleEmitter*> group;
+		static Array<ParticleJob> jobs;
+
+		// Spawning is cheap next to the simulation, so each emitter starts its frame here
+		draws.Clear();
+		active.Clear();
+		for(int i=0; i<emitters.Size(); i++)
+			if(emitters[i]->m_IsActive)
+			{
+				emitters[i]->BeginUpdate(elapsedTime);
+				active.Add(emitters[i]);
+			}
+		if(active.IsEmpty())
+			return 0;
+
+		// Big emitters are split up and small ones share the pool, so the jobs are
+		// balanced however the particles are spread over the emitters
+		BuildParticleJobs(active, jobs);
+		RunParticleJobs(jobs.Size(), SimulateJob, (ParticleJob*)jobs, bParallel);
+		RunParticleJobs(active.Size(), RemoveExpiredJob, (ParticleEmitter**)active, bParallel);
+
+		// Sort whole emitters, one per job
+		sorted.Clear();
+		for(int i=0; i<active.Size(); i++)
+			if(active[i]->m_bDepthSort && active[i]->m_NumInstances>0)
+				sorted.Add(active[i]);
+		RunParticleJobs(sorted.Size(), SortJob, (ParticleEmitter**)sorted, bParallel);
+
+		// Draws go in emitter order, and a sort group goes where its first emitter is
+		for(int i=0; i<active.Size(); i++)
+		{
+			ParticleEmitter* p = active[i];
+			if(p->m_NumInstances==0)
+				continue;
+			if(!p->m_bDepthSort || p->m_SortGroup==0)
+			{
+				ParticleDraw draw;
+				draw.pEmitter = p;
+				draw.Start = 0;
+				draw.Count = p->m_NumInstances;
+				draw.FirstInstance = 0;
+				draws.Add(draw);
+				continue;
+			}
+
+			bool merged = false;
+			for(int j=0; j<i && !merged; j++)
+				merged = active[j]->m_bDepthSort && active[j]->m_SortGroup==p->m_SortGroup && active[j]->m_NumInstances>0;
+			if(merged)
+				continue;
+			group.Clear();
+			for(int j=i; j<active.Size(); j++)
+				if(active[j]->m_bDepthSort && active[j]->m_SortGroup==p->m_SortGroup && active[j]->m_NumInstances>0)
+					group.Add(active[j]);
+			MergeSortGroup(group, draws);
+		}
+
+		// The instances of each draw follow the one before
+		int total = 0;
+		for(int i=0; i<draws.Size(); i++)
+		{
+			draws[i].FirstInstance = total;
+			total += draws[i].Count;
+		}
+		return total;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Writes the instances of the draws in runs of particles
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::PackEmitters(Array<ParticleDraw>& draws, InstanceVertex* pDest, bool bParallel)
+	{
+		static Array<ParticleJob> jobs;
+		jobs.Clear();
+		for(int i=0; i<draws.Size(); i++)
+		{
+			ParticleDraw& draw = draws[i];
+			for(int start=0; start<draw.Count; start+=PARTICLE_JOB_SIZE)
+			{
+				ParticleJob job;
+				job.pEmitter = draw.pEmitter;
+				job.start = draw.Start+start;
+				job.end = draw.Start+Math::Min(start+PARTICLE_JOB_SIZE, draw.Count);
+				job.pDest = pDest+draw.FirstInstance+start;
+				jobs.Add(job);
+			}
+		}
+		RunParticleJobs(jobs.Size(), PackJob, (ParticleJob*)jobs, bParallel);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Draws the runs in order
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitter::RenderEmitters(Array<ParticleDraw>& draws)
+	{
+		for(int i=0; i<draws.Size(); i++)
+			draws[i].pEmitter->Render(draws[i].FirstInstance, draws[i].Count);
+	}
+
+	void ParticleEmitter::Render(int firstInstance, int count)
+	{
+		// Set the texture
+		ID3D10ShaderResourceView* pTex = m_Texture ? m_Texture->GetResource() : NULL;
+		ID3D10ShaderResourceView* pSRV[] = {
+			pTex,
+			NULL,
+			NULL,
+			pTex,
+			NULL,
+			NULL,
+		};
+		BOOL pFlag[] = {pTex!=NULL, false, false, pTex!=NULL, false, false, };
+		m_pEffect->MaterialTextureFlagVariable->SetBoolArray(pFlag, 0, 6);
+		m_pEffect->MaterialTextureVariable->SetResourceArray(pSRV, 0, 6);
+		m_pEffect->MaterialDiffuseVariable->SetFloatVector((float*)&D3DXVECTOR4(1, 1, 1, 1));
+
+		// Draw
+		m_pEffect->Pass[PASS_INSTANCED]->Apply(0);
+		g_pd3dDevice->DrawInstanced(6, count, 0, firstInstance);
+		Device::FrameStats.DrawCalls++;
+		Device::FrameStats.PolysDrawn += 2*count;
 	}
 
 
@@ -201,12 +595,10 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void ParticleEmitter::Release()
 	{
-		m_Particles.Release();
-		m_Pool.Release();
-		m_ActiveParticles.Release();
+		SetDepthSort(false);
+		m_Store.Release();
+		m_Program.Release();
 		g_Textures.Deref(m_Texture);
-
-		for(int i=0;i<INTERNAL_MAX_BUFFERS;i++)
-			SAFE_RELEASE(m_pInstanceDataBuffer[i]);
+		m_Texture = NULL;
 	}
 }
\ No newline at end of file
@@ -10,24 +10,36 @@
 
 #include "stdafx.h"
 #include "Array.cpp"
-#include "Stack.cpp"
-#include "LinkedList.cpp"
+#include "ParticleStore.h"
+#include "ParticleSort.h"
+#include "ParticleProgram.h"
 #include "Effect.h"
 #include "Camera.h"
+#include "Vertex.h"
+#include "InstanceBuffer.h"
 
 namespace Core
 {
 
-#define INTERNAL_MAX_INSTANCES 1024
-#define INTERNAL_MAX_BUFFERS 100
+// Particles per job when emitters are updated on the thread pool
+#define PARTICLE_JOB_SIZE 4096
 
-	// Basic particle data
-	struct Particle
+// Instances the shared particle instance buffer starts with, it grows as needed
+#define PARTICLE_INSTANCE_CAPACITY 65536
+
+// Most draws a merged sort group may be split into before its emitters are just drawn
+// one after another, farthest first
+#define PARTICLE_MAX_GROUP_DRAWS 64
+
+	class ParticleEmitter;
+
+	// A run of one emitter's particles, drawn from the shared instance buffer
+	struct ParticleDraw
 	{
-		D3DXVECTOR3 Position;
-		D3DXVECTOR3 Velocity;
-		D3DXVECTOR4 Color;
-		float Age;
+		ParticleEmitter*	pEmitter;
+		int					Start;				// First particle in the emitter's store
+		int					Count;
+		int					FirstInstance;
 	};
 
 
@@ -40,15 +52,48 @@ namespace Core
 			m_Position = D3DXVECTOR3(0,0,0);
 			SetRotation(D3DXVECTOR3(0,0,0));
 			m_Callback = NULL;
+			m_pCallbackData = NULL;
+			m_Time = 0;
+			m_SpawnCount = 0;
+			m_RandomState = 1;
+			m_NumInstances = 0;
 			m_IsActive = false;
+			m_bDepthSort = false;
+			m_SortGroup = 0;
+			m_pSortKeys = NULL;
+			m_pSortOrder = NULL;
+			m_pSortScratch = NULL;
+			m_SortHead = 0;
+			m_pEffect = NULL;
+			m_Texture = NULL;
+			m_pCamera = NULL;
 		}
 		
 
-		// Creates new emitter
+		// Creates an emitter from a description, see ParticleProgram.h for the file format.
+		// An empty texture name leaves the billboards untextured.
+		void Create(const ParticleEmitterDesc& desc, Effect& effect, Camera& camera);
+
+		// Creates an emitter that sprays emitFrequency particles a frame upwards
 		void Create(char* texFile, int maxParticles, int emitFrequency, float particleLife, Effect& effect, Camera& camera);
 
-		// Updates the system
-		void Update(float elapsedTime);
+		// Simulates every active emitter and packs their instance data straight into the
+		// shared instance buffer.  The emitters are split into runs of particles that are
+		// spread over the thread pool, so this should be called once per frame after the
+		// camera has moved and before anything is drawn.  draws is filled with the runs to
+		// draw, in order.
+		static void UpdateEmitters(Array<ParticleEmitter*>& emitters, InstanceBuffer& instances, Array<ParticleDraw>& draws, float elapsedTime);
+
+		// The two halves of UpdateEmitters().  SimulateEmitters() fills draws with
+		// instances counted from zero and returns how many there are, PackEmitters() writes
+		// them to pDest.  With bParallel false every stage runs on the calling thread in
+		// the same order, which gives the same particles and instances as the pool.
+		static int SimulateEmitters(Array<ParticleEmitter*>& emitters, Array<ParticleDraw>& draws, float elapsedTime, bool bParallel=true);
+		static void PackEmitters(Array<ParticleDraw>& draws, InstanceVertex* pDest, bool bParallel=true);
+
+		// Draws the runs from UpdateEmitters(), the instance buffer must be bound to slot 1
+		// with the InstanceVertex layout
+		static void RenderEmitters(Array<ParticleDraw>& draws);
 
 		// Spawns a particle
 		void SpawnParticle(D3DXVECTOR3& pos, D3DXVECTOR3& vel, D3DXVECTOR4& color);
@@ -59,11 +104,39 @@ namespace Core
 		// Set the position
 		inline void SetPosition(D3DXVECTOR3& pos){ m_Position = pos; }
 
+		// Restarts the spawning random numbers, emitters with the same seed spawn alike
+		inline void SetSeed(UINT seed){ m_RandomState = seed ? seed : 1; }
+
 		// Set the direction
 		inline void SetRotation(D3DXVECTOR3& dir){ D3DXMatrixRotationYawPitchRoll(&m_matRotation, dir.x, dir.y, dir.z); }
 
-		// Set the simulation callback function
-		inline void SetCallback(void (*foo)(Particle&, const float&)){ m_Callback=foo; }
+		// Set the simulation callback function, it is called with runs of particles after
+		// the program and before they are moved.  The runs are handled on the thread pool,
+		// so the callback may be called from several threads at once.
+		inline void SetCallback(PARTICLE_BATCH_FUNC foo, void* pData=NULL){ m_Callback=foo; m_pCallbackData=pData; }
+
+		// Forces, applied after the ones in the description in the order they were added
+		void AddGravity(const D3DXVECTOR3& acceleration);
+		void AddDrag(float damping);
+		void AddVortex(const D3DXVECTOR3& center, float spin, float pull, float lift);
+		void AddCurlNoise(float frequency, float strength, float scrollSpeed);
+
+		// Clears the program, the description's forces and curves go too
+		inline void ClearForces(){ m_Program.Clear(); }
+
+		// Sorts the particles back to front every frame, for alpha blending.  Sorted
+		// emitters that share a nonzero group are merged by depth, so overlapping systems
+		// blend with each other too.
+		void SetDepthSort(bool enable, int group=0);
+
+		// Properties
+		inline int GetNumParticles(){ return m_Store.GetCount(); }
+		inline ParticleStore& GetStore(){ return m_Store; }
+		inline bool IsActive(){ return m_IsActive; }
+
+		// Bytes used by the emitter, the particles are most of it
+		inline int GetMemoryUsage(){ return sizeof(ParticleEmitter) + m_Store.GetMemoryUsage() + m_Program.GetMemoryUsage() + GetSortMemoryUsage(); }
+		int GetSortMemoryUsage();
 
 		// Change status
 		inline void Activate(bool enable){ m_IsActive=enable; }
@@ -71,44 +144,68 @@ namespace Core
 		// Frees mem
 		void Release();
 
-	private:		
-		Array<Particle>		  m_Particles;			// Particle memory block
-		LinkedList<Particle*> m_ActiveParticles;	// Active particles in the scene
-		Stack<Particle*>	  m_Pool;				// Pool of reserve particles
+	private:
+
+		// Stages of UpdateEmitters().  The first one spawns and runs on the calling thread,
+		// the others only touch the particles in [start, end) so they can run in parallel.
+		void BeginUpdate(float elapsedTime);
+		void Spawn(int count);
+		void Simulate(int start, int end);
+		void SortParticles();
+		void PackInstances(int start, int end, InstanceVertex* pDest);
+
+		// Thread pool jobs for the stages
+		static void SimulateJob(int start, int end, void* pData);
+		static void RemoveExpiredJob(int start, int end, void* pData);
+		static void SortJob(int start, int end, void* pData);
+		static void PackJob(int start, int end, void* pData);
+
+		// Interleaves the sorted particles of a group into draws, farthest first
+		static void MergeSortGroup(Array<ParticleEmitter*>& group, Array<ParticleDraw>& draws);
+		inline int GetSortHeadKey(){ return m_pSortKeys[m_SortHead]; }
+
+		// Spawning random numbers, each emitter has its own so effects repeat
+		inline float Random(){ m_RandomState ^= m_RandomState<<13; m_RandomState ^= m_RandomState>>17; m_RandomState ^= m_RandomState<<5; return (m_RandomState & 0xffffff)/16777215.0f; }
+
+		// Draws a run of the instances
+		void Render(int firstInstance, int count);
+
+		ParticleStore		  m_Store;				// Particle streams, live particles first
+		ParticleEmitterDesc	  m_Desc;				// Spawn settings
+		ParticleProgram		  m_Program;			// Forces and curves, compiled from the description
 		Effect*				  m_pEffect;			// The effect to use for drawing
 		Texture*			  m_Texture;			// Texture for billboards
 		Camera*				  m_pCamera;			// Camera for billboarding
-		int					  m_EmitFrequency;		// Number of particles emitted per frame
-		D3DXVECTOR4			  m_Color;				// Particle color
+		D3DXVECTOR4			  m_Color;				// Particle color, tints the color curve
 		D3DXVECTOR3			  m_Position;			// Emitter position
 		D3DXMATRIX			  m_matRotation;		// Rotation matrix for velocity direction
 		bool				  m_IsActive;			// True for processing
 
 		// Properties
 		float		m_Lifetime;		// Time for a particle to live, in seconds
+		float		m_Time;			// Time the emitter has been running, scrolls the noise
+		float		m_SpawnCount;	// Particles owed, spawning keeps the fraction between frames
+		UINT		m_RandomState;
+		int			m_NumInstances;	// Instances packed for drawing
+		ParticleFrame m_Frame;		// What the program sees this update
+
+		// Camera basis for the billboards
+		D3DXVECTOR3 m_BillboardRight;
+		D3DXVECTOR3 m_BillboardUp;
+		D3DXVECTOR3 m_BillboardLook;
+		D3DXVECTOR3 m_Eye;
+
+		// Depth sorting, the keys are left in the sorted order of the store for merging
+		bool			m_bDepthSort;
+		int				m_SortGroup;
+		ParticleSorter	m_Sorter;
+		USHORT*			m_pSortKeys;
+		int*			m_pSortOrder;
+		float*			m_pSortScratch;
+		int				m_SortHead;		// Next particle to merge
 
 		// Simulation callback function
-		void (*m_Callback)(Particle&, const float&);
-
-		////////////////////////////
-		// Instancing
-
-		struct InstanceData
-		{
-			D3DXVECTOR4 world1;			// the world transform for this matrix row 1
-			D3DXVECTOR4 world2;			// the world transform for this matrix row 2
-			D3DXVECTOR4 world3;			// the world transform for this matrix row 3 (row 4 is implicit)
-			D3DXVECTOR4 color;
-		};
-
-		// Encode a world matrix into the instance buffer
-		void SetWorldMatrix(int instance, D3DXMATRIX &mWorld);
-
-		// Encode a color into the instance buffer
-		void SetColor(int instance, D3DXVECTOR4& color);
-
-		InstanceData					m_instanceData[INTERNAL_MAX_BUFFERS*INTERNAL_MAX_INSTANCES];
-		D3DXMATRIX						m_initialMatrix[INTERNAL_MAX_BUFFERS*INTERNAL_MAX_INSTANCES];
-		ID3D10Buffer*					m_pInstanceDataBuffer[INTERNAL_MAX_BUFFERS];
+		PARTICLE_BATCH_FUNC	m_Callback;
+		void*				m_pCallbackData;
 	};
 }
\ No newline at end of file
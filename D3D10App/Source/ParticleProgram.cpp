@@ -0,0 +1,367 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleProgram.cpp
+//
+// Emitter descriptions and the compiled particle programs
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ParticleProgram.h"
+#include <fstream>
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Curves
+	//--------------------------------------------------------------------------------------
+	bool ParticleCurve::AddKey(float time, const D3DXVECTOR4& value)
+	{
+		if(NumKeys>=PARTICLE_MAX_KEYS)
+			return false;
+
+		// Keys with the same time stay in the order they were added, for steps
+		int i = NumKeys++;
+		for(; i>0 && Time[i-1]>time; i--)
+		{
+			Time[i] = Time[i-1];
+			Value[i] = Value[i-1];
+		}
+		Time[i] = time;
+		Value[i] = value;
+		return true;
+	}
+
+	D3DXVECTOR4 ParticleCurve::Evaluate(float t) const
+	{
+		if(NumKeys==0)
+			return D3DXVECTOR4(0, 0, 0, 0);
+		if(t<=Time[0])
+			return Value[0];
+		for(int i=1; i<NumKeys; i++)
+			if(t<Time[i])
+			{
+				float w = (t-Time[i-1]) / (Time[i]-Time[i-1]);
+				return Value[i-1] + (Value[i]-Value[i-1])*w;
+			}
+		return Value[NumKeys-1];
+	}
+
+	bool ParticleCurve::IsConstant() const
+	{
+		for(int i=1; i<NumKeys; i++)
+			if(Value[i]!=Value[0])
+				return false;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Defaults
+	//--------------------------------------------------------------------------------------
+	void ParticleEmitterDesc::SetDefaults()
+	{
+		strcpy(Texture, "Textures\\particle.jpg");
+		MaxParticles = 10000;
+		Lifetime = 4.0f;
+		Rate.Set(D3DXVECTOR4(600, 0, 0, 0));
+		RateLoop = 0;
+		SpawnRadius = 0;
+		ConeAxis = D3DXVECTOR3(0, 1, 0);
+		ConeAngle = 0;
+		MinSpeed = MaxSpeed = 1.0f;
+		Color.Set(D3DXVECTOR4(1, 1, 1, 1));
+		Size.Set(D3DXVECTOR4(1, 0, 0, 0));
+		NumForces = 0;
+		DepthSort = false;
+		SortGroup = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Loads a description file
+	//--------------------------------------------------------------------------------------
+	bool ParticleEmitterDesc::Load(const char* file)
+	{
+		std::ifstream stream(file);
+		if(!stream.is_open())
+		{
+			Log::Print("ParticleEmitterDesc::Load() can't open %s", file);
+			return false;
+		}
+		return Parse(stream, file);
+	}
+
+	// Adds a force if there is room
+	static bool AddDescForce(ParticleEmitterDesc& desc, PARTICLE_FORCE type, const D3DXVECTOR3& vec, const D3DXVECTOR3& params)
+	{
+		if(desc.NumForces>=PARTICLE_MAX_FORCES)
+			return false;
+		ParticleForce& f = desc.Forces[desc.NumForces++];
+		f.Type = type;
+		f.Vector = vec;
+		f.Params = params;
+		return true;
+	}
+
+	bool ParticleEmitterDesc::Parse(std::istream& stream, const char* name)
+	{
+		SetDefaults();
+
+		// The first key of a curve replaces the default
+		bool bRate = false, bColor = false, bSize = false;
+
+		char buf[256];
+		int line = 0;
+		while(stream.getline(buf, 255))
+		{
+			line++;
+			char* pComment = strchr(buf, '#');
+			if(pComment)
+				*pComment = 0;
+			char keyword[64];
+			if(sscanf(buf, "%63s", keyword)!=1)
+				continue;
+			const char* args = strstr(buf, keyword) + strlen(keyword);
+
+			float v[6];
+			bool ok = true;
+			if(strcmp(keyword, "texture")==0)
+			{
+				ok = sscanf(args, " %255[^\r\n]", Texture)==1;
+				for(int i=(int)strlen(Texture)-1; i>=0 && (Texture[i]==' ' || Texture[i]=='\t'); i--)
+					Texture[i] = 0;
+			}
+			else if(strcmp(keyword, "max_particles")==0)
+				ok = sscanf(args, "%d", &MaxParticles)==1 && MaxParticles>0;
+			else if(strcmp(keyword, "lifetime")==0)
+				ok = sscanf(args, "%f", &Lifetime)==1 && Lifetime>0;
+			else if(strcmp(keyword, "rate")==0)
+			{
+				if(!bRate)
+					Rate.NumKeys = 0;
+				bRate = true;
+				ok = sscanf(args, "%f %f", &v[0], &v[1])==2 && v[1]>=0 && Rate.AddKey(v[0], D3DXVECTOR4(v[1], 0, 0, 0));
+			}
+			else if(strcmp(keyword, "rate_loop")==0)
+				ok = sscanf(args, "%f", &RateLoop)==1 && RateLoop>=0;
+			else if(strcmp(keyword, "spawn_radius")==0)
+				ok = sscanf(args, "%f", &SpawnRadius)==1;
+			else if(strcmp(keyword, "cone")==0)
+			{
+				ok = sscanf(args, "%f %f %f %f", &v[0], &v[1], &v[2], &v[3])==4;
+				ConeAxis = D3DXVECTOR3(v[0], v[1], v[2]);
+				ok = ok && D3DXVec3Length(&ConeAxis)>0;
+				if(ok)
+					D3DXVec3Normalize(&ConeAxis, &ConeAxis);
+				ConeAngle = D3DXToRadian(Math::Clamp(v[3], 0.0f, 180.0f));
+			}
+			else if(strcmp(keyword, "speed")==0)
+				ok = sscanf(args, "%f %f", &MinSpeed, &MaxSpeed)==2;
+			else if(strcmp(keyword, "color")==0)
+			{
+				if(!bColor)
+					Color.NumKeys = 0;
+				bColor = true;
+				ok = sscanf(args, "%f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4])==5 && Color.AddKey(v[0], D3DXVECTOR4(v[1], v[2], v[3], v[4]));
+			}
+			else if(strcmp(keyword, "size")==0)
+			{
+				if(!bSize)
+					Size.NumKeys = 0;
+				bSize = true;
+				ok = sscanf(args, "%f %f", &v[0], &v[1])==2 && Size.AddKey(v[0], D3DXVECTOR4(v[1], 0, 0, 0));
+			}
+			else if(strcmp(keyword, "gravity")==0)
+				ok = sscanf(args, "%f %f %f", &v[0], &v[1], &v[2])==3 &&
+					AddDescForce(*this, PARTICLE_FORCE_GRAVITY, D3DXVECTOR3(v[0], v[1], v[2]), D3DXVECTOR3(0, 0, 0));
+			else if(strcmp(keyword, "drag")==0)
+				ok = sscanf(args, "%f", &v[0])==1 && v[0]>=0 &&
+					AddDescForce(*this, PARTICLE_FORCE_DRAG, D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(v[0], 0, 0));
+			else if(strcmp(keyword, "vortex")==0)
+				ok = sscanf(args, "%f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5])==6 &&
+					AddDescForce(*this, PARTICLE_FORCE_VORTEX, D3DXVECTOR3(v[0], v[1], v[2]), D3DXVECTOR3(v[3], v[4], v[5]));
+			else if(strcmp(keyword, "curl")==0)
+				ok = sscanf(args, "%f %f %f", &v[0], &v[1], &v[2])==3 &&
+					AddDescForce(*this, PARTICLE_FORCE_CURL_NOISE, D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(v[0], v[1], v[2]));
+			else if(strcmp(keyword, "sort")==0)
+			{
+				ok = sscanf(args, "%d", &SortGroup)==1 && SortGroup>=0;
+				DepthSort = true;
+			}
+			else
+			{
+				Log::Print("%s(%d): unknown setting '%s'", name, line, keyword);
+				return false;
+			}
+
+			if(!ok)
+			{
+				Log::Print("%s(%d): bad values for '%s'", name, line, keyword);
+				return false;
+			}
+		}
+
+		if(MinSpeed>MaxSpeed)
+		{
+			float t = MinSpeed; MinSpeed = MaxSpeed; MaxSpeed = t;
+		}
+		return true;
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Operator kernels.  The forces forward to the integrators, the curves add up their
+	// ramps four particles at a time.
+	//--------------------------------------------------------------------------------------
+	static void GravityKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame)
+	{
+		ParticleGravity(span, op.Vector, frame.Step);
+	}
+
+	static void DragKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame)
+	{
+		ParticleDrag(span, op.Params.x, frame.Step);
+	}
+
+	static void VortexKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame)
+	{
+		ParticleVortex(span, op.Vector+frame.Origin, op.Params.x, op.Params.y, op.Params.z, frame.Step);
+	}
+
+	static void CurlNoiseKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame)
+	{
+		ParticleCurlNoise(span, op.Params.x, op.Params.y, frame.Time*op.Params.z, frame.Step);
+	}
+
+	// Baked curve over life, for count components starting at stream first
+	static inline void CurveKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame, int first, int count, const float* pTint)
+	{
+		const float* pAge = span.Stream[PARTICLE_AGE];
+		const __m128 vInvLife = _mm_set1_ps(frame.InvLifetime);
+		const __m128 vZero = _mm_setzero_ps(), vOne = _mm_set1_ps(1.0f);
+		const float* pBase = (const float*)&op.Base;
+
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			__m128 t = _mm_mul_ps(_mm_loadu_ps(pAge+i), vInvLife);
+			__m128 w[PARTICLE_MAX_KEYS-1];
+			for(int r=0; r<op.NumRamps; r++)
+			{
+				__m128 x = _mm_mul_ps(_mm_sub_ps(t, _mm_set1_ps(op.Ramps[r].Start)), _mm_set1_ps(op.Ramps[r].Scale));
+				w[r] = _mm_min_ps(_mm_max_ps(x, vZero), vOne);
+			}
+			for(int c=0; c<count; c++)
+			{
+				__m128 v = _mm_set1_ps(pBase[c]);
+				for(int r=0; r<op.NumRamps; r++)
+					v = _mm_add_ps(v, _mm_mul_ps(w[r], _mm_set1_ps(((const float*)&op.Ramps[r].Delta)[c])));
+				_mm_storeu_ps(span.Stream[first+c]+i, _mm_mul_ps(v, _mm_set1_ps(pTint[c])));
+			}
+		}
+		for(; i<span.Count; i++)
+		{
+			float t = pAge[i]*frame.InvLifetime;
+			float w[PARTICLE_MAX_KEYS-1];
+			for(int r=0; r<op.NumRamps; r++)
+				w[r] = Math::Min(Math::Max((t-op.Ramps[r].Start)*op.Ramps[r].Scale, 0.0f), 1.0f);
+			for(int c=0; c<count; c++)
+			{
+				float v = pBase[c];
+				for(int r=0; r<op.NumRamps; r++)
+					v += w[r]*((const float*)&op.Ramps[r].Delta)[c];
+				span.Stream[first+c][i] = v*pTint[c];
+			}
+		}
+	}
+
+	static void ColorKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame)
+	{
+		CurveKernel(span, op, frame, PARTICLE_COLOR_R, 4, (const float*)&frame.Tint);
+	}
+
+	static void SizeKernel(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame)
+	{
+		const float one = 1.0f;
+		CurveKernel(span, op, frame, PARTICLE_SIZE, 1, &one);
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Compiles a description
+	//--------------------------------------------------------------------------------------
+	void ParticleProgram::Compile(const ParticleEmitterDesc& desc)
+	{
+		m_Ops.Clear();
+		for(int i=0; i<desc.NumForces; i++)
+			AddForce(desc.Forces[i]);
+		if(!desc.Color.IsConstant())
+			AddCurve(ColorKernel, desc.Color);
+		if(!desc.Size.IsConstant())
+			AddCurve(SizeKernel, desc.Size);
+	}
+
+	void ParticleProgram::AddForce(const ParticleForce& force)
+	{
+		ParticleOp op;
+		memset(&op, 0, sizeof(op));
+		op.Vector = force.Vector;
+		op.Params = force.Params;
+		switch(force.Type)
+		{
+		case PARTICLE_FORCE_GRAVITY:
+			op.Kernel = GravityKernel;
+			break;
+		case PARTICLE_FORCE_DRAG:
+			op.Kernel = DragKernel;
+			break;
+		case PARTICLE_FORCE_VORTEX:
+			op.Kernel = VortexKernel;
+			break;
+		case PARTICLE_FORCE_CURL_NOISE:
+			op.Kernel = CurlNoiseKernel;
+			break;
+		default:
+			return;
+		}
+		m_Ops.Add(op);
+	}
+
+	// Each pair of keys becomes a ramp that goes from 0 to 1 between their times, so
+	// the curve is the first value plus every ramp times the change across it.  Keys at
+	// the same time give a ramp that is a step.
+	void ParticleProgram::AddCurve(PARTICLE_KERNEL kernel, const ParticleCurve& curve)
+	{
+		ParticleOp op;
+		memset(&op, 0, sizeof(op));
+		op.Kernel = kernel;
+		op.Base = curve.Value[0];
+		for(int i=1; i<curve.NumKeys; i++)
+		{
+			ParticleRamp& r = op.Ramps[op.NumRamps++];
+			float width = curve.Time[i]-curve.Time[i-1];
+			r.Start = curve.Time[i-1];
+			r.Scale = width>1e-6f ? 1.0f/width : 1e6f;
+			r.Delta = curve.Value[i]-curve.Value[i-1];
+		}
+		m_Ops.Add(op);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Runs the program
+	//--------------------------------------------------------------------------------------
+	void ParticleProgram::Run(ParticleSpan& span, const ParticleFrame& frame)
+	{
+		for(int i=0; i<m_Ops.Size(); i++)
+			(*m_Ops[i].Kernel)(span, m_Ops[i], frame);
+	}
+
+}
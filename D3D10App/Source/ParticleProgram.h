@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleProgram.h
+//
+// Data driven particle effects.  An emitter description is read from a text file and
+// compiled into a program, a flat list of operators that each run one SSE kernel over a
+// whole span of particles.  Curves are baked into ramps when the program is compiled,
+// so the kernels never search for keys, and nothing is called per particle.
+//
+// Description files have one setting per line, # starts a comment.  Rates are per step
+// (1/60 of a second) like the rest of the engine's motion, except spawning which is in
+// particles per second.
+//
+//	texture		Textures\smoke.jpg
+//	max_particles	10000
+//	lifetime	6				# Seconds
+//	rate		0 600			# Spawn rate keys, seconds of emitter time and particles per second
+//	rate_loop	2				# Repeats the rate curve every 2 seconds
+//	spawn_radius	0.5			# Particles start in a sphere around the emitter
+//	cone		0 1 0 20		# Velocity axis and half angle in degrees
+//	speed		1 3.5			# Speed range
+//	color		0 1 1 1 1		# Color keys over life, life goes 0 to 1
+//	color		1 1 1 1 0
+//	size		0 1				# Size keys over life
+//	gravity		0 -0.0075 0
+//	drag		0.9
+//	vortex		0 0 0 0.02 0.004 0.033	# Center, spin, pull, lift
+//	curl		0.15 0.002 0.5			# Frequency, strength, scroll speed
+//	sort		1				# Back to front sorting in sort group 1, 0 for no group
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include <iosfwd>
+#include "Array.cpp"
+#include "ParticleStore.h"
+
+namespace Core
+{
+
+// Keys in a curve
+#define PARTICLE_MAX_KEYS 8
+
+// Forces in a description
+#define PARTICLE_MAX_FORCES 8
+
+	// Built in forces
+	enum PARTICLE_FORCE
+	{
+		PARTICLE_FORCE_GRAVITY=0,
+		PARTICLE_FORCE_DRAG,
+		PARTICLE_FORCE_VORTEX,
+		PARTICLE_FORCE_CURL_NOISE,
+	};
+
+	// A force and its settings, what the fields mean depends on the type
+	struct ParticleForce
+	{
+		PARTICLE_FORCE	Type;
+		D3DXVECTOR3		Vector;		// Gravity acceleration, or the vortex center relative to the emitter
+		D3DXVECTOR3		Params;		// Drag (damping), vortex (spin, pull, lift), noise (frequency, strength, scroll speed)
+	};
+
+
+	// Piecewise linear curve, scalar curves only use x
+	struct ParticleCurve
+	{
+		int			NumKeys;
+		float		Time[PARTICLE_MAX_KEYS];
+		D3DXVECTOR4	Value[PARTICLE_MAX_KEYS];
+
+		inline void Set(const D3DXVECTOR4& value){ NumKeys=1; Time[0]=0; Value[0]=value; }
+
+		// Adds a key in time order, returns false if the curve is full
+		bool AddKey(float time, const D3DXVECTOR4& value);
+
+		// Value at time t, held flat past the first and last keys
+		D3DXVECTOR4 Evaluate(float t) const;
+
+		// True if every key has the same value
+		bool IsConstant() const;
+	};
+
+
+	// Everything an emitter file sets
+	struct ParticleEmitterDesc
+	{
+		char			Texture[256];
+		int				MaxParticles;
+		float			Lifetime;					// Seconds a particle lives
+		ParticleCurve	Rate;						// Particles per second over the emitter's time
+		float			RateLoop;					// Period of the rate curve, 0 to hold the last key
+		float			SpawnRadius;
+		D3DXVECTOR3		ConeAxis;
+		float			ConeAngle;					// Half angle in radians
+		float			MinSpeed;
+		float			MaxSpeed;
+		ParticleCurve	Color;						// Over life
+		ParticleCurve	Size;						// Over life
+		ParticleForce	Forces[PARTICLE_MAX_FORCES];
+		int				NumForces;
+		bool			DepthSort;
+		int				SortGroup;
+
+		ParticleEmitterDesc(){ SetDefaults(); }
+
+		// A white point emitter going straight up with no forces
+		void SetDefaults();
+
+		// Reads a description file, returns false and logs the line if anything is wrong
+		bool Load(const char* file);
+		bool Parse(std::istream& stream, const char* name);
+	};
+
+
+	// Per frame values the operators read
+	struct ParticleFrame
+	{
+		float		ElapsedTime;	// Seconds
+		float		Step;			// Steps this frame, g_TimeScale
+		float		Time;			// Seconds the emitter has run, scrolls the noise
+		float		InvLifetime;	// Turns age into life from 0 to 1
+		D3DXVECTOR3	Origin;			// Emitter position, forces are placed relative to it
+		D3DXVECTOR4	Tint;			// Multiplies the color curve
+	};
+
+
+	// A ramp of a baked curve, the curve is Base plus the sum of
+	// clamp((t-Start)*Scale, 0, 1)*Delta over its ramps
+	struct ParticleRamp
+	{
+		float		Start;
+		float		Scale;
+		D3DXVECTOR4	Delta;
+	};
+
+	struct ParticleOp;
+	typedef void (*PARTICLE_KERNEL)(ParticleSpan& span, const ParticleOp& op, const ParticleFrame& frame);
+
+	// One step of a program, the kernel and what it was compiled with
+	struct ParticleOp
+	{
+		PARTICLE_KERNEL	Kernel;
+		D3DXVECTOR3		Vector;
+		D3DXVECTOR3		Params;
+		D3DXVECTOR4		Base;
+		ParticleRamp	Ramps[PARTICLE_MAX_KEYS-1];
+		int				NumRamps;
+	};
+
+
+	class ParticleProgram
+	{
+	public:
+		~ParticleProgram(){ Release(); }
+
+		// Builds the operators for the forces, then the color and size over life.
+		// Constant curves are left out since particles spawn with the value.
+		void Compile(const ParticleEmitterDesc& desc);
+
+		// Appends a force
+		void AddForce(const ParticleForce& force);
+
+		// Runs every operator over the span in order
+		void Run(ParticleSpan& span, const ParticleFrame& frame);
+
+		inline void Clear(){ m_Ops.Clear(); }
+		inline void Release(){ m_Ops.Release(); }
+
+		// Properties
+		inline int GetNumOps(){ return m_Ops.Size(); }
+		inline int GetMemoryUsage(){ return m_Ops.Size()*sizeof(ParticleOp); }
+
+	private:
+		void AddCurve(PARTICLE_KERNEL kernel, const ParticleCurve& curve);
+
+		Array<ParticleOp>	m_Ops;
+	};
+
+}
@@ -0,0 +1,211 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleSort.cpp
+//
+// Back to front sorting for alpha blended particles
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ParticleSort.h"
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Sort keys from view depth.  The quantized depth is inverted so an ascending sort
+	// puts the farthest particles first.
+	//--------------------------------------------------------------------------------------
+	void ParticleDepthKeys(ParticleSpan& span, const D3DXVECTOR3& eye, const D3DXVECTOR3& look, float nearZ, float farZ, USHORT* pKeys)
+	{
+		const float* px = span.Stream[PARTICLE_POS_X];
+		const float* py = span.Stream[PARTICLE_POS_Y];
+		const float* pz = span.Stream[PARTICLE_POS_Z];
+		const float scale = 65535.0f / Math::Max(farZ-nearZ, 1e-3f);
+
+		// Fold the eye into the offset so each particle only needs a dot product
+		const float offset = -(eye.x*look.x + eye.y*look.y + eye.z*look.z) - nearZ;
+
+		const __m128 vLx = _mm_set1_ps(look.x), vLy = _mm_set1_ps(look.y), vLz = _mm_set1_ps(look.z);
+		const __m128 vOffset = _mm_set1_ps(offset), vScale = _mm_set1_ps(scale);
+		const __m128 vZero = _mm_setzero_ps(), vMax = _mm_set1_ps(65535.0f);
+		const __m128i vMaxKey = _mm_set1_epi32(65535);
+		const __m128i vBias = _mm_set1_epi32(32768);
+		const __m128i vFlip = _mm_set1_epi16((short)0x8000);
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			__m128 d = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(px+i), vLx), _mm_mul_ps(_mm_loadu_ps(py+i), vLy));
+			d = _mm_add_ps(_mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(pz+i), vLz)), vOffset);
+			d = _mm_min_ps(_mm_max_ps(_mm_mul_ps(d, vScale), vZero), vMax);
+			__m128i k = _mm_sub_epi32(vMaxKey, _mm_cvttps_epi32(d));
+
+			// There is no unsigned 32 to 16 bit pack in SSE2, so bias into the signed range
+			// for the saturating pack and flip the top bit back afterwards
+			k = _mm_packs_epi32(_mm_sub_epi32(k, vBias), _mm_sub_epi32(k, vBias));
+			_mm_storel_epi64((__m128i*)(pKeys+i), _mm_xor_si128(k, vFlip));
+		}
+		for(; i<span.Count; i++)
+		{
+			float d = (px[i]*look.x + py[i]*look.y + pz[i]*look.z + offset)*scale;
+			d = Math::Min(Math::Max(d, 0.0f), 65535.0f);
+			pKeys[i] = (USHORT)(65535 - (int)d);
+		}
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ParticleSorter::ParticleSorter()
+	{
+		m_pKeys = NULL;
+		m_pOrder = NULL;
+		m_Capacity = 0;
+		m_Backoff = 0;
+	}
+
+	void ParticleSorter::Release()
+	{
+		SAFE_DELETE_ARRAY(m_pKeys);
+		SAFE_DELETE_ARRAY(m_pOrder);
+		m_Capacity = 0;
+	}
+
+	void ParticleSorter::Reserve(int count)
+	{
+		if(count<=m_Capacity)
+			return;
+		Release();
+		m_Capacity = count;
+		m_pKeys = new USHORT[count];
+		m_pOrder = new int[count];
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sorts the keys, trying the insertion sort first when they are mostly in order
+	//--------------------------------------------------------------------------------------
+	bool ParticleSorter::Sort(USHORT* pKeys, int count, int* pOrder)
+	{
+		for(int i=0; i<count; i++)
+			pOrder[i] = i;
+		if(count<2)
+			return true;
+
+		// Particles left in last frame's order only step out of place where they crossed
+		// a neighbor or were spawned and swapped in, so count the places that happened
+		int descents = 0;
+		for(int i=1; i<count; i++)
+			descents += pKeys[i] < pKeys[i-1];
+		if(descents==0)
+			return true;
+
+		// Particles that move a long way between frames in a dense cloud pass too many
+		// others for the insertion sort, and that tends to last, so after it gives up
+		// don't waste the moves on it for a few frames
+		if(m_Backoff>0)
+			m_Backoff--;
+		else if(descents <= count/8)
+		{
+			if(InsertionSort(pKeys, count, pOrder))
+				return true;
+			m_Backoff = PARTICLE_SORT_BACKOFF;
+		}
+
+		RadixSort(pKeys, count, pOrder);
+		return false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Stable insertion sort with a limit on the total moves, so a few keys that have far
+	// to go don't make it quadratic.  Whatever it finished is still a valid start for
+	// the radix sort.
+	//--------------------------------------------------------------------------------------
+	bool ParticleSorter::InsertionSort(USHORT* pKeys, int count, int* pOrder)
+	{
+		int budget = count*PARTICLE_SORT_MAX_MOVES;
+		for(int i=1; i<count; i++)
+		{
+			USHORT key = pKeys[i];
+			if(key>=pKeys[i-1])
+				continue;
+
+			int index = pOrder[i];
+			int j = i;
+			do
+			{
+				pKeys[j] = pKeys[j-1];
+				pOrder[j] = pOrder[j-1];
+				j--;
+			} while(j>0 && pKeys[j-1]>key);
+			pKeys[j] = key;
+			pOrder[j] = index;
+
+			budget -= i-j;
+			if(budget<0)
+				return false;
+		}
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Least significant byte first radix sort, a pass is skipped if every key has the
+	// same byte there
+	//--------------------------------------------------------------------------------------
+	void ParticleSorter::RadixSort(USHORT* pKeys, int count, int* pOrder)
+	{
+		Reserve(count);
+
+		int hist[2][256];
+		memset(hist, 0, sizeof(hist));
+		for(int i=0; i<count; i++)
+		{
+			hist[0][pKeys[i] & 0xff]++;
+			hist[1][pKeys[i] >> 8]++;
+		}
+
+		USHORT* pSrcKeys = pKeys;
+		int* pSrcOrder = pOrder;
+		USHORT* pDestKeys = m_pKeys;
+		int* pDestOrder = m_pOrder;
+		for(int pass=0; pass<2; pass++)
+		{
+			int shift = pass*8;
+			if(hist[pass][(pSrcKeys[0]>>shift) & 0xff]==count)
+				continue;
+
+			// Bucket starts
+			int offsets[256];
+			for(int b=0, sum=0; b<256; b++)
+			{
+				offsets[b] = sum;
+				sum += hist[pass][b];
+			}
+
+			for(int i=0; i<count; i++)
+			{
+				int dest = offsets[(pSrcKeys[i]>>shift) & 0xff]++;
+				pDestKeys[dest] = pSrcKeys[i];
+				pDestOrder[dest] = pSrcOrder[i];
+			}
+
+			USHORT* pTempKeys = pSrcKeys; pSrcKeys = pDestKeys; pDestKeys = pTempKeys;
+			int* pTempOrder = pSrcOrder; pSrcOrder = pDestOrder; pDestOrder = pTempOrder;
+		}
+
+		// An odd number of passes leaves the result in the scratch arrays
+		if(pSrcKeys!=pKeys)
+		{
+			memcpy(pKeys, pSrcKeys, count*sizeof(USHORT));
+			memcpy(pOrder, pSrcOrder, count*sizeof(int));
+		}
+	}
+
+}
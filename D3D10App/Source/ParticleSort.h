@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleSort.h
+//
+// Back to front sorting for alpha blended particles.  Each particle gets a 16 bit key
+// from its view depth, inverted so that the farthest particles come first, and the keys
+// are sorted with a two pass radix sort.  Emitters keep their particles in the sorted
+// order between frames, so most frames only a few particles are out of place and a
+// short insertion sort finishes the job instead.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "ParticleStore.h"
+
+namespace Core
+{
+
+// Insertion sort gives up and falls back to the radix sort after this many moves per key
+#define PARTICLE_SORT_MAX_MOVES 4
+
+// Frames to go straight to the radix sort after the insertion sort gave up
+#define PARTICLE_SORT_BACKOFF 8
+
+	//--------------------------------------------------------------------------------------
+	// Writes a sort key for each particle in the span.  Depths are quantized linearly over
+	// [nearZ, farZ] along the view direction, so keys from different emitters sorted with
+	// the same camera can be merged.
+	//--------------------------------------------------------------------------------------
+	void ParticleDepthKeys(ParticleSpan& span, const D3DXVECTOR3& eye, const D3DXVECTOR3& look, float nearZ, float farZ, USHORT* pKeys);
+
+
+	class ParticleSorter
+	{
+	public:
+		ParticleSorter();
+		~ParticleSorter(){ Release(); }
+
+		void Release();
+
+		// Sorts count keys in place into ascending order, keeping equal keys in their
+		// original order.  pOrder gets the original index of the key at each position.
+		// Returns true if the keys were close enough to sorted for the insertion sort.
+		bool Sort(USHORT* pKeys, int count, int* pOrder);
+
+		// Properties
+		inline int GetMemoryUsage(){ return m_Capacity*(sizeof(USHORT)+sizeof(int)); }
+
+	private:
+
+		// Grows the scratch arrays
+		void Reserve(int count);
+
+		// The two sorts, InsertionSort returns false if it ran out of moves
+		bool InsertionSort(USHORT* pKeys, int count, int* pOrder);
+		void RadixSort(USHORT* pKeys, int count, int* pOrder);
+
+		USHORT*	m_pKeys;		// Scratch for the radix passes
+		int*	m_pOrder;
+		int		m_Capacity;
+		int		m_Backoff;		// Frames left before the insertion sort is tried again
+	};
+
+}
@@ -0,0 +1,429 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleStore.cpp
+//
+// Structure of arrays particle storage and SSE integrators
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ParticleStore.h"
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ParticleStore::ParticleStore()
+	{
+		m_pData = NULL;
+		for(int i=0; i<PARTICLE_STREAM_COUNT; i++)
+			m_Streams[i] = NULL;
+		m_Count = 0;
+		m_Capacity = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Allocates every stream in one aligned block
+	//--------------------------------------------------------------------------------------
+	bool ParticleStore::Create(int maxParticles)
+	{
+		Release();
+		if(maxParticles<=0)
+			return false;
+
+		m_Capacity = (maxParticles+3) & ~3;
+		m_pData = (float*)_aligned_malloc((size_t)m_Capacity*PARTICLE_STREAM_COUNT*sizeof(float), 16);
+		if(!m_pData)
+		{
+			Log::Print("ParticleStore::Create() failed to allocate %d particles", maxParticles);
+			m_Capacity = 0;
+			return false;
+		}
+		memset(m_pData, 0, (size_t)m_Capacity*PARTICLE_STREAM_COUNT*sizeof(float));
+		for(int i=0; i<PARTICLE_STREAM_COUNT; i++)
+			m_Streams[i] = m_pData + (size_t)i*m_Capacity;
+		m_Count = 0;
+		return true;
+	}
+
+	void ParticleStore::Release()
+	{
+		if(m_pData)
+			_aligned_free(m_pData);
+		m_pData = NULL;
+		for(int i=0; i<PARTICLE_STREAM_COUNT; i++)
+			m_Streams[i] = NULL;
+		m_Count = m_Capacity = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds a particle to the end of the live range
+	//--------------------------------------------------------------------------------------
+	bool ParticleStore::Add(const D3DXVECTOR3& pos, const D3DXVECTOR3& vel, const D3DXVECTOR4& color, float size)
+	{
+		if(m_Count>=m_Capacity)
+			return false;
+		int i = m_Count++;
+		m_Streams[PARTICLE_POS_X][i] = pos.x;
+		m_Streams[PARTICLE_POS_Y][i] = pos.y;
+		m_Streams[PARTICLE_POS_Z][i] = pos.z;
+		m_Streams[PARTICLE_VEL_X][i] = vel.x;
+		m_Streams[PARTICLE_VEL_Y][i] = vel.y;
+		m_Streams[PARTICLE_VEL_Z][i] = vel.z;
+		m_Streams[PARTICLE_COLOR_R][i] = color.x;
+		m_Streams[PARTICLE_COLOR_G][i] = color.y;
+		m_Streams[PARTICLE_COLOR_B][i] = color.z;
+		m_Streams[PARTICLE_COLOR_A][i] = color.w;
+		m_Streams[PARTICLE_SIZE][i] = size;
+		m_Streams[PARTICLE_AGE][i] = 0;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Swap-removes a particle
+	//--------------------------------------------------------------------------------------
+	void ParticleStore::Remove(int i)
+	{
+		int last = --m_Count;
+		if(i==last)
+			return;
+		for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+			m_Streams[s][i] = m_Streams[s][last];
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Removes the expired particles.  Most groups of four are all alive, so the ages are
+	// tested four at a time and only groups with a dead particle are looked at closely.
+	//--------------------------------------------------------------------------------------
+	int ParticleStore::RemoveOlderThan(float maxAge, bool keepOrder)
+	{
+		const float* pAge = m_Streams[PARTICLE_AGE];
+		const __m128 vMax = _mm_set1_ps(maxAge);
+		int removed = 0;
+		int i = 0;
+		while(i<m_Count)
+		{
+			if(i+4<=m_Count && _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(pAge+i), vMax))==0)
+			{
+				i += 4;
+				continue;
+			}
+
+			// Slide the survivors after the first old particle down over the gaps
+			if(keepOrder && pAge[i]>maxAge)
+			{
+				int dest = i;
+				for(int j=i+1; j<m_Count; j++)
+				{
+					if(pAge[j]>maxAge)
+						continue;
+					for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+						m_Streams[s][dest] = m_Streams[s][j];
+					dest++;
+				}
+				removed += m_Count-dest;
+				m_Count = dest;
+				break;
+			}
+
+			// The particle moved in from the end needs testing too, so don't step
+			if(pAge[i]>maxAge)
+			{
+				Remove(i);
+				removed++;
+			}
+			else
+				i++;
+		}
+		return removed;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Gathers every stream through the order, one stream at a time
+	//--------------------------------------------------------------------------------------
+	void ParticleStore::Reorder(const int* pOrder, float* pScratch)
+	{
+		for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+		{
+			float* pStream = m_Streams[s];
+			for(int i=0; i<m_Count; i++)
+				pScratch[i] = pStream[pOrder[i]];
+			memcpy(pStream, pScratch, m_Count*sizeof(float));
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Run over the live particles
+	//--------------------------------------------------------------------------------------
+	ParticleSpan ParticleStore::GetSpan(int start, int end)
+	{
+		ParticleSpan span;
+		start = Math::Max(start, 0);
+		end = Math::Min(end, m_Count);
+		for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+			span.Stream[s] = m_Streams[s] ? m_Streams[s]+start : NULL;
+		span.Count = Math::Max(end-start, 0);
+		return span;
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Cosine for the curl noise, wrapped to [-pi, pi] and folded to [-pi/2, pi/2] where a
+	// short even polynomial is good to about 1e-5.  The scalar version does the
+	// same steps so both paths of an integrator agree.
+	//--------------------------------------------------------------------------------------
+	static const float COS_C2 = -1.0f/2.0f;
+	static const float COS_C4 = 1.0f/24.0f;
+	static const float COS_C6 = -1.0f/720.0f;
+	static const float COS_C8 = 1.0f/40320.0f;
+
+	static inline __m128 CosPS(__m128 x)
+	{
+		const __m128 vInv2Pi = _mm_set1_ps(0.5f/D3DX_PI);
+		const __m128 v2Pi = _mm_set1_ps(2.0f*D3DX_PI);
+		const __m128 vPi = _mm_set1_ps(D3DX_PI);
+		const __m128 vHalfPi = _mm_set1_ps(0.5f*D3DX_PI);
+		const __m128 vAbs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 vSign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+		__m128 q = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, vInv2Pi)));
+		x = _mm_sub_ps(x, _mm_mul_ps(q, v2Pi));
+
+		// cos(x) = -cos(pi-|x|)
+		__m128 ax = _mm_and_ps(x, vAbs);
+		__m128 flip = _mm_cmpgt_ps(ax, vHalfPi);
+		ax = _mm_or_ps(_mm_and_ps(flip, _mm_sub_ps(vPi, ax)), _mm_andnot_ps(flip, ax));
+
+		__m128 x2 = _mm_mul_ps(ax, ax);
+		__m128 p = _mm_set1_ps(COS_C8);
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(COS_C6));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(COS_C4));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(COS_C2));
+		p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+		return _mm_xor_ps(p, _mm_and_ps(flip, vSign));
+	}
+
+	static inline float FastCos(float x)
+	{
+		x -= floorf(x*(0.5f/D3DX_PI) + 0.5f)*(2.0f*D3DX_PI);
+		float ax = fabsf(x);
+		bool flip = ax > 0.5f*D3DX_PI;
+		if(flip)
+			ax = D3DX_PI - ax;
+		float x2 = ax*ax;
+		float p = ((((COS_C8*x2 + COS_C6)*x2 + COS_C4)*x2 + COS_C2)*x2 + 1.0f);
+		return flip ? -p : p;
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Ages and moves the particles
+	//--------------------------------------------------------------------------------------
+	void ParticleIntegrate(ParticleSpan& span, float elapsedTime, float step)
+	{
+		float* px = span.Stream[PARTICLE_POS_X];
+		float* py = span.Stream[PARTICLE_POS_Y];
+		float* pz = span.Stream[PARTICLE_POS_Z];
+		const float* vx = span.Stream[PARTICLE_VEL_X];
+		const float* vy = span.Stream[PARTICLE_VEL_Y];
+		const float* vz = span.Stream[PARTICLE_VEL_Z];
+		float* pAge = span.Stream[PARTICLE_AGE];
+
+		const __m128 vStep = _mm_set1_ps(step);
+		const __m128 vTime = _mm_set1_ps(elapsedTime);
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			_mm_storeu_ps(px+i, _mm_add_ps(_mm_loadu_ps(px+i), _mm_mul_ps(_mm_loadu_ps(vx+i), vStep)));
+			_mm_storeu_ps(py+i, _mm_add_ps(_mm_loadu_ps(py+i), _mm_mul_ps(_mm_loadu_ps(vy+i), vStep)));
+			_mm_storeu_ps(pz+i, _mm_add_ps(_mm_loadu_ps(pz+i), _mm_mul_ps(_mm_loadu_ps(vz+i), vStep)));
+			_mm_storeu_ps(pAge+i, _mm_add_ps(_mm_loadu_ps(pAge+i), vTime));
+		}
+		for(; i<span.Count; i++)
+		{
+			px[i] += vx[i]*step;
+			py[i] += vy[i]*step;
+			pz[i] += vz[i]*step;
+			pAge[i] += elapsedTime;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constant acceleration
+	//--------------------------------------------------------------------------------------
+	void ParticleGravity(ParticleSpan& span, const D3DXVECTOR3& gravity, float step)
+	{
+		float* vx = span.Stream[PARTICLE_VEL_X];
+		float* vy = span.Stream[PARTICLE_VEL_Y];
+		float* vz = span.Stream[PARTICLE_VEL_Z];
+		const float gx = gravity.x*step, gy = gravity.y*step, gz = gravity.z*step;
+
+		const __m128 vGx = _mm_set1_ps(gx), vGy = _mm_set1_ps(gy), vGz = _mm_set1_ps(gz);
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			_mm_storeu_ps(vx+i, _mm_add_ps(_mm_loadu_ps(vx+i), vGx));
+			_mm_storeu_ps(vy+i, _mm_add_ps(_mm_loadu_ps(vy+i), vGy));
+			_mm_storeu_ps(vz+i, _mm_add_ps(_mm_loadu_ps(vz+i), vGz));
+		}
+		for(; i<span.Count; i++)
+		{
+			vx[i] += gx;
+			vy[i] += gy;
+			vz[i] += gz;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Velocity damping
+	//--------------------------------------------------------------------------------------
+	void ParticleDrag(ParticleSpan& span, float damping, float step)
+	{
+		float* vx = span.Stream[PARTICLE_VEL_X];
+		float* vy = span.Stream[PARTICLE_VEL_Y];
+		float* vz = span.Stream[PARTICLE_VEL_Z];
+		const float k = powf(damping, step);
+
+		const __m128 vK = _mm_set1_ps(k);
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			_mm_storeu_ps(vx+i, _mm_mul_ps(_mm_loadu_ps(vx+i), vK));
+			_mm_storeu_ps(vy+i, _mm_mul_ps(_mm_loadu_ps(vy+i), vK));
+			_mm_storeu_ps(vz+i, _mm_mul_ps(_mm_loadu_ps(vz+i), vK));
+		}
+		for(; i<span.Count; i++)
+		{
+			vx[i] *= k;
+			vy[i] *= k;
+			vz[i] *= k;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Swirl around a vertical axis.  The turn is the same for every particle, so its sine
+	// and cosine are worked out once and each particle only needs a rotation and a
+	// square root for the outward drift.
+	//--------------------------------------------------------------------------------------
+	void ParticleVortex(ParticleSpan& span, const D3DXVECTOR3& center, float spin, float pull, float lift, float step)
+	{
+		float* px = span.Stream[PARTICLE_POS_X];
+		float* py = span.Stream[PARTICLE_POS_Y];
+		float* pz = span.Stream[PARTICLE_POS_Z];
+		float* vx = span.Stream[PARTICLE_VEL_X];
+		float* vz = span.Stream[PARTICLE_VEL_Z];
+		const float c = cosf(spin*step);
+		const float s = sinf(spin*step);
+		const float drift = pull*step;
+		const float rise = lift*step;
+		const float minRadius = 1e-4f;
+
+		const __m128 vC = _mm_set1_ps(c), vS = _mm_set1_ps(s);
+		const __m128 vCx = _mm_set1_ps(center.x), vCz = _mm_set1_ps(center.z);
+		const __m128 vDrift = _mm_set1_ps(drift), vRise = _mm_set1_ps(rise);
+		const __m128 vMinRadius = _mm_set1_ps(minRadius);
+		const __m128 vZero = _mm_setzero_ps(), vOne = _mm_set1_ps(1.0f);
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(px+i), vCx);
+			__m128 dz = _mm_sub_ps(_mm_loadu_ps(pz+i), vCz);
+			__m128 rx = _mm_sub_ps(_mm_mul_ps(dx, vC), _mm_mul_ps(dz, vS));
+			__m128 rz = _mm_add_ps(_mm_mul_ps(dx, vS), _mm_mul_ps(dz, vC));
+
+			// Scale the offset to the new radius, particles on the axis stay put
+			__m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(rz, rz)));
+			__m128 mask = _mm_cmpgt_ps(r, vMinRadius);
+			__m128 k = _mm_div_ps(_mm_max_ps(_mm_add_ps(r, vDrift), vZero), r);
+			k = _mm_or_ps(_mm_and_ps(mask, k), _mm_andnot_ps(mask, vOne));
+			_mm_storeu_ps(px+i, _mm_add_ps(vCx, _mm_mul_ps(rx, k)));
+			_mm_storeu_ps(pz+i, _mm_add_ps(vCz, _mm_mul_ps(rz, k)));
+			_mm_storeu_ps(py+i, _mm_add_ps(_mm_loadu_ps(py+i), vRise));
+
+			__m128 x = _mm_loadu_ps(vx+i);
+			__m128 z = _mm_loadu_ps(vz+i);
+			_mm_storeu_ps(vx+i, _mm_sub_ps(_mm_mul_ps(x, vC), _mm_mul_ps(z, vS)));
+			_mm_storeu_ps(vz+i, _mm_add_ps(_mm_mul_ps(x, vS), _mm_mul_ps(z, vC)));
+		}
+		for(; i<span.Count; i++)
+		{
+			float dx = px[i]-center.x;
+			float dz = pz[i]-center.z;
+			float rx = dx*c - dz*s;
+			float rz = dx*s + dz*c;
+			float r = sqrtf(rx*rx + rz*rz);
+			float k = r>minRadius ? Math::Max(r+drift, 0.0f)/r : 1.0f;
+			px[i] = center.x + rx*k;
+			pz[i] = center.z + rz*k;
+			py[i] += rise;
+
+			float x = vx[i], z = vz[i];
+			vx[i] = x*c - z*s;
+			vz[i] = x*s + z*c;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Curl noise.  The potential is psi = (sin(ky+a)+sin(kz+b), sin(kz+c)+sin(kx+d),
+	// sin(kx+e)+sin(ky+f)), its curl only needs six cosines per particle.
+	//--------------------------------------------------------------------------------------
+	static const float CURL_OFFSETS[6] = { 0.0f, 1.3f, 2.9f, 4.1f, 5.3f, 0.7f };
+
+	void ParticleCurlNoise(ParticleSpan& span, float frequency, float strength, float phase, float step)
+	{
+		const float* px = span.Stream[PARTICLE_POS_X];
+		const float* py = span.Stream[PARTICLE_POS_Y];
+		const float* pz = span.Stream[PARTICLE_POS_Z];
+		float* vx = span.Stream[PARTICLE_VEL_X];
+		float* vy = span.Stream[PARTICLE_VEL_Y];
+		float* vz = span.Stream[PARTICLE_VEL_Z];
+		const float amount = strength*step;
+		float o[6];
+		for(int j=0; j<6; j++)
+			o[j] = CURL_OFFSETS[j] + phase;
+
+		const __m128 vK = _mm_set1_ps(frequency);
+		const __m128 vAmount = _mm_set1_ps(amount);
+		__m128 vO[6];
+		for(int j=0; j<6; j++)
+			vO[j] = _mm_set1_ps(o[j]);
+		int i = 0;
+		for(; i+4<=span.Count; i+=4)
+		{
+			__m128 kx = _mm_mul_ps(_mm_loadu_ps(px+i), vK);
+			__m128 ky = _mm_mul_ps(_mm_loadu_ps(py+i), vK);
+			__m128 kz = _mm_mul_ps(_mm_loadu_ps(pz+i), vK);
+			__m128 cx = _mm_sub_ps(CosPS(_mm_add_ps(ky, vO[5])), CosPS(_mm_add_ps(kz, vO[2])));
+			__m128 cy = _mm_sub_ps(CosPS(_mm_add_ps(kz, vO[1])), CosPS(_mm_add_ps(kx, vO[4])));
+			__m128 cz = _mm_sub_ps(CosPS(_mm_add_ps(kx, vO[3])), CosPS(_mm_add_ps(ky, vO[0])));
+			_mm_storeu_ps(vx+i, _mm_add_ps(_mm_loadu_ps(vx+i), _mm_mul_ps(cx, vAmount)));
+			_mm_storeu_ps(vy+i, _mm_add_ps(_mm_loadu_ps(vy+i), _mm_mul_ps(cy, vAmount)));
+			_mm_storeu_ps(vz+i, _mm_add_ps(_mm_loadu_ps(vz+i), _mm_mul_ps(cz, vAmount)));
+		}
+		for(; i<span.Count; i++)
+		{
+			float kx = px[i]*frequency, ky = py[i]*frequency, kz = pz[i]*frequency;
+			vx[i] += (FastCos(ky+o[5]) - FastCos(kz+o[2]))*amount;
+			vy[i] += (FastCos(kz+o[1]) - FastCos(kx+o[4]))*amount;
+			vz[i] += (FastCos(kx+o[3]) - FastCos(ky+o[0]))*amount;
+		}
+	}
+
+}
@@ -0,0 +1,119 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleStore.h
+//
+// Structure of arrays particle storage.  Each particle attribute lives in its own
+// aligned stream, so the integrators below can run over whole runs of particles four at
+// a time with SSE.  Live particles are kept packed at the front of the streams and dead
+// ones are swap-removed, so a run of live particles is always a plain array range.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "QMath.h"
+
+namespace Core
+{
+
+	// Particle attribute streams
+	enum PARTICLE_STREAM
+	{
+		PARTICLE_POS_X=0,
+		PARTICLE_POS_Y,
+		PARTICLE_POS_Z,
+		PARTICLE_VEL_X,
+		PARTICLE_VEL_Y,
+		PARTICLE_VEL_Z,
+		PARTICLE_COLOR_R,
+		PARTICLE_COLOR_G,
+		PARTICLE_COLOR_B,
+		PARTICLE_COLOR_A,
+		PARTICLE_SIZE,			// Billboard scale
+		PARTICLE_AGE,			// Seconds since the particle was spawned
+
+		PARTICLE_STREAM_COUNT,
+	};
+
+	// A run of live particles, each pointer is the start of the run in that stream
+	struct ParticleSpan
+	{
+		float*	Stream[PARTICLE_STREAM_COUNT];
+		int		Count;
+	};
+
+	// Simulation callback, called with runs of particles rather than single ones
+	typedef void (*PARTICLE_BATCH_FUNC)(ParticleSpan& span, float elapsedTime, void* pData);
+
+
+	class ParticleStore
+	{
+	public:
+		ParticleStore();
+		~ParticleStore(){ Release(); }
+
+		// Allocates the streams, the capacity is rounded up to a multiple of four
+		bool Create(int maxParticles);
+		void Release();
+
+		// Adds a particle at the end of the live range, returns false if the store is full
+		bool Add(const D3DXVECTOR3& pos, const D3DXVECTOR3& vel, const D3DXVECTOR4& color, float size=1.0f);
+
+		// Removes a particle by moving the last live one into its slot
+		void Remove(int i);
+
+		// Swap-removes every particle older than maxAge, returns how many were removed.
+		// With keepOrder the rest are slid down instead, which is slower but leaves a
+		// sorted store sorted.
+		int RemoveOlderThan(float maxAge, bool keepOrder=false);
+
+		// Removes everything
+		inline void Clear(){ m_Count = 0; }
+
+		// Rearranges the live particles so that particle i is the one that was at
+		// pOrder[i].  pScratch needs room for every live particle.
+		void Reorder(const int* pOrder, float* pScratch);
+
+		// Run over the live particles in [start, end)
+		ParticleSpan GetSpan(int start, int end);
+		inline ParticleSpan GetSpan(){ return GetSpan(0, m_Count); }
+
+		// Properties
+		inline int GetCount(){ return m_Count; }
+		inline int GetCapacity(){ return m_Capacity; }
+		inline float* GetStream(PARTICLE_STREAM stream){ return m_Streams[stream]; }
+		inline int GetMemoryUsage(){ return m_Capacity*PARTICLE_STREAM_COUNT*sizeof(float); }
+
+	private:
+		float*	m_pData;							// Every stream in one block
+		float*	m_Streams[PARTICLE_STREAM_COUNT];
+		int		m_Count;
+		int		m_Capacity;
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Integrators.  These run over a span with SSE, four particles at a time, and finish
+	// the last few with the same math in scalar code.  Rates are per step, the emitters
+	// pass g_TimeScale as the step so they match the rest of the engine's motion.
+	//--------------------------------------------------------------------------------------
+
+	// Ages the particles by elapsedTime and moves them along their velocities
+	void ParticleIntegrate(ParticleSpan& span, float elapsedTime, float step);
+
+	// Adds a constant acceleration
+	void ParticleGravity(ParticleSpan& span, const D3DXVECTOR3& gravity, float step);
+
+	// Scales the velocities by damping each step
+	void ParticleDrag(ParticleSpan& span, float damping, float step);
+
+	// Swirls the particles around a vertical axis through center.  Positions and
+	// velocities turn spin radians per step, particles drift pull units outwards and
+	// rise lift units each step.
+	void ParticleVortex(ParticleSpan& span, const D3DXVECTOR3& center, float spin, float pull, float lift, float step);
+
+	// Adds the curl of a sum of sines potential to the velocities.  The field is
+	// divergence free so the particles swirl without bunching up.  Phase scrolls it.
+	void ParticleCurlNoise(ParticleSpan& span, float frequency, float strength, float phase, float step);
+
+}
@@ -34,6 +34,14 @@ namespace Core
 			return i > 0 && (i & (i - 1)) == 0;
 		} 
 
+		//--------------------------------------------------------------------------------------
+		// Integer division that rounds towards negative infinity
+		//--------------------------------------------------------------------------------------
+		static inline int FloorDiv(int a, int b)
+		{
+			return a>=0 ? a/b : -((-a+b-1)/b);
+		}
+
 	
 		//--------------------------------------------------------------------------------------
 		// Clamp an int
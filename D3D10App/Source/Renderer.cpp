@@ -30,6 +30,10 @@ namespace Core
 	UINT Renderer::ProbeSettings::resolution;
 	DXGI_FORMAT Renderer::ProbeSettings::format;
 	UINT Renderer::ProbeSettings::miplevels;
+	float Renderer::ProbeSettings::farPlane;
+	float Renderer::LODSettings::PixelError = 1.0f;
+	float Renderer::LODSettings::ShadowPixelError = 4.0f;
+	float Renderer::LODSettings::ProbePixelError = 4.0f;
 
 	//--------------------------------------------------------------------------------------
 	// Constructor
@@ -61,6 +65,7 @@ namespace Core
 		m_pRandomTex = NULL;
 		m_pRandomSRV = NULL;
 		m_CurVelocity = 0;
+		m_LODPixelScale = 0;
 		
 		m_qOffset=0;
 	}
@@ -124,9 +129,13 @@ namespace Core
 		m_mViewProj = m_Camera.GetViewMatrix()*m_Camera.GetProjMatrix();
 		Device::Effect->ViewProjectionVariable->SetMatrix( (float*)&m_mViewProj );
 
-		// Set the old world matrices for the meshes
+		// Set the old world matrices and the level of detail for the meshes
+		m_LODPixelScale = m_Height / (2.0f*tanf(m_Camera.GetFOV()*0.5f));
 		for(int i=0; i<m_MeshObjects.Size(); i++)
+		{
 			m_MeshObjects[i]->SetOldWorldMatrix( m_MeshObjects[i]->GetWorldMatrix() );
+			m_MeshObjects[i]->SetLOD( m_MeshObjects[i]->ComputeLOD(m_Camera.GetPos(), m_LODPixelScale, LODSettings::PixelError) );
+		}
 
 		// Camera position and direction
 		Device::Effect->CameraPosVariable->SetFloatVector( (float*)&m_Camera.GetPos() );
@@ -145,6 +154,18 @@ namespace Core
 		memcpy(pVerts, m_QuadVerts, Vertex::size*6);
 		m_pQuadVertexBuffer->Unmap();
 
+		// Simulate the particles, the render only draws them
+		ParticleEmitter::UpdateEmitters(m_Emitters, m_ParticleInstances, m_ParticleDraws, frameTime);
+
+		// Animate the skinned meshes, the scene keeps them at the front of the list
+		int numSkinned = 0;
+		while(numSkinned<m_MeshObjects.Size() && m_MeshObjects[numSkinned]->IsSkinned())
+			numSkinned++;
+		MeshObject::UpdateAnimations(m_MeshObjects, numSkinned, frameTime);
+
+		// Bring in streamed resources
+		UpdateStreaming();
+
 		// Update the scene
 		ProcessMessages();
 	}
@@ -201,8 +222,10 @@ namespace Core
 
 		// Go through all particle emitters, then drawe verything that is particle like that is transparent.
 		SetRenderToQuad();
-		for(int i=0; i<m_Emitters.Size(); i++)
-			m_Emitters[i]->Update(Device::FrameStats.ElapsedTime);
+		m_ParticleInstances.Bind(1);
+		Device::SetInputLayout(InstanceVertex::pInputLayout);
+		ParticleEmitter::RenderEmitters(m_ParticleDraws);
+		Device::SetInputLayout(Vertex::pInputLayout);
 
 		// Draw the transparent meshes
 		RenderTransparents();
@@ -246,18 +269,26 @@ namespace Core
 
 
 	//--------------------------------------------------------------------------------------
-	// Renders the sky
+	// Recomputes the scattering if the time or place changed
 	//--------------------------------------------------------------------------------------
-	void Renderer::RenderSky(const D3DXVECTOR3& pos)
+	void Renderer::UpdateSky()
 	{
-		// Compute the scattering
 		if(m_UpdateSky)
 		{
-			UINT offset=0;
 			SetRenderToQuad();
 			m_SkySystem.ComputeScattering(m_Camera.GetPos());
 			m_UpdateSky = false;
 		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Renders the sky
+	//--------------------------------------------------------------------------------------
+	void Renderer::RenderSky(const D3DXVECTOR3& pos)
+	{
+		// Compute the scattering
+		UpdateSky();
 		
 		// Render the sky
 		m_HDRSystem.Buffer().BindRenderTarget();
@@ -410,16 +441,10 @@ namespace Core
 
 				// Update the animation matrices
 				if(mesh.IsSkinned())
-				{
 					Device::Effect->AnimMatricesVariable->SetMatrixArray((float*)mesh.GetAnimMatrices(), 0, mesh.GetNumAnimMatrices());
 
-					// Set the input layout
-					Device::SetInputLayout( SkinnedVertex::pInputLayout );
-				}
-				else
-					Device::SetInputLayout( Vertex::pInputLayout );
-
-				// Render the submeshes
+				// Render the submeshes, a face covers half the probe
+				int lod = mesh.ComputeLOD(probeMesh.GetPos(), ProbeSettings::resolution*0.5f, LODSettings::ProbePixelError);
 				for(int k=0; k<mesh.GetNumSubMesh(); k++)
 				{
 					// Set the effect variables only when the material changes
@@ -429,17 +454,21 @@ namespace Core
 						pCurrentMaterial = mesh.GetSubMesh(k)->pMaterial;
 					}
 
+					// Set the input layout
+					Device::SetVertexFormat(*mesh.GetSubMesh(k));
+
 					if( mesh.IsSkinned() )	
 						Device::Effect->Pass[PASS_FORWARD_ANIM]->Apply(0);
 					else
 						Device::Effect->Pass[PASS_FORWARD]->Apply(0);
 
 					// Render the mesh				
-					Device::DrawSubmesh(*mesh.GetSubMesh(k));
+					Device::DrawSubmesh(*mesh.GetSubMesh(k), lod);
 				}	
 			}
 
 			// Render the terrain
+			Device::SetInputLayout( Vertex::pInputLayout );
 			RenderTerrain(frustum, Device::Effect->Pass[PASS_FORWARD_TERRAIN]);
 
 			// Render the sky
@@ -487,6 +516,10 @@ namespace Core
 			msg = "Polygons Rendered: ";
 			msg += Device::FrameStats.PolysDrawn;
 			m_pTxtHelper->DrawTextLine(msg);
+
+			msg = "Polygons Saved by LOD: ";
+			msg += Device::FrameStats.PolysSaved;
+			m_pTxtHelper->DrawTextLine(msg);
 			
 			msg = "Draw Calls: ";
 			msg += Device::FrameStats.DrawCalls;
@@ -513,6 +546,91 @@ namespace Core
 			msg += Device::FrameStats.ProcessedMessages;
 			m_pTxtHelper->DrawTextLine(msg);
 
+			msg = "Clipmap Texels Updated: ";
+			msg += Device::FrameStats.ClipmapTexelsUpdated;
+			m_pTxtHelper->DrawTextLine(msg);
+
+			// Particle memory, per emitter and the shared instances
+			if(!m_Emitters.IsEmpty())
+			{
+				int particles = 0, memory = 0;
+				for(int i=0; i<m_Emitters.Size(); i++)
+				{
+					particles += m_Emitters[i]->GetNumParticles();
+					memory += m_Emitters[i]->GetMemoryUsage();
+				}
+				msg = "Particles: ";
+				msg += particles;
+				msg += " in ";
+				msg += m_Emitters.Size();
+				msg += " emitters, ";
+				msg += memory/1024;
+				msg += "KB  Instances: ";
+				msg += m_ParticleInstances.GetMemoryUsage()/1024;
+				msg += "KB  Draws: ";
+				msg += m_ParticleDraws.Size();
+				m_pTxtHelper->DrawTextLine(msg);
+				for(int i=0; i<m_Emitters.Size(); i++)
+				{
+					if(!m_Emitters[i]->IsActive())
+						continue;
+					msg = "  Emitter ";
+					msg += i;
+					msg += ": ";
+					msg += m_Emitters[i]->GetNumParticles();
+					msg += " particles, ";
+					msg += m_Emitters[i]->GetMemoryUsage()/1024;
+					msg += "KB";
+					m_pTxtHelper->DrawTextLine(msg);
+				}
+			}
+
+			// Terrain levels drawn
+			if(m_pTerrain && m_pTerrain->IsLoaded())
+			{
+				const TerrainRenderStats& ts = m_pTerrain->GetRenderStats();
+				msg = "Terrain First Level: ";
+				msg += ts.FirstLevel;
+				msg += "  Fade: ";
+				msg += ts.Fade;
+				m_pTxtHelper->DrawTextLine(msg);
+				for(int i=ts.FirstLevel; i<CLIPMAP_LEVELS-1; i++)
+				{
+					msg = "  Level ";
+					msg += i;
+					msg += ": ";
+					msg += ts.Blocks[i];
+					msg += " drawn, ";
+					msg += ts.Culled[i];
+					msg += " culled, ";
+					msg += ts.Triangles[i];
+					msg += " tris";
+					m_pTxtHelper->DrawTextLine(msg);
+				}
+			}
+
+			// Terrain tile residency
+			if(m_pTerrain && m_pTerrain->IsStreaming())
+			{
+				const TileCacheStats* pStats = m_pTerrain->GetHeightTileStats();
+				msg = "Terrain Tiles: ";
+				msg += pStats->ResidentTiles;
+				msg += " / ";
+				msg += pStats->MaxTiles;
+				msg += "  Misses: ";
+				msg += pStats->Misses;
+				m_pTxtHelper->DrawTextLine(msg);
+
+				pStats = m_pTerrain->GetLayerTileStats();
+				msg = "Layer Tiles: ";
+				msg += pStats->ResidentTiles;
+				msg += " / ";
+				msg += pStats->MaxTiles;
+				msg += "  Misses: ";
+				msg += pStats->Misses;
+				m_pTxtHelper->DrawTextLine(msg);
+			}
+
 #ifdef PHASE_DEBUG
 			if(m_pTerrain)
 			{
@@ -117,6 +117,10 @@ namespace Core
 		// Process engine messages that are queued
 		void ProcessMessages();		
 
+		// Ranks streaming by camera distance, finishes what the streamer has ready and
+		// adds pending meshes that are resident
+		void UpdateStreaming();
+
 		// Creates a new light.  This does not add it to the scene
 		Light* CreateLight(bool bShadowCasting);
 
@@ -143,6 +147,10 @@ namespace Core
 		// Loads a mesh from a file.  This does not add it to the scene
 		MeshObject* LoadMesh( const char* file );
 		
+		// Streams a mesh in from a file, nearer meshes load sooner.  This does not add it
+		// to the scene, an added mesh that is still loading joins once it is resident.
+		MeshObject* LoadMeshAsync( const char* file );
+
 		// Adds a mesh object to the scene
 		void AddMesh( MeshObject* pMesh );
 
@@ -173,6 +181,9 @@ namespace Core
 		// Create a new emitter
 		ParticleEmitter* CreateParticleEmitter(char* texFile, int maxParticles, int freq, float lifetime);
 
+		// Create an emitter from a description file, returns NULL if it won't load
+		ParticleEmitter* LoadParticleEmitter(char* file);
+
 		// Delete an emitter
 		void DeleteParticleEmitter(ParticleEmitter* emitter);
 
@@ -257,8 +268,28 @@ namespace Core
 		// Sets the current date, and adjusts the sun position accordingly
 		inline void SetDate(int month, int day, int year){
 			m_SkySystem.SetDate(month, day, year);
+			m_UpdateSky = true;
 		}
 
+		// Sets where the viewer is on earth, in degrees and meters
+		inline void SetViewerLocation(double latitude, double longitude, double elevation){
+			m_SkySystem.SetViewerLocation(latitude, longitude, elevation);
+			m_UpdateSky = true;
+		}
+
+		// Sets the time zone the time of day is given in, hours from UTC
+		inline void SetTimeZone(double timezone){
+			m_SkySystem.SetTimeZone(timezone);
+			m_UpdateSky = true;
+		}
+
+		// Recomputes the scattering now if the time or place changed, otherwise
+		// it waits for the next frame
+		void UpdateSky();
+
+		// The sky system
+		inline Sky& GetSky(){ return m_SkySystem; }
+
 
 		// Cloud shape
 		inline void SetPerlinLacunarity(float f){ Device::Effect->PerlinLacunarityVariable->SetFloat(f); }
@@ -267,6 +298,18 @@ namespace Core
 		inline void SetCloudCover(float f){ Device::Effect->CloudCoverVariable->SetFloat(f); }
 		inline void SetCloudSharpness(float f){ Device::Effect->CloudSharpnessVariable->SetFloat(f); }
 
+
+
+		///////////////////////////////////
+		// Level of detail
+
+		// Largest error in pixels a level may show on screen, in shadow maps and in probes
+		inline void SetLODPixelError(float pixelError, float shadowPixelError, float probePixelError){
+			LODSettings::PixelError = pixelError;
+			LODSettings::ShadowPixelError = shadowPixelError;
+			LODSettings::ProbePixelError = probePixelError;
+		}
+
 		
 
 		///////////////////////////////////
@@ -289,9 +332,12 @@ namespace Core
 		Camera					m_Camera;				// Default camera
 		Light					m_Sun;					// The sun light
 		Array<ParticleEmitter*> m_Emitters;				// Particle emitters
+		InstanceBuffer			m_ParticleInstances;	// Instances of every emitter, refilled each frame
+		Array<ParticleDraw>		m_ParticleDraws;		// Runs of particles to draw this frame, back to front where sorted
 		Array<Light*>			m_Lights;				// Scene lights
 		Stack<Light*>			m_LightPool;			// Recycle bin for lights
 		Array<MeshObject*>		m_MeshObjects;			// BaseMesh objects
+		Array<MeshObject*>		m_PendingMeshes;		// Added meshes that are still streaming
 		Array<SubMesh*>			m_TransparentObjects;   // Objects with transparency enabled
 		Array<SubMesh*>			m_RenderList;			// Sorted list of submeshes to be rendered
 		MeshObject				m_SphereMesh;			// Sphere mesh
@@ -337,6 +383,9 @@ namespace Core
 		// Encodes the material data needed for shading into a texture
 		void EncodeMaterialTexture();
 
+		// Renames a loaded mesh so no mesh in the scene shares its name
+		void MakeMeshNameUnique( MeshObject* pMesh );
+
 		// Generates a random sampling texture for SSAO
 		void EncodeSSAOTexture(UINT width, UINT height);
 
@@ -429,6 +478,16 @@ namespace Core
 			}
 		};
 
+		// Level of detail selection, shadows and probes can take coarser levels than
+		// the screen as their detail is blurred or seen at a lower resolution
+		struct LODSettings
+		{
+			static float PixelError;
+			static float ShadowPixelError;
+			static float ProbePixelError;
+		};
+		float						m_LODPixelScale;		// Pixels a unit covers a unit from the camera
+
 		RenderSurface				m_ShadowMap;			// Shadow map
 		RenderSurface				m_ShadowMapMSAA;		// Shadow map with MSAA
 		RenderSurface				m_ShadowMapCube;		// Cube shadow map
@@ -463,12 +522,14 @@ namespace Core
 			static UINT resolution;
 			static DXGI_FORMAT format;
 			static UINT miplevels;
+			static float farPlane;		// Probes see meshes this close to them
 
 			ProbeSettings()
 			{
 				resolution = 512;
 				format = DXGI_FORMAT_R8G8B8A8_UNORM;
 				miplevels = 4;
+				farPlane = 1000.0f;
 			}
 		};	
 		Array<EnvironmentProbe*>	m_Probes;
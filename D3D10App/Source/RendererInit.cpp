@@ -109,9 +109,16 @@ namespace Core
 		}
 
 
+		// Shared instance buffer for the particles
+		if(!m_ParticleInstances.Create(InstanceVertex::size, PARTICLE_INSTANCE_CAPACITY))
+		{
+			Log::FatalError("Particle instance buffer failed to create.");
+			return E_FAIL;
+		}
+
 		// Setup the environment probe system
 		m_ProbeDepth.Create(ProbeSettings::resolution, ProbeSettings::resolution, NULL, false);
-		D3DXMatrixPerspectiveFovLH( &m_mProbeProj, D3DX_PI*0.5f, 1.0f, 0.01f, 1000.0f);
+		D3DXMatrixPerspectiveFovLH( &m_mProbeProj, D3DX_PI*0.5f, 1.0f, 0.01f, ProbeSettings::farPlane);
 
 		// Setup the debug renderer
 #ifdef PHASE_DEBUG
@@ -356,10 +363,13 @@ namespace Core
 		m_SphereMesh.Release();
 		m_VisibleLights.Release();
 
-		// Release the resource managers
+		// Release the resource managers, the loaders stop first
+		g_Streamer.Release();
+		g_Residency.Release();
 		g_Meshes.Release();
 		g_Textures.Release();
 		g_Materials.Release();
+		Texture::ReleasePlaceholder();
 		m_Lights.Release();
 
 		CleanupDevice();
@@ -383,6 +393,7 @@ namespace Core
 
 		// Mesh Objects
 		m_MeshObjects.Release();
+		m_PendingMeshes.Release();
 
 		// Particle emitters
 		for(int i=0; i<m_Emitters.Size(); i++)
@@ -391,6 +402,8 @@ namespace Core
 			delete m_Emitters[i];
 		}
 		m_Emitters.Release();
+		m_ParticleDraws.Release();
+		m_ParticleInstances.Release();
 
 		//Water
 		
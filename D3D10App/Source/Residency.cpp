@@ -0,0 +1,377 @@
+//--------------------------------------------------------------------------------------
+// File: Residency.cpp
+//
+// Keeps managed resources under a device memory budget
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "Streaming.h"
+#include "Residency.h"
+
+namespace Core
+{
+
+	// The global residency manager
+	ResidencyManager g_Residency;
+
+
+	//--------------------------------------------------------------------------------------
+	// The real device, through the resources and the streamer
+	//--------------------------------------------------------------------------------------
+	UINT ResidencyDevice::GetBytes(EngineResource* pResource)
+	{
+		return pResource->GetResidentBytes();
+	}
+
+	int ResidencyDevice::GetNumMips(EngineResource* pResource)
+	{
+		return pResource->GetNumMips();
+	}
+
+	UINT ResidencyDevice::DropMips(EngineResource* pResource, int levels)
+	{
+		return pResource->EvictMips(levels);
+	}
+
+	bool ResidencyDevice::Evict(EngineResource* pResource)
+	{
+		pResource->Evict();
+		return !pResource->IsResident();
+	}
+
+	void ResidencyDevice::Restream(EngineResource* pResource, const char* szFile, float priority, bool bRefresh)
+	{
+		g_Streamer.Request(pResource, szFile, priority, bRefresh);
+	}
+
+	bool ResidencyDevice::IsStreaming(EngineResource* pResource)
+	{
+		return pResource->m_pStream!=NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ResidencyManager::ResidencyManager()
+	{
+		m_Budget = RESIDENCY_DEFAULT_BUDGET;
+		m_Frame = 1;
+		m_pDevice = &m_DefaultDevice;
+		m_Evictions = m_MipDrops = m_Restreams = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Stops tracking everything
+	//--------------------------------------------------------------------------------------
+	void ResidencyManager::Release()
+	{
+		for(int i=0; i<m_Entries.Size(); i++)
+		{
+			m_Entries[i].pResource->m_ResidencySlot = -1;
+			delete[] m_Entries[i].szFile;
+		}
+		m_Entries.Release();
+		m_Candidates.Release();
+		m_Report = ResidencyReport();
+		m_Evictions = m_MipDrops = m_Restreams = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Starts tracking a resource, the file is where it streams back in from
+	//--------------------------------------------------------------------------------------
+	void ResidencyManager::Track(EngineResource* pResource, const char* szFile)
+	{
+		if(!pResource || !szFile || pResource->m_ResidencySlot>=0)
+			return;
+
+		ResidencyEntry entry;
+		entry.pResource = pResource;
+		entry.szFile = new char[strlen(szFile)+1];
+		strcpy(entry.szFile, szFile);
+		entry.Bytes = entry.FullBytes = m_pDevice->GetBytes(pResource);
+		entry.LastUsed = m_Frame;
+		entry.FirstUsed = 0;
+		entry.Priority = STREAM_PRIORITY_DEFAULT;
+		entry.MipsDropped = 0;
+		entry.bEvicted = false;
+		pResource->m_ResidencySlot = m_Entries.Size();
+		m_Entries.Add(entry);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Stops tracking a resource, the last entry moves into its slot
+	//--------------------------------------------------------------------------------------
+	void ResidencyManager::Untrack(EngineResource* pResource)
+	{
+		int slot = pResource ? pResource->m_ResidencySlot : -1;
+		if(slot<0)
+			return;
+
+		delete[] m_Entries[slot].szFile;
+		int last = m_Entries.Size()-1;
+		if(slot!=last)
+		{
+			m_Entries[slot] = m_Entries[last];
+			m_Entries[slot].pResource->m_ResidencySlot = slot;
+		}
+		m_Entries.Remove(last);
+		pResource->m_ResidencySlot = -1;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Marks a resource used this frame, the nearest use sets the priority
+	//--------------------------------------------------------------------------------------
+	void ResidencyManager::Touch(EngineResource* pResource, float priority)
+	{
+		int slot = pResource ? pResource->m_ResidencySlot : -1;
+		if(slot<0)
+			return;
+
+		ResidencyEntry& e = m_Entries[slot];
+		if(e.LastUsed!=m_Frame || priority<e.Priority)
+			e.Priority = priority;
+		e.LastUsed = m_Frame;
+		if(!e.FirstUsed)
+			e.FirstUsed = m_Frame;
+
+		// Evicted, it comes back for this use
+		if(e.bEvicted && !m_pDevice->IsStreaming(pResource) && !pResource->IsResident())
+		{
+			m_pDevice->Restream(pResource, e.szFile, priority, false);
+			m_Restreams++;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Can the policy act on it?  Not while the streamer has it.
+	//--------------------------------------------------------------------------------------
+	bool ResidencyManager::IsSettled(const ResidencyEntry& e)
+	{
+		return !e.bEvicted && e.pResource->IsResident() && !m_pDevice->IsStreaming(e.pResource);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Orders for the passes of Update
+	//--------------------------------------------------------------------------------------
+
+	// Least recently used first, larger first among those
+	static int CompareLeastRecent(const void* pA, const void* pB)
+	{
+		const ResidencyEntry* a = *(const ResidencyEntry**)pA;
+		const ResidencyEntry* b = *(const ResidencyEntry**)pB;
+		if(a->LastUsed!=b->LastUsed)
+			return a->LastUsed<b->LastUsed ? -1 : 1;
+		if(a->Bytes!=b->Bytes)
+			return a->Bytes>b->Bytes ? -1 : 1;
+		return 0;
+	}
+
+	// Least recently used first, farther first among those
+	static int CompareFarthest(const void* pA, const void* pB)
+	{
+		const ResidencyEntry* a = *(const ResidencyEntry**)pA;
+		const ResidencyEntry* b = *(const ResidencyEntry**)pB;
+		if(a->LastUsed!=b->LastUsed)
+			return a->LastUsed<b->LastUsed ? -1 : 1;
+		if(a->Priority!=b->Priority)
+			return a->Priority>b->Priority ? -1 : 1;
+		return 0;
+	}
+
+	// Most recently used first, nearer first among those
+	static int CompareNearest(const void* pA, const void* pB)
+	{
+		return CompareFarthest(pB, pA);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sizes everything up and evicts, drops or restores to fit the budget.  Bytes on
+	// their way back in count as if they were already there, so the budget makes room
+	// for them and does not restore more behind them.
+	//--------------------------------------------------------------------------------------
+	void ResidencyManager::Update()
+	{
+		UINT total = 0;
+		for(int i=0; i<m_Entries.Size(); i++)
+		{
+			ResidencyEntry& e = m_Entries[i];
+			bool bStreaming = m_pDevice->IsStreaming(e.pResource);
+
+			// Back in from an eviction, or loaded again some other way
+			if(e.bEvicted && e.pResource->IsResident() && !bStreaming)
+			{
+				e.bEvicted = false;
+				e.MipsDropped = 0;
+			}
+
+			if(bStreaming && (e.bEvicted || e.MipsDropped))
+				e.Bytes = e.FullBytes;
+			else
+			{
+				e.Bytes = e.bEvicted ? 0 : m_pDevice->GetBytes(e.pResource);
+				if(e.MipsDropped && e.Bytes>=e.FullBytes)
+					e.MipsDropped = 0;
+				if(!e.MipsDropped && !e.bEvicted)
+					e.FullBytes = e.Bytes;
+			}
+			total += e.Bytes;
+		}
+
+		if(total>m_Budget)
+			total = EvictUnused(total);
+		if(total>m_Budget)
+			total = DropMips(total);
+		else if(total<(UINT)(m_Budget*RESIDENCY_RESTORE_FRACTION))
+			total = RestoreMips(total);
+
+		// Report
+		m_Report = ResidencyReport();
+		m_Report.Budget = m_Budget;
+		m_Report.TotalBytes = total;
+		for(int i=0; i<m_Entries.Size(); i++)
+		{
+			ResidencyEntry& e = m_Entries[i];
+			int group = e.pResource->GetResidencyGroup();
+			if(group<0 || group>=RESIDENCY_GROUPS)
+				group = RESIDENCY_OTHER;
+			m_Report.GroupBytes[group] += e.Bytes;
+			m_Report.GroupCount[group]++;
+			if(!e.FirstUsed)
+				m_Report.PinnedBytes += e.Bytes;
+			if(e.bEvicted)
+				m_Report.NumEvicted++;
+			if(e.MipsDropped)
+				m_Report.NumReduced++;
+		}
+		m_Report.Evictions = m_Evictions;
+		m_Report.MipDrops = m_MipDrops;
+		m_Report.Restreams = m_Restreams;
+		m_Evictions = m_MipDrops = m_Restreams = 0;
+
+		m_Frame++;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Evicts what has not been used lately, least recently used first
+	//--------------------------------------------------------------------------------------
+	UINT ResidencyManager::EvictUnused(UINT total)
+	{
+		m_Candidates.Clear();
+		for(int i=0; i<m_Entries.Size(); i++)
+			if(!IsProtected(m_Entries[i]) && IsSettled(m_Entries[i]))
+				m_Candidates.Add(&m_Entries[i]);
+		if(m_Candidates.Size()>1)
+			qsort((ResidencyEntry**)m_Candidates, m_Candidates.Size(), sizeof(ResidencyEntry*), CompareLeastRecent);
+
+		for(int i=0; i<m_Candidates.Size() && total>m_Budget; i++)
+		{
+			ResidencyEntry& e = *m_Candidates[i];
+			UINT bytes = e.Bytes;
+			if(!m_pDevice->Evict(e.pResource))
+				continue;
+			total -= bytes;
+			e.Bytes = 0;
+			e.MipsDropped = 0;
+			e.bEvicted = true;
+			m_Evictions++;
+		}
+		return total;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// What is left is in use, its textures each give up a level at a time, least
+	// recently used and farthest first, until it fits
+	//--------------------------------------------------------------------------------------
+	UINT ResidencyManager::DropMips(UINT total)
+	{
+		m_Candidates.Clear();
+		for(int i=0; i<m_Entries.Size(); i++)
+			if(m_Entries[i].FirstUsed && IsSettled(m_Entries[i]) && m_pDevice->GetNumMips(m_Entries[i].pResource)>RESIDENCY_MIN_MIPS)
+				m_Candidates.Add(&m_Entries[i]);
+		if(m_Candidates.Size()>1)
+			qsort((ResidencyEntry**)m_Candidates, m_Candidates.Size(), sizeof(ResidencyEntry*), CompareFarthest);
+
+		while(total>m_Budget && m_Candidates.Size())
+		{
+			for(int i=0; i<m_Candidates.Size() && total>m_Budget; i++)
+			{
+				ResidencyEntry& e = *m_Candidates[i];
+				UINT bytes = m_pDevice->DropMips(e.pResource, 1);
+				bool bDropped = bytes<e.Bytes;
+				if(bDropped)
+				{
+					total -= e.Bytes-bytes;
+					e.Bytes = bytes;
+					e.MipsDropped++;
+					m_MipDrops++;
+				}
+
+				// Out of levels, or it could not drop one
+				if(!bDropped || m_pDevice->GetNumMips(e.pResource)<=RESIDENCY_MIN_MIPS)
+					m_Candidates.Remove(i--);
+			}
+		}
+		return total;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Streams dropped levels back in, nearest first, while the total stays under the
+	// restore part of the budget
+	//--------------------------------------------------------------------------------------
+	UINT ResidencyManager::RestoreMips(UINT total)
+	{
+		m_Candidates.Clear();
+		for(int i=0; i<m_Entries.Size(); i++)
+			if(m_Entries[i].MipsDropped && IsSettled(m_Entries[i]))
+				m_Candidates.Add(&m_Entries[i]);
+		if(m_Candidates.Size()>1)
+			qsort((ResidencyEntry**)m_Candidates, m_Candidates.Size(), sizeof(ResidencyEntry*), CompareNearest);
+
+		UINT limit = (UINT)(m_Budget*RESIDENCY_RESTORE_FRACTION);
+		for(int i=0; i<m_Candidates.Size(); i++)
+		{
+			ResidencyEntry& e = *m_Candidates[i];
+			UINT extra = e.FullBytes-e.Bytes;
+			if(total+extra>limit)
+				continue;
+			m_pDevice->Restream(e.pResource, e.szFile, e.Priority, true);
+			total += extra;
+			e.Bytes = e.FullBytes;
+			m_Restreams++;
+		}
+		return total;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Logs the last report
+	//--------------------------------------------------------------------------------------
+	void ResidencyManager::LogReport()
+	{
+		const ResidencyReport& r = m_Report;
+		const float mb = 1.0f/(1024.0f*1024.0f);
+		Log::Print("Residency: %.1f of %.1f MB, textures %.1f MB (%d), meshes %.1f MB (%d), other %.1f MB (%d), pinned %.1f MB",
+			r.TotalBytes*mb, r.Budget*mb,
+			r.GroupBytes[RESIDENCY_TEXTURE]*mb, r.GroupCount[RESIDENCY_TEXTURE],
+			r.GroupBytes[RESIDENCY_MESH]*mb, r.GroupCount[RESIDENCY_MESH],
+			r.GroupBytes[RESIDENCY_OTHER]*mb, r.GroupCount[RESIDENCY_OTHER],
+			r.PinnedBytes*mb);
+		Log::Print("Residency: %d evicted, %d with mips dropped, last frame %d evictions %d mip drops %d restreams",
+			r.NumEvicted, r.NumReduced, r.Evictions, r.MipDrops, r.Restreams);
+	}
+}
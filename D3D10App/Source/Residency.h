@@ -0,0 +1,172 @@
+//--------------------------------------------------------------------------------------
+// File: Residency.h
+//
+// Keeps the device memory of managed resources under a budget.  Each resource has its
+// size and the frame it was last used in.  When the total goes over budget the least
+// recently used resources are evicted, and if the ones in use still do not fit their
+// textures lose mip levels, farthest first.  An evicted resource streams back in when
+// it is next used, and lost mips come back once there is room.
+//
+// Resources are only evicted once something has marked them used, whatever never does
+// (terrain, sky, interface textures) is counted but stays put.
+//
+// What the policy does to resources goes through a ResidencyDevice, so a stub can stand
+// in for the device when testing it.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+#include "Streaming.h"
+
+namespace Core
+{
+
+// Device bytes the managed resources may use
+#define RESIDENCY_DEFAULT_BUDGET	(512*1024*1024)
+
+// Frames after its last use that a resource is safe from eviction
+#define RESIDENCY_GRACE_FRAMES		2
+
+// Lost mips come back while the total stays under this part of the budget, the gap
+// keeps a texture from bouncing between sizes
+#define RESIDENCY_RESTORE_FRACTION	0.9f
+
+// Textures keep at least this many mip levels
+#define RESIDENCY_MIN_MIPS			1
+
+	// Kinds of resource, for the report
+	enum RESIDENCY_GROUP
+	{
+		RESIDENCY_OTHER=0,
+		RESIDENCY_TEXTURE,
+		RESIDENCY_MESH,
+		RESIDENCY_GROUPS,	// Only used for number of groups
+	};
+
+	// A tracked resource
+	struct ResidencyEntry
+	{
+		EngineResource*	pResource;
+		char*			szFile;			// To stream it back in from
+		UINT			Bytes;			// Device bytes it holds
+		UINT			FullBytes;		// Bytes with every mip, while some are dropped
+		DWORD			LastUsed;		// Frame it was last used in
+		DWORD			FirstUsed;		// Frame it was first used in, 0 if never
+		float			Priority;		// Nearest use in that frame
+		int				MipsDropped;	// Levels given up to the budget
+		bool			bEvicted;		// Freed, streams back in when used
+	};
+
+	// Budget report
+	struct ResidencyReport
+	{
+		UINT	Budget;
+		UINT	TotalBytes;						// Everything tracked
+		UINT	GroupBytes[RESIDENCY_GROUPS];
+		int		GroupCount[RESIDENCY_GROUPS];
+		UINT	PinnedBytes;					// Never used, so never evicted
+		int		NumEvicted;						// Resources evicted right now
+		int		NumReduced;						// Textures with mips dropped
+		int		Evictions;						// Since the Update before
+		int		MipDrops;
+		int		Restreams;
+		ResidencyReport(){ memset(this, 0, sizeof(ResidencyReport)); }
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// What the residency policy does to resources.  The base class works on the real
+	// resources and the streamer, a stub overrides all of it for tests.
+	//--------------------------------------------------------------------------------------
+	class ResidencyDevice
+	{
+	public:
+		virtual ~ResidencyDevice(){}
+
+		// Device bytes a resource holds
+		virtual UINT GetBytes(EngineResource* pResource);
+
+		// Mip levels it could give up
+		virtual int GetNumMips(EngineResource* pResource);
+
+		// Drops its largest levels, returns the bytes left
+		virtual UINT DropMips(EngineResource* pResource, int levels);
+
+		// Frees it, returns false if it could not be
+		virtual bool Evict(EngineResource* pResource);
+
+		// Streams it back in.  A refresh keeps what it has bound until the new
+		// data is up.
+		virtual void Restream(EngineResource* pResource, const char* szFile, float priority, bool bRefresh);
+
+		// Is it on its way in?
+		virtual bool IsStreaming(EngineResource* pResource);
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Evicts least recently used resources to stay under a budget
+	//--------------------------------------------------------------------------------------
+	class ResidencyManager
+	{
+	public:
+		ResidencyManager();
+
+		// Stops tracking everything
+		void Release();
+
+		// Called by the resource managers as resources come and go
+		void Track(EngineResource* pResource, const char* szFile);
+		void Untrack(EngineResource* pResource);
+
+		// Marks a resource used this frame, an evicted one streams back in nearest first
+		void Touch(EngineResource* pResource, float priority=STREAM_PRIORITY_DEFAULT);
+
+		// Evicts or restores to fit the budget, once a frame before the streamer updates
+		void Update();
+
+		inline void SetBudget(UINT bytes){ m_Budget = bytes; }
+		inline UINT GetBudget(){ return m_Budget; }
+		inline DWORD GetFrame(){ return m_Frame; }
+
+		// The device the policy acts through, NULL for the real one
+		inline void SetDevice(ResidencyDevice* pDevice){ m_pDevice = pDevice ? pDevice : &m_DefaultDevice; }
+
+		// Where the memory is, as of the last Update
+		inline const ResidencyReport& GetReport(){ return m_Report; }
+		void LogReport();
+
+		inline int GetNumTracked(){ return m_Entries.Size(); }
+		inline const ResidencyEntry& GetEntry(int i){ return m_Entries[i]; }
+
+	private:
+		Array<ResidencyEntry>	m_Entries;
+		Array<ResidencyEntry*>	m_Candidates;	// Scratch for Update
+		ResidencyReport			m_Report;
+		UINT					m_Budget;
+		DWORD					m_Frame;
+		ResidencyDevice			m_DefaultDevice;
+		ResidencyDevice*		m_pDevice;
+		int						m_Evictions;	// Since the last Update
+		int						m_MipDrops;
+		int						m_Restreams;
+
+		// Is it safe from eviction this frame?
+		inline bool IsProtected(const ResidencyEntry& e){ return e.FirstUsed==0 || e.LastUsed+RESIDENCY_GRACE_FRAMES>=m_Frame; }
+
+		// Can it be acted on?  Not while the streamer has it.
+		bool IsSettled(const ResidencyEntry& e);
+
+		// Passes of Update, each returns the new total
+		UINT EvictUnused(UINT total);
+		UINT DropMips(UINT total);
+		UINT RestoreMips(UINT total);
+	};
+
+	// The global residency manager
+	extern ResidencyManager g_Residency;
+
+}
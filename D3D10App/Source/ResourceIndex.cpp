@@ -0,0 +1,287 @@
+//--------------------------------------------------------------------------------------
+// File: ResourceIndex.cpp
+//
+// Name lookup for the resource managers
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ResourceIndex.h"
+
+namespace Core
+{
+
+	// Smallest table, it doubles past half full
+	static const int MinBuckets = 64;
+
+	// Folds case and slash style out of a path character
+	static inline char NormalizeKeyChar(char c)
+	{
+		if(c>='A' && c<='Z')
+			return c-'A'+'a';
+		if(c=='/')
+			return '\\';
+		return c;
+	}
+
+	static ResourceHandle NullHandle()
+	{
+		ResourceHandle handle;
+		handle.Index = handle.Generation = 0;
+		return handle;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// FNV-1a over the normalized key
+	//--------------------------------------------------------------------------------------
+	DWORD ResourceIndex::HashKey(const char* szKey)
+	{
+		DWORD hash = 2166136261;
+		for(const char* p=szKey; *p; p++)
+		{
+			hash ^= (BYTE)NormalizeKeyChar(*p);
+			hash *= 16777619;
+		}
+		return hash;
+	}
+
+	bool ResourceIndex::KeysMatch(const char* szA, const char* szB)
+	{
+		while(*szA && NormalizeKeyChar(*szA)==NormalizeKeyChar(*szB))
+		{
+			szA++;
+			szB++;
+		}
+		return NormalizeKeyChar(*szA)==NormalizeKeyChar(*szB);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ResourceIndex::ResourceIndex()
+	{
+		m_DeadKeys = 0;
+		m_First = RESOURCE_NONE;
+		m_Count = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Frees everything
+	//--------------------------------------------------------------------------------------
+	void ResourceIndex::Release()
+	{
+		m_Slots.Release();
+		m_FreeSlots.Release();
+		m_Buckets.Release();
+		m_Keys.Release();
+		m_DeadKeys = 0;
+		m_First = RESOURCE_NONE;
+		m_Count = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Linear probe from the home bucket until the key or an empty bucket
+	//--------------------------------------------------------------------------------------
+	DWORD ResourceIndex::FindBucket(const char* szKey, DWORD hash)
+	{
+		const DWORD mask = m_Buckets.Size()-1;
+		const ResourceBucket* pBuckets = m_Buckets;
+		const char* pKeys = m_Keys;
+		for(DWORD i=hash&mask; ; i=(i+1)&mask)
+		{
+			const ResourceBucket& bucket = pBuckets[i];
+			if(bucket.Slot==RESOURCE_NONE)
+				return i;
+			if(bucket.Hash==hash && KeysMatch(szKey, pKeys+m_Slots[bucket.Slot].Key))
+				return i;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Finds the slot of a key
+	//--------------------------------------------------------------------------------------
+	ResourceHandle ResourceIndex::Find(const char* szKey)
+	{
+		if(!szKey || m_Count==0)
+			return NullHandle();
+		DWORD slot = m_Buckets[FindBucket(szKey, HashKey(szKey))].Slot;
+		if(slot==RESOURCE_NONE)
+			return NullHandle();
+		return MakeHandle(slot);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Rebuilds the table at a new size, the slots keep their hashes
+	//--------------------------------------------------------------------------------------
+	void ResourceIndex::Rehash(int numBuckets)
+	{
+		m_Buckets.Allocate(numBuckets);
+		for(int i=0; i<numBuckets; i++)
+			m_Buckets[i].Slot = RESOURCE_NONE;
+		const DWORD mask = numBuckets-1;
+		for(DWORD s=m_First; s!=RESOURCE_NONE; s=m_Slots[s].Next)
+		{
+			DWORD i = m_Slots[s].Hash&mask;
+			while(m_Buckets[i].Slot!=RESOURCE_NONE)
+				i = (i+1)&mask;
+			m_Buckets[i].Hash = m_Slots[s].Hash;
+			m_Buckets[i].Slot = s;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds a key that is not in the index yet
+	//--------------------------------------------------------------------------------------
+	ResourceHandle ResourceIndex::Insert(const char* szKey)
+	{
+		if(!szKey)
+			return NullHandle();
+		if(m_Buckets.Size()==0)
+			Rehash(MinBuckets);
+		else if((m_Count+1)*2>m_Buckets.Size())
+			Rehash(m_Buckets.Size()*2);
+
+		// Take a free slot or a new one
+		DWORD slot;
+		if(m_FreeSlots.Size()>0)
+		{
+			slot = m_FreeSlots[m_FreeSlots.Size()-1];
+			m_FreeSlots.Remove(m_FreeSlots.Size()-1);
+		}
+		else
+		{
+			ResourceSlot newSlot;
+			newSlot.Generation = 1;
+			m_Slots.Add(newSlot);
+			slot = m_Slots.Size()-1;
+		}
+
+		// Intern the key
+		ResourceSlot& s = m_Slots[slot];
+		s.Hash = HashKey(szKey);
+		s.Key = m_Keys.Size();
+		for(const char* p=szKey; *p; p++)
+			m_Keys.Add(*p);
+		m_Keys.Add(0);
+		s.bUsed = true;
+
+		// Newest first
+		s.Prev = RESOURCE_NONE;
+		s.Next = m_First;
+		if(m_First!=RESOURCE_NONE)
+			m_Slots[m_First].Prev = slot;
+		m_First = slot;
+
+		DWORD bucket = FindBucket(szKey, s.Hash);
+		m_Buckets[bucket].Hash = s.Hash;
+		m_Buckets[bucket].Slot = slot;
+		m_Count++;
+		return MakeHandle(slot);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Frees a slot.  The buckets after it in its run shift back into the gap when their
+	// home bucket allows, so probes never need markers for removed keys.
+	//--------------------------------------------------------------------------------------
+	bool ResourceIndex::Remove(const ResourceHandle& handle)
+	{
+		if(!IsValid(handle))
+			return false;
+		const DWORD slot = handle.Index;
+		ResourceSlot& s = m_Slots[slot];
+
+		const DWORD mask = m_Buckets.Size()-1;
+		DWORD i = s.Hash&mask;
+		while(m_Buckets[i].Slot!=slot)
+			i = (i+1)&mask;
+		for(DWORD j=(i+1)&mask; m_Buckets[j].Slot!=RESOURCE_NONE; j=(j+1)&mask)
+		{
+			// Move j back to i unless its home bucket lies in (i, j]
+			DWORD home = m_Buckets[j].Hash&mask;
+			bool bStays = (i<=j) ? (home>i && home<=j) : (home>i || home<=j);
+			if(!bStays)
+			{
+				m_Buckets[i] = m_Buckets[j];
+				i = j;
+			}
+		}
+		m_Buckets[i].Slot = RESOURCE_NONE;
+
+		// Out of the order list
+		if(s.Prev!=RESOURCE_NONE)
+			m_Slots[s.Prev].Next = s.Next;
+		else
+			m_First = s.Next;
+		if(s.Next!=RESOURCE_NONE)
+			m_Slots[s.Next].Prev = s.Prev;
+
+		m_DeadKeys += (UINT)strlen((const char*)m_Keys + s.Key)+1;
+		s.bUsed = false;
+		if(++s.Generation==0)
+			s.Generation = 1;
+		m_FreeSlots.Add(slot);
+		m_Count--;
+		if(m_DeadKeys*2>(UINT)m_Keys.Size())
+			CompactKeys();
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Rebuilds the pool without the removed keys
+	//--------------------------------------------------------------------------------------
+	void ResourceIndex::CompactKeys()
+	{
+		int size = m_Keys.Size()-m_DeadKeys;
+		char* pKeys = new char[size];
+		int offset = 0;
+		for(DWORD s=m_First; s!=RESOURCE_NONE; s=m_Slots[s].Next)
+		{
+			const char* szKey = (const char*)m_Keys + m_Slots[s].Key;
+			int length = (int)strlen(szKey)+1;
+			memcpy(pKeys+offset, szKey, length);
+			m_Slots[s].Key = offset;
+			offset += length;
+		}
+		m_Keys.TakeArray(pKeys, size);
+		m_DeadKeys = 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Walks the keys newest first
+	//--------------------------------------------------------------------------------------
+	ResourceHandle ResourceIndex::GetFirst()
+	{
+		if(m_First==RESOURCE_NONE)
+			return NullHandle();
+		return MakeHandle(m_First);
+	}
+
+	ResourceHandle ResourceIndex::GetNext(const ResourceHandle& handle)
+	{
+		if(!IsValid(handle) || m_Slots[handle.Index].Next==RESOURCE_NONE)
+			return NullHandle();
+		return MakeHandle(m_Slots[handle.Index].Next);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Bytes held
+	//--------------------------------------------------------------------------------------
+	UINT ResourceIndex::GetMemoryUsage()
+	{
+		return m_Slots.Size()*sizeof(ResourceSlot) + m_FreeSlots.Size()*sizeof(DWORD) +
+			   m_Buckets.Size()*sizeof(ResourceBucket) + m_Keys.Size();
+	}
+}
@@ -0,0 +1,112 @@
+//--------------------------------------------------------------------------------------
+// File: ResourceIndex.h
+//
+// Name lookup for the resource managers.  Keys are interned into one pool and found
+// through an open addressing hash table, each key owns a slot that handles point at.
+// A slot's generation changes when it is freed, so handles to it go stale instead of
+// pointing at whatever reuses it.  Paths match without regard to case or slash style.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+
+namespace Core
+{
+
+// Last slot index, also marks an empty bucket and the end of the order list
+#define RESOURCE_NONE 0xffffffff
+
+	//--------------------------------------------------------------------------------------
+	// Bookkeeping for one key
+	//--------------------------------------------------------------------------------------
+	struct ResourceSlot
+	{
+		DWORD	Hash;			// Hash of the normalized key
+		DWORD	Key;			// Offset of the key in the pool
+		DWORD	Generation;		// Changes each time the slot is freed
+		DWORD	Prev, Next;		// Order the keys were added in, newest first
+		bool	bUsed;			// False while on the free list
+	};
+
+	// A hash table entry, the hash is kept here to skip most key compares
+	struct ResourceBucket
+	{
+		DWORD	Hash;
+		DWORD	Slot;			// RESOURCE_NONE when empty
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Hashes keys to slots
+	//--------------------------------------------------------------------------------------
+	class ResourceIndex
+	{
+	public:
+		ResourceIndex();
+
+		// Frees everything.  Handles from before may match new keys afterwards.
+		void Release();
+
+		// Finds the slot of a key, a null handle if it is not in the index
+		ResourceHandle Find(const char* szKey);
+
+		// Adds a key that is not in the index yet
+		ResourceHandle Insert(const char* szKey);
+
+		// Frees the slot of a handle
+		bool Remove(const ResourceHandle& handle);
+
+		// Does the handle still name a key?
+		inline bool IsValid(const ResourceHandle& handle)
+		{
+			return handle.Index<(DWORD)m_Slots.Size() && m_Slots[handle.Index].bUsed &&
+				   m_Slots[handle.Index].Generation==handle.Generation;
+		}
+
+		// The key as it was added
+		inline const char* GetKey(const ResourceHandle& handle){ return (const char*)m_Keys + m_Slots[handle.Index].Key; }
+
+		// Walks the keys newest first, a null handle at the end
+		ResourceHandle GetFirst();
+		ResourceHandle GetNext(const ResourceHandle& handle);
+
+		inline int GetCount(){ return m_Count; }
+		UINT GetMemoryUsage();
+
+		// Hash of a path with case and slash style folded out
+		static DWORD HashKey(const char* szKey);
+
+		// Compares paths with case and slash style folded out
+		static bool KeysMatch(const char* szA, const char* szB);
+
+	private:
+		Array<ResourceSlot>		m_Slots;		// One for each key, freed ones are reused
+		Array<DWORD>			m_FreeSlots;	// Slots to reuse
+		Array<ResourceBucket>	m_Buckets;		// Power of two table, at most half full
+		Array<char>				m_Keys;			// Interned keys
+		UINT					m_DeadKeys;		// Pool bytes of removed keys
+		DWORD					m_First;		// Newest slot
+		int						m_Count;		// Keys in the index
+
+		// Bucket a key is in, or the empty bucket it would go in
+		DWORD FindBucket(const char* szKey, DWORD hash);
+
+		// Rebuilds the table at a new size
+		void Rehash(int numBuckets);
+
+		// Rebuilds the pool without the removed keys
+		void CompactKeys();
+
+		inline ResourceHandle MakeHandle(DWORD slot)
+		{
+			ResourceHandle handle;
+			handle.Index = slot;
+			handle.Generation = m_Slots[slot].Generation;
+			return handle;
+		}
+	};
+
+}
@@ -18,27 +18,27 @@ namespace Core
 
 
 	//--------------------------------------------------------------------------------------
-	// Retrieves an object pointer from the list, otherwise returns NULL
+	// Retrieves an object pointer from the manager, otherwise returns NULL
 	//--------------------------------------------------------------------------------------
 	template <class T>
 	T* ResourceManager<T>::Get(const char* sName)
 	{
-		if(!sName)
-			return NULL;
-		
-		// Itterate through the list
-		T* pObj = NULL;
-		m_Resources.Itterate();
-		while( (pObj=m_Resources.GetCurrent()) )
-		{
-			// Check if the filenames match
-			if( pObj && strcmp(pObj->GetName(),sName) == 0)
-				return pObj;
-			m_Resources.StepForward();
-		}
-		
-		// Model is not in the list so return NULL
-		return pObj;
+		return Get(m_Index.Find(sName));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Puts an object in the index under a name
+	//--------------------------------------------------------------------------------------
+	template <class T>
+	void ResourceManager<T>::Insert(T* pObj, const char* sName)
+	{
+		ResourceHandle handle = m_Index.Insert(sName);
+		if(handle.Index==(DWORD)m_Objects.Size())
+			m_Objects.Add(pObj);
+		else
+			m_Objects[handle.Index] = pObj;
+		pObj->m_Handle = handle;
 	}
 
 
@@ -53,10 +53,7 @@ namespace Core
 
 		// Make sure it's not already in the model list
 		if(!Get(pNew->GetName()))
-		{
-			// Add it to the list
-			m_Resources.Add(pNew);
-		}
+			Insert(pNew, pNew->GetName());
 	}
 
 
@@ -69,18 +66,24 @@ namespace Core
 		// If it exists
 		if(pObj)
 		{
-			if(!Get(pObj->GetName()))
+			if(!Holds(pObj))
 				return;
 			
 			// Dec the ref count
 			pObj->Deref();
 			
-			// If it is no longer active, delete it
+			// If it is no longer active, delete it.  One a loader is still
+			// reading is deleted by the streamer when it is done.
 			if(!pObj->IsActive())
 			{
-				m_Resources.Remove(pObj);
-				pObj->Release();
-				delete pObj;
+				m_Objects[pObj->m_Handle.Index] = NULL;
+				m_Index.Remove(pObj->m_Handle);
+				g_Residency.Untrack(pObj);
+				if(g_Streamer.Cancel(pObj))
+				{
+					pObj->Release();
+					delete pObj;
+				}
 			}		
 		}
 	}
@@ -103,32 +106,76 @@ namespace Core
 			T* pNew = new T;
 			if(!pNew->Load(sFile))
 			{
+				Log::Print("Resource %s failed to load!", sFile);
 				delete pNew;
 				return NULL;
-				Log::Print("Resource %s failed to load!", sFile);
 			}
 			
 			
 			pNew->AddRef();
 			
-			// Add it to the list
-			m_Resources.Add(pNew);
+			// Add it under the file it came from, which is not always its name
+			Insert(pNew, sFile);
+			g_Residency.Track(pNew, sFile);
 			return pNew;
 
 		}
+
+		// Someone asked for it in the background or it was evicted, this needs it now
+		if(!pObjPtr->IsResident())
+		{
+			g_Residency.Touch(pObjPtr);
+			g_Streamer.Finish(pObjPtr);
+		}
 		pObjPtr->AddRef();
 		return pObjPtr;
 	}
 
+
 	//--------------------------------------------------------------------------------------
-	// Reloads the resource
+	// Loads an object in the background, it is returned before it is resident
+	//--------------------------------------------------------------------------------------
+	template <class T>
+	T* ResourceManager<T>::LoadAsync(const char* sFile, float priority)
+	{
+		if(!sFile)
+			return NULL;
+
+		// Already loaded or on its way
+		T* pObjPtr = Get(sFile);
+		if(pObjPtr)
+		{
+			if(!pObjPtr->IsResident())
+			{
+				g_Residency.Touch(pObjPtr, priority);
+				g_Streamer.SetPriority(pObjPtr, priority);
+			}
+			pObjPtr->AddRef();
+			return pObjPtr;
+		}
+
+		// An empty object stands in until the streamer fills it
+		T* pNew = new T;
+		pNew->AddRef();
+		Insert(pNew, sFile);
+		g_Streamer.Request(pNew, sFile, priority);
+		g_Residency.Track(pNew, sFile);
+		return pNew;
+	}
+
+	//--------------------------------------------------------------------------------------
+	// Reloads the resource from the file it was loaded from
 	//--------------------------------------------------------------------------------------
 	template <class T>		
 	void ResourceManager<T>::Reload(T* pObj)
 	{
-		if(!pObj || !Get(pObj->GetName()) )
+		if(!pObj || !Holds(pObj))
 			return;
-		String szName = pObj->GetName();
+
+		// A loader may still be writing into it, even when a refresh left it resident
+		if(pObj->m_pStream)
+			g_Streamer.Finish(pObj);
+		String szName = m_Index.GetKey(pObj->m_Handle);
 		pObj->Release();
 		pObj->Load( szName );
 	}	
@@ -141,19 +188,21 @@ namespace Core
 	void ResourceManager<T>::Release()
 	{
 		// Itterate through the list
-		T* pObj;
-		m_Resources.Itterate();
-		while( (pObj=m_Resources.RemoveCurrent()) )
+		for(ResourceHandle handle=m_Index.GetFirst(); !handle.IsNull(); handle=m_Index.GetNext(handle))
 		{
+			T* pObj = m_Objects[handle.Index];
+
 			// Release the object
+			g_Residency.Untrack(pObj);
 			pObj->Release();
 					
 			// Delete the object
 			delete pObj;
 		}
 
-		// Release the linked list
-		m_Resources.Release();
+		// Release the index
+		m_Index.Release();
+		m_Objects.Release();
 
 	}
 
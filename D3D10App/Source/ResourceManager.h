@@ -6,12 +6,23 @@
 //
 // Any class to be used with a ResourceManager MUST inherit from class EngineResource! 
 //
+// Resources are found by the name they were loaded or added with through a hash
+// index, and can be held by handle.  A handle to a freed resource gets NULL back.
+//
+// LoadAsync hands new resources to the streamer and returns them at once, they are
+// placeholders until IsResident.  Load of one that is still streaming finishes it.
+//
+// Loaded resources are tracked by the residency manager, which may evict them once
+// they go unused.  Touch them as they are used, an evicted one streams back in.
+//
 // Coded by Nate Orr
 //--------------------------------------------------------------------------------------
 #pragma unmanaged
 #pragma once
 
-#include "LinkedList.cpp"
+#include "ResourceIndex.h"
+#include "Streaming.h"
+#include "Residency.h"
 
 namespace Core
 {
@@ -30,9 +41,24 @@ namespace Core
 			// Retrieves an object pointer from the manager by its name
 			T* Get(const char* sName); 
 
+			// Retrieves an object by handle, NULL once it has been freed
+			inline T* Get(const ResourceHandle& handle){ return m_Index.IsValid(handle) ? m_Objects[handle.Index] : NULL; }
+
+			// Handle of an object by its name, a null handle if it is not loaded
+			inline ResourceHandle GetHandle(const char* sName){ return m_Index.Find(sName); }
+
 			// Loads a new object from a file
 			T* Load(const char* sFile);
 
+			// Loads an object in the background, lower priorities load sooner
+			T* LoadAsync(const char* sFile, float priority=STREAM_PRIORITY_DEFAULT);
+
+			// Ranks an object that is still streaming
+			inline void SetPriority(T* pObj, float priority){ if(pObj && !pObj->IsResident()) g_Streamer.SetPriority(pObj, priority); }
+
+			// Marks an object used this frame, nearer uses have lower priorities
+			inline void Touch(T* pObj, float priority=STREAM_PRIORITY_DEFAULT){ if(pObj) g_Residency.Touch(pObj, priority); }
+
 			// Reloads the resource
 			void Reload(T* pObj);
 
@@ -42,10 +68,20 @@ namespace Core
 			// Releases all resources
 			void Release();
 
-			// Gets the resource list
-			inline LinkedList<T*>* GetList(){ return &m_Resources; }
-			
-			LinkedList<T*>		m_Resources;	// Linked list of object smart ptrs
+			// Walks the resources newest first, a null handle at the end
+			inline ResourceHandle GetFirst(){ return m_Index.GetFirst(); }
+			inline ResourceHandle GetNext(const ResourceHandle& handle){ return m_Index.GetNext(handle); }
+			inline int GetNumResources(){ return m_Index.GetCount(); }
+
+	private:
+			ResourceIndex		m_Index;		// Names to slots
+			Array<T*>			m_Objects;		// Object in each slot
+
+			// Is the object one this manager holds?
+			inline bool Holds(T* pObj){ return m_Index.IsValid(pObj->m_Handle) && m_Objects[pObj->m_Handle.Index]==pObj; }
+
+			// Puts an object in the index under a name
+			void Insert(T* pObj, const char* sName);
 	};
 
-}
\ No newline at end of file
+}
@@ -175,4 +175,9 @@ typedef struct
 //Calculate SPA output values (in structure) based on input values passed in structure
 int spa_calculate(spa_data *spa);
 
+//Julian day of a local date and time, and the geocentric values spa_calculate starts from
+//(jd and delta_t must already be in the structure).  Used by the batched solver.
+double julian_day(int year, int month, int day, int hour, int minute, int second, double tz);
+void calculate_geocentric_sun_right_ascension_and_declination(spa_data *spa);
+
 #endif
@@ -100,7 +100,36 @@ namespace Core
 
 		// Rebuild the material texture
 		EncodeMaterialTexture();
+		MakeMeshNameUnique(pMesh);
+		return pMesh;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Streams a mesh object in.  Its materials and textures arrive with it, so the
+	// material texture is rebuilt when it joins the scene.
+	//--------------------------------------------------------------------------------------
+	MeshObject* Renderer::LoadMeshAsync( const char* file )
+	{
+		MeshObject* pMesh = new MeshObject();
+		if(!pMesh->LoadAsync(file))
+		{
+			pMesh->Release();
+			delete pMesh;
+			return NULL;
+		}
+		if(!pMesh->IsPending())
+			EncodeMaterialTexture();
+		MakeMeshNameUnique(pMesh);
+		return pMesh;
+	}
+
 
+	//--------------------------------------------------------------------------------------
+	// Renames a loaded mesh so no mesh in the scene shares its name
+	//--------------------------------------------------------------------------------------
+	void Renderer::MakeMeshNameUnique( MeshObject* pMesh )
+	{
 		// Make sure there isnt another mesh with the same name
 		int num=2;
 		String baseName = pMesh->GetName();
@@ -121,8 +150,6 @@ namespace Core
 			}
 		}
 		pMesh->SetName(const_cast<char*>(realName.c_str()));
-
-		return pMesh;
 	}
 
 
@@ -133,6 +160,13 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Renderer::AddMesh( MeshObject* pMesh )
 	{
+		// Still streaming, UpdateStreaming adds it when it is ready
+		if(pMesh->IsPending())
+		{
+			m_PendingMeshes.Add( pMesh );
+			return;
+		}
+
 		// Update the mesh
 		pMesh->UpdateMesh();
 		
@@ -165,6 +199,10 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Renderer::RemoveMesh( MeshObject* pMesh )
 	{
+		// It never made it into the scene
+		if(m_PendingMeshes.Remove(pMesh))
+			return;
+
 		// Get rid of any light attachments
 		for(int i=0; i<m_Lights.Size(); i++)
 			if(m_Lights[i]->GetAttachedMesh() == pMesh)
@@ -287,6 +325,20 @@ namespace Core
 		return pEmitter;
 	}
 
+	//--------------------------------------------------------------------------------------
+	// Create an emitter from a description file
+	//--------------------------------------------------------------------------------------
+	ParticleEmitter* Renderer::LoadParticleEmitter(char* file)
+	{
+		ParticleEmitterDesc desc;
+		if(!desc.Load(file))
+			return NULL;
+		ParticleEmitter* pEmitter = new ParticleEmitter();
+		pEmitter->Create(desc, m_Effect, m_Camera);
+		m_Emitters.Add(pEmitter);
+		return pEmitter;
+	}
+
 
 	//--------------------------------------------------------------------------------------
 	// Delete an emitter
@@ -303,6 +355,86 @@ namespace Core
 
 
 
+	//--------------------------------------------------------------------------------------
+	// Keeps what is in view resident within the memory budget, ranks what is streaming by
+	// its distance to the camera, finishes what the loaders have ready within the frame
+	// budget and adds meshes that have arrived
+	//--------------------------------------------------------------------------------------
+	void Renderer::UpdateStreaming()
+	{
+		// What is in view stays resident, then the budget evicts what has not been
+		// used lately
+		D3DXVECTOR3 vEye = m_Camera.GetPos();
+		for(int i=0; i<m_MeshObjects.Size(); i++)
+			if(Device::IsMeshVisible(*m_MeshObjects[i], m_Camera))
+				m_MeshObjects[i]->TouchResources(vEye);
+
+		// So does what the shadow maps and probes will draw this frame, the passes run
+		// after the budget so they are gathered here
+		for(int i=0; i<m_Lights.Size(); i++)
+		{
+			Light& light = *m_Lights[i];
+			if(!light.IsShadowed || light.Type==Light::LIGHT_DIRECTIONAL || !IsLightVisible(light))
+				continue;
+			for(int j=0; j<light.MeshList.Size(); j++)
+				light.MeshList[j]->TouchResources(vEye);
+		}
+		for(int i=0; i<m_Probes.Size(); i++)
+		{
+			MeshObject* pProbeMesh = m_Probes[i]->GetMesh();
+			if(!m_Probes[i]->IsDynamic() || !pProbeMesh ||
+			   !m_Camera.GetFrustum().CheckSphere(pProbeMesh->GetPos(), pProbeMesh->GetRadius()))
+				continue;
+			for(int j=0; j<m_MeshObjects.Size(); j++)
+			{
+				D3DXVECTOR3 vDist = m_MeshObjects[j]->GetPos() - pProbeMesh->GetPos();
+				if(m_MeshObjects[j]!=pProbeMesh && D3DXVec3Length(&vDist)-m_MeshObjects[j]->GetRadius()<ProbeSettings::farPlane)
+					m_MeshObjects[j]->TouchResources(vEye);
+			}
+		}
+		g_Residency.Update();
+
+		// Nearer things first, a shared texture goes with its nearest user
+		if(g_Streamer.GetStats().QueueDepth>0)
+		{
+			for(int i=0; i<m_PendingMeshes.Size(); i++)
+			{
+				D3DXVECTOR3 vDist = m_PendingMeshes[i]->GetPos() - vEye;
+				g_Meshes.SetPriority(m_PendingMeshes[i]->GetMesh(), D3DXVec3Length(&vDist));
+			}
+			for(int i=0; i<m_MeshObjects.Size(); i++)
+			{
+				D3DXVECTOR3 vDist = m_MeshObjects[i]->GetPos() - vEye;
+				float dist = max(D3DXVec3Length(&vDist) - m_MeshObjects[i]->GetRadius(), 0.0f);
+				for(int j=0; j<m_MeshObjects[i]->GetNumSubMesh(); j++)
+					m_MeshObjects[i]->GetSubMesh(j)->pMaterial->PrioritizeTextures(dist);
+			}
+		}
+
+		// Put what is decoded on the device
+		if(g_Streamer.Update())
+			g_Materials.RefreshTextures();
+
+		// Objects pick up buffers their meshes freed or got back
+		for(int i=0; i<m_MeshObjects.Size(); i++)
+			m_MeshObjects[i]->SyncBuffers();
+
+		// Meshes that are resident join the scene with their new materials
+		bool bAdded = false;
+		for(int i=m_PendingMeshes.Size()-1; i>=0; i--)
+		{
+			MeshObject* pMesh = m_PendingMeshes[i];
+			if(!pMesh->FinishLoad())
+				continue;
+			m_PendingMeshes.Remove(i);
+			AddMesh(pMesh);
+			bAdded = true;
+		}
+		if(bAdded)
+			EncodeMaterialTexture();
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Process engine messages
 	//--------------------------------------------------------------------------------------
@@ -327,8 +459,9 @@ namespace Core
 			case MSG_MESH_UPDATE:
 				{
 					MeshObject* pMesh = (MeshObject*)msg.param;
-					for(int e=0; e<m_Lights.Size(); e++)
-						m_Lights[e]->CheckMesh( pMesh );
+					if(!pMesh->IsPending())
+						for(int e=0; e<m_Lights.Size(); e++)
+							m_Lights[e]->CheckMesh( pMesh );
 					pMesh->isUpdating=false;
 					break;
 				}
@@ -0,0 +1,163 @@
+//--------------------------------------------------------------------------------------
+// File: SelfTest.cpp
+//
+// Engine self tests
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+namespace Core
+{
+	// Zero initialized before any registrar runs
+	SelfTestEntry	SelfTest::m_Tests[SELFTEST_MAX];
+	int				SelfTest::m_NumTests = 0;
+	char			SelfTest::m_szFilter[64];
+	bool			SelfTest::m_bActive = false;
+	bool			SelfTest::m_bBenchmark = false;
+	const char*		SelfTest::m_szRunning = NULL;
+	int				SelfTest::m_Failures = 0;
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds a test
+	//--------------------------------------------------------------------------------------
+	void SelfTest::Register(const char* szName, SELFTEST_FUNC func, SELFTEST_TYPE type)
+	{
+		assert(m_NumTests<SELFTEST_MAX);
+		if(m_NumTests==SELFTEST_MAX)
+			return;
+		m_Tests[m_NumTests].szName = szName;
+		m_Tests[m_NumTests].Func = func;
+		m_Tests[m_NumTests].Type = type;
+		m_NumTests++;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reads "-test [filter]" or "-bench [filter]"
+	//--------------------------------------------------------------------------------------
+	bool SelfTest::ParseCommandLine(const wchar_t* szCmdLine)
+	{
+		if(!szCmdLine)
+			return false;
+		while(*szCmdLine==L' ')
+			szCmdLine++;
+
+		const wchar_t* szArgs = NULL;
+		bool bBenchmark = false;
+		if(wcsncmp(szCmdLine, L"-test", 5)==0)
+			szArgs = szCmdLine+5;
+		else if(wcsncmp(szCmdLine, L"-bench", 6)==0)
+		{
+			szArgs = szCmdLine+6;
+			bBenchmark = true;
+		}
+		if(!szArgs || (*szArgs!=0 && *szArgs!=L' '))
+			return false;
+		m_bActive = true;
+		m_bBenchmark = bBenchmark;
+
+		// The filter is the next word
+		while(*szArgs==L' ')
+			szArgs++;
+		int i=0;
+		for(; szArgs[i] && szArgs[i]!=L' ' && i<(int)sizeof(m_szFilter)-1; i++)
+			m_szFilter[i] = (char)szArgs[i];
+		m_szFilter[i] = 0;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Runs the tests of a type that match the filter
+	//--------------------------------------------------------------------------------------
+	int SelfTest::Run(SELFTEST_TYPE type, void* pContext)
+	{
+		int run=0, failed=0;
+		for(int i=0; i<m_NumTests; i++)
+		{
+			const SelfTestEntry& test = m_Tests[i];
+			if(test.Type!=type || !strstr(test.szName, m_szFilter))
+				continue;
+
+			m_szRunning = test.szName;
+			m_Failures = 0;
+			double start = GetTime();
+			test.Func(pContext);
+			double time = GetTime()-start;
+
+			run++;
+			if(m_Failures)
+			{
+				failed++;
+				Log::Print("[FAIL] %s, %d checks failed (%.0fms)", test.szName, m_Failures, time);
+			}
+			else
+				Log::Print("[ OK ] %s (%.0fms)", test.szName, time);
+		}
+		m_szRunning = NULL;
+
+		if(run)
+			Log::Print("%d of %d tests passed", run-failed, run);
+		return failed;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Number of tests of a type that match the filter
+	//--------------------------------------------------------------------------------------
+	int SelfTest::Count(SELFTEST_TYPE type)
+	{
+		int count=0;
+		for(int i=0; i<m_NumTests; i++)
+			if(m_Tests[i].Type==type && strstr(m_Tests[i].szName, m_szFilter))
+				count++;
+		return count;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Records a check in the running test
+	//--------------------------------------------------------------------------------------
+	bool SelfTest::Check(bool bPassed, const char* szExpr, const char* szFile, int line)
+	{
+		if(bPassed)
+			return true;
+		if(m_Failures<SELFTEST_MAX_REPORTED)
+			Log::Print("<!> %s(%d): %s failed %s", szFile, line, m_szRunning ? m_szRunning : "", szExpr);
+		m_Failures++;
+		return false;
+	}
+
+	bool SelfTest::CheckNear(double value, double expected, double tolerance, const char* szExpr, const char* szFile, int line)
+	{
+		if(fabs(value-expected)<=tolerance)
+			return true;
+		if(m_Failures<SELFTEST_MAX_REPORTED)
+			Log::Print("<!> %s(%d): %s failed %s, %f is %f off, allowed %f", szFile, line, m_szRunning ? m_szRunning : "", szExpr, value, fabs(value-expected), tolerance);
+		m_Failures++;
+		return false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Milliseconds on the high resolution timer
+	//--------------------------------------------------------------------------------------
+	double SelfTest::GetTime()
+	{
+		LARGE_INTEGER freq, t;
+		QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&t);
+		return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+	}
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+//--------------------------------------------------------------------------------------
+// File: SelfTest.h
+//
+// Engine self tests.  A test is a function declared with SELF_TEST() in one of the
+// files under Source\Tests, it registers itself when the program starts.  A debug build
+// run with "-test [filter]" runs every test whose name contains the filter and exits
+// with the number that failed, "-bench [filter]" runs the benchmarks instead.
+//
+// Headless tests run before the window is created.  Device tests run once the renderer
+// is up and get it as their context.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#ifdef PHASE_DEBUG
+
+namespace Core
+{
+
+// Most tests that can be registered
+#define SELFTEST_MAX			256
+
+// Failed checks logged for each test, the rest are only counted
+#define SELFTEST_MAX_REPORTED	8
+
+	// Kinds of test
+	enum SELFTEST_TYPE
+	{
+		SELFTEST_HEADLESS=0,	// Runs with -test before the window is created
+		SELFTEST_DEVICE,		// Runs with -test once the renderer is created
+		SELFTEST_BENCHMARK,		// Logs timings, runs with -bench
+	};
+
+	// A test body, the context is the Renderer for device tests and NULL otherwise
+	typedef void (*SELFTEST_FUNC)(void* pContext);
+
+	// A registered test
+	struct SelfTestEntry
+	{
+		const char*		szName;
+		SELFTEST_FUNC	Func;
+		SELFTEST_TYPE	Type;
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Registers and runs the self tests
+	//--------------------------------------------------------------------------------------
+	class SelfTest
+	{
+	public:
+
+		// Adds a test, the SELF_TEST macros do this at static init time
+		static void Register(const char* szName, SELFTEST_FUNC func, SELFTEST_TYPE type);
+
+		// Reads "-test [filter]" or "-bench [filter]", returns true if either was given
+		static bool ParseCommandLine(const wchar_t* szCmdLine);
+
+		// Was the program started to run tests?
+		static inline bool IsActive(){ return m_bActive; }
+		static inline bool IsBenchmark(){ return m_bBenchmark; }
+
+		// Runs the tests of a type that match the filter, returns the number that failed
+		static int Run(SELFTEST_TYPE type, void* pContext=NULL);
+
+		// Number of tests of a type that match the filter
+		static int Count(SELFTEST_TYPE type);
+
+		// Records a check in the running test, returns the condition
+		static bool Check(bool bPassed, const char* szExpr, const char* szFile, int line);
+		static bool CheckNear(double value, double expected, double tolerance, const char* szExpr, const char* szFile, int line);
+
+		// Milliseconds on the high resolution timer, for benchmarks
+		static double GetTime();
+
+	private:
+		static SelfTestEntry	m_Tests[SELFTEST_MAX];
+		static int				m_NumTests;
+		static char				m_szFilter[64];
+		static bool				m_bActive;
+		static bool				m_bBenchmark;
+		static const char*		m_szRunning;	// Test being run
+		static int				m_Failures;		// Failed checks in it
+	};
+
+
+	// Registers a test from a static initializer
+	struct SelfTestRegistrar
+	{
+		SelfTestRegistrar(const char* szName, SELFTEST_FUNC func, SELFTEST_TYPE type){ SelfTest::Register(szName, func, type); }
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Repeatable random numbers for test data.  Any seed works, the same seed always gives
+	// the same run.
+	//--------------------------------------------------------------------------------------
+	inline UINT TestRand(UINT& state)
+	{
+		state = state*1664525 + 1013904223;
+		UINT x = state;
+		x ^= x>>16;
+		x *= 0x7feb352d;
+		x ^= x>>15;
+		return x;
+	}
+
+	// Uniform in [lo, hi)
+	inline float TestRandFloat(UINT& state, float lo, float hi)
+	{
+		return lo + (hi-lo)*((TestRand(state)>>8)/16777216.0f);
+	}
+
+}
+
+// Declares and registers a test
+#define SELFTEST_DECLARE(name, type) \
+	static void SelfTest_##name(void* pContext); \
+	static Core::SelfTestRegistrar SelfTestRegistrar_##name(#name, SelfTest_##name, type); \
+	static void SelfTest_##name(void* pContext)
+
+#define SELF_TEST(name)			SELFTEST_DECLARE(name, Core::SELFTEST_HEADLESS)
+#define SELF_DEVICE_TEST(name)	SELFTEST_DECLARE(name, Core::SELFTEST_DEVICE)
+#define SELF_BENCHMARK(name)	SELFTEST_DECLARE(name, Core::SELFTEST_BENCHMARK)
+
+// Checks inside a test, both return the result so a test can stop on a failure
+#define TEST_CHECK(x)				Core::SelfTest::Check(!!(x), #x, __FILE__, __LINE__)
+#define TEST_CHECK_NEAR(x, y, tol)	Core::SelfTest::CheckNear((double)(x), (double)(y), (double)(tol), #x " ~ " #y, __FILE__, __LINE__)
+
+#endif
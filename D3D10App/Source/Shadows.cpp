@@ -147,28 +147,25 @@ namespace Core
 
 				// Update the animation matrices
 				if(mesh.IsSkinned())
-				{
 					Device::Effect->AnimMatricesVariable->SetMatrixArray((float*)mesh.GetAnimMatrices(), 0, mesh.GetNumAnimMatrices());
 
-					// Set the input layout
-					Device::SetInputLayout( SkinnedVertex::pInputLayout );
-				}
-				else
-					Device::SetInputLayout( Vertex::pInputLayout );
-
-				// Render the submeshes
+				// Render the submeshes, the level is picked for where the shadow is seen from
+				int lod = mesh.ComputeLOD(m_Camera.GetPos(), m_LODPixelScale, LODSettings::ShadowPixelError);
 				for(int k=0; k<mesh.GetNumSubMesh(); k++)
 				{
 					if(mesh.GetSubMesh(k)->pMaterial->IsTransparent() || mesh.GetSubMesh(k)->pMaterial->IsRefractive())
 						continue;
 					
+					// Set the input layout
+					Device::SetVertexFormat(*mesh.GetSubMesh(k));
+
 					if( mesh.IsSkinned() )	
 						Device::Effect->Pass[PASS_SHADOWMAP_ANIM]->Apply(0);
 					else
 						Device::Effect->Pass[PASS_SHADOWMAP]->Apply(0);
 
 					// Render the mesh				
-					Device::DrawSubmesh(*mesh.GetSubMesh(k));
+					Device::DrawSubmesh(*mesh.GetSubMesh(k), lod);
 				}				
 			}		
 
@@ -257,28 +254,25 @@ namespace Core
 
 					// Update the animation matrices
 					if(mesh.IsSkinned())
-					{
 						Device::Effect->AnimMatricesVariable->SetMatrixArray((float*)mesh.GetAnimMatrices(), 0, mesh.GetNumAnimMatrices());
 
-						// Set the input layout
-						Device::SetInputLayout( SkinnedVertex::pInputLayout );
-					}
-					else
-						Device::SetInputLayout( Vertex::pInputLayout );
-
-					// Render the submeshes
+					// Render the submeshes, the level is picked for where the shadow is seen from
+					int lod = mesh.ComputeLOD(m_Camera.GetPos(), m_LODPixelScale, LODSettings::ShadowPixelError);
 					for(int k=0; k<mesh.GetNumSubMesh(); k++)
 					{
 						if(mesh.GetSubMesh(k)->pMaterial->IsTransparent() || mesh.GetSubMesh(k)->pMaterial->IsRefractive())
 							continue;
 
+						// Set the input layout
+						Device::SetVertexFormat(*mesh.GetSubMesh(k));
+
 						if( mesh.IsSkinned() )	
 							Device::Effect->Pass[PASS_SHADOWMAP_ANIM]->Apply(0);
 						else
 							Device::Effect->Pass[PASS_SHADOWMAP]->Apply(0);
 
 						// Render the mesh				
-						Device::DrawSubmesh(*mesh.GetSubMesh(k));
+						Device::DrawSubmesh(*mesh.GetSubMesh(k), lod);
 					}		
 				}
 			}
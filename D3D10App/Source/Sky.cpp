@@ -14,6 +14,12 @@
 
 namespace Core
 {
+	// Sun path tables are kept here between runs
+	#define SKY_SUN_PATH_CACHE "SunPath.cache"
+
+	// Scattering tables for the sun the sky last started with
+	#define SKY_SCATTERING_CACHE "SkyScattering.cache"
+
 	//--------------------------------------------------------------------------------------
 	// Creates the sky system
 	//--------------------------------------------------------------------------------------
@@ -21,9 +27,6 @@ namespace Core
 	{
 		Log::Print("Building sky system");
 
-		// Setup the tod system
-		void InitTOD();
-		
 		m_DomeSize = 128;
 		m_OpticalDepthSize = 256;
 		m_ScatteringTextureSize = 128;
@@ -119,41 +122,7 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Sky::SetConstants()
 	{
-		m_Constants.PI = D3DX_PI;
-		double ESun = 20.0;
-		double Kr = 0.0025;
-		double Km = 0.0010;
-		m_Constants.KrESun = Kr * ESun;
-		m_Constants.KmESun = Km * ESun;
-		m_Constants.Kr4PI = Kr * 4.0 * m_Constants.PI;
-		m_Constants.Km4PI = Km * 4.0 * m_Constants.PI;
-		m_Constants.InnerRadius = 6356.7523142;
-		m_Constants.OuterRadius = m_Constants.InnerRadius * 1.0157313; // karman line
-		m_Constants.fScale = 1.0 / (m_Constants.OuterRadius - m_Constants.InnerRadius);
-		m_Constants.v2dRayleighMieScaleHeight.x = 0.25; 
-		m_Constants.v2dRayleighMieScaleHeight.y = 0.1;
-
-		m_Constants.InvWavelength4.x = 1.0 / pow( 0.650, 4 );
-		m_Constants.InvWavelength4.y = 1.0 / pow( 0.570, 4 );
-		m_Constants.InvWavelength4.z = 1.0 / pow( 0.475, 4 );
-		m_Constants.WavelengthMie.x = pow( 0.650, -0.84 );
-		m_Constants.WavelengthMie.y = pow( 0.570, -0.84 );
-		m_Constants.WavelengthMie.z = pow( 0.475, -0.84 );
-
-		double g = -0.995;
-		double g2 = g * g;
-		m_Constants.v3HG.x = 1.5f * ( (1.0f - g2) / (2.0f + g2) );
-		m_Constants.v3HG.y = 1.0f + g2;
-		m_Constants.v3HG.z = 2.0f * g;
-
-		m_Constants.tNumSamples = 50;
-		m_Constants.iNumSamples = 20;
-
-		m_Constants.InvOpticalDepthN = 1.0 / float( m_OpticalDepthSize );
-		m_Constants.InvOpticalDepthNLessOne = 1.0 / float( m_OpticalDepthSize - 1 );
-		m_Constants.HalfTexelOpticalDepthN = 0.5 / float( m_OpticalDepthSize );
-		m_Constants.InvRayleighMieN = D3DXVECTOR2( 1.0f / float( m_ScatteringTextureSize ), 1.0f / float( m_ScatteringTextureSize / 2 ) );
-		m_Constants.InvRayleighMieNLessOne = D3DXVECTOR2( 1.0f / float( m_ScatteringTextureSize - 1 ), 1.0f / float( m_ScatteringTextureSize / 2 - 1) );
+		SetScatteringConstants(m_Constants, m_ScatteringTextureSize, m_OpticalDepthSize);
 
 		D3D10_BUFFER_DESC cbDesc;
 		cbDesc.ByteWidth = sizeof( ScbConstant );
@@ -173,31 +142,6 @@ namespace Core
 	}
 
 
-	//--------------------------------------------------------------------------------------
-	// Setup the tod system
-	//--------------------------------------------------------------------------------------
-	void Sky::InitTOD()
-	{
-		m_TOD.year          = m_Year;
-		m_TOD.month         = m_Month;
-		m_TOD.day           = m_Day;
-		m_TOD.hour          = m_Hour;
-		m_TOD.minute        = m_Minute;
-		m_TOD.second        = m_Second;
-		m_TOD.timezone      = -7.0;
-		m_TOD.delta_t       = 67;
-		m_TOD.longitude     = -105.1786;
-		m_TOD.latitude      = 0;
-		m_TOD.elevation     = 1830.14;
-		m_TOD.pressure      = 820;
-		m_TOD.temperature   = 11;
-		m_TOD.slope         = 30;
-		m_TOD.azm_rotation  = -10;
-		m_TOD.atmos_refract = 0.5667;
-		m_TOD.function      = SPA_ALL;
-	}
-
-
 	//--------------------------------------------------------------------------------------
 	// Free resources
 	//--------------------------------------------------------------------------------------
@@ -213,6 +157,8 @@ namespace Core
 		m_CloudDepth.Release();
 		SAFE_RELEASE(m_PerlinSamplerSRV);
 		SAFE_RELEASE(m_PerlinSampler);
+		m_SunPosition.Release();
+		m_SunPath.Release();
 	}
 
 
@@ -307,34 +253,30 @@ namespace Core
 
 	
 	//--------------------------------------------------------------------------------------
-	// Computes the sun direction from the spa data
+	// Computes the sun direction from the date, time and location.  Once the year's sun
+	// path is built this is a table lookup, until then the position is computed and the
+	// table is built in the background.
 	//--------------------------------------------------------------------------------------
 	void Sky::ComputeSunDirection()
 	{
-		/*const double d2r = 0.0174532925;
-		
-		// Get the sun data
-		InitTOD();
-		Log::Print("spa result %d", spa_calculate(&m_TOD));
-		Log::Print("zenith %f", m_TOD.zenith);
-		Log::Print("azimuth %f", m_TOD.azimuth);
-		Log::Print("incidience %f", m_TOD.incidence);
-		Log::Print("hours %d %d", m_TOD.hour, m_Hour);
-
-
-		// Convert the angles into a direction vector
-		D3DXMATRIX mRot, mRot2;
-		D3DXMatrixRotationX(&mRot, -((90.0f-m_TOD.zenith)*d2r));
-		D3DXMatrixRotationY(&mRot2, m_TOD.azimuth*d2r);
-		D3DXMatrixMultiply(&mRot, &mRot2, &mRot);
-		D3DXVec3TransformNormal(&m_SunDirection, &D3DXVECTOR3(0,0,1), &mRot);*/
+		bool tableMatches = m_SunPath.Matches(m_Year, m_Location, m_TimeZone);
+		if(!tableMatches || !m_SunPath.IsReady() || !m_SunPath.Lookup(m_Month, m_Day, m_Hour, m_Minute, m_Second, m_SunDirection))
+		{
+			double jd = SunPosition::JulianDay(m_Year, m_Month, m_Day, m_Hour, m_Minute, m_Second, m_TimeZone);
+			float zenith, azimuth;
+			m_SunPosition.Compute(jd, m_Location, zenith, azimuth);
 
-		// Convert the hours to the angle in the sphere
-		float deg = ((float)m_Hour / 24.0f) * (2*D3DX_PI);
-		D3DXMATRIX mRot;
-		D3DXMatrixRotationZ(&mRot, deg);
-		D3DXVec3TransformNormal(&m_SunDirection, &D3DXVECTOR3(1,0,0), &mRot);
+			// Convert the angles into a direction vector, x east, y up and z north
+			float elevation = D3DXToRadian(90.0f-zenith);
+			float heading = D3DXToRadian(azimuth);
+			m_SunDirection = D3DXVECTOR3(sinf(heading)*cosf(elevation), sinf(elevation), cosf(heading)*cosf(elevation));
 
+			if(!tableMatches && !m_SunPath.IsBuilding())
+			{
+				m_SunPath.Setup(m_Year, m_Location, m_TimeZone);
+				m_SunPath.BuildAsync(SKY_SUN_PATH_CACHE);
+			}
+		}
 
 		// Set it in the shader
 		m_pEffect->SunDirectionVariable->SetFloatVector((float*)&m_SunDirection);
@@ -349,14 +291,16 @@ namespace Core
 		// Set the sun direction
 		ComputeSunDirection();
 		
-		// Compute the scattering integrals into a texture
-		m_PrecomputedScattering.BindRenderTarget();
-		m_pEffect->OrthoProjectionVariable->SetMatrix( (float*)&m_PrecomputedScattering.GetOrthoMatrix() );
-		g_pd3dDevice->RSSetViewports(1, &m_PrecomputedScattering.GetViewport());
-		m_pEffect->Pass[PASS_COMPUTE_SCATTERING]->Apply(0);
-		g_pd3dDevice->Draw(6, 0);
-		Device::FrameStats.DrawCalls++;
-		Device::FrameStats.PolysDrawn += 2;
+		// Compute the scattering integrals into a texture.  The first tables come
+		// from the cache so startup skips the pass.
+		bool bBaked = false;
+		if(m_bLoadScattering)
+		{
+			m_bLoadScattering = false;
+			bBaked = BakeScattering(SKY_SCATTERING_CACHE);
+		}
+		if(!bBaked)
+			RenderScattering();
 
 		// Center the dome at the camera position
 		/*D3DXMATRIX mWorld;
@@ -374,6 +318,87 @@ namespace Core
 		//m_pDomeMesh->DrawSubset(0);
 	}
 
+	//--------------------------------------------------------------------------------------
+	// Runs the scattering pass into the textures
+	//--------------------------------------------------------------------------------------
+	void Sky::RenderScattering()
+	{
+		m_PrecomputedScattering.BindRenderTarget();
+		m_pEffect->OrthoProjectionVariable->SetMatrix( (float*)&m_PrecomputedScattering.GetOrthoMatrix() );
+		g_pd3dDevice->RSSetViewports(1, &m_PrecomputedScattering.GetViewport());
+		m_pEffect->Pass[PASS_COMPUTE_SCATTERING]->Apply(0);
+		g_pd3dDevice->Draw(6, 0);
+		Device::FrameStats.DrawCalls++;
+		Device::FrameStats.PolysDrawn += 2;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Fills the scattering textures on the CPU for the current sun, rounded to the cache
+	// step so the tables are the same whether they were loaded or baked
+	//--------------------------------------------------------------------------------------
+	bool Sky::BakeScattering(const char* szCache)
+	{
+		if(!m_PrecomputedScattering.Exists())
+			return false;
+
+		UINT width = m_ScatteringTextureSize;
+		UINT height = m_ScatteringTextureSize/2;
+		ScatteringBaker baker;
+		if(!szCache || !baker.Load(szCache, m_Constants, m_SunDirection, width, height))
+		{
+			Log::Print("Baking sky scattering");
+			baker.Bake(m_Constants, ScatteringBaker::GetCacheSun(m_SunDirection), width, height);
+			if(szCache)
+				baker.Save(szCache);
+		}
+
+		for(int i=0; i<SKY_TABLE_COUNT; i++)
+			g_pd3dDevice->UpdateSubresource(m_PrecomputedScattering.GetTex()[i], 0, NULL, baker.GetTable(i), width*4*sizeof(D3DXFLOAT16), 0);
+		baker.Release();
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reads a scattering table back through a staging texture
+	//--------------------------------------------------------------------------------------
+	bool Sky::ReadScattering(int table, float* pTexels)
+	{
+		if(!m_PrecomputedScattering.Exists() || table<0 || table>=SKY_TABLE_COUNT)
+			return false;
+
+		D3D10_TEXTURE2D_DESC td;
+		m_PrecomputedScattering.GetTex()[table]->GetDesc(&td);
+		td.BindFlags = 0;
+		td.MiscFlags = 0;
+		td.MipLevels = 1;
+		td.ArraySize = 1;
+		td.CPUAccessFlags = D3D10_CPU_ACCESS_READ;
+		td.Usage = D3D10_USAGE_STAGING;
+		ID3D10Texture2D* pStage = NULL;
+		if(FAILED(g_pd3dDevice->CreateTexture2D(&td, NULL, &pStage)))
+		{
+			Log::Print("Sky::ReadScattering() failed to create the staging texture");
+			return false;
+		}
+		g_pd3dDevice->CopySubresourceRegion(pStage, 0, 0, 0, 0, m_PrecomputedScattering.GetTex()[table], 0, NULL);
+
+		UINT width = m_ScatteringTextureSize;
+		UINT height = m_ScatteringTextureSize/2;
+		D3D10_MAPPED_TEXTURE2D mappedTexture;
+		bool ok = SUCCEEDED(pStage->Map(0, D3D10_MAP_READ, 0, &mappedTexture));
+		if(ok)
+		{
+			for(UINT y=0; y<height; y++)
+				D3DXFloat16To32Array(pTexels + y*width*4, (const D3DXFLOAT16*)((BYTE*)mappedTexture.pData + y*mappedTexture.RowPitch), width*4);
+			pStage->Unmap(0);
+		}
+		SAFE_RELEASE(pStage);
+		return ok;
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Draw the sky
 	//--------------------------------------------------------------------------------------
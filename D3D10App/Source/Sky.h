@@ -13,7 +13,8 @@
 #include "stdafx.h"
 #include "Effect.h"
 #include "RenderSurface.h"
-#include "spa/spa.h"
+#include "SunPath.h"
+#include "SkyScattering.h"
 
 namespace Core
 {
@@ -30,6 +31,11 @@ namespace Core
 			m_PerlinSamplerSRV = NULL;
 			m_ConstantBuffer = NULL;
 			m_PlaneBuffer = NULL;
+			m_bLoadScattering = true;
+
+			// Golden, Colorado
+			m_Location = SunLocation(39.742476, -105.1786, 1830.14, 820, 11);
+			m_TimeZone = -7;
 		}
 		
 		// Creates the sky system
@@ -44,6 +50,15 @@ namespace Core
 		// Build the scattering textures
 		void ComputeScattering(D3DXVECTOR3& pos);
 
+		// Fills the scattering textures on the CPU for the current sun rounded to the
+		// cache step, from the cache file if it has them, otherwise baking them and
+		// saving the file
+		bool BakeScattering(const char* szCache=NULL);
+
+		// Reads a scattering table back from the GPU as floats, GetScatteringSize() by
+		// half that texels of four channels, to check the pass against the baker
+		bool ReadScattering(int table, float* pTexels);
+
 		// Binds the effect variables when the effect is reloaded
 		void BindEffectVariables(Effect* pEffect);
 
@@ -61,11 +76,16 @@ namespace Core
 			m_Second = second;
 		}
 		
-		// Set the location on earth
-		inline void SetViewerLocation(int latitude, int longitude, int elevation){
-			m_TOD.latitude = latitude;
-			m_TOD.longitude = longitude;
-			m_TOD.elevation = elevation;
+		// Set the location on earth, in degrees and meters
+		inline void SetViewerLocation(double latitude, double longitude, double elevation){
+			m_Location.Latitude = latitude;
+			m_Location.Longitude = longitude;
+			m_Location.Elevation = elevation;
+		}
+
+		// Set the time zone, in hours from UTC and negative west of Greenwich
+		inline void SetTimeZone(double timezone){
+			m_TimeZone = timezone;
 		}
 
 
@@ -74,33 +94,22 @@ namespace Core
 			return -m_SunDirection;
 		}
 
+		// Size and constants of the scattering tables
+		inline UINT GetScatteringSize(){
+			return m_ScatteringTextureSize;
+		}
+		inline const ScbConstant& GetScatteringConstants(){
+			return m_Constants;
+		}
 
+		// The year's sun path, sunrise and sunset times once it is ready
+		inline const SunPathTable& GetSunPath(){
+			return m_SunPath;
+		}
 
-	private:
 
-		// Constants needed for rendering
-		struct ScbConstant
-		{
-			float PI;
-			float InnerRadius;
-			float OuterRadius;
-			float fScale;
-			float KrESun;
-			float KmESun;
-			float Kr4PI;
-			float Km4PI;
-			int tNumSamples;
-			int iNumSamples;
-			D3DXVECTOR2 v2dRayleighMieScaleHeight;
-			D3DXVECTOR3 WavelengthMie;
-			float InvOpticalDepthN;
-			D3DXVECTOR3 v3HG;
-			float InvOpticalDepthNLessOne;
-			D3DXVECTOR2 InvRayleighMieN;
-			D3DXVECTOR2 InvRayleighMieNLessOne;
-			float HalfTexelOpticalDepthN;
-			D3DXVECTOR3 InvWavelength4;
-		};
+
+	private:
 
 		ID3DX10Mesh*		m_pDomeMesh;				// The skydome mesh
 		Effect*				m_pEffect;					// Parent effect
@@ -128,8 +137,12 @@ namespace Core
 		int					m_Minute;
 		int					m_Second;
 
-		spa_data			m_TOD;						// Time of day and sun angle data
+		SunPosition			m_SunPosition;				// Solar position with the ephemeris cached by day
+		SunPathTable		m_SunPath;					// The year at this location, for scrubbing the time
+		SunLocation			m_Location;					// Where the viewer is on earth
+		double				m_TimeZone;
 		D3DXVECTOR3			m_SunDirection;				// Direction of the sun in the sky
+		bool				m_bLoadScattering;			// The first tables come from the cache
 
 		// Generates the perlin noise sampler
 		void GeneratePerlinSampler();
@@ -140,10 +153,10 @@ namespace Core
 		// Sets up the constants
 		void SetConstants();
 
-		// Computes the sun direction from the spa data
+		// Computes the sun direction from the date, time and location
 		void ComputeSunDirection();
 
-		// Setup the tod system
-		void InitTOD();
+		// Runs the scattering pass into the textures
+		void RenderScattering();
 	};
 }
@@ -0,0 +1,549 @@
+//--------------------------------------------------------------------------------------
+// File: SkyScattering.cpp
+//
+// CPU version of the sky's scattering pass
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "SkyScattering.h"
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Fills the constants the sky uses
+	//--------------------------------------------------------------------------------------
+	void SetScatteringConstants(ScbConstant& c, UINT scatteringSize, UINT opticalDepthSize)
+	{
+		c.PI = D3DX_PI;
+		double ESun = 20.0;
+		double Kr = 0.0025;
+		double Km = 0.0010;
+		c.KrESun = Kr * ESun;
+		c.KmESun = Km * ESun;
+		c.Kr4PI = Kr * 4.0 * c.PI;
+		c.Km4PI = Km * 4.0 * c.PI;
+		c.InnerRadius = 6356.7523142;
+		c.OuterRadius = c.InnerRadius * 1.0157313; // karman line
+		c.fScale = 1.0 / (c.OuterRadius - c.InnerRadius);
+		c.v2dRayleighMieScaleHeight.x = 0.25;
+		c.v2dRayleighMieScaleHeight.y = 0.1;
+
+		c.InvWavelength4.x = 1.0 / pow( 0.650, 4 );
+		c.InvWavelength4.y = 1.0 / pow( 0.570, 4 );
+		c.InvWavelength4.z = 1.0 / pow( 0.475, 4 );
+		c.WavelengthMie.x = pow( 0.650, -0.84 );
+		c.WavelengthMie.y = pow( 0.570, -0.84 );
+		c.WavelengthMie.z = pow( 0.475, -0.84 );
+
+		double g = -0.995;
+		double g2 = g * g;
+		c.v3HG.x = 1.5f * ( (1.0f - g2) / (2.0f + g2) );
+		c.v3HG.y = 1.0f + g2;
+		c.v3HG.z = 2.0f * g;
+
+		c.tNumSamples = 50;
+		c.iNumSamples = 20;
+
+		c.InvOpticalDepthN = 1.0 / float( opticalDepthSize );
+		c.InvOpticalDepthNLessOne = 1.0 / float( opticalDepthSize - 1 );
+		c.HalfTexelOpticalDepthN = 0.5 / float( opticalDepthSize );
+		c.InvRayleighMieN = D3DXVECTOR2( 1.0f / float( scatteringSize ), 1.0f / float( scatteringSize / 2 ) );
+		c.InvRayleighMieNLessOne = D3DXVECTOR2( 1.0f / float( scatteringSize - 1 ), 1.0f / float( scatteringSize / 2 - 1) );
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// View direction of a texel.  Both angles come from Tex0.x in the shader, so the
+	// row does not matter.
+	//--------------------------------------------------------------------------------------
+	static inline D3DXVECTOR3 TexelDirection(const ScbConstant& c, UINT x)
+	{
+		float u = (x + 0.5f) * c.InvRayleighMieN.x;
+		float angleY = 100.0f * u * c.PI / 180.0f;
+		float angleXZ = c.PI * u;
+		D3DXVECTOR3 dir(sinf(angleY)*cosf(angleXZ), cosf(angleY), sinf(angleY)*sinf(angleXZ));
+		D3DXVec3Normalize(&dir, &dir);
+		return dir;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Scalar versions of the shader functions
+	//--------------------------------------------------------------------------------------
+	static inline float HitOuterSphere(const ScbConstant& c, const D3DXVECTOR3& O, const D3DXVECTOR3& dir)
+	{
+		float B = -(O.x*dir.x + O.y*dir.y + O.z*dir.z);
+		float C = O.x*O.x + O.y*O.y + O.z*O.z;
+		float D = C - B*B;
+		return B + sqrtf(c.OuterRadius*c.OuterRadius - D);
+	}
+
+	static inline void DensityRatio(const ScbConstant& c, float height, float& rayleigh, float& mie)
+	{
+		float altitude = (height - c.InnerRadius) * c.fScale;
+		rayleigh = expf(-altitude / c.v2dRayleighMieScaleHeight.x);
+		mie = expf(-altitude / c.v2dRayleighMieScaleHeight.y);
+	}
+
+	static void OpticalDepth(const ScbConstant& c, D3DXVECTOR3 P, const D3DXVECTOR3& Px, float& rayleigh, float& mie)
+	{
+		D3DXVECTOR3 v = Px - P;
+		float far = D3DXVec3Length(&v);
+		D3DXVECTOR3 dir = v / far;
+		float sampleLength = far / c.tNumSamples;
+		float scaledLength = sampleLength * c.fScale;
+		D3DXVECTOR3 ray = dir * sampleLength;
+		P += ray * 0.5f;
+
+		rayleigh = mie = 0;
+		for(int i=0; i<c.tNumSamples; i++)
+		{
+			float r, m;
+			DensityRatio(c, D3DXVec3Length(&P), r, m);
+			rayleigh += r;
+			mie += m;
+			P += ray;
+		}
+		rayleigh *= scaledLength;
+		mie *= scaledLength;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// PS_ComputeScattering for one texel
+	//--------------------------------------------------------------------------------------
+	void ScatteringBaker::ComputeTexel(const ScbConstant& c, const D3DXVECTOR3& sunDir, UINT x, UINT y, D3DXVECTOR3& rayleigh, D3DXVECTOR3& mie)
+	{
+		const D3DXVECTOR3 Pv(0, c.InnerRadius, 0);
+		D3DXVECTOR3 dir = TexelDirection(c, x);
+
+		float far = HitOuterSphere(c, Pv, dir);
+		float sampleLength = far / c.iNumSamples;
+		float scaledLength = sampleLength * c.fScale;
+		D3DXVECTOR3 ray = dir * sampleLength;
+		D3DXVECTOR3 P = Pv + ray * 0.5f;
+
+		D3DXVECTOR3 rayleighSum(0, 0, 0), mieSum(0, 0, 0);
+		for(int k=0; k<c.iNumSamples; k++)
+		{
+			float densityR, densityM;
+			DensityRatio(c, D3DXVec3Length(&P), densityR, densityM);
+			densityR *= scaledLength;
+			densityM *= scaledLength;
+
+			float viewerR, viewerM, sunR, sunM;
+			OpticalDepth(c, P, Pv, viewerR, viewerM);
+			OpticalDepth(c, P, P + sunDir * HitOuterSphere(c, P, sunDir), sunR, sunM);
+
+			float depthR = sunR + viewerR;
+			float depthM = sunM + viewerM;
+			D3DXVECTOR3 attenuation(
+				expf(-c.Kr4PI * c.InvWavelength4.x * depthR - c.Km4PI * depthM),
+				expf(-c.Kr4PI * c.InvWavelength4.y * depthR - c.Km4PI * depthM),
+				expf(-c.Kr4PI * c.InvWavelength4.z * depthR - c.Km4PI * depthM));
+
+			rayleighSum += attenuation * densityR;
+			mieSum += attenuation * densityM;
+			P += ray;
+		}
+
+		rayleigh = D3DXVECTOR3(rayleighSum.x * c.KrESun * c.InvWavelength4.x, rayleighSum.y * c.KrESun * c.InvWavelength4.y, rayleighSum.z * c.KrESun * c.InvWavelength4.z);
+		mie = D3DXVECTOR3(mieSum.x * c.KmESun * c.WavelengthMie.x, mieSum.y * c.KmESun * c.WavelengthMie.y, mieSum.z * c.KmESun * c.WavelengthMie.z);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// e^x for four values, good to about 2e-7 relative.  Splits off a power of two and
+	// uses the Cephes polynomial for the rest.
+	//--------------------------------------------------------------------------------------
+	static const float EXP_C1 = 0.693359375f;
+	static const float EXP_C2 = -2.12194440e-4f;
+	static const float EXP_P0 = 1.9875691500e-4f;
+	static const float EXP_P1 = 1.3981999507e-3f;
+	static const float EXP_P2 = 8.3334519073e-3f;
+	static const float EXP_P3 = 4.1665795894e-2f;
+	static const float EXP_P4 = 1.6666665459e-1f;
+	static const float EXP_P5 = 5.0000001201e-1f;
+
+	static inline __m128 ExpPS(__m128 x)
+	{
+		const __m128 vOne = _mm_set1_ps(1.0f);
+		x = _mm_min_ps(x, _mm_set1_ps(88.0f));
+		x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+
+		// n = floor(x/ln2 + 0.5)
+		__m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+		__m128 n = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+		n = _mm_sub_ps(n, _mm_and_ps(_mm_cmpgt_ps(n, fx), vOne));
+		x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(EXP_C1)));
+		x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(EXP_C2)));
+
+		__m128 z = _mm_mul_ps(x, x);
+		__m128 y = _mm_set1_ps(EXP_P0);
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P1));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P2));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P3));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P4));
+		y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P5));
+		y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, z), x), vOne);
+
+		// Scale by 2^n through the exponent bits
+		__m128i pow2n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n), _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(y, _mm_castsi128_ps(pow2n));
+	}
+
+
+	// Four points or directions, one per lane
+	struct Vec3PS
+	{
+		__m128 x, y, z;
+	};
+
+	static inline __m128 LengthPS(const Vec3PS& v)
+	{
+		return _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(v.x, v.x), _mm_mul_ps(v.y, v.y)), _mm_mul_ps(v.z, v.z)));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// The optical depth integral t() for four rays at once
+	//--------------------------------------------------------------------------------------
+	struct ScatteringPS
+	{
+		__m128	InnerRadius;
+		__m128	OuterRadius2;
+		__m128	fScale;
+		__m128	InvTNumSamples;
+		__m128	RayleighFalloff;	// -fScale/height, the exponent per unit of height
+		__m128	MieFalloff;
+		__m128	RayleighAbsorb[3];	// -Kr4PI*InvWavelength4
+		__m128	MieAbsorb;			// -Km4PI
+		int		tNumSamples;
+	};
+
+	static inline void OpticalDepthPS(const ScatteringPS& c, Vec3PS P, const Vec3PS& Px, __m128& rayleigh, __m128& mie)
+	{
+		const __m128 vHalf = _mm_set1_ps(0.5f);
+		Vec3PS v;
+		v.x = _mm_sub_ps(Px.x, P.x);
+		v.y = _mm_sub_ps(Px.y, P.y);
+		v.z = _mm_sub_ps(Px.z, P.z);
+		__m128 far = LengthPS(v);
+		__m128 sampleLength = _mm_mul_ps(far, c.InvTNumSamples);
+		__m128 scaledLength = _mm_mul_ps(sampleLength, c.fScale);
+		__m128 step = _mm_div_ps(sampleLength, far);
+		Vec3PS ray;
+		ray.x = _mm_mul_ps(v.x, step);
+		ray.y = _mm_mul_ps(v.y, step);
+		ray.z = _mm_mul_ps(v.z, step);
+		P.x = _mm_add_ps(P.x, _mm_mul_ps(ray.x, vHalf));
+		P.y = _mm_add_ps(P.y, _mm_mul_ps(ray.y, vHalf));
+		P.z = _mm_add_ps(P.z, _mm_mul_ps(ray.z, vHalf));
+
+		rayleigh = mie = _mm_setzero_ps();
+		for(int i=0; i<c.tNumSamples; i++)
+		{
+			__m128 height = _mm_sub_ps(LengthPS(P), c.InnerRadius);
+			rayleigh = _mm_add_ps(rayleigh, ExpPS(_mm_mul_ps(height, c.RayleighFalloff)));
+			mie = _mm_add_ps(mie, ExpPS(_mm_mul_ps(height, c.MieFalloff)));
+			P.x = _mm_add_ps(P.x, ray.x);
+			P.y = _mm_add_ps(P.y, ray.y);
+			P.z = _mm_add_ps(P.z, ray.z);
+		}
+		rayleigh = _mm_mul_ps(rayleigh, scaledLength);
+		mie = _mm_mul_ps(mie, scaledLength);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Bake job, each item is four columns of the first row.  The output rows are RGBA
+	// floats, the Rayleigh row then the Mie row.
+	//--------------------------------------------------------------------------------------
+	struct ScatteringJobData
+	{
+		const ScbConstant*	pConstants;
+		ScatteringPS		Constants;
+		D3DXVECTOR3			SunDir;
+		UINT				Width;
+		float*				pRows[SKY_TABLE_COUNT];
+	};
+
+	static void ScatteringJob(int start, int end, void* pData)
+	{
+		const ScatteringJobData& job = *(const ScatteringJobData*)pData;
+		const ScbConstant& c = *job.pConstants;
+		const ScatteringPS& cps = job.Constants;
+		const __m128 vHalf = _mm_set1_ps(0.5f);
+		const __m128 vInnerRadius = _mm_set1_ps(c.InnerRadius);
+		const __m128 vSunX = _mm_set1_ps(job.SunDir.x);
+		const __m128 vSunY = _mm_set1_ps(job.SunDir.y);
+		const __m128 vSunZ = _mm_set1_ps(job.SunDir.z);
+
+		for(int item=start; item<end; item++)
+		{
+			// Directions and view ray lengths, past the edge the last column repeats
+			UINT first = item*4;
+			__declspec(align(16)) float dir[3][4], far[4];
+			for(int j=0; j<4; j++)
+			{
+				const D3DXVECTOR3 Pv(0, c.InnerRadius, 0);
+				D3DXVECTOR3 d = TexelDirection(c, min(first+j, job.Width-1));
+				dir[0][j] = d.x;
+				dir[1][j] = d.y;
+				dir[2][j] = d.z;
+				far[j] = HitOuterSphere(c, Pv, d);
+			}
+
+			Vec3PS Pv;
+			Pv.x = Pv.z = _mm_setzero_ps();
+			Pv.y = vInnerRadius;
+			__m128 sampleLength = _mm_div_ps(_mm_load_ps(far), _mm_set1_ps((float)c.iNumSamples));
+			__m128 scaledLength = _mm_mul_ps(sampleLength, cps.fScale);
+			Vec3PS ray, P;
+			ray.x = _mm_mul_ps(_mm_load_ps(dir[0]), sampleLength);
+			ray.y = _mm_mul_ps(_mm_load_ps(dir[1]), sampleLength);
+			ray.z = _mm_mul_ps(_mm_load_ps(dir[2]), sampleLength);
+			P.x = _mm_mul_ps(ray.x, vHalf);
+			P.y = _mm_add_ps(Pv.y, _mm_mul_ps(ray.y, vHalf));
+			P.z = _mm_mul_ps(ray.z, vHalf);
+
+			__m128 rayleighSum[3], mieSum[3];
+			for(int i=0; i<3; i++)
+				rayleighSum[i] = mieSum[i] = _mm_setzero_ps();
+
+			for(int k=0; k<c.iNumSamples; k++)
+			{
+				__m128 height = _mm_sub_ps(LengthPS(P), vInnerRadius);
+				__m128 densityR = _mm_mul_ps(ExpPS(_mm_mul_ps(height, cps.RayleighFalloff)), scaledLength);
+				__m128 densityM = _mm_mul_ps(ExpPS(_mm_mul_ps(height, cps.MieFalloff)), scaledLength);
+
+				__m128 viewerR, viewerM, sunR, sunM;
+				OpticalDepthPS(cps, P, Pv, viewerR, viewerM);
+
+				// Out to the atmosphere toward the sun
+				__m128 B = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(P.x, vSunX), _mm_mul_ps(P.y, vSunY)), _mm_mul_ps(P.z, vSunZ)));
+				__m128 D = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(P.x, P.x), _mm_mul_ps(P.y, P.y)), _mm_mul_ps(P.z, P.z)), _mm_mul_ps(B, B));
+				__m128 sunFar = _mm_add_ps(B, _mm_sqrt_ps(_mm_sub_ps(cps.OuterRadius2, D)));
+				Vec3PS Pc;
+				Pc.x = _mm_add_ps(P.x, _mm_mul_ps(vSunX, sunFar));
+				Pc.y = _mm_add_ps(P.y, _mm_mul_ps(vSunY, sunFar));
+				Pc.z = _mm_add_ps(P.z, _mm_mul_ps(vSunZ, sunFar));
+				OpticalDepthPS(cps, P, Pc, sunR, sunM);
+
+				__m128 depthR = _mm_add_ps(sunR, viewerR);
+				__m128 depthM = _mm_mul_ps(cps.MieAbsorb, _mm_add_ps(sunM, viewerM));
+				for(int i=0; i<3; i++)
+				{
+					__m128 attenuation = ExpPS(_mm_add_ps(_mm_mul_ps(cps.RayleighAbsorb[i], depthR), depthM));
+					rayleighSum[i] = _mm_add_ps(rayleighSum[i], _mm_mul_ps(densityR, attenuation));
+					mieSum[i] = _mm_add_ps(mieSum[i], _mm_mul_ps(densityM, attenuation));
+				}
+
+				P.x = _mm_add_ps(P.x, ray.x);
+				P.y = _mm_add_ps(P.y, ray.y);
+				P.z = _mm_add_ps(P.z, ray.z);
+			}
+
+			// Scale and write out as RGBA
+			const float rayleighScale[3] = { c.KrESun*c.InvWavelength4.x, c.KrESun*c.InvWavelength4.y, c.KrESun*c.InvWavelength4.z };
+			const float mieScale[3] = { c.KmESun*c.WavelengthMie.x, c.KmESun*c.WavelengthMie.y, c.KmESun*c.WavelengthMie.z };
+			__declspec(align(16)) float rayleigh[3][4], mie[3][4];
+			for(int i=0; i<3; i++)
+			{
+				_mm_store_ps(rayleigh[i], _mm_mul_ps(rayleighSum[i], _mm_set1_ps(rayleighScale[i])));
+				_mm_store_ps(mie[i], _mm_mul_ps(mieSum[i], _mm_set1_ps(mieScale[i])));
+			}
+			for(UINT j=0; j<4 && first+j<job.Width; j++)
+			{
+				float* pRayleigh = job.pRows[SKY_TABLE_RAYLEIGH] + (first+j)*4;
+				float* pMie = job.pRows[SKY_TABLE_MIE] + (first+j)*4;
+				for(int i=0; i<3; i++)
+				{
+					pRayleigh[i] = rayleigh[i][j];
+					pMie[i] = mie[i][j];
+				}
+				pRayleigh[3] = pMie[3] = 1.0f;
+			}
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ScatteringBaker::ScatteringBaker()
+	{
+		ZeroMemory(&m_Desc, sizeof(SkyTableDesc));
+		for(int i=0; i<SKY_TABLE_COUNT; i++)
+			m_pTables[i] = NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Free resources
+	//--------------------------------------------------------------------------------------
+	void ScatteringBaker::Release()
+	{
+		for(int i=0; i<SKY_TABLE_COUNT; i++)
+			SAFE_DELETE_ARRAY(m_pTables[i]);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Allocates the tables for the size in the desc
+	//--------------------------------------------------------------------------------------
+	void ScatteringBaker::Allocate()
+	{
+		Release();
+		for(int i=0; i<SKY_TABLE_COUNT; i++)
+			m_pTables[i] = new D3DXFLOAT16[m_Desc.Width*m_Desc.Height*4];
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Bakes both tables for a sun direction
+	//--------------------------------------------------------------------------------------
+	void ScatteringBaker::Bake(const ScbConstant& constants, const D3DXVECTOR3& sunDir, UINT width, UINT height)
+	{
+		m_Desc.Width = width;
+		m_Desc.Height = height;
+		m_Desc.Constants = constants;
+		m_Desc.SunDir = sunDir;
+		Allocate();
+
+		ScatteringJobData job;
+		job.pConstants = &constants;
+		job.SunDir = sunDir;
+		job.Width = width;
+		job.Constants.InnerRadius = _mm_set1_ps(constants.InnerRadius);
+		job.Constants.OuterRadius2 = _mm_set1_ps(constants.OuterRadius*constants.OuterRadius);
+		job.Constants.fScale = _mm_set1_ps(constants.fScale);
+		job.Constants.InvTNumSamples = _mm_set1_ps(1.0f/constants.tNumSamples);
+		job.Constants.RayleighFalloff = _mm_set1_ps(-constants.fScale/constants.v2dRayleighMieScaleHeight.x);
+		job.Constants.MieFalloff = _mm_set1_ps(-constants.fScale/constants.v2dRayleighMieScaleHeight.y);
+		job.Constants.RayleighAbsorb[0] = _mm_set1_ps(-constants.Kr4PI*constants.InvWavelength4.x);
+		job.Constants.RayleighAbsorb[1] = _mm_set1_ps(-constants.Kr4PI*constants.InvWavelength4.y);
+		job.Constants.RayleighAbsorb[2] = _mm_set1_ps(-constants.Kr4PI*constants.InvWavelength4.z);
+		job.Constants.MieAbsorb = _mm_set1_ps(-constants.Km4PI);
+		job.Constants.tNumSamples = constants.tNumSamples;
+		float* pRows = new float[width*4*SKY_TABLE_COUNT];
+		for(int i=0; i<SKY_TABLE_COUNT; i++)
+			job.pRows[i] = pRows + i*width*4;
+		g_ThreadPool.ParallelFor((width+3)/4, ScatteringJob, &job, 1);
+
+		// To half floats, then copy the first row down
+		for(int i=0; i<SKY_TABLE_COUNT; i++)
+		{
+			D3DXFloat32To16Array(m_pTables[i], job.pRows[i], width*4);
+			for(UINT y=1; y<height; y++)
+				memcpy(m_pTables[i] + y*width*4, m_pTables[i], width*4*sizeof(D3DXFLOAT16));
+		}
+		delete[] pRows;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Cache keys, the sun's elevation and heading in whole steps.  The heading means
+	// nothing with the sun straight up or down, so it is 0 there.
+	//--------------------------------------------------------------------------------------
+	void ScatteringBaker::GetCacheKey(const D3DXVECTOR3& sunDir, int& elevation, int& heading)
+	{
+		const int stepsAround = (int)(360.0f/SKY_CACHE_SUN_STEP + 0.5f);
+		D3DXVECTOR3 dir;
+		D3DXVec3Normalize(&dir, &sunDir);
+		float sinElevation = max(-1.0f, min(1.0f, dir.y));
+		elevation = (int)floorf(D3DXToDegree(asinf(sinElevation))/SKY_CACHE_SUN_STEP + 0.5f);
+		if(abs(elevation)*SKY_CACHE_SUN_STEP >= 90.0f)
+		{
+			heading = 0;
+			return;
+		}
+		heading = (int)floorf(D3DXToDegree(atan2f(dir.x, dir.z))/SKY_CACHE_SUN_STEP + 0.5f);
+		heading = (heading%stepsAround + stepsAround) % stepsAround;
+	}
+
+	D3DXVECTOR3 ScatteringBaker::GetCacheSun(int elevation, int heading)
+	{
+		float e = D3DXToRadian(elevation*SKY_CACHE_SUN_STEP);
+		float h = D3DXToRadian(heading*SKY_CACHE_SUN_STEP);
+		return D3DXVECTOR3(sinf(h)*cosf(e), sinf(e), cosf(h)*cosf(e));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Writes the tables and what they were baked with
+	//--------------------------------------------------------------------------------------
+	bool ScatteringBaker::Save(const char* szFile)
+	{
+		if(!IsBaked())
+			return false;
+		SkyCacheHeader h;
+		ZeroMemory(&h, sizeof(SkyCacheHeader));
+		h.Magic = SKY_CACHE_MAGIC;
+		h.Version = SKY_CACHE_VERSION;
+		h.Width = m_Desc.Width;
+		h.Height = m_Desc.Height;
+		h.Constants = m_Desc.Constants;
+		GetCacheKey(m_Desc.SunDir, h.SunElevation, h.SunHeading);
+
+		FILE* fp = fopen(szFile, "wb");
+		if(!fp)
+		{
+			Log::Print("Unable to write sky cache %s", szFile);
+			return false;
+		}
+		size_t count = m_Desc.Width*m_Desc.Height*4;
+		bool ok = fwrite(&h, sizeof(SkyCacheHeader), 1, fp)==1;
+		for(int i=0; i<SKY_TABLE_COUNT && ok; i++)
+			ok = fwrite(m_pTables[i], sizeof(D3DXFLOAT16), count, fp)==count;
+		fclose(fp);
+		if(!ok)
+			Log::Print("Unable to write sky cache %s", szFile);
+		return ok;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Loads tables if they were baked with the same constants and size, for a sun in the
+	// same step.  The desc gets the step's sun.
+	//--------------------------------------------------------------------------------------
+	bool ScatteringBaker::Load(const char* szFile, const ScbConstant& constants, const D3DXVECTOR3& sunDir, UINT width, UINT height)
+	{
+		FILE* fp = fopen(szFile, "rb");
+		if(!fp)
+			return false;
+
+		int elevation, heading;
+		GetCacheKey(sunDir, elevation, heading);
+		SkyCacheHeader h;
+		bool ok = fread(&h, sizeof(SkyCacheHeader), 1, fp)==1 &&
+			h.Magic==SKY_CACHE_MAGIC && h.Version==SKY_CACHE_VERSION && h.Width==width && h.Height==height &&
+			memcmp(&h.Constants, &constants, sizeof(ScbConstant))==0 && h.SunElevation==elevation && h.SunHeading==heading;
+		if(ok)
+		{
+			m_Desc.Width = width;
+			m_Desc.Height = height;
+			m_Desc.Constants = constants;
+			m_Desc.SunDir = GetCacheSun(elevation, heading);
+			Allocate();
+			size_t count = width*height*4;
+			for(int i=0; i<SKY_TABLE_COUNT && ok; i++)
+				ok = fread(m_pTables[i], sizeof(D3DXFLOAT16), count, fp)==count;
+			if(!ok)
+			{
+				Log::Print("Sky cache %s is truncated", szFile);
+				Release();
+			}
+		}
+		fclose(fp);
+		return ok;
+	}
+
+}
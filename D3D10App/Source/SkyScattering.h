@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+// File: SkyScattering.h
+//
+// CPU version of the sky's scattering pass.  The same integral as PS_ComputeScattering
+// in Atmosphere.fxh with the same constants, evaluated for four texels at a time with
+// SSE on the thread pool.  Baked tables can be saved and loaded, so the sky can start
+// from a file, and the GPU pass can be checked against the CPU without a window.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "stdafx.h"
+
+namespace Core
+{
+
+#define SKY_CACHE_MAGIC		0x32534B53	// "SKS2"
+#define SKY_CACHE_VERSION	2
+#define SKY_CACHE_SUN_STEP	0.25f		// Degrees between the suns the cache keeps tables for
+
+	// Constants needed for rendering, laid out like cbSky
+	struct ScbConstant
+	{
+		float PI;
+		float InnerRadius;
+		float OuterRadius;
+		float fScale;
+		float KrESun;
+		float KmESun;
+		float Kr4PI;
+		float Km4PI;
+		int tNumSamples;
+		int iNumSamples;
+		D3DXVECTOR2 v2dRayleighMieScaleHeight;
+		D3DXVECTOR3 WavelengthMie;
+		float InvOpticalDepthN;
+		D3DXVECTOR3 v3HG;
+		float InvOpticalDepthNLessOne;
+		D3DXVECTOR2 InvRayleighMieN;
+		D3DXVECTOR2 InvRayleighMieNLessOne;
+		float HalfTexelOpticalDepthN;
+		D3DXVECTOR3 InvWavelength4;
+	};
+
+	// Fills the constants the sky uses for a scattering texture of size x size/2
+	void SetScatteringConstants(ScbConstant& c, UINT scatteringSize, UINT opticalDepthSize);
+
+
+	// The two tables, in the order of g_txScattering
+	enum SKY_TABLE
+	{
+		SKY_TABLE_RAYLEIGH=0,
+		SKY_TABLE_MIE,
+
+		SKY_TABLE_COUNT,
+	};
+
+	// What a table was baked with
+	struct SkyTableDesc
+	{
+		UINT		Width;
+		UINT		Height;
+		ScbConstant	Constants;
+		D3DXVECTOR3	SunDir;
+	};
+
+	// Start of a cache file.  The tables are found by their constants, their size and
+	// the sun rounded to SKY_CACHE_SUN_STEP, so any sun in the same step loads them.
+	struct SkyCacheHeader
+	{
+		DWORD		Magic;
+		DWORD		Version;
+		UINT		Width;
+		UINT		Height;
+		ScbConstant	Constants;
+		int			SunElevation;	// Steps above the horizon
+		int			SunHeading;		// Steps around from +z toward +x, 0 with the sun straight up or down
+	};
+
+
+	class ScatteringBaker
+	{
+	public:
+		ScatteringBaker();
+		~ScatteringBaker(){ Release(); }
+
+		void Release();
+
+		// Bakes both tables for a sun direction on the thread pool.  The shader takes
+		// both view angles from the texel's column, so each column is integrated once
+		// and copied down.
+		void Bake(const ScbConstant& constants, const D3DXVECTOR3& sunDir, UINT width, UINT height);
+
+		// Cache files.  Save keys the tables by the sun they were baked for, so tables meant
+		// for the cache are baked for GetCacheSun().  Load fails unless the file was baked
+		// with the same constants and size and the sun rounds to the same step.
+		bool Save(const char* szFile);
+		bool Load(const char* szFile, const ScbConstant& constants, const D3DXVECTOR3& sunDir, UINT width, UINT height);
+
+		// Rounds a sun direction to the cache steps, and gives the direction of a step
+		static void GetCacheKey(const D3DXVECTOR3& sunDir, int& elevation, int& heading);
+		static D3DXVECTOR3 GetCacheSun(int elevation, int heading);
+		static inline D3DXVECTOR3 GetCacheSun(const D3DXVECTOR3& sunDir){
+			int elevation, heading;
+			GetCacheKey(sunDir, elevation, heading);
+			return GetCacheSun(elevation, heading);
+		}
+
+		// The shader for one texel in plain floats, the reference for the SSE path.
+		// The sun direction is g_SunDir, toward the sun.
+		static void ComputeTexel(const ScbConstant& c, const D3DXVECTOR3& sunDir, UINT x, UINT y, D3DXVECTOR3& rayleigh, D3DXVECTOR3& mie);
+
+		// R16G16B16A16_FLOAT texels of a table, rows are Width*8 bytes
+		inline const D3DXFLOAT16* GetTable(int table){ return m_pTables[table]; }
+
+		// Properties
+		inline bool IsBaked(){ return m_pTables[0]!=NULL; }
+		inline UINT GetWidth(){ return m_Desc.Width; }
+		inline UINT GetHeight(){ return m_Desc.Height; }
+		inline int GetMemoryUsage(){ return IsBaked() ? m_Desc.Width*m_Desc.Height*4*sizeof(D3DXFLOAT16)*SKY_TABLE_COUNT : 0; }
+
+	private:
+
+		// Allocates the tables for the size in the desc
+		void Allocate();
+
+		SkyTableDesc	m_Desc;
+		D3DXFLOAT16*	m_pTables[SKY_TABLE_COUNT];
+	};
+
+}
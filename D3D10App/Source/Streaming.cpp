@@ -0,0 +1,495 @@
+//--------------------------------------------------------------------------------------
+// File: Streaming.cpp
+//
+// Background loading of resources
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "Streaming.h"
+
+namespace Core
+{
+
+	// The global streamer
+	ResourceStreamer g_Streamer;
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	ResourceStreamer::ResourceStreamer()
+	{
+		m_Budget = STREAM_DEFAULT_BUDGET;
+		m_Frame = 0;
+		m_hWork = m_hExit = NULL;
+		for(int i=0; i<STREAM_LOADER_THREADS; i++)
+			m_hThreads[i] = NULL;
+		m_bStarted = false;
+		InitializeCriticalSection(&m_Lock);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Starts the loaders the first time something is requested
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::Start()
+	{
+		m_hWork = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+		m_hExit = CreateEvent(NULL, TRUE, FALSE, NULL);
+		for(int i=0; i<STREAM_LOADER_THREADS; i++)
+		{
+			unsigned int id;
+			m_hThreads[i] = (HANDLE)_beginthreadex(NULL, 0, LoaderThread, this, 0, &id);
+			SetThreadPriority(m_hThreads[i], THREAD_PRIORITY_BELOW_NORMAL);
+		}
+		m_bStarted = true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Stops the loaders and drops every request
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::Release()
+	{
+		if(m_bStarted)
+		{
+			// Loaders finish the request they are on first
+			SetEvent(m_hExit);
+			WaitForMultipleObjects(STREAM_LOADER_THREADS, m_hThreads, TRUE, INFINITE);
+			for(int i=0; i<STREAM_LOADER_THREADS; i++)
+			{
+				CloseHandle(m_hThreads[i]);
+				m_hThreads[i] = NULL;
+			}
+			CloseHandle(m_hWork);
+			CloseHandle(m_hExit);
+			m_hWork = m_hExit = NULL;
+			m_bStarted = false;
+		}
+
+		// The managers free what is still queued, cancelled resources are gone
+		// from them and have to be freed here
+		for(int i=0; i<m_Queue.Size(); i++)
+		{
+			m_Queue[i]->pResource->m_pStream = NULL;
+			delete m_Queue[i];
+		}
+		for(int i=0; i<m_Decoded.Size(); i++)
+		{
+			StreamRequest* pRequest = m_Decoded[i];
+			if(pRequest->bCancelled)
+			{
+				pRequest->pResource->Release();
+				delete pRequest->pResource;
+			}
+			else
+				pRequest->pResource->m_pStream = NULL;
+			delete pRequest;
+		}
+		m_Queue.Release();
+		m_Decoded.Release();
+		m_Stats = StreamingStats();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Queues a resource for the loaders
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::Request(EngineResource* pResource, const char* szFile, float priority, bool bRefresh)
+	{
+		if(!pResource || !szFile || pResource->m_pStream)
+			return;
+		if(!m_bStarted)
+			Start();
+
+		StreamRequest* pRequest = new StreamRequest;
+		pRequest->pResource = pResource;
+		strncpy(pRequest->szFile, szFile, MAX_PATH-1);
+		pRequest->szFile[MAX_PATH-1] = 0;
+		pRequest->Priority = priority;
+		pRequest->PriorityFrame = m_Frame;
+		pRequest->HeapIndex = -1;
+		pRequest->State = STREAM_QUEUED;
+		pRequest->Bytes = 0;
+		pRequest->bDecoded = false;
+		pRequest->bCancelled = false;
+		pResource->m_pStream = pRequest;
+		if(!bRefresh)
+			pResource->m_bResident = false;
+
+		EnterCriticalSection(&m_Lock);
+		HeapPush(pRequest);
+		m_Stats.QueueDepth++;
+		LeaveCriticalSection(&m_Lock);
+		ReleaseSemaphore(m_hWork, 1, NULL);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Ranks a request, the lowest priority within a frame wins
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::SetPriority(EngineResource* pResource, float priority)
+	{
+		StreamRequest* pRequest = pResource ? pResource->m_pStream : NULL;
+		if(!pRequest)
+			return;
+
+		EnterCriticalSection(&m_Lock);
+		if(pRequest->PriorityFrame==m_Frame && pRequest->Priority<priority)
+			priority = pRequest->Priority;
+		float old = pRequest->Priority;
+		pRequest->Priority = priority;
+		pRequest->PriorityFrame = m_Frame;
+		if(pRequest->State==STREAM_QUEUED)
+		{
+			if(priority<old)
+				HeapUp(pRequest->HeapIndex);
+			else
+				HeapDown(pRequest->HeapIndex);
+		}
+		LeaveCriticalSection(&m_Lock);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Drops a request, returns false if a loader still has it
+	//--------------------------------------------------------------------------------------
+	bool ResourceStreamer::Cancel(EngineResource* pResource)
+	{
+		StreamRequest* pRequest = pResource ? pResource->m_pStream : NULL;
+		if(!pRequest)
+			return true;
+
+		EnterCriticalSection(&m_Lock);
+		if(pRequest->State==STREAM_LOADING)
+		{
+			// Upload deletes it when the loader hands it over
+			pRequest->bCancelled = true;
+			LeaveCriticalSection(&m_Lock);
+			return false;
+		}
+		if(pRequest->State==STREAM_QUEUED)
+		{
+			HeapRemove(pRequest);
+			m_Stats.QueueDepth--;
+		}
+		else
+		{
+			m_Decoded.Remove(pRequest);
+			m_Stats.Decoded--;
+			m_Stats.BytesInFlight -= pRequest->Bytes;
+		}
+		m_Stats.Cancelled++;
+		LeaveCriticalSection(&m_Lock);
+
+		pResource->m_pStream = NULL;
+		delete pRequest;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Loads a requested resource on this thread
+	//--------------------------------------------------------------------------------------
+	bool ResourceStreamer::Finish(EngineResource* pResource)
+	{
+		StreamRequest* pRequest = pResource ? pResource->m_pStream : NULL;
+		if(!pRequest)
+			return pResource && pResource->IsResident();
+
+		EnterCriticalSection(&m_Lock);
+		if(pRequest->State==STREAM_QUEUED)
+		{
+			// Take it before a loader does, the extra count on the semaphore
+			// just wakes a loader to an empty queue
+			HeapRemove(pRequest);
+			m_Stats.QueueDepth--;
+			m_Stats.Loading++;
+			pRequest->State = STREAM_LOADING;
+			LeaveCriticalSection(&m_Lock);
+			Decode(pRequest);
+			EnterCriticalSection(&m_Lock);
+			m_Stats.Loading--;
+		}
+		else
+		{
+			// Wait for the loader that has it
+			while(pRequest->State==STREAM_LOADING)
+			{
+				LeaveCriticalSection(&m_Lock);
+				Sleep(1);
+				EnterCriticalSection(&m_Lock);
+			}
+			m_Decoded.Remove(pRequest);
+			m_Stats.Decoded--;
+			m_Stats.BytesInFlight -= pRequest->Bytes;
+		}
+		LeaveCriticalSection(&m_Lock);
+
+		return Upload(pRequest);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Finishes decoded resources within the budget
+	//--------------------------------------------------------------------------------------
+	int ResourceStreamer::Update()
+	{
+		m_Frame++;
+		m_Stats.BytesUploaded = 0;
+
+		int numResident = 0;
+		int numUploaded = 0;
+		for(;;)
+		{
+			// Nearest decoded request, the list is short so a scan will do
+			EnterCriticalSection(&m_Lock);
+			int best = -1;
+			for(int i=0; i<m_Decoded.Size(); i++)
+			{
+				if(m_Decoded[i]->bCancelled)
+				{
+					best = i;
+					break;
+				}
+				if(best<0 || m_Decoded[i]->Priority<m_Decoded[best]->Priority)
+					best = i;
+			}
+			if(best<0)
+			{
+				LeaveCriticalSection(&m_Lock);
+				break;
+			}
+
+			// Something always goes up so big resources are not stuck
+			StreamRequest* pRequest = m_Decoded[best];
+			if(!pRequest->bCancelled && numUploaded>0 && m_Stats.BytesUploaded+pRequest->Bytes>m_Budget)
+			{
+				LeaveCriticalSection(&m_Lock);
+				break;
+			}
+			m_Decoded.Remove(best);
+			m_Stats.Decoded--;
+			m_Stats.BytesInFlight -= pRequest->Bytes;
+			LeaveCriticalSection(&m_Lock);
+
+			if(!pRequest->bCancelled)
+			{
+				numUploaded++;
+				m_Stats.BytesUploaded += pRequest->Bytes;
+			}
+			if(Upload(pRequest))
+				numResident++;
+		}
+		return numResident;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Finishes everything queued
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::Flush()
+	{
+		UINT budget = m_Budget;
+		m_Budget = 0xffffffff;
+		Update();
+		while(!IsIdle())
+		{
+			Sleep(1);
+			Update();
+		}
+		m_Budget = budget;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Loader thread entry
+	//--------------------------------------------------------------------------------------
+	unsigned _stdcall ResourceStreamer::LoaderThread(void* pParam)
+	{
+		((ResourceStreamer*)pParam)->LoaderLoop();
+		return 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Decodes the nearest queued request until told to stop
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::LoaderLoop()
+	{
+		HANDLE handles[2] = { m_hExit, m_hWork };
+		while(WaitForMultipleObjects(2, handles, FALSE, INFINITE)==WAIT_OBJECT_0+1)
+		{
+			// Finish and Cancel take requests without taking a count back
+			EnterCriticalSection(&m_Lock);
+			StreamRequest* pRequest = HeapPop();
+			if(!pRequest)
+			{
+				LeaveCriticalSection(&m_Lock);
+				continue;
+			}
+			pRequest->State = STREAM_LOADING;
+			m_Stats.QueueDepth--;
+			m_Stats.Loading++;
+			LeaveCriticalSection(&m_Lock);
+
+			Decode(pRequest);
+
+			EnterCriticalSection(&m_Lock);
+			pRequest->State = STREAM_DECODED;
+			m_Stats.Loading--;
+			m_Stats.Decoded++;
+			m_Stats.BytesInFlight += pRequest->Bytes;
+			m_Decoded.Add(pRequest);
+			LeaveCriticalSection(&m_Lock);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reads and decodes a request, cancelled ones are skipped
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::Decode(StreamRequest* pRequest)
+	{
+		if(pRequest->bCancelled)
+			return;
+		pRequest->bDecoded = pRequest->pResource->StreamDecode(pRequest->szFile);
+		pRequest->Bytes = pRequest->bDecoded ? pRequest->pResource->GetStreamBytes() : 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Puts a decoded request on the device, returns true if the resource is resident
+	//--------------------------------------------------------------------------------------
+	bool ResourceStreamer::Upload(StreamRequest* pRequest)
+	{
+		EngineResource* pResource = pRequest->pResource;
+		pResource->m_pStream = NULL;
+
+		// Nothing holds it any more
+		if(pRequest->bCancelled)
+		{
+			pResource->Release();
+			delete pResource;
+			delete pRequest;
+			m_Stats.Cancelled++;
+			return false;
+		}
+
+		// A failed resource is still done, it keeps its placeholder
+		bool bLoaded = pRequest->bDecoded && pResource->StreamUpload(pRequest->szFile);
+		pResource->m_bResident = true;
+		if(bLoaded)
+			m_Stats.Completed++;
+		else
+		{
+			Log::Print("<!> Resource %s failed to stream!", pRequest->szFile);
+			m_Stats.Failed++;
+		}
+		delete pRequest;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Heap on priority, lowest at the top
+	//--------------------------------------------------------------------------------------
+	void ResourceStreamer::HeapUp(int i)
+	{
+		StreamRequest* pRequest = m_Queue[i];
+		while(i>0)
+		{
+			int parent = (i-1)>>1;
+			if(m_Queue[parent]->Priority<=pRequest->Priority)
+				break;
+			m_Queue[i] = m_Queue[parent];
+			m_Queue[i]->HeapIndex = i;
+			i = parent;
+		}
+		m_Queue[i] = pRequest;
+		pRequest->HeapIndex = i;
+	}
+
+	void ResourceStreamer::HeapDown(int i)
+	{
+		StreamRequest* pRequest = m_Queue[i];
+		int size = m_Queue.Size();
+		for(;;)
+		{
+			int child = i*2+1;
+			if(child>=size)
+				break;
+			if(child+1<size && m_Queue[child+1]->Priority<m_Queue[child]->Priority)
+				child++;
+			if(pRequest->Priority<=m_Queue[child]->Priority)
+				break;
+			m_Queue[i] = m_Queue[child];
+			m_Queue[i]->HeapIndex = i;
+			i = child;
+		}
+		m_Queue[i] = pRequest;
+		pRequest->HeapIndex = i;
+	}
+
+	void ResourceStreamer::HeapPush(StreamRequest* pRequest)
+	{
+		m_Queue.Add(pRequest);
+		HeapUp(m_Queue.Size()-1);
+	}
+
+	StreamRequest* ResourceStreamer::HeapPop()
+	{
+		if(m_Queue.IsEmpty())
+			return NULL;
+		StreamRequest* pTop = m_Queue[0];
+		HeapRemove(pTop);
+		return pTop;
+	}
+
+	void ResourceStreamer::HeapRemove(StreamRequest* pRequest)
+	{
+		int i = pRequest->HeapIndex;
+		StreamRequest* pLast = m_Queue.Remove(m_Queue.Size()-1);
+		pRequest->HeapIndex = -1;
+		if(pLast==pRequest)
+			return;
+
+		// Fill the hole with the last one and move it whichever way it needs
+		m_Queue[i] = pLast;
+		pLast->HeapIndex = i;
+		HeapUp(i);
+		HeapDown(pLast->HeapIndex);
+	}
+
+
+
+#ifdef PHASE_DEBUG
+	//--------------------------------------------------------------------------------------
+	// Checks the queue is ordered and agrees with the counters
+	//--------------------------------------------------------------------------------------
+	bool ResourceStreamer::CheckQueue()
+	{
+		EnterCriticalSection(&m_Lock);
+		bool bValid = m_Queue.Size()==m_Stats.QueueDepth && m_Decoded.Size()==m_Stats.Decoded;
+		for(int i=0; i<m_Queue.Size(); i++)
+		{
+			if(m_Queue[i]->HeapIndex!=i || m_Queue[i]->State!=STREAM_QUEUED)
+				bValid = false;
+			if(i>0 && m_Queue[(i-1)>>1]->Priority>m_Queue[i]->Priority)
+				bValid = false;
+		}
+		UINT bytes = 0;
+		for(int i=0; i<m_Decoded.Size(); i++)
+			bytes += m_Decoded[i]->Bytes;
+		if(bytes!=m_Stats.BytesInFlight)
+			bValid = false;
+		LeaveCriticalSection(&m_Lock);
+		return bValid;
+	}
+#endif
+
+}
@@ -0,0 +1,155 @@
+//--------------------------------------------------------------------------------------
+// File: Streaming.h
+//
+// Background loading of resources.  A request hands a resource that is not resident
+// yet to the loader threads, which read and decode it nearest first.  The main thread
+// finishes decoded resources on the device each frame, up to a budget of bytes, so a
+// burst of loads spreads over several frames instead of hitching one.  Until then the
+// resource stands in with a placeholder.
+//
+// The loaders are their own threads rather than jobs on the thread pool, a file read
+// would hold a pool thread and stall every ParallelFor queued behind it.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include <process.h>
+#include <windows.h>
+#include "Array.cpp"
+
+namespace Core
+{
+
+// Loader threads, more than one keeps a slow file from holding up the rest
+#define STREAM_LOADER_THREADS	2
+
+// Bytes finished on the device each frame
+#define STREAM_DEFAULT_BUDGET	(4*1024*1024)
+
+// Priority of requests nothing has ranked yet, lower loads sooner.  Ranked
+// requests use the distance to the camera.
+#define STREAM_PRIORITY_DEFAULT	1000000.0f
+
+	// Where a request is
+	enum STREAM_STATE
+	{
+		STREAM_QUEUED,		// Waiting for a loader
+		STREAM_LOADING,		// On a loader thread
+		STREAM_DECODED,		// Waiting for the main thread
+	};
+
+	// A resource on its way in
+	struct StreamRequest
+	{
+		EngineResource*	pResource;
+		char			szFile[MAX_PATH];
+		float			Priority;
+		DWORD			PriorityFrame;	// Frame the priority was set in
+		int				HeapIndex;		// Place in the queue while queued
+		STREAM_STATE	State;
+		UINT			Bytes;			// Device bytes, known once decoded
+		bool			bDecoded;		// The decode worked
+		bool			bCancelled;		// Nothing wants it any more
+	};
+
+	// Counters
+	struct StreamingStats
+	{
+		int		QueueDepth;		// Requests waiting for a loader
+		int		Loading;		// Requests on the loaders
+		int		Decoded;		// Requests waiting for the device
+		UINT	BytesInFlight;	// Decoded bytes waiting for the device
+		UINT	BytesUploaded;	// Bytes finished this frame
+		int		Completed;		// Totals
+		int		Failed;
+		int		Cancelled;
+		StreamingStats(){
+			QueueDepth=Loading=Decoded=Completed=Failed=Cancelled=0;
+			BytesInFlight=BytesUploaded=0;
+		}
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Loads resources in the background
+	//--------------------------------------------------------------------------------------
+	class ResourceStreamer
+	{
+	public:
+		ResourceStreamer();
+
+		// Stops the loaders and drops every request, resources that were cancelled
+		// while loading are deleted
+		void Release();
+
+		// Queues a resource, it is not resident until an Update finishes it.  A refresh
+		// of a resident one keeps it resident and in use until the new data is up.
+		void Request(EngineResource* pResource, const char* szFile, float priority=STREAM_PRIORITY_DEFAULT, bool bRefresh=false);
+
+		// Ranks a request, lower loads sooner.  Calls within a frame keep the lowest
+		// so shared resources load for their nearest user.
+		void SetPriority(EngineResource* pResource, float priority);
+
+		// Drops the request of a resource nothing needs any more.  Returns false if a
+		// loader is working on it, the streamer then deletes the resource once the
+		// loader is done and the caller must not.
+		bool Cancel(EngineResource* pResource);
+
+		// Loads a requested resource now, on this thread
+		bool Finish(EngineResource* pResource);
+
+		// Finishes decoded resources nearest first within the budget, at least one a
+		// frame so large ones get through.  Returns the number made resident.
+		int Update();
+
+		// Finishes everything queued, for loading screens
+		void Flush();
+
+		inline void SetUploadBudget(UINT bytes){ m_Budget = bytes; }
+		inline UINT GetUploadBudget(){ return m_Budget; }
+		inline const StreamingStats& GetStats(){ return m_Stats; }
+		inline bool IsIdle(){ return m_Stats.QueueDepth+m_Stats.Loading+m_Stats.Decoded==0; }
+
+#ifdef PHASE_DEBUG
+		// Checks the queue is ordered and agrees with the counters, for the self tests
+		bool CheckQueue();
+#endif
+
+	private:
+		Array<StreamRequest*>	m_Queue;		// Heap on priority
+		Array<StreamRequest*>	m_Decoded;		// Waiting for the main thread
+		StreamingStats			m_Stats;
+		UINT					m_Budget;		// Device bytes a frame
+		DWORD					m_Frame;		// Counts updates, for the priorities
+
+		CRITICAL_SECTION		m_Lock;
+		HANDLE					m_hWork;		// Counts queued requests
+		HANDLE					m_hExit;
+		HANDLE					m_hThreads[STREAM_LOADER_THREADS];
+		bool					m_bStarted;
+
+		// Loader threads
+		void Start();
+		static unsigned _stdcall LoaderThread(void* pParam);
+		void LoaderLoop();
+
+		// Decodes a request, on whichever thread
+		void Decode(StreamRequest* pRequest);
+
+		// Puts a decoded request on the device, or deletes a cancelled one
+		bool Upload(StreamRequest* pRequest);
+
+		// Heap, the lock must be held
+		void HeapPush(StreamRequest* pRequest);
+		StreamRequest* HeapPop();
+		void HeapRemove(StreamRequest* pRequest);
+		void HeapUp(int i);
+		void HeapDown(int i);
+	};
+
+	// The global streamer
+	extern ResourceStreamer g_Streamer;
+
+}
@@ -28,8 +28,10 @@ namespace Core
 		pVertexBuffer = NULL;
 		pIndexBuffer = NULL;
 		pPosVertexBuffer = NULL;
+		pQuantization = NULL;
 		name = "SubMesh";
 		startIndex = numIndices = 0;
+		numLods = lod = 0;
 		pWorldMatrix = NULL;
 		pWorldPosition = NULL;
 		pCubeMap = NULL;
@@ -10,12 +10,22 @@
 #pragma once
 
 #include "Vertex.h"
+#include "VertexCompress.h"
 #include "Material.h"
 #include "RenderSurface.h"
 #include "Camera.h"
 
 namespace Core
 {
+	// Most reduced levels of detail a submesh can have
+	#define MAX_MESH_LODS 4
+
+	// Index range of a reduced level of detail, in the parent index buffer
+	struct SubMeshLOD
+	{
+		INT startIndex, numIndices;
+	};
+
 	//--------------------------------------------------------------------------------------
 	// Submesh within a larger mesh
 	//--------------------------------------------------------------------------------------
@@ -25,7 +35,11 @@ namespace Core
 		ID3D10Buffer*	pIndexBuffer;	// Parent index buffer
 		ID3D10Buffer*	pVertexBuffer;	// Parent vertex buffer
 		ID3D10Buffer*	pPosVertexBuffer;	// Parent vertex buffer
+		const VertexQuantization* pQuantization;	// Decoding of a compact vertex buffer, NULL for full vertices
 		INT startIndex, numIndices;		// Number of indices
+		SubMeshLOD		lods[MAX_MESH_LODS];	// Reduced levels, coarser with each one
+		int				numLods;		// Number of reduced levels
+		int				lod;			// Level to draw, 0 is the full mesh
 		D3DXMATRIX*	    pWorldMatrix;	// Ptr to world matrix
 		D3DXMATRIX*	    pWorldMatrixPrev;// Ptr to world matrix from the last frame
 		D3DXVECTOR3	    localPosition;	// Local position
@@ -41,6 +55,20 @@ namespace Core
 		// Constructor
 		SubMesh();
 
+		// Index range of a level, clamped to the levels there are
+		inline void GetLOD(int level, INT& start, INT& count) const
+		{
+			if(level<=0 || numLods==0)
+			{
+				start = startIndex;
+				count = numIndices;
+				return;
+			}
+			const SubMeshLOD& l = lods[min(level, numLods)-1];
+			start = l.startIndex;
+			count = l.numIndices;
+		}
+
 		// Friend to overloaded operators
 		friend int CompareSubMeshDistance(SubMesh*& lhs, SubMesh*& rhs);
 		friend class Renderer;
@@ -0,0 +1,451 @@
+//--------------------------------------------------------------------------------------
+// File: SunPath.cpp
+//
+// A year of sun positions at one place
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "SunPath.h"
+#include "spa/spa.h"
+
+namespace Core
+{
+
+	static const double PATH_D2R = 3.1415926535897932384626433832795/180.0;
+	static const double PATH_R2D = 180.0/3.1415926535897932384626433832795;
+
+	// From the SPA, refraction only applies above this elevation
+	static const double PATH_REFRACTION_LIMIT = -(0.26667 + 0.5667);
+
+	static inline bool IsLeapYear(int year)
+	{
+		return (year%4==0 && year%100!=0) || year%400==0;
+	}
+
+	static inline int DaysInMonth(int year, int month)
+	{
+		static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		return (month==2 && IsLeapYear(year)) ? 29 : days[month-1];
+	}
+
+	// Direction from zenith and azimuth in degrees
+	static inline D3DXVECTOR3 AnglesToDirection(float zenith, float azimuth)
+	{
+		double z = zenith*PATH_D2R;
+		double a = azimuth*PATH_D2R;
+		return D3DXVECTOR3((float)(sin(a)*sin(z)), (float)cos(z), (float)(cos(a)*sin(z)));
+	}
+
+	static inline SHORT PackComponent(float c)
+	{
+		return (SHORT)floorf(c*32767.0f + 0.5f);
+	}
+
+	// Angle between two unit vectors in degrees, well conditioned near zero unlike acos
+	static inline double AngleBetween(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+	{
+		double cx = (double)a.y*b.z - (double)a.z*b.y;
+		double cy = (double)a.z*b.x - (double)a.x*b.z;
+		double cz = (double)a.x*b.y - (double)a.y*b.x;
+		double dot = (double)a.x*b.x + (double)a.y*b.y + (double)a.z*b.z;
+		return atan2(sqrt(cx*cx + cy*cy + cz*cz), dot)*PATH_R2D;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	SunPathTable::SunPathTable()
+	{
+		memset(&m_Header, 0, sizeof(SunPathHeader));
+		m_StartJD = 0;
+		m_Refraction = 0;
+		m_Normal = D3DXVECTOR3(0, 1, 0);
+		m_szCache[0] = 0;
+		m_hThread = NULL;
+		m_bReady = false;
+		m_bInThread = false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Free resources, waits for a build in progress
+	//--------------------------------------------------------------------------------------
+	void SunPathTable::Release()
+	{
+		if(m_hThread)
+		{
+			WaitForSingleObject(m_hThread, INFINITE);
+			CloseHandle(m_hThread);
+			m_hThread = NULL;
+		}
+		m_bReady = false;
+		m_Samples.Release();
+		m_Days.Release();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sets what the next build makes
+	//--------------------------------------------------------------------------------------
+	void SunPathTable::Setup(int year, const SunLocation& location, double timezone, int samplesPerDay, double slope, double azmRotation)
+	{
+		m_bReady = false;
+
+		int numDays = 0;
+		for(int m=1; m<=12; m++)
+			numDays += DaysInMonth(year, m);
+
+		memset(&m_Header, 0, sizeof(SunPathHeader));
+		m_Header.Magic = SUN_PATH_MAGIC;
+		m_Header.Version = SUN_PATH_VERSION;
+		m_Header.Year = year;
+		m_Header.NumDays = numDays;
+		m_Header.SamplesPerDay = max(samplesPerDay, 1);
+		m_Header.NumSamples = numDays*m_Header.SamplesPerDay + 1;
+		m_Header.Latitude = location.Latitude;
+		m_Header.Longitude = location.Longitude;
+		m_Header.Elevation = location.Elevation;
+		m_Header.Pressure = location.Pressure;
+		m_Header.Temperature = location.Temperature;
+		m_Header.TimeZone = timezone;
+		m_Header.DeltaT = 67;
+		m_Header.Slope = slope;
+		m_Header.AzmRotation = azmRotation;
+
+		m_StartJD = SunPosition::JulianDay(year, 1, 1, 0, 0, 0, timezone);
+		m_Refraction = (location.Pressure/1010.0)*(283.0/(273.0+location.Temperature))*1.02/60.0;
+
+		// The SPA's azimuth rotation is measured westward from south
+		double s = slope*PATH_D2R;
+		double r = azmRotation*PATH_D2R;
+		m_Normal = D3DXVECTOR3((float)(-sin(r)*sin(s)), (float)cos(s), (float)(-cos(r)*sin(s)));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// True if the table was set up with these settings
+	//--------------------------------------------------------------------------------------
+	bool SunPathTable::Matches(int year, const SunLocation& location, double timezone) const
+	{
+		return m_Header.Magic==SUN_PATH_MAGIC && m_Header.Year==year && m_Header.TimeZone==timezone &&
+			m_Header.Latitude==location.Latitude && m_Header.Longitude==location.Longitude &&
+			m_Header.Elevation==location.Elevation && m_Header.Pressure==location.Pressure &&
+			m_Header.Temperature==location.Temperature;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds the refraction to a direction computed without it
+	//--------------------------------------------------------------------------------------
+	static void Refract(D3DXVECTOR3& dir, double scale)
+	{
+		double horizontal = sqrt(dir.x*dir.x + dir.z*dir.z);
+		double e0 = atan2((double)dir.y, horizontal)*PATH_R2D;
+		if(e0 < PATH_REFRACTION_LIMIT || horizontal < 1e-6)
+			return;
+		double e = (e0 + scale/tan((e0 + 10.3/(e0 + 5.11))*PATH_D2R))*PATH_D2R;
+		double c = cos(e)/horizontal;
+		dir = D3DXVECTOR3((float)(dir.x*c), (float)sin(e), (float)(dir.z*c));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Blends the samples around a Julian day, without refraction
+	//--------------------------------------------------------------------------------------
+	bool SunPathTable::Interpolate(double jd, D3DXVECTOR3& dir) const
+	{
+		double t = (jd - m_StartJD)*m_Header.SamplesPerDay;
+		const SHORT* pSamples = m_Samples;
+		if(!(t >= 0 && t <= m_Header.NumSamples-1) || !pSamples)
+			return false;
+
+		int i = min((int)t, m_Header.NumSamples-2);
+		float f = (float)(t - i);
+		const SHORT* p = pSamples + i*3;
+		dir = D3DXVECTOR3(p[0] + (p[3]-p[0])*f, p[1] + (p[4]-p[1])*f, p[2] + (p[5]-p[2])*f);
+		D3DXVec3Normalize(&dir, &dir);
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Direction to the sun at a Julian day
+	//--------------------------------------------------------------------------------------
+	bool SunPathTable::Lookup(double jd, D3DXVECTOR3& dir) const
+	{
+		if(!Interpolate(jd, dir))
+			return false;
+		Refract(dir, m_Refraction);
+		return true;
+	}
+
+	bool SunPathTable::Lookup(int month, int day, int hour, int minute, double second, D3DXVECTOR3& dir) const
+	{
+		return Lookup(SunPosition::JulianDay(m_Header.Year, month, day, hour, minute, second, m_Header.TimeZone), dir);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sunrise, transit and sunset of a date
+	//--------------------------------------------------------------------------------------
+	const SunPathDay* SunPathTable::GetDay(int month, int day) const
+	{
+		if(month<1 || month>12 || day<1 || day>DaysInMonth(m_Header.Year, month))
+			return NULL;
+		int index = day-1;
+		for(int m=1; m<month; m++)
+			index += DaysInMonth(m_Header.Year, m);
+		const SunPathDay* pDays = m_Days;
+		if(!pDays || index >= m_Header.NumDays)
+			return NULL;
+		return pDays + index;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Angle between a direction and the surface normal
+	//--------------------------------------------------------------------------------------
+	float SunPathTable::GetIncidence(const D3DXVECTOR3& dir) const
+	{
+		return (float)AngleBetween(dir, m_Normal);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Zenith and azimuth of a direction
+	//--------------------------------------------------------------------------------------
+	void SunPathTable::ToAngles(const D3DXVECTOR3& dir, float& zenith, float& azimuth)
+	{
+		zenith = (float)(atan2(sqrt(dir.x*dir.x + dir.z*dir.z), (double)dir.y)*PATH_R2D);
+		azimuth = (float)(atan2(dir.x, dir.z)*PATH_R2D);
+		if(azimuth < 0)
+			azimuth += 360.0f;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Fills the samples a day at a time, then the sunrise and sunset of each day, then
+	// measures the error halfway between samples where the blend is worst
+	//--------------------------------------------------------------------------------------
+	void SunPathTable::Compute()
+	{
+		const int spd = m_Header.SamplesPerDay;
+		SunLocation geometric(m_Header.Latitude, m_Header.Longitude, m_Header.Elevation, 0, m_Header.Temperature);
+		SunPosition sun;
+		sun.SetDeltaT(m_Header.DeltaT);
+
+		// A day of samples runs inline in SunPosition, so the build doesn't
+		// need the rest of the pool while it is on it
+		double* pTimes = new double[spd+1];
+		float* pZenith = new float[spd+1];
+		float* pAzimuth = new float[spd+1];
+
+		m_Samples.Allocate(m_Header.NumSamples*3);
+		for(int d=0; d<m_Header.NumDays; d++)
+		{
+			int count = (d==m_Header.NumDays-1) ? spd+1 : spd;
+			for(int s=0; s<count; s++)
+				pTimes[s] = m_StartJD + d + (double)s/spd;
+			sun.Compute(pTimes, count, &geometric, 1, pZenith, pAzimuth);
+			for(int s=0; s<count; s++)
+			{
+				D3DXVECTOR3 dir = AnglesToDirection(pZenith[s], pAzimuth[s]);
+				SHORT* p = &m_Samples[(d*spd+s)*3];
+				p[0] = PackComponent(dir.x);
+				p[1] = PackComponent(dir.y);
+				p[2] = PackComponent(dir.z);
+			}
+		}
+
+		// Rise and set times from the SPA itself
+		m_Days.Allocate(m_Header.NumDays);
+		int index = 0;
+		for(int m=1; m<=12; m++)
+			for(int d=1; d<=DaysInMonth(m_Header.Year, m); d++, index++)
+			{
+				spa_data spa;
+				spa.year = m_Header.Year;
+				spa.month = m;
+				spa.day = d;
+				spa.hour = 12;
+				spa.minute = 0;
+				spa.second = 0;
+				spa.timezone = m_Header.TimeZone;
+				spa.delta_t = m_Header.DeltaT;
+				spa.longitude = m_Header.Longitude;
+				spa.latitude = m_Header.Latitude;
+				spa.elevation = m_Header.Elevation;
+				spa.pressure = m_Header.Pressure;
+				spa.temperature = m_Header.Temperature;
+				spa.slope = m_Header.Slope;
+				spa.azm_rotation = m_Header.AzmRotation;
+				spa.atmos_refract = 0.5667;
+				spa.function = SPA_ZA_RTS;
+				SunPathDay& day = m_Days[index];
+				if(spa_calculate(&spa)==0 && spa.sunrise >= -24)
+				{
+					day.Sunrise = (float)spa.sunrise;
+					day.Transit = (float)spa.suntransit;
+					day.Sunset = (float)spa.sunset;
+				}
+				else
+					day.Sunrise = day.Transit = day.Sunset = -1;
+			}
+
+		// Error against the exact direction halfway between samples.  Refraction is left
+		// out since the lookup adds it exactly, except where the SPA switches it on just
+		// below the horizon and the elevation jumps by about half a degree.
+		double maxError = 0, sumError = 0;
+		for(int d=0; d<m_Header.NumDays; d++)
+		{
+			for(int s=0; s<spd; s++)
+				pTimes[s] = m_StartJD + d + (s+0.5)/spd;
+			sun.Compute(pTimes, spd, &geometric, 1, pZenith, pAzimuth);
+			for(int s=0; s<spd; s++)
+			{
+				D3DXVECTOR3 exact = AnglesToDirection(pZenith[s], pAzimuth[s]), dir;
+				Interpolate(pTimes[s], dir);
+				double error = AngleBetween(exact, dir);
+				maxError = max(maxError, error);
+				sumError += error;
+			}
+		}
+		m_Header.MaxError = (float)maxError;
+		m_Header.MeanError = (float)(sumError/(m_Header.NumDays*spd));
+
+		delete[] pTimes;
+		delete[] pZenith;
+		delete[] pAzimuth;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Loads the cache file if it matches the setup, otherwise computes the table
+	//--------------------------------------------------------------------------------------
+	bool SunPathTable::Build(const char* szCache)
+	{
+		m_bReady = false;
+		if(!m_Header.NumSamples)
+		{
+			Log::Print("SunPathTable::Build() called before Setup()");
+			return false;
+		}
+
+		if(!szCache || !Load(szCache))
+		{
+			DWORD start = timeGetTime();
+			Compute();
+			Log::Print("Sun path for %d built in %dms, %d samples, error %.4f max %.4f mean degrees",
+				m_Header.Year, timeGetTime()-start, m_Header.NumSamples, m_Header.MaxError, m_Header.MeanError);
+			if(szCache)
+				Save(szCache);
+		}
+
+		m_bReady = true;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Builds on a thread of its own, a pool thread would be held for the whole year
+	//--------------------------------------------------------------------------------------
+	void SunPathTable::BuildAsync(const char* szCache)
+	{
+		if(m_bInThread)
+			return;
+
+		// The last build is done with, but its thread may not have exited yet
+		if(m_hThread)
+		{
+			WaitForSingleObject(m_hThread, INFINITE);
+			CloseHandle(m_hThread);
+			m_hThread = NULL;
+		}
+
+		if(szCache)
+		{
+			strncpy(m_szCache, szCache, sizeof(m_szCache)-1);
+			m_szCache[sizeof(m_szCache)-1] = 0;
+		}
+		else
+			m_szCache[0] = 0;
+		m_bReady = false;
+		m_bInThread = true;
+		unsigned int id;
+		m_hThread = (HANDLE)_beginthreadex(NULL, 0, BuildThread, this, 0, &id);
+		if(!m_hThread)
+		{
+			Log::Print("SunPathTable::BuildAsync() couldn't start a thread, building inline");
+			Build(m_szCache[0] ? m_szCache : NULL);
+			m_bInThread = false;
+			return;
+		}
+		SetThreadPriority(m_hThread, THREAD_PRIORITY_BELOW_NORMAL);
+	}
+
+	unsigned _stdcall SunPathTable::BuildThread(void* pParam)
+	{
+		SunPathTable* pTable = (SunPathTable*)pParam;
+		pTable->Build(pTable->m_szCache[0] ? pTable->m_szCache : NULL);
+		pTable->m_bInThread = false;
+		return 0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Saves the table
+	//--------------------------------------------------------------------------------------
+	bool SunPathTable::Save(const char* szFile)
+	{
+		FILE* fp = fopen(szFile, "wb");
+		if(!fp)
+		{
+			Log::Print("Unable to write sun path cache %s", szFile);
+			return false;
+		}
+		bool ok = fwrite(&m_Header, sizeof(SunPathHeader), 1, fp)==1 &&
+			fwrite((SHORT*)m_Samples, sizeof(SHORT)*3, m_Header.NumSamples, fp)==(size_t)m_Header.NumSamples &&
+			fwrite((SunPathDay*)m_Days, sizeof(SunPathDay), m_Header.NumDays, fp)==(size_t)m_Header.NumDays;
+		fclose(fp);
+		if(!ok)
+			Log::Print("Unable to write sun path cache %s", szFile);
+		return ok;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Loads a table if it was built with the settings from Setup
+	//--------------------------------------------------------------------------------------
+	bool SunPathTable::Load(const char* szFile)
+	{
+		FILE* fp = fopen(szFile, "rb");
+		if(!fp)
+			return false;
+
+		SunPathHeader h;
+		bool ok = fread(&h, sizeof(SunPathHeader), 1, fp)==1 &&
+			h.Magic==m_Header.Magic && h.Version==m_Header.Version && h.Year==m_Header.Year &&
+			h.NumDays==m_Header.NumDays && h.SamplesPerDay==m_Header.SamplesPerDay && h.NumSamples==m_Header.NumSamples &&
+			h.Latitude==m_Header.Latitude && h.Longitude==m_Header.Longitude && h.Elevation==m_Header.Elevation &&
+			h.Pressure==m_Header.Pressure && h.Temperature==m_Header.Temperature && h.TimeZone==m_Header.TimeZone &&
+			h.DeltaT==m_Header.DeltaT && h.Slope==m_Header.Slope && h.AzmRotation==m_Header.AzmRotation;
+		if(ok)
+		{
+			m_Samples.Allocate(h.NumSamples*3);
+			m_Days.Allocate(h.NumDays);
+			ok = fread((SHORT*)m_Samples, sizeof(SHORT)*3, h.NumSamples, fp)==(size_t)h.NumSamples &&
+				fread((SunPathDay*)m_Days, sizeof(SunPathDay), h.NumDays, fp)==(size_t)h.NumDays;
+			if(ok)
+				m_Header = h;
+			else
+				Log::Print("Sun path cache %s is truncated", szFile);
+		}
+		fclose(fp);
+		return ok;
+	}
+}
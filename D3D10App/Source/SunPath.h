@@ -0,0 +1,130 @@
+//--------------------------------------------------------------------------------------
+// File: SunPath.h
+//
+// A year of sun positions at one place, for scrubbing the time of day without running
+// the SPA.  Directions to the sun are sampled at a fixed rate through the year and
+// stored as 16 bit vectors.  A lookup blends the two samples around the time, so it is
+// the same handful of operations at any time.  The samples leave out refraction, which
+// jumps at the horizon, and the lookup adds it back exactly.  Sunrise, transit and
+// sunset are stored for each day.
+//
+// Tables are built on a thread of their own and saved to a cache file.  A file is only
+// used if it was built with the same settings.  A year of positions takes long enough
+// that it would hold a pool thread and stall every ParallelFor queued behind it.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include <process.h>
+#include <windows.h>
+#include "SunPosition.h"
+
+namespace Core
+{
+
+#define SUN_PATH_MAGIC		0x31505053	// "SPP1"
+#define SUN_PATH_VERSION	1
+
+	// Settings a table was built with, and how far it is from the exact positions
+	struct SunPathHeader
+	{
+		DWORD	Magic;
+		DWORD	Version;
+		int		Year;
+		int		NumDays;
+		int		SamplesPerDay;
+		int		NumSamples;			// NumDays*SamplesPerDay+1, the last is midnight after the year
+		double	Latitude;
+		double	Longitude;
+		double	Elevation;
+		double	Pressure;
+		double	Temperature;
+		double	TimeZone;
+		double	DeltaT;
+		double	Slope;				// Surface for the incidence angle, as in the SPA
+		double	AzmRotation;
+		float	MaxError;			// Degrees between the table and the exact direction halfway between
+									// samples, without refraction
+		float	MeanError;
+	};
+
+	// Local times in hours, negative if the sun does not rise or set that day
+	struct SunPathDay
+	{
+		float	Sunrise;
+		float	Transit;
+		float	Sunset;
+	};
+
+
+	class SunPathTable
+	{
+	public:
+		SunPathTable();
+		~SunPathTable(){ Release(); }
+
+		void Release();
+
+		// Sets what the next build makes, the sample rate is per day
+		void Setup(int year, const SunLocation& location, double timezone, int samplesPerDay=144, double slope=0, double azmRotation=0);
+
+		// True if the table was set up with these settings
+		bool Matches(int year, const SunLocation& location, double timezone) const;
+
+		// Loads the cache file if it matches the setup, otherwise computes the table
+		// and saves it to the file
+		bool Build(const char* szCache=NULL);
+
+		// The same on a build thread, the table can be used once IsReady is true
+		void BuildAsync(const char* szCache=NULL);
+
+		// Cache files
+		bool Load(const char* szFile);
+		bool Save(const char* szFile);
+
+		// Direction to the sun, x east, y up and z north.  Returns false if the
+		// time is not in the table's year.
+		bool Lookup(int month, int day, int hour, int minute, double second, D3DXVECTOR3& dir) const;
+		bool Lookup(double jd, D3DXVECTOR3& dir) const;
+
+		// Sunrise, transit and sunset of a date, NULL if it is not in the year
+		const SunPathDay* GetDay(int month, int day) const;
+
+		// Angle between a direction and the surface normal in degrees
+		float GetIncidence(const D3DXVECTOR3& dir) const;
+
+		// Zenith and azimuth (eastward from north) in degrees of a direction
+		static void ToAngles(const D3DXVECTOR3& dir, float& zenith, float& azimuth);
+
+		// Properties
+		inline bool IsReady() const { return m_bReady; }
+		inline bool IsBuilding() const { return m_bInThread; }
+		inline const SunPathHeader& GetHeader() const { return m_Header; }
+		inline int GetMemoryUsage(){ return m_Samples.Size()*sizeof(SHORT) + m_Days.Size()*sizeof(SunPathDay); }
+
+	private:
+
+		// Fills the samples and days, and measures the error
+		void Compute();
+
+		// Blends the samples around a time, without refraction
+		bool Interpolate(double jd, D3DXVECTOR3& dir) const;
+
+		// Build thread entry
+		static unsigned _stdcall BuildThread(void* pParam);
+
+		SunPathHeader		m_Header;
+		Array<SHORT>		m_Samples;		// Three per sample
+		Array<SunPathDay>	m_Days;
+		double				m_StartJD;		// Julian day of the first sample
+		double				m_Refraction;	// Pressure and temperature scale of the refraction
+		D3DXVECTOR3			m_Normal;		// Surface normal for the incidence
+		char				m_szCache[256];
+		HANDLE				m_hThread;		// The last build thread, until it is waited on
+		volatile bool		m_bReady;
+		volatile bool		m_bInThread;
+	};
+
+}
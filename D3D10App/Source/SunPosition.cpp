@@ -0,0 +1,426 @@
+//--------------------------------------------------------------------------------------
+// File: SunPosition.cpp
+//
+// Batched solar position built on the NREL SPA
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ThreadPool.h"
+#include "SunPosition.h"
+#include "spa/spa.h"
+#include <emmintrin.h>
+
+namespace Core
+{
+
+	static const double SUN_PI = 3.1415926535897932384626433832795;
+	static const double SUN_D2R = SUN_PI/180.0;
+
+	// From the SPA
+	static const double SUN_RADIUS_DEG = 0.26667;
+	static const double EARTH_RADIUS_M = 6378140.0;
+	static const double EARTH_FLATTENING = 0.99664719;
+
+	// Wraps to [0, 360)
+	static inline double LimitDegrees(double degrees)
+	{
+		degrees = fmod(degrees, 360.0);
+		return degrees<0 ? degrees+360.0 : degrees;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	SunPosition::SunPosition()
+	{
+		m_DeltaT = 67;
+		m_AtmosRefract = 0.5667;
+		m_pLocations = NULL;
+		m_LocationCapacity = 0;
+		Flush();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Free resources
+	//--------------------------------------------------------------------------------------
+	void SunPosition::Release()
+	{
+		if(m_pLocations)
+		{
+			_aligned_free(m_pLocations);
+			m_pLocations = NULL;
+		}
+		m_LocationCapacity = 0;
+		m_Times.Release();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Empties the ephemeris cache
+	//--------------------------------------------------------------------------------------
+	void SunPosition::Flush()
+	{
+		for(int i=0; i<SUN_CACHE_DAYS; i++)
+			m_Cache[i].Day = -1;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Julian day in universal time of a local date and time
+	//--------------------------------------------------------------------------------------
+	double SunPosition::JulianDay(int year, int month, int day, int hour, int minute, double second, double timezone)
+	{
+		return julian_day(year, month, day, hour, minute, 0, timezone) + second/86400.0;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Runs the full SPA for the values that only depend on time
+	//--------------------------------------------------------------------------------------
+	void SunPosition::SampleDay(double jd, double* pValues)
+	{
+		spa_data spa;
+		spa.jd = jd;
+		spa.delta_t = m_DeltaT;
+		calculate_geocentric_sun_right_ascension_and_declination(&spa);
+
+		pValues[SUN_VALUE_LAMDA] = spa.lamda;
+		pValues[SUN_VALUE_BETA] = spa.beta;
+		pValues[SUN_VALUE_EPSILON] = spa.epsilon;
+		pValues[SUN_VALUE_EQUINOX] = spa.del_psi*cos(spa.epsilon*SUN_D2R);
+		pValues[SUN_VALUE_RADIUS] = spa.r;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Returns the cached day, computing it if needed.  Samples are at 0h, 12h and 24h UT,
+	// and the end of a day is the start of the next, so a day next to a cached one
+	// only needs two full evaluations.
+	//--------------------------------------------------------------------------------------
+	const SunDay& SunPosition::GetDay(int day)
+	{
+		SunDay& entry = m_Cache[day & (SUN_CACHE_DAYS-1)];
+		if(entry.Day == day)
+			return entry;
+
+		const SunDay& prev = m_Cache[(day-1) & (SUN_CACHE_DAYS-1)];
+		const SunDay& next = m_Cache[(day+1) & (SUN_CACHE_DAYS-1)];
+		double samples[3][SUN_VALUE_COUNT];
+		for(int s=0; s<3; s++)
+		{
+			if(s==0 && prev.Day==day-1)
+				for(int v=0; v<SUN_VALUE_COUNT; v++)
+					samples[s][v] = prev.Values[v][2];
+			else if(s==2 && next.Day==day+1)
+				for(int v=0; v<SUN_VALUE_COUNT; v++)
+					samples[s][v] = next.Values[v][0];
+			else
+				SampleDay(day + 0.5 + s*0.5, samples[s]);
+		}
+
+		entry.Day = day;
+		for(int v=0; v<SUN_VALUE_COUNT; v++)
+			for(int s=0; s<3; s++)
+				entry.Values[v][s] = samples[s][v];
+
+		// The longitude wraps at 360, keep it continuous over the day
+		double* pLamda = entry.Values[SUN_VALUE_LAMDA];
+		for(int s=1; s<3; s++)
+		{
+			while(pLamda[s]-pLamda[0] > 180.0) pLamda[s] -= 360.0;
+			while(pLamda[s]-pLamda[0] < -180.0) pLamda[s] += 360.0;
+		}
+		return entry;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Interpolates the day and finishes the terms for a time, the same steps as
+	// spa_calculate up to the hour angle
+	//--------------------------------------------------------------------------------------
+	void SunPosition::ComputeTime(double jd, SunTime& time)
+	{
+		double dayStart = floor(jd - 0.5);
+		const SunDay& day = GetDay((int)dayStart);
+
+		// Quadratic through the samples at f = 0, 0.5 and 1
+		double f = jd - 0.5 - dayStart;
+		double v[SUN_VALUE_COUNT];
+		for(int i=0; i<SUN_VALUE_COUNT; i++)
+		{
+			const double* p = day.Values[i];
+			v[i] = p[0] + f*(-3.0*p[0] + 4.0*p[1] - p[2]) + f*f*(2.0*p[0] - 4.0*p[1] + 2.0*p[2]);
+		}
+
+		double lamda = v[SUN_VALUE_LAMDA]*SUN_D2R;
+		double beta = v[SUN_VALUE_BETA]*SUN_D2R;
+		double epsilon = v[SUN_VALUE_EPSILON]*SUN_D2R;
+		double alpha = atan2(sin(lamda)*cos(epsilon) - tan(beta)*sin(epsilon), cos(lamda));
+		double delta = asin(sin(beta)*cos(epsilon) + cos(beta)*sin(epsilon)*sin(lamda));
+
+		// Greenwich sidereal time is cheap and moves fast, so it is never interpolated
+		double jc = (jd - 2451545.0)/36525.0;
+		double nu0 = LimitDegrees(280.46061837 + 360.98564736629*(jd - 2451545.0) + jc*jc*(0.000387933 - jc/38710000.0));
+		double h = (nu0 + v[SUN_VALUE_EQUINOX])*SUN_D2R - alpha;
+
+		double xi = 8.794/(3600.0*v[SUN_VALUE_RADIUS]);
+
+		time.SinH = (float)sin(h);
+		time.CosH = (float)cos(h);
+		time.SinDelta = (float)sin(delta);
+		time.CosDelta = (float)cos(delta);
+		time.SinXi = (float)sin(xi*SUN_D2R);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Fills the location streams, padding to a multiple of 4 with the last location
+	//--------------------------------------------------------------------------------------
+	void SunPosition::SetLocations(const SunLocation* pLocations, int numLocations)
+	{
+		int capacity = (numLocations+3) & ~3;
+		if(capacity > m_LocationCapacity)
+		{
+			if(m_pLocations)
+				_aligned_free(m_pLocations);
+			m_pLocations = (float*)_aligned_malloc((size_t)capacity*SUN_LOCATION_STREAM_COUNT*sizeof(float), 16);
+			m_LocationCapacity = capacity;
+		}
+
+		float* pStream[SUN_LOCATION_STREAM_COUNT];
+		for(int s=0; s<SUN_LOCATION_STREAM_COUNT; s++)
+			pStream[s] = m_pLocations + s*m_LocationCapacity;
+
+		for(int i=0; i<capacity; i++)
+		{
+			const SunLocation& loc = pLocations[i<numLocations ? i : numLocations-1];
+			double lat = loc.Latitude*SUN_D2R;
+			double lon = loc.Longitude*SUN_D2R;
+			double u = atan(EARTH_FLATTENING*tan(lat));
+
+			pStream[SUN_LOCATION_SIN_LON][i] = (float)sin(lon);
+			pStream[SUN_LOCATION_COS_LON][i] = (float)cos(lon);
+			pStream[SUN_LOCATION_SIN_LAT][i] = (float)sin(lat);
+			pStream[SUN_LOCATION_COS_LAT][i] = (float)cos(lat);
+			pStream[SUN_LOCATION_X][i] = (float)(cos(u) + loc.Elevation*cos(lat)/EARTH_RADIUS_M);
+			pStream[SUN_LOCATION_Y][i] = (float)(EARTH_FLATTENING*sin(u) + loc.Elevation*sin(lat)/EARTH_RADIUS_M);
+			pStream[SUN_LOCATION_REFRACTION][i] = (float)((loc.Pressure/1010.0)*(283.0/(273.0+loc.Temperature))*1.02/60.0);
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Arc tangent of y/x for four angles, good to about 1e-7 radians.  The ratio is folded
+	// into [0, 1] and then around tan(pi/8) for a short polynomial.
+	//--------------------------------------------------------------------------------------
+	static const float ATAN_C3 = -3.33329491539e-1f;
+	static const float ATAN_C5 = 1.99777106478e-1f;
+	static const float ATAN_C7 = -1.38776856032e-1f;
+	static const float ATAN_C9 = 8.05374449538e-2f;
+
+	static inline __m128 Atan2PS(__m128 y, __m128 x)
+	{
+		const __m128 vAbs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 vSign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+		const __m128 vOne = _mm_set1_ps(1.0f);
+		const __m128 vPi = _mm_set1_ps((float)SUN_PI);
+
+		__m128 ax = _mm_and_ps(x, vAbs);
+		__m128 ay = _mm_and_ps(y, vAbs);
+		__m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+
+		// atan(a) = pi/4 + atan((a-1)/(a+1))
+		__m128 fold = _mm_cmpgt_ps(a, _mm_set1_ps(0.414213562f));
+		__m128 r = _mm_or_ps(_mm_and_ps(fold, _mm_div_ps(_mm_sub_ps(a, vOne), _mm_add_ps(a, vOne))), _mm_andnot_ps(fold, a));
+		__m128 z = _mm_mul_ps(r, r);
+		__m128 p = _mm_set1_ps(ATAN_C9);
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(ATAN_C7));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(ATAN_C5));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(ATAN_C3));
+		p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), r), r);
+		p = _mm_add_ps(p, _mm_and_ps(fold, _mm_set1_ps((float)(SUN_PI/4))));
+
+		// Unfold the octant and quadrant
+		__m128 swap = _mm_cmpgt_ps(ay, ax);
+		p = _mm_or_ps(_mm_and_ps(swap, _mm_sub_ps(_mm_set1_ps((float)(SUN_PI/2)), p)), _mm_andnot_ps(swap, p));
+		__m128 left = _mm_cmplt_ps(x, _mm_setzero_ps());
+		p = _mm_or_ps(_mm_and_ps(left, _mm_sub_ps(vPi, p)), _mm_andnot_ps(left, p));
+		return _mm_xor_ps(p, _mm_and_ps(y, vSign));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Cotangent for the refraction, the angle is between 1.5 and 90.1 degrees so it is
+	// centered on pi/4 and both sine and cosine come from short polynomials
+	//--------------------------------------------------------------------------------------
+	static const float SIN_C3 = -1.6666654611e-1f;
+	static const float SIN_C5 = 8.3321608736e-3f;
+	static const float SIN_C7 = -1.9515295891e-4f;
+	static const float COS_C4 = 4.166664568298827e-2f;
+	static const float COS_C6 = -1.388731625493765e-3f;
+	static const float COS_C8 = 2.443315711809948e-5f;
+
+	static inline __m128 CotPS(__m128 x)
+	{
+		__m128 t = _mm_sub_ps(x, _mm_set1_ps((float)(SUN_PI/4)));
+		__m128 z = _mm_mul_ps(t, t);
+		__m128 s = _mm_set1_ps(SIN_C7);
+		s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(SIN_C5));
+		s = _mm_add_ps(_mm_mul_ps(s, z), _mm_set1_ps(SIN_C3));
+		s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), t), t);
+		__m128 c = _mm_set1_ps(COS_C8);
+		c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(COS_C6));
+		c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(COS_C4));
+		c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(-0.5f));
+		c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(1.0f));
+
+		// sin(x) = (sin t + cos t)/sqrt(2), cos(x) = (cos t - sin t)/sqrt(2)
+		return _mm_div_ps(_mm_sub_ps(c, s), _mm_add_ps(c, s));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Location loop, each item is one time and a block of locations
+	//--------------------------------------------------------------------------------------
+	struct SunJobData
+	{
+		const SunTime*	pTimes;
+		const float*	pLocations;
+		int				Capacity;
+		int				NumLocations;
+		int				NumBlocks;
+		float			RefractionLimit;
+		float*			pZenith;
+		float*			pAzimuth;
+	};
+
+	static void SunJob(int start, int end, void* pData)
+	{
+		const SunJobData& job = *(const SunJobData*)pData;
+		const float* pSinLon = job.pLocations + SUN_LOCATION_SIN_LON*job.Capacity;
+		const float* pCosLon = job.pLocations + SUN_LOCATION_COS_LON*job.Capacity;
+		const float* pSinLat = job.pLocations + SUN_LOCATION_SIN_LAT*job.Capacity;
+		const float* pCosLat = job.pLocations + SUN_LOCATION_COS_LAT*job.Capacity;
+		const float* pX = job.pLocations + SUN_LOCATION_X*job.Capacity;
+		const float* pY = job.pLocations + SUN_LOCATION_Y*job.Capacity;
+		const float* pRefraction = job.pLocations + SUN_LOCATION_REFRACTION*job.Capacity;
+
+		const __m128 vR2D = _mm_set1_ps((float)(180.0/SUN_PI));
+		const __m128 vD2R = _mm_set1_ps((float)SUN_D2R);
+		const __m128 v90 = _mm_set1_ps(90.0f);
+		const __m128 v180 = _mm_set1_ps(180.0f);
+		const __m128 vLimit = _mm_set1_ps(job.RefractionLimit);
+
+		for(int item=start; item<end; item++)
+		{
+			int t = item / job.NumBlocks;
+			int first = (item % job.NumBlocks)*SUN_LOCATION_BLOCK;
+			int last = min(first+SUN_LOCATION_BLOCK, job.NumLocations);
+			const SunTime& time = job.pTimes[t];
+			__m128 vSinH0 = _mm_set1_ps(time.SinH);
+			__m128 vCosH0 = _mm_set1_ps(time.CosH);
+			__m128 vSinDelta = _mm_set1_ps(time.SinDelta);
+			__m128 vCosDelta = _mm_set1_ps(time.CosDelta);
+			__m128 vSinXi = _mm_set1_ps(time.SinXi);
+			float* pZenith = job.pZenith + t*job.NumLocations;
+			float* pAzimuth = job.pAzimuth + t*job.NumLocations;
+
+			for(int i=first; i<last; i+=4)
+			{
+				// Local hour angle, H0 plus the longitude
+				__m128 sinLon = _mm_load_ps(pSinLon+i);
+				__m128 cosLon = _mm_load_ps(pCosLon+i);
+				__m128 sinH = _mm_add_ps(_mm_mul_ps(vSinH0, cosLon), _mm_mul_ps(vCosH0, sinLon));
+				__m128 cosH = _mm_sub_ps(_mm_mul_ps(vCosH0, cosLon), _mm_mul_ps(vSinH0, sinLon));
+
+				// Direction to the sun from the observer in the equatorial frame of the local
+				// meridian.  Moving the observer off the earth's center is the parallax.
+				__m128 vx = _mm_sub_ps(_mm_mul_ps(vCosDelta, cosH), _mm_mul_ps(_mm_load_ps(pX+i), vSinXi));
+				__m128 vy = _mm_mul_ps(vCosDelta, sinH);
+				__m128 vz = _mm_sub_ps(vSinDelta, _mm_mul_ps(_mm_load_ps(pY+i), vSinXi));
+
+				// Into the horizon frame, up and toward the south
+				__m128 sinLat = _mm_load_ps(pSinLat+i);
+				__m128 cosLat = _mm_load_ps(pCosLat+i);
+				__m128 up = _mm_add_ps(_mm_mul_ps(vx, cosLat), _mm_mul_ps(vz, sinLat));
+				__m128 south = _mm_sub_ps(_mm_mul_ps(vx, sinLat), _mm_mul_ps(vz, cosLat));
+				__m128 horizontal = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vy, vy), _mm_mul_ps(south, south)));
+				__m128 e0 = _mm_mul_ps(Atan2PS(up, horizontal), vR2D);
+
+				// Refraction, only above the limit
+				__m128 angle = _mm_add_ps(e0, _mm_div_ps(_mm_set1_ps(10.3f), _mm_add_ps(e0, _mm_set1_ps(5.11f))));
+				__m128 refraction = _mm_mul_ps(_mm_load_ps(pRefraction+i), CotPS(_mm_mul_ps(angle, vD2R)));
+				refraction = _mm_and_ps(_mm_cmpge_ps(e0, vLimit), refraction);
+
+				__m128 zenith = _mm_sub_ps(v90, _mm_add_ps(e0, refraction));
+				__m128 azimuth = _mm_add_ps(_mm_mul_ps(Atan2PS(vy, south), vR2D), v180);
+
+				if(i+4 <= last)
+				{
+					_mm_storeu_ps(pZenith+i, zenith);
+					_mm_storeu_ps(pAzimuth+i, azimuth);
+				}
+				else
+				{
+					__declspec(align(16)) float z[4], a[4];
+					_mm_store_ps(z, zenith);
+					_mm_store_ps(a, azimuth);
+					for(int j=0; j<last-i; j++)
+					{
+						pZenith[i+j] = z[j];
+						pAzimuth[i+j] = a[j];
+					}
+				}
+			}
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sun angles for each of the times at each of the locations.  The times are finished
+	// here in order, which fills the cache, and the locations run on the thread pool.
+	//--------------------------------------------------------------------------------------
+	void SunPosition::Compute(const double* pTimes, int numTimes, const SunLocation* pLocations, int numLocations, float* pZenith, float* pAzimuth)
+	{
+		if(numTimes<=0 || numLocations<=0)
+			return;
+
+		m_Times.Clear();
+		for(int t=0; t<numTimes; t++)
+		{
+			SunTime time;
+			ComputeTime(pTimes[t], time);
+			m_Times.Add(time);
+		}
+		SetLocations(pLocations, numLocations);
+
+		SunJobData job;
+		job.pTimes = m_Times;
+		job.pLocations = m_pLocations;
+		job.Capacity = m_LocationCapacity;
+		job.NumLocations = numLocations;
+		job.NumBlocks = (numLocations+SUN_LOCATION_BLOCK-1)/SUN_LOCATION_BLOCK;
+		job.RefractionLimit = (float)-(SUN_RADIUS_DEG + m_AtmosRefract);
+		job.pZenith = pZenith;
+		job.pAzimuth = pAzimuth;
+
+		// Small batches are not worth waking the pool for
+		int count = numTimes*job.NumBlocks;
+		int minBand = max(1, 1024/min(numLocations, SUN_LOCATION_BLOCK));
+		g_ThreadPool.ParallelFor(count, SunJob, &job, minBand);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sun angles for one time at one location
+	//--------------------------------------------------------------------------------------
+	void SunPosition::Compute(double time, const SunLocation& location, float& zenith, float& azimuth)
+	{
+		Compute(&time, 1, &location, 1, &zenith, &azimuth);
+	}
+}
@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// File: SunPosition.h
+//
+// Batched solar position built on the NREL SPA.  The expensive part of the SPA, the
+// periodic term sums for the earth's orbit and the nutation, depends only on time and
+// changes smoothly, so it is evaluated three times per day and cached.  Any time in
+// the day interpolates the cached values, and the rest of the algorithm is split into
+// terms per time and terms per location.  Sun angles for many times at many places
+// are then a short SSE loop over the locations.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Array.cpp"
+
+namespace Core
+{
+
+// Days kept in the ephemeris cache, a power of two
+#define SUN_CACHE_DAYS 32
+
+// Locations processed by one job of a batch
+#define SUN_LOCATION_BLOCK 64
+
+	// A place on earth
+	struct SunLocation
+	{
+		double	Latitude;		// Degrees, negative south of the equator
+		double	Longitude;		// Degrees, negative west of Greenwich
+		double	Elevation;		// Meters
+		double	Pressure;		// Annual average in millibars, for refraction
+		double	Temperature;	// Annual average in degrees Celsius, for refraction
+
+		SunLocation(){ Latitude=0; Longitude=0; Elevation=0; Pressure=1010; Temperature=10; }
+		SunLocation(double lat, double lon, double elev, double pressure=1010, double temperature=10){
+			Latitude=lat; Longitude=lon; Elevation=elev; Pressure=pressure; Temperature=temperature;
+		}
+	};
+
+
+	// Ephemeris values at the start, middle and end of a day
+	enum SUN_VALUE
+	{
+		SUN_VALUE_LAMDA=0,		// Apparent sun longitude, unwrapped over the day
+		SUN_VALUE_BETA,			// Geocentric latitude
+		SUN_VALUE_EPSILON,		// True obliquity of the ecliptic
+		SUN_VALUE_EQUINOX,		// Nutation in longitude times cos(epsilon)
+		SUN_VALUE_RADIUS,		// Earth radius vector in AU
+
+		SUN_VALUE_COUNT,
+	};
+
+	struct SunDay
+	{
+		int		Day;			// Julian day number of the day's 0h UT, minus a half
+		double	Values[SUN_VALUE_COUNT][3];
+	};
+
+
+	// What the location loop needs from a time, H is the Greenwich hour angle
+	struct SunTime
+	{
+		float	SinH;
+		float	CosH;
+		float	SinDelta;
+		float	CosDelta;
+		float	SinXi;			// Horizontal parallax
+	};
+
+
+	// Time invariant terms of a location, one stream each
+	enum SUN_LOCATION_STREAM
+	{
+		SUN_LOCATION_SIN_LON=0,
+		SUN_LOCATION_COS_LON,
+		SUN_LOCATION_SIN_LAT,
+		SUN_LOCATION_COS_LAT,
+		SUN_LOCATION_X,				// Observer position in earth radii for the parallax
+		SUN_LOCATION_Y,
+		SUN_LOCATION_REFRACTION,	// Pressure and temperature scale of the refraction
+
+		SUN_LOCATION_STREAM_COUNT,
+	};
+
+
+	class SunPosition
+	{
+	public:
+		SunPosition();
+		~SunPosition(){ Release(); }
+
+		void Release();
+
+		// Difference between terrestrial and universal time in seconds, the SPA's delta_t
+		inline void SetDeltaT(double deltaT){ m_DeltaT = deltaT; Flush(); }
+
+		// Refraction at sunrise and sunset in degrees, 0.5667 is typical
+		inline void SetRefraction(double atmosRefract){ m_AtmosRefract = atmosRefract; }
+
+		// Empties the ephemeris cache
+		void Flush();
+
+		// Julian day in universal time of a local date and time
+		static double JulianDay(int year, int month, int day, int hour, int minute, double second, double timezone);
+
+		// Topocentric zenith and azimuth (eastward from north) in degrees for each of the
+		// times at each of the locations.  Results for time t at location l are written
+		// to index t*numLocations+l.  Times are Julian days in universal time.
+		void Compute(const double* pTimes, int numTimes, const SunLocation* pLocations, int numLocations, float* pZenith, float* pAzimuth);
+		void Compute(double time, const SunLocation& location, float& zenith, float& azimuth);
+
+		// Properties
+		inline int GetMemoryUsage(){ return sizeof(m_Cache) + m_Times.Size()*sizeof(SunTime) + m_LocationCapacity*SUN_LOCATION_STREAM_COUNT*sizeof(float); }
+
+	private:
+
+		// Runs the full SPA for the values that only depend on time
+		void SampleDay(double jd, double* pValues);
+
+		// Returns the cached day, computing it if needed
+		const SunDay& GetDay(int day);
+
+		// Interpolates the day and finishes the terms for a time
+		void ComputeTime(double jd, SunTime& time);
+
+		// Fills the location streams
+		void SetLocations(const SunLocation* pLocations, int numLocations);
+
+		SunDay			m_Cache[SUN_CACHE_DAYS];
+		double			m_DeltaT;
+		double			m_AtmosRefract;
+		Array<SunTime>	m_Times;
+		float*			m_pLocations;		// Location streams in one aligned block
+		int				m_LocationCapacity;	// Per stream, a multiple of 4
+	};
+
+}
@@ -32,15 +32,23 @@ namespace Core
 		m_bQueueThread=false;
 		m_FlagForUpdate = false;
 		m_vPos *= 0;
-		m_HeightScale = 128.0f;
+		m_HeightScale = TERRAIN_HEIGHT_SCALE;
 		m_Scale = 1.0f;
 
 		m_VertexBuffer = NULL;
 		m_IndexBuffer = NULL;
+		m_StagingHeightmap = NULL;
+
+		m_pHeightTiles = NULL;
+		m_pLayerTiles = NULL;
 
 		m_TrimXSide = NULL;
 		m_TrimZSide = NULL;
 		m_ClipmapOffsets = NULL;
+
+		m_LODError = TERRAIN_LOD_ERROR;
+		m_FirstLevel = 0;
+		memset(m_ClipmapMorph, 0, sizeof(m_ClipmapMorph));
 		
 		m_pRootNode = NULL;
 
@@ -88,6 +96,26 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Terrain::ExportHeightmap(char* fileName)
 	{
+		// Tile files are written separately
+		int len = strlen(fileName);
+		if(len>4 && _stricmp(fileName+len-4, ".ptt")==0)
+		{
+			ExportTiles(fileName);
+			return;
+		}
+		if(len>4 && _stricmp(fileName+len-4, ".ptb")==0)
+		{
+			ExportBinary(fileName);
+			return;
+		}
+
+		// Streamed terrains have no full textures to save
+		if(m_pHeightTiles)
+		{
+			Log::Print("Streamed terrains can only be exported as tiles");
+			return;
+		}
+
 		// Save the heightmap	
 		D3DX10SaveTextureToFileA(m_Heightmap.GetTex()[0], D3DX10_IFF_DDS, fileName);
 
@@ -126,8 +154,111 @@ namespace Core
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Writes the heights and layers out as tile files for streaming
+	//--------------------------------------------------------------------------------------
+	void Terrain::ExportTiles(const char* szFile)
+	{
+		if(m_pHeightTiles)
+		{
+			Log::Print("Terrain is already streamed from tiles");
+			return;
+		}
+
+		String fileName = szFile;
+		String actualFile = fileName.GetDirectory() + fileName.GetFile().Substring(0, fileName.GetFile().Length()-5);
+
+		// Heights come from the staging copy, which is kept in sync with sculpting.  They
+		// are unscaled, so the scale goes in the header.
+		D3D10_MAPPED_TEXTURE2D mappedTexture;
+		if( SUCCEEDED(m_StagingHeightmap->Map(0, D3D10_MAP_READ, 0, &mappedTexture)) )
+		{
+			TileCache::Build(szFile, mappedTexture.pData, mappedTexture.RowPitch, m_Size, CLIPMAP_LEVELS, DXGI_FORMAT_R16_FLOAT,
+				TILE_DEFAULT_SIZE, m_HeightScale);
+			m_StagingHeightmap->Unmap(0);
+		}
+
+		// Layer map
+		if( SUCCEEDED(m_LayerMaps.GetBaseTexture()->Map(0, D3D10_MAP_READ, 0, &mappedTexture)) )
+		{
+			TileCache::Build(actualFile + "_d.ptt", mappedTexture.pData, mappedTexture.RowPitch, m_Size, CLIPMAP_LEVELS, DXGI_FORMAT_R8G8B8A8_UNORM);
+			m_LayerMaps.GetBaseTexture()->Unmap(0);
+		}
+
+		// Layer textures go in the same text file as a full terrain export
+		ofstream file;
+		file.open(actualFile + ".ptf");
+		for(int i=0; i<NUM_LAYERS; i++)
+			if(m_HasTextureLayer[i])
+				file << GetTextureName(i) << endl;
+			else
+				file << "NONE" << endl;
+		for(int i=0; i<NUM_LAYERS; i++)
+			if(m_HasNormalLayer[i])
+				file << GetNormalmapName(i) << endl;
+			else
+				file << "NONE" << endl;
+		for(int i=0; i<NUM_LAYERS; i++)
+			file << m_LayerScales[i] << endl;
+		file.close();
+	}
+
+
 	
 
+	//--------------------------------------------------------------------------------------
+	// Writes the heights, layers and layer setup to a binary terrain file
+	//--------------------------------------------------------------------------------------
+	bool Terrain::ExportBinary(const char* szFile, bool compress)
+	{
+		if(m_pHeightTiles)
+		{
+			Log::Print("Streamed terrains can only be exported as tiles");
+			return false;
+		}
+		if(!m_LayerPyramid.GetLevels())
+		{
+			Log::Print("Terrain has no layer data to export");
+			return false;
+		}
+
+		// Layer setup, unused layers have no texture name
+		TerrainFileLayer layers[NUM_LAYERS];
+		memset(layers, 0, sizeof(layers));
+		for(int i=0; i<NUM_LAYERS; i++)
+		{
+			if(m_HasTextureLayer[i])
+				strncpy(layers[i].Texture, GetTextureName(i), TERRAIN_FILE_NAME-1);
+			if(m_HasNormalLayer[i])
+				strncpy(layers[i].Normalmap, GetNormalmapName(i), TERRAIN_FILE_NAME-1);
+			layers[i].Scale = m_LayerScales[i];
+		}
+
+		// Heights come from the staging copy, which is kept in sync with sculpting
+		D3D10_MAPPED_TEXTURE2D mappedTexture;
+		if( FAILED(m_StagingHeightmap->Map(0, D3D10_MAP_READ, 0, &mappedTexture)) )
+		{
+			Log::Print("Terrain export failed to read the heights> %s", szFile);
+			return false;
+		}
+		TerrainFileDesc desc;
+		desc.Size = m_Size;
+		desc.HeightScale = m_HeightScale;
+		desc.pHeights = (const D3DXFLOAT16*)mappedTexture.pData;
+		desc.HeightPitch = mappedTexture.RowPitch;
+		desc.pLayers = m_LayerPyramid.GetLevel(0);
+		desc.LayerPitch = m_Size*sizeof(BlendTexel);
+		desc.pLayerInfo = layers;
+		desc.LayerCount = NUM_LAYERS;
+		desc.Compress = compress;
+		bool ok = TerrainFile::Write(szFile, desc);
+		m_StagingHeightmap->Unmap(0);
+		if(!ok)
+			Log::Print("Terrain export failed> %s", szFile);
+		return ok;
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Loads from an image heightmap
 	//--------------------------------------------------------------------------------------
@@ -178,6 +309,10 @@ namespace Core
 			pStage->Unmap(0);
 		}
 		m_StagingHeightmap = pStage;
+
+		// Build the culling bounds and the normals
+		m_HeightBounds.Create((D3DXFLOAT16*)m_Height, m_Size);
+		UpdateNormals(NULL);
 		pHeightmap->Release();
 		
 		// Create the blendmaps
@@ -207,14 +342,53 @@ namespace Core
 			}
 		}
 		
-		// Generate the mip-maps
-		D3DX10FilterTexture(m_LayerMaps.GetBaseTexture(), 0, D3DX10_FILTER_POINT);
+		// Generate the mip-maps from a CPU copy, painting then only rebuilds the texels under the brush
+		if( m_LayerPyramid.Create(m_Size, CLIPMAP_LEVELS) &&
+			SUCCEEDED(m_LayerMaps.GetBaseTexture()->Map(0, D3D10_MAP_READ, 0, &mappedTexture)) )
+		{
+			for( int row = 0; row < m_Size; row++ )
+				memcpy(m_LayerPyramid.GetLevel(0) + row*m_Size, (BYTE*)mappedTexture.pData + row*mappedTexture.RowPitch, m_Size*sizeof(BlendTexel));
+			m_LayerMaps.GetBaseTexture()->Unmap(0);
+
+			RECT rects[CLIPMAP_LEVELS];
+			RECT full = { 0, 0, m_Size, m_Size };
+			m_LayerPyramid.BuildMips(full, rects);
+			UploadLayerPyramid(rects);
+		}
+		else
+			D3DX10FilterTexture(m_LayerMaps.GetBaseTexture(), 0, D3DX10_FILTER_POINT);
 
 		return td.Height;
 	}
 
 
 
+	//--------------------------------------------------------------------------------------
+	// Copies the given rect of each layer pyramid level into the layer clipmap's base
+	// texture, so only the footprint of an edit is written
+	//--------------------------------------------------------------------------------------
+	void Terrain::UploadLayerPyramid(const RECT* pRects)
+	{
+		ID3D10Texture2D* pBase = m_LayerMaps.GetBaseTexture();
+		for(int i=0; i<m_LayerPyramid.GetLevels(); i++)
+		{
+			const RECT& r = pRects[i];
+			if(r.left>=r.right || r.top>=r.bottom)
+				continue;
+
+			D3D10_MAPPED_TEXTURE2D mappedTexture;
+			if( FAILED(pBase->Map(i, D3D10_MAP_WRITE, 0, &mappedTexture)) )
+				continue;
+			int width = m_LayerPyramid.GetLevelSize(i);
+			for( int row = r.top; row < r.bottom; row++ )
+				memcpy((BYTE*)mappedTexture.pData + row*mappedTexture.RowPitch + r.left*sizeof(BlendTexel),
+					m_LayerPyramid.GetLevel(i) + row*width + r.left, (r.right-r.left)*sizeof(BlendTexel));
+			pBase->Unmap(i);
+		}
+	}
+
+
+
 	//--------------------------------------------------------------------------------------
 	// Create a terrain from a heightmap that is already loaded
 	//--------------------------------------------------------------------------------------
@@ -226,7 +400,7 @@ namespace Core
 		m_Size = hd.Width;
 
 		SetScale(1.0f);
-		SetHeightScale(128.0f);
+		SetHeightScale(TERRAIN_HEIGHT_SCALE);
 
 		// Setup clipmap
 		SetupClipmap(255, CLIPMAP_LEVELS);
@@ -267,6 +441,10 @@ namespace Core
 
 		// Check if we are loading a full terrain file
 		int len = strlen(szFile);
+		if(len>4 && _stricmp(szFile+len-4, ".ptt")==0)
+			return CreateFromTiles(szFile, pCam);
+		if(len>4 && _stricmp(szFile+len-4, ".ptb")==0)
+			return CreateFromBinary(szFile, pCam);
 		if( (szFile[len-1] == 'f' || szFile[len-1] == 'F') &&
 			(szFile[len-2] == 't' || szFile[len-2] == 'T') &&
 			(szFile[len-3] == 'p' || szFile[len-3] == 'P') )
@@ -293,34 +471,7 @@ namespace Core
 			}
 
 			// Load the file
-			ifstream file;
-			file.open(fileName);
-			
-			// Detail textures
-			char buf[256];
-			for(int i=0; i<4; i++)
-			{
-				file.getline(buf, 255);
-				if(strcmp(buf, "NONE") != 0)
-					LoadTexture(buf, i);
-			}
-
-			// Normal maps
-			for(int i=0; i<4; i++)
-			{
-				file.getline(buf, 255);
-				if(strcmp(buf, "NONE") != 0)
-					LoadNormalmap(buf, i);
-			}
-
-			// Texture scales
-			for(int i=0; i<NUM_LAYERS; i++)
-			{
-				file.getline(buf, 255);
-				sscanf(buf, "%f", &m_LayerScales[i]);
-			}
-
-			file.close();
+			LoadLayerFile(fileName);
 
 			return CreateFromTexture(tTex, tTex2, pCam);
 		}
@@ -349,6 +500,281 @@ namespace Core
 		return CreateFromTexture(tTex, NULL, pCam);
 	}
 
+	//--------------------------------------------------------------------------------------
+	// Loads the layer textures and scales from a terrain file
+	//--------------------------------------------------------------------------------------
+	bool Terrain::LoadLayerFile(const char* szFile)
+	{
+		ifstream file;
+		file.open(szFile);
+		if(!file.is_open())
+			return false;
+		
+		// Detail textures
+		char buf[256];
+		for(int i=0; i<4; i++)
+		{
+			file.getline(buf, 255);
+			if(strcmp(buf, "NONE") != 0)
+				LoadTexture(buf, i);
+		}
+
+		// Normal maps
+		for(int i=0; i<4; i++)
+		{
+			file.getline(buf, 255);
+			if(strcmp(buf, "NONE") != 0)
+				LoadNormalmap(buf, i);
+		}
+
+		// Texture scales
+		for(int i=0; i<NUM_LAYERS; i++)
+		{
+			file.getline(buf, 255);
+			sscanf(buf, "%f", &m_LayerScales[i]);
+		}
+
+		file.close();
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Scales bands of heights in place
+	//--------------------------------------------------------------------------------------
+	struct ScaleHeightsData
+	{
+		D3DXFLOAT16*	pHeights;
+		int				size;
+		float			scale;
+	};
+
+	static void ScaleHeightsJob(int start, int end, void* pData)
+	{
+		ScaleHeightsData& d = *(ScaleHeightsData*)pData;
+		float* pRow = new float[d.size];
+		for(int row=start; row<end; row++)
+		{
+			D3DXFLOAT16* pHeights = d.pHeights + row*d.size;
+			D3DXFloat16To32Array(pRow, pHeights, d.size);
+			for(int i=0; i<d.size; i++)
+				pRow[i] *= d.scale;
+			D3DXFloat32To16Array(pHeights, pRow, d.size);
+		}
+		delete[] pRow;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Create a terrain from a binary terrain file.  The chunks are decoded in parallel
+	// straight into the height and layer stores, and the textures are made from those.
+	//--------------------------------------------------------------------------------------
+	HRESULT Terrain::CreateFromBinary(const char* szFile, Camera* pCam)
+	{
+		m_szName = szFile;
+		TerrainFile file;
+		if(!file.Open(szFile))
+			return E_FAIL;
+		const TerrainFileHeader& header = file.GetHeader();
+		m_Size = header.Size;
+
+		// Layer textures
+		for(int i=0; i<NUM_LAYERS; i++)
+			m_LayerScales[i] = (m_Size/4);
+		char buf[TERRAIN_FILE_NAME];
+		for(int i=0; i<Math::Min((int)header.LayerCount, NUM_LAYERS); i++)
+		{
+			const TerrainFileLayer& layer = file.GetLayer(i);
+			buf[TERRAIN_FILE_NAME-1] = 0;
+			if(layer.Texture[0])
+			{
+				strncpy(buf, layer.Texture, TERRAIN_FILE_NAME-1);
+				LoadTexture(buf, i);
+			}
+			if(layer.Normalmap[0])
+			{
+				strncpy(buf, layer.Normalmap, TERRAIN_FILE_NAME-1);
+				LoadNormalmap(buf, i);
+			}
+			m_LayerScales[i] = layer.Scale;
+		}
+
+		SetScale(1.0f);
+		SetHeightScale(header.HeightScale);
+
+		// Setup clipmap
+		SetupClipmap(255, CLIPMAP_LEVELS);
+
+		// Decode the unscaled heights
+		m_Height.Allocate(m_Size*m_Size);
+		if(!file.ReadHeights((D3DXFLOAT16*)m_Height, m_Size))
+		{
+			Log::Print("Terrain heights failed to load> %s", szFile);
+			return E_FAIL;
+		}
+
+		// The heightmap and its staging copy are created from them
+		D3D10_TEXTURE2D_DESC desc = D3D10_TEXTURE2D_DESC();
+		desc.Width = m_Size;
+		desc.Height = m_Size;
+		desc.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE;
+		desc.Usage = D3D10_USAGE_DEFAULT;
+		desc.MipLevels = 1;
+		desc.Format = DXGI_FORMAT_R16_FLOAT;
+		desc.ArraySize = 1;
+		desc.SampleDesc.Count = 1;
+		D3D10_SUBRESOURCE_DATA initData;
+		initData.pSysMem = (D3DXFLOAT16*)m_Height;
+		initData.SysMemPitch = m_Size*sizeof(D3DXFLOAT16);
+		initData.SysMemSlicePitch = 0;
+		ID3D10Texture2D* pHeightmap = NULL;
+		HRESULT hr = g_pd3dDevice->CreateTexture2D(&desc, &initData, &pHeightmap);
+		if(FAILED(hr))
+		{
+			Log::D3D10Error(hr);
+			return hr;
+		}
+		m_Heightmap.CreateFromTexture(pHeightmap);
+		desc.BindFlags = 0;
+		desc.Usage = D3D10_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D10_CPU_ACCESS_READ | D3D10_CPU_ACCESS_WRITE;
+		hr = g_pd3dDevice->CreateTexture2D(&desc, &initData, &m_StagingHeightmap);
+		if(FAILED(hr))
+		{
+			Log::D3D10Error(hr);
+			return hr;
+		}
+
+		// Now scale the height store, the file holds the range
+		ScaleHeightsData scale;
+		scale.pHeights = (D3DXFLOAT16*)m_Height;
+		scale.size = m_Size;
+		scale.scale = m_HeightScale;
+		g_ThreadPool.ParallelFor(m_Size, ScaleHeightsJob, &scale, 64);
+		m_HeightExtents.x = header.MinHeight * m_HeightScale;
+		m_HeightExtents.y = header.MaxHeight * m_HeightScale;
+
+		// The culling bounds come from the pyramid in the file.  The heights were rounded to
+		// 16 bits after scaling and rounding keeps their order, so the ranges scaled and
+		// rounded the same way are exactly what a scan of the heights would find.
+		int cells = file.GetPyramidSize(0);
+		float* pRanges = new float[cells*cells*2];
+		for(int y=0; y<cells; y++)
+			for(int x=0; x<cells; x++)
+			{
+				float range[2];
+				D3DXFLOAT16 rounded[2];
+				file.GetMinMax(0, x, y, range[0], range[1]);
+				range[0] *= m_HeightScale;
+				range[1] *= m_HeightScale;
+				D3DXFloat32To16Array(rounded, range, 2);
+				D3DXFloat16To32Array(range, rounded, 2);
+				pRanges[(y*cells+x)*2] = Math::Min(range[0], range[1]);
+				pRanges[(y*cells+x)*2+1] = Math::Max(range[0], range[1]);
+			}
+		m_HeightBounds.CreateFromRanges(pRanges, m_Size, header.PyramidCell);
+		delete[] pRanges;
+		UpdateNormals(NULL);
+
+		// Decode the layers into the pyramid and build the mips
+		m_LayerMaps.Create(m_Size, m_ClipmapSize, CLIPMAP_LEVELS, DXGI_FORMAT_R8G8B8A8_UNORM);
+		if(!m_LayerPyramid.Create(m_Size, CLIPMAP_LEVELS) || !file.ReadLayers(m_LayerPyramid.GetLevel(0), m_Size))
+		{
+			Log::Print("Terrain layers failed to load> %s", szFile);
+			return E_FAIL;
+		}
+		RECT rects[CLIPMAP_LEVELS];
+		RECT full = { 0, 0, m_Size, m_Size };
+		m_LayerPyramid.BuildMips(full, rects);
+		UploadLayerPyramid(rects);
+
+		// Setup the quadtree
+		m_pRootNode = new QuadtreeNode();
+		m_pRootNode->pos = D3DXVECTOR3(0, m_HeightScale*0.5f, 0);
+		m_pRootNode->size = D3DXVECTOR3((float)m_Size/2, m_HeightScale*0.5f, (float)m_Size/2);
+		BuildQuadtree(m_pRootNode, 32);
+
+		Log::Print("Terrain loaded!");
+		m_bLoaded = true;
+		m_pCamera = pCam;
+		m_FlagForUpdate = true;
+		return S_OK;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Create a terrain that streams from tile files.  Only the tiles around the camera
+	// are kept mapped, so the heightfield can be far larger than memory.
+	//--------------------------------------------------------------------------------------
+	HRESULT Terrain::CreateFromTiles(const char* szFile, Camera* pCam)
+	{
+		m_szName = szFile;
+
+		// Open the heights
+		m_pHeightTiles = new TileCache();
+		if(!m_pHeightTiles->Open(szFile, TERRAIN_TILE_BUDGET) || m_pHeightTiles->GetFormat()!=DXGI_FORMAT_R16_FLOAT)
+		{
+			Log::Print("Terrain tiles failed to load> %s", szFile);
+			SAFE_DELETE(m_pHeightTiles);
+			return E_FAIL;
+		}
+		m_Size = m_pHeightTiles->GetSize();
+
+		// Open the layer map
+		String fileName = szFile;
+		String actualFile = fileName.GetDirectory() + fileName.GetFile().Substring(0, fileName.GetFile().Length()-5);
+		m_pLayerTiles = new TileCache();
+		if(!m_pLayerTiles->Open(actualFile + "_d.ptt", TERRAIN_TILE_BUDGET) || m_pLayerTiles->GetSize()!=m_Size)
+		{
+			Log::Print("Terrain layer tiles failed to load> %s", szFile);
+			SAFE_DELETE(m_pHeightTiles);
+			SAFE_DELETE(m_pLayerTiles);
+			return E_FAIL;
+		}
+
+		// Layer textures
+		if(!LoadLayerFile(actualFile + ".ptf"))
+		{
+			for(int i=0; i<NUM_LAYERS; i++)
+				m_LayerScales[i] = (m_Size/4);
+			LoadTexture("Textures\\grass.png", 0);
+		}
+
+		// The tile file stores the height scale it was exported with, files from before
+		// it did were all exported at the import scale
+		SetScale(1.0f);
+		SetHeightScale(m_pHeightTiles->GetScale()>0 ? m_pHeightTiles->GetScale() : TERRAIN_HEIGHT_SCALE);
+
+		// Setup clipmap
+		SetupClipmap(255, CLIPMAP_LEVELS);
+		if(!m_LayerMaps.CreateStreaming(m_pLayerTiles, m_ClipmapSize, CLIPMAP_LEVELS) ||
+			m_pHeightTiles->GetLevels() < CLIPMAP_LEVELS-1)
+		{
+			Log::Print("Terrain tiles are missing levels> %s", szFile);
+			return E_FAIL;
+		}
+		m_StreamRegion.Allocate((m_ClipmapSize+1)*(m_ClipmapSize+1));
+		m_StreamLevel.Allocate(m_ClipmapSize*m_ClipmapSize);
+		m_StreamRows.Allocate((m_ClipmapSize+1)*2);
+
+		// The tile file stores the height range
+		m_HeightExtents.x = m_pHeightTiles->GetMinValue() * m_HeightScale;
+		m_HeightExtents.y = m_pHeightTiles->GetMaxValue() * m_HeightScale;
+
+		// Setup the quadtree
+		m_pRootNode = new QuadtreeNode();
+		m_pRootNode->pos = D3DXVECTOR3(0, m_HeightScale*0.5f, 0);
+		m_pRootNode->size = D3DXVECTOR3((float)m_Size/2, m_HeightScale*0.5f, (float)m_Size/2);
+		BuildQuadtree(m_pRootNode, 32);
+
+		Log::Print("Terrain tiles opened!");
+		m_bLoaded = true;
+		m_pCamera = pCam;
+		m_FlagForUpdate = true;
+		return S_OK;
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Create a terrain from a heightmap
 	//--------------------------------------------------------------------------------------
@@ -422,6 +848,24 @@ namespace Core
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Regenerates the normals from the height store.  The heights are already scaled and
+	// the texels are a world unit apart.
+	//--------------------------------------------------------------------------------------
+	void Terrain::UpdateNormals(const RECT* pDirty)
+	{
+		if(m_Height.IsEmpty())
+			return;
+		if(!pDirty)
+		{
+			m_Normals.Allocate(m_Size*m_Size);
+			GenerateNormalMap((const D3DXFLOAT16*)m_Height, m_Size, m_Size, 1.0f, (PackedNormal*)m_Normals);
+		}
+		else if(!m_Normals.IsEmpty())
+			UpdateNormalMap((const D3DXFLOAT16*)m_Height, m_Size, m_Size, 1.0f, (PackedNormal*)m_Normals, *pDirty);
+	}
+
+
 
 
 	//--------------------------------------------------------------------------------------
@@ -462,9 +906,10 @@ namespace Core
 		m_Heightmap.Release();
 		m_Clipmaps.Release();
 
-		m_StagingHeightmap->Release();
+		SAFE_RELEASE(m_StagingHeightmap);
 
 		m_LayerMaps.Release();
+		m_LayerPyramid.Release();
 
 		SAFE_RELEASE(m_VertexBuffer);
 		SAFE_RELEASE(m_IndexBuffer);
@@ -472,8 +917,18 @@ namespace Core
 		SAFE_DELETE(m_TrimXSide);
 		SAFE_DELETE(m_TrimZSide);
 		SAFE_DELETE(m_ClipmapOffsets);
+		m_ClipRegions.Release();
+		m_ClipUpdates.Release();
 
 		m_Height.Release();
+		m_HeightBounds.Release();
+		m_Normals.Release();
+
+		SAFE_DELETE(m_pHeightTiles);
+		SAFE_DELETE(m_pLayerTiles);
+		m_StreamRegion.Release();
+		m_StreamLevel.Release();
+		m_StreamRows.Release();
 	}
 
 	
@@ -15,6 +15,11 @@
 #include "ThreadPool.h"
 #include "Effect.h"
 #include "Clipmap.h"
+#include "ClipmapRegions.h"
+#include "Heightmap.h"
+#include "BlendPyramid.h"
+#include "HeightBounds.h"
+#include "TerrainFile.h"
 
 namespace Core
 {
@@ -22,6 +27,15 @@ namespace Core
 
 #define CLIPMAP_LEVELS 8
 
+// Resident tile budget for each streamed terrain map
+#define TERRAIN_TILE_BUDGET 128
+
+// Height scale given to imported heightmaps
+#define TERRAIN_HEIGHT_SCALE 128.0f
+
+// Pixels a grid cell of the finest level drawn must cover on screen
+#define TERRAIN_LOD_ERROR 3.0f
+
 	// Perform sculpting
 	enum SCULPT_TYPE
 	{
@@ -36,6 +50,19 @@ namespace Core
 	};
 
 
+	// Clipmap drawing counters, reset each frame
+	struct TerrainRenderStats
+	{
+		int		FirstLevel;						// Finest level drawn
+		float	Fade;							// How far the finest level has morphed into the next
+		int		Blocks[CLIPMAP_LEVELS];			// Pieces drawn in each level
+		int		Culled[CLIPMAP_LEVELS];			// Pieces rejected in each level
+		int		Triangles[CLIPMAP_LEVELS];
+		TerrainRenderStats(){ Reset(); }
+		inline void Reset(){ memset(this, 0, sizeof(TerrainRenderStats)); }
+	};
+
+
 
 	
 	class Terrain : public WorkerThread
@@ -55,14 +82,28 @@ namespace Core
 		HRESULT Create(UINT size, Camera* pCam);
 		HRESULT CreateFromTexture(ID3D10Texture2D* pHeightmap,  ID3D10Texture2D* pBlendmap, Camera* pCam);
 
+		// Create a terrain that streams its heights and layers from tile files
+		HRESULT CreateFromTiles(const char* szFile, Camera* pCam);
+
+		// Create a terrain from a binary terrain file
+		HRESULT CreateFromBinary(const char* szFile, Camera* pCam);
+
 		// Internal data loading
 	private:
 		UINT LoadHeightMap(ID3D10Texture2D* pHeightmap,  ID3D10Texture2D* pBlendmap);
+		bool LoadLayerFile(const char* szFile);
 	public:
 
 		// Saving
 		void ExportHeightmap(char* file);
 
+		// Writes the heights and layers out as tile files for streaming
+		void ExportTiles(const char* szFile);
+
+		// Writes the heights, layers and layer setup to a binary terrain file, returns false
+		// if it couldn't be written
+		bool ExportBinary(const char* szFile, bool compress=true);
+
 		// Destroy the terrain
 		void Release();
 		
@@ -88,6 +129,29 @@ namespace Core
 		// Returns the heightfield
 		inline Array<D3DXFLOAT16>* GetHeightfield(){ return &m_Height; }
 
+		// Returns the scaled height at a heightmap texel
+		inline float GetHeight(int col, int row){
+			Math::Clamp(col, 0, m_Size-1);
+			Math::Clamp(row, 0, m_Size-1);
+			if(m_pHeightTiles)
+				return (float)*(const D3DXFLOAT16*)m_pHeightTiles->GetTexel(0, col, row) * m_HeightScale;
+			return (float)m_Height[row*m_Size+col];
+		}
+
+		// Returns the unit normal at a heightmap texel, straight up while streaming
+		inline D3DXVECTOR3 GetNormal(int col, int row){
+			if(m_Normals.IsEmpty())
+				return D3DXVECTOR3(0, 1, 0);
+			Math::Clamp(col, 0, m_Size-1);
+			Math::Clamp(row, 0, m_Size-1);
+			return DecodeNormal(m_Normals[row*m_Size+col]);
+		}
+
+		// Streaming
+		inline bool IsStreaming(){ return m_pHeightTiles!=NULL; }
+		inline const TileCacheStats* GetHeightTileStats(){ return m_pHeightTiles ? &m_pHeightTiles->GetStats() : NULL; }
+		inline const TileCacheStats* GetLayerTileStats(){ return m_pLayerTiles ? &m_pLayerTiles->GetStats() : NULL; }
+
 		// Sets the size scale (not working)
 		inline void SetScale(float f){ 
 			/*float d = 2.0f * ((f-m_Scale) / (m_Scale+f)); 
@@ -106,6 +170,13 @@ namespace Core
 		// Performs a ray intersection test with the terrain
 		bool RayIntersection(D3DXVECTOR3& rayPos, D3DXVECTOR3& rayDir, float& dist);
 
+		// Levels whose grid cells cover fewer pixels than this are skipped, 0 draws them all
+		inline void SetLODError(float pixels){ m_LODError = pixels; }
+		inline float GetLODError(){ return m_LODError; }
+
+		// Counters from the last Render()
+		inline const TerrainRenderStats& GetRenderStats(){ return m_RenderStats; }
+
 		
 	private:
 
@@ -116,6 +187,10 @@ namespace Core
 		int					m_Size;				// Heightmap dimensions
 		D3DXVECTOR3			m_vPos;				// Center of the heightmap
 		Array<D3DXFLOAT16>	m_Height;			// Height list
+		HeightBounds		m_HeightBounds;		// Min/max pyramid over m_Height
+		Array<PackedNormal>	m_Normals;			// Packed normals of m_Height, empty when streaming
+		TileCache*			m_pHeightTiles;		// Height source when streaming
+		TileCache*			m_pLayerTiles;		// Layer map source when streaming
 		D3DXMATRIX			m_WorldMatrix;		// World transform
 		bool				m_bInThread;		// True if the async thread is running
 		bool				m_bQueueThread;		// True if it needs to update again after the thread finishes
@@ -129,6 +204,26 @@ namespace Core
 		// Draws the full terrain
 		int Render(Effect& effect);
 
+		// Picks the finest level to draw and computes each level's morph factors
+		void SelectLevels();
+
+		// Sets the textures and constants for drawing a level
+		void BindLevel(Effect& effect, int level);
+
+		// Draws a piece of a level unless its box is culled, returns the triangles drawn.
+		// The extents are in grid cells of the level, relative to the grid offset.
+		int DrawPiece(Effect& effect, int level, const D3DXVECTOR2& gridOffset, float x0, float z0, float x1, float z1, int ib, int vb);
+
+		// Height range under a world space rect, grown by pad.  Returns false if the
+		// rect is off the terrain.
+		bool GetHeightRange(float x0, float z0, float x1, float z1, float pad, float& minHeight, float& maxHeight);
+
+		// LOD selection
+		float				m_LODError;			// Pixels per grid cell below which a level is skipped
+		int					m_FirstLevel;		// Finest level drawn this frame
+		D3DXVECTOR4			m_ClipmapMorph[CLIPMAP_LEVELS];	// Transition start, 1/width and fade of each level
+		TerrainRenderStats	m_RenderStats;
+
 #ifdef PHASE_DEBUG
 		// Draws the terrain in debug visualization
 		void RenderDebug(MeshObject& boxMesh, Effect& effect);
@@ -138,12 +233,27 @@ namespace Core
 		// (must set quad vertex buffer first)
 		void UpdateClipmaps(Effect& effect);
 
+		// Marks the clipmap texels built from a rect of the heightmap as dirty
+		void InvalidateClipmaps(const RECT& r);
+
+		// Copies the given rect of each layer pyramid level into the layer clipmap's base texture
+		void UploadLayerPyramid(const RECT* pRects);
+
+		// Fills part of a height clipmap level from the tiles
+		void StreamClipmap(int level, float scale, const ClipmapUpdate& update);
+		Array<D3DXFLOAT16>	m_StreamRegion;		// Tile texels under the level
+		Array<D3DXFLOAT16>	m_StreamLevel;		// Filtered level ready for upload
+		Array<float>		m_StreamRows;		// Two unpacked rows of the region
+
 		// Updates the world matrix
 		void UpdateWorldMatrix();
 
 		// Asyncronous updating
 		void UpdateBuffers();
 
+		// Regenerates the normals around a changed rect of m_Height, or all of them for NULL
+		void UpdateNormals(const RECT* pDirty);
+
 		// Updates the normals and height values in a new thread
 		inline void Update(){ 
 			if(m_bInThread){ 
@@ -214,12 +324,6 @@ private:
 			Layer(){ texMap=normalMap="None"; }
 		};
 
-		// Blendmap texel mapping
-		struct BlendTexel
-		{
-			UCHAR data[4];
-		};
-
 		// Sets up the texture arrays
 		void BuildTextureLayers(int res, int mips);
 		
@@ -276,6 +380,7 @@ private:
 		// Blendmaps
 		Clipmap		m_LayerMaps;
 		Clipmap		m_BlendMaps;
+		BlendPyramid	m_LayerPyramid;		// CPU copy of m_LayerMaps' base texture and mips
 
 		// The min and max heights
 		D3DXVECTOR2			m_HeightExtents;
@@ -294,6 +399,10 @@ private:
 		BYTE*			m_TrimZSide;
 		D3DXVECTOR2*	m_ClipmapOffsets;
 
+		// Toroidal update tracking
+		ClipmapRegions			m_ClipRegions;
+		Array<ClipmapUpdate>	m_ClipUpdates;
+
 		// Camera
 		Camera*			m_pCamera;
 
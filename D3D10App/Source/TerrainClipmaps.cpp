@@ -275,6 +275,7 @@ namespace Core
 
 					// Cached clipmap positions
 					m_ClipmapOffsets = new D3DXVECTOR2[m_ClipmapLevels-1];
+					m_ClipRegions.Create(m_ClipmapSize, m_ClipmapLevels-1);
 
 					// Create the clipmap height textures
 					DXGI_FORMAT* formats = new DXGI_FORMAT[m_ClipmapLevels-1];
@@ -299,11 +300,23 @@ namespace Core
 		g_pd3dDevice->RSSetViewports(1, &m_Clipmaps.GetViewport());
 
 		// Set the heightmap
-		Device::Effect->HeightmapVariable->SetResource(m_Heightmap.GetSRV()[0]);
+		if(!m_pHeightTiles)
+			Device::Effect->HeightmapVariable->SetResource(m_Heightmap.GetSRV()[0]);
+
+		// Pick the levels to draw this frame
+		SelectLevels();
 
 		// Update each level
 		float size = 1.0f;
 		D3DXVECTOR3 camPos(floorf(m_pCamera->GetPos().x), 0, floorf(m_pCamera->GetPos().z));
+
+		// Page in the tiles around the camera, counters are per frame
+		if(m_pHeightTiles)
+		{
+			m_pHeightTiles->ResetCounters();
+			m_pLayerTiles->ResetCounters();
+			m_pHeightTiles->Prefetch((int)camPos.x + m_Size/2, (int)camPos.z + m_Size/2, m_ClipmapSize/2+1);
+		}
 		for(int i=0; i<m_ClipmapLevels-1; i++, size*=2)
 		{
 			// Calculate the new position
@@ -322,35 +335,28 @@ namespace Core
 			m_ClipmapOffsets[i].y = (camPos.z)+(G2 - modY);
 
 			// Compute the trim locations
-			bool update = false;	
-			if(G2 - modX > G)
-			{
-				if(m_TrimXSide[i]==0)
-					update = true;
-				m_TrimXSide[i] = 1;
-			}
-			else
-			{
-				if(m_TrimXSide[i]==1)
-					update = true;
-				m_TrimXSide[i] = 0;
-			}
+			m_TrimXSide[i] = (G2 - modX > G) ? 1 : 0;
+			m_TrimZSide[i] = (G2 - modY > G) ? 1 : 0;
 
-			if(G2 - modY > G)
-			{
-				if(m_TrimZSide[i]==0)
-					update = true;
-				m_TrimZSide[i] = 1;
-			}
-			else
-			{
-				if(m_TrimZSide[i]==1)
-					update = true;
-				m_TrimZSide[i] = 0;
-			}
+			// Slide the level's window over the grid, the storage wraps so only
+			// the newly exposed texels need to be filled
+			if(m_FlagForUpdate)
+				m_ClipRegions.Invalidate(i);
+			m_ClipRegions.SetOrigin(i, (int)m_ClipmapOffsets[i].x/G - 1 - (N-1)/2, (int)m_ClipmapOffsets[i].y/G - 1 - (N-1)/2);
 
-			if(!update && !m_FlagForUpdate)
+			// Levels that aren't drawn keep their dirty rects until they are needed
+			if(i<m_FirstLevel || !m_ClipRegions.IsDirty(i))
 				continue;
+			m_ClipUpdates.Clear();
+			Device::FrameStats.ClipmapTexelsUpdated += m_ClipRegions.Flush(i, m_ClipUpdates);
+
+			// Streamed levels are filtered on the cpu
+			if(m_pHeightTiles)
+			{
+				for(int u=0; u<m_ClipUpdates.Size(); u++)
+					StreamClipmap(i, size, m_ClipUpdates[u]);
+				continue;
+			}
 
 			// Update!
 			effect.ClipmapOffsetVariable->SetFloatVector((float*)&m_ClipmapOffsets[i]);
@@ -359,27 +365,238 @@ namespace Core
 			effect.HeightmapSizeVariable->SetFloat((float)m_Size);
 			g_pd3dDevice->OMSetRenderTargets(1, &m_Clipmaps.GetRTV()[i], m_Clipmaps.GetDSV());
 			effect.Pass[PASS_CLIPMAP_UPDATE]->Apply(0);
-			g_pd3dDevice->Draw(6, 0);
+
+			// Draw into just the dirty texels, the shader works out which grid texel
+			// each wrapped texel holds
+			for(int u=0; u<m_ClipUpdates.Size(); u++)
+			{
+				D3D10_VIEWPORT vp = m_Clipmaps.GetViewport();
+				vp.TopLeftX = m_ClipUpdates[u].TexX;
+				vp.TopLeftY = m_ClipUpdates[u].TexY;
+				vp.Width = m_ClipUpdates[u].Width;
+				vp.Height = m_ClipUpdates[u].Height;
+				g_pd3dDevice->RSSetViewports(1, &vp);
+				g_pd3dDevice->Draw(6, 0);
+			}
 		}
 		m_FlagForUpdate = false;
 
 		// Update the blendmaps
-		m_LayerMaps.Update(m_pCamera->GetPos());
+		Device::FrameStats.ClipmapTexelsUpdated += m_LayerMaps.Update(m_pCamera->GetPos());
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Marks the clipmap texels built from a rect of the heightmap as dirty
+	//--------------------------------------------------------------------------------------
+	void Terrain::InvalidateClipmaps(const RECT& r)
+	{
+		// Each grid texel samples between the two heightmap texels before it
+		int half = m_Size/2;
+		for(int i=0, size=1; i<m_ClipmapLevels-1; i++, size*=2)
+		{
+			m_ClipRegions.Invalidate(i, Math::FloorDiv(r.left-half, size), Math::FloorDiv(r.top-half, size),
+				Math::FloorDiv(r.right-half, size)+2, Math::FloorDiv(r.bottom-half, size)+2);
+		}
 	}
 
 
 
 	//--------------------------------------------------------------------------------------
-	// Draws a clipmap level
+	// Fills part of a height clipmap level from the tiles.  This samples the same positions
+	// as PASS_CLIPMAP_UPDATE, but reads the matching mip of the tile pyramid so coarse
+	// levels only touch coarse tiles.
+	//--------------------------------------------------------------------------------------
+	void Terrain::StreamClipmap(int level, float scale, const ClipmapUpdate& update)
+	{
+		// Position of the first texel in the texel space of this mip, the same place
+		// PASS_CLIPMAP_UPDATE samples the heightmap
+		float sx = update.GridX + m_Size/(2.0f*scale) - 0.5f;
+		float sy = update.GridY + m_Size/(2.0f*scale) - 0.5f;
+		int x0 = (int)floorf(sx);
+		int y0 = (int)floorf(sy);
+		float fx = sx - x0;
+		float fy = sy - y0;
+		int W = update.Width+1;
+		int H = update.Height+1;
+
+		// Every texel shares the same bilinear weights, so read the texels under the
+		// update once and filter them
+		D3DXFLOAT16* pRegion = (D3DXFLOAT16*)m_StreamRegion;
+		m_pHeightTiles->ReadRegion(level, x0, y0, W, H, pRegion, W*sizeof(D3DXFLOAT16));
+
+		float* pRows[2] = { (float*)m_StreamRows, (float*)m_StreamRows + W };
+		D3DXFLOAT16* pOut = (D3DXFLOAT16*)m_StreamLevel;
+		D3DXFloat16To32Array(pRows[0], pRegion, W);
+		for(int y=0; y<update.Height; y++)
+		{
+			D3DXFloat16To32Array(pRows[1], pRegion + (y+1)*W, W);
+			const float* r0 = pRows[0];
+			const float* r1 = pRows[1];
+
+			// The filtered row can overwrite the upper row, it isn't needed again
+			for(int x=0; x<update.Width; x++)
+			{
+				float top = r0[x] + (r0[x+1]-r0[x])*fx;
+				float bottom = r1[x] + (r1[x+1]-r1[x])*fx;
+				pRows[0][x] = top + (bottom-top)*fy;
+			}
+			D3DXFloat32To16Array(pOut + y*update.Width, pRows[0], update.Width);
+
+			float* pTemp = pRows[0];
+			pRows[0] = pRows[1];
+			pRows[1] = pTemp;
+		}
+
+		D3D10_BOX destRegion;
+		destRegion.left = update.TexX;
+		destRegion.right = update.TexX + update.Width;
+		destRegion.top = update.TexY;
+		destRegion.bottom = update.TexY + update.Height;
+		destRegion.front = 0;
+		destRegion.back = 1;
+		g_pd3dDevice->UpdateSubresource(m_Clipmaps.GetTex()[level], 0, &destRegion, pOut, update.Width*sizeof(D3DXFLOAT16), 0);
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Picks the finest level worth drawing.  Each level's grid cells are projected at the
+	// closest the terrain under the level gets to the camera, and levels whose cells cover
+	// fewer than m_LODError pixels are skipped.  The finest level left fades into the next
+	// one as it nears the threshold so it doesn't pop when it is dropped.
+	//--------------------------------------------------------------------------------------
+	void Terrain::SelectLevels()
+	{
+		// Transitions to the next coarser level at the edge of each level
+		for(int level=0, size=1; level<m_ClipmapLevels-1; level++, size*=2)
+		{
+			float width = (m_ClipmapSize*size) / 10.0f;
+			m_ClipmapMorph[level] = D3DXVECTOR4((m_ClipmapSize*size-1)*0.5f - width - 1, 1.0f/width, 0, 0);
+		}
+
+		m_FirstLevel = 0;
+		if(m_LODError<=0 || !m_pCamera)
+			return;
+
+		// Pixels covered by a unit at unit distance
+		float pixels = m_pCamera->BackBufferHeight() / (2.0f*tanf(m_pCamera->GetFOV()*0.5f));
+		const D3DXVECTOR3& camPos = m_pCamera->GetPos();
+		for(int level=0, size=1; level<m_ClipmapLevels-1; level++, size*=2)
+		{
+			// Levels that are off the terrain don't draw anything anyway
+			float half = (float)(size*(2*m_BlockSize+2));
+			float minHeight, maxHeight;
+			if(!GetHeightRange(camPos.x-half, camPos.z-half, camPos.x+half, camPos.z+half, 0, minHeight, maxHeight) &&
+				level<m_ClipmapLevels-2)
+				continue;
+
+			// The camera is below the highest point, keep everything from here
+			float dist = camPos.y - maxHeight;
+			m_FirstLevel = level;
+			if(dist<=0)
+				break;
+			float cell = size*pixels/dist;
+			if(cell>=m_LODError || level==m_ClipmapLevels-2)
+			{
+				float fade = (2*m_LODError - cell) / m_LODError;
+				m_ClipmapMorph[level].z = Math::Clamp(fade, 0.0f, 1.0f);
+				break;
+			}
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Height range under a world space rect
+	//--------------------------------------------------------------------------------------
+	bool Terrain::GetHeightRange(float x0, float z0, float x1, float z1, float pad, float& minHeight, float& maxHeight)
+	{
+		float half = m_Size*0.5f;
+		if(x1<-half || z1<-half || x0>half || z0>half)
+			return false;
+
+		// Streamed terrains only know their full range
+		if(!m_HeightBounds.IsCreated())
+		{
+			minHeight = m_HeightExtents.x;
+			maxHeight = m_HeightExtents.y;
+			return true;
+		}
+		return m_HeightBounds.GetRange((int)floorf(x0-pad+half), (int)floorf(z0-pad+half),
+			(int)ceilf(x1+pad+half)+1, (int)ceilf(z1+pad+half)+1, minHeight, maxHeight);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Sets the textures and constants for drawing a level
+	//--------------------------------------------------------------------------------------
+	void Terrain::BindLevel(Effect& effect, int level)
+	{
+		// Set the level size
+		effect.ClipmapScaleVariable->SetFloat((float)(1<<level));
+
+		// Bind the clipmaps as textures
+		effect.ClipmapVariable->SetResource(m_Clipmaps.GetSRV()[level]);
+		effect.BlendClipmapVariable->SetResource(m_LayerMaps.GetClipmaps().GetSRV()[level]);
+
+		// Set the offset and transitions
+		effect.ClipmapFixVariable->SetFloatVector((float*)&m_ClipmapOffsets[level]);
+		effect.ClipmapMorphVariable->SetFloatVector((float*)&m_ClipmapMorph[level]);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Draws a piece of a level if its box is visible
+	//--------------------------------------------------------------------------------------
+	int Terrain::DrawPiece(Effect& effect, int level, const D3DXVECTOR2& gridOffset, float x0, float z0, float x1, float z1, int ib, int vb)
+	{
+		// World space footprint, the vertex shader moves every piece by the level's fix offset
+		float size = (float)(1<<level);
+		D3DXVECTOR2 origin = m_ClipmapOffsets[level] + gridOffset;
+		x0 = origin.x + x0*size;
+		x1 = origin.x + x1*size;
+		z0 = origin.y + z0*size;
+		z1 = origin.y + z1*size;
+
+		// The clipmap texels are filtered from their neighbors, and the transitions
+		// sample the next level, so allow a couple of texels around the piece
+		float minHeight, maxHeight;
+		if(!GetHeightRange(x0, z0, x1, z1, 2*size, minHeight, maxHeight))
+		{
+			m_RenderStats.Culled[level]++;
+			return 0;
+		}
+		D3DXVECTOR3 center((x0+x1)*0.5f, (minHeight+maxHeight)*0.5f, (z0+z1)*0.5f);
+		D3DXVECTOR3 bounds((x1-x0)*0.5f, (maxHeight-minHeight)*0.5f, (z1-z0)*0.5f);
+		if(!m_pCamera->GetFrustum().CheckRectangle(center, bounds))
+		{
+			m_RenderStats.Culled[level]++;
+			return 0;
+		}
+
+		// Draw the patch
+		effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
+		effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
+		g_pd3dDevice->DrawIndexed(m_IBCount[ib], m_IBOffsets[ib], m_VBOffsets[vb]);
+		m_RenderStats.Blocks[level]++;
+		m_RenderStats.Triangles[level] += m_IBCount[ib]/3;
+		return m_IBCount[ib]/3;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Draws the clipmap levels, starting from the finest one picked by SelectLevels()
 	//--------------------------------------------------------------------------------------
 	int Terrain::Render(Effect& effect)
 	{
+		m_RenderStats.Reset();
+		m_RenderStats.FirstLevel = m_FirstLevel;
+		m_RenderStats.Fade = m_ClipmapMorph[m_FirstLevel].z;
+
 		// Used for offsetting the building blocks
 		D3DXVECTOR2 gridOffset;
-		D3DXVECTOR3 blockBounds, cullPos, cullBounds;
-
-		// Just for a little optimizing (not worth it i know :)
-		const float b2 = m_BlockSize*0.5f;
+		const float B = (float)m_BlockSize;
 
 		// Discrete camera location in the grid
 		D3DXVECTOR3 camPos(floorf(m_pCamera->GetPos().x), 0, floorf(m_pCamera->GetPos().z));
@@ -388,194 +605,83 @@ namespace Core
 		effect.HeightmapSizeVariable->SetFloat((float)m_Size);
 		effect.HeightmapScaleVariable->SetFloat(m_HeightScale);
 
-		// Compute the height bounds
-		float hCenter = (m_HeightExtents.y-m_HeightExtents.x)*0.5f;
-		float hMax = m_HeightExtents.y-hCenter;
-
 		// Set the texture layers
 		BindTextures(effect);
 
 		// Keep track of poly count
 		int polyCount = 0;
 
-		// Patch size
-		float size = 1;
-
-		// The finest level is different
+		// The finest level drawn also fills the hole in the middle
 		{
-			// Bind the clipmaps as textures
-			effect.ClipmapVariable->SetResource(m_Clipmaps.GetSRV()[0]);
-			effect.BlendClipmapVariable->SetResource(m_LayerMaps.GetClipmaps().GetSRV()[0]);
-
-			// Set the patch size
-			effect.ClipmapScaleVariable->SetFloat(size);
-
-			effect.ClipmapFixVariable->SetFloatVector((float*)&m_ClipmapOffsets[0]);
+			int level = m_FirstLevel;
+			float size = (float)(1<<level);
+			BindLevel(effect, level);
 
-			// Offset
+			// Offset, from the camera position on the level's grid
 			D3DXVECTOR2 offsetTrim;
-			int modX = (int)camPos.x % 2;
-			int modY = (int)camPos.z % 2;
+			int modX = Math::FloorDiv((int)camPos.x, 1<<level) % 2;
+			int modY = Math::FloorDiv((int)camPos.z, 1<<level) % 2;
 			modX += modX < 0 ? 2 : 0;
 			modY += modY < 0 ? 2 : 0;
-			offsetTrim.x = modX-2;
-			offsetTrim.y = modY-2;
+			offsetTrim.x = (float)(modX-2);
+			offsetTrim.y = (float)(modY-2);
 
-			//------------
 			// Draw the trim
-
-			// Set the patch offset position
-			gridOffset = offsetTrim + D3DXVECTOR2(1-m_BlockSize, m_BlockSize);
-			effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-
-			// Draw the trim
-			effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-			g_pd3dDevice->DrawIndexed(m_IBCount[IB_CENTER_TRIM], m_IBOffsets[IB_CENTER_TRIM], m_VBOffsets[VB_CENTER_TRIM]);
-			polyCount += m_IBCount[IB_CENTER_TRIM]/3;
-
-
-			//------------
-			// Draw the blocks
+			gridOffset = (offsetTrim + D3DXVECTOR2(1-B, B))*size;
+			polyCount += DrawPiece(effect, level, gridOffset, 0, 1-2*B, 2*B-1, 0, IB_CENTER_TRIM, VB_CENTER_TRIM);
 
 			// Block positions
 			D3DXVECTOR2 offsets[4];
 			offsets[0] = D3DXVECTOR2(1, 1);
-			offsets[1] = D3DXVECTOR2(2-m_BlockSize, 1);
-			offsets[2] = D3DXVECTOR2(1, 2-m_BlockSize);
-			offsets[3] = D3DXVECTOR2(2-m_BlockSize, 2-m_BlockSize);
+			offsets[1] = D3DXVECTOR2(2-B, 1);
+			offsets[2] = D3DXVECTOR2(1, 2-B);
+			offsets[3] = D3DXVECTOR2(2-B, 2-B);
 
 			// 4 blocks
-			blockBounds = D3DXVECTOR3(m_BlockSize, hMax, m_BlockSize);
-			cullBounds = blockBounds*0.5f;
 			for(int i=0; i<4; i++)
 			{
-				// Set the patch offset position
-				gridOffset = offsetTrim + D3DXVECTOR2(offsets[i].x, offsets[i].y + (m_BlockSize-1)-1);
-				if(m_pCamera->GetFrustum().CheckRectangle(camPos+D3DXVECTOR3(gridOffset.x + b2, hCenter, gridOffset.y - b2), blockBounds))
-				{
-					// Draw the patch
-					effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-					effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_BLOCK], m_IBOffsets[IB_BLOCK], m_VBOffsets[VB_BLOCK]);
-					polyCount += m_IBCount[IB_BLOCK]/3;
-				}
+				gridOffset = (offsetTrim + D3DXVECTOR2(offsets[i].x, offsets[i].y + (B-1)-1))*size;
+				polyCount += DrawPiece(effect, level, gridOffset, 0, 1-B, B-1, 0, IB_BLOCK, VB_BLOCK);
 			}
 		}
 
-		// Render the coarser levels
-		for(int level=0, size=1; level<m_ClipmapLevels-1; level++, size*=2)
+		// Render the rings around it
+		for(int level=m_FirstLevel; level<m_ClipmapLevels-1; level++)
 		{
-			// Set the level size
-			effect.ClipmapScaleVariable->SetFloat(size);
-
-			// Bind the clipmaps as textures
-			effect.ClipmapVariable->SetResource(m_Clipmaps.GetSRV()[level]);
-			effect.BlendClipmapVariable->SetResource(m_LayerMaps.GetClipmaps().GetSRV()[level]);
-
-			// Set the offset
-			effect.ClipmapFixVariable->SetFloatVector((float*)&m_ClipmapOffsets[level]);
+			float size = (float)(1<<level);
+			BindLevel(effect, level);
 
 			// Draw the trim
-			{
-				// Trim offset
-				gridOffset = D3DXVECTOR2(-size*(m_BlockSize+1), size*(m_BlockSize-1));					
-
-				// Draw the trim
-				effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-				effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-				if(m_TrimZSide[level]==1 && m_TrimXSide[level]==0)
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_TRIM], m_IBOffsets[IB_TRIM], m_VBOffsets[VB_TRIM_TL]);
-				else if(m_TrimZSide[level]==1 && m_TrimXSide[level]==1)
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_TRIM], m_IBOffsets[IB_TRIM], m_VBOffsets[VB_TRIM_TR]);
-				else if(m_TrimZSide[level]==0 && m_TrimXSide[level]==1)
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_TRIM], m_IBOffsets[IB_TRIM], m_VBOffsets[VB_TRIM_BR]);
-				else
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_TRIM], m_IBOffsets[IB_TRIM], m_VBOffsets[VB_TRIM_BL]);
-				polyCount += m_IBCount[IB_TRIM]/3;
-			}
+			int vb;
+			if(m_TrimZSide[level]==1 && m_TrimXSide[level]==0)
+				vb = VB_TRIM_TL;
+			else if(m_TrimZSide[level]==1 && m_TrimXSide[level]==1)
+				vb = VB_TRIM_TR;
+			else if(m_TrimZSide[level]==0 && m_TrimXSide[level]==1)
+				vb = VB_TRIM_BR;
+			else
+				vb = VB_TRIM_BL;
+			gridOffset = D3DXVECTOR2(-size*(B+1), size*(B-1));
+			polyCount += DrawPiece(effect, level, gridOffset, 0, -2*B, 2*B, 1, IB_TRIM, vb);
 
 			// Draw the blocks
-			blockBounds = D3DXVECTOR3(m_BlockSize*size, hMax, m_BlockSize*size);
-			cullBounds = blockBounds*0.5f;
-			float b2s = b2*size;
 			for(int i=0; i<12; i++)
 			{
-				// Set the patch offset position
-				gridOffset = D3DXVECTOR2(size*(m_BlockOffsets[i].x-2), size*(m_BlockOffsets[i].y+m_BlockSize-1));
-
-				// Draw the patch if it is visible and contained inside the terrain bounds
-				cullPos = camPos+D3DXVECTOR3(gridOffset.x+b2s, hCenter, gridOffset.y-b2s);
-				if(m_pCamera->GetFrustum().CheckRectangle(cullPos, blockBounds) &&
-					!( cullPos.x-cullBounds.x > m_Size/2 || cullPos.x+cullBounds.x < -m_Size/2 ||
-					cullPos.z-cullBounds.z > m_Size/2 || cullPos.z+cullBounds.z < -m_Size/2 ))
-				{
-					effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-					effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_BLOCK], m_IBOffsets[IB_BLOCK], m_VBOffsets[VB_BLOCK]);
-					polyCount += m_IBCount[IB_BLOCK]/3;
-				}
-			}
-
-
-			// Draw the ring fix strips
-			{
-				// Left
-				gridOffset = D3DXVECTOR2(-2*size*m_BlockSize, 0);
-				blockBounds = D3DXVECTOR3(m_BlockSize*size, hMax, 6*size);
-				cullBounds = blockBounds*0.5f;
-				cullPos = camPos+D3DXVECTOR3(gridOffset.x + b2s, hCenter, gridOffset.y);
-				if(m_pCamera->GetFrustum().CheckRectangle(cullPos, blockBounds) &&
-					!( cullPos.x-cullBounds.x > m_Size/2 || cullPos.x+cullBounds.x < -m_Size/2 ||
-					cullPos.z-cullBounds.z > m_Size/2 || cullPos.z+cullBounds.z < -m_Size/2 ))
-				{
-					effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-					effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_RING1], m_IBOffsets[IB_RING1], m_VBOffsets[VB_RING1]);
-					polyCount += m_IBCount[IB_RING1]/3;
-				}
-
-				// Right
-				gridOffset = D3DXVECTOR2(size*(m_BlockSize-1), 0);
-				cullPos = camPos+D3DXVECTOR3(gridOffset.x +b2s, hCenter, gridOffset.y);
-				if(m_pCamera->GetFrustum().CheckRectangle(cullPos, blockBounds) &&
-					!( cullPos.x-cullBounds.x > m_Size/2 || cullPos.x+cullBounds.x < -m_Size/2 ||
-					cullPos.z-cullBounds.z > m_Size/2 || cullPos.z+cullBounds.z < -m_Size/2 ))
-				{
-					effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-					effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_RING1], m_IBOffsets[IB_RING1], m_VBOffsets[VB_RING1]);
-					polyCount += m_IBCount[IB_RING1]/3;
-				}
-
-				// Top
-				gridOffset = D3DXVECTOR2(-2*size, 2*size*(m_BlockSize-1));
-				blockBounds = D3DXVECTOR3(6*size, hMax, m_BlockSize*size);
-				cullBounds = blockBounds*0.5f;
-				cullPos = camPos+D3DXVECTOR3(gridOffset.x+1.5f*size, hCenter, gridOffset.y - b2s);
-				if(m_pCamera->GetFrustum().CheckRectangle(cullPos, blockBounds) &&
-					!( cullPos.x-cullBounds.x > m_Size/2 || cullPos.x+cullBounds.x < -m_Size/2 ||
-					cullPos.z-cullBounds.z > m_Size/2 || cullPos.z+cullBounds.z < -m_Size/2 ))
-				{
-					effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-					effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_RING2], m_IBOffsets[IB_RING2], m_VBOffsets[VB_RING2]);
-					polyCount += m_IBCount[IB_RING2]/3;
-				}
-
-				// Bottom
-				gridOffset = D3DXVECTOR2(-2*size, -size*(m_BlockSize+1));
-				cullPos = camPos+D3DXVECTOR3(gridOffset.x+1.5f*size, hCenter, gridOffset.y - b2s);
-				if(m_pCamera->GetFrustum().CheckRectangle(cullPos, blockBounds) &&
-					!( cullPos.x-cullBounds.x > m_Size/2 || cullPos.x+cullBounds.x < -m_Size/2 ||
-					cullPos.z-cullBounds.z > m_Size/2 || cullPos.z+cullBounds.z < -m_Size/2 ))
-				{
-					effect.ClipmapOffsetVariable->SetFloatVector((float*)&gridOffset);
-					effect.Pass[PASS_GBUFFER_TERRAIN]->Apply(0);
-					g_pd3dDevice->DrawIndexed(m_IBCount[IB_RING2], m_IBOffsets[IB_RING2], m_VBOffsets[VB_RING2]);
-					polyCount += m_IBCount[IB_RING2]/3;
-				}
+				gridOffset = D3DXVECTOR2(size*(m_BlockOffsets[i].x-2), size*(m_BlockOffsets[i].y+B-1));
+				polyCount += DrawPiece(effect, level, gridOffset, 0, 1-B, B-1, 0, IB_BLOCK, VB_BLOCK);
 			}
 
+			// Draw the ring fix strips, left and right
+			gridOffset = D3DXVECTOR2(-2*size*B, 0);
+			polyCount += DrawPiece(effect, level, gridOffset, 0, -2, B-1, 0, IB_RING1, VB_RING1);
+			gridOffset = D3DXVECTOR2(size*(B-1), 0);
+			polyCount += DrawPiece(effect, level, gridOffset, 0, -2, B-1, 0, IB_RING1, VB_RING1);
+
+			// Top and bottom
+			gridOffset = D3DXVECTOR2(-2*size, 2*size*(B-1));
+			polyCount += DrawPiece(effect, level, gridOffset, 0, 1-B, 2, 0, IB_RING2, VB_RING2);
+			gridOffset = D3DXVECTOR2(-2*size, -size*(B+1));
+			polyCount += DrawPiece(effect, level, gridOffset, 0, 1-B, 2, 0, IB_RING2, VB_RING2);
 		}
 		return polyCount;
 	}
@@ -43,12 +43,10 @@ namespace Core
 			for(int x=minBounds.x; x<maxBounds.x; x++)
 			{
 				// Form a quad at this location
-				int index = y*m_Size+x;
-
 				// Check the first triangle				
-				tri[0] = D3DXVECTOR3(x, (float)m_Height[index], y) + offset;
-				tri[1] = D3DXVECTOR3(x+1, (float)m_Height[index+1], y) + offset;
-				tri[2] = D3DXVECTOR3(x+1, (float)m_Height[index+m_Size+1], y+1) + offset;
+				tri[0] = D3DXVECTOR3(x, GetHeight(x, y), y) + offset;
+				tri[1] = D3DXVECTOR3(x+1, GetHeight(x+1, y), y) + offset;
+				tri[2] = D3DXVECTOR3(x+1, GetHeight(x+1, y+1), y+1) + offset;
 				if(D3DXIntersectTri(&tri[0], &tri[1], &tri[2], &rayPos, &rayDir, &u, &v, &t) && t<dist)
 				{
 					dist = t;
@@ -56,9 +54,9 @@ namespace Core
 				}
 
 				// Check the 2nd triangle
-				tri[0] = D3DXVECTOR3(x+1, (float)m_Height[index+m_Size+1], y+1) + offset;
-				tri[1] = D3DXVECTOR3(x, (float)m_Height[index+m_Size], y+1) + offset;
-				tri[2] = D3DXVECTOR3(x, (float)m_Height[index], y) + offset;
+				tri[0] = D3DXVECTOR3(x+1, GetHeight(x+1, y+1), y+1) + offset;
+				tri[1] = D3DXVECTOR3(x, GetHeight(x, y+1), y+1) + offset;
+				tri[2] = D3DXVECTOR3(x, GetHeight(x, y), y) + offset;
 				if(D3DXIntersectTri(&tri[0], &tri[1], &tri[2], &rayPos, &rayDir, &u, &v, &t) && t<dist)
 				{
 					dist = t;
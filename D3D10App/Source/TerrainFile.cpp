@@ -0,0 +1,629 @@
+//--------------------------------------------------------------------------------------
+// File: TerrainFile.cpp
+//
+// Binary terrain container
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "TerrainFile.h"
+#include <float.h>
+
+namespace Core
+{
+
+// Tables and chunks start on this boundary
+#define TERRAIN_FILE_ALIGN 16
+
+	// Bytes per texel of each stream
+	static const int g_StreamTexelSize[TERRAIN_STREAM_COUNT] = { sizeof(D3DXFLOAT16), sizeof(BlendTexel) };
+
+	static inline UINT AlignOffset(UINT offset){ return (offset + TERRAIN_FILE_ALIGN-1) & ~(TERRAIN_FILE_ALIGN-1); }
+
+
+	//--------------------------------------------------------------------------------------
+	// Varints, 7 bits per byte with the high bit set on all but the last byte
+	//--------------------------------------------------------------------------------------
+	static inline BYTE* PutVarint(BYTE* p, UINT v)
+	{
+		while(v>=0x80)
+		{
+			*p++ = (BYTE)(v | 0x80);
+			v >>= 7;
+		}
+		*p++ = (BYTE)v;
+		return p;
+	}
+
+	static inline bool GetVarint(const BYTE*& p, const BYTE* pEnd, UINT& v)
+	{
+		v = 0;
+		for(int shift=0; shift<32; shift+=7)
+		{
+			if(p>=pEnd)
+				return false;
+			BYTE b = *p++;
+			v |= (UINT)(b & 0x7F) << shift;
+			if(!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Gradient predictor for 16 bit texels, wraps like the stored bits do
+	//--------------------------------------------------------------------------------------
+	static inline WORD PredictTexel(const WORD* pRow, const WORD* pUp, int x, int y)
+	{
+		if(y==0)
+			return x ? pRow[x-1] : 0;
+		if(x==0)
+			return pUp[0];
+		return (WORD)(pRow[x-1] + pUp[x] - pUp[x-1]);
+	}
+
+	int TerrainFile::EncodeDelta16(const WORD* pSrc, int w, int h, BYTE* pDest, int maxBytes)
+	{
+		BYTE* p = pDest;
+		BYTE* pEnd = pDest + maxBytes;
+		for(int y=0; y<h; y++)
+		{
+			const WORD* pRow = pSrc + y*w;
+			const WORD* pUp = y ? pRow - w : NULL;
+			for(int x=0; x<w; x++)
+			{
+				if(pEnd-p < 3)
+					return 0;
+				int r = (short)(WORD)(pRow[x] - PredictTexel(pRow, pUp, x, y));
+				p = PutVarint(p, (UINT)((r << 1) ^ (r >> 31)) & 0xFFFF);
+			}
+		}
+		return (int)(p-pDest);
+	}
+
+	bool TerrainFile::DecodeDelta16(const BYTE* pSrc, int bytes, WORD* pDest, int pitch, int w, int h)
+	{
+		const BYTE* pEnd = pSrc + bytes;
+		for(int y=0; y<h; y++)
+		{
+			WORD* pRow = pDest + y*pitch;
+			const WORD* pUp = y ? pRow - pitch : NULL;
+			for(int x=0; x<w; x++)
+			{
+				UINT z;
+				if(!GetVarint(pSrc, pEnd, z) || z>0xFFFF)
+					return false;
+				int r = (int)(z >> 1) ^ -(int)(z & 1);
+				pRow[x] = (WORD)(PredictTexel(pRow, pUp, x, y) + r);
+			}
+		}
+		return pSrc==pEnd;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Runs of repeated 32 bit texels.  Each token is a varint, odd tokens are a run of
+	// (token>>1)+1 copies of the next texel, even tokens are that many literal texels.
+	//--------------------------------------------------------------------------------------
+	static inline BYTE* PutLiterals(BYTE* p, BYTE* pEnd, const DWORD* pSrc, int count)
+	{
+		if(!p || count==0)
+			return p;
+		if(pEnd-p < 5+count*4)
+			return NULL;
+		p = PutVarint(p, (UINT)(count-1) << 1);
+		memcpy(p, pSrc, count*4);
+		return p + count*4;
+	}
+
+	int TerrainFile::EncodeRun32(const DWORD* pSrc, int count, BYTE* pDest, int maxBytes)
+	{
+		BYTE* p = pDest;
+		BYTE* pEnd = pDest + maxBytes;
+		int i = 0, literalStart = 0;
+		while(i<count && p)
+		{
+			int run = 1;
+			while(i+run<count && pSrc[i+run]==pSrc[i])
+				run++;
+
+			// Short repeats are cheaper as literals
+			if(run<3)
+			{
+				i += run;
+				continue;
+			}
+			p = PutLiterals(p, pEnd, pSrc+literalStart, i-literalStart);
+			if(!p || pEnd-p < 9)
+				return 0;
+			p = PutVarint(p, ((UINT)(run-1) << 1) | 1);
+			memcpy(p, pSrc+i, 4);
+			p += 4;
+			i += run;
+			literalStart = i;
+		}
+		p = PutLiterals(p, pEnd, pSrc+literalStart, count-literalStart);
+		return p ? (int)(p-pDest) : 0;
+	}
+
+	bool TerrainFile::DecodeRun32(const BYTE* pSrc, int bytes, DWORD* pDest, int pitch, int w, int h)
+	{
+		const BYTE* pEnd = pSrc + bytes;
+		int x = 0, y = 0;
+		int remaining = w*h;
+		while(remaining>0)
+		{
+			UINT token;
+			if(!GetVarint(pSrc, pEnd, token))
+				return false;
+			int count = (int)(token >> 1) + 1;
+			bool run = (token & 1)!=0;
+			if(count>remaining || pEnd-pSrc < (run ? 4 : count*4))
+				return false;
+			remaining -= count;
+
+			DWORD texel = 0;
+			if(run)
+			{
+				memcpy(&texel, pSrc, 4);
+				pSrc += 4;
+			}
+			while(count>0)
+			{
+				// Fill up to the end of the row
+				int span = Math::Min(count, w-x);
+				DWORD* pOut = pDest + y*pitch + x;
+				if(run)
+				{
+					for(int i=0; i<span; i++)
+						pOut[i] = texel;
+				}
+				else
+				{
+					memcpy(pOut, pSrc, span*4);
+					pSrc += span*4;
+				}
+				count -= span;
+				x += span;
+				if(x==w)
+				{
+					x = 0;
+					y++;
+				}
+			}
+		}
+		return pSrc==pEnd;
+	}
+
+
+
+	//--------------------------------------------------------------------------------------
+	// Pads the file up to an aligned offset and writes a block there
+	//--------------------------------------------------------------------------------------
+	static void WriteAt(FILE* fp, ULONGLONG& pos, ULONGLONG offset, const void* pData, UINT bytes)
+	{
+		static const BYTE pad[TERRAIN_FILE_ALIGN] = { 0 };
+		fwrite(pad, (size_t)(offset-pos), 1, fp);
+		fwrite(pData, bytes, 1, fp);
+		pos = offset + bytes;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Compresses the chunks of both streams in parallel
+	//--------------------------------------------------------------------------------------
+	struct EncodeData
+	{
+		const TerrainFileDesc*	pDesc;
+		int						chunksPerSide;
+		int						cellsPerSide;
+		BYTE**					ppData;		// Per stream per chunk
+		int*					pBytes;
+		DWORD*					pCodec;
+		float*					pMinMax;	// Per pyramid cell
+	};
+
+	static void EncodeChunkJob(int start, int end, void* pData)
+	{
+		EncodeData& e = *(EncodeData*)pData;
+		const TerrainFileDesc& desc = *e.pDesc;
+		int numChunks = e.chunksPerSide*e.chunksPerSide;
+		float* pRow = new float[desc.ChunkSize];
+		for(int k=start; k<end; k++)
+		{
+			int cx = k % e.chunksPerSide;
+			int cy = k / e.chunksPerSide;
+			int w = Math::Min(desc.ChunkSize, desc.Size - cx*desc.ChunkSize);
+			int h = Math::Min(desc.ChunkSize, desc.Size - cy*desc.ChunkSize);
+			for(int s=0; s<TERRAIN_STREAM_COUNT; s++)
+			{
+				// Gather the chunk into contiguous rows
+				int texelSize = g_StreamTexelSize[s];
+				int rawBytes = w*h*texelSize;
+				const BYTE* pImage = (s==TERRAIN_STREAM_HEIGHT) ? (const BYTE*)desc.pHeights : (const BYTE*)desc.pLayers;
+				int pitch = (s==TERRAIN_STREAM_HEIGHT) ? desc.HeightPitch : desc.LayerPitch;
+				BYTE* pRaw = new BYTE[rawBytes];
+				for(int y=0; y<h; y++)
+					memcpy(pRaw + y*w*texelSize, pImage + (cy*desc.ChunkSize+y)*pitch + cx*desc.ChunkSize*texelSize, w*texelSize);
+
+				// Height range of the pyramid cells in the chunk, which start on a cell boundary
+				if(s==TERRAIN_STREAM_HEIGHT)
+				{
+					int cellSize = desc.PyramidCell;
+					int cells = (w+cellSize-1)/cellSize;
+					for(int y=0; y<h; y++)
+					{
+						float* pRange = e.pMinMax + ((cy*desc.ChunkSize+y)/cellSize*e.cellsPerSide + cx*desc.ChunkSize/cellSize)*2;
+						if(y%cellSize==0)
+						{
+							for(int i=0; i<cells; i++)
+							{
+								pRange[i*2] = FLT_MAX;
+								pRange[i*2+1] = -FLT_MAX;
+							}
+						}
+						D3DXFloat16To32Array(pRow, (const D3DXFLOAT16*)pRaw + y*w, w);
+						for(int x=0; x<w; x++)
+						{
+							float* p = pRange + (x/cellSize)*2;
+							p[0] = Math::Min(p[0], pRow[x]);
+							p[1] = Math::Max(p[1], pRow[x]);
+						}
+					}
+				}
+
+				// Keep whichever is smaller
+				int slot = s*numChunks + k;
+				e.ppData[slot] = pRaw;
+				e.pBytes[slot] = rawBytes;
+				e.pCodec[slot] = TERRAIN_CODEC_RAW;
+				if(!desc.Compress)
+					continue;
+				BYTE* pPacked = new BYTE[rawBytes];
+				int packed = (s==TERRAIN_STREAM_HEIGHT) ?
+					TerrainFile::EncodeDelta16((const WORD*)pRaw, w, h, pPacked, rawBytes-1) :
+					TerrainFile::EncodeRun32((const DWORD*)pRaw, w*h, pPacked, rawBytes-1);
+				if(packed>0)
+				{
+					delete[] pRaw;
+					e.ppData[slot] = pPacked;
+					e.pBytes[slot] = packed;
+					e.pCodec[slot] = (s==TERRAIN_STREAM_HEIGHT) ? TERRAIN_CODEC_DELTA16 : TERRAIN_CODEC_RUN32;
+				}
+				else
+					delete[] pPacked;
+			}
+		}
+		delete[] pRow;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	TerrainFile::TerrainFile()
+	{
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+		m_pView = NULL;
+		m_FileSize = 0;
+		m_pHeader = NULL;
+		m_pLayers = NULL;
+		m_pPyramid = NULL;
+		m_pChunks = NULL;
+		m_PyramidStart = NULL;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Writes a terrain file
+	//--------------------------------------------------------------------------------------
+	bool TerrainFile::Write(const char* szFile, const TerrainFileDesc& desc)
+	{
+		if(desc.Size<=0 || desc.Size>TERRAIN_FILE_MAX_SIZE || desc.ChunkSize<=0 || !Math::IsPowerOf2(desc.PyramidCell) ||
+			desc.ChunkSize%desc.PyramidCell!=0 || !desc.pHeights || !desc.pLayers || desc.LayerCount>TERRAIN_FILE_LAYERS)
+		{
+			Log::Print("TerrainFile::Write() invalid terrain> %s", szFile);
+			return false;
+		}
+
+		// Compress everything up front
+		int n = (desc.Size + desc.ChunkSize-1) / desc.ChunkSize;
+		int numChunks = n*n;
+		EncodeData e;
+		e.pDesc = &desc;
+		e.chunksPerSide = n;
+		e.cellsPerSide = (desc.Size + desc.PyramidCell-1) / desc.PyramidCell;
+		e.ppData = new BYTE*[numChunks*TERRAIN_STREAM_COUNT];
+		e.pBytes = new int[numChunks*TERRAIN_STREAM_COUNT];
+		e.pCodec = new DWORD[numChunks*TERRAIN_STREAM_COUNT];
+		e.pMinMax = new float[e.cellsPerSide*e.cellsPerSide*2];
+		g_ThreadPool.ParallelFor(numChunks, EncodeChunkJob, &e);
+
+		// Min/max pyramid, each level halves the one before
+		int cells = e.cellsPerSide;
+		int levels = 1;
+		int pyramidTexels = cells*cells;
+		while(((cells-1)>>(levels-1)) > 0)
+		{
+			int size = ((cells-1)>>levels)+1;
+			pyramidTexels += size*size;
+			levels++;
+		}
+		float* pPyramid = new float[pyramidTexels*2];
+		memcpy(pPyramid, e.pMinMax, cells*cells*2*sizeof(float));
+		float* pLevel = pPyramid;
+		for(int l=1; l<levels; l++)
+		{
+			int prevSize = ((cells-1)>>(l-1))+1;
+			int size = ((cells-1)>>l)+1;
+			float* pNext = pLevel + prevSize*prevSize*2;
+			for(int y=0; y<size; y++)
+				for(int x=0; x<size; x++)
+				{
+					float minHeight = FLT_MAX, maxHeight = -FLT_MAX;
+					for(int j=2*y; j<Math::Min(2*y+2, prevSize); j++)
+						for(int i=2*x; i<Math::Min(2*x+2, prevSize); i++)
+						{
+							minHeight = Math::Min(minHeight, pLevel[(j*prevSize+i)*2]);
+							maxHeight = Math::Max(maxHeight, pLevel[(j*prevSize+i)*2+1]);
+						}
+					pNext[(y*size+x)*2] = minHeight;
+					pNext[(y*size+x)*2+1] = maxHeight;
+				}
+			pLevel = pNext;
+		}
+
+		// Layout
+		TerrainFileHeader header;
+		memset(&header, 0, sizeof(TerrainFileHeader));
+		header.Magic = TERRAIN_FILE_MAGIC;
+		header.Version = TERRAIN_FILE_VERSION;
+		header.Size = desc.Size;
+		header.ChunkSize = desc.ChunkSize;
+		header.ChunksPerSide = n;
+		header.LayerCount = desc.LayerCount;
+		header.PyramidLevels = levels;
+		header.PyramidCell = desc.PyramidCell;
+		header.HeightScale = desc.HeightScale;
+		header.MinHeight = pLevel[0];
+		header.MaxHeight = pLevel[1];
+		header.LayerOffset = AlignOffset(sizeof(TerrainFileHeader));
+		header.PyramidOffset = AlignOffset(header.LayerOffset + desc.LayerCount*sizeof(TerrainFileLayer));
+		header.IndexOffset = AlignOffset(header.PyramidOffset + pyramidTexels*2*sizeof(float));
+
+		TerrainFileChunk* pIndex = new TerrainFileChunk[numChunks*TERRAIN_STREAM_COUNT];
+		ULONGLONG offset = AlignOffset(header.IndexOffset + numChunks*TERRAIN_STREAM_COUNT*sizeof(TerrainFileChunk));
+		for(int i=0; i<numChunks*TERRAIN_STREAM_COUNT; i++)
+		{
+			pIndex[i].Offset = offset;
+			pIndex[i].Bytes = e.pBytes[i];
+			pIndex[i].Codec = e.pCodec[i];
+			offset = (offset + e.pBytes[i] + TERRAIN_FILE_ALIGN-1) & ~(ULONGLONG)(TERRAIN_FILE_ALIGN-1);
+		}
+
+		// Write it all out in order, padding up to each offset
+		bool ok = false;
+		FILE* fp = fopen(szFile, "wb");
+		if(fp)
+		{
+			ULONGLONG pos = 0;
+			WriteAt(fp, pos, 0, &header, sizeof(TerrainFileHeader));
+			WriteAt(fp, pos, header.LayerOffset, desc.pLayerInfo, desc.LayerCount*sizeof(TerrainFileLayer));
+			WriteAt(fp, pos, header.PyramidOffset, pPyramid, pyramidTexels*2*sizeof(float));
+			WriteAt(fp, pos, header.IndexOffset, pIndex, numChunks*TERRAIN_STREAM_COUNT*sizeof(TerrainFileChunk));
+			for(int i=0; i<numChunks*TERRAIN_STREAM_COUNT; i++)
+				WriteAt(fp, pos, pIndex[i].Offset, e.ppData[i], e.pBytes[i]);
+			ok = (ferror(fp)==0);
+			fclose(fp);
+		}
+		if(!ok)
+			Log::Print("TerrainFile::Write() failed writing> %s", szFile);
+
+		for(int i=0; i<numChunks*TERRAIN_STREAM_COUNT; i++)
+			delete[] e.ppData[i];
+		delete[] e.ppData;
+		delete[] e.pBytes;
+		delete[] e.pCodec;
+		delete[] e.pMinMax;
+		delete[] pPyramid;
+		delete[] pIndex;
+		return ok;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Maps the whole file and checks the tables fit inside it
+	//--------------------------------------------------------------------------------------
+	bool TerrainFile::Open(const char* szFile)
+	{
+		Close();
+
+		m_hFile = CreateFileA(szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if(m_hFile==INVALID_HANDLE_VALUE)
+		{
+			Log::Print("Terrain file failed to open> %s", szFile);
+			return false;
+		}
+		LARGE_INTEGER size;
+		if(!GetFileSizeEx(m_hFile, &size) || size.QuadPart<(LONGLONG)sizeof(TerrainFileHeader))
+		{
+			Log::Print("Invalid terrain file> %s", szFile);
+			Close();
+			return false;
+		}
+		m_FileSize = size.QuadPart;
+
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(m_hMapping)
+			m_pView = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if(!m_pView)
+		{
+			Log::Print("Terrain file failed to map> %s", szFile);
+			Close();
+			return false;
+		}
+
+		// Check the header and that the tables lie inside the file.  Sizes are worked out in
+		// 64 bits, a damaged count must not wrap around to a small one.
+		m_pHeader = (const TerrainFileHeader*)m_pView;
+		const TerrainFileHeader& h = *m_pHeader;
+		bool valid = h.Magic==TERRAIN_FILE_MAGIC && h.Version==TERRAIN_FILE_VERSION && h.Size>0 && h.Size<=TERRAIN_FILE_MAX_SIZE &&
+			h.ChunkSize>0 && h.ChunksPerSide==((ULONGLONG)h.Size+h.ChunkSize-1)/h.ChunkSize && h.LayerCount<=TERRAIN_FILE_LAYERS &&
+			Math::IsPowerOf2(h.PyramidCell) && h.ChunkSize%h.PyramidCell==0;
+		DWORD lastCell = valid ? (h.Size-1)/h.PyramidCell : 0;
+		valid = valid && h.PyramidLevels>0 && h.PyramidLevels<=32 && (lastCell>>(h.PyramidLevels-1))==0 &&
+			(h.PyramidLevels==1 || (lastCell>>(h.PyramidLevels-2))>0);
+		ULONGLONG numChunks = valid ? (ULONGLONG)h.ChunksPerSide*h.ChunksPerSide : 0;
+		if(valid)
+		{
+			m_PyramidStart = new ULONGLONG[h.PyramidLevels];
+			ULONGLONG pyramidTexels = 0;
+			for(UINT i=0; i<h.PyramidLevels; i++)
+			{
+				ULONGLONG size = (lastCell>>i) + 1;
+				m_PyramidStart[i] = pyramidTexels;
+				pyramidTexels += size*size;
+			}
+			valid = (ULONGLONG)h.LayerOffset + h.LayerCount*sizeof(TerrainFileLayer) <= m_FileSize &&
+				(ULONGLONG)h.PyramidOffset + pyramidTexels*2*sizeof(float) <= m_FileSize &&
+				(ULONGLONG)h.IndexOffset + numChunks*TERRAIN_STREAM_COUNT*sizeof(TerrainFileChunk) <= m_FileSize;
+		}
+		if(valid)
+		{
+			m_pLayers = (const TerrainFileLayer*)(m_pView + h.LayerOffset);
+			m_pPyramid = (const float*)(m_pView + h.PyramidOffset);
+			m_pChunks = (const TerrainFileChunk*)(m_pView + h.IndexOffset);
+			for(ULONGLONG i=0; i<numChunks*TERRAIN_STREAM_COUNT && valid; i++)
+				valid = m_pChunks[i].Offset <= m_FileSize && m_pChunks[i].Bytes <= m_FileSize - m_pChunks[i].Offset;
+		}
+		if(!valid)
+		{
+			Log::Print("Invalid terrain file> %s", szFile);
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Unmaps and closes the file
+	//--------------------------------------------------------------------------------------
+	void TerrainFile::Close()
+	{
+		if(m_pView)
+			UnmapViewOfFile(m_pView);
+		if(m_hMapping)
+			CloseHandle(m_hMapping);
+		if(m_hFile!=INVALID_HANDLE_VALUE)
+			CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+		m_pView = NULL;
+		m_FileSize = 0;
+		m_pHeader = NULL;
+		m_pLayers = NULL;
+		m_pPyramid = NULL;
+		m_pChunks = NULL;
+		SAFE_DELETE_ARRAY(m_PyramidStart);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Decodes a chunk into an image with the given pitch in bytes
+	//--------------------------------------------------------------------------------------
+	bool TerrainFile::DecodeChunk(TERRAIN_STREAM stream, int cx, int cy, BYTE* pImage, int pitch)
+	{
+		const TerrainFileChunk& c = GetChunk(stream, cx, cy);
+		int texelSize = g_StreamTexelSize[stream];
+		int w = GetChunkWidth(cx);
+		int h = GetChunkWidth(cy);
+		const BYTE* pSrc = m_pView + c.Offset;
+		BYTE* pDest = pImage + cy*m_pHeader->ChunkSize*pitch + cx*m_pHeader->ChunkSize*texelSize;
+		switch(c.Codec)
+		{
+		case TERRAIN_CODEC_RAW:
+			if(c.Bytes!=(ULONGLONG)w*h*texelSize)
+				return false;
+			for(int y=0; y<h; y++)
+				memcpy(pDest + y*pitch, pSrc + y*w*texelSize, w*texelSize);
+			return true;
+
+		case TERRAIN_CODEC_DELTA16:
+			return texelSize==2 && DecodeDelta16(pSrc, c.Bytes, (WORD*)pDest, pitch/2, w, h);
+
+		case TERRAIN_CODEC_RUN32:
+			return texelSize==4 && DecodeRun32(pSrc, c.Bytes, (DWORD*)pDest, pitch/4, w, h);
+		}
+		return false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Decodes the chunks of a stream on the thread pool
+	//--------------------------------------------------------------------------------------
+	struct DecodeData
+	{
+		TerrainFile*	pFile;
+		TERRAIN_STREAM	stream;
+		BYTE*			pDest;
+		int				pitch;
+		int				chunksPerSide;
+		volatile LONG	failed;
+	};
+
+	static void DecodeChunkJob(int start, int end, void* pData)
+	{
+		DecodeData& d = *(DecodeData*)pData;
+		for(int k=start; k<end; k++)
+		{
+			if(!d.pFile->DecodeChunk(d.stream, k % d.chunksPerSide, k / d.chunksPerSide, d.pDest, d.pitch))
+				InterlockedIncrement(&d.failed);
+		}
+	}
+
+	bool TerrainFile::ReadStream(TERRAIN_STREAM stream, BYTE* pDest, int pitch)
+	{
+		if(!m_pView)
+			return false;
+		DecodeData d;
+		d.pFile = this;
+		d.stream = stream;
+		d.pDest = pDest;
+		d.pitch = pitch;
+		d.chunksPerSide = m_pHeader->ChunksPerSide;
+		d.failed = 0;
+		g_ThreadPool.ParallelFor(d.chunksPerSide*d.chunksPerSide, DecodeChunkJob, &d);
+		if(d.failed)
+			Log::Print("TerrainFile: %d corrupt chunks", d.failed);
+		return d.failed==0;
+	}
+
+	bool TerrainFile::ReadHeights(D3DXFLOAT16* pDest, int pitch)
+	{
+		return ReadStream(TERRAIN_STREAM_HEIGHT, (BYTE*)pDest, pitch*sizeof(D3DXFLOAT16));
+	}
+
+	bool TerrainFile::ReadLayers(BlendTexel* pDest, int pitch)
+	{
+		return ReadStream(TERRAIN_STREAM_LAYER, (BYTE*)pDest, pitch*sizeof(BlendTexel));
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Min/max of the heights under a pyramid texel
+	//--------------------------------------------------------------------------------------
+	void TerrainFile::GetMinMax(int level, int x, int y, float& minHeight, float& maxHeight)
+	{
+		const float* p = m_pPyramid + (m_PyramidStart[level] + (ULONGLONG)y*GetPyramidSize(level) + x)*2;
+		minHeight = p[0];
+		maxHeight = p[1];
+	}
+
+}
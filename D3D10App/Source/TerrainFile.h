@@ -0,0 +1,158 @@
+//--------------------------------------------------------------------------------------
+// File: TerrainFile.h
+//
+// Binary terrain container.  Heights and blend layers are cut into square chunks that
+// are compressed on their own, so a terrain can be decoded by several threads at once.
+// Chunks that don't compress are stored raw and are copied straight out of the mapping.
+// The file also holds the layer setup and a min/max pyramid over the heights, laid out
+// like HeightBounds so the terrain can take its culling bounds straight from it.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "QMath.h"
+#include "BlendPyramid.h"
+#include "HeightBounds.h"
+
+namespace Core
+{
+
+#define TERRAIN_FILE_MAGIC		0x31425450	// "PTB1"
+#define TERRAIN_FILE_VERSION	2
+#define TERRAIN_FILE_LAYERS		16
+#define TERRAIN_FILE_NAME		128
+#define TERRAIN_CHUNK_SIZE		256
+#define TERRAIN_FILE_MAX_SIZE	(1<<20)		// Texels per side
+
+	// Chunk encodings
+	enum TERRAIN_CODEC
+	{
+		TERRAIN_CODEC_RAW = 0,		// Rows of texels, readable in place
+		TERRAIN_CODEC_DELTA16,		// 16 bit texels, gradient predicted residuals as varints
+		TERRAIN_CODEC_RUN32,		// 32 bit texels, runs and literal spans
+	};
+
+	// Chunk streams
+	enum TERRAIN_STREAM
+	{
+		TERRAIN_STREAM_HEIGHT = 0,	// R16_FLOAT heights, not scaled by the height scale
+		TERRAIN_STREAM_LAYER,		// BlendTexel layer ids and weights
+		TERRAIN_STREAM_COUNT,
+	};
+
+	// Header at the start of the file
+	struct TerrainFileHeader
+	{
+		DWORD Magic;
+		DWORD Version;
+		DWORD Size;				// Texels per side
+		DWORD ChunkSize;		// Texels per chunk side
+		DWORD ChunksPerSide;
+		DWORD LayerCount;		// Number of TerrainFileLayer entries
+		DWORD PyramidLevels;	// Levels in the min/max pyramid
+		DWORD PyramidCell;		// Texels per side under a first level pyramid texel, divides ChunkSize
+		float HeightScale;
+		float MinHeight;		// Height range, not scaled by the height scale
+		float MaxHeight;
+		DWORD LayerOffset;		// Offset of the layer table
+		DWORD PyramidOffset;	// Offset of the min/max pairs, levels follow each other
+		DWORD IndexOffset;		// Offset of the chunk table, one TerrainFileChunk per stream per chunk
+	};
+
+	// Texture layer setup
+	struct TerrainFileLayer
+	{
+		char	Texture[TERRAIN_FILE_NAME];		// Empty if unused
+		char	Normalmap[TERRAIN_FILE_NAME];
+		float	Scale;
+	};
+
+	// Entry in the chunk table
+	struct TerrainFileChunk
+	{
+		ULONGLONG	Offset;
+		DWORD		Bytes;
+		DWORD		Codec;
+	};
+
+	// Everything needed to write a file
+	struct TerrainFileDesc
+	{
+		int						Size;
+		float					HeightScale;
+		const D3DXFLOAT16*		pHeights;		// Unscaled heights
+		int						HeightPitch;	// In bytes
+		const BlendTexel*		pLayers;
+		int						LayerPitch;		// In bytes
+		const TerrainFileLayer*	pLayerInfo;
+		int						LayerCount;
+		int						ChunkSize;
+		int						PyramidCell;	// A power of two that divides the chunk size
+		bool					Compress;		// Otherwise every chunk is stored raw
+		TerrainFileDesc(){
+			memset(this, 0, sizeof(TerrainFileDesc));
+			ChunkSize = TERRAIN_CHUNK_SIZE;
+			PyramidCell = HEIGHT_BOUNDS_CELL;
+			Compress = true;
+		}
+	};
+
+
+	class TerrainFile
+	{
+	public:
+		TerrainFile();
+		~TerrainFile(){ Close(); }
+
+		// Compresses the chunks in parallel and writes the file
+		static bool Write(const char* szFile, const TerrainFileDesc& desc);
+
+		// Maps a file and checks its tables
+		bool Open(const char* szFile);
+		void Close();
+
+		// Decodes every chunk of a stream in parallel.  Pitches are in texels.
+		bool ReadHeights(D3DXFLOAT16* pDest, int pitch);
+		bool ReadLayers(BlendTexel* pDest, int pitch);
+
+		// Decodes one chunk into an image, the pitch is in bytes
+		bool DecodeChunk(TERRAIN_STREAM stream, int cx, int cy, BYTE* pImage, int pitch);
+
+		// Min/max of the unscaled heights under a pyramid texel
+		void GetMinMax(int level, int x, int y, float& minHeight, float& maxHeight);
+
+		// Properties
+		inline bool IsOpen(){ return m_pView!=NULL; }
+		inline const TerrainFileHeader& GetHeader(){ return *m_pHeader; }
+		inline const TerrainFileLayer& GetLayer(int i){ return m_pLayers[i]; }
+		inline int GetPyramidSize(int level){ return (int)(((m_pHeader->Size-1)/m_pHeader->PyramidCell)>>level) + 1; }
+		inline int GetChunkWidth(int cx){ return Math::Min((int)m_pHeader->ChunkSize, (int)m_pHeader->Size - cx*(int)m_pHeader->ChunkSize); }
+		inline const TerrainFileChunk& GetChunk(TERRAIN_STREAM stream, int cx, int cy){
+			return m_pChunks[(stream*m_pHeader->ChunksPerSide + cy)*m_pHeader->ChunksPerSide + cx]; }
+
+		// Chunk codecs.  Encoders take contiguous rows and return the encoded size, or 0 if
+		// it doesn't fit in maxBytes.  Decoder pitches are in texels.
+		static int EncodeDelta16(const WORD* pSrc, int w, int h, BYTE* pDest, int maxBytes);
+		static bool DecodeDelta16(const BYTE* pSrc, int bytes, WORD* pDest, int pitch, int w, int h);
+		static int EncodeRun32(const DWORD* pSrc, int count, BYTE* pDest, int maxBytes);
+		static bool DecodeRun32(const BYTE* pSrc, int bytes, DWORD* pDest, int pitch, int w, int h);
+
+	private:
+
+		// Decodes a stream with the thread pool
+		bool ReadStream(TERRAIN_STREAM stream, BYTE* pDest, int pitch);
+
+		HANDLE					m_hFile;
+		HANDLE					m_hMapping;
+		const BYTE*				m_pView;
+		ULONGLONG				m_FileSize;
+		const TerrainFileHeader*	m_pHeader;
+		const TerrainFileLayer*		m_pLayers;
+		const float*			m_pPyramid;
+		const TerrainFileChunk*	m_pChunks;
+		ULONGLONG*				m_PyramidStart;		// Offset of each pyramid level in min/max pairs
+	};
+
+}
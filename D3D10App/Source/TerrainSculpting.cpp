@@ -20,6 +20,10 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Terrain::Sculpt(D3DXVECTOR3 center, float radius, float hardness, float strength, float delta, int detail, SCULPT_TYPE mode)
 	{
+		// Streamed terrains are read only
+		if(m_pHeightTiles)
+			return;
+
 		// Determine the region we need to use
 		D3DXVECTOR2 pos = D3DXVECTOR2(floorf(center.x), floorf(center.z)) + D3DXVECTOR2(0.5f, 0.5f)*m_Size;
 		D3DXVECTOR2 minBounds = pos - D3DXVECTOR2(radius, radius);
@@ -97,6 +101,11 @@ namespace Core
 			}
 			m_StagingHeightmap->Unmap(0);
 
+			// Rebuild the culling bounds and normals under the brush
+			RECT dirty = { (LONG)minBounds.x, (LONG)minBounds.y, (LONG)maxBounds.x, (LONG)maxBounds.y };
+			m_HeightBounds.Update((D3DXFLOAT16*)m_Height, dirty);
+			UpdateNormals(&dirty);
+
 			// Copy the subregion back to the main heightmap
 			D3D10_BOX sourceRegion;
 			sourceRegion.left = minBounds.x;
@@ -108,21 +117,21 @@ namespace Core
 			g_pd3dDevice->CopySubresourceRegion(m_Heightmap.GetTex()[0], 0, minBounds.x, minBounds.y, 0, 
 				m_StagingHeightmap, 0, &sourceRegion);
 
-			// Flag all clipmaps to be updated
-			m_FlagForUpdate = true;
+			// Refresh the clipmap texels under the brush
+			InvalidateClipmaps(dirty);
 		}
 		else
 		{
-			D3D10_MAPPED_TEXTURE2D mappedTexture;
-			BlendTexel* pTexels;
-			m_LayerMaps.GetBaseTexture()->Map(0, D3D10_MAP_READ_WRITE, 0, &mappedTexture);
-			pTexels = (BlendTexel*)mappedTexture.pData;
+			// Paint into the CPU copy of the layers
+			BlendTexel* pTexels = m_LayerPyramid.GetLevel(0);
+			if(!pTexels)
+				return;
 
 			// Process the sculpting
 			D3DXVECTOR4 texel;
 			for( int row = (int)minBounds.y; row < (int)maxBounds.y; row++ )
 			{
-				UINT rowStart = row * mappedTexture.RowPitch/4;
+				UINT rowStart = row * m_Size;
 				for( int col = (int)minBounds.x; col < (int)maxBounds.x; col++)
 				{
 					// Convert this index to world space coords
@@ -186,46 +195,12 @@ namespace Core
 				}
 			}
 
-			// Unmap the mip-maps
-			float size = 2.0f;
-			for(int i=1; i<CLIPMAP_LEVELS-1; i++, size*=2.0f)
-			{
-				// Map this mip map
-				D3D10_MAPPED_TEXTURE2D mappedMip;
-				BlendTexel* pMipTexels;
-				m_LayerMaps.GetBaseTexture()->Map(i, D3D10_MAP_READ_WRITE, 0, &mappedMip);
-				pMipTexels = (BlendTexel*)mappedMip.pData;
-				
-				// Update the height values for this level
-				D3DXVECTOR2 minB = minBounds / size; 
-				D3DXVECTOR2 maxB = maxBounds / size; 
-				UINT mRow = minBounds.y;
-				for( UINT row = minB.y; row < maxB.y; row++, mRow+=size )
-				{
-					UINT rowStart = row * mappedMip.RowPitch/4;
-					UINT mRowStart = mRow * mappedTexture.RowPitch/4;
-					UINT mCol = minBounds.x;
-					for( UINT col = minB.x; col < maxB.x; col++, mCol+=size )
-					{
-						// Update the values
-						for(int count=0; count<4; count++)
-						{
-							float sum = static_cast<float>(pTexels[mRowStart + mCol+1].data[count]) / 255.0f;
-							sum += static_cast<float>(pTexels[mRowStart + mCol-1].data[count]) / 255.0f;
-							sum += static_cast<float>(pTexels[mRowStart+(mappedTexture.RowPitch/4) + mCol].data[count]) / 255.0f;
-							sum += static_cast<float>(pTexels[mRowStart-(mappedTexture.RowPitch/4) + mCol].data[count]) / 255.0f;
-							sum *= 0.25f;
-							sum *= 255.0f;
-							pMipTexels[rowStart + col].data[count] = static_cast<UCHAR>(sum);
-						}
-						
-					}
-				}
-				m_LayerMaps.GetBaseTexture()->Unmap(i);
-			}
-			m_LayerMaps.GetBaseTexture()->Unmap(0);
-
-			m_LayerMaps.ForceUpdate();
+			// Rebuild the mips under the brush and write just that footprint back
+			RECT dirty = { (LONG)minBounds.x, (LONG)minBounds.y, (LONG)maxBounds.x, (LONG)maxBounds.y };
+			RECT rects[CLIPMAP_LEVELS];
+			m_LayerPyramid.BuildMips(dirty, rects);
+			UploadLayerPyramid(rects);
+			m_LayerMaps.Invalidate(dirty);
 		}
 	}
 
@@ -243,11 +218,12 @@ namespace Core
 		SculptRegion r = m_UndoStack.Pop();
 		ApplyUndo(r);
 		
-		// Force a clipmap update
+		// Refresh the clipmap texels in the region
+		RECT dirty = { (LONG)r.region.left, (LONG)r.region.top, (LONG)r.region.right, (LONG)r.region.bottom };
 		if(r.paint)
-			m_LayerMaps.ForceUpdate();
+			m_LayerMaps.Invalidate(dirty);
 		else
-			m_FlagForUpdate = true;
+			InvalidateClipmaps(dirty);
 
 		// Push to the redo stack
 		m_RedoStack.Push(r);
@@ -266,11 +242,12 @@ namespace Core
 		SculptRegion r = m_RedoStack.Pop();
 		ApplyUndo(r);
 
-		// Force a clipmap update
+		// Refresh the clipmap texels in the region
+		RECT dirty = { (LONG)r.region.left, (LONG)r.region.top, (LONG)r.region.right, (LONG)r.region.bottom };
 		if(r.paint)
-			m_LayerMaps.ForceUpdate();
+			m_LayerMaps.Invalidate(dirty);
 		else
-			m_FlagForUpdate = true;
+			InvalidateClipmaps(dirty);
 		
 		// Push to the undo stack
 		m_UndoStack.Push(r);
@@ -295,51 +272,20 @@ namespace Core
 		
 		if(r.paint)
 		{
-			g_pd3dDevice->CopySubresourceRegion(m_LayerMaps.GetBaseTexture(), 0, r.region.left, r.region.top, 0, 
-				r.tex, 0, &localRegion);
-
-			// Unmap the mip-maps
-			float size = 2.0f;
+			// Restore the cached texels into the CPU layers
 			D3D10_MAPPED_TEXTURE2D mappedTex;
-			m_LayerMaps.GetBaseTexture()->Map(0, D3D10_MAP_READ_WRITE, 0, &mappedTex);
-			BlendTexel* pTexels = (BlendTexel*)mappedTex.pData;
-
-			for(int i=1; i<CLIPMAP_LEVELS-1; i++, size*=2.0f)
-			{
-				// Map this mip map
-				D3D10_MAPPED_TEXTURE2D mappedMip;
-				BlendTexel* pMipTexels;
-				m_LayerMaps.GetBaseTexture()->Map(i, D3D10_MAP_READ_WRITE, 0, &mappedMip);
-				pMipTexels = (BlendTexel*)mappedMip.pData;
-
-				// Update the height values for this level
-				D3DXVECTOR2 minB = minBounds / size; 
-				D3DXVECTOR2 maxB = maxBounds / size; 
-				UINT mRow = minBounds.y;
-				for( UINT row = minB.y; row < maxB.y; row++, mRow+=size )
-				{
-					UINT rowStart = row * mappedMip.RowPitch/4;
-					UINT mRowStart = mRow * mappedTex.RowPitch/4;
-					UINT mCol = minBounds.x;
-					for( UINT col = minB.x; col < maxB.x; col++, mCol+=size )
-					{
-						// Update the values
-						for(int count=0; count<4; count++)
-						{
-							float sum = static_cast<float>(pTexels[mRowStart + mCol+1].data[count]) / 255.0f;
-							sum += static_cast<float>(pTexels[mRowStart + mCol-1].data[count]) / 255.0f;
-							sum += static_cast<float>(pTexels[mRowStart+(mappedTex.RowPitch/4) + mCol].data[count]) / 255.0f;
-							sum += static_cast<float>(pTexels[mRowStart-(mappedTex.RowPitch/4) + mCol].data[count]) / 255.0f;
-							sum *= 0.25f;
-							sum *= 255.0f;
-							pMipTexels[rowStart + col].data[count] = static_cast<UCHAR>(sum);
-						}
-
-					}
-				}
-				m_LayerMaps.GetBaseTexture()->Unmap(i);
-			}
-			m_LayerMaps.GetBaseTexture()->Unmap(0);
+			if( FAILED(r.tex->Map(0, D3D10_MAP_READ, 0, &mappedTex)) )
+				return;
+			for( UINT row = r.region.top; row < r.region.bottom; row++ )
+				memcpy(&m_LayerPyramid.GetTexel(0, r.region.left, row), (BYTE*)mappedTex.pData + (row-r.region.top)*mappedTex.RowPitch,
+					localRegion.right*sizeof(BlendTexel));
+			r.tex->Unmap(0);
+
+			// Rebuild the mips in the region and write them back
+			RECT dirty = { (LONG)r.region.left, (LONG)r.region.top, (LONG)r.region.right, (LONG)r.region.bottom };
+			RECT rects[CLIPMAP_LEVELS];
+			m_LayerPyramid.BuildMips(dirty, rects);
+			UploadLayerPyramid(rects);
 		}
 		else
 		{
@@ -367,6 +313,11 @@ namespace Core
 				}
 			}
 			m_StagingHeightmap->Unmap(0);
+
+			// Rebuild the culling bounds and normals in the region
+			RECT dirty = { (LONG)minBounds.x, (LONG)minBounds.y, (LONG)maxBounds.x, (LONG)maxBounds.y };
+			m_HeightBounds.Update((D3DXFLOAT16*)m_Height, dirty);
+			UpdateNormals(&dirty);
 		}
 	}
 
@@ -377,6 +328,9 @@ namespace Core
 	//--------------------------------------------------------------------------------------
 	void Terrain::CacheSculptRegion(D3DXVECTOR3 pickPoint, float radius, bool paint)
 	{
+		if(m_pHeightTiles)
+			return;
+
 		// Determine the region we need to use
 		D3DXVECTOR2 pos = D3DXVECTOR2(floorf(pickPoint.x), floorf(pickPoint.z)) + D3DXVECTOR2(0.5f, 0.5f)*m_Size;
 		D3DXVECTOR2 minBounds = pos - D3DXVECTOR2(radius, radius);
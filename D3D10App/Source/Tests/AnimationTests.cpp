@@ -0,0 +1,501 @@
+//--------------------------------------------------------------------------------------
+// File: AnimationTests.cpp
+//
+// Self tests and benchmark for the skeletal animation runtime
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Animation.h"
+#include "ThreadPool.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+static inline int AnimNumFrames(float duration)
+{
+	return max(2, (int)ceilf(duration*ANIM_SAMPLE_RATE)+1);
+}
+
+//--------------------------------------------------------------------------------------
+// A random hierarchy with bones about a unit long and clips where every node swings
+// about its own axis, the roots move and a few nodes scale
+//--------------------------------------------------------------------------------------
+static void AnimTestData(int numNodes, int numClips, int numFrames, UINT seed, Array<DWORD>& parents,
+	Array<AnimSRT>& bind, Array<D3DXMATRIX>& offsets, Array<AnimSRT>& samples)
+{
+	UINT state = seed*7919 + 17;
+	parents.Allocate(numNodes);
+	bind.Allocate(numNodes);
+	offsets.Allocate(numNodes);
+	Array<D3DXMATRIX> model;
+	model.Allocate(numNodes);
+	for(int i=0; i<numNodes; i++)
+	{
+		parents[i] = i==0 ? ANIM_ROOT : (DWORD)TestRandFloat(state, 0, (float)i-0.001f);
+		D3DXVECTOR3 axis(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1));
+		D3DXVec3Normalize(&axis, &axis);
+		D3DXQuaternionRotationAxis(&bind[i].Rot, &axis, TestRandFloat(state, -1, 1));
+		bind[i].Pos = D3DXVECTOR3(TestRandFloat(state, -0.3f, 0.3f), TestRandFloat(state, 0.5f, 1), TestRandFloat(state, -0.3f, 0.3f));
+		bind[i].Scale = D3DXVECTOR3(1, 1, 1);
+		D3DXMATRIX local;
+		D3DXMatrixTransformation(&local, NULL, NULL, &bind[i].Scale, NULL, &bind[i].Rot, &bind[i].Pos);
+		if(parents[i]==ANIM_ROOT)
+			model[i] = local;
+		else
+			D3DXMatrixMultiply(&model[i], &local, &model[parents[i]]);
+		D3DXMatrixInverse(&offsets[i], NULL, &model[i]);
+	}
+	model.Release();
+
+	samples.Allocate(numClips*numNodes*numFrames);
+	for(int c=0; c<numClips; c++)
+	for(int i=0; i<numNodes; i++)
+	{
+		D3DXVECTOR3 axis(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1));
+		D3DXVec3Normalize(&axis, &axis);
+		float amp = TestRandFloat(state, 0.2f, 2.5f), phase = TestRandFloat(state, 0, 6.28f);
+		bool bScale = TestRandFloat(state, 0, 1)<0.1f;
+		for(int f=0; f<numFrames; f++)
+		{
+			float a = 6.2831853f*f/(numFrames-1);
+			AnimSRT& srt = samples[(c*numNodes+i)*numFrames+f];
+			D3DXQUATERNION swing;
+			D3DXQuaternionRotationAxis(&swing, &axis, amp*sinf(a+phase));
+			srt.Rot = swing*bind[i].Rot;
+			srt.Pos = bind[i].Pos;
+			if(parents[i]==ANIM_ROOT)
+				srt.Pos += D3DXVECTOR3(2*sinf(a), 0.1f*cosf(2*a), 3*cosf(a));
+			srt.Scale = bind[i].Scale;
+			if(bScale)
+				srt.Scale *= 1+0.3f*sinf(a+phase);
+		}
+	}
+}
+
+// A skeleton with a bone on every node of the test data
+static void CreateTestSkeleton(Skeleton& skeleton, int numNodes, int numClips, float duration, UINT seed)
+{
+	int numFrames = AnimNumFrames(duration);
+	Array<DWORD> parents;
+	Array<AnimSRT> bind, samples;
+	Array<D3DXMATRIX> offsets;
+	AnimTestData(numNodes, numClips, numFrames, seed, parents, bind, offsets, samples);
+
+	Array<DWORD> boneNodes;
+	boneNodes.Allocate(numNodes);
+	for(int i=0; i<numNodes; i++)
+		boneNodes[i] = i;
+	skeleton.Release();
+	skeleton.SetHierarchy(parents, bind, numNodes, boneNodes, offsets, numNodes);
+	skeleton.SetMaxVertInfluences(4);
+	for(int c=0; c<numClips; c++)
+	{
+		char szName[32];
+		sprintf(szName, "Clip%d", c);
+		skeleton.AddClip(szName, duration, (AnimSRT*)samples + c*numNodes*numFrames, numFrames);
+	}
+	parents.Release();
+	bind.Release();
+	samples.Release();
+	offsets.Release();
+	boneNodes.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// The bone matrices from uncompressed samples with D3DX, blended the same way
+//--------------------------------------------------------------------------------------
+static void AnimReferencePose(const DWORD* pParents, const AnimSRT* pBind, const D3DXMATRIX* pOffsets, int numNodes,
+	const AnimSRT* pSamples, int numFrames, float duration, const AnimLayer* pLayers, int numLayers,
+	D3DXMATRIX* pModel, D3DXMATRIX* pFinal)
+{
+	for(int i=0; i<numNodes; i++)
+	{
+		D3DXQUATERNION q(0,0,0,0);
+		D3DXVECTOR3 t(0,0,0), s(0,0,0);
+		float rest = 1;
+		for(int l=0; l<numLayers; l++)
+		{
+			if(pLayers[l].Clip<0 || pLayers[l].Weight<=0)
+				continue;
+			const AnimSRT* pNode = pSamples + (pLayers[l].Clip*numNodes + i)*numFrames;
+			float frame = max(0.0f, min(pLayers[l].Time*(numFrames-1)/duration, (float)(numFrames-1)));
+			int f0 = min((int)frame, numFrames-2);
+			float frac = frame-f0;
+			D3DXQUATERNION q0, q1, lq;
+			D3DXQuaternionNormalize(&q0, &pNode[f0].Rot);
+			D3DXQuaternionNormalize(&q1, &pNode[f0+1].Rot);
+			if(D3DXQuaternionDot(&q0, &q1)<0)
+				q1 = -q1;
+			lq = q0 + (q1-q0)*frac;
+			if(D3DXQuaternionDot(&q, &lq)<0)
+				lq = -lq;
+			q += lq*pLayers[l].Weight;
+			t += (pNode[f0].Pos + (pNode[f0+1].Pos-pNode[f0].Pos)*frac)*pLayers[l].Weight;
+			s += (pNode[f0].Scale + (pNode[f0+1].Scale-pNode[f0].Scale)*frac)*pLayers[l].Weight;
+			rest -= pLayers[l].Weight;
+		}
+		if(rest>0)
+		{
+			D3DXQUATERNION lq = pBind[i].Rot;
+			if(D3DXQuaternionDot(&q, &lq)<0)
+				lq = -lq;
+			q += lq*rest;
+			t += pBind[i].Pos*rest;
+			s += pBind[i].Scale*rest;
+		}
+		D3DXQuaternionNormalize(&q, &q);
+		D3DXMATRIX local;
+		D3DXMatrixTransformation(&local, NULL, NULL, &s, NULL, &q, &t);
+		if(pParents[i]==ANIM_ROOT)
+			pModel[i] = local;
+		else
+			D3DXMatrixMultiply(&pModel[i], &local, &pModel[pParents[i]]);
+		D3DXMatrixMultiply(&pFinal[i], &pOffsets[i], &pModel[i]);
+	}
+}
+
+// Largest difference between two matrices
+static float AnimMatrixError(const D3DXMATRIX& a, const D3DXMATRIX& b)
+{
+	float error = 0;
+	for(int e=0; e<16; e++)
+		error = max(error, fabsf(((const float*)&a)[e] - ((const float*)&b)[e]));
+	return error;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Parts of a track that never change keep one key, even a rotation whose samples
+// switch between q and -q, and rotation keys that do change stay in one hemisphere.
+// Positions are stored as fractions of their range.
+//--------------------------------------------------------------------------------------
+SELF_TEST(AnimationClipCompression)
+{
+	const int numFrames = 5;
+	const DWORD parents[3] = { ANIM_ROOT, 0, 1 };
+	AnimSRT bind[3];
+	for(int i=0; i<3; i++)
+	{
+		bind[i].Rot = D3DXQUATERNION(0, 0, 0, 1);
+		bind[i].Pos = D3DXVECTOR3(0, 1, 0);
+		bind[i].Scale = D3DXVECTOR3(1, 1, 1);
+	}
+	const DWORD boneNodes[3] = { 0, 1, 2 };
+	D3DXMATRIX offsets[3];
+	for(int i=0; i<3; i++)
+		D3DXMatrixIdentity(&offsets[i]);
+
+	// The root turns with the sign of every other key flipped and moves, the middle
+	// node holds still, the last has a fixed rotation that flips and moves and scales
+	AnimSRT samples[3*numFrames];
+	D3DXVECTOR3 axis(0, 1, 0);
+	for(int f=0; f<numFrames; f++)
+	{
+		float sign = (f&1) ? -1.0f : 1.0f;
+		AnimSRT& root = samples[f];
+		D3DXQuaternionRotationAxis(&root.Rot, &axis, 0.3f*f);
+		root.Rot = root.Rot*sign;
+		root.Pos = D3DXVECTOR3(0.5f*f, 2, -1.0f*f);
+		root.Scale = D3DXVECTOR3(1, 1, 1);
+		samples[numFrames+f] = bind[1];
+		AnimSRT& last = samples[2*numFrames+f];
+		D3DXQuaternionRotationAxis(&last.Rot, &axis, 1.0f);
+		last.Rot = last.Rot*sign;
+		last.Pos = D3DXVECTOR3(0.25f*f, 1, 0);
+		last.Scale = D3DXVECTOR3(1, 1+0.1f*f, 1);
+	}
+
+	Skeleton skeleton;
+	skeleton.SetHierarchy(parents, bind, 3, boneNodes, offsets, 3);
+	TEST_CHECK(skeleton.AddClip("Walk", 1.0f, samples, numFrames)==0);
+	TEST_CHECK(skeleton.FindClip("Walk")==0 && skeleton.FindClip("Run")==-1);
+	AnimationClip& clip = skeleton.GetClip(0);
+	TEST_CHECK(clip.Tracks[0].Flags==ANIM_CONST_SCALE);
+	TEST_CHECK(clip.Tracks[1].Flags==(ANIM_CONST_ROT|ANIM_CONST_POS|ANIM_CONST_SCALE));
+	TEST_CHECK(clip.Tracks[2].Flags==ANIM_CONST_ROT);
+	TEST_CHECK(clip.RotKeys.Size()==(numFrames+1+1)*4);
+	TEST_CHECK(clip.PosKeys.Size()==(numFrames+1+numFrames)*4);
+	TEST_CHECK(clip.ScaleKeys.Size()==(1+1+numFrames)*4);
+	TEST_CHECK(clip.GetMemoryUsage()==3*sizeof(AnimTrack) + (clip.RotKeys.Size()+clip.PosKeys.Size()+clip.ScaleKeys.Size())*sizeof(WORD));
+
+	// Each root key is the sample or its negation, on the same side as the key before
+	bool bHemisphere = true, bKeys = true;
+	for(int f=0; f<numFrames; f++)
+	{
+		const SHORT* pKey = &clip.RotKeys[(clip.Tracks[0].RotKey+f)*4];
+		D3DXQUATERNION rot(pKey[0]/32767.0f, pKey[1]/32767.0f, pKey[2]/32767.0f, pKey[3]/32767.0f);
+		if(fabsf(fabsf(D3DXQuaternionDot(&rot, &samples[f].Rot))-1) > 1e-4f)
+			bKeys = false;
+		if(f>0)
+		{
+			const SHORT* pPrev = pKey-4;
+			D3DXQUATERNION prev(pPrev[0]/32767.0f, pPrev[1]/32767.0f, pPrev[2]/32767.0f, pPrev[3]/32767.0f);
+			if(D3DXQuaternionDot(&rot, &prev)<0)
+				bHemisphere = false;
+		}
+	}
+	TEST_CHECK(bKeys && bHemisphere);
+
+	// The root moves from (0,2,0) to (2,2,-4), so x and z span their range and y has none
+	const AnimTrack& root = clip.Tracks[0];
+	TEST_CHECK(root.PosMin==D3DXVECTOR4(0, 2, -4, 0) && root.PosRange==D3DXVECTOR4(2, 0, 4, 0));
+	const WORD* pFirst = &clip.PosKeys[root.PosKey*4];
+	const WORD* pLast = &clip.PosKeys[(root.PosKey+numFrames-1)*4];
+	TEST_CHECK(pFirst[0]==0 && pFirst[1]==0 && pFirst[2]==65535);
+	TEST_CHECK(pLast[0]==65535 && pLast[1]==0 && pLast[2]==0);
+	TEST_CHECK(clip.PosKeys[(root.PosKey+2)*4]==32768);
+	skeleton.Release();
+	TEST_CHECK(!skeleton.IsBuilt() && skeleton.GetNumClips()==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Layers wrap when looping, in either direction, and clamp to the clip otherwise
+//--------------------------------------------------------------------------------------
+SELF_TEST(AnimationAdvanceLayer)
+{
+	Skeleton skeleton;
+	CreateTestSkeleton(skeleton, 4, 1, 2.0f, 1);
+
+	AnimLayer layer = { 0, 1.5f, 1.0f, 1.0f, true };
+	skeleton.AdvanceLayer(layer, 1.0f);
+	TEST_CHECK_NEAR(layer.Time, 0.5f, 1e-5f);
+	layer.Speed = -1.0f;
+	skeleton.AdvanceLayer(layer, 0.75f);
+	TEST_CHECK_NEAR(layer.Time, 1.75f, 1e-5f);
+	layer.Speed = 3.0f;
+	skeleton.AdvanceLayer(layer, 1.0f);
+	TEST_CHECK_NEAR(layer.Time, 0.75f, 1e-5f);
+
+	layer.bLoop = false;
+	skeleton.AdvanceLayer(layer, 1.0f);
+	TEST_CHECK(layer.Time==2.0f);
+	layer.Speed = -1.0f;
+	skeleton.AdvanceLayer(layer, 5.0f);
+	TEST_CHECK(layer.Time==0.0f);
+
+	// A layer that is off doesn't move
+	layer.Clip = -1;
+	layer.Time = 0.3f;
+	skeleton.AdvanceLayer(layer, 1.0f);
+	TEST_CHECK(layer.Time==0.3f);
+	layer.Clip = 1;
+	skeleton.AdvanceLayer(layer, 1.0f);
+	TEST_CHECK(layer.Time==0.3f);
+	skeleton.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// With no weight on any layer every node is in its bind pose, so each bone matrix is
+// its offset times the inverse of it
+//--------------------------------------------------------------------------------------
+SELF_TEST(AnimationBindPose)
+{
+	const int numNodes = 40;
+	Skeleton skeleton;
+	CreateTestSkeleton(skeleton, numNodes, 1, 1.0f, 2);
+	TEST_CHECK(skeleton.GetNumNodes()==numNodes && skeleton.GetNumBones()==numNodes && skeleton.GetNumClips()==1);
+
+	D3DXMATRIX model[numNodes], bones[numNodes], identity;
+	D3DXMatrixIdentity(&identity);
+	AnimLayer layers[ANIM_MAX_LAYERS] = { { 0, 0.5f, 1.0f, 0.0f, true }, { -1, 0.0f, 1.0f, 1.0f, true } };
+	for(int pass=0; pass<2; pass++)
+	{
+		skeleton.ComputePose(layers, pass==0 ? 0 : ANIM_MAX_LAYERS, model, bones);
+		float error = 0;
+		for(int i=0; i<numNodes; i++)
+			error = max(error, AnimMatrixError(bones[i], identity));
+		TEST_CHECK(error<1e-4f);
+	}
+	skeleton.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Poses at random times, one clip, a cross fade and a partial blend with the bind pose,
+// match ones built from the uncompressed samples with D3DX.  A 16 bit rotation key is
+// within about 6e-5 radians and a position key within 1/131070 of its range, and errors
+// grow with the depth of a bone and how far it is from the root, so the bound allows
+// 1e-4 for each unit of reach and level.
+//--------------------------------------------------------------------------------------
+SELF_TEST(AnimationMatchesReference)
+{
+	const float duration = 2.0f;
+	const int numClips = 2, numPoses = 300;
+	const int numFrames = AnimNumFrames(duration);
+	const int sizes[] = { 30, 80 };
+	for(int test=0; test<2; test++)
+	{
+		int numNodes = sizes[test];
+		UINT seed = test*7;
+		Array<DWORD> parents;
+		Array<AnimSRT> bind, samples;
+		Array<D3DXMATRIX> offsets;
+		AnimTestData(numNodes, numClips, numFrames, seed, parents, bind, offsets, samples);
+		Skeleton skeleton;
+		CreateTestSkeleton(skeleton, numNodes, numClips, duration, seed);
+		TEST_CHECK(skeleton.GetMemoryUsage() < (UINT)(numClips*numNodes*numFrames*sizeof(AnimSRT))/2);
+
+		Array<DWORD> depth;
+		depth.Allocate(numNodes);
+		for(int i=0; i<numNodes; i++)
+			depth[i] = parents[i]==ANIM_ROOT ? 1 : depth[parents[i]]+1;
+
+		Array<D3DXMATRIX> model, bones, refModel, refBones;
+		model.Allocate(numNodes);
+		bones.Allocate(numNodes);
+		refModel.Allocate(numNodes);
+		refBones.Allocate(numNodes);
+		UINT state = seed + 101;
+		int errors = 0;
+		float maxError = 0;
+		for(int p=0; p<numPoses; p++)
+		{
+			AnimLayer layers[ANIM_MAX_LAYERS];
+			int kind = p%3;
+			for(int l=0; l<ANIM_MAX_LAYERS; l++)
+			{
+				layers[l].Clip = (kind==0 && l>0) ? -1 : l%numClips;
+				layers[l].Time = TestRandFloat(state, 0, duration);
+				layers[l].Speed = 1;
+				layers[l].bLoop = true;
+			}
+
+			// The first and last frames exactly
+			if(p<6)
+				layers[0].Time = p<3 ? 0 : duration;
+			float w = TestRandFloat(state, 0, 1);
+			layers[0].Weight = kind==0 ? 1.0f : w;
+			layers[1].Weight = kind==1 ? 1.0f-w : (kind==2 ? (1.0f-w)*0.5f : 0.0f);
+
+			skeleton.ComputePose(layers, ANIM_MAX_LAYERS, model, bones);
+			AnimReferencePose(parents, bind, offsets, numNodes, samples, numFrames, duration, layers, ANIM_MAX_LAYERS, refModel, refBones);
+			for(int i=0; i<numNodes; i++)
+			{
+				D3DXVECTOR3 reach(refModel[i]._41, refModel[i]._42, refModel[i]._43);
+				float bound = 1e-4f*depth[i]*(1+D3DXVec3Length(&reach));
+				float error = AnimMatrixError(bones[i], refBones[i]);
+				maxError = max(maxError, error/bound);
+				errors += error>bound;
+			}
+		}
+		if(!TEST_CHECK(errors==0))
+			Log::Print("AnimationMatchesReference: %d nodes, %d bones off, worst at %.2f of its bound", numNodes, errors, maxError);
+
+		skeleton.Release();
+		parents.Release();
+		bind.Release();
+		samples.Release();
+		offsets.Release();
+		depth.Release();
+		model.Release();
+		bones.Release();
+		refModel.Release();
+		refBones.Release();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// A crowd for the benchmark, each character with its own layers and matrices
+//--------------------------------------------------------------------------------------
+struct AnimCrowd
+{
+	Skeleton*	pSkeleton;
+	AnimLayer*	pLayers;
+	D3DXMATRIX*	pModel;
+	D3DXMATRIX*	pFinal;
+	float		Elapsed;
+};
+
+static void AnimCrowdJob(int start, int end, void* pData)
+{
+	AnimCrowd& crowd = *(AnimCrowd*)pData;
+	int numNodes = crowd.pSkeleton->GetNumNodes();
+	for(int i=start; i<end; i++)
+	{
+		AnimLayer* pLayers = crowd.pLayers + i*ANIM_MAX_LAYERS;
+		for(int l=0; l<ANIM_MAX_LAYERS; l++)
+			crowd.pSkeleton->AdvanceLayer(pLayers[l], crowd.Elapsed);
+		crowd.pSkeleton->ComputePose(pLayers, ANIM_MAX_LAYERS, crowd.pModel + i*numNodes, crowd.pFinal + i*numNodes);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Advances and poses a crowd on one thread and on the pool, and the same poses through
+// D3DX math and the uncompressed samples for comparison
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(Animation)
+{
+	const int numCharacters = 1000, numNodes = 60, numFrames = 60, numClips = 4;
+	const float duration = 2.0f;
+	Skeleton skeleton;
+	CreateTestSkeleton(skeleton, numNodes, numClips, duration, 3);
+
+	// Half the crowd plays one clip and the other half cross fades
+	UINT state = 5;
+	AnimLayer* pLayers = new AnimLayer[numCharacters*ANIM_MAX_LAYERS];
+	for(int i=0; i<numCharacters; i++)
+	{
+		AnimLayer* pLayer = pLayers + i*ANIM_MAX_LAYERS;
+		for(int l=0; l<ANIM_MAX_LAYERS; l++)
+		{
+			pLayer[l].Clip = (i+l)%numClips;
+			pLayer[l].Time = TestRandFloat(state, 0, duration);
+			pLayer[l].Speed = TestRandFloat(state, 0.8f, 1.2f);
+			pLayer[l].bLoop = true;
+		}
+		pLayer[0].Weight = (i&1) ? 0.6f : 1.0f;
+		pLayer[1].Weight = (i&1) ? 0.4f : 0.0f;
+	}
+	D3DXMATRIX* pModel = new D3DXMATRIX[numCharacters*numNodes];
+	D3DXMATRIX* pFinal = new D3DXMATRIX[numCharacters*numNodes];
+	AnimCrowd crowd = { &skeleton, pLayers, pModel, pFinal, 1.0f/60.0f };
+
+	double start = SelfTest::GetTime();
+	for(int f=0; f<numFrames; f++)
+		AnimCrowdJob(0, numCharacters, &crowd);
+	double singleTime = (SelfTest::GetTime()-start)/numFrames;
+
+	start = SelfTest::GetTime();
+	for(int f=0; f<numFrames; f++)
+		g_ThreadPool.ParallelFor(numCharacters, AnimCrowdJob, &crowd, ANIM_JOB_BAND);
+	double poolTime = (SelfTest::GetTime()-start)/numFrames;
+
+	int numSampleFrames = AnimNumFrames(duration);
+	Array<DWORD> parents;
+	Array<AnimSRT> bind, samples;
+	Array<D3DXMATRIX> offsets;
+	AnimTestData(numNodes, numClips, numSampleFrames, 3, parents, bind, offsets, samples);
+	start = SelfTest::GetTime();
+	for(int f=0; f<numFrames; f++)
+	for(int i=0; i<numCharacters; i++)
+		AnimReferencePose(parents, bind, offsets, numNodes, samples, numSampleFrames, duration,
+			pLayers + i*ANIM_MAX_LAYERS, ANIM_MAX_LAYERS, pModel + i*numNodes, pFinal + i*numNodes);
+	double referenceTime = (SelfTest::GetTime()-start)/numFrames;
+
+	Log::Print("Animation: %d characters, %d bones, clips %dKB from %dKB: %.2fms a frame on one thread, %.2fms on %d threads, %.2fms with D3DX math",
+		numCharacters, numNodes, skeleton.GetMemoryUsage()/1024, numClips*numNodes*numSampleFrames*(int)sizeof(AnimSRT)/1024,
+		singleTime, poolTime, g_ThreadPool.GetNumThreads(), referenceTime);
+
+	skeleton.Release();
+	parents.Release();
+	bind.Release();
+	samples.Release();
+	offsets.Release();
+	delete[] pLayers;
+	delete[] pModel;
+	delete[] pFinal;
+}
+
+#endif
@@ -0,0 +1,190 @@
+//--------------------------------------------------------------------------------------
+// File: BlendPyramidTests.cpp
+//
+// Self tests for the CPU blendmap mip chain
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "BlendPyramid.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Makes a texel
+static BlendTexel MakeTexel(int id0, int id1, int w0, int w1)
+{
+	BlendTexel t;
+	t.data[0] = (UCHAR)id0;
+	t.data[1] = (UCHAR)id1;
+	t.data[2] = (UCHAR)w0;
+	t.data[3] = (UCHAR)w1;
+	return t;
+}
+
+// Does a texel hold these values?
+static bool IsTexel(const BlendTexel& t, int id0, int id1, int w0, int w1)
+{
+	return t.data[0]==id0 && t.data[1]==id1 && t.data[2]==w0 && t.data[3]==w1;
+}
+
+// Fills the top level with a few layers in patches, with some texels mixing in the next
+static void FillTestLayers(BlendPyramid& pyramid, UINT& state)
+{
+	int size = pyramid.GetSize();
+	BlendTexel* pTop = pyramid.GetLevel(0);
+	for(int i=0; i<size*size; i++)
+	{
+		state ^= state<<13; state ^= state>>17; state ^= state<<5;
+		int id = (i/size/16 + i%size/16) % 3;
+		int w0 = (state>>16) & 255;
+		pTop[i] = MakeTexel(id, (state>>8)%16==0 ? id+1 : id, w0, 255-w0);
+	}
+}
+
+// Number of texels on levels below the top that don't match Reduce() of the level above
+static int CountStaleMips(BlendPyramid& pyramid)
+{
+	int stale = 0;
+	for(int i=1; i<pyramid.GetLevels(); i++)
+	{
+		int w = pyramid.GetLevelSize(i);
+		for(int y=0; y<w; y++)
+			for(int x=0; x<w; x++)
+			{
+				BlendTexel ref = BlendPyramid::Reduce(pyramid.GetTexel(i-1, 2*x, 2*y), pyramid.GetTexel(i-1, 2*x+1, 2*y),
+					pyramid.GetTexel(i-1, 2*x, 2*y+1), pyramid.GetTexel(i-1, 2*x+1, 2*y+1));
+				if(memcmp(&ref, &pyramid.GetTexel(i, x, y), sizeof(BlendTexel)))
+					stale++;
+			}
+	}
+	return stale;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Blocks on the same layers average their weights, mixed blocks keep the two layers
+// with the most total weight, clamped to a byte
+//--------------------------------------------------------------------------------------
+SELF_TEST(BlendReduce)
+{
+	BlendTexel t = BlendPyramid::Reduce(MakeTexel(4,5,10,20), MakeTexel(4,5,11,21), MakeTexel(4,5,12,22), MakeTexel(4,5,13,25));
+	TEST_CHECK(IsTexel(t, 4,5,12,22));
+
+	// Layer 3 has 505, layer 1 has 305 and layer 2 only 210
+	t = BlendPyramid::Reduce(MakeTexel(1,2,200,55), MakeTexel(1,2,100,155), MakeTexel(3,1,250,5), MakeTexel(3,3,128,127));
+	TEST_CHECK(IsTexel(t, 3,1,126,76));
+
+	t = BlendPyramid::Reduce(MakeTexel(1,1,255,255), MakeTexel(1,1,255,255), MakeTexel(1,1,255,255), MakeTexel(2,1,0,0));
+	TEST_CHECK(IsTexel(t, 1,2,255,0));
+}
+
+
+//--------------------------------------------------------------------------------------
+// The four texel Downsample path matches Reduce() for every width, including the
+// leftovers past the last group of four, from a source that isn't aligned
+//--------------------------------------------------------------------------------------
+SELF_TEST(BlendDownsampleMatchesReduce)
+{
+	BlendPyramid pyramid;
+	if(!TEST_CHECK(pyramid.Create(64, 2)))
+		return;
+	UINT state = 1;
+	FillTestLayers(pyramid, state);
+
+	BlendTexel out[32*4];
+	for(int width=1; width<=30; width++)
+	{
+		memset(out, 0xcd, sizeof(out));
+		BlendPyramid::Downsample(pyramid.GetLevel(0) + 3, 64, out, 32, width, 4);
+		for(int y=0; y<4; y++)
+		{
+			for(int x=0; x<width; x++)
+			{
+				BlendTexel ref = BlendPyramid::Reduce(pyramid.GetTexel(0, 3+2*x, 2*y), pyramid.GetTexel(0, 4+2*x, 2*y),
+					pyramid.GetTexel(0, 3+2*x, 2*y+1), pyramid.GetTexel(0, 4+2*x, 2*y+1));
+				TEST_CHECK(!memcmp(&ref, &out[y*32+x], sizeof(BlendTexel)));
+			}
+
+			// Nothing written past the width
+			TEST_CHECK(IsTexel(out[y*32+width], 0xcd, 0xcd, 0xcd, 0xcd));
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Painting rects and rebuilding only the mips under them gives the same chain as a
+// full rebuild, and the rect reported for each level covers the texels that changed
+//--------------------------------------------------------------------------------------
+SELF_TEST(BlendPyramidIncremental)
+{
+	const int size=256, levels=6;
+	BlendPyramid pyramid;
+	if(!TEST_CHECK(pyramid.Create(size, levels)))
+		return;
+	UINT state = 7;
+	FillTestLayers(pyramid, state);
+	pyramid.BuildMips();
+	TEST_CHECK(CountStaleMips(pyramid)==0);
+
+	RECT rects[levels];
+	BlendTexel* pBefore = new BlendTexel[size*size];
+	int outside = 0;
+	for(int e=0; e<300; e++)
+	{
+		state ^= state<<13; state ^= state>>17; state ^= state<<5;
+		RECT r;
+		r.left = (state>>4) % size;
+		r.top = (state>>12) % size;
+		r.right = r.left + 1 + (state>>20)%37;
+		r.bottom = r.top + 1 + (state>>24)%37;
+		UCHAR detail = (UCHAR)(state%5);
+		for(int y=r.top; y<Math::Min((int)r.bottom, size); y++)
+			for(int x=r.left; x<Math::Min((int)r.right, size); x++)
+			{
+				BlendTexel& t = pyramid.GetTexel(0, x, y);
+				t.data[(x+y)&1] = detail;
+				t.data[2] = (UCHAR)(t.data[2] + 17);
+			}
+
+		// Texels of the second level outside its rect must not change
+		memcpy(pBefore, pyramid.GetLevel(1), (size/2)*(size/2)*sizeof(BlendTexel));
+		pyramid.BuildMips(r, rects);
+		TEST_CHECK(rects[0].right<=size && rects[0].bottom<=size);
+		for(int y=0; y<size/2; y++)
+			for(int x=0; x<size/2; x++)
+				if((x<rects[1].left || x>=rects[1].right || y<rects[1].top || y>=rects[1].bottom) &&
+					memcmp(&pBefore[y*(size/2)+x], &pyramid.GetTexel(1, x, y), sizeof(BlendTexel)))
+					outside++;
+	}
+	TEST_CHECK(outside==0);
+	TEST_CHECK(CountStaleMips(pyramid)==0);
+	delete[] pBefore;
+
+	// The bottom level covers the whole rect
+	RECT r = { 0, 0, size, size };
+	pyramid.BuildMips(r, rects);
+	TEST_CHECK(rects[levels-1].left==0 && rects[levels-1].right==size>>(levels-1));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Sizes that don't halve down to the requested levels are refused
+//--------------------------------------------------------------------------------------
+SELF_TEST(BlendPyramidCreate)
+{
+	BlendPyramid pyramid;
+	TEST_CHECK(!pyramid.Create(96, 2));
+	TEST_CHECK(!pyramid.Create(16, 6));
+	TEST_CHECK(pyramid.Create(16, 5));
+	TEST_CHECK(pyramid.GetLevelSize(4)==1);
+}
+
+#endif
@@ -0,0 +1,212 @@
+//--------------------------------------------------------------------------------------
+// File: ClipmapRegionsTests.cpp
+//
+// Self tests for the toroidal clipmap dirty regions
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ClipmapRegions.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include <limits.h>
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Flushes a level and returns the texels to update
+static int FlushTexels(ClipmapRegions& regions, Array<ClipmapUpdate>& updates)
+{
+	updates.Clear();
+	return regions.Flush(0, updates);
+}
+
+// Does an update cover the grid texel?
+static bool Covers(Array<ClipmapUpdate>& updates, int x, int y)
+{
+	for(int i=0; i<updates.Size(); i++)
+	{
+		const ClipmapUpdate& u = updates[i];
+		if(x>=u.GridX && x<u.GridX+u.Width && y>=u.GridY && y<u.GridY+u.Height)
+			return true;
+	}
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The first placement refreshes the whole level, split where it wraps, and nothing is
+// left afterwards
+//--------------------------------------------------------------------------------------
+SELF_TEST(ClipmapRegionsFirstPlacement)
+{
+	const int size=64;
+	ClipmapRegions regions;
+	regions.Create(size, 2);
+	Array<ClipmapUpdate> updates;
+
+	TEST_CHECK(!regions.IsDirty(0));
+	regions.SetOrigin(0, -10, 20);
+	TEST_CHECK(regions.IsDirty(0) && !regions.IsDirty(1));
+	TEST_CHECK(FlushTexels(regions, updates)==size*size);
+	TEST_CHECK(updates.Size()==4);		// Wraps on both axes
+	for(int i=0; i<updates.Size(); i++)
+	{
+		const ClipmapUpdate& u = updates[i];
+		TEST_CHECK(u.TexX==regions.Wrap(u.GridX) && u.TexY==regions.Wrap(u.GridY));
+		TEST_CHECK(u.TexX+u.Width<=size && u.TexY+u.Height<=size);
+	}
+	TEST_CHECK(!regions.IsDirty(0));
+
+	// Setting the same origin again does nothing
+	regions.SetOrigin(0, -10, 20);
+	TEST_CHECK(!regions.IsDirty(0));
+	updates.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Scrolling exposes only the strips along the edges, an L when moving diagonally, and
+// a jump of a whole level refreshes all of it
+//--------------------------------------------------------------------------------------
+SELF_TEST(ClipmapRegionsScroll)
+{
+	const int size=32;
+	ClipmapRegions regions;
+	regions.Create(size, 1);
+	Array<ClipmapUpdate> updates;
+	regions.SetOrigin(0, 0, 0);
+	FlushTexels(regions, updates);
+
+	regions.SetOrigin(0, 3, 0);
+	TEST_CHECK(FlushTexels(regions, updates)==3*size);
+	TEST_CHECK(Covers(updates, size, 0) && Covers(updates, size+2, size-1));
+	TEST_CHECK(!Covers(updates, size-1, 0));
+
+	regions.SetOrigin(0, 1, 4);
+	TEST_CHECK(FlushTexels(regions, updates)==2*size + 4*(size-2));
+	TEST_CHECK(Covers(updates, 1, 4) && Covers(updates, 2, size+3));
+	TEST_CHECK(Covers(updates, size, size+3) && !Covers(updates, size, size-1));
+
+	regions.SetOrigin(0, 1+size, 4);
+	TEST_CHECK(FlushTexels(regions, updates)==size*size);
+	updates.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Invalidated rects are clipped to the window, covered rects are dropped and too many
+// separate ones merge into one
+//--------------------------------------------------------------------------------------
+SELF_TEST(ClipmapRegionsInvalidate)
+{
+	const int size=64;
+	ClipmapRegions regions;
+	regions.Create(size, 1);
+	Array<ClipmapUpdate> updates;
+
+	// Nothing to do before the level is placed
+	regions.Invalidate(0, 0, 0, 8, 8);
+	TEST_CHECK(!regions.IsDirty(0));
+	regions.SetOrigin(0, 0, 0);
+	FlushTexels(regions, updates);
+
+	regions.Invalidate(0, size, 0, size+8, 8);
+	regions.Invalidate(0, -8, -8, 0, 0);
+	TEST_CHECK(!regions.IsDirty(0));
+
+	regions.Invalidate(0, -4, -4, 4, 4);
+	regions.Invalidate(0, 1, 1, 3, 3);
+	TEST_CHECK(FlushTexels(regions, updates)==16);
+	TEST_CHECK(updates.Size()==1 && updates[0].GridX==0 && updates[0].GridY==0);
+
+	for(int i=0; i<=CLIPMAP_MAX_DIRTY; i++)
+		regions.Invalidate(0, i*4, 0, i*4+2, 2);
+	TEST_CHECK(FlushTexels(regions, updates)<=CLIPMAP_MAX_DIRTY*4*2+2*2);
+	for(int i=0; i<=CLIPMAP_MAX_DIRTY; i++)
+		TEST_CHECK(Covers(updates, i*4, 0) && Covers(updates, i*4+1, 1));
+	updates.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Moves a clipmap around at random with edits in and around it, against a texel by
+// texel model of the wrapped texture.  Each texel remembers which grid texel it holds
+// and which version of it, and every texel in the window must be current after a flush.
+//--------------------------------------------------------------------------------------
+SELF_TEST(ClipmapRegionsRandomWalk)
+{
+	const int size=48, moves=2000;
+	const int worldSize = size*8;
+	int* pGridX = new int[size*size];
+	int* pGridY = new int[size*size];
+	int* pVersion = new int[size*size];
+	int* pWorld = new int[worldSize*worldSize];
+	memset(pWorld, 0, worldSize*worldSize*sizeof(int));
+	for(int i=0; i<size*size; i++)
+		pGridX[i] = pGridY[i] = pVersion[i] = INT_MIN;
+
+	ClipmapRegions regions;
+	regions.Create(size, 1);
+	Array<ClipmapUpdate> updates;
+	UINT state = 1;
+	int x = 0, y = 0, stale = 0;
+	for(int m=0; m<moves; m++)
+	{
+		// Mostly small steps with the occasional jump
+		state ^= state<<13; state ^= state>>17; state ^= state<<5;
+		int step = (state%16)==0 ? size*2 : 3;
+		x += (int)((state>>8)%(2*step+1)) - step;
+		y += (int)((state>>16)%(2*step+1)) - step;
+		Math::Clamp(x, -worldSize/2, worldSize/2-size);
+		Math::Clamp(y, -worldSize/2, worldSize/2-size);
+		regions.SetOrigin(0, x, y);
+
+		if((state>>24)%4==0)
+		{
+			int ex = x + (int)((state>>4)%(size+8)) - 4;
+			int ey = y + (int)((state>>12)%(size+8)) - 4;
+			int ew = 1 + (int)((state>>20)%8);
+			for(int j=ey; j<ey+ew; j++)
+				for(int i=ex; i<ex+ew; i++)
+					if(i>=-worldSize/2 && i<worldSize/2 && j>=-worldSize/2 && j<worldSize/2)
+						pWorld[(j+worldSize/2)*worldSize + i+worldSize/2]++;
+			regions.Invalidate(0, ex, ey, ex+ew, ey+ew);
+		}
+
+		FlushTexels(regions, updates);
+		for(int u=0; u<updates.Size(); u++)
+		{
+			ClipmapUpdate& cu = updates[u];
+			for(int j=0; j<cu.Height; j++)
+				for(int i=0; i<cu.Width; i++)
+				{
+					int t = (cu.TexY+j)*size + cu.TexX+i;
+					pGridX[t] = cu.GridX+i;
+					pGridY[t] = cu.GridY+j;
+					pVersion[t] = pWorld[(cu.GridY+j+worldSize/2)*worldSize + cu.GridX+i+worldSize/2];
+				}
+		}
+
+		for(int j=y; j<y+size; j++)
+			for(int i=x; i<x+size; i++)
+			{
+				int t = regions.Wrap(j)*size + regions.Wrap(i);
+				if(pGridX[t]!=i || pGridY[t]!=j || pVersion[t]!=pWorld[(j+worldSize/2)*worldSize + i+worldSize/2])
+					stale++;
+			}
+	}
+	TEST_CHECK(stale==0);
+
+	updates.Release();
+	delete[] pGridX;
+	delete[] pGridY;
+	delete[] pVersion;
+	delete[] pWorld;
+}
+
+#endif
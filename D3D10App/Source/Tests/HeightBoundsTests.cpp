@@ -0,0 +1,196 @@
+//--------------------------------------------------------------------------------------
+// File: HeightBoundsTests.cpp
+//
+// Self tests for the terrain height min/max pyramid
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "HeightBounds.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Rolling hills with some noise on top
+static D3DXFLOAT16* CreateTestHeights(int size, UINT& state)
+{
+	D3DXFLOAT16* pHeights = new D3DXFLOAT16[size*size];
+	for(int i=0; i<size*size; i++)
+	{
+		state ^= state<<13; state ^= state>>17; state ^= state<<5;
+		pHeights[i] = (D3DXFLOAT16)(sinf((i%size)*0.05f)*cosf((i/size)*0.03f)*100.0f + (state%64)*0.25f);
+	}
+	return pHeights;
+}
+
+// True range under a rect clipped to the heightfield, false if nothing is left
+static bool ScanRange(const D3DXFLOAT16* pHeights, int size, int x0, int y0, int x1, int y1, float& minHeight, float& maxHeight)
+{
+	minHeight = FLT_MAX;
+	maxHeight = -FLT_MAX;
+	bool inside = false;
+	for(int y=Math::Max(y0, 0); y<Math::Min(y1, size); y++)
+		for(int x=Math::Max(x0, 0); x<Math::Min(x1, size); x++)
+		{
+			minHeight = Math::Min(minHeight, (float)pHeights[y*size+x]);
+			maxHeight = Math::Max(maxHeight, (float)pHeights[y*size+x]);
+			inside = true;
+		}
+	return inside;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Rects that line up with cells get the exact range, including the whole map and the
+// partial cells along the edge of a size that isn't a multiple of the cell
+//--------------------------------------------------------------------------------------
+SELF_TEST(HeightBoundsExact)
+{
+	const int size=200, cell=HEIGHT_BOUNDS_CELL;
+	UINT state = 1;
+	D3DXFLOAT16* pHeights = CreateTestHeights(size, state);
+	HeightBounds bounds;
+	if(!TEST_CHECK(bounds.Create(pHeights, size)))
+	{
+		delete[] pHeights;
+		return;
+	}
+	TEST_CHECK(bounds.GetLevelSize(0)==13 && bounds.GetLevelSize(bounds.GetLevels()-1)==1);
+
+	float mn, mx, tmn, tmx;
+	ScanRange(pHeights, size, 0, 0, size, size, tmn, tmx);
+	TEST_CHECK(bounds.GetRange(0, 0, size, size, mn, mx) && mn==tmn && mx==tmx);
+	TEST_CHECK(bounds.GetRange(-50, -50, size+50, size+50, mn, mx) && mn==tmn && mx==tmx);
+
+	for(int y=0; y<size; y+=cell)
+		for(int x=0; x<size; x+=cell)
+		{
+			ScanRange(pHeights, size, x, y, x+cell, y+cell, tmn, tmx);
+			TEST_CHECK(bounds.GetRange(x, y, x+cell, y+cell, mn, mx) && mn==tmn && mx==tmx);
+		}
+
+	TEST_CHECK(!bounds.GetRange(size, 0, size+10, 10, mn, mx));
+	TEST_CHECK(!bounds.GetRange(-10, -10, 0, 0, mn, mx));
+	TEST_CHECK(!bounds.GetRange(5, 5, 5, 10, mn, mx));
+	delete[] pHeights;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Sculpting random rects and updating only the cells under them keeps every query
+// holding the true range.  A range may be looser than a scan, never tighter.
+//--------------------------------------------------------------------------------------
+SELF_TEST(HeightBoundsSculpt)
+{
+	const int size=333, queries=3000;
+	UINT state = 5;
+	D3DXFLOAT16* pHeights = CreateTestHeights(size, state);
+	HeightBounds bounds;
+	if(!TEST_CHECK(bounds.Create(pHeights, size)))
+	{
+		delete[] pHeights;
+		return;
+	}
+
+	int wrong = 0;
+	for(int q=0; q<queries; q++)
+	{
+		state ^= state<<13; state ^= state>>17; state ^= state<<5;
+		if(q%4==0)
+		{
+			RECT r;
+			r.left = (state>>4) % size;
+			r.top = (state>>12) % size;
+			r.right = Math::Min((int)r.left + 1 + (int)((state>>20)%40), size);
+			r.bottom = Math::Min((int)r.top + 1 + (int)((state>>24)%40), size);
+			float delta = (float)((int)(state%200) - 100);
+			for(int y=r.top; y<r.bottom; y++)
+				for(int x=r.left; x<r.right; x++)
+					pHeights[y*size+x] = (D3DXFLOAT16)((float)pHeights[y*size+x] + delta);
+			bounds.Update(pHeights, r);
+		}
+
+		// Query rects of all sizes, some hanging off the edges
+		int w = 1 + (state>>6)%(size/2);
+		int h = 1 + (state>>14)%(size/2);
+		int x0 = (int)((state>>3)%(size+16)) - 8 - w/2;
+		int y0 = (int)((state>>11)%(size+16)) - 8 - h/2;
+		float mn, mx, tmn, tmx;
+		bool hit = bounds.GetRange(x0, y0, x0+w, y0+h, mn, mx);
+		bool inside = ScanRange(pHeights, size, x0, y0, x0+w, y0+h, tmn, tmx);
+		if(hit!=inside || (inside && (mn>tmn || mx<tmx)))
+			wrong++;
+	}
+	TEST_CHECK(wrong==0);
+
+	// The whole map is still exact after the edits
+	float mn, mx, tmn, tmx;
+	ScanRange(pHeights, size, 0, 0, size, size, tmn, tmx);
+	TEST_CHECK(bounds.GetRange(0, 0, size, size, mn, mx) && mn==tmn && mx==tmx);
+	delete[] pHeights;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cell sizes that aren't a power of two are refused
+//--------------------------------------------------------------------------------------
+SELF_TEST(HeightBoundsCreate)
+{
+	D3DXFLOAT16 heights[64];
+	for(int i=0; i<64; i++)
+		heights[i] = (D3DXFLOAT16)(float)i;
+	HeightBounds bounds;
+	TEST_CHECK(!bounds.Create(heights, 8, 12));
+	TEST_CHECK(!bounds.Create(NULL, 8));
+	TEST_CHECK(!bounds.IsCreated());
+
+	float mn, mx;
+	TEST_CHECK(bounds.Create(heights, 8, 4) && bounds.GetLevels()==2);
+	TEST_CHECK(bounds.GetRange(4, 0, 8, 4, mn, mx) && mn==4.0f && mx==31.0f);
+	TEST_CHECK(bounds.GetRange(3, 3, 4, 4, mn, mx) && mn==0.0f && mx==27.0f);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A pyramid built from the ranges of its cells answers every rect like one built from
+// the heights
+//--------------------------------------------------------------------------------------
+SELF_TEST(HeightBoundsFromRanges)
+{
+	const int size=200, cell=HEIGHT_BOUNDS_CELL, cells=(size+cell-1)/cell;
+	UINT state = 3;
+	D3DXFLOAT16* pHeights = CreateTestHeights(size, state);
+	float* pRanges = new float[cells*cells*2];
+	for(int cy=0; cy<cells; cy++)
+		for(int cx=0; cx<cells; cx++)
+			ScanRange(pHeights, size, cx*cell, cy*cell, cx*cell+cell, cy*cell+cell, pRanges[(cy*cells+cx)*2], pRanges[(cy*cells+cx)*2+1]);
+
+	HeightBounds scanned, seeded;
+	TEST_CHECK(!seeded.CreateFromRanges(NULL, size));
+	if(TEST_CHECK(scanned.Create(pHeights, size) && seeded.CreateFromRanges(pRanges, size)))
+	{
+		TEST_CHECK(seeded.GetLevels()==scanned.GetLevels());
+		int mismatches = 0;
+		for(int i=0; i<500; i++)
+		{
+			int x0 = (int)(TestRand(state)%(size+40)) - 20, y0 = (int)(TestRand(state)%(size+40)) - 20;
+			int x1 = x0 + 1 + TestRand(state)%size, y1 = y0 + 1 + TestRand(state)%size;
+			float mn0, mx0, mn1, mx1;
+			bool inside0 = scanned.GetRange(x0, y0, x1, y1, mn0, mx0);
+			bool inside1 = seeded.GetRange(x0, y0, x1, y1, mn1, mx1);
+			if(inside0!=inside1 || (inside0 && (mn0!=mn1 || mx0!=mx1)))
+				mismatches++;
+		}
+		TEST_CHECK(mismatches==0);
+	}
+	delete[] pRanges;
+	delete[] pHeights;
+}
+
+#endif
@@ -0,0 +1,371 @@
+//--------------------------------------------------------------------------------------
+// File: HeightmapTests.cpp
+//
+// Self tests for the liquid heightmap generator and the terrain normal maps
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Heightmap.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+// Wave equation constants the terrain editor uses
+#define LIQUID_D	1.0f
+#define LIQUID_T	0.1f
+#define LIQUID_MU	0.01f
+#define LIQUID_C	1.0f
+
+
+//--------------------------------------------------------------------------------------
+// The tiled generator gives the same bytes as the scalar loop, for sizes that do and
+// do not fill the last tiles and the last SSE group, and step counts on both sides of
+// a block
+//--------------------------------------------------------------------------------------
+SELF_TEST(LiquidHeightmapMatchesReference)
+{
+	const struct { int w, h, num; UINT seed; } cases[] = {
+		{ 257, 300, 37, 5 },	// Partial last tiles and partial SSE groups
+		{ 256, 256,  8, 3 },	// Exactly one block over whole tiles
+		{ 129, 131,  9, 4 },	// One step into the second block, one texel edge tiles
+		{  13,   9,  3, 1 },	// Smaller than a tile and its halo
+		{   3, 200, 10, 6 },	// A single column of interior texels
+		{ 500, 130,  0, 2 },	// No steps, just the seed normalized
+	};
+
+	for(int c=0; c<sizeof(cases)/sizeof(cases[0]); c++)
+	{
+		const int w = cases[c].w;
+		const int h = cases[c].h;
+		unsigned char* pRef = GenerateLiquidHeightmapReference(w, h, cases[c].num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, cases[c].seed);
+		unsigned char* pImg = GenerateLiquidHeightmap(w, h, cases[c].num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, cases[c].seed);
+
+		int diff=0;
+		for(int i=0; i<w*h; i++)
+			if(pImg[i]!=pRef[i])
+				diff++;
+		if(!TEST_CHECK(diff==0))
+			Log::Print("    %dx%d, %d steps: %d texels differ", w, h, cases[c].num, diff);
+
+		delete[] pRef;
+		delete[] pImg;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// An empty map has nothing to simulate
+//--------------------------------------------------------------------------------------
+SELF_TEST(LiquidHeightmapEmpty)
+{
+	TEST_CHECK(GenerateLiquidHeightmap(0, 64, 10, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C)==NULL);
+	TEST_CHECK(GenerateLiquidHeightmap(64, 0, 10, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C)==NULL);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The seed alone decides the surface, and the fixed border rows and columns all land
+// on the same height
+//--------------------------------------------------------------------------------------
+SELF_TEST(LiquidHeightmapSeed)
+{
+	const int w=192, h=160, num=20;
+	unsigned char* pA = GenerateLiquidHeightmap(w, h, num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, 7);
+	unsigned char* pB = GenerateLiquidHeightmap(w, h, num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, 7);
+	unsigned char* pC = GenerateLiquidHeightmap(w, h, num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, 8);
+
+	TEST_CHECK(memcmp(pA, pB, w*h)==0);
+	TEST_CHECK(memcmp(pA, pC, w*h)!=0);
+
+	int border=0;
+	for(int x=0; x<w; x++)
+		border += (pA[x]!=pA[0]) + (pA[(h-1)*w+x]!=pA[0]);
+	for(int y=0; y<h; y++)
+		border += (pA[y*w]!=pA[0]) + (pA[y*w+w-1]!=pA[0]);
+	TEST_CHECK(border==0);
+
+	delete[] pA;
+	delete[] pB;
+	delete[] pC;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The output is normalized to the full byte range
+//--------------------------------------------------------------------------------------
+SELF_TEST(LiquidHeightmapRange)
+{
+	const int w=256, h=256;
+	unsigned char* pImg = GenerateLiquidHeightmap(w, h, 50, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, 11);
+	int lo=255, hi=0;
+	for(int i=0; i<w*h; i++)
+	{
+		lo = Math::Min(lo, (int)pImg[i]);
+		hi = Math::Max(hi, (int)pImg[i]);
+	}
+	TEST_CHECK(lo==0);
+	TEST_CHECK(hi==255);
+	delete[] pImg;
+}
+
+
+// Rolling hills with some noise on top, up to about 60 units high
+static void CreateTestHeights(float* pHeight, int w, int h, UINT seed)
+{
+	for(int y=0; y<h; y++)
+		for(int x=0; x<w; x++)
+			pHeight[y*w+x] = 20.0f*sinf(x*0.11f) + 15.0f*cosf(y*0.07f + x*0.03f) + TestRandFloat(seed, 0, 25.0f);
+}
+
+// The Sobel normal of one texel, one at a time and clamped at the map edges
+static PackedNormal ReferenceNormal(const float* pHeight, int w, int h, int x, int y, float hs)
+{
+	int xl = Math::Max(x-1, 0), xh = Math::Min(x+1, w-1);
+	int yl = Math::Max(y-1, 0), yh = Math::Min(y+1, h-1);
+	const float* r0 = pHeight + yl*w;
+	const float* r1 = pHeight + y*w;
+	const float* r2 = pHeight + yh*w;
+	float gx = (r0[xh] + r2[xh] + 2*r1[xh]) - (r0[xl] + r2[xl] + 2*r1[xl]);
+	float gz = (r2[xl] + r2[xh] + 2*r2[x]) - (r0[xl] + r0[xh] + 2*r0[x]);
+	return EncodeNormal(D3DXVECTOR3(gx*-0.125f, hs, gz*-0.125f));
+}
+
+// Largest difference between two packed maps, in snorm16 steps
+static int PackedNormalDiff(const PackedNormal* pA, const PackedNormal* pB, int count)
+{
+	int diff=0;
+	for(int i=0; i<count; i++)
+	{
+		diff = Math::Max(diff, abs(pA[i].x-pB[i].x));
+		diff = Math::Max(diff, abs(pA[i].z-pB[i].z));
+	}
+	return diff;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The SSE rows give the same packed normals as the scalar filter, from float and half
+// heights, for widths that do and do not fill the last group of four.  The SSE path
+// rounds halves to even, so a texel may be one step off.
+//--------------------------------------------------------------------------------------
+SELF_TEST(NormalMapMatchesScalar)
+{
+	const struct { int w, h; } sizes[] = { { 37, 23 }, { 64, 64 }, { 6, 3 }, { 5, 9 }, { 1, 7 }, { 2, 2 } };
+	for(int c=0; c<sizeof(sizes)/sizeof(sizes[0]); c++)
+	{
+		const int w = sizes[c].w;
+		const int h = sizes[c].h;
+		float* pHeight = new float[w*h];
+		D3DXFLOAT16* pHalf = new D3DXFLOAT16[w*h];
+		float* pRounded = new float[w*h];
+		PackedNormal* pRef = new PackedNormal[w*h];
+		PackedNormal* pOut = new PackedNormal[w*h];
+		CreateTestHeights(pHeight, w, h, c+1);
+		D3DXFloat32To16Array(pHalf, pHeight, w*h);
+		D3DXFloat16To32Array(pRounded, pHalf, w*h);
+
+		// Float heights
+		for(int y=0; y<h; y++)
+			for(int x=0; x<w; x++)
+				pRef[y*w+x] = ReferenceNormal(pHeight, w, h, x, y, 2.0f);
+		GenerateNormalMap(pHeight, w, h, 2.0f, pOut);
+		if(!TEST_CHECK(PackedNormalDiff(pRef, pOut, w*h)<=1))
+			Log::Print("    %dx%d float: %d steps off", w, h, PackedNormalDiff(pRef, pOut, w*h));
+
+		// Half heights are the float heights rounded
+		for(int y=0; y<h; y++)
+			for(int x=0; x<w; x++)
+				pRef[y*w+x] = ReferenceNormal(pRounded, w, h, x, y, 2.0f);
+		GenerateNormalMap((const D3DXFLOAT16*)pHalf, w, h, 2.0f, pOut);
+		if(!TEST_CHECK(PackedNormalDiff(pRef, pOut, w*h)<=1))
+			Log::Print("    %dx%d half: %d steps off", w, h, PackedNormalDiff(pRef, pOut, w*h));
+
+		// The full precision map points the same way
+		D3DXVECTOR3* pVector = GenerateNormalMap(pHeight, w, h, 2.0f);
+		GenerateNormalMap(pHeight, w, h, 2.0f, pOut);
+		float worst = 1;
+		for(int i=0; i<w*h; i++)
+		{
+			D3DXVECTOR3 n = DecodeNormal(pOut[i]);
+			worst = Math::Min(worst, n.x*pVector[i].x + n.y*pVector[i].y + n.z*pVector[i].z);
+		}
+		TEST_CHECK(worst>0.99999f);
+
+		delete[] pVector;
+		delete[] pHeight;
+		delete[] pHalf;
+		delete[] pRounded;
+		delete[] pRef;
+		delete[] pOut;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Updating the normals under a changed rect gives the same map as rebuilding it, and
+// leaves the texels the change can't reach alone
+//--------------------------------------------------------------------------------------
+SELF_TEST(NormalMapDirtyRect)
+{
+	const int w=97, h=80;
+	const RECT rects[] = { { 10, 20, 31, 29 }, { 0, 0, 5, 3 }, { 90, 70, 97, 80 }, { 40, 7, 41, 8 } };
+	float* pHeight = new float[w*h];
+	D3DXFLOAT16* pHalf = new D3DXFLOAT16[w*h];
+	PackedNormal* pOld = new PackedNormal[w*h];
+	PackedNormal* pUpdated = new PackedNormal[w*h];
+	PackedNormal* pFull = new PackedNormal[w*h];
+	CreateTestHeights(pHeight, w, h, 9);
+	UINT seed = 3;
+
+	for(int r=0; r<sizeof(rects)/sizeof(rects[0]); r++)
+	{
+		const RECT& dirty = rects[r];
+		for(int pass=0; pass<2; pass++)
+		{
+			// Normals of the heights before the change
+			D3DXFloat32To16Array(pHalf, pHeight, w*h);
+			if(pass==0)
+				GenerateNormalMap(pHeight, w, h, 1.0f, pOld);
+			else
+				GenerateNormalMap((const D3DXFLOAT16*)pHalf, w, h, 1.0f, pOld);
+			memcpy(pUpdated, pOld, w*h*sizeof(PackedNormal));
+
+			// Raise the rect
+			for(int y=dirty.top; y<dirty.bottom; y++)
+				for(int x=dirty.left; x<dirty.right; x++)
+					pHeight[y*w+x] += TestRandFloat(seed, 2.0f, 10.0f);
+			D3DXFloat32To16Array(pHalf, pHeight, w*h);
+
+			if(pass==0)
+			{
+				UpdateNormalMap(pHeight, w, h, 1.0f, pUpdated, dirty);
+				GenerateNormalMap(pHeight, w, h, 1.0f, pFull);
+			}
+			else
+			{
+				UpdateNormalMap((const D3DXFLOAT16*)pHalf, w, h, 1.0f, pUpdated, dirty);
+				GenerateNormalMap((const D3DXFLOAT16*)pHalf, w, h, 1.0f, pFull);
+			}
+			if(!TEST_CHECK(PackedNormalDiff(pUpdated, pFull, w*h)<=1))
+				Log::Print("    rect %d, pass %d: %d steps off", r, pass, PackedNormalDiff(pUpdated, pFull, w*h));
+
+			// Outside the rect and its one texel border nothing was written, and the
+			// border itself did change
+			int outside=0, border=0;
+			for(int y=0; y<h; y++)
+				for(int x=0; x<w; x++)
+				{
+					bool near = x>=dirty.left-1 && x<=dirty.right && y>=dirty.top-1 && y<=dirty.bottom;
+					bool inside = x>=dirty.left && x<dirty.right && y>=dirty.top && y<dirty.bottom;
+					bool same = memcmp(&pUpdated[y*w+x], &pOld[y*w+x], sizeof(PackedNormal))==0;
+					if(!near && !same)
+						outside++;
+					if(near && !inside && !same)
+						border++;
+				}
+			TEST_CHECK(outside==0);
+			TEST_CHECK(border>0);
+		}
+	}
+
+	delete[] pHeight;
+	delete[] pHalf;
+	delete[] pOld;
+	delete[] pUpdated;
+	delete[] pFull;
+}
+
+
+//--------------------------------------------------------------------------------------
+// A zero vector packs to the middle of the square instead of dividing by zero, on the
+// SSE path as well as the clamped edge texels
+//--------------------------------------------------------------------------------------
+SELF_TEST(NormalMapZeroVector)
+{
+	PackedNormal p = EncodeNormal(D3DXVECTOR3(0, 0, 0));
+	TEST_CHECK(p.x==0 && p.z==0);
+
+	// A flat map with no grid spacing has no normal anywhere
+	const int w=13, h=5;
+	float heights[w*h];
+	PackedNormal normals[w*h];
+	for(int i=0; i<w*h; i++)
+		heights[i] = 3.0f;
+	memset(normals, 0x7f, sizeof(normals));
+	GenerateNormalMap(heights, w, h, 0.0f, normals);
+	int bad=0;
+	for(int i=0; i<w*h; i++)
+		bad += normals[i].x!=0 || normals[i].z!=0;
+	TEST_CHECK(bad==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times the scalar loop against the tiled generator on an editor sized map
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(LiquidHeightmap)
+{
+	const int w=1024, h=1024, num=64;
+
+	double start = SelfTest::GetTime();
+	unsigned char* pRef = GenerateLiquidHeightmapReference(w, h, num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, 1);
+	double refTime = SelfTest::GetTime()-start;
+
+	start = SelfTest::GetTime();
+	unsigned char* pImg = GenerateLiquidHeightmap(w, h, num, LIQUID_D, LIQUID_T, LIQUID_MU, LIQUID_C, 1);
+	double time = SelfTest::GetTime()-start;
+
+	TEST_CHECK(memcmp(pRef, pImg, w*h)==0);
+	Log::Print("    %dx%d, %d steps: scalar %.1fms, tiled %.1fms", w, h, num, refTime, time);
+
+	delete[] pRef;
+	delete[] pImg;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times packing the normals of a streaming sized map from half heights, against the
+// scalar filter and against the update after a sculpt stroke
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(NormalMap)
+{
+	const int w=2048, h=2048;
+	float* pHeight = new float[w*h];
+	D3DXFLOAT16* pHalf = new D3DXFLOAT16[w*h];
+	PackedNormal* pRef = new PackedNormal[w*h];
+	PackedNormal* pOut = new PackedNormal[w*h];
+	CreateTestHeights(pHeight, w, h, 1);
+	D3DXFloat32To16Array(pHalf, pHeight, w*h);
+	D3DXFloat16To32Array(pHeight, pHalf, w*h);
+
+	double start = SelfTest::GetTime();
+	for(int y=0; y<h; y++)
+		for(int x=0; x<w; x++)
+			pRef[y*w+x] = ReferenceNormal(pHeight, w, h, x, y, 1.0f);
+	double refTime = SelfTest::GetTime()-start;
+
+	start = SelfTest::GetTime();
+	GenerateNormalMap((const D3DXFLOAT16*)pHalf, w, h, 1.0f, pOut);
+	double time = SelfTest::GetTime()-start;
+	TEST_CHECK(PackedNormalDiff(pRef, pOut, w*h)<=1);
+
+	RECT brush = { 1000, 1000, 1064, 1064 };
+	start = SelfTest::GetTime();
+	UpdateNormalMap((const D3DXFLOAT16*)pHalf, w, h, 1.0f, pOut, brush);
+	double brushTime = SelfTest::GetTime()-start;
+
+	Log::Print("    %dx%d: scalar %.1fms, SSE %.1fms, 64x64 brush %.3fms", w, h, refTime, time, brushTime);
+
+	delete[] pHeight;
+	delete[] pHalf;
+	delete[] pRef;
+	delete[] pOut;
+}
+
+#endif
@@ -0,0 +1,163 @@
+//--------------------------------------------------------------------------------------
+// File: InstanceBufferTests.cpp
+//
+// Self tests for the instance ring buffer and the memory the particle emitters report
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "InstanceBuffer.h"
+#include "Particle.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Maps a batch and tags each instance with the batch and its place in it
+static bool WriteBatch(InstanceBuffer& buffer, int count, float tag, int& first)
+{
+	D3DXVECTOR4* pData = (D3DXVECTOR4*)buffer.Map(count, first);
+	if(!pData)
+		return false;
+	for(int i=0; i<count; i++)
+		pData[i] = D3DXVECTOR4(tag, (float)i, 0, 1);
+	buffer.Unmap();
+	return true;
+}
+
+// Copies the whole buffer back through a staging buffer
+static bool ReadInstances(InstanceBuffer& buffer, D3DXVECTOR4* pInstances)
+{
+	D3D10_BUFFER_DESC bd;
+	buffer.GetBuffer()->GetDesc(&bd);
+	bd.Usage = D3D10_USAGE_STAGING;
+	bd.BindFlags = 0;
+	bd.CPUAccessFlags = D3D10_CPU_ACCESS_READ;
+	bd.MiscFlags = 0;
+	ID3D10Buffer* pStage = NULL;
+	if(FAILED(g_pd3dDevice->CreateBuffer(&bd, NULL, &pStage)))
+		return false;
+	g_pd3dDevice->CopyResource(pStage, buffer.GetBuffer());
+	void* pData;
+	bool ok = SUCCEEDED(pStage->Map(D3D10_MAP_READ, 0, &pData));
+	if(ok)
+	{
+		memcpy(pInstances, pData, bd.ByteWidth);
+		pStage->Unmap();
+	}
+	pStage->Release();
+	return ok;
+}
+
+// Is a batch still where it was written?
+static bool BatchIntact(const D3DXVECTOR4* pInstances, int first, int count, float tag)
+{
+	for(int i=0; i<count; i++)
+		if(pInstances[first+i].x!=tag || pInstances[first+i].y!=(float)i)
+			return false;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Batches go one after another with no-overwrite, the ring is discarded when a batch
+// doesn't fit, and a batch bigger than the buffer grows it without moving the batches
+// already written
+//--------------------------------------------------------------------------------------
+SELF_DEVICE_TEST(InstanceBufferRing)
+{
+	InstanceBuffer buffer;
+	if(!TEST_CHECK(buffer.Create(sizeof(D3DXVECTOR4), 8)))
+		return;
+	D3DXVECTOR4 instances[32];
+	int first = -1;
+
+	// Fill it exactly
+	TEST_CHECK(WriteBatch(buffer, 3, 1, first) && first==0);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_DISCARD && buffer.GetDiscards()==1);
+	TEST_CHECK(WriteBatch(buffer, 3, 2, first) && first==3);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_NO_OVERWRITE);
+	TEST_CHECK(WriteBatch(buffer, 2, 3, first) && first==6);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_NO_OVERWRITE && buffer.GetDiscards()==1);
+	if(TEST_CHECK(ReadInstances(buffer, instances)))
+		TEST_CHECK(BatchIntact(instances, 0, 3, 1) && BatchIntact(instances, 3, 3, 2) && BatchIntact(instances, 6, 2, 3));
+
+	// Wrap
+	TEST_CHECK(WriteBatch(buffer, 1, 4, first) && first==0);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_DISCARD && buffer.GetDiscards()==2);
+	TEST_CHECK(WriteBatch(buffer, 3, 5, first) && first==1);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_NO_OVERWRITE);
+
+	// Past the capacity, the new batch goes after the others in a bigger buffer
+	TEST_CHECK(WriteBatch(buffer, 20, 6, first) && first==4);
+	TEST_CHECK(buffer.GetGrows()==1 && buffer.GetCapacity()==24);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_NO_OVERWRITE && buffer.GetDiscards()==2);
+	TEST_CHECK(buffer.GetMemoryUsage()==24*(int)sizeof(D3DXVECTOR4));
+	if(TEST_CHECK(ReadInstances(buffer, instances)))
+		TEST_CHECK(BatchIntact(instances, 0, 1, 4) && BatchIntact(instances, 1, 3, 5) && BatchIntact(instances, 4, 20, 6));
+	TEST_CHECK(WriteBatch(buffer, 2, 7, first) && first==0);
+	TEST_CHECK(buffer.GetLastMapType()==D3D10_MAP_WRITE_DISCARD && buffer.GetDiscards()==3);
+
+	// A new buffer grows on its first map with nothing to keep
+	TEST_CHECK(buffer.Create(sizeof(D3DXVECTOR4), 4));
+	TEST_CHECK(WriteBatch(buffer, 10, 8, first) && first==0);
+	TEST_CHECK(buffer.GetCapacity()==10 && buffer.GetLastMapType()==D3D10_MAP_WRITE_DISCARD);
+	if(TEST_CHECK(ReadInstances(buffer, instances)))
+		TEST_CHECK(BatchIntact(instances, 0, 10, 8));
+
+	// Nothing, or a second map before the unmap
+	TEST_CHECK(buffer.Map(0, first)==NULL);
+	TEST_CHECK(buffer.Map(2, first)!=NULL);
+	TEST_CHECK(buffer.Map(2, first)==NULL);
+	buffer.Unmap();
+	buffer.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// An emitter reports its particle streams and sort arrays, sized from its own
+// maxParticles, and nothing for the shared instances
+//--------------------------------------------------------------------------------------
+SELF_DEVICE_TEST(InstanceBufferEmitterBytes)
+{
+	Effect effect;
+	Camera camera;
+	ParticleEmitter small, big, sorted;
+	ParticleEmitterDesc desc;
+	desc.Texture[0] = 0;
+	desc.MaxParticles = 1000;
+	small.Create(desc, effect, camera);
+	desc.MaxParticles = 50001;
+	big.Create(desc, effect, camera);
+	desc.DepthSort = true;
+	sorted.Create(desc, effect, camera);
+
+	// The streams hold the capacity rounded up to four
+	TEST_CHECK(small.GetStore().GetCapacity()==1000 && big.GetStore().GetCapacity()==50004);
+	TEST_CHECK(big.GetMemoryUsage()-small.GetMemoryUsage()==(50004-1000)*PARTICLE_STREAM_COUNT*(int)sizeof(float));
+	TEST_CHECK(small.GetMemoryUsage()<(int)sizeof(ParticleEmitter) + 1000*PARTICLE_STREAM_COUNT*(int)sizeof(float) + 65536);
+
+	// Sort arrays show up once the emitter has sorted
+	TEST_CHECK(sorted.GetSortMemoryUsage()==0 && sorted.GetMemoryUsage()==big.GetMemoryUsage());
+	Array<ParticleEmitter*> emitters;
+	emitters.Add(&small);
+	emitters.Add(&big);
+	emitters.Add(&sorted);
+	Array<ParticleDraw> draws;
+	int total = ParticleEmitter::SimulateEmitters(emitters, draws, 1.0f/60.0f);
+	TEST_CHECK(total==small.GetNumParticles()+big.GetNumParticles()+sorted.GetNumParticles() && total>0);
+	TEST_CHECK(sorted.GetSortMemoryUsage()>=50004*(int)(sizeof(USHORT)+sizeof(int)+sizeof(float)));
+	TEST_CHECK(sorted.GetMemoryUsage()-big.GetMemoryUsage()==sorted.GetSortMemoryUsage());
+	TEST_CHECK(small.GetSortMemoryUsage()==0);
+
+	small.Release();
+	big.Release();
+	sorted.Release();
+}
+
+#endif
@@ -0,0 +1,312 @@
+//--------------------------------------------------------------------------------------
+// File: MeshBVHTests.cpp
+//
+// Self tests and benchmark for the triangle BVH used for picking
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "MeshBVH.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include <float.h>
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+//--------------------------------------------------------------------------------------
+// Closest hit over every triangle, what the tree has to match.  Two sided, with the
+// same determinant test as the tree's own.
+//--------------------------------------------------------------------------------------
+static int BruteForceRay(const D3DXVECTOR3* pVerts, const DWORD* pIndices, int numIndices,
+	const D3DXVECTOR3& orig, const D3DXVECTOR3& dir, float maxT, float& bestT)
+{
+	int best = -1;
+	bestT = maxT;
+	for(int i=0; i<numIndices; i+=3)
+	{
+		D3DXVECTOR3 e1 = pVerts[pIndices[i+1]]-pVerts[pIndices[i]], e2 = pVerts[pIndices[i+2]]-pVerts[pIndices[i]], p, q;
+		D3DXVec3Cross(&p, &dir, &e2);
+		float det = D3DXVec3Dot(&e1, &p);
+		if(det==0)
+			continue;
+		D3DXVECTOR3 s = orig-pVerts[pIndices[i]];
+		float u = D3DXVec3Dot(&s, &p)/det;
+		D3DXVec3Cross(&q, &s, &e1);
+		float v = D3DXVec3Dot(&dir, &q)/det;
+		float t = D3DXVec3Dot(&e2, &q)/det;
+		if(u>=0 && u<=1 && v>=0 && u+v<=1 && t>0 && t<bestT)
+		{
+			bestT = t;
+			best = i/3;
+		}
+	}
+	return best;
+}
+
+// A hit matches if it is the same triangle or one just as close
+static bool SameHit(const MeshRayHit& hit, int expected, float expectedT)
+{
+	if(hit.Tri==expected)
+		return true;
+	return hit.Tri>=0 && expected>=0 && fabsf(hit.t-expectedT)<=1e-5f*max(1.0f, expectedT);
+}
+
+// Small triangles scattered through a box
+static void MakeTriangleSoup(int numTris, UINT& state, D3DXVECTOR3* pVerts, DWORD* pIndices)
+{
+	for(int i=0; i<numTris; i++)
+	{
+		D3DXVECTOR3 c(TestRandFloat(state, -10, 10), TestRandFloat(state, -10, 10), TestRandFloat(state, -10, 10));
+		for(int k=0; k<3; k++)
+		{
+			pVerts[i*3+k] = c + D3DXVECTOR3(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1));
+			pIndices[i*3+k] = i*3+k;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// One triangle: the hit, its barycentric coords, both sides, misses and the range of t
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshBVHSingleTriangle)
+{
+	const D3DXVECTOR3 verts[3] = { D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(1, 0, 0), D3DXVECTOR3(0, 1, 0) };
+	const DWORD indices[3] = { 0, 1, 2 };
+	MeshBVH bvh;
+	if(!TEST_CHECK(bvh.Build(verts, sizeof(D3DXVECTOR3), 3, indices, 3)))
+		return;
+	TEST_CHECK(bvh.GetNumNodes()==1 && bvh.GetNumTris()==1);
+
+	MeshRayHit hit;
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.25f, 0.5f, 5), D3DXVECTOR3(0, 0, -1), 100, hit));
+	TEST_CHECK(hit.Tri==0 && hit.SubMesh==-1);
+	TEST_CHECK_NEAR(hit.t, 5.0f, 1e-6f);
+	TEST_CHECK_NEAR(hit.u, 0.25f, 1e-6f);
+	TEST_CHECK_NEAR(hit.v, 0.5f, 1e-6f);
+
+	// The back is hit too, and t is in units of the direction
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.25f, 0.25f, -4), D3DXVECTOR3(0, 0, 2), 100, hit));
+	TEST_CHECK_NEAR(hit.t, 2.0f, 1e-6f);
+
+	// Beside it, away from it, past maxT and starting on the far side
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.75f, 0.75f, 5), D3DXVECTOR3(0, 0, -1), 100, hit));
+	TEST_CHECK(hit.Tri==-1);
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.25f, 0.5f, 5), D3DXVECTOR3(0, 0, 1), 100, hit));
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.25f, 0.5f, 5), D3DXVECTOR3(0, 0, -1), 4.9f, hit));
+	TEST_CHECK(hit.t==4.9f);
+
+	// Nothing to build and nothing to hit
+	TEST_CHECK(!bvh.Build(verts, sizeof(D3DXVECTOR3), 3, indices, 0));
+	TEST_CHECK(!bvh.IsBuilt());
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.25f, 0.5f, 5), D3DXVECTOR3(0, 0, -1), 100, hit));
+	bvh.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// A stack of square layers, each two triangles.  Rays straight along the stack from
+// either end hit the first layer they meet, so the walk must find the closest hit
+// whichever child it goes into first.  Rays along the other axes don't divide by zero.
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshBVHClosestHit)
+{
+	const int numLayers = 40;
+	D3DXVECTOR3 verts[numLayers*4];
+	DWORD indices[numLayers*6];
+	for(int l=0; l<numLayers; l++)
+	{
+		float z = (float)l;
+		verts[l*4] = D3DXVECTOR3(0, 0, z);
+		verts[l*4+1] = D3DXVECTOR3(1, 0, z);
+		verts[l*4+2] = D3DXVECTOR3(0, 1, z);
+		verts[l*4+3] = D3DXVECTOR3(1, 1, z);
+		const DWORD quad[6] = { 0, 1, 2, 2, 1, 3 };
+		for(int k=0; k<6; k++)
+			indices[l*6+k] = l*4 + quad[k];
+	}
+	MeshBVH bvh;
+	if(!TEST_CHECK(bvh.Build(verts, sizeof(D3DXVECTOR3), numLayers*4, indices, numLayers*6)))
+		return;
+	TEST_CHECK(bvh.GetNumTris()==numLayers*2 && bvh.GetNumNodes()<=numLayers*4-1);
+
+	MeshRayHit hit;
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.2f, 0.2f, -3), D3DXVECTOR3(0, 0, 1), 1000, hit));
+	TEST_CHECK(hit.Tri==0 && hit.t==3.0f);
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.8f, 0.8f, 50), D3DXVECTOR3(0, 0, -1), 1000, hit));
+	TEST_CHECK(hit.Tri==(numLayers-1)*2+1 && hit.t==51.0f-numLayers);
+
+	// From inside the stack each way, and a layer further on once the first is out of reach
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.2f, 0.2f, 17.5f), D3DXVECTOR3(0, 0, 1), 1000, hit));
+	TEST_CHECK(hit.Tri==18*2 && hit.t==0.5f);
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.2f, 0.2f, 17.5f), D3DXVECTOR3(0, 0, -1), 1000, hit));
+	TEST_CHECK(hit.Tri==17*2 && hit.t==0.5f);
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.2f, 0.2f, 17.5f), D3DXVECTOR3(0, 0, -1), 0.25f, hit));
+
+	// Across the layers, along x and along y, in the plane of none of them
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(-1, 0.5f, 10.5f), D3DXVECTOR3(1, 0, 0), 1000, hit));
+	TEST_CHECK(!bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.5f, -1, 10.5f), D3DXVECTOR3(0, 1, 0), 1000, hit));
+
+	// A slanted ray through the stack from behind
+	TEST_CHECK(bvh.Intersect(verts, sizeof(D3DXVECTOR3), D3DXVECTOR3(0.1f, 0.1f, 60), D3DXVECTOR3(0.01f, 0.01f, -1), 1000, hit));
+	TEST_CHECK(hit.Tri/2==numLayers-1 && fabsf(hit.t-(61.0f-numLayers))<1e-4f);
+	bvh.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Random rays through a random triangle soup match a loop over all the triangles, one
+// at a time and as a batch, and again after moving the vertices and refitting a copy of
+// the tree.  Some rays run along an axis.
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshBVHMatchesBruteForce)
+{
+	const int numTris = 3000, numRays = 2000;
+	UINT state = 2891336453u;
+	int numVerts = numTris*3;
+	D3DXVECTOR3* pVerts = new D3DXVECTOR3[numVerts];
+	DWORD* pIndices = new DWORD[numTris*3];
+	MakeTriangleSoup(numTris, state, pVerts, pIndices);
+
+	// Rays from outside the box towards points inside it
+	D3DXVECTOR3* pOrig = new D3DXVECTOR3[numRays];
+	D3DXVECTOR3* pDir = new D3DXVECTOR3[numRays];
+	for(int i=0; i<numRays; i++)
+	{
+		pOrig[i] = D3DXVECTOR3(TestRandFloat(state, -20, 20), TestRandFloat(state, -20, 20), TestRandFloat(state, -20, 20));
+		D3DXVECTOR3 target(TestRandFloat(state, -10, 10), TestRandFloat(state, -10, 10), TestRandFloat(state, -10, 10));
+		pDir[i] = target-pOrig[i];
+		if(i%5==0)
+			pDir[i].x = pDir[i].y = 0;
+	}
+
+	MeshBVH bvh, pose;
+	MeshRayHit* pHits = new MeshRayHit[numRays];
+	if(!TEST_CHECK(bvh.Build(pVerts, sizeof(D3DXVECTOR3), numVerts, pIndices, numTris*3)))
+		return;
+	TEST_CHECK(bvh.GetNumTris()==numTris && bvh.GetNumNodes()<numTris*2);
+
+	int errors = 0, numHits = 0;
+	for(int i=0; i<numRays; i++)
+	{
+		float t;
+		int expected = BruteForceRay(pVerts, pIndices, numTris*3, pOrig[i], pDir[i], 1000.0f, t);
+		MeshRayHit hit;
+		bvh.Intersect(pVerts, sizeof(D3DXVECTOR3), pOrig[i], pDir[i], 1000.0f, hit);
+		errors += !SameHit(hit, expected, t);
+		numHits += expected>=0;
+	}
+	if(!TEST_CHECK(errors==0))
+		Log::Print("MeshBVHMatchesBruteForce: %d of %d rays differ", errors, numRays);
+	TEST_CHECK(numHits>numRays/10 && numHits<numRays);
+
+	// The batch gives the same hits
+	int batchHits = bvh.IntersectBatch(pVerts, sizeof(D3DXVECTOR3), pOrig, pDir, numRays, 1000.0f, pHits);
+	int batchErrors = 0, singleHits = 0;
+	for(int i=0; i<numRays; i++)
+	{
+		MeshRayHit hit;
+		singleHits += bvh.Intersect(pVerts, sizeof(D3DXVECTOR3), pOrig[i], pDir[i], 1000.0f, hit);
+		if(hit.Tri!=pHits[i].Tri || hit.t!=pHits[i].t)
+			batchErrors++;
+	}
+	TEST_CHECK(batchErrors==0 && batchHits==singleHits);
+
+	// Move every vertex as a pose would and refit a copy
+	D3DXVECTOR3* pMoved = new D3DXVECTOR3[numVerts];
+	for(int i=0; i<numVerts; i++)
+		pMoved[i] = pVerts[i] + D3DXVECTOR3(sinf(pVerts[i].y*0.3f)*2, 0, cosf(pVerts[i].x*0.3f)*2);
+	pose.CopyFrom(bvh);
+	TEST_CHECK(pose.GetNumNodes()==bvh.GetNumNodes() && pose.GetNumTris()==bvh.GetNumTris());
+	pose.Refit(pMoved, sizeof(D3DXVECTOR3));
+	errors = 0;
+	for(int i=0; i<numRays; i++)
+	{
+		float t;
+		int expected = BruteForceRay(pMoved, pIndices, numTris*3, pOrig[i], pDir[i], 1000.0f, t);
+		MeshRayHit hit;
+		pose.Intersect(pMoved, sizeof(D3DXVECTOR3), pOrig[i], pDir[i], 1000.0f, hit);
+		errors += !SameHit(hit, expected, t);
+	}
+	TEST_CHECK(errors==0);
+
+	bvh.Release();
+	pose.Release();
+	delete[] pVerts;
+	delete[] pMoved;
+	delete[] pIndices;
+	delete[] pOrig;
+	delete[] pDir;
+	delete[] pHits;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times the build, a refit, rays one at a time and as a batch, and a loop over all the
+// triangles, on a large soup with rays aimed at its vertices from around it
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(MeshBVH)
+{
+	const int numTris = 200000, numRays = 100000;
+	UINT state = 12345;
+	int numVerts = numTris*3;
+	D3DXVECTOR3* pVerts = new D3DXVECTOR3[numVerts];
+	DWORD* pIndices = new DWORD[numTris*3];
+	MakeTriangleSoup(numTris, state, pVerts, pIndices);
+
+	D3DXVECTOR3* pOrig = new D3DXVECTOR3[numRays];
+	D3DXVECTOR3* pDir = new D3DXVECTOR3[numRays];
+	for(int i=0; i<numRays; i++)
+	{
+		pOrig[i] = D3DXVECTOR3(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1))*40.0f;
+		pDir[i] = pVerts[(int)(TestRandFloat(state, 0, 1)*(numVerts-1))] - pOrig[i];
+	}
+
+	MeshBVH bvh;
+	MeshRayHit* pHits = new MeshRayHit[numRays];
+	double start = SelfTest::GetTime();
+	bvh.Build(pVerts, sizeof(D3DXVECTOR3), numVerts, pIndices, numTris*3);
+	double buildTime = SelfTest::GetTime()-start;
+
+	start = SelfTest::GetTime();
+	for(int r=0; r<10; r++)
+		bvh.Refit(pVerts, sizeof(D3DXVECTOR3));
+	double refitTime = (SelfTest::GetTime()-start)/10;
+
+	// The loop is slow so it only gets a few of the rays
+	const int numBrute = 64;
+	int bruteHits = 0;
+	start = SelfTest::GetTime();
+	for(int i=0; i<numBrute; i++)
+	{
+		float t;
+		bruteHits += BruteForceRay(pVerts, pIndices, numTris*3, pOrig[i], pDir[i], FLT_MAX, t)>=0;
+	}
+	double bruteTime = (SelfTest::GetTime()-start)/numBrute;
+
+	start = SelfTest::GetTime();
+	int numHits = 0;
+	for(int i=0; i<numRays; i++)
+		numHits += bvh.Intersect(pVerts, sizeof(D3DXVECTOR3), pOrig[i], pDir[i], FLT_MAX, pHits[i]);
+	double singleTime = SelfTest::GetTime()-start;
+
+	start = SelfTest::GetTime();
+	bvh.IntersectBatch(pVerts, sizeof(D3DXVECTOR3), pOrig, pDir, numRays, FLT_MAX, pHits);
+	double batchTime = SelfTest::GetTime()-start;
+
+	Log::Print("MeshBVH: %d triangles, %d nodes, %dKB: build %.1fms, refit %.2fms, %d rays (%d hit) %.1fms one at a time, %.1fms batched, %.3fms a ray looping over the triangles (%d of %d hit)",
+		numTris, bvh.GetNumNodes(), bvh.GetMemoryUsage()/1024, buildTime, refitTime, numRays, numHits, singleTime, batchTime, bruteTime, bruteHits, numBrute);
+	bvh.Release();
+	delete[] pVerts;
+	delete[] pIndices;
+	delete[] pOrig;
+	delete[] pDir;
+	delete[] pHits;
+}
+
+#endif
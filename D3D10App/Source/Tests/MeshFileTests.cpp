@@ -0,0 +1,388 @@
+//--------------------------------------------------------------------------------------
+// File: MeshFileTests.cpp
+//
+// Self tests and benchmark for the binary mesh cache
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "MeshFile.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include <stddef.h>
+#include <float.h>
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+static const char* g_szMeshFileTest = "MeshFileTest.tmp";
+
+// A random mesh in three submeshes and two materials, with one level of detail that
+// keeps every other triangle
+struct TestMesh
+{
+	Vertex*				pVerts;
+	DWORD*				pIndices;
+	DWORD*				pLodIndices;
+	MeshFileSubMesh		SubMeshes[3];
+	MeshFileMaterial	Materials[2];
+	MeshFileLOD			Lods[3];
+	MeshFileDesc		Desc;
+
+	TestMesh(int numVerts, UINT seed)
+	{
+		UINT state = seed*2654435761u + 1;
+		pVerts = new Vertex[numVerts];
+		for(int i=0; i<numVerts; i++)
+		{
+			pVerts[i].pos = D3DXVECTOR3((TestRand(state)%2000)*0.01f-10, (TestRand(state)%2000)*0.01f-10, (TestRand(state)%2000)*0.01f-10);
+			pVerts[i].tu = (TestRand(state)%1000)*0.001f;
+			pVerts[i].tv = (TestRand(state)%1000)*0.001f;
+			pVerts[i].normal = D3DXVECTOR3(0, 1, 0);
+		}
+		int numIndices = numVerts*6;
+		pIndices = new DWORD[numIndices];
+		for(int i=0; i<numIndices; i++)
+			pIndices[i] = TestRand(state)%numVerts;
+
+		memset(SubMeshes, 0, sizeof(SubMeshes));
+		memset(Materials, 0, sizeof(Materials));
+		int split = (numIndices/9)*3;
+		SubMeshes[0].StartIndex = 0;
+		SubMeshes[0].NumIndices = split;
+		SubMeshes[1].StartIndex = split;
+		SubMeshes[1].NumIndices = split;
+		SubMeshes[1].Material = 1;
+		SubMeshes[2].StartIndex = split*2;
+		SubMeshes[2].NumIndices = numIndices-split*2;
+		Materials[0].Diffuse = D3DXVECTOR4(1, 0.5f, 0.25f, 1);
+		Materials[0].Power = 8;
+		strcpy(Materials[1].Texture, "Textures\\test.dds");
+
+		int numLodIndices = 0;
+		pLodIndices = new DWORD[numIndices];
+		for(int s=0; s<3; s++)
+		{
+			Lods[s].StartIndex = numIndices + numLodIndices;
+			for(DWORD t=SubMeshes[s].StartIndex; t<SubMeshes[s].StartIndex+SubMeshes[s].NumIndices; t+=6)
+			{
+				memcpy(pLodIndices+numLodIndices, pIndices+t, 3*sizeof(DWORD));
+				numLodIndices += 3;
+			}
+			Lods[s].NumIndices = numIndices + numLodIndices - Lods[s].StartIndex;
+		}
+
+		Desc.SourceHash = 0x0123456789abcdefull;
+		Desc.SourceSize = 12345;
+		Desc.pVerts = pVerts;
+		Desc.NumVerts = numVerts;
+		Desc.pIndices = pIndices;
+		Desc.NumIndices = numIndices;
+		Desc.pSubMeshes = SubMeshes;
+		Desc.NumSubMeshes = 3;
+		Desc.pMaterials = Materials;
+		Desc.NumMaterials = 2;
+		Desc.pLodIndices = pLodIndices;
+		Desc.NumLodIndices = numLodIndices;
+		Desc.pLods = Lods;
+		Desc.NumLods = 1;
+		Desc.LodError[0] = 0.5f;
+	}
+
+	~TestMesh()
+	{
+		delete[] pVerts;
+		delete[] pIndices;
+		delete[] pLodIndices;
+	}
+};
+
+// Overwrites a DWORD in the file
+static void PatchFile(const char* szFile, long offset, DWORD value)
+{
+	FILE* fp = fopen(szFile, "r+b");
+	if(fp)
+	{
+		fseek(fp, offset, SEEK_SET);
+		fwrite(&value, sizeof(DWORD), 1, fp);
+		fclose(fp);
+	}
+}
+
+// Writes the mesh, patches one DWORD and tries to open it
+static bool OpensPatched(const TestMesh& mesh, long offset, DWORD value)
+{
+	MeshFile::Write(g_szMeshFileTest, mesh.Desc);
+	PatchFile(g_szMeshFileTest, offset, value);
+	MeshFile file;
+	bool ok = file.Open(g_szMeshFileTest, mesh.Desc.SourceHash, mesh.Desc.SourceSize);
+	file.Close();
+	return ok;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Every stream and table comes back as written, with the positions and bounds that
+// Write builds
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshFileRoundTrip)
+{
+	const int numVerts = 1000;
+	TestMesh mesh(numVerts, 3);
+	const MeshFileDesc& desc = mesh.Desc;
+	if(!TEST_CHECK(MeshFile::Write(g_szMeshFileTest, desc)))
+		return;
+
+	MeshFile file;
+	if(TEST_CHECK(file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize)))
+	{
+		const MeshFileHeader& h = file.GetHeader();
+		TEST_CHECK(h.NumVerts==(DWORD)numVerts && h.NumIndices==(DWORD)desc.NumIndices && h.NumSubMeshes==3 && h.NumMaterials==2);
+		TEST_CHECK(h.NumLods==1 && h.NumLodIndices==(DWORD)desc.NumLodIndices && h.LodError[0]==0.5f);
+		TEST_CHECK(h.SubMeshOffset%16==0 && h.MaterialOffset%16==0 && h.VertexOffset%16==0 && h.PosOffset%16==0 && h.IndexOffset%16==0 && h.LodOffset%16==0);
+		TEST_CHECK(memcmp(file.GetVerts(), mesh.pVerts, numVerts*sizeof(Vertex))==0);
+		TEST_CHECK(memcmp(file.GetIndices(), mesh.pIndices, desc.NumIndices*sizeof(DWORD))==0);
+		TEST_CHECK(memcmp(file.GetIndices()+desc.NumIndices, mesh.pLodIndices, desc.NumLodIndices*sizeof(DWORD))==0);
+		TEST_CHECK(memcmp(file.GetLods(), mesh.Lods, sizeof(mesh.Lods))==0);
+		TEST_CHECK(memcmp(file.GetMaterials(), mesh.Materials, sizeof(mesh.Materials))==0);
+
+		int posErrors = 0;
+		D3DXVECTOR3 boundMin(FLT_MAX, FLT_MAX, FLT_MAX), boundMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int i=0; i<numVerts; i++)
+		{
+			if(memcmp(&file.GetPosVerts()[i].pos, &mesh.pVerts[i].pos, sizeof(D3DXVECTOR3))!=0)
+				posErrors++;
+			const D3DXVECTOR3& p = mesh.pVerts[i].pos;
+			boundMin = D3DXVECTOR3(min(boundMin.x, p.x), min(boundMin.y, p.y), min(boundMin.z, p.z));
+			boundMax = D3DXVECTOR3(max(boundMax.x, p.x), max(boundMax.y, p.y), max(boundMax.z, p.z));
+		}
+		TEST_CHECK(posErrors==0);
+		TEST_CHECK(h.BoundMin==boundMin && h.BoundMax==boundMax);
+
+		// Each submesh's bounds are exactly those of the vertices it uses
+		for(int s=0; s<3; s++)
+		{
+			const MeshFileSubMesh& sub = file.GetSubMeshes()[s];
+			TEST_CHECK(sub.StartIndex==mesh.SubMeshes[s].StartIndex && sub.NumIndices==mesh.SubMeshes[s].NumIndices && sub.Material==mesh.SubMeshes[s].Material);
+			D3DXVECTOR3 subMin(FLT_MAX, FLT_MAX, FLT_MAX), subMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for(DWORD i=sub.StartIndex; i<sub.StartIndex+sub.NumIndices; i++)
+			{
+				const D3DXVECTOR3& p = mesh.pVerts[mesh.pIndices[i]].pos;
+				subMin = D3DXVECTOR3(min(subMin.x, p.x), min(subMin.y, p.y), min(subMin.z, p.z));
+				subMax = D3DXVECTOR3(max(subMax.x, p.x), max(subMax.y, p.y), max(subMax.z, p.z));
+			}
+			TEST_CHECK(sub.BoundMin==subMin && sub.BoundMax==subMax);
+		}
+	}
+	file.Close();
+	remove(g_szMeshFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A mesh without materials or levels of detail has empty tables, and its submeshes
+// point at the first material
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshFileEmptyTables)
+{
+	TestMesh mesh(50, 4);
+	mesh.SubMeshes[1].Material = 0;
+	mesh.Desc.NumMaterials = 0;
+	mesh.Desc.pMaterials = NULL;
+	mesh.Desc.NumLods = 0;
+	mesh.Desc.NumLodIndices = 0;
+	mesh.Desc.pLods = NULL;
+	if(!TEST_CHECK(MeshFile::Write(g_szMeshFileTest, mesh.Desc)))
+		return;
+	MeshFile file;
+	if(TEST_CHECK(file.Open(g_szMeshFileTest, mesh.Desc.SourceHash, mesh.Desc.SourceSize)))
+	{
+		const MeshFileHeader& h = file.GetHeader();
+		TEST_CHECK(h.NumMaterials==0 && h.NumLods==0 && h.NumLodIndices==0 && h.NumSubMeshes==3);
+		TEST_CHECK(memcmp(file.GetIndices(), mesh.pIndices, mesh.Desc.NumIndices*sizeof(DWORD))==0);
+	}
+	file.Close();
+	remove(g_szMeshFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The source hash is FNV-1a over the whole file
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshFileHash)
+{
+	ULONGLONG hash, size;
+	TEST_CHECK(!MeshFile::HashFile("MeshFileMissing.tmp", hash, size));
+
+	FILE* fp = fopen(g_szMeshFileTest, "wb");
+	if(!TEST_CHECK(fp!=NULL))
+		return;
+	fclose(fp);
+	TEST_CHECK(MeshFile::HashFile(g_szMeshFileTest, hash, size) && hash==14695981039346656037ull && size==0);
+
+	fp = fopen(g_szMeshFileTest, "wb");
+	fputs("foobar", fp);
+	fclose(fp);
+	TEST_CHECK(MeshFile::HashFile(g_szMeshFileTest, hash, size) && hash==0x85944171f73967e8ull && size==6);
+	remove(g_szMeshFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Open turns away a different source, a damaged or truncated file, and counts so large
+// their table sizes would wrap around in 32 bits
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshFileRejects)
+{
+	TestMesh mesh(300, 5);
+	const MeshFileDesc& desc = mesh.Desc;
+	MeshFile file;
+	remove(g_szMeshFileTest);
+	TEST_CHECK(!file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize));
+
+	// A stale cache
+	if(!TEST_CHECK(MeshFile::Write(g_szMeshFileTest, desc)))
+		return;
+	TEST_CHECK(!file.Open(g_szMeshFileTest, desc.SourceHash+1, desc.SourceSize));
+	TEST_CHECK(!file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize+1));
+	TEST_CHECK(!file.IsOpen());
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, Magic), 0));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, Version), MESH_FILE_VERSION+1));
+
+	// An unpatched file still opens, so the failures below are the patches
+	TEST_CHECK(OpensPatched(mesh, offsetof(MeshFileHeader, SourceSize), (DWORD)desc.SourceSize));
+
+	// Damaged indices and tables
+	MeshFileHeader h;
+	MeshFile::Write(g_szMeshFileTest, desc);
+	if(!TEST_CHECK(file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize)))
+		return;
+	h = file.GetHeader();
+	file.Close();
+	TEST_CHECK(!OpensPatched(mesh, h.IndexOffset + (desc.NumIndices/2)*sizeof(DWORD), desc.NumVerts));
+	TEST_CHECK(!OpensPatched(mesh, h.IndexOffset + (desc.NumIndices + desc.NumLodIndices - 1)*sizeof(DWORD), desc.NumVerts));
+	TEST_CHECK(!OpensPatched(mesh, h.SubMeshOffset + offsetof(MeshFileSubMesh, NumIndices), desc.NumIndices+3));
+	TEST_CHECK(!OpensPatched(mesh, h.SubMeshOffset + sizeof(MeshFileSubMesh) + offsetof(MeshFileSubMesh, Material), 2));
+	TEST_CHECK(!OpensPatched(mesh, h.LodOffset + offsetof(MeshFileLOD, StartIndex), desc.NumIndices + desc.NumLodIndices));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, NumIndices), desc.NumIndices+1));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, NumLods), MESH_FILE_MAX_LODS+1));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, NumVerts), desc.NumVerts*4));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, PosOffset), 0xfffffff0));
+
+	// Counts whose table size is just past 4GB, which comes to a few bytes in 32 bits
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, NumSubMeshes), (DWORD)(0x100000000ull/sizeof(MeshFileSubMesh) + 1)));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, NumMaterials), (DWORD)(0x100000000ull/sizeof(MeshFileMaterial) + 1)));
+	TEST_CHECK(!OpensPatched(mesh, offsetof(MeshFileHeader, NumSubMeshes), 0x40000001));
+
+	// With the tables zeroed and no levels of detail every submesh Open reads looks valid,
+	// so only the size check keeps it from walking off the end of the mapping
+	MeshFile::Write(g_szMeshFileTest, desc);
+	PatchFile(g_szMeshFileTest, offsetof(MeshFileHeader, NumLods), 0);
+	UINT tableSize = h.LodOffset + desc.NumSubMeshes*desc.NumLods*sizeof(MeshFileLOD) - h.SubMeshOffset;
+	FILE* fp = fopen(g_szMeshFileTest, "r+b");
+	if(fp)
+	{
+		BYTE* pZero = new BYTE[tableSize];
+		memset(pZero, 0, tableSize);
+		fseek(fp, h.SubMeshOffset, SEEK_SET);
+		fwrite(pZero, tableSize, 1, fp);
+		fclose(fp);
+		delete[] pZero;
+	}
+	TEST_CHECK(file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize));
+	file.Close();
+	PatchFile(g_szMeshFileTest, offsetof(MeshFileHeader, NumSubMeshes), (DWORD)(0x100000000ull/sizeof(MeshFileSubMesh) + 1));
+	TEST_CHECK(!file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize));
+
+	// Cut off in the middle of the last table, and inside the header
+	MeshFile::Write(g_szMeshFileTest, desc);
+	fp = fopen(g_szMeshFileTest, "rb");
+	UINT cutSize = h.LodOffset + sizeof(MeshFileLOD) + 4;
+	BYTE* pData = new BYTE[cutSize];
+	size_t read = fp ? fread(pData, 1, cutSize, fp) : 0;
+	if(fp)
+		fclose(fp);
+	for(int cut=0; cut<2; cut++)
+	{
+		fp = fopen(g_szMeshFileTest, "wb");
+		fwrite(pData, cut ? sizeof(MeshFileHeader)-4 : read, 1, fp);
+		fclose(fp);
+		TEST_CHECK(!file.Open(g_szMeshFileTest, desc.SourceHash, desc.SourceSize));
+	}
+	delete[] pData;
+	file.Close();
+	remove(g_szMeshFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Write refuses anything Open would turn away
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshFileWriteRefuses)
+{
+	TestMesh mesh(200, 6);
+	MeshFileDesc& desc = mesh.Desc;
+	remove(g_szMeshFileTest);
+
+	mesh.pIndices[desc.NumIndices/2] = desc.NumVerts;
+	TEST_CHECK(!MeshFile::Write(g_szMeshFileTest, desc));
+	mesh.pIndices[desc.NumIndices/2] = 0;
+
+	mesh.pLodIndices[desc.NumLodIndices-1] = desc.NumVerts;
+	TEST_CHECK(!MeshFile::Write(g_szMeshFileTest, desc));
+	mesh.pLodIndices[desc.NumLodIndices-1] = 0;
+
+	mesh.SubMeshes[2].NumIndices += 3;
+	TEST_CHECK(!MeshFile::Write(g_szMeshFileTest, desc));
+	mesh.SubMeshes[2].NumIndices -= 3;
+
+	mesh.SubMeshes[0].Material = 2;
+	TEST_CHECK(!MeshFile::Write(g_szMeshFileTest, desc));
+	mesh.SubMeshes[0].Material = 0;
+
+	DWORD lodIndices = mesh.Lods[1].NumIndices;
+	mesh.Lods[1].NumIndices = desc.NumIndices + desc.NumLodIndices;
+	TEST_CHECK(!MeshFile::Write(g_szMeshFileTest, desc));
+	mesh.Lods[1].NumIndices = lodIndices;
+
+	desc.NumLods = MESH_FILE_MAX_LODS+1;
+	TEST_CHECK(!MeshFile::Write(g_szMeshFileTest, desc));
+	desc.NumLods = 1;
+
+	// Nothing was left behind, and the fixed mesh is written
+	FILE* fp = fopen(g_szMeshFileTest, "rb");
+	TEST_CHECK(fp==NULL);
+	if(fp)
+		fclose(fp);
+	TEST_CHECK(MeshFile::Write(g_szMeshFileTest, desc));
+	remove(g_szMeshFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times writing and opening the cache for a large mesh
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(MeshFile)
+{
+	const int numVerts = 200000;
+	TestMesh mesh(numVerts, 7);
+	double start = SelfTest::GetTime();
+	bool written = MeshFile::Write(g_szMeshFileTest, mesh.Desc);
+	double writeTime = SelfTest::GetTime()-start;
+
+	MeshFile file;
+	start = SelfTest::GetTime();
+	bool opened = file.Open(g_szMeshFileTest, mesh.Desc.SourceHash, mesh.Desc.SourceSize);
+	double openTime = SelfTest::GetTime()-start;
+	file.Close();
+	remove(g_szMeshFileTest);
+
+	Log::Print("MeshFile: %d vertices, %d indices: write %.1fms, open %.1fms%s", numVerts, mesh.Desc.NumIndices,
+		writeTime, openTime, written && opened ? "" : " (failed)");
+}
+
+#endif
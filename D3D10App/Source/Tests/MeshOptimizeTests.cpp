@@ -0,0 +1,357 @@
+//--------------------------------------------------------------------------------------
+// File: MeshOptimizeTests.cpp
+//
+// Self tests and benchmark for triangle and vertex ordering
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "MeshOptimize.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// A bumpy grid of quads in two triangles, shuffled so the cache has nothing to work with
+static void MakeShuffledGrid(int gridSize, UINT seed, D3DXVECTOR3* pPos, DWORD* pIndices)
+{
+	for(int y=0; y<=gridSize; y++)
+		for(int x=0; x<=gridSize; x++)
+			pPos[y*(gridSize+1)+x] = D3DXVECTOR3((float)x, sinf(x*0.3f)*cosf(y*0.2f), (float)y);
+	for(int y=0; y<gridSize; y++)
+		for(int x=0; x<gridSize; x++)
+		{
+			DWORD v = y*(gridSize+1)+x;
+			DWORD* pQuad = pIndices + (y*gridSize+x)*6;
+			pQuad[0] = v; pQuad[1] = v+gridSize+1; pQuad[2] = v+1;
+			pQuad[3] = v+1; pQuad[4] = v+gridSize+1; pQuad[5] = v+gridSize+2;
+		}
+
+	UINT state = seed*2654435761u + 1;
+	int numFaces = gridSize*gridSize*2;
+	for(int f=numFaces-1; f>0; f--)
+	{
+		int g = TestRand(state)%(f+1);
+		for(int k=0; k<3; k++)
+			Swap(pIndices[f*3+k], pIndices[g*3+k]);
+	}
+}
+
+// A triangle as its attribute and three positions, rotated so the smallest vertex comes
+// first.  The winding is kept.
+struct OptimizeTestFace
+{
+	DWORD	Attrib;
+	float	Pos[9];
+};
+
+static int CompareOptimizeTestFace(const void* pA, const void* pB)
+{
+	return memcmp(pA, pB, sizeof(OptimizeTestFace));
+}
+
+static void MakeTestFace(OptimizeTestFace& face, DWORD attrib, const D3DXVECTOR3* pPos, const DWORD* pTri)
+{
+	int first = 0;
+	for(int k=1; k<3; k++)
+		if(memcmp(&pPos[pTri[k]], &pPos[pTri[first]], sizeof(D3DXVECTOR3))<0)
+			first = k;
+	memset(&face, 0, sizeof(OptimizeTestFace));
+	face.Attrib = attrib;
+	for(int k=0; k<3; k++)
+		memcpy(&face.Pos[k*3], &pPos[pTri[(first+k)%3]], sizeof(D3DXVECTOR3));
+}
+
+// Sorted faces of a range of indices, all with one attribute
+static void MakeTestFaces(OptimizeTestFace* pFaces, DWORD attrib, const D3DXVECTOR3* pPos, const DWORD* pIndices, int numFaces)
+{
+	for(int f=0; f<numFaces; f++)
+		MakeTestFace(pFaces[f], attrib, pPos, pIndices+f*3);
+	qsort(pFaces, numFaces, sizeof(OptimizeTestFace), CompareOptimizeTestFace);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cache stats of small index lists worked out by hand
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshCacheStats)
+{
+	MeshCacheStats stats;
+	const DWORD tri[] = { 0, 1, 2 };
+	ComputeCacheStats(tri, 3, 3, stats);
+	TEST_CHECK(stats.ACMR==3.0f && stats.ATVR==1.0f);
+
+	// A quad shares two of its vertices
+	const DWORD quad[] = { 0, 1, 2, 2, 1, 3 };
+	ComputeCacheStats(quad, 6, 4, stats);
+	TEST_CHECK(stats.ACMR==2.0f && stats.ATVR==1.0f);
+
+	// The first triangle is still cached after the second with the default size, and
+	// pushed out with a cache of three
+	const DWORD again[] = { 0, 1, 2, 3, 4, 5, 0, 1, 2 };
+	ComputeCacheStats(again, 9, 6, stats);
+	TEST_CHECK(stats.ACMR==2.0f && stats.ATVR==1.0f);
+	ComputeCacheStats(again, 9, 6, stats, 3);
+	TEST_CHECK(stats.ACMR==3.0f && stats.ATVR==1.5f);
+
+	// The cache is a FIFO, so a hit doesn't keep 0 in it the way it would an LRU cache
+	const DWORD fifo[] = { 0, 1, 2, 0, 3, 4, 0, 5, 6 };
+	ComputeCacheStats(fifo, 9, 7, stats, 3);
+	TEST_CHECK(stats.ACMR==8.0f/3 && stats.ATVR==8.0f/7);
+
+	// Unused vertices don't count towards ATVR, and there is nothing to draw in less
+	// than a triangle
+	const DWORD sparse[] = { 7, 3, 9 };
+	ComputeCacheStats(sparse, 3, 10, stats);
+	TEST_CHECK(stats.ACMR==3.0f && stats.ATVR==1.0f);
+	ComputeCacheStats(sparse, 2, 10, stats);
+	TEST_CHECK(stats.ACMR==0 && stats.ATVR==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Triangles are grouped by attribute in order, keeping their order in a group, with a
+// range for each attribute in use
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshSortByAttribute)
+{
+	DWORD indices[] = { 0,0,0, 1,1,1, 2,2,2, 3,3,3, 4,4,4, 5,5,5 };
+	const DWORD attribs[] = { 2, 0, 2, 5, 0, 2 };
+	Array<MeshAttributeRange> ranges;
+	SortByAttribute(indices, 6, attribs, ranges);
+
+	const DWORD expected[] = { 1,1,1, 4,4,4, 0,0,0, 2,2,2, 5,5,5, 3,3,3 };
+	TEST_CHECK(memcmp(indices, expected, sizeof(expected))==0);
+	if(TEST_CHECK(ranges.Size()==3))
+	{
+		TEST_CHECK(ranges[0].Attrib==0 && ranges[0].StartIndex==0 && ranges[0].NumIndices==6);
+		TEST_CHECK(ranges[1].Attrib==2 && ranges[1].StartIndex==6 && ranges[1].NumIndices==9);
+		TEST_CHECK(ranges[2].Attrib==5 && ranges[2].StartIndex==15 && ranges[2].NumIndices==3);
+	}
+
+	SortByAttribute(indices, 0, attribs, ranges);
+	TEST_CHECK(ranges.Size()==0);
+	ranges.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Tipsify keeps every triangle and its winding, brings a shuffled grid well under one
+// miss per triangle, and reports clusters in order starting at the first triangle
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshOptimizeVertexCache)
+{
+	const int gridSize = 48;
+	const int numVerts = (gridSize+1)*(gridSize+1), numFaces = gridSize*gridSize*2;
+	D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+	DWORD* pIndices = new DWORD[numFaces*3];
+	MakeShuffledGrid(gridSize, 1, pPos, pIndices);
+
+	OptimizeTestFace* pExpected = new OptimizeTestFace[numFaces];
+	OptimizeTestFace* pResult = new OptimizeTestFace[numFaces];
+	MakeTestFaces(pExpected, 0, pPos, pIndices, numFaces);
+	MeshCacheStats before, after;
+	ComputeCacheStats(pIndices, numFaces*3, numVerts, before);
+
+	Array<DWORD> clusters;
+	OptimizeVertexCache(pIndices, numFaces*3, numVerts, &clusters);
+	ComputeCacheStats(pIndices, numFaces*3, numVerts, after);
+	MakeTestFaces(pResult, 0, pPos, pIndices, numFaces);
+	TEST_CHECK(memcmp(pResult, pExpected, numFaces*sizeof(OptimizeTestFace))==0);
+	if(!TEST_CHECK(before.ACMR > 2.0f && after.ACMR < 0.8f && after.ATVR < 1.4f))
+		Log::Print("MeshOptimizeVertexCache: ACMR %.3f to %.3f, ATVR %.3f to %.3f", before.ACMR, after.ACMR, before.ATVR, after.ATVR);
+
+	bool ordered = clusters.Size()>0 && clusters[0]==0;
+	for(int c=1; c<clusters.Size(); c++)
+		ordered = ordered && clusters[c]>clusters[c-1] && clusters[c]<(DWORD)numFaces;
+	TEST_CHECK(ordered);
+
+	// A smaller cache is still honoured
+	MakeShuffledGrid(gridSize, 2, pPos, pIndices);
+	OptimizeVertexCache(pIndices, numFaces*3, numVerts, NULL, 8);
+	ComputeCacheStats(pIndices, numFaces*3, numVerts, after, 8);
+	TEST_CHECK(after.ACMR < 1.0f);
+
+	delete[] pPos;
+	delete[] pIndices;
+	delete[] pExpected;
+	delete[] pResult;
+	clusters.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Of two clusters the one facing away from the center of the mesh is drawn first
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshOptimizeOverdraw)
+{
+	// A quad at the back facing the center, then one at the front facing away from it
+	const D3DXVECTOR3 pos[8] = {
+		D3DXVECTOR3(0, 0, -1), D3DXVECTOR3(0, 1, -1), D3DXVECTOR3(1, 0, -1), D3DXVECTOR3(1, 1, -1),
+		D3DXVECTOR3(0, 0, 1), D3DXVECTOR3(0, 1, 1), D3DXVECTOR3(1, 0, 1), D3DXVECTOR3(1, 1, 1),
+	};
+	DWORD indices[12] = { 0, 2, 1, 1, 2, 3, 4, 6, 5, 5, 6, 7 };
+	D3DXVECTOR3 e1 = pos[2]-pos[0], e2 = pos[1]-pos[0], n;
+	D3DXVec3Cross(&n, &e1, &e2);
+	if(!TEST_CHECK(n.z > 0))
+		return;
+
+	Array<DWORD> clusters;
+	clusters.Add(0);
+	clusters.Add(2);
+	OptimizeOverdraw(indices, 12, pos, sizeof(D3DXVECTOR3), clusters);
+	const DWORD expected[12] = { 4, 6, 5, 5, 6, 7, 0, 2, 1, 1, 2, 3 };
+	TEST_CHECK(memcmp(indices, expected, sizeof(expected))==0);
+
+	// Flipped, and given front first, the back quad goes first
+	DWORD flipped[12] = { 4, 5, 6, 6, 5, 7, 0, 1, 2, 2, 1, 3 };
+	OptimizeOverdraw(flipped, 12, pos, sizeof(D3DXVECTOR3), clusters);
+	const DWORD expectedFlipped[12] = { 0, 1, 2, 2, 1, 3, 4, 5, 6, 6, 5, 7 };
+	TEST_CHECK(memcmp(flipped, expectedFlipped, sizeof(expectedFlipped))==0);
+	clusters.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Vertices are moved to the order the indices first use them, unused ones to the end in
+// their old order
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshOptimizeVertexFetch)
+{
+	struct FetchVertex
+	{
+		float	Pos[3];
+		DWORD	Id;
+	};
+	FetchVertex verts[6];
+	for(int v=0; v<6; v++)
+	{
+		memset(&verts[v], 0, sizeof(FetchVertex));
+		verts[v].Pos[0] = (float)v;
+		verts[v].Id = v;
+	}
+	DWORD indices[6] = { 4, 2, 0, 0, 2, 5 };
+	OptimizeVertexFetch(verts, sizeof(FetchVertex), 6, indices, 6);
+
+	const DWORD expectedIndices[6] = { 0, 1, 2, 2, 1, 3 };
+	const DWORD expectedIds[6] = { 4, 2, 0, 5, 1, 3 };
+	TEST_CHECK(memcmp(indices, expectedIndices, sizeof(expectedIndices))==0);
+	bool moved = true;
+	for(int v=0; v<6; v++)
+		moved = moved && verts[v].Id==expectedIds[v] && verts[v].Pos[0]==(float)expectedIds[v];
+	TEST_CHECK(moved);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The whole pass on shuffled grids with attributes by region gives the same triangles
+// with the same attributes, grouped in order, with the vertices in order of first use
+// and a better cache
+//--------------------------------------------------------------------------------------
+SELF_TEST(MeshOptimizeMatchesInput)
+{
+	const int sizes[] = { 7, 40 };
+	for(int s=0; s<2; s++)
+	{
+		int gridSize = sizes[s];
+		int numVerts = (gridSize+1)*(gridSize+1);
+		int numFaces = gridSize*gridSize*2;
+		D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+		DWORD* pIndices = new DWORD[numFaces*3];
+		DWORD* pAttribs = new DWORD[numFaces];
+		MakeShuffledGrid(gridSize, s+3, pPos, pIndices);
+		for(int f=0; f<numFaces; f++)
+			pAttribs[f] = (DWORD)(pPos[pIndices[f*3]].x*3/(gridSize+1)) * 2;
+
+		OptimizeTestFace* pExpected = new OptimizeTestFace[numFaces];
+		for(int f=0; f<numFaces; f++)
+			MakeTestFace(pExpected[f], pAttribs[f], pPos, pIndices+f*3);
+		qsort(pExpected, numFaces, sizeof(OptimizeTestFace), CompareOptimizeTestFace);
+
+		Array<MeshAttributeRange> ranges;
+		MeshCacheStats before, after;
+		OptimizeMesh(pPos, sizeof(D3DXVECTOR3), numVerts, pIndices, numFaces, pAttribs, ranges, &before, &after);
+
+		// The same triangles with the same attributes
+		int errors = 0;
+		OptimizeTestFace* pResult = new OptimizeTestFace[numFaces];
+		DWORD expectedStart = 0;
+		for(int r=0; r<ranges.Size(); r++)
+		{
+			if(ranges[r].StartIndex!=expectedStart || (r>0 && ranges[r].Attrib<=ranges[r-1].Attrib))
+				errors++;
+			expectedStart += ranges[r].NumIndices;
+			for(DWORD i=ranges[r].StartIndex; i<ranges[r].StartIndex+ranges[r].NumIndices; i+=3)
+				MakeTestFace(pResult[i/3], ranges[r].Attrib, pPos, pIndices+i);
+		}
+		if(TEST_CHECK(ranges.Size()==3 && expectedStart==(DWORD)numFaces*3))
+		{
+			qsort(pResult, numFaces, sizeof(OptimizeTestFace), CompareOptimizeTestFace);
+			if(memcmp(pResult, pExpected, numFaces*sizeof(OptimizeTestFace))!=0)
+				errors++;
+		}
+
+		// Vertices in order of first use
+		DWORD next = 0;
+		for(int i=0; i<numFaces*3; i++)
+		{
+			if(pIndices[i]>next)
+				errors++;
+			else if(pIndices[i]==next)
+				next++;
+		}
+		TEST_CHECK(errors==0);
+		TEST_CHECK(after.ACMR < before.ACMR);
+
+		delete[] pPos;
+		delete[] pIndices;
+		delete[] pAttribs;
+		delete[] pExpected;
+		delete[] pResult;
+		ranges.Release();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times each step on a large shuffled grid and logs the cache stats after each
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(MeshOptimize)
+{
+	const int gridSize = 400;
+	const int numVerts = (gridSize+1)*(gridSize+1), numFaces = gridSize*gridSize*2;
+	D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+	DWORD* pIndices = new DWORD[numFaces*3];
+	MakeShuffledGrid(gridSize, 9, pPos, pIndices);
+
+	MeshCacheStats before, cache, after;
+	ComputeCacheStats(pIndices, numFaces*3, numVerts, before);
+
+	Array<DWORD> clusters;
+	double start = SelfTest::GetTime();
+	OptimizeVertexCache(pIndices, numFaces*3, numVerts, &clusters);
+	double cacheTime = SelfTest::GetTime()-start;
+	ComputeCacheStats(pIndices, numFaces*3, numVerts, cache);
+
+	start = SelfTest::GetTime();
+	OptimizeOverdraw(pIndices, numFaces*3, pPos, sizeof(D3DXVECTOR3), clusters);
+	double overdrawTime = SelfTest::GetTime()-start;
+
+	start = SelfTest::GetTime();
+	OptimizeVertexFetch(pPos, sizeof(D3DXVECTOR3), numVerts, pIndices, numFaces*3);
+	double fetchTime = SelfTest::GetTime()-start;
+	ComputeCacheStats(pIndices, numFaces*3, numVerts, after);
+
+	Log::Print("MeshOptimize: %d triangles: ACMR %.3f, %.3f after the cache pass, %.3f after overdraw, ATVR %.3f to %.3f, %d clusters, cache %.1fms, overdraw %.1fms, fetch %.1fms",
+		numFaces, before.ACMR, cache.ACMR, after.ACMR, before.ATVR, after.ATVR, clusters.Size(), cacheTime, overdrawTime, fetchTime);
+	delete[] pPos;
+	delete[] pIndices;
+	clusters.Release();
+}
+
+#endif
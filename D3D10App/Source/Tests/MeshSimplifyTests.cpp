@@ -0,0 +1,232 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSimplifyTests.cpp
+//
+// Self tests and benchmark for mesh simplification
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "MeshSimplify.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Two halves of a grid with bumps of the given height, the middle column is split into
+// two vertices like a UV seam.  pPos holds (gridSize+2)*(gridSize+1) vertices and
+// pIndices gridSize*gridSize*6 indices, returns the number of indices.
+static int MakeSeamGrid(int gridSize, float bumps, D3DXVECTOR3* pPos, DWORD* pIndices)
+{
+	int row = gridSize+2;
+	for(int y=0; y<=gridSize; y++)
+		for(int x=0; x<row; x++)
+		{
+			int gx = x<=gridSize/2 ? x : x-1;
+			pPos[y*row+x] = D3DXVECTOR3((float)gx, bumps*sinf(gx*0.25f)*cosf(y*0.2f), (float)y);
+		}
+	int numIndices = 0;
+	for(int y=0; y<gridSize; y++)
+		for(int x=0; x<row-1; x++)
+		{
+			if(x==gridSize/2)
+				continue;
+			DWORD v = y*row+x;
+			pIndices[numIndices++] = v; pIndices[numIndices++] = v+row; pIndices[numIndices++] = v+1;
+			pIndices[numIndices++] = v+1; pIndices[numIndices++] = v+row; pIndices[numIndices++] = v+row+1;
+		}
+	return numIndices;
+}
+
+// Normal of a triangle scaled by twice its area
+static D3DXVECTOR3 FaceNormal(const D3DXVECTOR3* pPos, const DWORD* pTri)
+{
+	D3DXVECTOR3 e1 = pPos[pTri[1]]-pPos[pTri[0]], e2 = pPos[pTri[2]]-pPos[pTri[0]], n;
+	D3DXVec3Cross(&n, &e1, &e2);
+	return n;
+}
+
+
+//--------------------------------------------------------------------------------------
+// A bumpy grid reaches the target, and every border and seam vertex is still used with
+// nothing flipped over
+//--------------------------------------------------------------------------------------
+SELF_TEST(SimplifyKeepsBordersAndSeams)
+{
+	const int sizes[] = { 40, 31 };
+	for(int s=0; s<2; s++)
+	{
+		int gridSize = sizes[s];
+		int row = gridSize+2;
+		int numVerts = row*(gridSize+1);
+		D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+		DWORD* pIndices = new DWORD[gridSize*gridSize*6];
+		int numIndices = MakeSeamGrid(gridSize, 0.3f, pPos, pIndices);
+
+		DWORD* pOut = new DWORD[numIndices];
+		int target = (numIndices/12)*3;
+		float error;
+		int count = SimplifyMesh(pPos, sizeof(D3DXVECTOR3), numVerts, pIndices, numIndices, pOut, target, 1.0f, &error);
+		TEST_CHECK(count<=target && count>0 && count%3==0);
+		TEST_CHECK(error>0 && error<=1.0f);
+
+		bool* pUsed = new bool[numVerts];
+		memset(pUsed, 0, numVerts*sizeof(bool));
+		int badIndices = 0;
+		for(int i=0; i<count; i++)
+		{
+			if(pOut[i]>=(DWORD)numVerts)
+				badIndices++;
+			else
+				pUsed[pOut[i]] = true;
+		}
+		if(!TEST_CHECK(badIndices==0))
+			break;
+
+		int missing = 0;
+		for(int y=0; y<=gridSize; y++)
+			for(int x=0; x<row; x++)
+			{
+				bool edge = x==0 || x==row-1 || y==0 || y==gridSize || x==gridSize/2 || x==gridSize/2+1;
+				if(edge && !pUsed[y*row+x])
+					missing++;
+			}
+		TEST_CHECK(missing==0);
+
+		int flipped = 0, degenerate = 0;
+		for(int i=0; i<count; i+=3)
+		{
+			if(FaceNormal(pPos, pOut+i).y<=0)
+				flipped++;
+			if(pOut[i]==pOut[i+1] || pOut[i]==pOut[i+2] || pOut[i+1]==pOut[i+2])
+				degenerate++;
+		}
+		TEST_CHECK(flipped==0 && degenerate==0);
+
+		delete[] pPos;
+		delete[] pIndices;
+		delete[] pOut;
+		delete[] pUsed;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// A flat grid collapses for free and still covers the same area, since nothing overlaps
+// or folds.  A triangle off to the side shares a position with a vertex in the middle
+// of the grid, as another submesh would, and that vertex stays.
+//--------------------------------------------------------------------------------------
+SELF_TEST(SimplifyFlat)
+{
+	const int gridSize = 24;
+	int row = gridSize+2;
+	int gridVerts = row*(gridSize+1);
+	int numVerts = gridVerts+3;
+	D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+	DWORD* pIndices = new DWORD[gridSize*gridSize*6 + 3];
+	int numIndices = MakeSeamGrid(gridSize, 0, pPos, pIndices);
+	DWORD middle = (gridSize/2)*row + gridSize/4;
+	pPos[gridVerts] = pPos[middle];
+	pPos[gridVerts+1] = pPos[middle] + D3DXVECTOR3(0, 1, 0);
+	pPos[gridVerts+2] = pPos[middle] + D3DXVECTOR3(1, 1, 0);
+	for(int k=0; k<3; k++)
+		pIndices[numIndices++] = gridVerts+k;
+	DWORD* pOut = new DWORD[numIndices];
+
+	float error;
+	int target = (numIndices/12)*3;
+	int count = SimplifyMesh(pPos, sizeof(D3DXVECTOR3), numVerts, pIndices, numIndices, pOut, target, 0.001f, &error);
+	TEST_CHECK(count<=target && error<0.001f);
+
+	double area = 0;
+	bool usesMiddle = false, keptSide = false;
+	for(int i=0; i<count; i+=3)
+	{
+		if(pOut[i]==(DWORD)gridVerts)
+			keptSide = (pOut[i+1]==(DWORD)gridVerts+1 && pOut[i+2]==(DWORD)gridVerts+2);
+		else
+			area += FaceNormal(pPos, pOut+i).y*0.5;
+		usesMiddle = usesMiddle || pOut[i]==middle || pOut[i+1]==middle || pOut[i+2]==middle;
+	}
+	TEST_CHECK_NEAR(area, (double)gridSize*gridSize, 0.001);
+	TEST_CHECK(usesMiddle && keptSide);
+
+	delete[] pPos;
+	delete[] pIndices;
+	delete[] pOut;
+}
+
+
+//--------------------------------------------------------------------------------------
+// No collapse costs more than the error allowed, so a tight limit stops short of the
+// target, and a mesh already under the target comes back as it was
+//--------------------------------------------------------------------------------------
+SELF_TEST(SimplifyLimits)
+{
+	const int gridSize = 32;
+	int numVerts = (gridSize+2)*(gridSize+1);
+	D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+	DWORD* pIndices = new DWORD[gridSize*gridSize*6];
+	int numIndices = MakeSeamGrid(gridSize, 2.0f, pPos, pIndices);
+	DWORD* pOut = new DWORD[numIndices];
+	int target = (numIndices/12)*3;
+
+	const float limits[] = { 0.01f, 0.05f, 0.2f };
+	int lastCount = numIndices+1;
+	for(int l=0; l<3; l++)
+	{
+		float error;
+		int count = SimplifyMesh(pPos, sizeof(D3DXVECTOR3), numVerts, pIndices, numIndices, pOut, target, limits[l], &error);
+		TEST_CHECK(error<=limits[l]);
+		TEST_CHECK(count<=lastCount);
+		lastCount = count;
+		if(l==0)
+			TEST_CHECK(count>target);
+	}
+
+	float error = 1;
+	memset(pOut, 0, numIndices*sizeof(DWORD));
+	int count = SimplifyMesh(pPos, sizeof(D3DXVECTOR3), numVerts, pIndices, numIndices, pOut, numIndices, 1.0f, &error);
+	TEST_CHECK(count==numIndices && error==0 && memcmp(pOut, pIndices, numIndices*sizeof(DWORD))==0);
+
+	delete[] pPos;
+	delete[] pIndices;
+	delete[] pOut;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times a chain of levels of a large bumpy grid the way the mesh loader builds them
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(Simplify)
+{
+	const int gridSize = 300;
+	int numVerts = (gridSize+2)*(gridSize+1);
+	D3DXVECTOR3* pPos = new D3DXVECTOR3[numVerts];
+	DWORD* pLevel = new DWORD[gridSize*gridSize*6];
+	int count = MakeSeamGrid(gridSize, 3.0f, pPos, pLevel);
+	DWORD* pNext = new DWORD[count];
+
+	float radius = gridSize*0.7071f;
+	float error = 0;
+	for(int level=1; level<4; level++)
+	{
+		float levelError;
+		double start = SelfTest::GetTime();
+		int next = SimplifyMesh(pPos, sizeof(D3DXVECTOR3), numVerts, pLevel, count, pNext, (int)(count*MESH_LOD_RATIO)/3*3, radius*MESH_LOD_MAX_ERROR, &levelError);
+		double time = SelfTest::GetTime()-start;
+		error += levelError;
+		Log::Print("Simplify: level %d: %d to %d triangles, error %.4f of the radius, %.1fms", level, count/3, next/3, error/radius, time);
+		memcpy(pLevel, pNext, next*sizeof(DWORD));
+		count = next;
+	}
+	delete[] pPos;
+	delete[] pLevel;
+	delete[] pNext;
+}
+
+#endif
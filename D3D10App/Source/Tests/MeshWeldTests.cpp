@@ -0,0 +1,301 @@
+//--------------------------------------------------------------------------------------
+// File: MeshWeldTests.cpp
+//
+// Self tests and benchmark for vertex welding
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Array.cpp"
+#include "MeshWeld.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Vertex at a position with an up normal
+static Vertex MakeVertex(float x, float y, float z, float tu=0, float tv=0)
+{
+	Vertex v;
+	v.pos = D3DXVECTOR3(x, y, z);
+	v.tu = tu;
+	v.tv = tv;
+	v.normal = D3DXVECTOR3(0, 1, 0);
+	return v;
+}
+
+// Welds and checks the remap against the expected one
+static bool WeldsTo(const Vertex* pVerts, int numVerts, const DWORD* pExpected, float tolerance=WELD_TOLERANCE, DWORD flags=0)
+{
+	DWORD remap[16];
+	int numKept = WeldVertices(pVerts, numVerts, remap, tolerance, flags);
+	int expectedKept = 0;
+	for(int i=0; i<numVerts; i++)
+	{
+		if(remap[i]!=pExpected[i])
+			return false;
+		expectedKept = max(expectedKept, (int)pExpected[i]+1);
+	}
+	return numKept==expectedKept;
+}
+
+//--------------------------------------------------------------------------------------
+// The loop BaseMesh::Clean used to run, kept for comparison
+//--------------------------------------------------------------------------------------
+static void CleanReference(Array<Vertex>& verts, Array<DWORD>& indices)
+{
+	bool flag=true;
+	while(flag)
+	{
+		flag=false;
+		for(int i=0; i<verts.Size(); i++)
+		{
+			for(int j=0; j<verts.Size(); j++)
+			{
+				if(i==j) continue;
+				if( (fabs(verts[i].pos.x-verts[j].pos.x)<0.001f) &&
+					(fabs(verts[i].pos.y-verts[j].pos.y)<0.001f) &&
+					(fabs(verts[i].pos.z-verts[j].pos.z)<0.001f) )
+				{
+					verts.Remove(j);
+					for(int k=0; k<indices.Size(); k++)
+					{
+						if(indices[k]==(UINT)j)
+							indices[k]=(UINT)i;
+						else
+							if(indices[k]>(UINT)j)
+								indices[k]--;
+					}
+					flag=true;
+					break;
+				}
+			}
+			if(flag==true)
+				break;
+		}
+	}
+}
+
+// A grid of vertices with a quarter duplicated, some exactly, some within the
+// tolerance and some just outside it, and random triangles over them
+static void MakeWeldMesh(int numVerts, UINT seed, Array<Vertex>& verts, Array<DWORD>& indices)
+{
+	UINT state = seed*2654435761u + 1;
+	verts.Clear();
+	indices.Clear();
+	int side = (int)pow((double)numVerts, 1.0/3.0) + 1;
+	while(verts.Size()<numVerts)
+	{
+		Vertex v;
+		if(verts.Size()>0 && TestRand(state)%4==0)
+		{
+			v = verts[(int)(TestRand(state)%verts.Size())];
+			float offsets[] = { 0, 0.0004f, -0.0009f, 0.0011f, -0.0015f };
+			v.pos.x += offsets[TestRand(state)%5];
+			v.pos.y += offsets[TestRand(state)%5];
+			v.pos.z += offsets[TestRand(state)%5];
+		}
+		else
+			v = MakeVertex((TestRand(state)%side)*0.01f, (TestRand(state)%side)*0.01f, (TestRand(state)%side)*0.01f,
+				(TestRand(state)%100)*0.01f, (TestRand(state)%100)*0.01f);
+		verts.Add(v);
+	}
+	for(int i=0; i<numVerts*2; i++)
+		indices.Add(TestRand(state)%numVerts);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Exact and near duplicates weld, ones just past the tolerance don't, including pairs
+// on either side of a cell boundary and of zero.  A vertex only welds to kept ones, so
+// a chain of near vertices doesn't collapse into the first.
+//--------------------------------------------------------------------------------------
+SELF_TEST(WeldPositions)
+{
+	const float cell = WELD_TOLERANCE*2.5f;
+	Vertex verts[6];
+	verts[0] = MakeVertex(1, 2, 3);
+	verts[1] = MakeVertex(1, 2, 3);
+	verts[2] = MakeVertex(1.0009f, 2, 2.9992f);
+	verts[3] = MakeVertex(1, 2.0011f, 3);
+	verts[4] = MakeVertex(1.0009f, 2.0009f, 3.0009f);
+	verts[5] = MakeVertex(0.9989f, 2, 3);
+	const DWORD remap0[6] = { 0, 0, 0, 1, 0, 2 };
+	TEST_CHECK(WeldsTo(verts, 6, remap0));
+
+	// Across a cell boundary on each axis, and across zero
+	verts[0] = MakeVertex(cell*40-0.0004f, 0, 0);
+	verts[1] = MakeVertex(cell*40+0.0004f, 0, 0);
+	verts[2] = MakeVertex(5, cell*-7-0.0003f, cell*3+0.0002f);
+	verts[3] = MakeVertex(5, cell*-7+0.0005f, cell*3-0.0004f);
+	verts[4] = MakeVertex(-0.0004f, -0.0004f, -0.0004f);
+	verts[5] = MakeVertex(0.0004f, 0.0004f, 0.0004f);
+	const DWORD remap1[6] = { 0, 0, 1, 1, 2, 2 };
+	TEST_CHECK(WeldsTo(verts, 6, remap1));
+
+	// A chain, the third is only near the second which was welded away
+	verts[0] = MakeVertex(0, 0, 0);
+	verts[1] = MakeVertex(0.0008f, 0, 0);
+	verts[2] = MakeVertex(0.0016f, 0, 0);
+	verts[3] = MakeVertex(0.0017f, 0, 0);
+	const DWORD remap2[4] = { 0, 0, 1, 1 };
+	TEST_CHECK(WeldsTo(verts, 4, remap2));
+
+	// Far out past the cell limit the cells are shared, but only near vertices weld
+	verts[0] = MakeVertex(1e9f, 0, 0);
+	verts[1] = MakeVertex(2e9f, 0, 0);
+	verts[2] = MakeVertex(1e9f, 0, 0);
+	verts[3] = MakeVertex(-3e9f, 0, 0);
+	const DWORD remap3[4] = { 0, 1, 0, 2 };
+	TEST_CHECK(WeldsTo(verts, 4, remap3));
+
+	// A looser tolerance
+	verts[0] = MakeVertex(0, 0, 0);
+	verts[1] = MakeVertex(0.04f, -0.04f, 0.04f);
+	verts[2] = MakeVertex(0.06f, 0, 0);
+	const DWORD remap4[3] = { 0, 0, 1 };
+	TEST_CHECK(WeldsTo(verts, 3, remap4, 0.05f));
+
+	DWORD remap[1];
+	TEST_CHECK(WeldVertices(verts, 0, remap)==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// UVs and normals only keep vertices apart when asked to
+//--------------------------------------------------------------------------------------
+SELF_TEST(WeldFlags)
+{
+	Vertex verts[4];
+	verts[0] = MakeVertex(1, 1, 1, 0.5f, 0.5f);
+	verts[1] = MakeVertex(1, 1, 1, 0.25f, 0.5f);
+	verts[2] = MakeVertex(1, 1, 1, 0.50005f, 0.5f);
+	verts[3] = MakeVertex(1, 1, 1, 0.5f, 0.5f);
+	verts[3].normal = D3DXVECTOR3(1, 0, 0);
+	const DWORD none[4] = { 0, 0, 0, 0 };
+	const DWORD uv[4] = { 0, 1, 0, 0 };
+	const DWORD normal[4] = { 0, 0, 0, 1 };
+	const DWORD both[4] = { 0, 1, 0, 2 };
+	TEST_CHECK(WeldsTo(verts, 4, none));
+	TEST_CHECK(WeldsTo(verts, 4, uv, WELD_TOLERANCE, WELD_UV));
+	TEST_CHECK(WeldsTo(verts, 4, normal, WELD_TOLERANCE, WELD_NORMAL));
+	TEST_CHECK(WeldsTo(verts, 4, both, WELD_TOLERANCE, WELD_UV|WELD_NORMAL));
+
+	// Half a degree apart is the same normal
+	verts[3].normal = D3DXVECTOR3(sinf(D3DXToRadian(0.5f)), cosf(D3DXToRadian(0.5f)), 0);
+	TEST_CHECK(WeldsTo(verts, 4, none, WELD_TOLERANCE, WELD_NORMAL));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compacting keeps the first of each group in order, and the indices follow
+//--------------------------------------------------------------------------------------
+SELF_TEST(WeldCompact)
+{
+	Vertex verts[6];
+	verts[0] = MakeVertex(0, 0, 0);
+	verts[1] = MakeVertex(1, 0, 0);
+	verts[2] = MakeVertex(0, 0, 0.0005f);
+	verts[3] = MakeVertex(2, 0, 0);
+	verts[4] = MakeVertex(1, 0.0005f, 0);
+	verts[5] = MakeVertex(3, 0, 0);
+	DWORD indices[9] = { 0, 1, 2, 2, 3, 4, 4, 5, 0 };
+	DWORD remap[6];
+	TEST_CHECK(WeldVertices(verts, 6, remap)==4);
+	TEST_CHECK(CompactVertices(verts, 6, remap)==4);
+	TEST_CHECK(verts[0].pos.z==0 && verts[1].pos.x==1 && verts[2].pos.x==2 && verts[3].pos.x==3);
+	RemapIndices(indices, 9, remap);
+	const DWORD expected[9] = { 0, 1, 0, 0, 2, 1, 1, 3, 0 };
+	TEST_CHECK(!memcmp(indices, expected, sizeof(expected)));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Random meshes full of near duplicates weld to the same vertices and indices as the
+// old loop
+//--------------------------------------------------------------------------------------
+SELF_TEST(WeldMatchesOldLoop)
+{
+	const int sizes[3] = { 100, 700, 1500 };
+	for(int s=0; s<3; s++)
+	{
+		int numVerts = sizes[s];
+		Array<Vertex> verts, refVerts;
+		Array<DWORD> indices, refIndices;
+		MakeWeldMesh(numVerts, s+1, verts, indices);
+		refVerts.FromArray(verts, verts.Size());
+		refIndices.FromArray(indices, indices.Size());
+		CleanReference(refVerts, refIndices);
+
+		DWORD* pRemap = new DWORD[numVerts];
+		int numKept = WeldVertices(verts, numVerts, pRemap);
+		TEST_CHECK(numKept<numVerts && CompactVertices(verts, numVerts, pRemap)==numKept);
+		RemapIndices(indices, indices.Size(), pRemap);
+
+		int differ = 0;
+		if(TEST_CHECK(numKept==refVerts.Size()))
+			for(int i=0; i<numKept; i++)
+				if(memcmp(&verts[i], &refVerts[i], sizeof(Vertex))!=0)
+					differ++;
+		for(int i=0; i<indices.Size(); i++)
+			if(indices[i]!=refIndices[i])
+				differ++;
+		TEST_CHECK(differ==0);
+
+		delete[] pRemap;
+		verts.Release();
+		refVerts.Release();
+		indices.Release();
+		refIndices.Release();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times the old loop against the hash, the old loop only on the small mesh
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(Weld)
+{
+	const int sizes[2] = { 2048, 1000000 };
+	for(int s=0; s<2; s++)
+	{
+		int numVerts = sizes[s];
+		Array<Vertex> verts, refVerts;
+		Array<DWORD> indices, refIndices;
+		MakeWeldMesh(numVerts, 7, verts, indices);
+
+		double refTime = 0;
+		if(s==0)
+		{
+			refVerts.FromArray(verts, verts.Size());
+			refIndices.FromArray(indices, indices.Size());
+			double start = SelfTest::GetTime();
+			CleanReference(refVerts, refIndices);
+			refTime = SelfTest::GetTime()-start;
+		}
+
+		DWORD* pRemap = new DWORD[numVerts];
+		double start = SelfTest::GetTime();
+		int numKept = WeldVertices(verts, numVerts, pRemap);
+		CompactVertices(verts, numVerts, pRemap);
+		RemapIndices(indices, indices.Size(), pRemap);
+		double weldTime = SelfTest::GetTime()-start;
+
+		if(s==0)
+			Log::Print("Weld: %d vertices to %d: old loop %.1fms, hash %.2fms", numVerts, numKept, refTime, weldTime);
+		else
+			Log::Print("Weld: %d vertices to %d: hash %.1fms", numVerts, numKept, weldTime);
+		delete[] pRemap;
+		verts.Release();
+		refVerts.Release();
+		indices.Release();
+		refIndices.Release();
+	}
+}
+
+#endif
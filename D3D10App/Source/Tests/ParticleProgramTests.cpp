@@ -0,0 +1,300 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleProgramTests.cpp
+//
+// Self tests for the particle effect descriptions and compiled programs
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ParticleProgram.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include <sstream>
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Has every setting, with curves that have steps and keys out of order
+static const char* g_TestEmitterDesc =
+	"# Test effect\n"
+	"texture  Textures\\smoke.jpg  \r\n"
+	"max_particles 5000\n"
+	"lifetime 3\n"
+	"rate 0 100\n"
+	"rate 1 400\n"
+	"rate_loop 2\n"
+	"spawn_radius 0.5\n"
+	"cone 0 2 0 30\n"
+	"speed 3 1\n"
+	"color 1 1 0.2 0.1 0\n"
+	"color 0 1 1 1 1\n"
+	"color 0.25 1 0.8 0.3 1\n"
+	"color 0.5 0.5 0.5 0.5 0.8\n"
+	"color 0.5 0.4 0.4 0.4 0.6\n"
+	"size 0 0.5\n"
+	"size 0.7 2\n"
+	"gravity 0 -0.0075 0\n"
+	"drag 0.95\n"
+	"vortex 1 0 -1 0.02 0.004 0.03\n"
+	"curl 0.15 0.01 0.5\n"
+	"sort 2\n";
+
+// Parses a description from a string
+static bool ParseDesc(ParticleEmitterDesc& desc, const char* szText)
+{
+	std::istringstream text(szText);
+	return desc.Parse(text, "SelfTest");
+}
+
+
+//--------------------------------------------------------------------------------------
+// The parser picks up every setting, sorts curve keys by time and keeps keys at the
+// same time in file order
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleDescParse)
+{
+	ParticleEmitterDesc desc;
+	if(!TEST_CHECK(ParseDesc(desc, g_TestEmitterDesc)))
+		return;
+	TEST_CHECK(strcmp(desc.Texture, "Textures\\smoke.jpg")==0);
+	TEST_CHECK(desc.MaxParticles==5000 && desc.Lifetime==3.0f);
+	TEST_CHECK(desc.Rate.NumKeys==2 && desc.RateLoop==2.0f && desc.SpawnRadius==0.5f);
+	TEST_CHECK(desc.ConeAxis==D3DXVECTOR3(0, 1, 0));
+	TEST_CHECK_NEAR(desc.ConeAngle, D3DXToRadian(30.0f), 1e-6f);
+	TEST_CHECK(desc.MinSpeed==1.0f && desc.MaxSpeed==3.0f);
+	TEST_CHECK(desc.Color.NumKeys==5 && desc.Size.NumKeys==2);
+	TEST_CHECK(desc.Color.Time[0]==0 && desc.Color.Time[4]==1);
+	TEST_CHECK(desc.Color.Value[2].w==0.8f && desc.Color.Value[3].w==0.6f);
+	TEST_CHECK(desc.NumForces==4 && desc.DepthSort && desc.SortGroup==2);
+	TEST_CHECK(desc.Forces[0].Type==PARTICLE_FORCE_GRAVITY && desc.Forces[3].Type==PARTICLE_FORCE_CURL_NOISE);
+	TEST_CHECK(desc.Forces[2].Vector==D3DXVECTOR3(1, 0, -1) && desc.Forces[2].Params==D3DXVECTOR3(0.02f, 0.004f, 0.03f));
+
+	// Parsing again starts from the defaults
+	TEST_CHECK(ParseDesc(desc, "lifetime 2\n"));
+	TEST_CHECK(desc.NumForces==0 && !desc.DepthSort && desc.Color.NumKeys==1 && desc.Rate.Value[0].x==600.0f);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Unknown settings, missing values and too many keys or forces are refused
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleDescRejects)
+{
+	ParticleEmitterDesc desc;
+	TEST_CHECK(!ParseDesc(desc, "lifetime 2\nwobble 3\n"));
+	TEST_CHECK(!ParseDesc(desc, "vortex 0 0 0 1\n"));
+	TEST_CHECK(!ParseDesc(desc, "lifetime 0\n"));
+	TEST_CHECK(!ParseDesc(desc, "cone 0 0 0 10\n"));
+	TEST_CHECK(!ParseDesc(desc, "rate 0 -5\n"));
+	TEST_CHECK(!ParseDesc(desc, "size 0 1\nsize 1 1\nsize 2 1\nsize 3 1\nsize 4 1\nsize 5 1\nsize 6 1\nsize 7 1\nsize 8 1\n"));
+	TEST_CHECK(!ParseDesc(desc, "drag 1\ndrag 1\ndrag 1\ndrag 1\ndrag 1\ndrag 1\ndrag 1\ndrag 1\ndrag 1\n"));
+	TEST_CHECK(ParseDesc(desc, "  # only a comment\n\n\t\n"));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Curves interpolate between keys, hold flat past the ends and step where two keys
+// share a time
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleCurve)
+{
+	ParticleCurve curve;
+	curve.Set(D3DXVECTOR4(2, 0, 0, 0));
+	TEST_CHECK(curve.IsConstant() && curve.Evaluate(5.0f).x==2.0f);
+
+	curve.NumKeys = 0;
+	curve.AddKey(1.0f, D3DXVECTOR4(10, 0, 0, 0));
+	curve.AddKey(0.0f, D3DXVECTOR4(0, 0, 0, 0));
+	curve.AddKey(0.5f, D3DXVECTOR4(4, 0, 0, 0));
+	curve.AddKey(0.5f, D3DXVECTOR4(6, 0, 0, 0));
+	TEST_CHECK(!curve.IsConstant());
+	TEST_CHECK(curve.Evaluate(-1.0f).x==0.0f && curve.Evaluate(2.0f).x==10.0f);
+	TEST_CHECK_NEAR(curve.Evaluate(0.25f).x, 2.0f, 1e-6f);
+	TEST_CHECK_NEAR(curve.Evaluate(0.4999f).x, 4.0f, 1e-3f);
+	TEST_CHECK_NEAR(curve.Evaluate(0.5f).x, 6.0f, 1e-6f);
+	TEST_CHECK_NEAR(curve.Evaluate(0.75f).x, 8.0f, 1e-6f);
+
+	for(int i=curve.NumKeys; i<PARTICLE_MAX_KEYS; i++)
+		TEST_CHECK(curve.AddKey(2.0f, D3DXVECTOR4(10, 0, 0, 0)));
+	TEST_CHECK(!curve.AddKey(3.0f, D3DXVECTOR4(0, 0, 0, 0)));
+}
+
+
+//--------------------------------------------------------------------------------------
+// The compiled program gives the same particles as interpreting the description one
+// particle at a time.  The interpreter uses the integrators on a span of one for the
+// vortex and the noise, which only takes their scalar code.
+//--------------------------------------------------------------------------------------
+struct ScalarParticle
+{
+	D3DXVECTOR3 Position;
+	D3DXVECTOR3 Velocity;
+	D3DXVECTOR4 Color;
+	float Size;
+	float Age;
+};
+
+static void InterpretParticle(const ParticleEmitterDesc& desc, ScalarParticle& p, const ParticleFrame& frame)
+{
+	ParticleSpan span;
+	span.Stream[PARTICLE_POS_X] = &p.Position.x;
+	span.Stream[PARTICLE_POS_Y] = &p.Position.y;
+	span.Stream[PARTICLE_POS_Z] = &p.Position.z;
+	span.Stream[PARTICLE_VEL_X] = &p.Velocity.x;
+	span.Stream[PARTICLE_VEL_Y] = &p.Velocity.y;
+	span.Stream[PARTICLE_VEL_Z] = &p.Velocity.z;
+	span.Stream[PARTICLE_COLOR_R] = &p.Color.x;
+	span.Stream[PARTICLE_COLOR_G] = &p.Color.y;
+	span.Stream[PARTICLE_COLOR_B] = &p.Color.z;
+	span.Stream[PARTICLE_COLOR_A] = &p.Color.w;
+	span.Stream[PARTICLE_SIZE] = &p.Size;
+	span.Stream[PARTICLE_AGE] = &p.Age;
+	span.Count = 1;
+
+	for(int i=0; i<desc.NumForces; i++)
+	{
+		const ParticleForce& f = desc.Forces[i];
+		switch(f.Type)
+		{
+		case PARTICLE_FORCE_GRAVITY:
+			p.Velocity += f.Vector*frame.Step;
+			break;
+		case PARTICLE_FORCE_DRAG:
+			p.Velocity *= powf(f.Params.x, frame.Step);
+			break;
+		case PARTICLE_FORCE_VORTEX:
+			ParticleVortex(span, f.Vector+frame.Origin, f.Params.x, f.Params.y, f.Params.z, frame.Step);
+			break;
+		case PARTICLE_FORCE_CURL_NOISE:
+			ParticleCurlNoise(span, f.Params.x, f.Params.y, frame.Time*f.Params.z, frame.Step);
+			break;
+		}
+	}
+
+	float life = p.Age*frame.InvLifetime;
+	if(!desc.Color.IsConstant())
+	{
+		D3DXVECTOR4 c = desc.Color.Evaluate(life);
+		p.Color = D3DXVECTOR4(c.x*frame.Tint.x, c.y*frame.Tint.y, c.z*frame.Tint.z, c.w*frame.Tint.w);
+	}
+	if(!desc.Size.IsConstant())
+		p.Size = desc.Size.Evaluate(life).x;
+
+	p.Position += p.Velocity*frame.Step;
+	p.Age += frame.ElapsedTime;
+}
+
+SELF_TEST(ParticleProgramMatchesInterpreter)
+{
+	const int count=4000, steps=120;
+	ParticleEmitterDesc desc;
+	if(!TEST_CHECK(ParseDesc(desc, g_TestEmitterDesc)))
+		return;
+
+	// A cloud of particles at every age, some past their lifetime
+	UINT state = 1;
+	ParticleStore store;
+	store.Create(count);
+	ScalarParticle* pScalar = new ScalarParticle[count];
+	for(int i=0; i<count; i++)
+	{
+		float r[8];
+		for(int j=0; j<8; j++)
+		{
+			state ^= state<<13; state ^= state>>17; state ^= state<<5;
+			r[j] = (state & 0xffff)/65535.0f;
+		}
+		ScalarParticle& p = pScalar[i];
+		p.Position = D3DXVECTOR3(r[0]*40-20, r[1]*20, r[2]*40-20);
+		p.Velocity = D3DXVECTOR3(r[3]-0.5f, r[4]*2, r[5]-0.5f);
+		p.Color = D3DXVECTOR4(1, 1, 1, 1);
+		p.Size = 1;
+		p.Age = r[6]*desc.Lifetime*1.2f;
+		store.Add(p.Position, p.Velocity, p.Color, p.Size);
+		store.GetStream(PARTICLE_AGE)[i] = p.Age;
+	}
+
+	ParticleProgram program;
+	program.Compile(desc);
+	TEST_CHECK(program.GetNumOps()==6);
+
+	ParticleFrame frame;
+	frame.ElapsedTime = 1.0f/60.0f;
+	frame.Step = 1.0f;
+	frame.InvLifetime = 1.0f/desc.Lifetime;
+	frame.Origin = D3DXVECTOR3(2, 0, 1);
+	frame.Tint = D3DXVECTOR4(1, 0.5f, 0.25f, 1);
+	for(int s=0; s<steps; s++)
+	{
+		frame.Time = s*frame.ElapsedTime;
+
+		// Odd sized runs so the scalar tails of the kernels are used too
+		for(int start=0; start<count; start+=1001)
+		{
+			ParticleSpan span = store.GetSpan(start, start+1001);
+			program.Run(span, frame);
+			ParticleIntegrate(span, frame.ElapsedTime, frame.Step);
+		}
+		for(int i=0; i<count; i++)
+			InterpretParticle(desc, pScalar[i], frame);
+	}
+
+	int differ = 0;
+	for(int i=0; i<count; i++)
+	{
+		const ScalarParticle& p = pScalar[i];
+		const float expected[PARTICLE_STREAM_COUNT] = { p.Position.x, p.Position.y, p.Position.z, p.Velocity.x, p.Velocity.y, p.Velocity.z,
+			p.Color.x, p.Color.y, p.Color.z, p.Color.w, p.Size, p.Age };
+		for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+		{
+			float v = store.GetStream((PARTICLE_STREAM)s)[i];
+			if(fabsf(v-expected[s]) > 1e-3f*Math::Max(1.0f, fabsf(expected[s])))
+				differ++;
+		}
+	}
+	TEST_CHECK(differ==0);
+	delete[] pScalar;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Constant curves compile to nothing, since particles spawn with their value
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleProgramCompile)
+{
+	ParticleEmitterDesc desc;
+	ParticleProgram program;
+	program.Compile(desc);
+	TEST_CHECK(program.GetNumOps()==0);
+
+	TEST_CHECK(ParseDesc(desc, "color 0 1 1 1 1\ncolor 1 1 1 1 1\nsize 0 1\nsize 1 0\ngravity 0 -1 0\n"));
+	program.Compile(desc);
+	TEST_CHECK(program.GetNumOps()==2);
+
+	// Size goes 1 to 0 over the life, gravity adds its step to the velocity
+	ParticleStore store;
+	store.Create(5);
+	for(int i=0; i<5; i++)
+		store.Add(D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(0, 0, 0), D3DXVECTOR4(1, 1, 1, 1));
+	for(int i=0; i<5; i++)
+		store.GetStream(PARTICLE_AGE)[i] = i*0.25f*desc.Lifetime;
+	ParticleFrame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.Step = 2.0f;
+	frame.InvLifetime = 1.0f/desc.Lifetime;
+	frame.Tint = D3DXVECTOR4(1, 1, 1, 1);
+	ParticleSpan span = store.GetSpan();
+	program.Run(span, frame);
+	for(int i=0; i<5; i++)
+	{
+		TEST_CHECK_NEAR(store.GetStream(PARTICLE_SIZE)[i], 1.0f-i*0.25f, 1e-5f);
+		TEST_CHECK(store.GetStream(PARTICLE_VEL_Y)[i]==-2.0f);
+	}
+	program.Release();
+}
+
+#endif
@@ -0,0 +1,274 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleSortTests.cpp
+//
+// Self tests and benchmark for the back to front particle sort
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ParticleSort.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Is a sorted copy in order, stable and a permutation of the keys it came from?
+static bool IsSortedFrom(const USHORT* pInput, const USHORT* pKeys, const int* pOrder, int count)
+{
+	bool* pSeen = new bool[count];
+	memset(pSeen, 0, count);
+	bool ok = true;
+	for(int i=0; i<count && ok; i++)
+	{
+		if(pOrder[i]<0 || pOrder[i]>=count || pSeen[pOrder[i]] || pInput[pOrder[i]]!=pKeys[i])
+			ok = false;
+		else if(i>0 && (pKeys[i]<pKeys[i-1] || (pKeys[i]==pKeys[i-1] && pOrder[i]<pOrder[i-1])))
+			ok = false;
+		else
+			pSeen[pOrder[i]] = true;
+	}
+	delete[] pSeen;
+	return ok;
+}
+
+// Sorts a copy of the input and checks it, returns what Sort() did
+static bool SortAndCheck(ParticleSorter& sorter, const USHORT* pInput, USHORT* pKeys, int* pOrder, int count)
+{
+	memcpy(pKeys, pInput, count*sizeof(USHORT));
+	bool bCoherent = sorter.Sort(pKeys, count, pOrder);
+	TEST_CHECK(IsSortedFrom(pInput, pKeys, pOrder, count));
+	return bCoherent;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The nearest particles get the highest keys, depths are clamped to the range, and the
+// SSE keys match the scalar ones on a span that isn't a multiple of four
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleDepthKeys)
+{
+	ParticleStore store;
+	store.Create(8);
+	const float z[7] = { 10.1f, 10.0f, 8.0f, 60.0f, 120.0f, 200.0f, 35.0f };
+	for(int i=0; i<7; i++)
+		store.Add(D3DXVECTOR3(5, -3, z[i]), D3DXVECTOR3(0, 0, 0), D3DXVECTOR4(1, 1, 1, 1));
+	USHORT keys[7];
+	ParticleSpan span = store.GetSpan();
+	ParticleDepthKeys(span, D3DXVECTOR3(0, 0, 10), D3DXVECTOR3(0, 0, 1), 0.1f, 100.1f, keys);
+	TEST_CHECK(keys[0]==65535 && keys[1]==65535 && keys[2]==65535);
+	TEST_CHECK_NEAR(keys[3], 65535.0f-49.9f*65535.0f/100.0f, 1.0f);
+	TEST_CHECK(keys[4]==0 && keys[5]==0);
+	TEST_CHECK(keys[6]<keys[0] && keys[6]>keys[3]);
+
+	const int count=1003;
+	store.Create(count);
+	UINT state = 5;
+	for(int i=0; i<count; i++)
+	{
+		D3DXVECTOR3 pos((TestRand(state)%4000)*0.1f-200, (TestRand(state)%4000)*0.1f-200, (TestRand(state)%4000)*0.1f-200);
+		store.Add(pos, D3DXVECTOR3(0, 0, 0), D3DXVECTOR4(1, 1, 1, 1));
+	}
+	D3DXVECTOR3 eye(3, 7, -250), look(0.28f, -0.1f, 0.95f);
+	D3DXVec3Normalize(&look, &look);
+	USHORT* pKeys = new USHORT[count];
+	span = store.GetSpan();
+	ParticleDepthKeys(span, eye, look, 0.1f, 500.0f, pKeys);
+	int differ = 0;
+	for(int i=0; i<count; i++)
+	{
+		USHORT key;
+		span = store.GetSpan(i, i+1);
+		ParticleDepthKeys(span, eye, look, 0.1f, 500.0f, &key);
+		if(key!=pKeys[i])
+			differ++;
+	}
+	TEST_CHECK(differ==0);
+	delete[] pKeys;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Random keys go through the radix sort, including ranges narrow enough to be full of
+// equal keys and ones that only need the low byte pass
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleSortRandom)
+{
+	const int count=5000;
+	USHORT* pInput = new USHORT[count];
+	USHORT* pKeys = new USHORT[count];
+	int* pOrder = new int[count];
+	ParticleSorter sorter;
+	UINT state = 11;
+
+	const int ranges[4] = { 65536, 64, 256, 2 };
+	for(int r=0; r<4; r++)
+	{
+		for(int i=0; i<count; i++)
+			pInput[i] = (USHORT)(TestRand(state) % ranges[r]);
+		TEST_CHECK(!SortAndCheck(sorter, pInput, pKeys, pOrder, count));
+	}
+
+	// Only the high byte differs
+	for(int i=0; i<count; i++)
+		pInput[i] = (USHORT)((TestRand(state) % 256) << 8 | 0x5a);
+	SortAndCheck(sorter, pInput, pKeys, pOrder, count);
+
+	// Short and empty runs
+	for(int n=0; n<5; n++)
+	{
+		for(int i=0; i<n; i++)
+			pInput[i] = (USHORT)(TestRand(state) % 4);
+		SortAndCheck(sorter, pInput, pKeys, pOrder, n);
+	}
+
+	delete[] pInput;
+	delete[] pKeys;
+	delete[] pOrder;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Keys left in last frame's order with a few neighbors crossed take the insertion sort.
+// Respawns far out of place run it out of moves, and after that the radix sort is used
+// for a few frames before the insertion sort is tried again.
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleSortCoherent)
+{
+	const int count=4000;
+	USHORT* pInput = new USHORT[count];
+	USHORT* pKeys = new USHORT[count];
+	int* pOrder = new int[count];
+	ParticleSorter sorter;
+	UINT state = 3;
+
+	for(int i=0; i<count; i++)
+		pInput[i] = (USHORT)(i*16 + TestRand(state)%16);
+	TEST_CHECK(SortAndCheck(sorter, pInput, pKeys, pOrder, count));
+	for(int i=0; i<count; i++)
+		TEST_CHECK(pOrder[i]==i);
+
+	// Neighbors crossed
+	for(int c=0; c<count/20; c++)
+	{
+		int i = TestRand(state) % (count-1);
+		USHORT tmp = pInput[i]; pInput[i] = pInput[i+1]; pInput[i+1] = tmp;
+	}
+	TEST_CHECK(SortAndCheck(sorter, pInput, pKeys, pOrder, count));
+
+	// Respawned anywhere
+	memcpy(pInput, pKeys, count*sizeof(USHORT));
+	for(int c=0; c<count/20; c++)
+		pInput[TestRand(state) % count] = (USHORT)(TestRand(state) % 65536);
+	TEST_CHECK(!SortAndCheck(sorter, pInput, pKeys, pOrder, count));
+
+	// Backing off, even though these would suit the insertion sort
+	memcpy(pInput, pKeys, count*sizeof(USHORT));
+	USHORT tmp = pInput[10]; pInput[10] = pInput[11]; pInput[11] = tmp;
+	for(int f=0; f<PARTICLE_SORT_BACKOFF; f++)
+		TEST_CHECK(!SortAndCheck(sorter, pInput, pKeys, pOrder, count));
+	TEST_CHECK(SortAndCheck(sorter, pInput, pKeys, pOrder, count));
+
+	delete[] pInput;
+	delete[] pKeys;
+	delete[] pOrder;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times a comparison sort of the depths against the radix sort, and the insertion sort
+// on the order left from the previous frame, as the particles drift
+//--------------------------------------------------------------------------------------
+struct BenchDepth
+{
+	float Depth;
+	int Index;
+};
+
+static int CompareBenchDepth(const void* a, const void* b)
+{
+	float da = ((const BenchDepth*)a)->Depth, db = ((const BenchDepth*)b)->Depth;
+	return da<db ? 1 : (da>db ? -1 : 0);
+}
+
+SELF_BENCHMARK(ParticleSort)
+{
+	const int count=1000000, frames=20;
+	const float speed=0.01f;
+	UINT state = 7;
+	ParticleStore store;
+	store.Create(count);
+	for(int i=0; i<count; i++)
+	{
+		D3DXVECTOR3 pos((TestRand(state)%4000)*0.1f-200, (TestRand(state)%4000)*0.1f-200, (TestRand(state)%4000)*0.1f);
+		D3DXVECTOR3 vel(((int)(TestRand(state)%200)-100)*0.01f*speed, ((int)(TestRand(state)%200)-100)*0.01f*speed, ((int)(TestRand(state)%200)-100)*0.01f*speed);
+		store.Add(pos, vel, D3DXVECTOR4(1, 1, 1, 1));
+	}
+	D3DXVECTOR3 eye(0, 0, -10), look(0, 0, 1);
+
+	USHORT* pKeys = new USHORT[count];
+	int* pOrder = new int[count];
+	float* pScratch = new float[count];
+	BenchDepth* pDepths = new BenchDepth[count];
+	ParticleSorter radixSorter, sorter;
+	double compareTime = 0, radixTime = 0, coherentTime = 0, reorderTime = 0;
+	int coherentFrames = 0;
+
+	for(int f=0; f<frames; f++)
+	{
+		ParticleSpan span = store.GetSpan();
+		ParticleIntegrate(span, 1.0f/60.0f, 1.0f);
+
+		// Comparison sort on float depths
+		double start = SelfTest::GetTime();
+		const float* px = store.GetStream(PARTICLE_POS_X);
+		const float* py = store.GetStream(PARTICLE_POS_Y);
+		const float* pz = store.GetStream(PARTICLE_POS_Z);
+		for(int i=0; i<count; i++)
+		{
+			pDepths[i].Depth = (px[i]-eye.x)*look.x + (py[i]-eye.y)*look.y + (pz[i]-eye.z)*look.z;
+			pDepths[i].Index = i;
+		}
+		qsort(pDepths, count, sizeof(BenchDepth), CompareBenchDepth);
+		compareTime += SelfTest::GetTime()-start;
+
+		// Radix sort from scratch, the keys are shuffled so no order is left over
+		start = SelfTest::GetTime();
+		ParticleDepthKeys(span, eye, look, 0.1f, 500.0f, pKeys);
+		radixTime += SelfTest::GetTime()-start;
+		for(int i=count-1; i>0; i--)
+		{
+			int j = TestRand(state) % (i+1);
+			USHORT tmp = pKeys[i]; pKeys[i] = pKeys[j]; pKeys[j] = tmp;
+		}
+		start = SelfTest::GetTime();
+		radixSorter.Sort(pKeys, count, pOrder);
+		radixTime += SelfTest::GetTime()-start;
+
+		// Keys in the order the store was left in last frame
+		start = SelfTest::GetTime();
+		ParticleDepthKeys(span, eye, look, 0.1f, 500.0f, pKeys);
+		if(sorter.Sort(pKeys, count, pOrder))
+			coherentFrames++;
+		coherentTime += SelfTest::GetTime()-start;
+
+		// Moving the particles into the new order is paid either way
+		start = SelfTest::GetTime();
+		store.Reorder(pOrder, pScratch);
+		reorderTime += SelfTest::GetTime()-start;
+	}
+
+	Log::Print("ParticleSort: %d particles, %d frames, speed %.3f: qsort %.2fms, radix %.2fms, coherent %.2fms (%d frames insertion sorted), reorder %.2fms",
+		count, frames, speed, compareTime/frames, radixTime/frames, coherentTime/frames, coherentFrames, reorderTime/frames);
+
+	delete[] pKeys;
+	delete[] pOrder;
+	delete[] pScratch;
+	delete[] pDepths;
+}
+
+#endif
@@ -0,0 +1,337 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleStoreTests.cpp
+//
+// Self tests and benchmark for the particle streams and integrators
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ParticleStore.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include "Array.cpp"
+#include "Stack.cpp"
+#include "LinkedList.cpp"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Fills a store with a random cloud of particles
+static void FillParticleStore(ParticleStore& store, int count, UINT seed)
+{
+	UINT state = seed*2654435761u + 1;
+	store.Create(count);
+	for(int i=0; i<count; i++)
+	{
+		float r[7];
+		for(int j=0; j<7; j++)
+		{
+			state ^= state<<13; state ^= state>>17; state ^= state<<5;
+			r[j] = (state & 0xffff)/65535.0f;
+		}
+		store.Add(D3DXVECTOR3(r[0]*40-20, r[1]*20, r[2]*40-20), D3DXVECTOR3(r[3]-0.5f, r[4]*2, r[5]-0.5f),
+			D3DXVECTOR4(r[6], r[6], 1, 1));
+		store.GetStream(PARTICLE_AGE)[i] = r[6]*4;
+	}
+}
+
+// Every integrator, in the order the emitters use them
+static void RunParticleKernels(ParticleSpan& span, float elapsedTime, float step, float phase)
+{
+	ParticleGravity(span, D3DXVECTOR3(0, -0.0075f, 0), step);
+	ParticleDrag(span, 0.98f, step);
+	ParticleVortex(span, D3DXVECTOR3(0, 0, 0), 0.02f, 0.004f, 0.03f, step);
+	ParticleCurlNoise(span, 0.15f, 0.01f, phase, step);
+	ParticleIntegrate(span, elapsedTime, step);
+}
+
+// A store with a single particle
+static ParticleSpan CreateSingle(ParticleStore& store, const D3DXVECTOR3& pos, const D3DXVECTOR3& vel)
+{
+	store.Create(1);
+	store.Add(pos, vel, D3DXVECTOR4(1, 1, 1, 1));
+	return store.GetSpan();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Adding stops at the capacity, removal moves the last particle into the gap and spans
+// are clipped to the live range
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleStoreAddRemove)
+{
+	ParticleStore store;
+	if(!TEST_CHECK(store.Create(10)))
+		return;
+	TEST_CHECK(store.GetCapacity()==12);
+	int added = 0;
+	while(store.Add(D3DXVECTOR3((float)added, 0, 0), D3DXVECTOR3(0, 0, 0), D3DXVECTOR4(1, 1, 1, 1), (float)added))
+		added++;
+	TEST_CHECK(added==12 && store.GetCount()==12);
+
+	store.Remove(3);
+	TEST_CHECK(store.GetCount()==11);
+	TEST_CHECK(store.GetStream(PARTICLE_POS_X)[3]==11.0f && store.GetStream(PARTICLE_SIZE)[3]==11.0f);
+	store.Remove(10);
+	TEST_CHECK(store.GetCount()==10 && store.GetStream(PARTICLE_POS_X)[9]==9.0f);
+
+	ParticleSpan span = store.GetSpan(-5, 4);
+	TEST_CHECK(span.Count==4 && span.Stream[PARTICLE_POS_X]==store.GetStream(PARTICLE_POS_X));
+	span = store.GetSpan(8, 100);
+	TEST_CHECK(span.Count==2 && span.Stream[PARTICLE_AGE][0]==0.0f);
+	TEST_CHECK(store.GetSpan(7, 3).Count==0);
+
+	// Reversing twice gives the store back
+	int order[10];
+	float scratch[10];
+	for(int i=0; i<10; i++)
+		order[i] = 9-i;
+	store.Reorder(order, scratch);
+	TEST_CHECK(store.GetStream(PARTICLE_POS_X)[0]==9.0f && store.GetStream(PARTICLE_SIZE)[6]==11.0f);
+	store.Reorder(order, scratch);
+	TEST_CHECK(store.GetStream(PARTICLE_POS_X)[3]==11.0f && store.GetStream(PARTICLE_POS_X)[9]==9.0f);
+
+	store.Clear();
+	TEST_CHECK(store.GetCount()==0 && store.GetSpan().Count==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Each integrator does what it says on a single particle
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleKernelsKnownValues)
+{
+	ParticleStore store;
+	ParticleSpan span = CreateSingle(store, D3DXVECTOR3(1, 2, 3), D3DXVECTOR3(1, 0, 0));
+	ParticleGravity(span, D3DXVECTOR3(0, -1, 0.5f), 2.0f);
+	TEST_CHECK(span.Stream[PARTICLE_VEL_X][0]==1.0f && span.Stream[PARTICLE_VEL_Y][0]==-2.0f && span.Stream[PARTICLE_VEL_Z][0]==1.0f);
+	ParticleDrag(span, 0.5f, 2.0f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_X][0], 0.25f, 1e-6f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_Y][0], -0.5f, 1e-6f);
+	ParticleIntegrate(span, 0.1f, 4.0f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_POS_X][0], 2.0f, 1e-6f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_POS_Y][0], 0.0f, 1e-6f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_POS_Z][0], 4.0f, 1e-6f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_AGE][0], 0.1f, 1e-6f);
+
+	// A quarter turn around (1,0,1) that also pushes the particle out by one
+	span = CreateSingle(store, D3DXVECTOR3(3, 0, 1), D3DXVECTOR3(1, 0, 0));
+	ParticleVortex(span, D3DXVECTOR3(1, 5, 1), 0.25f*D3DX_PI, 0.5f, 0.25f, 2.0f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_POS_X][0], 1.0f, 1e-5f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_POS_Z][0], 4.0f, 1e-5f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_POS_Y][0], 0.5f, 1e-6f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_X][0], 0.0f, 1e-5f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_Z][0], 1.0f, 1e-5f);
+
+	// The curl at the origin only depends on the offsets: (cos .7 - cos 2.9, cos 1.3 - cos 5.3, cos 4.1 - cos 0)
+	span = CreateSingle(store, D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(0, 0, 0));
+	ParticleCurlNoise(span, 1.0f, 0.5f, 0.0f, 2.0f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_X][0], cosf(0.7f)-cosf(2.9f), 1e-4f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_Y][0], cosf(1.3f)-cosf(5.3f), 1e-4f);
+	TEST_CHECK_NEAR(span.Stream[PARTICLE_VEL_Z][0], cosf(4.1f)-1.0f, 1e-4f);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Runs every integrator over a whole store and again one particle at a time, which
+// only takes the scalar path.  The count isn't a multiple of four so the SSE loop
+// also hands its leftovers to the scalar one.
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleKernelsMatchScalar)
+{
+	const int count=1001, steps=60;
+	ParticleStore fast, scalar;
+	FillParticleStore(fast, count, 3);
+	FillParticleStore(scalar, count, 3);
+	for(int s=0; s<steps; s++)
+	{
+		float phase = s*0.05f;
+		ParticleSpan span = fast.GetSpan();
+		RunParticleKernels(span, 1.0f/60.0f, 1.0f, phase);
+		for(int i=0; i<count; i++)
+		{
+			span = scalar.GetSpan(i, i+1);
+			RunParticleKernels(span, 1.0f/60.0f, 1.0f, phase);
+		}
+	}
+
+	int differ = 0;
+	for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+	{
+		const float* pA = fast.GetStream((PARTICLE_STREAM)s);
+		const float* pB = scalar.GetStream((PARTICLE_STREAM)s);
+		for(int i=0; i<count; i++)
+			if(fabsf(pA[i]-pB[i]) > 1e-3f*Math::Max(1.0f, fabsf(pB[i])))
+				differ++;
+	}
+	TEST_CHECK(differ==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Removing old particles leaves exactly the young ones, and keeping the order leaves
+// them in the order they were in
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleRemoveOlderThan)
+{
+	const int count=999;
+	const float maxAge=2.0f;
+	ParticleStore swapped, ordered;
+	FillParticleStore(swapped, count, 9);
+	FillParticleStore(ordered, count, 9);
+
+	Array<float> ages, xs;
+	ages.Allocate(count);
+	xs.Allocate(count);
+	memcpy((float*)ages, ordered.GetStream(PARTICLE_AGE), count*sizeof(float));
+	memcpy((float*)xs, ordered.GetStream(PARTICLE_POS_X), count*sizeof(float));
+	int young = 0;
+	for(int i=0; i<count; i++)
+		if(ages[i]<=maxAge)
+			young++;
+
+	TEST_CHECK(swapped.RemoveOlderThan(maxAge)==count-young);
+	TEST_CHECK(swapped.GetCount()==young);
+	const float* pAge = swapped.GetStream(PARTICLE_AGE);
+	int old = 0;
+	for(int i=0; i<swapped.GetCount(); i++)
+		if(pAge[i]>maxAge)
+			old++;
+	TEST_CHECK(old==0);
+
+	TEST_CHECK(ordered.RemoveOlderThan(maxAge, true)==count-young);
+	TEST_CHECK(ordered.GetCount()==young);
+	pAge = ordered.GetStream(PARTICLE_AGE);
+	const float* pX = ordered.GetStream(PARTICLE_POS_X);
+	int misplaced = 0;
+	for(int i=0, j=0; i<count && j<ordered.GetCount(); i++)
+	{
+		if(ages[i]>maxAge)
+			continue;
+		if(pX[j]!=xs[i] || pAge[j]!=ages[i])
+			misplaced++;
+		j++;
+	}
+	TEST_CHECK(misplaced==0);
+
+	// Nothing to remove, and everything to remove
+	TEST_CHECK(ordered.RemoveOlderThan(maxAge, true)==0 && ordered.GetCount()==young);
+	TEST_CHECK(swapped.RemoveOlderThan(-1.0f)==young && swapped.GetCount()==0);
+	ages.Release();
+	xs.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// The old layout, a linked list of structs with a call per particle, for comparison
+//--------------------------------------------------------------------------------------
+struct BenchParticle
+{
+	D3DXVECTOR3 Position;
+	D3DXVECTOR3 Velocity;
+	D3DXVECTOR4 Color;
+	float Size;
+	float Age;
+};
+
+static float g_BenchPhase;
+
+static void BenchParticleProc(BenchParticle& p, const float& time)
+{
+	ParticleSpan span;
+	span.Stream[PARTICLE_POS_X] = &p.Position.x;
+	span.Stream[PARTICLE_POS_Y] = &p.Position.y;
+	span.Stream[PARTICLE_POS_Z] = &p.Position.z;
+	span.Stream[PARTICLE_VEL_X] = &p.Velocity.x;
+	span.Stream[PARTICLE_VEL_Y] = &p.Velocity.y;
+	span.Stream[PARTICLE_VEL_Z] = &p.Velocity.z;
+	span.Stream[PARTICLE_COLOR_R] = &p.Color.x;
+	span.Stream[PARTICLE_COLOR_G] = &p.Color.y;
+	span.Stream[PARTICLE_COLOR_B] = &p.Color.z;
+	span.Stream[PARTICLE_COLOR_A] = &p.Color.w;
+	span.Stream[PARTICLE_SIZE] = &p.Size;
+	span.Stream[PARTICLE_AGE] = &p.Age;
+	span.Count = 1;
+	RunParticleKernels(span, time, 1.0f, g_BenchPhase);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times both layouts over the same frames
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(Particles)
+{
+	const int count=100000, frames=100;
+	const float lifetime = 3.5f;
+	const float elapsedTime = 1.0f/60.0f;
+
+	ParticleStore store;
+	FillParticleStore(store, count, 1);
+	Array<BenchParticle> particles;
+	particles.Allocate(count);
+	LinkedList<BenchParticle*> active;
+	Stack<BenchParticle*> pool;
+	for(int i=0; i<count; i++)
+	{
+		BenchParticle& p = particles[i];
+		p.Position = D3DXVECTOR3(store.GetStream(PARTICLE_POS_X)[i], store.GetStream(PARTICLE_POS_Y)[i], store.GetStream(PARTICLE_POS_Z)[i]);
+		p.Velocity = D3DXVECTOR3(store.GetStream(PARTICLE_VEL_X)[i], store.GetStream(PARTICLE_VEL_Y)[i], store.GetStream(PARTICLE_VEL_Z)[i]);
+		p.Color = D3DXVECTOR4(1, 1, 1, 1);
+		p.Size = 1;
+		p.Age = store.GetStream(PARTICLE_AGE)[i];
+		active.Add(&p);
+	}
+	void (*pCallback)(BenchParticle&, const float&) = &BenchParticleProc;
+
+	double start = SelfTest::GetTime();
+	for(int f=0; f<frames; f++)
+	{
+		g_BenchPhase = f*0.05f;
+		active.Itterate();
+		BenchParticle* p;
+		while( (p=active.GetCurrent()) != NULL )
+		{
+			(*pCallback)(*p, elapsedTime);
+			if(p->Age>lifetime)
+			{
+				active.RemoveCurrent();
+				pool.Push(p);
+			}
+			else
+				active.StepForward();
+		}
+
+		// Respawn what died
+		while(!pool.IsEmpty())
+		{
+			p = pool.Pop();
+			p->Position = D3DXVECTOR3(0, 0, 0);
+			p->Age = 0;
+			active.Add(p);
+		}
+	}
+	double listTime = SelfTest::GetTime()-start;
+	active.Release();
+	pool.Release();
+	particles.Release();
+
+	start = SelfTest::GetTime();
+	for(int f=0; f<frames; f++)
+	{
+		ParticleSpan span = store.GetSpan();
+		RunParticleKernels(span, elapsedTime, 1.0f, f*0.05f);
+		store.RemoveOlderThan(lifetime);
+		while(store.GetCount()<count)
+			store.Add(D3DXVECTOR3(0, 0, 0), D3DXVECTOR3(0, 0, 0), D3DXVECTOR4(1, 1, 1, 1));
+	}
+	double storeTime = SelfTest::GetTime()-start;
+
+	Log::Print("Particles: %d particles, %d frames: list and callback %.2fms/frame, streams and SSE %.2fms/frame",
+		count, frames, listTime/frames, storeTime/frames);
+}
+
+#endif
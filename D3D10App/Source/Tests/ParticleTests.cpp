@@ -0,0 +1,192 @@
+//--------------------------------------------------------------------------------------
+// File: ParticleTests.cpp
+//
+// Self tests and benchmark for updating the particle emitters on the thread pool
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Particle.h"
+#include "ThreadPool.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// A spread of emitters: one big enough to be split into several jobs, a sort group of
+// two, a sorted one of its own and a small one.  The view is the identity, so they sit
+// out along +z to be sorted.
+static void CreateTestEmitters(ParticleEmitter* pEmitters, Array<ParticleEmitter*>& list, int scale, Effect& effect, Camera& camera)
+{
+	const D3DXVECTOR3 positions[5] = { D3DXVECTOR3(0, -2, 40), D3DXVECTOR3(5, 0, 30), D3DXVECTOR3(-3, 1, 32), D3DXVECTOR3(0, 0, 50), D3DXVECTOR3(2, 2, 20) };
+	const float rates[5] = { 300000.0f, 6000.0f, 6000.0f, 1200.0f, 120.0f };
+	list.Clear();
+	for(int i=0; i<5; i++)
+	{
+		ParticleEmitterDesc desc;
+		desc.Texture[0] = 0;
+		desc.Lifetime = i==4 ? 0.3f : 0.5f;
+		desc.Rate.Set(D3DXVECTOR4(rates[i]*scale, 0, 0, 0));
+		desc.MaxParticles = (int)(rates[i]*scale*desc.Lifetime) + 256;
+		desc.SpawnRadius = 2.0f;
+		desc.ConeAngle = D3DXToRadian(30.0f);
+		desc.MinSpeed = 0.5f;
+		desc.MaxSpeed = 4.0f;
+		desc.Color.Set(D3DXVECTOR4(1, 0.5f, 0.25f, 1));
+		desc.DepthSort = i>=1 && i<=3;
+		desc.SortGroup = i<=2 ? 1 : 0;
+
+		ParticleEmitter& e = pEmitters[i];
+		e.Create(desc, effect, camera);
+		D3DXVECTOR3 pos = positions[i];
+		e.SetPosition(pos);
+		e.SetSeed(i+1);
+		e.AddGravity(D3DXVECTOR3(0, -9.8f, 0));
+		e.AddDrag(0.02f);
+		if(i==0)
+			e.AddCurlNoise(0.2f, 3.0f, 1.0f);
+		if(i==1)
+			e.AddVortex(D3DXVECTOR3(0, 0, 0), 2.0f, 0.5f, 1.0f);
+		list.Add(&e);
+	}
+}
+
+// Room for every instance the emitters can have
+static int GetTestCapacity(ParticleEmitter* pEmitters)
+{
+	int capacity = 0;
+	for(int i=0; i<5; i++)
+		capacity += pEmitters[i].GetStore().GetCapacity();
+	return capacity;
+}
+
+static void ReleaseTestEmitters(ParticleEmitter* pEmitters)
+{
+	for(int i=0; i<5; i++)
+		pEmitters[i].Release();
+}
+
+// Are two emitters' live particles the same to the bit?
+static bool SameParticles(ParticleEmitter& a, ParticleEmitter& b)
+{
+	ParticleStore& sa = a.GetStore();
+	ParticleStore& sb = b.GetStore();
+	if(sa.GetCount()!=sb.GetCount())
+		return false;
+	for(int s=0; s<PARTICLE_STREAM_COUNT; s++)
+		if(memcmp(sa.GetStream((PARTICLE_STREAM)s), sb.GetStream((PARTICLE_STREAM)s), sa.GetCount()*sizeof(float))!=0)
+			return false;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The pool gives the same particles, draws and packed instances as running every stage
+// in order on one thread, frame after frame as the emitters fill up and expire
+//--------------------------------------------------------------------------------------
+SELF_TEST(ParticleUpdateMatchesSerial)
+{
+	Effect effect;
+	Camera camera;
+	ParticleEmitter parallel[5], serial[5];
+	Array<ParticleEmitter*> parallelList, serialList;
+	CreateTestEmitters(parallel, parallelList, 1, effect, camera);
+	CreateTestEmitters(serial, serialList, 1, effect, camera);
+
+	Array<ParticleDraw> parallelDraws, serialDraws;
+	InstanceVertex* pParallelInstances = new InstanceVertex[GetTestCapacity(parallel)];
+	InstanceVertex* pSerialInstances = new InstanceVertex[GetTestCapacity(serial)];
+	int wrongTotals = 0, wrongDraws = 0, wrongInstances = 0, wrongParticles = 0;
+	int mostParticles = 0, mostDraws = 0;
+	for(int f=0; f<60; f++)
+	{
+		int total = ParticleEmitter::SimulateEmitters(parallelList, parallelDraws, 1.0f/60.0f, true);
+		int serialTotal = ParticleEmitter::SimulateEmitters(serialList, serialDraws, 1.0f/60.0f, false);
+		if(total!=serialTotal || parallelDraws.Size()!=serialDraws.Size())
+		{
+			wrongTotals++;
+			continue;
+		}
+		for(int i=0; i<parallelDraws.Size(); i++)
+		{
+			const ParticleDraw& a = parallelDraws[i];
+			const ParticleDraw& b = serialDraws[i];
+			if(a.pEmitter-parallel!=b.pEmitter-serial || a.Start!=b.Start || a.Count!=b.Count || a.FirstInstance!=b.FirstInstance)
+				wrongDraws++;
+		}
+
+		memset(pParallelInstances, 0xcd, total*sizeof(InstanceVertex));
+		memset(pSerialInstances, 0, total*sizeof(InstanceVertex));
+		ParticleEmitter::PackEmitters(parallelDraws, pParallelInstances, true);
+		ParticleEmitter::PackEmitters(serialDraws, pSerialInstances, false);
+		if(memcmp(pParallelInstances, pSerialInstances, total*sizeof(InstanceVertex))!=0)
+			wrongInstances++;
+
+		for(int i=0; i<5; i++)
+			wrongParticles += SameParticles(parallel[i], serial[i]) ? 0 : 1;
+		mostParticles = Math::Max(mostParticles, parallel[0].GetNumParticles());
+		mostDraws = Math::Max(mostDraws, parallelDraws.Size());
+	}
+	TEST_CHECK(wrongTotals==0);
+	TEST_CHECK(wrongDraws==0);
+	TEST_CHECK(wrongInstances==0);
+	TEST_CHECK(wrongParticles==0);
+
+	// The big emitter was split into jobs and the sort group was interleaved
+	TEST_CHECK(mostParticles>2*PARTICLE_JOB_SIZE);
+	TEST_CHECK(mostDraws>5);
+
+	delete[] pParallelInstances;
+	delete[] pSerialInstances;
+	ReleaseTestEmitters(parallel);
+	ReleaseTestEmitters(serial);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times a frame of the emitters on the pool and on one thread
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(ParticleUpdate)
+{
+	const int scale=4, warmup=40, frames=60;
+	Effect effect;
+	Camera camera;
+	ParticleEmitter parallel[5], serial[5];
+	Array<ParticleEmitter*> parallelList, serialList;
+	CreateTestEmitters(parallel, parallelList, scale, effect, camera);
+	CreateTestEmitters(serial, serialList, scale, effect, camera);
+
+	Array<ParticleDraw> draws;
+	InstanceVertex* pInstances = new InstanceVertex[GetTestCapacity(parallel)];
+	double simulateTime[2] = { 0, 0 }, packTime[2] = { 0, 0 };
+	int particles = 0;
+	for(int f=0; f<warmup+frames; f++)
+		for(int k=0; k<2; k++)
+		{
+			double start = SelfTest::GetTime();
+			int total = ParticleEmitter::SimulateEmitters(k==0 ? parallelList : serialList, draws, 1.0f/60.0f, k==0);
+			double simulated = SelfTest::GetTime();
+			ParticleEmitter::PackEmitters(draws, pInstances, k==0);
+			double packed = SelfTest::GetTime();
+			if(f>=warmup)
+			{
+				simulateTime[k] += simulated-start;
+				packTime[k] += packed-simulated;
+				particles = total;
+			}
+		}
+
+	Log::Print("ParticleUpdate: %d particles, %d threads: simulate %.2fms pool, %.2fms serial, pack %.2fms pool, %.2fms serial",
+		particles, g_ThreadPool.GetNumThreads()+1, simulateTime[0]/frames, simulateTime[1]/frames, packTime[0]/frames, packTime[1]/frames);
+
+	delete[] pInstances;
+	ReleaseTestEmitters(parallel);
+	ReleaseTestEmitters(serial);
+}
+
+#endif
@@ -0,0 +1,463 @@
+//--------------------------------------------------------------------------------------
+// File: ResidencyTests.cpp
+//
+// Self tests and benchmark for the device memory budget, run against a stub device
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Residency.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+// Resources at the start of a row that are never used
+#define RESIDENCY_TEST_PINNED	4
+
+// Resources the camera sees on each side of it
+#define RESIDENCY_TEST_WINDOW	16
+
+
+//--------------------------------------------------------------------------------------
+// A resource that only exists on the stub device
+//--------------------------------------------------------------------------------------
+class ResidencyTestResource : public EngineResource
+{
+public:
+	UINT	FullBytes;
+	int		NumMips;
+	int		Dropped;		// Levels the stub has dropped
+	bool	bOnDevice;
+	int		Streaming;		// Frames until its restream is done, 0 if none
+	DWORD	LastTouched;	// Frame the test last used it, 0 if never
+
+	ResidencyTestResource(){ FullBytes = 1024*1024; NumMips = 1; Dropped = 0; bOnDevice = true; Streaming = 0; LastTouched = 0; }
+	void Release(){}
+	int GetResidencyGroup(){ return RESIDENCY_TEXTURE; }
+	inline UINT GetBytes(){ return bOnDevice ? max(FullBytes>>(2*Dropped), 16u) : 0; }
+};
+
+
+//--------------------------------------------------------------------------------------
+// Keeps the test resources in memory and checks what the policy asks of it
+//--------------------------------------------------------------------------------------
+class ResidencyTestDevice : public ResidencyDevice
+{
+public:
+	UINT	State;
+	DWORD	Frame;			// The manager's frame
+	DWORD	NewestEvicted;	// Last use of the most recently used eviction this frame
+	int		Evictions, Restreams;
+
+	ResidencyTestDevice(){ State = 1; Frame = 0; NewestEvicted = 0; Evictions = Restreams = 0; }
+
+	UINT GetBytes(EngineResource* pResource){ return ((ResidencyTestResource*)pResource)->GetBytes(); }
+	int GetNumMips(EngineResource* pResource){ ResidencyTestResource* p = (ResidencyTestResource*)pResource; return p->NumMips-p->Dropped; }
+	bool IsStreaming(EngineResource* pResource){ return ((ResidencyTestResource*)pResource)->Streaming>0; }
+
+	UINT DropMips(EngineResource* pResource, int levels)
+	{
+		ResidencyTestResource* p = (ResidencyTestResource*)pResource;
+		if(!TEST_CHECK(p->bOnDevice && !p->Streaming && p->NumMips-p->Dropped-levels>=RESIDENCY_MIN_MIPS))
+			return p->GetBytes();
+		p->Dropped += levels;
+		return p->GetBytes();
+	}
+
+	// Only what was used, and not within the grace frames, may go
+	bool Evict(EngineResource* pResource)
+	{
+		ResidencyTestResource* p = (ResidencyTestResource*)pResource;
+		TEST_CHECK(p->LastTouched && p->LastTouched+RESIDENCY_GRACE_FRAMES<Frame);
+		TEST_CHECK(p->bOnDevice && !p->Streaming);
+		NewestEvicted = max(NewestEvicted, p->LastTouched);
+		p->bOnDevice = false;
+		p->m_bResident = false;
+		p->Dropped = 0;
+		Evictions++;
+		return true;
+	}
+
+	// A refresh is only for a resource that is still up
+	void Restream(EngineResource* pResource, const char* szFile, float priority, bool bRefresh)
+	{
+		ResidencyTestResource* p = (ResidencyTestResource*)pResource;
+		TEST_CHECK(!p->Streaming && bRefresh==p->bOnDevice);
+		p->Streaming = 1 + TestRand(State)%3;
+		Restreams++;
+	}
+
+	// Finishes restreams that are due
+	void Tick(ResidencyTestResource* pResources, int num)
+	{
+		for(int i=0; i<num; i++)
+		{
+			ResidencyTestResource& r = pResources[i];
+			if(r.Streaming && --r.Streaming==0)
+			{
+				r.bOnDevice = true;
+				r.m_bResident = true;
+				r.Dropped = 0;
+			}
+		}
+	}
+};
+
+
+//--------------------------------------------------------------------------------------
+// A row of stub resources for a camera to walk along, the first few are never used
+//--------------------------------------------------------------------------------------
+struct ResidencyRow
+{
+	ResidencyTestDevice		Device;
+	ResidencyManager		Manager;
+	ResidencyTestResource*	pResources;
+	int						NumResources;
+	UINT					Pinned;		// Bytes that are never used
+	UINT					Widest;		// Most bytes in view and the grace frames behind it
+	UINT					All;		// Bytes of the row
+};
+
+
+//--------------------------------------------------------------------------------------
+// Tracks a row that was all seen a while ago, as a level would be while it loads, and
+// sets a budget that holds what is in view but not the whole row
+//--------------------------------------------------------------------------------------
+static void CreateRow(ResidencyRow& row, int numResources, UINT seed)
+{
+	row.Device.State = seed*7919+1;
+	row.NumResources = numResources;
+	row.pResources = new ResidencyTestResource[numResources];
+	for(int i=0; i<numResources; i++)
+	{
+		ResidencyTestResource& r = row.pResources[i];
+		r.NumMips = 6 + TestRand(row.Device.State)%5;
+		r.FullBytes = (64 + TestRand(row.Device.State)%960)*1024;
+	}
+
+	row.Pinned = row.Widest = row.All = 0;
+	for(int i=0; i<RESIDENCY_TEST_PINNED; i++)
+		row.Pinned += row.pResources[i].FullBytes;
+	for(int i=RESIDENCY_TEST_PINNED; i<numResources; i++)
+	{
+		row.All += row.pResources[i].FullBytes;
+		UINT span = 0;
+		for(int j=i; j<min(i+RESIDENCY_TEST_WINDOW+RESIDENCY_GRACE_FRAMES+2, numResources); j++)
+			span += row.pResources[j].FullBytes;
+		row.Widest = max(row.Widest, span);
+	}
+
+	char szFile[MAX_PATH];
+	row.Manager.SetDevice(&row.Device);
+	row.Manager.SetBudget(0xffffffff);
+	for(int i=0; i<numResources; i++)
+	{
+		sprintf(szFile, "Residency%05d.dds", i);
+		row.Manager.Track(&row.pResources[i], szFile);
+	}
+	for(int i=RESIDENCY_TEST_PINNED; i<numResources; i++)
+	{
+		row.Manager.Touch(&row.pResources[i]);
+		row.pResources[i].LastTouched = row.Manager.GetFrame();
+	}
+	for(int i=0; i<=RESIDENCY_GRACE_FRAMES; i++)
+		row.Manager.Update();
+	row.Manager.SetBudget(row.Pinned + row.Widest);
+}
+
+static void ReleaseRow(ResidencyRow& row)
+{
+	row.Manager.Release();
+	delete[] row.pResources;
+}
+
+
+//--------------------------------------------------------------------------------------
+// One frame: restreams land, the camera uses what is around it nearest first, and the
+// manager fits the budget.  Returns false if something in view was left evicted.
+//--------------------------------------------------------------------------------------
+static bool LookAt(ResidencyRow& row, int camera)
+{
+	bool bStreamed = true;
+	row.Device.Tick(row.pResources, row.NumResources);
+	row.Device.Frame = row.Manager.GetFrame();
+	row.Device.NewestEvicted = 0;
+	for(int i=max(camera-RESIDENCY_TEST_WINDOW/2, RESIDENCY_TEST_PINNED); i<min(camera+RESIDENCY_TEST_WINDOW/2, row.NumResources); i++)
+	{
+		ResidencyTestResource& r = row.pResources[i];
+		row.Manager.Touch(&r, (float)abs(i-camera));
+		r.LastTouched = row.Manager.GetFrame();
+		if(!r.bOnDevice && !r.Streaming)
+			bStreamed = false;
+	}
+	row.Manager.Update();
+	return bStreamed;
+}
+
+// Bytes in view of the camera
+static UINT GetViewBytes(ResidencyRow& row, int camera)
+{
+	UINT view = 0;
+	for(int i=max(camera-RESIDENCY_TEST_WINDOW/2, RESIDENCY_TEST_PINNED); i<min(camera+RESIDENCY_TEST_WINDOW/2, row.NumResources); i++)
+		view += row.pResources[i].FullBytes;
+	return view;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Resources that are never used stay put under any budget, the least recently used go
+// first, an evicted one streams back in when used, and untracking moves the last
+// entry into the gap
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResidencyEviction)
+{
+	ResidencyTestDevice device;
+	ResidencyTestResource pResources[4];
+	for(int i=0; i<4; i++)
+		pResources[i].FullBytes = (i+1)*1024*1024;
+
+	ResidencyManager manager;
+	manager.SetDevice(&device);
+	manager.Track(&pResources[0], "Pinned.dds");
+	manager.Track(&pResources[1], "Old.dds");
+	manager.Track(&pResources[2], "Newer.dds");
+	manager.Track(&pResources[3], "Newest.dds");
+	TEST_CHECK(manager.GetNumTracked()==4 && pResources[3].m_ResidencySlot==3);
+	manager.Track(&pResources[3], "Newest.dds");
+	TEST_CHECK(manager.GetNumTracked()==4);
+
+	// Used on three different frames, then left alone past the grace frames
+	for(int i=1; i<4; i++)
+	{
+		manager.Touch(&pResources[i], 5.0f);
+		pResources[i].LastTouched = manager.GetFrame();
+		manager.Update();
+	}
+	for(int i=0; i<=RESIDENCY_GRACE_FRAMES; i++)
+		manager.Update();
+	device.Frame = manager.GetFrame();
+
+	// Room for all but the two oldest
+	UINT total = 10*1024*1024;
+	manager.SetBudget(total - 2*1024*1024);
+	manager.Update();
+	const ResidencyReport& report = manager.GetReport();
+	TEST_CHECK(!pResources[1].bOnDevice && pResources[2].bOnDevice && pResources[3].bOnDevice);
+	TEST_CHECK(report.Evictions==1 && report.NumEvicted==1 && report.TotalBytes==total-2*1024*1024);
+	TEST_CHECK(report.PinnedBytes==1024*1024 && report.GroupCount[RESIDENCY_TEXTURE]==4);
+
+	// Nothing but the pinned one fits, and it still stays
+	device.Frame = manager.GetFrame();
+	manager.SetBudget(0);
+	manager.Update();
+	TEST_CHECK(pResources[0].bOnDevice && !pResources[2].bOnDevice && !pResources[3].bOnDevice);
+	TEST_CHECK(manager.GetReport().NumEvicted==3 && manager.GetReport().TotalBytes==1024*1024);
+
+	// Used again, it is counted while on its way back
+	manager.SetBudget(0xffffffff);
+	manager.Touch(&pResources[2], 1.0f);
+	manager.Touch(&pResources[2], 3.0f);
+	TEST_CHECK(pResources[2].Streaming && device.Restreams==1);
+	TEST_CHECK(manager.GetEntry(2).Priority==1.0f);
+	manager.Update();
+	TEST_CHECK(manager.GetReport().Restreams==1 && manager.GetReport().TotalBytes==4*1024*1024);
+	while(pResources[2].Streaming)
+		device.Tick(pResources, 4);
+	manager.Update();
+	TEST_CHECK(manager.GetReport().NumEvicted==2 && manager.GetReport().Restreams==0);
+
+	// The last entry fills the gap
+	manager.Untrack(&pResources[1]);
+	TEST_CHECK(manager.GetNumTracked()==3 && pResources[1].m_ResidencySlot==-1);
+	TEST_CHECK(manager.GetEntry(1).pResource==&pResources[3] && pResources[3].m_ResidencySlot==1);
+	manager.Untrack(&pResources[1]);
+	TEST_CHECK(manager.GetNumTracked()==3);
+
+	manager.Release();
+	TEST_CHECK(manager.GetNumTracked()==0 && pResources[0].m_ResidencySlot==-1);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Walks a camera back and forth along a row with a budget that holds the resources in
+// view but not the whole row.  The total stays under budget, nothing in view is
+// evicted, evictions go least recently used first, evicted resources stream back when
+// used and the report agrees with the stub.
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResidencyMovingCamera)
+{
+	for(UINT seed=0; seed<3; seed++)
+	{
+		ResidencyRow row;
+		CreateRow(row, 200, seed);
+		ResidencyManager& manager = row.Manager;
+		ResidencyTestResource* pResources = row.pResources;
+		const int numResources = row.NumResources;
+
+		int frames = 0;
+		int camera = RESIDENCY_TEST_PINNED;
+		int direction = 1;
+		int passes = 0;
+		char szFile[MAX_PATH];
+		while(passes<4)
+		{
+			TEST_CHECK(LookAt(row, camera));
+			frames++;
+
+			// Least recently used went first
+			for(int i=RESIDENCY_TEST_PINNED; i<numResources; i++)
+			{
+				ResidencyTestResource& r = pResources[i];
+				if(r.bOnDevice && !r.Streaming && r.LastTouched+RESIDENCY_GRACE_FRAMES<row.Device.Frame)
+					TEST_CHECK(r.LastTouched>=row.Device.NewestEvicted);
+			}
+
+			// Budget, and the report agrees with the device
+			const ResidencyReport& report = manager.GetReport();
+			UINT total = 0, pinnedBytes = 0;
+			int numEvicted = 0;
+			for(int i=0; i<numResources; i++)
+			{
+				ResidencyTestResource& r = pResources[i];
+				UINT bytes = r.Streaming ? r.FullBytes : r.GetBytes();
+				total += bytes;
+				if(!r.LastTouched)
+					pinnedBytes += bytes;
+				if(!r.bOnDevice)
+					numEvicted++;
+			}
+			TEST_CHECK(report.TotalBytes==total && report.GroupBytes[RESIDENCY_TEXTURE]==total);
+			TEST_CHECK(report.PinnedBytes==pinnedBytes && report.NumEvicted==numEvicted);
+			TEST_CHECK(report.GroupCount[RESIDENCY_TEXTURE]==numResources);
+			TEST_CHECK(total<=manager.GetBudget());
+
+			// Swap-remove keeps the slots right
+			for(int i=0; i<manager.GetNumTracked(); i++)
+				if(!TEST_CHECK(manager.GetEntry(i).pResource->m_ResidencySlot==i))
+					break;
+
+			// Back and forth along the row
+			camera += direction;
+			if(camera>=numResources || camera<RESIDENCY_TEST_PINNED)
+			{
+				direction = -direction;
+				camera += 2*direction;
+				passes++;
+			}
+
+			// Now and then one goes away and comes back
+			if(frames%7==0)
+			{
+				int id = RESIDENCY_TEST_PINNED + TestRand(row.Device.State)%(numResources-RESIDENCY_TEST_PINNED);
+				if(pResources[id].bOnDevice && !pResources[id].Streaming && !pResources[id].Dropped)
+				{
+					manager.Untrack(&pResources[id]);
+					sprintf(szFile, "Residency%05d.dds", id);
+					manager.Track(&pResources[id], szFile);
+					manager.Touch(&pResources[id], 0.0f);
+					pResources[id].LastTouched = manager.GetFrame();
+				}
+			}
+		}
+		TEST_CHECK(row.Device.Evictions>0 && row.Device.Restreams>0);
+
+		// Never used, never evicted
+		for(int i=0; i<RESIDENCY_TEST_PINNED; i++)
+			TEST_CHECK(pResources[i].bOnDevice && !pResources[i].Dropped);
+		ReleaseRow(row);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// A still camera with an eighth of the room its view needs: textures give up levels,
+// farthest first and only for the first few frames.  As room comes back the levels
+// return without going over, and stay.
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResidencyMipBudget)
+{
+	ResidencyRow row;
+	CreateRow(row, 200, 5);
+	ResidencyManager& manager = row.Manager;
+	const int camera = row.NumResources/2;
+	for(int i=0; i<=RESIDENCY_GRACE_FRAMES+3; i++)
+		LookAt(row, camera);
+
+	UINT tight = row.Pinned + GetViewBytes(row, camera)/8;
+	manager.SetBudget(tight);
+	int dropFrames = 0;
+	for(int n=0; n<20; n++)
+	{
+		TEST_CHECK(LookAt(row, camera));
+		TEST_CHECK(manager.GetReport().TotalBytes<=tight);
+		if(manager.GetReport().MipDrops)
+			dropFrames++;
+	}
+	TEST_CHECK(manager.GetReport().NumReduced>0);
+	TEST_CHECK(dropFrames>0 && dropFrames<=RESIDENCY_GRACE_FRAMES+1);
+	for(int i=0; i<row.NumResources; i++)
+		TEST_CHECK(row.pResources[i].NumMips-row.pResources[i].Dropped>=RESIDENCY_MIN_MIPS);
+
+	// Farther ones gave up at least as much, unless they ran out of levels
+	for(int i=camera-RESIDENCY_TEST_WINDOW/2; i<camera+RESIDENCY_TEST_WINDOW/2; i++)
+	{
+		ResidencyTestResource& far = row.pResources[i];
+		for(int j=camera-RESIDENCY_TEST_WINDOW/2; j<camera+RESIDENCY_TEST_WINDOW/2; j++)
+			if(abs(i-camera)>abs(j-camera))
+				TEST_CHECK(far.Dropped>=row.pResources[j].Dropped || far.NumMips-far.Dropped==RESIDENCY_MIN_MIPS);
+	}
+
+	// Some room back, only the levels that fit under the restore part return so none
+	// have to be dropped again
+	UINT some = tight*3/2;
+	manager.SetBudget(some);
+	for(int n=0; n<20; n++)
+	{
+		LookAt(row, camera);
+		TEST_CHECK(manager.GetReport().TotalBytes<=some && manager.GetReport().MipDrops==0);
+	}
+	TEST_CHECK(manager.GetReport().NumReduced>0);
+
+	// The view has to fit under the restore part of the budget
+	manager.SetBudget((row.Pinned + row.Widest)*5/4);
+	for(int n=0; n<20; n++)
+	{
+		LookAt(row, camera);
+		TEST_CHECK(manager.GetReport().MipDrops==0);
+	}
+	TEST_CHECK(manager.GetReport().NumReduced==0);
+
+	for(int i=0; i<RESIDENCY_TEST_PINNED; i++)
+		TEST_CHECK(row.pResources[i].bOnDevice && !row.pResources[i].Dropped);
+	ReleaseRow(row);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Time for an Update over a large row as the camera walks it, and what it moved
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(Residency)
+{
+	ResidencyRow row;
+	CreateRow(row, 5000, 1);
+	const int frames = 2000;
+	double worst = 0, start = SelfTest::GetTime();
+	for(int n=0; n<frames; n++)
+	{
+		double t = SelfTest::GetTime();
+		LookAt(row, RESIDENCY_TEST_PINNED + n*(row.NumResources-RESIDENCY_TEST_PINNED)/frames);
+		worst = max(worst, SelfTest::GetTime()-t);
+	}
+	double total = SelfTest::GetTime()-start;
+	Log::Print("Residency: 5000 resources, %.1f MB row in %.1f MB, %.3fms a frame (worst %.3fms), %d evictions %d restreams",
+		row.All/(1024.0f*1024.0f), (row.Pinned+row.Widest)/(1024.0f*1024.0f), total/frames, worst,
+		row.Device.Evictions, row.Device.Restreams);
+	ReleaseRow(row);
+}
+
+#endif
@@ -0,0 +1,331 @@
+//--------------------------------------------------------------------------------------
+// File: ResourceIndexTests.cpp
+//
+// Self tests for the resource name index and a benchmark of the resource manager
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "ResourceIndex.h"
+#include "ResourceManager.cpp"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// A test key, the case and slashes vary with style so the same path is spelled
+// several ways
+static void ResourceTestKey(char* szKey, int id, UINT style)
+{
+	sprintf(szKey, (style&1) ? "Textures/Level%d/Tex%05d.dds" : "textures\\level%d\\tex%05d.DDS", id%17, id);
+}
+
+// The next key after *pId whose home bucket in the smallest table is the given one
+static void ResourceKeyInBucket(char* szKey, int* pId, DWORD bucket)
+{
+	do
+		sprintf(szKey, "key%d", (*pId)++);
+	while((ResourceIndex::HashKey(szKey)&63)!=bucket);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Paths match and hash the same whatever their case and slashes, and nothing else does
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResourceIndexKeys)
+{
+	TEST_CHECK(ResourceIndex::KeysMatch("Models/Tree.X", "models\\tree.x"));
+	TEST_CHECK(ResourceIndex::HashKey("Models/Tree.X")==ResourceIndex::HashKey("models\\tree.x"));
+	TEST_CHECK(!ResourceIndex::KeysMatch("models\\tree", "models\\tree.x"));
+	TEST_CHECK(!ResourceIndex::KeysMatch("models\\tree.x", "models\\tree"));
+	TEST_CHECK(!ResourceIndex::KeysMatch("models\\tree.x", "models\\tree.y"));
+	TEST_CHECK(ResourceIndex::KeysMatch("", ""));
+
+	// FNV-1a
+	TEST_CHECK(ResourceIndex::HashKey("")==2166136261u);
+	TEST_CHECK(ResourceIndex::HashKey("a")==0xe40c292cu);
+	TEST_CHECK(ResourceIndex::HashKey("A")==0xe40c292cu);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A key is found by any spelling, and once it is removed its handle goes stale, even
+// after a new key takes its slot
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResourceIndexHandles)
+{
+	ResourceIndex index;
+	TEST_CHECK(index.Find("textures\\grass.dds").IsNull());
+	TEST_CHECK(index.Insert(NULL).IsNull() && index.Find(NULL).IsNull());
+
+	ResourceHandle grass = index.Insert("Textures/Grass.dds");
+	ResourceHandle rock = index.Insert("textures\\rock.dds");
+	TEST_CHECK(!grass.IsNull() && !rock.IsNull() && grass!=rock);
+	TEST_CHECK(index.Find("textures\\GRASS.DDS")==grass && index.Find("TEXTURES/rock.dds")==rock);
+	TEST_CHECK(strcmp(index.GetKey(grass), "Textures/Grass.dds")==0);
+	TEST_CHECK(index.GetCount()==2);
+
+	TEST_CHECK(index.Remove(grass));
+	TEST_CHECK(!index.Remove(grass));
+	TEST_CHECK(!index.IsValid(grass) && index.IsValid(rock));
+	TEST_CHECK(index.Find("textures\\grass.dds").IsNull());
+	TEST_CHECK(index.GetCount()==1);
+
+	// The freed slot is reused under a new generation
+	ResourceHandle sand = index.Insert("textures\\sand.dds");
+	TEST_CHECK(sand.Index==grass.Index && sand.Generation!=grass.Generation);
+	TEST_CHECK(!index.IsValid(grass) && index.IsValid(sand));
+	TEST_CHECK(index.Find("textures\\sand.dds")==sand && index.Find("textures\\rock.dds")==rock);
+
+	// A handle past the slots is never valid
+	ResourceHandle past;
+	past.Index = 100;
+	past.Generation = 1;
+	TEST_CHECK(!index.IsValid(past) && !index.Remove(past));
+	index.Release();
+	TEST_CHECK(index.GetCount()==0 && index.GetFirst().IsNull() && index.Find("textures\\rock.dds").IsNull());
+}
+
+
+//--------------------------------------------------------------------------------------
+// Runs of keys that wrap around the end of the table, removing from the front, the
+// middle and the end of the run shifts the rest back so they are all still found
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResourceIndexWrappedRuns)
+{
+	// Homes 62, 63, 63, 63, 0, 0, 1 fill buckets 62 to 4
+	const DWORD homes[] = { 62, 63, 63, 63, 0, 0, 1 };
+	const int numKeys = 7;
+	char szKeys[numKeys][32];
+	int id = 0;
+	for(int k=0; k<numKeys; k++)
+		ResourceKeyInBucket(szKeys[k], &id, homes[k]);
+
+	// Every order of removing three of them
+	int errors = 0;
+	for(int a=0; a<numKeys; a++)
+	for(int b=0; b<numKeys; b++)
+	for(int c=0; c<numKeys; c++)
+	{
+		if(a==b || a==c || b==c)
+			continue;
+		ResourceIndex index;
+		ResourceHandle handles[numKeys];
+		for(int k=0; k<numKeys; k++)
+			handles[k] = index.Insert(szKeys[k]);
+		index.Remove(handles[a]);
+		index.Remove(handles[b]);
+		index.Remove(handles[c]);
+		for(int k=0; k<numKeys; k++)
+		{
+			bool bRemoved = k==a || k==b || k==c;
+			ResourceHandle found = index.Find(szKeys[k]);
+			if(bRemoved ? !found.IsNull() : found!=handles[k])
+				errors++;
+		}
+		index.Release();
+	}
+	TEST_CHECK(errors==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Random adds, finds and removes against a plain list, with stale handles checked and
+// the walk newest first like the linked list the managers used to keep.  Few keys keep
+// the table small so runs wrap around its end, more make it grow.
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResourceIndexMatchesList)
+{
+	const int sizes[][2] = { { 20, 20000 }, { 60, 50000 }, { 3000, 100000 } };
+	for(int test=0; test<3; test++)
+	{
+		int numKeys = sizes[test][0], numOps = sizes[test][1];
+		UINT state = test*7919+1;
+		ResourceIndex index;
+		ResourceHandle* pHandles = new ResourceHandle[numKeys];
+		ResourceHandle* pStale = new ResourceHandle[numKeys];
+		for(int i=0; i<numKeys; i++)
+			pHandles[i].Index = pHandles[i].Generation = pStale[i].Index = pStale[i].Generation = 0;
+		Array<DWORD> order;				// Ids in the index, oldest first
+		char szKey[MAX_PATH];
+		int wrongSlot = 0, staleValid = 0;
+
+		for(int op=0; op<numOps; op++)
+		{
+			int id = TestRand(state)%numKeys;
+			ResourceTestKey(szKey, id, TestRand(state));
+			if(index.Find(szKey)!=pHandles[id])
+				wrongSlot++;
+			if(!pStale[id].IsNull() && index.IsValid(pStale[id]) && pStale[id]!=pHandles[id])
+				staleValid++;
+
+			if(pHandles[id].IsNull())
+			{
+				// Keys are added with one spelling and found with others
+				pHandles[id] = index.Insert(szKey);
+				order.Add(id);
+			}
+			else if(TestRand(state)%3==0)
+			{
+				index.Remove(pHandles[id]);
+				pStale[id] = pHandles[id];
+				pHandles[id].Index = pHandles[id].Generation = 0;
+				for(int i=0; i<order.Size(); i++)
+					if(order[i]==(DWORD)id)
+					{
+						order.Remove(i);
+						break;
+					}
+			}
+		}
+		if(!TEST_CHECK(wrongSlot==0 && staleValid==0))
+			Log::Print("ResourceIndexMatchesList: %d keys, %d wrong slots, %d stale handles valid", numKeys, wrongSlot, staleValid);
+
+		// Newest first, with every key as it was added
+		TEST_CHECK(index.GetCount()==order.Size());
+		int n = order.Size()-1;
+		bool bOrdered = true;
+		for(ResourceHandle h=index.GetFirst(); !h.IsNull() && bOrdered; h=index.GetNext(h), n--)
+		{
+			if(n<0 || h!=pHandles[order[n]])
+				bOrdered = false;
+			else
+			{
+				ResourceTestKey(szKey, order[n], 0);
+				bOrdered = ResourceIndex::KeysMatch(index.GetKey(h), szKey);
+			}
+		}
+		TEST_CHECK(bOrdered && n==-1);
+
+		index.Release();
+		order.Release();
+		delete[] pHandles;
+		delete[] pStale;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Removing most of the keys compacts the pool, and the rest keep their names
+//--------------------------------------------------------------------------------------
+SELF_TEST(ResourceIndexCompactsKeys)
+{
+	const int numKeys = 2000;
+	ResourceIndex index;
+	ResourceHandle* pHandles = new ResourceHandle[numKeys];
+	char szKey[MAX_PATH];
+	for(int i=0; i<numKeys; i++)
+	{
+		ResourceTestKey(szKey, i, i);
+		pHandles[i] = index.Insert(szKey);
+	}
+	UINT fullSize = index.GetMemoryUsage();
+	for(int i=0; i<numKeys; i++)
+		if(i%10)
+			index.Remove(pHandles[i]);
+	TEST_CHECK(index.GetCount()==numKeys/10);
+
+	// The slots and table stay and the free list grows, but the pool shrinks by more
+	TEST_CHECK(index.GetMemoryUsage() < fullSize);
+
+	int wrong = 0;
+	for(int i=0; i<numKeys; i+=10)
+	{
+		ResourceTestKey(szKey, i, i);
+		if(strcmp(index.GetKey(pHandles[i]), szKey)!=0 || index.Find(szKey)!=pHandles[i])
+			wrong++;
+	}
+	TEST_CHECK(wrong==0);
+	index.Release();
+	delete[] pHandles;
+}
+
+
+//--------------------------------------------------------------------------------------
+// A resource that loads without touching a file
+//--------------------------------------------------------------------------------------
+class TestResource : public EngineResource
+{
+public:
+	bool Load(const char* file){ m_szName = file; return true; }
+	void Release(){}
+};
+
+
+//--------------------------------------------------------------------------------------
+// Loads, finds and frees stand-in resources through a ResourceManager, and times the
+// name search it used to do for part of them to compare
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(ResourceManager)
+{
+	const int numResources = 100000;
+	ResourceManager<TestResource> manager;
+	char szKey[MAX_PATH];
+
+	// Every resource loaded once and then found three more times, like textures
+	// shared between the materials of a level
+	double start = SelfTest::GetTime();
+	for(int pass=0; pass<4; pass++)
+		for(int i=0; i<numResources; i++)
+		{
+			ResourceTestKey(szKey, i, pass);
+			manager.Load(szKey);
+		}
+	double loadTime = SelfTest::GetTime()-start;
+
+	// Handles to resources that were freed
+	ResourceHandle handle = manager.GetFirst();
+	TestResource* pFirst = manager.Get(handle);
+	for(int pass=0; pass<4; pass++)
+		manager.Deref(pFirst);
+	int staleHits = manager.Get(handle) ? 1 : 0;
+
+	start = SelfTest::GetTime();
+	for(ResourceHandle h=manager.GetFirst(); !h.IsNull(); )
+	{
+		TestResource* pObj = manager.Get(h);
+		h = manager.GetNext(h);
+		for(int pass=0; pass<4; pass++)
+			manager.Deref(pObj);
+	}
+	double freeTime = SelfTest::GetTime()-start;
+
+	// The strcmp walk Get used to do over a list of the names, newest first, on as
+	// many of them as finishes in reasonable time
+	const int numRef = 10000;
+	Array<String*> names;
+	for(int i=0; i<numRef; i++)
+	{
+		ResourceTestKey(szKey, i, 0);
+		names.Add(new String(szKey));
+	}
+	int found = 0;
+	start = SelfTest::GetTime();
+	for(int i=0; i<numRef; i++)
+	{
+		ResourceTestKey(szKey, i, 0);
+		for(int j=numRef-1; j>=0; j--)
+			if(strcmp(names[j]->c_str(), szKey)==0)
+			{
+				found++;
+				break;
+			}
+	}
+	double refTime = SelfTest::GetTime()-start;
+	for(int i=0; i<numRef; i++)
+		delete names[i];
+	names.Release();
+
+	Log::Print("ResourceManager: %d resources: %.3fus a load or find, %.3fus a deref, %d stale hits, "
+		"%.3fus a find by name search over %d (%d found)",
+		numResources, loadTime*1000.0/(numResources*4), freeTime*1000.0/(numResources*4), staleHits,
+		refTime*1000.0/numRef, numRef, found);
+	manager.Release();
+}
+
+#endif
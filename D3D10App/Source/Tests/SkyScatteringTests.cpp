@@ -0,0 +1,330 @@
+//--------------------------------------------------------------------------------------
+// File: SkyScatteringTests.cpp
+//
+// Self tests and benchmark for the CPU sky scattering baker, and the GPU pass
+// checked against it
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "SkyScattering.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include "Renderer.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Overhead, morning, low, setting and under the horizon
+static const D3DXVECTOR3 g_TestSuns[] = {
+	D3DXVECTOR3(0, 1, 0),
+	D3DXVECTOR3(0.5f, 0.7f, 0.3f),
+	D3DXVECTOR3(-0.9f, 0.15f, 0.2f),
+	D3DXVECTOR3(0.1f, 0.01f, -0.99f),
+	D3DXVECTOR3(0.3f, -0.2f, 0.9f),
+};
+static const int g_NumTestSuns = sizeof(g_TestSuns)/sizeof(D3DXVECTOR3);
+
+// Relative difference of the color channels, with a floor under the darkest texels
+// where half floats lose bits
+static float TexelError(const float* pTexel, const D3DXVECTOR3& ref)
+{
+	float e = 0;
+	for(int k=0; k<3; k++)
+	{
+		float r = ((const float*)&ref)[k];
+		e = max(e, fabsf(pTexel[k] - r) / max(fabsf(r), 1e-4f));
+	}
+	return e;
+}
+
+// Sun at an elevation and heading in degrees, the way the sky places it
+static D3DXVECTOR3 SunAt(float elevation, float heading)
+{
+	float e = D3DXToRadian(elevation), h = D3DXToRadian(heading);
+	return D3DXVECTOR3(sinf(h)*cosf(e), sinf(e), cosf(h)*cosf(e));
+}
+
+static const char* g_szSkyCacheTest = "SkyScatteringTest.tmp";
+
+
+//--------------------------------------------------------------------------------------
+// The constants follow the table sizes, and the sky is blue with the sun overhead and
+// redder as it sets
+//--------------------------------------------------------------------------------------
+SELF_TEST(SkyScatteringTexel)
+{
+	ScbConstant c;
+	SetScatteringConstants(c, 128, 256);
+	TEST_CHECK_NEAR(c.InvRayleighMieN.x, 1.0f/128, 1e-7f);
+	TEST_CHECK_NEAR(c.InvRayleighMieN.y, 1.0f/64, 1e-7f);
+	TEST_CHECK_NEAR(c.InvOpticalDepthN, 1.0f/256, 1e-7f);
+	TEST_CHECK(c.OuterRadius > c.InnerRadius && c.InvWavelength4.z > c.InvWavelength4.x);
+
+	// Rows are the same, the shader only reads the column
+	D3DXVECTOR3 r0, m0, r1, m1;
+	D3DXVECTOR3 sun(0.5f, 0.7f, 0.3f);
+	D3DXVec3Normalize(&sun, &sun);
+	ScatteringBaker::ComputeTexel(c, sun, 40, 0, r0, m0);
+	ScatteringBaker::ComputeTexel(c, sun, 40, 63, r1, m1);
+	TEST_CHECK(r0==r1 && m0==m1);
+	TEST_CHECK(r0.x>0 && r0.y>0 && r0.z>0 && m0.x>0);
+
+	// Blue scatters more than red with the sun overhead, and the low sun's light has
+	// lost more of its blue than its red on the way through
+	D3DXVECTOR3 high, low, mie;
+	ScatteringBaker::ComputeTexel(c, D3DXVECTOR3(0, 1, 0), 64, 0, high, mie);
+	TEST_CHECK(high.z > high.x);
+	D3DXVECTOR3 lowSun(0, 0.02f, 0.9998f);
+	ScatteringBaker::ComputeTexel(c, lowSun, 64, 0, low, mie);
+	TEST_CHECK(low.z/low.x < high.z/high.x);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The SSE bake on the thread pool matches ComputeTexel in every column for each of the
+// test suns, within the half float rounding of the tables, with a width that isn't a
+// multiple of the four texels the SSE path works on.  The rows are copies of the first.
+//--------------------------------------------------------------------------------------
+SELF_TEST(SkyScatteringBakeMatchesTexel)
+{
+	const UINT sizes[2] = { 128, 70 };
+	for(int s=0; s<2; s++)
+	{
+		ScbConstant c;
+		SetScatteringConstants(c, sizes[s], 256);
+		UINT width = sizes[s], height = sizes[s]/2;
+		ScatteringBaker baker;
+		float* pTexels[SKY_TABLE_COUNT];
+		for(int t=0; t<SKY_TABLE_COUNT; t++)
+			pTexels[t] = new float[width*height*4];
+		int errors = 0;
+		float maxError = 0;
+		for(int i=0; i<g_NumTestSuns; i++)
+		{
+			D3DXVECTOR3 sun;
+			D3DXVec3Normalize(&sun, &g_TestSuns[i]);
+			baker.Bake(c, sun, width, height);
+			if(!TEST_CHECK(baker.IsBaked() && baker.GetWidth()==width && baker.GetHeight()==height))
+				break;
+			for(int t=0; t<SKY_TABLE_COUNT; t++)
+			{
+				D3DXFloat16To32Array(pTexels[t], baker.GetTable(t), width*height*4);
+				for(UINT y=1; y<height; y++)
+					if(memcmp(pTexels[t], pTexels[t]+y*width*4, width*4*sizeof(float)))
+						errors++;
+			}
+
+			for(UINT x=0; x<width; x++)
+			{
+				UINT y = (x*7+i) % height;
+				D3DXVECTOR3 ref[SKY_TABLE_COUNT];
+				ScatteringBaker::ComputeTexel(c, sun, x, y, ref[SKY_TABLE_RAYLEIGH], ref[SKY_TABLE_MIE]);
+				for(int t=0; t<SKY_TABLE_COUNT; t++)
+				{
+					const float* pTexel = pTexels[t] + (y*width+x)*4;
+					float e = TexelError(pTexel, ref[t]);
+					maxError = max(maxError, e);
+					if(e > 0.005f || pTexel[3] != 1.0f)
+						errors++;
+				}
+			}
+		}
+		if(!TEST_CHECK(errors==0))
+			Log::Print("SkyScatteringBakeMatchesTexel: %dx%d max relative error %.6f", width, height, maxError);
+		for(int t=0; t<SKY_TABLE_COUNT; t++)
+			delete[] pTexels[t];
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cache keys round the sun to the nearest step, every step's sun has its own key, and
+// the heading wraps around and is ignored straight overhead
+//--------------------------------------------------------------------------------------
+SELF_TEST(SkyScatteringCacheKey)
+{
+	const int stepsUp = (int)(90.0f/SKY_CACHE_SUN_STEP + 0.5f), stepsAround = (int)(360.0f/SKY_CACHE_SUN_STEP + 0.5f);
+	UINT state = 5;
+	int wrongKeys = 0, farSuns = 0;
+	for(int i=0; i<2000; i++)
+	{
+		int elevation = (int)(TestRand(state)%(2*stepsUp-1)) - (stepsUp-1);
+		int heading = TestRand(state)%stepsAround;
+		int e, h;
+		ScatteringBaker::GetCacheKey(ScatteringBaker::GetCacheSun(elevation, heading), e, h);
+		wrongKeys += (e!=elevation || h!=heading) ? 1 : 0;
+
+		// A sun rounds to a step at most half a step away each way
+		D3DXVECTOR3 sun = SunAt(TestRandFloat(state, -89.0f, 89.0f), TestRandFloat(state, 0, 360.0f));
+		D3DXVECTOR3 cached = ScatteringBaker::GetCacheSun(sun);
+		float angle = D3DXToDegree(acosf(min(1.0f, D3DXVec3Dot(&sun, &cached))));
+		farSuns += angle > SKY_CACHE_SUN_STEP*0.71f+0.01f ? 1 : 0;
+	}
+	TEST_CHECK(wrongKeys==0);
+	TEST_CHECK(farSuns==0);
+
+	int e, h;
+	ScatteringBaker::GetCacheKey(D3DXVECTOR3(0, 2, 0), e, h);
+	TEST_CHECK(e==stepsUp && h==0);
+	ScatteringBaker::GetCacheKey(SunAt(-90.0f, 123.0f), e, h);
+	TEST_CHECK(e==-stepsUp && h==0);
+	ScatteringBaker::GetCacheKey(SunAt(10.0f, 360.0f-SKY_CACHE_SUN_STEP*0.2f), e, h);
+	TEST_CHECK(e==(int)(10.0f/SKY_CACHE_SUN_STEP) && h==0);
+	ScatteringBaker::GetCacheKey(SunAt(10.0f, -90.0f), e, h);
+	TEST_CHECK(h==stepsAround*3/4);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A saved bake loads back for any sun in its step, and a different size, different
+// constants, another step or a damaged file makes the caller bake instead
+//--------------------------------------------------------------------------------------
+SELF_TEST(SkyScatteringCache)
+{
+	const UINT width = 70, height = 35;
+	ScbConstant c;
+	SetScatteringConstants(c, width, 256);
+	const float elevation = 20*SKY_CACHE_SUN_STEP, heading = 300*SKY_CACHE_SUN_STEP;
+	ScatteringBaker baked, loaded;
+	baked.Bake(c, SunAt(elevation, heading), width, height);
+	remove(g_szSkyCacheTest);
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation, heading), width, height));
+	if(!TEST_CHECK(baked.Save(g_szSkyCacheTest)))
+		return;
+
+	// Anywhere in the step
+	const float offsets[][2] = { {0, 0}, {0.4f, 0.4f}, {-0.4f, 0.3f}, {0.3f, -0.45f} };
+	for(int i=0; i<sizeof(offsets)/sizeof(offsets[0]); i++)
+	{
+		D3DXVECTOR3 sun = SunAt(elevation + offsets[i][0]*SKY_CACHE_SUN_STEP, heading + offsets[i][1]*SKY_CACHE_SUN_STEP);
+		if(!TEST_CHECK(loaded.Load(g_szSkyCacheTest, c, sun, width, height)))
+			continue;
+		TEST_CHECK(loaded.GetWidth()==width && loaded.GetHeight()==height);
+		for(int t=0; t<SKY_TABLE_COUNT; t++)
+			TEST_CHECK(memcmp(loaded.GetTable(t), baked.GetTable(t), width*height*4*sizeof(D3DXFLOAT16))==0);
+	}
+
+	// Next steps over, another size or other constants
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation + SKY_CACHE_SUN_STEP, heading), width, height));
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation, heading - SKY_CACHE_SUN_STEP), width, height));
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation, heading), width+2, height));
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation, heading), width, height-1));
+	ScbConstant other = c;
+	other.KrESun *= 1.01f;
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, other, SunAt(elevation, heading), width, height));
+	other = c;
+	other.iNumSamples++;
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, other, SunAt(elevation, heading), width, height));
+
+	// Another version, and cut short
+	FILE* fp = fopen(g_szSkyCacheTest, "r+b");
+	if(fp)
+	{
+		DWORD version = SKY_CACHE_VERSION+1;
+		fseek(fp, 4, SEEK_SET);
+		fwrite(&version, 4, 1, fp);
+		fclose(fp);
+	}
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation, heading), width, height));
+	baked.Save(g_szSkyCacheTest);
+	const UINT bytes = sizeof(SkyCacheHeader) + width*height*4*sizeof(D3DXFLOAT16)*SKY_TABLE_COUNT;
+	BYTE* pData = new BYTE[bytes];
+	size_t read = 0;
+	fp = fopen(g_szSkyCacheTest, "rb");
+	if(fp)
+	{
+		read = fread(pData, 1, bytes, fp);
+		fclose(fp);
+	}
+	TEST_CHECK(read==bytes);
+	fp = fopen(g_szSkyCacheTest, "wb");
+	if(fp)
+	{
+		fwrite(pData, bytes-2, 1, fp);
+		fclose(fp);
+	}
+	delete[] pData;
+	TEST_CHECK(!loaded.Load(g_szSkyCacheTest, c, SunAt(elevation, heading), width, height) && !loaded.IsBaked());
+	remove(g_szSkyCacheTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The GPU pass matches a CPU bake of the sky's own constants and sun.  The GPU's exp
+// is an approximation, so this is looser than the baker's own check.
+//--------------------------------------------------------------------------------------
+SELF_DEVICE_TEST(SkyScatteringMatchesGPU)
+{
+	Renderer* pRenderer = (Renderer*)pContext;
+	Sky& sky = pRenderer->GetSky();
+	pRenderer->SetTimeOfDay(16, 30, 0);
+	pRenderer->UpdateSky();
+
+	UINT width = sky.GetScatteringSize(), height = width/2;
+	ScatteringBaker baker;
+	baker.Bake(sky.GetScatteringConstants(), -sky.GetSunDirection(), width, height);
+
+	float* pGPU = new float[width*height*4];
+	float* pCPU = new float[width*height*4];
+	int errors = 0;
+	float maxError = 0;
+	for(int t=0; t<SKY_TABLE_COUNT; t++)
+	{
+		if(!TEST_CHECK(sky.ReadScattering(t, pGPU)))
+			break;
+		D3DXFloat16To32Array(pCPU, baker.GetTable(t), width*height*4);
+		for(UINT p=0; p<width*height; p++)
+		{
+			D3DXVECTOR3 ref(pCPU[p*4], pCPU[p*4+1], pCPU[p*4+2]);
+			float e = TexelError(pGPU+p*4, ref);
+			maxError = max(maxError, e);
+			if(e > 0.01f)
+				errors++;
+		}
+	}
+	if(!TEST_CHECK(errors==0))
+		Log::Print("SkyScatteringMatchesGPU: %dx%d max relative error %.6f", width, height, maxError);
+	delete[] pGPU;
+	delete[] pCPU;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times ComputeTexel over a whole table against the SSE bake on the thread pool
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(SkyScattering)
+{
+	const UINT width = 128, height = 64;
+	const int runs = 20;
+	ScbConstant c;
+	SetScatteringConstants(c, width, 256);
+	D3DXVECTOR3 sun(0.5f, 0.7f, 0.3f);
+	D3DXVec3Normalize(&sun, &sun);
+
+	// Every texel, as the pixel shader does it
+	float sum = 0;
+	double start = SelfTest::GetTime();
+	for(UINT y=0; y<height; y++)
+		for(UINT x=0; x<width; x++)
+		{
+			D3DXVECTOR3 rayleigh, mie;
+			ScatteringBaker::ComputeTexel(c, sun, x, y, rayleigh, mie);
+			sum += rayleigh.x + mie.x;
+		}
+	double scalarTime = SelfTest::GetTime()-start;
+
+	ScatteringBaker baker;
+	start = SelfTest::GetTime();
+	for(int i=0; i<runs; i++)
+		baker.Bake(c, sun, width, height);
+	double bakeTime = (SelfTest::GetTime()-start)/runs;
+
+	Log::Print("SkyScattering: %dx%d: scalar %.1fms, bake %.2fms (%f)", width, height, scalarTime, bakeTime, sum);
+}
+
+#endif
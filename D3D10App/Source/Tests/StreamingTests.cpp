@@ -0,0 +1,390 @@
+//--------------------------------------------------------------------------------------
+// File: StreamingTests.cpp
+//
+// Self tests and benchmark for background resource loading
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Streaming.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+//--------------------------------------------------------------------------------------
+// A resource that sleeps to decode, standing in for file reads.  A gated one holds its
+// loader until the gate opens.
+//--------------------------------------------------------------------------------------
+class StreamTestResource : public EngineResource
+{
+public:
+	int				DecodeMs;
+	UINT			Bytes;
+	bool			bFail;
+	volatile long*	pGate;			// Decode waits while it is zero
+	volatile long*	pCounter;		// Numbers the decodes in the order they start
+	long			DecodeOrder;
+	int				Uploads;
+	static volatile long NumAlive;
+
+	StreamTestResource(){ DecodeMs = 0; Bytes = 4096; bFail = false; pGate = pCounter = NULL; DecodeOrder = 0; Uploads = 0; InterlockedIncrement(&NumAlive); }
+	~StreamTestResource(){ InterlockedDecrement(&NumAlive); }
+	void Release(){}
+	bool StreamDecode(const char* file)
+	{
+		if(pCounter)
+			DecodeOrder = InterlockedIncrement(pCounter);
+		while(pGate && *pGate==0)
+			Sleep(1);
+		Sleep(DecodeMs);
+		return !bFail;
+	}
+	UINT GetStreamBytes(){ return Bytes; }
+	bool StreamUpload(const char* file){ Uploads++; return true; }
+};
+volatile long StreamTestResource::NumAlive = 0;
+
+// Waits up to ten seconds for the loaders to have this many requests
+static bool WaitForLoading(int loading, int queued)
+{
+	for(int i=0; i<10000; i++)
+	{
+		const StreamingStats& stats = g_Streamer.GetStats();
+		if(stats.Loading==loading && stats.QueueDepth==queued)
+			return true;
+		Sleep(1);
+	}
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Finishing a request on the main thread, one that fails to decode, a refresh that
+// keeps its resource resident, and calls on resources with no request
+//--------------------------------------------------------------------------------------
+SELF_TEST(StreamingFinish)
+{
+	StreamingStats start = g_Streamer.GetStats();
+	StreamTestResource* pRes = new StreamTestResource;
+	g_Streamer.Request(pRes, "Stream.dds", 10.0f);
+	StreamRequest* pRequest = pRes->m_pStream;
+	TEST_CHECK(pRequest && !pRes->IsResident());
+	g_Streamer.Request(pRes, "Other.dds", 5.0f);
+	TEST_CHECK(pRes->m_pStream==pRequest);
+
+	TEST_CHECK(g_Streamer.Finish(pRes));
+	TEST_CHECK(pRes->IsResident() && pRes->Uploads==1 && !pRes->m_pStream);
+	TEST_CHECK(g_Streamer.GetStats().Completed==start.Completed+1);
+
+	// Nothing to finish or cancel
+	TEST_CHECK(g_Streamer.Finish(pRes) && g_Streamer.Cancel(pRes));
+	TEST_CHECK(!g_Streamer.Finish(NULL) && g_Streamer.Cancel(NULL));
+
+	// A refresh leaves the old data in use until the new is up
+	g_Streamer.Request(pRes, "Stream.dds", 10.0f, true);
+	TEST_CHECK(pRes->m_pStream && pRes->IsResident());
+	TEST_CHECK(g_Streamer.Finish(pRes));
+	TEST_CHECK(pRes->Uploads==2 && !pRes->m_pStream);
+
+	// A failed decode is done, but keeps its placeholder
+	StreamTestResource* pBad = new StreamTestResource;
+	pBad->bFail = true;
+	g_Streamer.Request(pBad, "Missing.dds");
+	TEST_CHECK(g_Streamer.Finish(pBad));
+	TEST_CHECK(pBad->IsResident() && pBad->Uploads==0 && !pBad->m_pStream);
+	TEST_CHECK(g_Streamer.GetStats().Failed==start.Failed+1);
+
+	TEST_CHECK(g_Streamer.IsIdle() && g_Streamer.CheckQueue());
+	delete pRes;
+	delete pBad;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Gated resources hold both loaders so the rest stay queued.  The queue is reordered,
+// cancelled from and finished from, then one loader is let go and must decode what is
+// left nearest first.  Decoded resources go up nearest first within the budget, and a
+// resource cancelled while a loader has it is deleted by the streamer.
+//--------------------------------------------------------------------------------------
+SELF_TEST(StreamingQueueOrder)
+{
+	const int numResources = 200;
+	StreamingStats start = g_Streamer.GetStats();
+	long aliveBefore = StreamTestResource::NumAlive;
+	UINT oldBudget = g_Streamer.GetUploadBudget();
+	volatile long gates[STREAM_LOADER_THREADS] = { 0 };
+	volatile long counter = 0;
+
+	StreamTestResource* pGated[STREAM_LOADER_THREADS];
+	for(int i=0; i<STREAM_LOADER_THREADS; i++)
+	{
+		pGated[i] = new StreamTestResource;
+		pGated[i]->pGate = &gates[i];
+		g_Streamer.Request(pGated[i], "Gated.dds", 0.0f);
+	}
+	if(!TEST_CHECK(WaitForLoading(STREAM_LOADER_THREADS, 0)))
+	{
+		for(int i=0; i<STREAM_LOADER_THREADS; i++)
+			gates[i] = 1;
+		g_Streamer.Flush();
+		for(int i=0; i<STREAM_LOADER_THREADS; i++)
+			delete pGated[i];
+		return;
+	}
+
+	UINT state = 12345;
+	StreamTestResource** pResources = new StreamTestResource*[numResources];
+	float* pPriority = new float[numResources];
+	bool* pFinished = new bool[numResources];
+	for(int i=0; i<numResources; i++)
+	{
+		pFinished[i] = false;
+		pResources[i] = new StreamTestResource;
+		pResources[i]->Bytes = 16*1024 + TestRand(state)%(64*1024);
+		pResources[i]->pCounter = &counter;
+		pPriority[i] = (float)(TestRand(state)%1000);
+		g_Streamer.Request(pResources[i], "Stream.dds", pPriority[i]);
+	}
+	TEST_CHECK(g_Streamer.GetStats().QueueDepth==numResources && g_Streamer.CheckQueue());
+
+	// Within a frame the nearest user wins, after it a request may move back
+	bool bPriorities = true;
+	for(int n=0; n<300; n++)
+	{
+		int id = TestRand(state)%numResources;
+		float priority = (float)(TestRand(state)%1000);
+		g_Streamer.SetPriority(pResources[id], priority);
+		pPriority[id] = min(pPriority[id], priority);
+		bPriorities = bPriorities && pResources[id]->m_pStream->Priority==pPriority[id];
+	}
+	TEST_CHECK(g_Streamer.Update()==0);
+	for(int id=0; id<numResources; id+=7)
+	{
+		pPriority[id] += 500.0f;
+		g_Streamer.SetPriority(pResources[id], pPriority[id]);
+		bPriorities = bPriorities && pResources[id]->m_pStream->Priority==pPriority[id];
+	}
+	TEST_CHECK(bPriorities && g_Streamer.CheckQueue());
+
+	// Queued requests cancel at once, and finish on this thread
+	int numCancelled = 0, numFinished = 0;
+	for(int id=3; id<numResources; id+=6)
+	{
+		TEST_CHECK(g_Streamer.Cancel(pResources[id]));
+		delete pResources[id];
+		pResources[id] = NULL;
+		numCancelled++;
+	}
+	for(int id=5; id<numResources; id+=12)
+	{
+		TEST_CHECK(g_Streamer.Finish(pResources[id]) && pResources[id]->IsResident());
+		pFinished[id] = true;
+		numFinished++;
+	}
+	int numQueued = numResources-numCancelled-numFinished;
+	TEST_CHECK(g_Streamer.GetStats().QueueDepth==numQueued && g_Streamer.CheckQueue());
+
+	// The second loader's resource is dropped while it has it
+	TEST_CHECK(!g_Streamer.Cancel(pGated[1]));
+
+	// One loader takes the rest in order
+	gates[0] = 1;
+	TEST_CHECK(WaitForLoading(1, 0));
+	bool bOrdered = true;
+	for(int a=0; a<numResources; a++)
+	for(int b=0; b<numResources; b++)
+	{
+		if(!pResources[a] || !pResources[b] || pFinished[a] || pFinished[b])
+			continue;
+		if(pResources[a]->DecodeOrder<pResources[b]->DecodeOrder && pPriority[a]>pPriority[b])
+			bOrdered = false;
+	}
+	TEST_CHECK(bOrdered);
+
+	// Turn the order round so the nearest were decoded last
+	for(int id=0; id<numResources; id++)
+		if(pResources[id] && !pFinished[id])
+		{
+			pPriority[id] = -(float)pResources[id]->DecodeOrder;
+			g_Streamer.SetPriority(pResources[id], pPriority[id]);
+		}
+
+	// The nearest go up first, over the budget only for the first
+	const UINT budget = 256*1024;
+	g_Streamer.SetUploadBudget(budget);
+	int numUp = g_Streamer.Update();
+	const StreamingStats& stats = g_Streamer.GetStats();
+	TEST_CHECK(numUp>0 && numUp<numQueued && (stats.BytesUploaded<=budget || numUp==1));
+	float farthestUp = -1e30f, nearestLeft = 1e30f;
+	for(int id=0; id<numResources; id++)
+	{
+		if(!pResources[id] || pFinished[id])
+			continue;
+		if(pResources[id]->IsResident())
+			farthestUp = max(farthestUp, pPriority[id]);
+		else
+			nearestLeft = min(nearestLeft, pPriority[id]);
+	}
+	TEST_CHECK(farthestUp<=nearestLeft);
+	TEST_CHECK(g_Streamer.CheckQueue());
+
+	// Everything left goes up once and the dropped one is gone
+	gates[1] = 1;
+	g_Streamer.Flush();
+	TEST_CHECK(g_Streamer.IsIdle() && g_Streamer.GetStats().BytesInFlight==0);
+	int wrong = 0;
+	for(int id=0; id<numResources; id++)
+		if(pResources[id] && (!pResources[id]->IsResident() || pResources[id]->Uploads!=1 || pResources[id]->m_pStream))
+			wrong++;
+	TEST_CHECK(wrong==0);
+	TEST_CHECK(g_Streamer.GetStats().Cancelled==start.Cancelled+numCancelled+1);
+	TEST_CHECK(g_Streamer.GetStats().Completed==start.Completed+numResources-numCancelled+1);
+
+	g_Streamer.SetUploadBudget(oldBudget);
+	for(int id=0; id<numResources; id++)
+		SAFE_DELETE(pResources[id]);
+	delete pGated[0];
+	TEST_CHECK(StreamTestResource::NumAlive==aliveBefore);
+	delete[] pResources;
+	delete[] pPriority;
+	delete[] pFinished;
+}
+
+
+//--------------------------------------------------------------------------------------
+// What happened to a run of random use
+//--------------------------------------------------------------------------------------
+struct StreamRun
+{
+	int		Errors;
+	int		Frames;
+	UINT	TotalBytes;
+	UINT	WorstBytes;
+	double	WorstFrame;
+};
+
+//--------------------------------------------------------------------------------------
+// Streams resources that sleep to decode, reprioritizing, cancelling and finishing some
+// of them at random while frames run.  Every kept resource must end up resident after
+// one upload, nothing cancelled is uploaded, uploads stay in budget and the counters
+// return to zero.
+//--------------------------------------------------------------------------------------
+static void StreamRandomUse(int numResources, UINT seed, StreamRun& run)
+{
+	UINT state = seed*7919+1;
+	const UINT budget = 256*1024;
+	UINT oldBudget = g_Streamer.GetUploadBudget();
+	g_Streamer.SetUploadBudget(budget);
+	long aliveBefore = StreamTestResource::NumAlive;
+	memset(&run, 0, sizeof(StreamRun));
+
+	StreamTestResource** pResources = new StreamTestResource*[numResources];
+	bool* pHeld = new bool[numResources];
+	for(int i=0; i<numResources; i++)
+	{
+		pResources[i] = new StreamTestResource;
+		pResources[i]->DecodeMs = TestRand(state)%3;
+		pResources[i]->Bytes = 4096 + TestRand(state)%(128*1024);
+		pHeld[i] = true;
+		g_Streamer.Request(pResources[i], "Stream.dds", (float)(TestRand(state)%1000));
+	}
+	StreamingStats start = g_Streamer.GetStats();
+	if(start.QueueDepth+start.Loading+start.Decoded!=numResources)
+		run.Errors++;
+
+	// Run frames, meddling as a game would
+	while(!g_Streamer.IsIdle())
+	{
+		for(int n=0; n<4; n++)
+		{
+			int id = TestRand(state)%numResources;
+			if(!pHeld[id] || pResources[id]->IsResident())
+				continue;
+			switch(TestRand(state)%8)
+			{
+			case 0:
+				// Nothing needs it, the streamer deletes it if a loader has it
+				pHeld[id] = false;
+				if(g_Streamer.Cancel(pResources[id]))
+					delete pResources[id];
+				pResources[id] = NULL;
+				break;
+			case 1:
+				if(!g_Streamer.Finish(pResources[id]) || !pResources[id]->IsResident())
+					run.Errors++;
+				break;
+			default:
+				g_Streamer.SetPriority(pResources[id], (float)(TestRand(state)%1000));
+				break;
+			}
+		}
+
+		double frameStart = SelfTest::GetTime();
+		g_Streamer.Update();
+		run.WorstFrame = max(run.WorstFrame, SelfTest::GetTime()-frameStart);
+		run.Frames++;
+
+		// A single upload may go over the budget
+		const StreamingStats& stats = g_Streamer.GetStats();
+		run.TotalBytes += stats.BytesUploaded;
+		run.WorstBytes = max(run.WorstBytes, stats.BytesUploaded);
+		if(stats.BytesUploaded>budget+128*1024+4096)
+			run.Errors++;
+		if(stats.Loading<0 || !g_Streamer.CheckQueue())
+			run.Errors++;
+		Sleep(1);
+	}
+
+	// Everything still held is resident and went up once
+	int numHeld = 0;
+	for(int i=0; i<numResources; i++)
+	{
+		if(!pHeld[i])
+			continue;
+		numHeld++;
+		if(!pResources[i]->IsResident() || pResources[i]->Uploads!=1 || pResources[i]->m_pStream)
+			run.Errors++;
+		delete pResources[i];
+	}
+	const StreamingStats& stats = g_Streamer.GetStats();
+	if(stats.Completed-start.Completed!=numHeld ||
+	   stats.Cancelled-start.Cancelled!=numResources-numHeld || stats.BytesInFlight!=0)
+		run.Errors++;
+	if(StreamTestResource::NumAlive!=aliveBefore)
+		run.Errors++;
+
+	delete[] pResources;
+	delete[] pHeld;
+	g_Streamer.SetUploadBudget(oldBudget);
+}
+
+SELF_TEST(StreamingRandomUse)
+{
+	for(UINT seed=0; seed<3; seed++)
+	{
+		StreamRun run;
+		StreamRandomUse(300, seed, run);
+		if(!TEST_CHECK(run.Errors==0))
+			Log::Print("StreamingRandomUse: seed %d, %d errors", seed, run.Errors);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// The worst frame of a large burst against the total that would have gone up at once
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(Streaming)
+{
+	StreamRun run;
+	StreamRandomUse(2000, 1, run);
+	Log::Print("Streaming: 2000 resources, %u bytes over %d frames, worst frame %u bytes in %.3fms, %d errors",
+		run.TotalBytes, run.Frames, run.WorstBytes, run.WorstFrame, run.Errors);
+}
+
+#endif
@@ -0,0 +1,328 @@
+//--------------------------------------------------------------------------------------
+// File: SunPathTests.cpp
+//
+// Self tests and benchmark for the yearly sun path table
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "SunPath.h"
+#include "spa/spa.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// A random place, time zone and surface
+struct PathPlace
+{
+	int			Year;
+	SunLocation	Location;
+	double		TimeZone;
+	double		Slope;
+	double		Rotation;
+};
+
+static void RandomPlace(PathPlace& place, UINT& state)
+{
+	place.Year = 2000 + TestRand(state)%30;
+	place.Location = SunLocation((int)(TestRand(state)%13000)*0.01 - 65, (int)(TestRand(state)%36000)*0.01 - 180,
+		TestRand(state)%3000, 800 + TestRand(state)%250, (int)(TestRand(state)%40) - 10);
+	place.TimeZone = (int)(TestRand(state)%25) - 12;
+	place.Slope = TestRand(state)%60;
+	place.Rotation = (int)(TestRand(state)%360) - 180;
+}
+
+// Fills an spa_data with a random time at a place
+static void RandomSpa(spa_data& spa, const PathPlace& place, UINT& state)
+{
+	memset(&spa, 0, sizeof(spa_data));
+	spa.year = place.Year;
+	spa.month = 1 + TestRand(state)%12;
+	spa.day = 1 + TestRand(state)%28;
+	spa.hour = TestRand(state)%24;
+	spa.minute = TestRand(state)%60;
+	spa.second = TestRand(state)%60;
+	spa.timezone = place.TimeZone;
+	spa.delta_t = 67;
+	spa.longitude = place.Location.Longitude;
+	spa.latitude = place.Location.Latitude;
+	spa.elevation = place.Location.Elevation;
+	spa.pressure = place.Location.Pressure;
+	spa.temperature = place.Location.Temperature;
+	spa.slope = place.Slope;
+	spa.azm_rotation = place.Rotation;
+	spa.atmos_refract = 0.5667;
+	spa.function = SPA_ALL;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Lookups at random times match spa_calculate within 0.05 degrees, including the
+// refraction added back near the horizon and the incidence on a tilted surface, and
+// the stored sunrise, transit and sunset are within a minute
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPathMatchesSpa)
+{
+	const int numPlaces=3, numTests=1000;
+	UINT state = 1;
+	for(int p=0; p<numPlaces; p++)
+	{
+		PathPlace place;
+		RandomPlace(place, state);
+		SunPathTable table;
+		table.Setup(place.Year, place.Location, place.TimeZone, 144, place.Slope, place.Rotation);
+		if(!TEST_CHECK(table.Build() && table.IsReady()))
+			return;
+		TEST_CHECK(table.GetHeader().MaxError < 0.05f);
+
+		int errors = 0;
+		double maxZenith = 0, maxAzimuth = 0, maxIncidence = 0, maxTime = 0;
+		for(int t=0; t<numTests; t++)
+		{
+			spa_data spa;
+			RandomSpa(spa, place, state);
+			D3DXVECTOR3 dir;
+			if(spa_calculate(&spa)!=0 || !table.Lookup(spa.month, spa.day, spa.hour, spa.minute, spa.second, dir))
+			{
+				errors++;
+				continue;
+			}
+
+			float zenith, azimuth;
+			SunPathTable::ToAngles(dir, zenith, azimuth);
+			double dz = fabs(zenith - spa.zenith);
+			double da = fabs(azimuth - spa.azimuth);
+			if(da > 180)
+				da = 360 - da;
+			da *= sin(spa.zenith*3.1415926535897932/180.0);
+			double di = fabs(table.GetIncidence(dir) - spa.incidence);
+			if(dz > 0.05 || da > 0.05 || di > 0.05)
+				errors++;
+			maxZenith = max(maxZenith, dz);
+			maxAzimuth = max(maxAzimuth, da);
+			maxIncidence = max(maxIncidence, di);
+
+			const SunPathDay* pDay = table.GetDay(spa.month, spa.day);
+			if(!pDay)
+				errors++;
+			else if(spa.sunrise >= -24)
+			{
+				double dt = max(fabs(pDay->Sunrise - spa.sunrise), max(fabs(pDay->Transit - spa.suntransit), fabs(pDay->Sunset - spa.sunset)))*60.0;
+				if(dt > 1.0)
+					errors++;
+				maxTime = max(maxTime, dt);
+			}
+		}
+		if(!TEST_CHECK(errors==0))
+			Log::Print("SunPathMatchesSpa: max error zenith %.4f, azimuth %.4f, incidence %.4f degrees, rise/set %.4f minutes",
+				maxZenith, maxAzimuth, maxIncidence, maxTime);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times and dates outside the table's year are refused, and the year ends at the
+// right day for leap years
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPathRange)
+{
+	SunLocation loc(47.6, -122.3, 50);
+	SunPathTable table;
+	D3DXVECTOR3 dir;
+	TEST_CHECK(!table.Build());
+	TEST_CHECK(!table.Lookup(1, 1, 12, 0, 0, dir));
+
+	table.Setup(2011, loc, -8, 24);
+	if(!TEST_CHECK(table.Build()))
+		return;
+	TEST_CHECK(table.GetHeader().NumDays==365 && table.GetHeader().NumSamples==365*24+1);
+	TEST_CHECK(table.Matches(2011, loc, -8) && !table.Matches(2012, loc, -8) && !table.Matches(2011, loc, -7));
+	TEST_CHECK(table.Lookup(1, 1, 0, 0, 0, dir) && table.Lookup(12, 31, 23, 59, 59.9, dir));
+	TEST_CHECK(!table.Lookup(SunPosition::JulianDay(2010, 12, 31, 23, 59, 0, -8), dir));
+	TEST_CHECK(!table.Lookup(SunPosition::JulianDay(2012, 1, 1, 0, 1, 0, -8), dir));
+	TEST_CHECK(table.GetDay(12, 31)==table.GetDay(1, 1)+364);
+	TEST_CHECK(!table.GetDay(2, 29) && !table.GetDay(13, 1) && !table.GetDay(4, 31) && !table.GetDay(0, 5));
+
+	// Midday in June is long after sunrise in Seattle
+	const SunPathDay* pDay = table.GetDay(6, 21);
+	TEST_CHECK(pDay && pDay->Sunrise > 4 && pDay->Sunrise < pDay->Transit && pDay->Transit < pDay->Sunset && pDay->Sunset < 21);
+
+	table.Setup(2012, loc, -8, 24);
+	table.Build();
+	TEST_CHECK(table.GetHeader().NumDays==366 && table.GetDay(2, 29) && table.GetDay(12, 31)==table.GetDay(1, 1)+365);
+
+	// No sunrise in the polar night
+	table.Setup(2012, SunLocation(78.2, 15.6, 10), 1, 24);
+	table.Build();
+	pDay = table.GetDay(12, 21);
+	TEST_CHECK(pDay && pDay->Sunrise < 0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Directions convert to the angles they were made from, and the incidence on a level
+// surface is the zenith
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPathAngles)
+{
+	float zenith, azimuth;
+	SunPathTable::ToAngles(D3DXVECTOR3(0, 1, 0), zenith, azimuth);
+	TEST_CHECK(zenith==0);
+	SunPathTable::ToAngles(D3DXVECTOR3(1, 0, 0), zenith, azimuth);
+	TEST_CHECK_NEAR(zenith, 90.0f, 0.0001f);
+	TEST_CHECK_NEAR(azimuth, 90.0f, 0.0001f);
+	SunPathTable::ToAngles(D3DXVECTOR3(0, 0, -1), zenith, azimuth);
+	TEST_CHECK_NEAR(azimuth, 180.0f, 0.0001f);
+	SunPathTable::ToAngles(D3DXVECTOR3(-0.5f, 0.7071068f, 0.5f), zenith, azimuth);
+	TEST_CHECK_NEAR(zenith, 45.0f, 0.001f);
+	TEST_CHECK_NEAR(azimuth, 315.0f, 0.001f);
+
+	SunPathTable table;
+	table.Setup(2011, SunLocation(47.6, -122.3, 50), -8, 24);
+	D3DXVECTOR3 dir(0.3f, 0.8f, -0.52f);
+	D3DXVec3Normalize(&dir, &dir);
+	SunPathTable::ToAngles(dir, zenith, azimuth);
+	TEST_CHECK_NEAR(table.GetIncidence(dir), zenith, 0.001f);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A cache file is loaded by a table set up the same way and gives the same lookups.
+// Files from other settings and truncated files are refused.
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPathCache)
+{
+	const char* szFile = "SunPathTest.tmp";
+	SunLocation loc(-33.9, 151.2, 50);
+	SunPathTable table;
+	table.Setup(2015, loc, 10, 48);
+	if(!TEST_CHECK(table.Build(szFile)))
+		return;
+
+	SunPathTable loaded;
+	loaded.Setup(2015, loc, 10, 48);
+	TEST_CHECK(loaded.Load(szFile));
+	TEST_CHECK(loaded.GetHeader().MaxError==table.GetHeader().MaxError);
+	int differ = 0;
+	for(int h=0; h<24*30; h+=7)
+	{
+		D3DXVECTOR3 a, b;
+		if(!table.Lookup(3, 1+h/24, h%24, 17, 0, a) || !loaded.Lookup(3, 1+h/24, h%24, 17, 0, b) || a!=b)
+			differ++;
+	}
+	TEST_CHECK(differ==0);
+	TEST_CHECK(!memcmp(loaded.GetDay(7, 4), table.GetDay(7, 4), sizeof(SunPathDay)));
+
+	SunPathTable other;
+	other.Setup(2015, SunLocation(-33.8, 151.2, 50), 10, 48);
+	TEST_CHECK(!other.Load(szFile));
+	other.Setup(2015, loc, 10, 96);
+	TEST_CHECK(!other.Load(szFile));
+
+	// Cut the file off partway through the days
+	FILE* fp = fopen(szFile, "rb");
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char* pData = new char[size];
+	fread(pData, 1, size, fp);
+	fclose(fp);
+	fp = fopen(szFile, "wb");
+	fwrite(pData, 1, size-100, fp);
+	fclose(fp);
+	delete[] pData;
+	loaded.Setup(2015, loc, 10, 48);
+	TEST_CHECK(!loaded.Load(szFile));
+	remove(szFile);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A build on its own thread makes the same table, and releasing a table waits for the
+// build it is on
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPathBuildAsync)
+{
+	SunLocation loc(47.6, -122.3, 50);
+	SunPathTable table, async;
+	table.Setup(2020, loc, -8, 24);
+	async.Setup(2020, loc, -8, 24);
+	if(!TEST_CHECK(table.Build()))
+		return;
+	async.BuildAsync();
+	while(async.IsBuilding())
+		Sleep(1);
+	if(!TEST_CHECK(async.IsReady()))
+		return;
+	TEST_CHECK(async.GetHeader().MaxError==table.GetHeader().MaxError);
+	int differ = 0;
+	for(int h=0; h<24*60; h+=13)
+	{
+		D3DXVECTOR3 a, b;
+		if(!table.Lookup(5, 1+h/24, h%24, 41, 0, a) || !async.Lookup(5, 1+h/24, h%24, 41, 0, b) || a!=b)
+			differ++;
+	}
+	TEST_CHECK(differ==0);
+
+	// Build again, and again straight after
+	async.Setup(2021, loc, -8, 24);
+	async.BuildAsync();
+	async.Release();
+	TEST_CHECK(!async.IsBuilding() && !async.IsReady());
+	async.Setup(2021, loc, -8, 24);
+	async.BuildAsync();
+	while(async.IsBuilding())
+		Sleep(1);
+	async.BuildAsync();
+	async.Release();
+	TEST_CHECK(!async.IsBuilding());
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times the table build, and lookups against spa_calculate
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(SunPath)
+{
+	const int numTests=10000, repeat=100;
+	UINT state = 3;
+	PathPlace place;
+	RandomPlace(place, state);
+	SunPathTable table;
+	table.Setup(place.Year, place.Location, place.TimeZone, 144, place.Slope, place.Rotation);
+	double start = SelfTest::GetTime();
+	table.Build();
+	double buildTime = SelfTest::GetTime()-start;
+
+	spa_data* pSpa = new spa_data[numTests];
+	for(int t=0; t<numTests; t++)
+		RandomSpa(pSpa[t], place, state);
+
+	start = SelfTest::GetTime();
+	for(int t=0; t<numTests; t++)
+		spa_calculate(&pSpa[t]);
+	double spaTime = SelfTest::GetTime()-start;
+
+	// Lookups are too quick to time one at a time
+	D3DXVECTOR3 dir, sum(0, 0, 0);
+	start = SelfTest::GetTime();
+	for(int t=0; t<numTests; t++)
+		for(int r=0; r<repeat; r++)
+		{
+			table.Lookup(pSpa[t].month, pSpa[t].day, pSpa[t].hour, pSpa[t].minute, pSpa[t].second+r*1e-6, dir);
+			sum += dir;
+		}
+	double lookupTime = SelfTest::GetTime()-start;
+
+	Log::Print("SunPath: build %.1fms, error %.4f max %.4f mean degrees, lookup %.3fus, spa_calculate %.3fus (%.1f)",
+		buildTime, table.GetHeader().MaxError, table.GetHeader().MeanError, lookupTime*1000.0/(numTests*repeat), spaTime*1000.0/numTests, sum.y);
+	delete[] pSpa;
+}
+
+#endif
@@ -0,0 +1,270 @@
+//--------------------------------------------------------------------------------------
+// File: SunPositionTests.cpp
+//
+// Self tests and benchmark for the batched solar position
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "SunPosition.h"
+#include "spa/spa.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Fills an spa_data with a date and location
+static void SetupSpa(spa_data& spa, int year, int month, int day, int hour, int minute, int second, double timezone, const SunLocation& loc, double deltaT)
+{
+	memset(&spa, 0, sizeof(spa_data));
+	spa.year = year;
+	spa.month = month;
+	spa.day = day;
+	spa.hour = hour;
+	spa.minute = minute;
+	spa.second = second;
+	spa.timezone = timezone;
+	spa.delta_t = deltaT;
+	spa.longitude = loc.Longitude;
+	spa.latitude = loc.Latitude;
+	spa.elevation = loc.Elevation;
+	spa.pressure = loc.Pressure;
+	spa.temperature = loc.Temperature;
+	spa.atmos_refract = 0.5667;
+	spa.function = SPA_ZA;
+}
+
+// Angle between two azimuths, scaled by the sine of the zenith since the azimuth means
+// nothing with the sun overhead
+static double AzimuthError(double a, double b, double zenith)
+{
+	double d = fabs(a-b);
+	if(d > 180.0)
+		d = 360.0-d;
+	return d*sin(zenith*3.1415926535897932/180.0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The worked example from the SPA paper: Golden, Colorado on 17 October 2003
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPositionKnownValue)
+{
+	double jd = SunPosition::JulianDay(2003, 10, 17, 12, 30, 30, -7);
+	TEST_CHECK_NEAR(jd, 2452930.312847, 0.000001);
+
+	SunPosition sun;
+	sun.SetDeltaT(67);
+	float zenith, azimuth;
+	sun.Compute(jd, SunLocation(39.742476, -105.1786, 1830.14, 820, 11), zenith, azimuth);
+	TEST_CHECK_NEAR(zenith, 50.11162f, 0.002f);
+	TEST_CHECK_NEAR(azimuth, 194.34024f, 0.002f);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Random times at random locations match spa_calculate within a thousandth of a degree.
+// The location count isn't a multiple of four or of a job's block, and the dates jump
+// around a century with runs of times on the same date like a real batch.
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPositionMatchesSpa)
+{
+	const int numTimes=256, numLocations=67;
+	const double deltaT = 67;
+	UINT state = 1;
+
+	Array<SunLocation> locations;
+	for(int l=0; l<numLocations; l++)
+		locations.Add(SunLocation((int)(TestRand(state)%17800)*0.01 - 89, (int)(TestRand(state)%36000)*0.01 - 180,
+			TestRand(state)%4000, 700 + TestRand(state)%400, (int)(TestRand(state)%60) - 20));
+
+	Array<spa_data> dates;
+	Array<double> times;
+	for(int t=0; t<numTimes; t++)
+	{
+		spa_data spa;
+		if(t%16==0)
+			SetupSpa(spa, 1950 + TestRand(state)%100, 1 + TestRand(state)%12, 1 + TestRand(state)%28, 0, 0, 0, (int)(TestRand(state)%25) - 12, locations[0], deltaT);
+		else
+			spa = dates[t-1];
+		spa.hour = TestRand(state)%24;
+		spa.minute = TestRand(state)%60;
+		spa.second = TestRand(state)%60;
+		times.Add(SunPosition::JulianDay(spa.year, spa.month, spa.day, spa.hour, spa.minute, spa.second, spa.timezone));
+		dates.Add(spa);
+	}
+
+	float* pZenith = new float[numTimes*numLocations];
+	float* pAzimuth = new float[numTimes*numLocations];
+	SunPosition sun;
+	sun.SetDeltaT(deltaT);
+	sun.Compute(times, numTimes, locations, numLocations, pZenith, pAzimuth);
+
+	int errors = 0;
+	double maxZenith = 0, maxAzimuth = 0;
+	for(int t=0; t<numTimes; t++)
+		for(int l=0; l<numLocations; l++)
+		{
+			spa_data spa = dates[t];
+			SetupSpa(spa, spa.year, spa.month, spa.day, spa.hour, spa.minute, spa.second, spa.timezone, locations[l], deltaT);
+			if(spa_calculate(&spa) != 0)
+			{
+				errors++;
+				continue;
+			}
+			double dz = fabs(pZenith[t*numLocations+l] - spa.zenith);
+			double da = AzimuthError(pAzimuth[t*numLocations+l], spa.azimuth, spa.zenith);
+			if(dz > 0.001 || da > 0.001)
+				errors++;
+			maxZenith = max(maxZenith, dz);
+			maxAzimuth = max(maxAzimuth, da);
+		}
+	if(!TEST_CHECK(errors==0))
+		Log::Print("SunPositionMatchesSpa: max zenith error %.6f, max azimuth error %.6f degrees", maxZenith, maxAzimuth);
+
+	delete[] pZenith;
+	delete[] pAzimuth;
+	locations.Release();
+	dates.Release();
+	times.Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// A batch gives the same angles as one position at a time, whatever order the times
+// come in.  The times span more days than the cache holds, and go back in time so
+// cached days are evicted and computed again.
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPositionBatchMatchesSingle)
+{
+	const int numTimes=100, numLocations=5;
+	SunLocation locations[numLocations];
+	locations[0] = SunLocation(60.2, 24.9, 20);
+	locations[1] = SunLocation(-33.9, 151.2, 50);
+	locations[2] = SunLocation(0.5, -78.5, 2850);
+	locations[3] = SunLocation(78.2, 15.6, 10);
+	locations[4] = SunLocation(-45.0, -170.0, 0);
+
+	double times[numTimes];
+	double start = SunPosition::JulianDay(2010, 6, 1, 0, 0, 0, 0);
+	for(int t=0; t<numTimes; t++)
+		times[t] = start + ((t*37)%numTimes)*(SUN_CACHE_DAYS*3.0/numTimes) + (t%7)/7.0;
+
+	float zenith[numTimes*numLocations], azimuth[numTimes*numLocations];
+	SunPosition sun;
+	sun.Compute(times, numTimes, locations, numLocations, zenith, azimuth);
+
+	SunPosition single;
+	int differ = 0;
+	for(int t=numTimes-1; t>=0; t--)
+		for(int l=0; l<numLocations; l++)
+		{
+			float z, a;
+			single.Compute(times[t], locations[l], z, a);
+			if(fabsf(z-zenith[t*numLocations+l]) > 0.0001f || AzimuthError(a, azimuth[t*numLocations+l], z) > 0.0001)
+				differ++;
+		}
+	TEST_CHECK(differ==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Changing delta T drops the cached days, and the refraction is applied only near the
+// horizon
+//--------------------------------------------------------------------------------------
+SELF_TEST(SunPositionSettings)
+{
+	SunLocation loc(39.742476, -105.1786, 1830.14, 820, 11);
+	double jd = SunPosition::JulianDay(2003, 10, 17, 12, 30, 30, -7);
+	SunPosition sun;
+	float z0, a0, z1, a1;
+	sun.SetDeltaT(67);
+	sun.Compute(jd, loc, z0, a0);
+
+	// Two hours of delta T, about as far as the SPA allows, moves the sun along the
+	// ecliptic by a tenth of a degree.  That only shows if the days cached for the old
+	// delta T are gone.
+	spa_data spa;
+	SetupSpa(spa, 2003, 10, 17, 12, 30, 30, -7, loc, 7000);
+	TEST_CHECK(spa_calculate(&spa)==0);
+	sun.SetDeltaT(7000);
+	sun.Compute(jd, loc, z1, a1);
+	TEST_CHECK(fabsf(z1-z0) > 0.01f);
+	TEST_CHECK(fabs(z1-spa.zenith) < 0.001 && AzimuthError(a1, spa.azimuth, spa.zenith) < 0.001);
+	sun.SetDeltaT(67);
+	sun.Compute(jd, loc, z1, a1);
+	TEST_CHECK(z1==z0 && a1==a0);
+
+	// The sun is high, so the refraction at the horizon changes nothing
+	sun.SetRefraction(2.0);
+	sun.Compute(jd, loc, z1, a1);
+	TEST_CHECK(z1==z0 && a1==a0);
+
+	// A degree below the horizon the sun is lifted only when the refraction reaches it
+	double dusk = SunPosition::JulianDay(2003, 10, 17, 17, 20, 0, -7);
+	sun.SetRefraction(0.5667);
+	sun.Compute(dusk, loc, z0, a0);
+	TEST_CHECK(z0 > 90.5f && z0 < 91.5f);
+	sun.SetRefraction(2.0);
+	sun.Compute(dusk, loc, z1, a1);
+	TEST_CHECK(z1 < z0-0.1f && a1==a0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times spa_calculate against the batch for a year of hourly times
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(SunPosition)
+{
+	const int numTimes=8760, numLocations=256;
+	const double deltaT = 67;
+	UINT state = 11;
+
+	Array<SunLocation> locations;
+	for(int l=0; l<numLocations; l++)
+		locations.Add(SunLocation((int)(TestRand(state)%12000)*0.01 - 60, (int)(TestRand(state)%36000)*0.01 - 180, TestRand(state)%2000));
+
+	Array<double> times;
+	double start = SunPosition::JulianDay(2009, 1, 1, 0, 0, 0, 0);
+	for(int t=0; t<numTimes; t++)
+		times.Add(start + t/24.0);
+
+	float* pZenith = new float[numTimes*numLocations];
+	float* pAzimuth = new float[numTimes*numLocations];
+
+	// The reference on a sample of the pairs, it is far too slow for all of them
+	int stride = max(1, numTimes/256);
+	int spaCount = 0;
+	double startTime = SelfTest::GetTime();
+	for(int t=0; t<numTimes; t+=stride)
+		for(int l=0; l<numLocations; l++)
+		{
+			spa_data spa;
+			SetupSpa(spa, 2009, 1, 1 + (t/24)%28, t%24, 0, 0, 0, locations[l], deltaT);
+			spa_calculate(&spa);
+			spaCount++;
+		}
+	double spaTime = SelfTest::GetTime()-startTime;
+
+	// The batch on a cold cache
+	SunPosition sun;
+	sun.SetDeltaT(deltaT);
+	startTime = SelfTest::GetTime();
+	sun.Compute(times, numTimes, locations, numLocations, pZenith, pAzimuth);
+	double batchTime = SelfTest::GetTime()-startTime;
+
+	Log::Print("SunPosition: %d times, %d locations: spa_calculate %.3fus, batch %.4fus per position (%.1fms total)",
+		numTimes, numLocations, spaTime*1000.0/spaCount, batchTime*1000.0/(numTimes*numLocations), batchTime);
+
+	delete[] pZenith;
+	delete[] pAzimuth;
+	locations.Release();
+	times.Release();
+}
+
+#endif
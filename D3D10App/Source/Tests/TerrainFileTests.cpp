@@ -0,0 +1,597 @@
+//--------------------------------------------------------------------------------------
+// File: TerrainFileTests.cpp
+//
+// Self tests and benchmark for the binary terrain container
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "TerrainFile.h"
+#include "SelfTest.h"
+#include "Log.h"
+#include <stddef.h>
+#include <float.h>
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+static const char* g_szTerrainFileTest = "TerrainFileTest.tmp";
+
+// A terrain with rolling heights and blocky layer patches, so both streams compress.
+// Noisy heights are random bits and don't.  The source rows are padded to check pitches.
+struct TestTerrain
+{
+	D3DXFLOAT16*		pHeights;
+	BlendTexel*			pLayers;
+	TerrainFileLayer	LayerInfo[3];
+	TerrainFileDesc		Desc;
+
+	TestTerrain(int size, int chunkSize, bool noisy, UINT seed)
+	{
+		UINT state = seed*2654435761u + 1;
+		int pitch = size+5;
+		pHeights = new D3DXFLOAT16[pitch*size];
+		pLayers = new BlendTexel[pitch*size];
+		float* pRow = new float[size];
+		for(int y=0; y<size; y++)
+		{
+			for(int x=0; x<size; x++)
+				pRow[x] = 40.0f*sinf(x*0.05f)*cosf(y*0.03f) + 0.0625f*(TestRand(state)%3);
+			D3DXFloat32To16Array(pHeights + y*pitch, pRow, size);
+			if(noisy)
+			{
+				for(int x=0; x<size; x++)
+					((WORD*)pHeights)[y*pitch+x] = (WORD)(TestRand(state) & 0x7BFF);
+			}
+			for(int x=0; x<size; x++)
+			{
+				BlendTexel& t = pLayers[y*pitch+x];
+				t.data[0] = (UCHAR)((x/24 + y/16) % 3);
+				t.data[1] = (UCHAR)((x/24 + y/16 + 1) % 3);
+				t.data[2] = (UCHAR)(255 - (x/8)%4*60);
+				t.data[3] = (UCHAR)((x/8)%4*60);
+			}
+		}
+		delete[] pRow;
+
+		memset(LayerInfo, 0, sizeof(LayerInfo));
+		strcpy(LayerInfo[0].Texture, "Textures\\grass.dds");
+		strcpy(LayerInfo[1].Normalmap, "Textures\\rock_n.dds");
+		LayerInfo[2].Scale = 4.0f;
+
+		Desc.Size = size;
+		Desc.HeightScale = 128.0f;
+		Desc.pHeights = pHeights;
+		Desc.HeightPitch = pitch*sizeof(D3DXFLOAT16);
+		Desc.pLayers = pLayers;
+		Desc.LayerPitch = pitch*sizeof(BlendTexel);
+		Desc.pLayerInfo = LayerInfo;
+		Desc.LayerCount = 3;
+		Desc.ChunkSize = chunkSize;
+	}
+
+	~TestTerrain()
+	{
+		delete[] pHeights;
+		delete[] pLayers;
+	}
+
+	inline int GetPitch() const { return Desc.Size+5; }
+};
+
+// Overwrites part of the file
+static void PatchFile(const char* szFile, long offset, const void* pData, int bytes)
+{
+	FILE* fp = fopen(szFile, "r+b");
+	if(fp)
+	{
+		fseek(fp, offset, SEEK_SET);
+		fwrite(pData, bytes, 1, fp);
+		fclose(fp);
+	}
+}
+
+// Writes the terrain, patches a DWORD and tries to open it
+static bool OpensPatched(const TestTerrain& terrain, long offset, DWORD value)
+{
+	TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+	PatchFile(g_szTerrainFileTest, offset, &value, sizeof(DWORD));
+	TerrainFile file;
+	return file.Open(g_szTerrainFileTest);
+}
+
+// Reads both streams back and compares them with the source
+static bool ReadsBack(TerrainFile& file, const TestTerrain& terrain)
+{
+	int size = terrain.Desc.Size;
+	int pitch = size+3;
+	D3DXFLOAT16* pHeights = new D3DXFLOAT16[pitch*size];
+	BlendTexel* pLayers = new BlendTexel[pitch*size];
+	bool ok = file.ReadHeights(pHeights, pitch) && file.ReadLayers(pLayers, pitch);
+	for(int y=0; y<size && ok; y++)
+	{
+		ok = memcmp(pHeights + y*pitch, terrain.pHeights + y*terrain.GetPitch(), size*sizeof(D3DXFLOAT16))==0 &&
+			memcmp(pLayers + y*pitch, terrain.pLayers + y*terrain.GetPitch(), size*sizeof(BlendTexel))==0;
+	}
+	delete[] pHeights;
+	delete[] pLayers;
+	return ok;
+}
+
+// Sentinel around decoded blocks, decoders must not write past their rows
+#define TERRAIN_TEST_GUARD 0xCDCDCDCD
+
+// Fills a block with the sentinel, rows are pitch texels apart with a row spare below
+static void FillGuard(DWORD* pBlock, int pitch, int h)
+{
+	for(int i=0; i<pitch*(h+1); i++)
+		pBlock[i] = TERRAIN_TEST_GUARD;
+}
+
+// Checks the sentinel is intact outside the w*h texels of the block
+static bool GuardIntact(const DWORD* pBlock, int pitch, int w, int h, int texelSize)
+{
+	const BYTE* p = (const BYTE*)pBlock;
+	for(int y=0; y<=h; y++)
+		for(int i=(y<h ? w*texelSize : 0); i<pitch*4; i++)
+			if(p[y*pitch*4 + i]!=0xCD)
+				return false;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// The 16 bit delta codec round trips smooth, noisy and wrapping blocks of any shape,
+// and gives up when the output doesn't fit
+//--------------------------------------------------------------------------------------
+SELF_TEST(TerrainFileDelta16)
+{
+	static const int shapes[][2] = { {1,1}, {1,9}, {9,1}, {7,3}, {64,64}, {33,17} };
+	UINT state = 11;
+	WORD src[64*64];
+	DWORD block[72*65];
+	BYTE packed[64*64*3];
+	for(int s=0; s<sizeof(shapes)/sizeof(shapes[0]); s++)
+	{
+		int w = shapes[s][0], h = shapes[s][1];
+		for(int kind=0; kind<3; kind++)
+		{
+			for(int i=0; i<w*h; i++)
+			{
+				if(kind==0)
+					src[i] = (WORD)(15000 + (i%w)*3 + (i/w)*5 + TestRand(state)%3);
+				else if(kind==1)
+					src[i] = (WORD)TestRand(state);
+				else
+					src[i] = (i+i/w) & 1 ? 0xFFFF : 0;
+			}
+			int bytes = TerrainFile::EncodeDelta16(src, w, h, packed, w*h*3);
+			if(!TEST_CHECK(bytes>0 && bytes<=w*h*3))
+				continue;
+			if(kind==0 && w*h>=64)
+				TEST_CHECK(bytes<w*h*2);
+
+			// Decode into a wider image, only the block may change
+			int pitch = w*2+8;
+			FillGuard(block, pitch/2, h);
+			TEST_CHECK(TerrainFile::DecodeDelta16(packed, bytes, (WORD*)block, pitch, w, h));
+			bool same = true;
+			for(int y=0; y<h; y++)
+				same = same && memcmp((WORD*)block + y*pitch, src + y*w, w*sizeof(WORD))==0;
+			TEST_CHECK(same);
+			TEST_CHECK(GuardIntact(block, pitch/2, w, h, 2));
+
+			// One byte short
+			TEST_CHECK(TerrainFile::EncodeDelta16(src, w, h, packed, bytes-1)==0);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// The 32 bit run codec round trips runs, literals and mixes of both across rows
+//--------------------------------------------------------------------------------------
+SELF_TEST(TerrainFileRun32)
+{
+	static const int shapes[][2] = { {1,1}, {1,9}, {9,1}, {7,3}, {64,64}, {33,17} };
+	UINT state = 12;
+	DWORD src[64*64];
+	DWORD block[72*65];
+	BYTE packed[64*64*5+16];
+	for(int s=0; s<sizeof(shapes)/sizeof(shapes[0]); s++)
+	{
+		int w = shapes[s][0], h = shapes[s][1];
+		for(int kind=0; kind<4; kind++)
+		{
+			for(int i=0; i<w*h; i++)
+			{
+				if(kind==0)
+					src[i] = 0x11223344;
+				else if(kind==1)
+					src[i] = TestRand(state);
+				else if(kind==2)
+					src[i] = TestRand(state)%3;
+				else
+					src[i] = (i/13)*7;
+			}
+			int bytes = TerrainFile::EncodeRun32(src, w*h, packed, sizeof(packed));
+			if(!TEST_CHECK(bytes>0))
+				continue;
+			if(kind==0)
+				TEST_CHECK(bytes<=9);
+
+			int pitch = w+4;
+			FillGuard(block, pitch, h);
+			TEST_CHECK(TerrainFile::DecodeRun32(packed, bytes, block, pitch, w, h));
+			bool same = true;
+			for(int y=0; y<h; y++)
+				same = same && memcmp(block + y*pitch, src + y*w, w*sizeof(DWORD))==0;
+			TEST_CHECK(same);
+			TEST_CHECK(GuardIntact(block, pitch, w, h, 4));
+			TEST_CHECK(TerrainFile::EncodeRun32(src, w*h, packed, bytes-1)==0);
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Truncated, padded and random chunk data fails without writing outside the block
+//--------------------------------------------------------------------------------------
+SELF_TEST(TerrainFileCorruptChunks)
+{
+	const int w = 21, h = 11, pitch = 24;
+	UINT state = 13;
+	WORD heights[w*h];
+	DWORD layers[w*h];
+	for(int i=0; i<w*h; i++)
+	{
+		heights[i] = (WORD)(20000 + i*3 + TestRand(state)%5);
+		layers[i] = TestRand(state)%4 ? 0x01020304 : TestRand(state);
+	}
+	BYTE packed16[w*h*3+1], packed32[w*h*5+16];
+	int bytes16 = TerrainFile::EncodeDelta16(heights, w, h, packed16, w*h*3);
+	int bytes32 = TerrainFile::EncodeRun32(layers, w*h, packed32, sizeof(packed32)-1);
+	if(!TEST_CHECK(bytes16>0 && bytes32>0))
+		return;
+
+	// Every truncation fails, as does a stray byte on the end
+	DWORD block[pitch*(h+1)];
+	int failed = 0, overran = 0;
+	for(int cut=0; cut<bytes16; cut++)
+	{
+		FillGuard(block, pitch, h);
+		failed += TerrainFile::DecodeDelta16(packed16, cut, (WORD*)block, pitch*2, w, h) ? 0 : 1;
+		overran += GuardIntact(block, pitch, w, h, 2) ? 0 : 1;
+	}
+	TEST_CHECK(failed==bytes16 && overran==0);
+	failed = overran = 0;
+	for(int cut=0; cut<bytes32; cut++)
+	{
+		FillGuard(block, pitch, h);
+		failed += TerrainFile::DecodeRun32(packed32, cut, block, pitch, w, h) ? 0 : 1;
+		overran += GuardIntact(block, pitch, w, h, 4) ? 0 : 1;
+	}
+	TEST_CHECK(failed==bytes32 && overran==0);
+	packed16[bytes16] = 0;
+	packed32[bytes32] = 0;
+	TEST_CHECK(!TerrainFile::DecodeDelta16(packed16, bytes16+1, (WORD*)block, pitch*2, w, h));
+	TEST_CHECK(!TerrainFile::DecodeRun32(packed32, bytes32+1, block, pitch, w, h));
+
+	// A varint that never ends, a residual over 16 bits and a run longer than the block
+	BYTE bad[16];
+	memset(bad, 0x80, sizeof(bad));
+	TEST_CHECK(!TerrainFile::DecodeDelta16(bad, sizeof(bad), (WORD*)block, pitch*2, 1, 1));
+	TEST_CHECK(!TerrainFile::DecodeRun32(bad, sizeof(bad), block, pitch, 1, 1));
+	BYTE wide[3] = { 0x80, 0x80, 0x04 };
+	TEST_CHECK(!TerrainFile::DecodeDelta16(wide, 3, (WORD*)block, pitch*2, 1, 1));
+	UINT token = ((w*h) << 1) | 1;
+	BYTE longRun[6] = { (BYTE)(token | 0x80), (BYTE)(token >> 7), 1, 2, 3, 4 };
+	FillGuard(block, pitch, h);
+	TEST_CHECK(!TerrainFile::DecodeRun32(longRun, 6, block, pitch, w, h));
+	TEST_CHECK(GuardIntact(block, pitch, 0, h, 4));
+
+	// Random bytes never write outside the block
+	BYTE noise[256];
+	overran = 0;
+	for(int n=0; n<500; n++)
+	{
+		int bytes = 1 + TestRand(state)%sizeof(noise);
+		for(int i=0; i<bytes; i++)
+			noise[i] = (BYTE)TestRand(state);
+		FillGuard(block, pitch, h);
+		TerrainFile::DecodeDelta16(noise, bytes, (WORD*)block, pitch*2, w, h);
+		overran += GuardIntact(block, pitch, w, h, 2) ? 0 : 1;
+		FillGuard(block, pitch, h);
+		TerrainFile::DecodeRun32(noise, bytes, block, pitch, w, h);
+		overran += GuardIntact(block, pitch, w, h, 4) ? 0 : 1;
+	}
+	TEST_CHECK(overran==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compressed and raw files hold the same terrain, and chunks that don't compress stay raw
+//--------------------------------------------------------------------------------------
+SELF_TEST(TerrainFileRoundTrip)
+{
+	for(int pass=0; pass<3; pass++)
+	{
+		// Compressed, uncompressed, and compressed with heights that don't compress
+		TestTerrain terrain(200, 64, pass==2, 20+pass);
+		terrain.Desc.Compress = (pass!=1);
+		if(!TEST_CHECK(TerrainFile::Write(g_szTerrainFileTest, terrain.Desc)))
+			continue;
+
+		TerrainFile file;
+		if(!TEST_CHECK(file.Open(g_szTerrainFileTest)))
+			continue;
+		const TerrainFileHeader& h = file.GetHeader();
+		TEST_CHECK(h.Size==200 && h.ChunkSize==64 && h.ChunksPerSide==4 && h.PyramidLevels==5 && h.HeightScale==128.0f);
+		TEST_CHECK(h.LayerCount==3 && memcmp(&file.GetLayer(0), terrain.LayerInfo, sizeof(terrain.LayerInfo))==0);
+		TEST_CHECK(file.GetChunkWidth(0)==64 && file.GetChunkWidth(3)==200-3*64);
+		TEST_CHECK(ReadsBack(file, terrain));
+
+		int rawHeights = 0, rawLayers = 0;
+		for(int k=0; k<16; k++)
+		{
+			rawHeights += file.GetChunk(TERRAIN_STREAM_HEIGHT, k%4, k/4).Codec==TERRAIN_CODEC_RAW ? 1 : 0;
+			rawLayers += file.GetChunk(TERRAIN_STREAM_LAYER, k%4, k/4).Codec==TERRAIN_CODEC_RAW ? 1 : 0;
+		}
+		TEST_CHECK(rawHeights==(pass==0 ? 0 : 16));
+		TEST_CHECK(rawLayers==(pass==1 ? 16 : 0));
+		file.Close();
+	}
+
+	// Compression pays for itself on the smooth terrain
+	TestTerrain terrain(200, 64, false, 23);
+	ULONGLONG sizes[2] = { 0, 0 };
+	for(int compress=0; compress<2; compress++)
+	{
+		terrain.Desc.Compress = compress!=0;
+		TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+		FILE* fp = fopen(g_szTerrainFileTest, "rb");
+		if(fp)
+		{
+			fseek(fp, 0, SEEK_END);
+			sizes[compress] = ftell(fp);
+			fclose(fp);
+		}
+	}
+	TEST_CHECK(sizes[1]>0 && sizes[1]<sizes[0]);
+	remove(g_szTerrainFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The first level of the pyramid is the height range of each cell, and a HeightBounds
+// built from it answers like one built from the heights
+//--------------------------------------------------------------------------------------
+SELF_TEST(TerrainFilePyramid)
+{
+	static const int cellSizes[] = { HEIGHT_BOUNDS_CELL, 32, 64 };
+	const int size = 200;
+	TestTerrain terrain(size, 64, false, 24);
+	D3DXFLOAT16* pHeights = new D3DXFLOAT16[size*size];
+	UINT state = 25;
+	for(int c=0; c<sizeof(cellSizes)/sizeof(cellSizes[0]); c++)
+	{
+		int cellSize = cellSizes[c];
+		terrain.Desc.PyramidCell = cellSize;
+		TerrainFile file;
+		if(!TEST_CHECK(TerrainFile::Write(g_szTerrainFileTest, terrain.Desc) && file.Open(g_szTerrainFileTest) &&
+			file.ReadHeights(pHeights, size)))
+			continue;
+		int cells = (size+cellSize-1)/cellSize;
+		const TerrainFileHeader& h = file.GetHeader();
+		TEST_CHECK(h.PyramidCell==(DWORD)cellSize && file.GetPyramidSize(0)==cells && file.GetPyramidSize(h.PyramidLevels-1)==1);
+
+		int wrong = 0;
+		float* pRanges = new float[cells*cells*2];
+		float minHeight = FLT_MAX, maxHeight = -FLT_MAX;
+		for(int cy=0; cy<cells; cy++)
+			for(int cx=0; cx<cells; cx++)
+			{
+				float cellMin = FLT_MAX, cellMax = -FLT_MAX;
+				for(int y=cy*cellSize; y<Math::Min(size, (cy+1)*cellSize); y++)
+					for(int x=cx*cellSize; x<Math::Min(size, (cx+1)*cellSize); x++)
+					{
+						cellMin = Math::Min(cellMin, (float)pHeights[y*size+x]);
+						cellMax = Math::Max(cellMax, (float)pHeights[y*size+x]);
+					}
+				float* pRange = pRanges + (cy*cells+cx)*2;
+				file.GetMinMax(0, cx, cy, pRange[0], pRange[1]);
+				wrong += (pRange[0]!=cellMin || pRange[1]!=cellMax) ? 1 : 0;
+				minHeight = Math::Min(minHeight, cellMin);
+				maxHeight = Math::Max(maxHeight, cellMax);
+			}
+		TEST_CHECK(wrong==0);
+
+		// The top of the pyramid is the whole range
+		float topMin, topMax;
+		file.GetMinMax(h.PyramidLevels-1, 0, 0, topMin, topMax);
+		TEST_CHECK(topMin==minHeight && topMax==maxHeight && h.MinHeight==minHeight && h.MaxHeight==maxHeight);
+
+		HeightBounds scanned, seeded;
+		if(TEST_CHECK(scanned.Create(pHeights, size, cellSize) && seeded.CreateFromRanges(pRanges, size, cellSize)))
+		{
+			int mismatches = 0;
+			for(int i=0; i<200; i++)
+			{
+				int x0 = TestRand(state)%size, y0 = TestRand(state)%size;
+				int x1 = x0 + 1 + TestRand(state)%size, y1 = y0 + 1 + TestRand(state)%size;
+				float mn0, mx0, mn1, mx1;
+				scanned.GetRange(x0, y0, x1, y1, mn0, mx0);
+				seeded.GetRange(x0, y0, x1, y1, mn1, mx1);
+				mismatches += (mn0!=mn1 || mx0!=mx1) ? 1 : 0;
+			}
+			TEST_CHECK(mismatches==0);
+		}
+		delete[] pRanges;
+	}
+	delete[] pHeights;
+
+	// Cells must be a power of two that divides the chunk
+	terrain.Desc.PyramidCell = 12;
+	TEST_CHECK(!TerrainFile::Write(g_szTerrainFileTest, terrain.Desc));
+	terrain.Desc.PyramidCell = 128;
+	TEST_CHECK(!TerrainFile::Write(g_szTerrainFileTest, terrain.Desc));
+	remove(g_szTerrainFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Open turns away damaged headers and tables, including counts whose table sizes wrap
+// around in 32 bits, and a damaged chunk fails the read
+//--------------------------------------------------------------------------------------
+SELF_TEST(TerrainFileRejects)
+{
+	TestTerrain terrain(200, 64, false, 30);
+	TerrainFile file;
+	remove(g_szTerrainFileTest);
+	TEST_CHECK(!file.Open(g_szTerrainFileTest));
+	TEST_CHECK(!file.IsOpen());
+
+	// An unpatched file still opens, so the failures below are the patches
+	TEST_CHECK(OpensPatched(terrain, offsetof(TerrainFileHeader, Size), 200));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, Magic), 0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, Version), TERRAIN_FILE_VERSION+1));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, Size), 0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, Size), 300));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, Size), TERRAIN_FILE_MAX_SIZE+1));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, ChunkSize), 0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, ChunksPerSide), 5));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, LayerCount), TERRAIN_FILE_LAYERS+1));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidLevels), 0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidLevels), 2));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidLevels), 33));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidCell), 0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidCell), 24));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidCell), 128));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidCell), 32));
+
+	// Cells bigger than a chunk, with the pyramid levels to match
+	DWORD bigCells[2] = { 2, 128 };
+	terrain.Desc.PyramidCell = 64;
+	TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+	PatchFile(g_szTerrainFileTest, offsetof(TerrainFileHeader, PyramidLevels), bigCells, sizeof(bigCells));
+	TEST_CHECK(!file.Open(g_szTerrainFileTest));
+	terrain.Desc.PyramidCell = HEIGHT_BOUNDS_CELL;
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, LayerOffset), 0xfffffff0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, PyramidOffset), 0xfffffff0));
+	TEST_CHECK(!OpensPatched(terrain, offsetof(TerrainFileHeader, IndexOffset), 0xfffffff0));
+
+	// 65536 single texel chunks a side comes to 2^32 chunks, which is none at all in 32
+	// bits, with the right pyramid for it and with one level that would wrap around as well
+	DWORD wrap[6] = { 65536, 1, 65536, 3, 17, 1 };
+	for(int levels=0; levels<2; levels++)
+	{
+		wrap[4] = levels ? 1 : 17;
+		TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+		PatchFile(g_szTerrainFileTest, offsetof(TerrainFileHeader, Size), wrap, sizeof(wrap));
+		TEST_CHECK(!file.Open(g_szTerrainFileTest));
+	}
+
+	// Chunks that run off the end of the file
+	TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+	if(!TEST_CHECK(file.Open(g_szTerrainFileTest)))
+		return;
+	TerrainFileHeader h = file.GetHeader();
+	TerrainFileChunk last = file.GetChunk(TERRAIN_STREAM_LAYER, 3, 3);
+	file.Close();
+	long lastEntry = h.IndexOffset + (2*16-1)*sizeof(TerrainFileChunk);
+	TEST_CHECK(!OpensPatched(terrain, lastEntry + offsetof(TerrainFileChunk, Bytes), last.Bytes+1));
+	TEST_CHECK(!OpensPatched(terrain, lastEntry + offsetof(TerrainFileChunk, Offset) + 4, 1));
+
+	// Cut off in the middle of the last chunk, and inside the header
+	UINT cutSize = (UINT)(last.Offset + last.Bytes/2);
+	BYTE* pData = new BYTE[cutSize];
+	TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+	FILE* fp = fopen(g_szTerrainFileTest, "rb");
+	size_t read = fp ? fread(pData, 1, cutSize, fp) : 0;
+	if(fp)
+		fclose(fp);
+	for(int cut=0; cut<2; cut++)
+	{
+		fp = fopen(g_szTerrainFileTest, "wb");
+		fwrite(pData, cut ? sizeof(TerrainFileHeader)-4 : read, 1, fp);
+		fclose(fp);
+		TEST_CHECK(!file.Open(g_szTerrainFileTest));
+	}
+	delete[] pData;
+
+	// Chunks that are inside the file but don't decode open, and fail the read
+	static const long damage[][2] = {
+		{ offsetof(TerrainFileChunk, Bytes), -1 },				// A packed height chunk one byte short
+		{ offsetof(TerrainFileChunk, Codec), 7 },				// An unknown codec
+		{ 16*sizeof(TerrainFileChunk) + offsetof(TerrainFileChunk, Codec), TERRAIN_CODEC_DELTA16 },	// Layers in the height codec
+	};
+	TerrainFileChunk first = { 0 };
+	if(TerrainFile::Write(g_szTerrainFileTest, terrain.Desc) && file.Open(g_szTerrainFileTest))
+		first = file.GetChunk(TERRAIN_STREAM_HEIGHT, 0, 0);
+	file.Close();
+	for(int d=0; d<sizeof(damage)/sizeof(damage[0]); d++)
+	{
+		DWORD value = damage[d][1]<0 ? first.Bytes-1 : (DWORD)damage[d][1];
+		if(TEST_CHECK(OpensPatched(terrain, h.IndexOffset + damage[d][0], value)))
+		{
+			file.Open(g_szTerrainFileTest);
+			TEST_CHECK(!ReadsBack(file, terrain));
+		}
+	}
+
+	// A raw chunk whose size doesn't match its width
+	terrain.Desc.Compress = false;
+	if(TEST_CHECK(OpensPatched(terrain, h.IndexOffset + offsetof(TerrainFileChunk, Bytes), 64*64*sizeof(D3DXFLOAT16)-2)))
+	{
+		file.Open(g_szTerrainFileTest);
+		TEST_CHECK(!ReadsBack(file, terrain));
+	}
+	file.Close();
+	remove(g_szTerrainFileTest);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times writing a large terrain and decoding it, across the thread pool and on one thread
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(TerrainFile)
+{
+	const int size = 2048;
+	TestTerrain terrain(size, TERRAIN_CHUNK_SIZE, false, 40);
+	double start = SelfTest::GetTime();
+	bool ok = TerrainFile::Write(g_szTerrainFileTest, terrain.Desc);
+	double writeTime = SelfTest::GetTime()-start;
+
+	TerrainFile file;
+	ok = ok && file.Open(g_szTerrainFileTest);
+	D3DXFLOAT16* pHeights = new D3DXFLOAT16[size*size];
+	BlendTexel* pLayers = new BlendTexel[size*size];
+	const int runs = 5;
+	start = SelfTest::GetTime();
+	for(int r=0; r<runs && ok; r++)
+		ok = file.ReadHeights(pHeights, size) && file.ReadLayers(pLayers, size);
+	double parallelTime = (SelfTest::GetTime()-start)/runs;
+
+	int chunksPerSide = ok ? file.GetHeader().ChunksPerSide : 0;
+	start = SelfTest::GetTime();
+	for(int r=0; r<runs && ok; r++)
+		for(int k=0; k<chunksPerSide*chunksPerSide; k++)
+		{
+			ok = ok && file.DecodeChunk(TERRAIN_STREAM_HEIGHT, k%chunksPerSide, k/chunksPerSide, (BYTE*)pHeights, size*sizeof(D3DXFLOAT16));
+			ok = ok && file.DecodeChunk(TERRAIN_STREAM_LAYER, k%chunksPerSide, k/chunksPerSide, (BYTE*)pLayers, size*sizeof(BlendTexel));
+		}
+	double serialTime = (SelfTest::GetTime()-start)/runs;
+	file.Close();
+	remove(g_szTerrainFileTest);
+	delete[] pHeights;
+	delete[] pLayers;
+
+	Log::Print("TerrainFile: %dx%d: write %.1fms, decode %.1fms on the pool, %.1fms on one thread%s", size, size,
+		writeTime, parallelTime, serialTime, ok ? "" : " (failed)");
+}
+
+#endif
@@ -0,0 +1,288 @@
+//--------------------------------------------------------------------------------------
+// File: TileCacheTests.cpp
+//
+// Self tests for the tile file builder and cache
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "TileCache.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+#define TILE_TEST_FILE "SelfTest.ptt"
+
+
+// Heights the tests build from, a different value at every texel
+static float TestHeight(int x, int y)
+{
+	return (float)((x*7 + y*13) % 256);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Hands out rows of the test heights and records how they were asked for
+//--------------------------------------------------------------------------------------
+struct TestRowSource
+{
+	int size;
+	int nextRow;		// Row the builder should ask for next
+	int maxCount;		// Most rows in one read
+	bool bInOrder;
+};
+
+static bool ReadTestRows(int y, int count, void* pDest, void* pData)
+{
+	TestRowSource& src = *(TestRowSource*)pData;
+	src.bInOrder = src.bInOrder && y==src.nextRow;
+	src.nextRow = y+count;
+	src.maxCount = Math::Max(src.maxCount, count);
+	D3DXFLOAT16* pOut = (D3DXFLOAT16*)pDest;
+	for(int i=0; i<count; i++)
+		for(int x=0; x<src.size; x++)
+			pOut[i*src.size+x] = D3DXFLOAT16(TestHeight(x, y+i));
+	return true;
+}
+
+
+// Builds a height file of the test heights from memory
+static bool BuildTestFile(int size, int levels, int tileSize)
+{
+	D3DXFLOAT16* pHeights = new D3DXFLOAT16[size*size];
+	for(int y=0; y<size; y++)
+		for(int x=0; x<size; x++)
+			pHeights[y*size+x] = D3DXFLOAT16(TestHeight(x, y));
+	bool ok = TileCache::Build(TILE_TEST_FILE, pHeights, size*sizeof(D3DXFLOAT16), size, levels, DXGI_FORMAT_R16_FLOAT, tileSize);
+	delete[] pHeights;
+	return ok;
+}
+
+// Reads the first texel of a top level tile, true if it has the right height
+static bool TouchTile(TileCache& cache, int tx, int ty)
+{
+	int ts = cache.GetTileSize();
+	return (float)*(const D3DXFLOAT16*)cache.GetTexel(0, tx*ts, ty*ts)==TestHeight(tx*ts, ty*ts);
+}
+
+
+//--------------------------------------------------------------------------------------
+// A height file built a band at a time reads back the source on the top level,
+// clamped at the edges, and the box filtered source on the next level
+//--------------------------------------------------------------------------------------
+SELF_TEST(TileCacheBuildBanded)
+{
+	const int size=1000, tileSize=256, levels=4;
+	TestRowSource src;
+	src.size = size;
+	src.nextRow = 0;
+	src.maxCount = 0;
+	src.bInOrder = true;
+	if(!TEST_CHECK(TileCache::Build(TILE_TEST_FILE, ReadTestRows, &src, size, levels, DXGI_FORMAT_R16_FLOAT, tileSize)))
+		return;
+	TEST_CHECK(src.bInOrder && src.nextRow==size);
+	TEST_CHECK(src.maxCount<=tileSize);
+
+	TileCache cache;
+	if(!TEST_CHECK(cache.Open(TILE_TEST_FILE, 8)))
+		return;
+	TEST_CHECK(cache.GetLevels()==levels);
+	TEST_CHECK(cache.GetMinValue()==0 && cache.GetMaxValue()==255);
+
+	for(int y=-3; y<size+3; y+=7)
+		for(int x=-3; x<size+3; x+=5)
+		{
+			float expected = TestHeight(Math::Min(Math::Max(x, 0), size-1), Math::Min(Math::Max(y, 0), size-1));
+			TEST_CHECK((float)*(const D3DXFLOAT16*)cache.GetTexel(0, x, y)==expected);
+		}
+
+	// Both sides of a band boundary on the next level
+	for(int y=126; y<130; y++)
+		for(int x=0; x<size/2; x+=31)
+		{
+			float box = (TestHeight(x*2, y*2) + TestHeight(x*2+1, y*2) + TestHeight(x*2, y*2+1) + TestHeight(x*2+1, y*2+1)) * 0.25f;
+			TEST_CHECK_NEAR((float)*(const D3DXFLOAT16*)cache.GetTexel(1, x, y), box, 0.125f);
+		}
+
+	cache.Close();
+	DeleteFileA(TILE_TEST_FILE);
+}
+
+
+//--------------------------------------------------------------------------------------
+// With the budget full the least recently used tile goes, and touching a tile again
+// saves it
+//--------------------------------------------------------------------------------------
+SELF_TEST(TileCacheEvictionOrder)
+{
+	const int tileSize=16;
+	TileCache cache;
+	if(!TEST_CHECK(BuildTestFile(64, 1, tileSize) && cache.Open(TILE_TEST_FILE, 3)))
+		return;
+
+	// Fill the budget, then use the first tile again
+	TEST_CHECK(TouchTile(cache, 0, 0) && TouchTile(cache, 1, 0) && TouchTile(cache, 2, 0));
+	TEST_CHECK(cache.GetStats().Misses==3 && cache.GetStats().Evictions==0);
+	TEST_CHECK(cache.GetStats().ResidentTiles==3 && cache.GetStats().ResidentBytes==3*tileSize*tileSize*sizeof(D3DXFLOAT16));
+	TEST_CHECK(TouchTile(cache, 0, 0));
+	TEST_CHECK(cache.GetStats().Hits==1);
+
+	// The second tile is the oldest now
+	TEST_CHECK(TouchTile(cache, 3, 0));
+	TEST_CHECK(cache.GetStats().Evictions==1 && cache.GetStats().ResidentTiles==3);
+	cache.ResetCounters();
+	TEST_CHECK(TouchTile(cache, 0, 0) && TouchTile(cache, 2, 0) && TouchTile(cache, 3, 0));
+	TEST_CHECK(cache.GetStats().Hits==3 && cache.GetStats().Misses==0);
+
+	// Which leaves the first tile the oldest, and the second maps back in its place
+	TEST_CHECK(TouchTile(cache, 1, 0));
+	TEST_CHECK(cache.GetStats().Misses==1 && cache.GetStats().Evictions==1);
+	TEST_CHECK(TouchTile(cache, 2, 0) && TouchTile(cache, 3, 0) && TouchTile(cache, 1, 0));
+	TEST_CHECK(cache.GetStats().Hits==6 && cache.GetStats().Misses==1);
+	TEST_CHECK(TouchTile(cache, 0, 0));
+	TEST_CHECK(cache.GetStats().Misses==2 && cache.GetStats().Evictions==2);
+
+	cache.Close();
+	DeleteFileA(TILE_TEST_FILE);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Prefetch maps every tile in the radius on every level, and with a small budget the
+// tile under the point is the one kept
+//--------------------------------------------------------------------------------------
+SELF_TEST(TileCachePrefetch)
+{
+	const int size=256, levels=3, tileSize=32, x=100, y=100, radius=40;
+	if(!TEST_CHECK(BuildTestFile(size, levels, tileSize)))
+		return;
+
+	// Level 0 covers tiles 1-4, level 1 tiles 0-2 and level 2 both of its tiles
+	TileCache cache;
+	if(TEST_CHECK(cache.Open(TILE_TEST_FILE, 64)))
+	{
+		cache.Prefetch(x, y, radius);
+		TEST_CHECK(cache.GetStats().ResidentTiles==16+9+4 && cache.GetStats().Misses==16+9+4);
+		cache.ResetCounters();
+		for(int level=0; level<levels; level++)
+			for(int dy=-radius; dy<=radius; dy+=3)
+				for(int dx=-radius; dx<=radius; dx+=3)
+					cache.GetTexel(level, (x>>level)+dx, (y>>level)+dy);
+		TEST_CHECK(cache.GetStats().Misses==0 && cache.GetStats().Hits>0);
+	}
+
+	// The coarse levels go first
+	if(TEST_CHECK(cache.Open(TILE_TEST_FILE, 5)))
+	{
+		cache.Prefetch(x, y, radius);
+		TEST_CHECK(cache.GetStats().ResidentTiles==5 && cache.GetStats().Evictions==16+9+4-5);
+		cache.ResetCounters();
+		TEST_CHECK((float)*(const D3DXFLOAT16*)cache.GetTexel(0, x, y)==TestHeight(x, y));
+		TEST_CHECK(cache.GetStats().Hits==1);
+		cache.GetTexel(2, x>>2, y>>2);
+		TEST_CHECK(cache.GetStats().Misses==1);
+	}
+
+	cache.Close();
+	DeleteFileA(TILE_TEST_FILE);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Regions across tile edges and off the map read back the texels clamped to the level,
+// with a budget small enough that tiles are evicted in the middle of a read
+//--------------------------------------------------------------------------------------
+SELF_TEST(TileCacheReadRegion)
+{
+	const int size=100, tileSize=32;
+	const struct { int level, x, y, w, h; } regions[] = {
+		{ 0,  -5,  -7,  50,  40 },	// Off the top left, across the first tile edges
+		{ 0,  80,  90,  30,  20 },	// Off the bottom right, through the partial tiles
+		{ 0, -10, -20, 150, 160 },	// Past every edge and the padding of the last tiles
+		{ 0,  31,  31,   2,   2 },	// Four tiles, one texel each
+		{ 1,  40,  -3,  20,  10 },	// Off two edges of the next level
+	};
+	TileCache cache;
+	if(!TEST_CHECK(BuildTestFile(size, 2, tileSize) && cache.Open(TILE_TEST_FILE, 2)))
+		return;
+
+	for(int r=0; r<sizeof(regions)/sizeof(regions[0]); r++)
+	{
+		const int level = regions[r].level;
+		const int w = regions[r].w;
+		const int h = regions[r].h;
+		const int levelSize = cache.GetLevelSize(level);
+
+		// The rows are padded to check the pitch is used
+		const int pitch = w+3;
+		D3DXFLOAT16* pRegion = new D3DXFLOAT16[pitch*h];
+		cache.ReadRegion(level, regions[r].x, regions[r].y, w, h, pRegion, pitch*sizeof(D3DXFLOAT16));
+		int wrong=0;
+		for(int j=0; j<h; j++)
+			for(int i=0; i<w; i++)
+			{
+				int sx = Math::Min(Math::Max(regions[r].x+i, 0), levelSize-1);
+				int sy = Math::Min(Math::Max(regions[r].y+j, 0), levelSize-1);
+				float expected = level==0 ? TestHeight(sx, sy) : (float)*(const D3DXFLOAT16*)cache.GetTexel(level, sx, sy);
+				if((float)pRegion[j*pitch+i]!=expected)
+					wrong++;
+			}
+		if(!TEST_CHECK(wrong==0))
+			Log::Print("    region %d: %d texels wrong", r, wrong);
+		delete[] pRegion;
+	}
+	TEST_CHECK(cache.GetStats().Evictions>0 && cache.GetStats().ResidentTiles==2);
+
+	cache.Close();
+	DeleteFileA(TILE_TEST_FILE);
+}
+
+
+//--------------------------------------------------------------------------------------
+// The scale is kept in the header, and a version 1 file without one still opens
+//--------------------------------------------------------------------------------------
+SELF_TEST(TileCacheScale)
+{
+	const int size=64;
+	D3DXFLOAT16 heights[size*size];
+	for(int y=0; y<size; y++)
+		for(int x=0; x<size; x++)
+			heights[y*size+x] = D3DXFLOAT16(TestHeight(x, y));
+
+	TileCache cache;
+	TEST_CHECK(TileCache::Build(TILE_TEST_FILE, heights, size*sizeof(D3DXFLOAT16), size, 2, DXGI_FORMAT_R16_FLOAT, 32, 200.0f));
+	if(TEST_CHECK(cache.Open(TILE_TEST_FILE, 4)))
+		TEST_CHECK(cache.GetScale()==200.0f);
+	cache.Close();
+	TEST_CHECK(TileCache::Build(TILE_TEST_FILE, heights, size*sizeof(D3DXFLOAT16), size, 2, DXGI_FORMAT_R16_FLOAT, 32));
+	if(TEST_CHECK(cache.Open(TILE_TEST_FILE, 4)))
+		TEST_CHECK(cache.GetScale()==1.0f);
+	cache.Close();
+
+	// Turn it into a version 1 file, the scale was never written there
+	TEST_CHECK(TileCache::Build(TILE_TEST_FILE, heights, size*sizeof(D3DXFLOAT16), size, 2, DXGI_FORMAT_R16_FLOAT, 32, 200.0f));
+	FILE* fp = fopen(TILE_TEST_FILE, "r+b");
+	if(TEST_CHECK(fp!=NULL))
+	{
+		TileFileHeader header;
+		fread(&header, sizeof(header), 1, fp);
+		header.Version = 1;
+		fseek(fp, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, fp);
+		fclose(fp);
+	}
+	if(TEST_CHECK(cache.Open(TILE_TEST_FILE, 4)))
+	{
+		TEST_CHECK(cache.GetScale()==0);
+		TEST_CHECK((float)*(const D3DXFLOAT16*)cache.GetTexel(0, 5, 9)==TestHeight(5, 9));
+	}
+	cache.Close();
+	DeleteFileA(TILE_TEST_FILE);
+}
+
+#endif
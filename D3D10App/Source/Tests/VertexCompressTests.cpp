@@ -0,0 +1,308 @@
+//--------------------------------------------------------------------------------------
+// File: VertexCompressTests.cpp
+//
+// Self tests and benchmark for the compact vertex formats
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "VertexCompress.h"
+#include "SelfTest.h"
+#include "Log.h"
+
+#ifdef PHASE_DEBUG
+
+using namespace Core;
+
+
+// Random skinned vertices with some normals straight up and down and some weights unused
+static void MakeSkinnedVertices(SkinnedVertex* pVerts, int numVerts, UINT seed)
+{
+	UINT state = seed*2654435761u + 1;
+	for(int i=0; i<numVerts; i++)
+	{
+		SkinnedVertex& v = pVerts[i];
+		v.pos = D3DXVECTOR3(TestRandFloat(state, -50, 50), TestRandFloat(state, -2, 2), TestRandFloat(state, 0, 300));
+		v.tu = TestRandFloat(state, -4, 4);
+		v.tv = TestRandFloat(state, 0, 1);
+		v.normal = D3DXVECTOR3(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1));
+		if(i%7==0)
+			v.normal = D3DXVECTOR3(0, 0, (i%2) ? 1.0f : -1.0f);
+		D3DXVec3Normalize(&v.normal, &v.normal);
+		v.weights = D3DXVECTOR4(TestRandFloat(state, 0, 1), TestRandFloat(state, 0, 1), 0, (i%3) ? 0 : TestRandFloat(state, 0, 1));
+		v.weights /= v.weights.x + v.weights.y + v.weights.z + v.weights.w;
+		for(int k=0; k<4; k++)
+			v.indices[k] = (UCHAR)(TestRand(state)%64);
+	}
+}
+
+// Angle between two unit vectors in degrees
+static float AngleBetween(const D3DXVECTOR3& a, const D3DXVECTOR3& b)
+{
+	D3DXVECTOR3 cross;
+	D3DXVec3Cross(&cross, &a, &b);
+	return D3DXToDegree(atan2f(D3DXVec3Length(&cross), D3DXVec3Dot(&a, &b)));
+}
+
+
+//--------------------------------------------------------------------------------------
+// The range spans the positions in 65535 steps, and an empty or flat mesh has nothing
+// to scale
+//--------------------------------------------------------------------------------------
+SELF_TEST(VertexQuantization)
+{
+	Vertex verts[3];
+	memset(verts, 0, sizeof(verts));
+	verts[0].pos = D3DXVECTOR3(-1, 5, 2);
+	verts[1].pos = D3DXVECTOR3(3, 5, -6);
+	verts[2].pos = D3DXVECTOR3(0, 5, 0);
+	VertexQuantization quant;
+	ComputeQuantization(verts, sizeof(Vertex), 3, quant);
+	TEST_CHECK(quant.Offset==D3DXVECTOR3(-1, 5, -6));
+	TEST_CHECK_NEAR(quant.Scale.x, 4/65535.0f, 1e-9f);
+	TEST_CHECK(quant.Scale.y==0);
+	TEST_CHECK_NEAR(quant.Scale.z, 8/65535.0f, 1e-9f);
+
+	// The corners land on the ends of the range, and the flat axis comes back exactly
+	CompactVertex compact[3];
+	CompressVertices(verts, 3, quant, compact);
+	TEST_CHECK(compact[0].pos[0]==0 && compact[1].pos[0]==65535 && compact[1].pos[2]==0 && compact[0].pos[2]==65535);
+	TEST_CHECK(compact[0].pos[1]==0 && compact[0].pos[3]==65535);
+	Vertex decoded[3];
+	DecompressVertices(compact, 3, quant, decoded);
+	TEST_CHECK(decoded[0].pos.y==5 && decoded[1].pos.y==5);
+
+	ComputeQuantization(verts, sizeof(Vertex), 0, quant);
+	TEST_CHECK(quant.Offset==D3DXVECTOR3(0, 0, 0) && quant.Scale==D3DXVECTOR3(0, 0, 0));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Octahedral normals bring the axes back exactly and everything else within a hundredth
+// of a degree, on both halves of the octahedron
+//--------------------------------------------------------------------------------------
+SELF_TEST(VertexNormalEncoding)
+{
+	const D3DXVECTOR3 axes[6] = {
+		D3DXVECTOR3(1, 0, 0), D3DXVECTOR3(-1, 0, 0), D3DXVECTOR3(0, 1, 0),
+		D3DXVECTOR3(0, -1, 0), D3DXVECTOR3(0, 0, 1), D3DXVECTOR3(0, 0, -1),
+	};
+	SHORT packed[2];
+	for(int a=0; a<6; a++)
+	{
+		EncodeNormal(axes[a], packed);
+		TEST_CHECK(DecodeNormal(packed)==axes[a]);
+	}
+
+	// Up is the middle of the square, down its corners
+	EncodeNormal(D3DXVECTOR3(0, 0, 1), packed);
+	TEST_CHECK(packed[0]==0 && packed[1]==0);
+	EncodeNormal(D3DXVECTOR3(0, 0, -1), packed);
+	TEST_CHECK(abs(packed[0])==32767 && abs(packed[1])==32767);
+
+	// The length doesn't matter, and a zero normal doesn't divide by zero
+	SHORT scaled[2];
+	EncodeNormal(D3DXVECTOR3(0.3f, -0.5f, -0.2f), packed);
+	EncodeNormal(D3DXVECTOR3(3.0f, -5.0f, -2.0f), scaled);
+	TEST_CHECK(packed[0]==scaled[0] && packed[1]==scaled[1]);
+	EncodeNormal(D3DXVECTOR3(0, 0, 0), packed);
+	TEST_CHECK(packed[0]==0 && packed[1]==0);
+
+	UINT state = 5;
+	float maxError = 0;
+	for(int i=0; i<10000; i++)
+	{
+		D3DXVECTOR3 n(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1));
+		if(D3DXVec3Length(&n)<0.01f)
+			continue;
+		D3DXVec3Normalize(&n, &n);
+		EncodeNormal(n, packed);
+		maxError = max(maxError, AngleBetween(n, DecodeNormal(packed)));
+	}
+	if(!TEST_CHECK(maxError < 0.01f))
+		Log::Print("VertexNormalEncoding: max error %f degrees", maxError);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Another hemisphere axis is the same packing with the components swapped around, so
+// the terrain's y up normals land in the middle of the square.  The sums run in another
+// order, so the last bit may differ.
+//--------------------------------------------------------------------------------------
+SELF_TEST(VertexNormalEncodingAxis)
+{
+	SHORT packed[2], swapped[2];
+	for(int axis=0; axis<3; axis++)
+	{
+		D3DXVECTOR3 up(0, 0, 0);
+		((float*)&up)[axis] = 1;
+		EncodeNormal(up, packed, axis);
+		TEST_CHECK(packed[0]==0 && packed[1]==0);
+		TEST_CHECK(DecodeNormal(packed, axis)==up);
+		EncodeNormal(-up, packed, axis);
+		TEST_CHECK(abs(packed[0])==32767 && abs(packed[1])==32767);
+		TEST_CHECK(DecodeNormal(packed, axis)==-up);
+	}
+
+	UINT state = 9;
+	int wrong = 0;
+	for(int i=0; i<1000; i++)
+	{
+		D3DXVECTOR3 n(TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1), TestRandFloat(state, -1, 1));
+		const D3DXVECTOR3 moved[3] = { D3DXVECTOR3(n.y, n.z, n.x), D3DXVECTOR3(n.x, n.z, n.y), n };
+		for(int axis=0; axis<3; axis++)
+		{
+			EncodeNormal(n, packed, axis);
+			EncodeNormal(moved[axis], swapped);
+			D3DXVECTOR3 d = DecodeNormal(packed, axis), m = DecodeNormal(swapped);
+			const D3DXVECTOR3 back[3] = { D3DXVECTOR3(m.z, m.x, m.y), D3DXVECTOR3(m.x, m.z, m.y), m };
+			D3DXVECTOR3 diff = d-back[axis];
+			if(abs(packed[0]-swapped[0])>1 || abs(packed[1]-swapped[1])>1 || D3DXVec3Length(&diff)>1e-4f)
+				wrong++;
+		}
+	}
+	TEST_CHECK(wrong==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Weights always add up to 255, with the leftover steps going to the largest remainders
+//--------------------------------------------------------------------------------------
+SELF_TEST(VertexWeightEncoding)
+{
+	BYTE w[4];
+	EncodeWeights(D3DXVECTOR4(1, 0, 0, 0), w);
+	TEST_CHECK(w[0]==255 && w[1]==0 && w[2]==0 && w[3]==0);
+
+	// An even split gives the odd step to the first
+	EncodeWeights(D3DXVECTOR4(0.5f, 0.5f, 0, 0), w);
+	TEST_CHECK(w[0]==128 && w[1]==127 && w[2]==0 && w[3]==0);
+	EncodeWeights(D3DXVECTOR4(1, 1, 1, 0), w);
+	TEST_CHECK(w[0]==85 && w[1]==85 && w[2]==85 && w[3]==0);
+
+	// Rounded down these come to 53, 84 and 117, and the step left goes to the largest
+	// remainder, 0.55 of the first.  Even quarters leave three steps for the first three.
+	EncodeWeights(D3DXVECTOR4(0.21f, 0.33f, 0.46f, 0), w);
+	TEST_CHECK(w[0]==54 && w[1]==84 && w[2]==117 && w[3]==0);
+	EncodeWeights(D3DXVECTOR4(0.25f, 0.25f, 0.25f, 0.25f), w);
+	TEST_CHECK(w[0]==64 && w[1]==64 && w[2]==64 && w[3]==63);
+
+	// Weights that don't add up to one are scaled, negative ones count as zero and
+	// nothing at all goes to the first bone
+	EncodeWeights(D3DXVECTOR4(2, 2, 0, 0), w);
+	TEST_CHECK(w[0]==128 && w[1]==127);
+	EncodeWeights(D3DXVECTOR4(-1, 0.5f, 0.5f, 0), w);
+	TEST_CHECK(w[0]==0 && w[1]==128 && w[2]==127 && w[3]==0);
+	EncodeWeights(D3DXVECTOR4(0, 0, 0, 0), w);
+	TEST_CHECK(w[0]==255 && w[1]==0 && w[2]==0 && w[3]==0);
+
+	UINT state = 9;
+	int badSums = 0;
+	for(int i=0; i<10000; i++)
+	{
+		D3DXVECTOR4 weights(TestRandFloat(state, 0, 1), TestRandFloat(state, 0, 1), TestRandFloat(state, 0, 1), TestRandFloat(state, 0, 1));
+		EncodeWeights(weights, w);
+		if(w[0]+w[1]+w[2]+w[3]!=255)
+			badSums++;
+	}
+	TEST_CHECK(badSums==0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Random skinned vertices come back within what each format allows, with the bone
+// indices untouched, and what was decoded compresses to the same bytes.  Plain vertices
+// go through the same packing.
+//--------------------------------------------------------------------------------------
+SELF_TEST(VertexCompressRoundTrip)
+{
+	const int numVerts = 5000;
+	SkinnedVertex* pVerts = new SkinnedVertex[numVerts];
+	MakeSkinnedVertices(pVerts, numVerts, 1);
+
+	VertexQuantization quant;
+	ComputeQuantization(pVerts, sizeof(SkinnedVertex), numVerts, quant);
+	CompactSkinnedVertex* pCompact = new CompactSkinnedVertex[numVerts];
+	CompactSkinnedVertex* pCompact2 = new CompactSkinnedVertex[numVerts];
+	SkinnedVertex* pDecoded = new SkinnedVertex[numVerts];
+	CompressVertices(pVerts, numVerts, quant, pCompact);
+	DecompressVertices(pCompact, numVerts, quant, pDecoded);
+	VertexCompressionStats stats;
+	MeasureCompression(pVerts, pDecoded, numVerts, stats);
+
+	// Half a step of each format plus float rounding, weights can be a whole step off
+	// since one may be rounded the wrong way to keep the sum
+	TEST_CHECK(stats.PosError>0 && stats.PosError <= 0.501f*D3DXVec3Length(&quant.Scale));
+	TEST_CHECK(stats.UVError <= 4.0f/2048);
+	TEST_CHECK(stats.NormalError < 0.01f);
+	TEST_CHECK(stats.WeightError <= 1.0f/255 + 1e-5f);
+	TEST_CHECK(stats.FullSize==numVerts*(sizeof(SkinnedVertex)+sizeof(PosVertex)) && stats.CompactSize==numVerts*sizeof(CompactSkinnedVertex));
+	int badVerts = 0;
+	for(int i=0; i<numVerts; i++)
+		if(pCompact[i].weights[0]+pCompact[i].weights[1]+pCompact[i].weights[2]+pCompact[i].weights[3]!=255 ||
+			memcmp(pCompact[i].indices, pVerts[i].indices, 4)!=0 || memcmp(pDecoded[i].indices, pVerts[i].indices, 4)!=0)
+			badVerts++;
+	TEST_CHECK(badVerts==0);
+	CompressVertices(pDecoded, numVerts, quant, pCompact2);
+	TEST_CHECK(memcmp(pCompact, pCompact2, numVerts*sizeof(CompactSkinnedVertex))==0);
+
+	// The same vertices without the skinning
+	Vertex* pPlain = new Vertex[numVerts];
+	Vertex* pPlainDecoded = new Vertex[numVerts];
+	CompactVertex* pPlainCompact = new CompactVertex[numVerts];
+	for(int i=0; i<numVerts; i++)
+	{
+		pPlain[i].pos = pVerts[i].pos;
+		pPlain[i].tu = pVerts[i].tu;
+		pPlain[i].tv = pVerts[i].tv;
+		pPlain[i].normal = pVerts[i].normal;
+	}
+	CompressVertices(pPlain, numVerts, quant, pPlainCompact);
+	DecompressVertices(pPlainCompact, numVerts, quant, pPlainDecoded);
+	VertexCompressionStats plainStats;
+	MeasureCompression(pPlain, pPlainDecoded, numVerts, plainStats);
+	TEST_CHECK(plainStats.PosError==stats.PosError && plainStats.UVError==stats.UVError && plainStats.NormalError==stats.NormalError);
+	TEST_CHECK(plainStats.WeightError==0 && plainStats.CompactSize==numVerts*sizeof(CompactVertex));
+
+	delete[] pVerts;
+	delete[] pCompact;
+	delete[] pCompact2;
+	delete[] pDecoded;
+	delete[] pPlain;
+	delete[] pPlainDecoded;
+	delete[] pPlainCompact;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times compressing and decoding a large skinned mesh
+//--------------------------------------------------------------------------------------
+SELF_BENCHMARK(VertexCompress)
+{
+	const int numVerts = 500000;
+	SkinnedVertex* pVerts = new SkinnedVertex[numVerts];
+	SkinnedVertex* pDecoded = new SkinnedVertex[numVerts];
+	CompactSkinnedVertex* pCompact = new CompactSkinnedVertex[numVerts];
+	MakeSkinnedVertices(pVerts, numVerts, 2);
+
+	double start = SelfTest::GetTime();
+	VertexQuantization quant;
+	ComputeQuantization(pVerts, sizeof(SkinnedVertex), numVerts, quant);
+	CompressVertices(pVerts, numVerts, quant, pCompact);
+	double compressTime = SelfTest::GetTime()-start;
+	start = SelfTest::GetTime();
+	DecompressVertices(pCompact, numVerts, quant, pDecoded);
+	double decompressTime = SelfTest::GetTime()-start;
+
+	VertexCompressionStats stats;
+	MeasureCompression(pVerts, pDecoded, numVerts, stats);
+	Log::Print("VertexCompress: %d vertices, %d to %d bytes: compress %.1fms, decompress %.1fms, position %f, uv %f, normal %f degrees, weight %f",
+		numVerts, stats.FullSize, stats.CompactSize, compressTime, decompressTime, stats.PosError, stats.UVError, stats.NormalError, stats.WeightError);
+	delete[] pVerts;
+	delete[] pDecoded;
+	delete[] pCompact;
+}
+
+#endif
@@ -9,6 +9,7 @@
 
 #include "stdafx.h"
 #include "Texture.h"
+#include "Material.h"
 
 namespace Core
 {
@@ -16,12 +17,18 @@ namespace Core
 	// The global texture manager
 	ResourceManager<Texture>  g_Textures;
 
+	// Stands in for streaming textures
+	ID3D10ShaderResourceView* Texture::m_pPlaceholder = NULL;
+
 	//--------------------------------------------------------------------------------------
 	// Constructor
 	//--------------------------------------------------------------------------------------
 	Texture::Texture()
 	{ 
 		m_pTex = NULL; 
+		m_Width = m_Height = 0;
+		m_MipLevels = 0;
+		m_Bytes = 0;
 	}
 
 	//--------------------------------------------------------------------------------------
@@ -77,9 +84,23 @@ namespace Core
 		}
 
 		// If the load was successful, store the new texture
+		SetResource(tTex, file);
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Takes a newly loaded texture
+	//--------------------------------------------------------------------------------------
+	void Texture::SetResource(ID3D10ShaderResourceView* pTex, const char* file)
+	{
+		// Materials bound to the old texture take the new one
 		if(m_pTex)
+		{
+			g_Materials.ReplaceTextureSRV(m_pTex, pTex);
 			Release();
-		m_pTex = tTex;
+		}
+		m_pTex = pTex;
 
 		// Get the width and height
 		ID3D10Resource* pRC;
@@ -89,13 +110,274 @@ namespace Core
 		pT->GetDesc(&desc);
 		m_Width = desc.Width;
 		m_Height = desc.Height;
+		m_MipLevels = (desc.MiscFlags & D3D10_RESOURCE_MISC_TEXTURECUBE) ? 1 : desc.MipLevels;
+		m_Bytes = ComputeBytes(desc);
 		pRC->Release();
 		
 		m_szName = String(file).ChopDirectory().c_str();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reads a texture file on a loader thread, trying the same paths as Load.  Only the
+	// header is parsed here, D3DX decodes the image when it is created.
+	//--------------------------------------------------------------------------------------
+	bool Texture::StreamDecode(const char* file)
+	{
+		String szFile = file;
+		String szPaths[3];
+		int numPaths = 0;
+		szPaths[numPaths++] = szFile;
+		if( (file[0]=='c'||file[0]=='C') && file[1]==':' )
+			szPaths[numPaths++] = g_szDirectory + szFile.ChopDirectory();
+		else
+		{
+			szPaths[numPaths++] = szFile.GetDirectory() + szFile.ChopDirectory();
+			szPaths[numPaths++] = g_szDirectory + file;
+		}
+
+		for(int i=0; i<numPaths; i++)
+		{
+			FILE* pFile = fopen(szPaths[i].c_str(), "rb");
+			if(!pFile)
+				continue;
+			fseek(pFile, 0, SEEK_END);
+			long size = ftell(pFile);
+			fseek(pFile, 0, SEEK_SET);
+			m_FileData.Allocate(size);
+			bool bRead = size>0 && fread((BYTE*)m_FileData, 1, size, pFile)==(size_t)size;
+			fclose(pFile);
+			if(bRead && SUCCEEDED(D3DX10GetImageInfoFromMemory(m_FileData, size, NULL, &m_FileInfo, NULL)))
+			{
+				m_szFile = szPaths[i];
+				return true;
+			}
+			m_FileData.Release();
+		}
+		return false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Video memory the texture will take, DDS files go up as they are and anything else
+	// gets a full mip chain of 32 bit texels
+	//--------------------------------------------------------------------------------------
+	UINT Texture::GetStreamBytes()
+	{
+		if(m_FileInfo.ImageFileFormat==D3DX10_IFF_DDS)
+			return m_FileData.Size();
+		return m_FileInfo.Width*m_FileInfo.Height*m_FileInfo.ArraySize*4*4/3;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Creates the texture from the file a loader read
+	//--------------------------------------------------------------------------------------
+	bool Texture::StreamUpload(const char* file)
+	{
+		Log::Print("%s", m_szFile.c_str());
+
+		D3DX10_IMAGE_LOAD_INFO info;
+		info.Usage = D3D10_USAGE_IMMUTABLE;
+		info.FirstMipLevel = 0;
+		info.MipLevels = 0;
+		ID3D10ShaderResourceView* tTex = NULL;
+		HRESULT hr = D3DX10CreateShaderResourceViewFromMemory( g_pd3dDevice,
+															   m_FileData,
+															   m_FileData.Size(),
+															   &info,
+															   NULL,
+															   &tTex, NULL );
+		m_FileData.Release();
+		if(FAILED(hr) || !tTex)
+		{
+			Log::Error( "Texture load failed> %s", m_szFile.c_str());
+			return false;
+		}
+		SetResource(tTex, m_szFile);
 		return true;
 	}
 
 
+	//--------------------------------------------------------------------------------------
+	// Bytes in a 4x4 block of a compressed format, 0 for others
+	//--------------------------------------------------------------------------------------
+	static UINT GetBlockBytes(DXGI_FORMAT format)
+	{
+		switch(format)
+		{
+		case DXGI_FORMAT_BC1_TYPELESS:
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_TYPELESS:
+		case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC4_SNORM:
+			return 8;
+		case DXGI_FORMAT_BC2_TYPELESS:
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_TYPELESS:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_TYPELESS:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC5_SNORM:
+			return 16;
+		}
+		return 0;
+	}
+
+	//--------------------------------------------------------------------------------------
+	// Bits in a texel of an uncompressed format, what D3DX loads images as by default
+	//--------------------------------------------------------------------------------------
+	static UINT GetTexelBits(DXGI_FORMAT format)
+	{
+		switch(format)
+		{
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		case DXGI_FORMAT_R32G32B32A32_UINT:
+			return 128;
+		case DXGI_FORMAT_R32G32B32_FLOAT:
+			return 96;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		case DXGI_FORMAT_R16G16B16A16_UNORM:
+		case DXGI_FORMAT_R32G32_FLOAT:
+			return 64;
+		case DXGI_FORMAT_R8G8_UNORM:
+		case DXGI_FORMAT_R16_FLOAT:
+		case DXGI_FORMAT_R16_UNORM:
+		case DXGI_FORMAT_B5G6R5_UNORM:
+		case DXGI_FORMAT_B5G5R5A1_UNORM:
+			return 16;
+		case DXGI_FORMAT_R8_UNORM:
+		case DXGI_FORMAT_A8_UNORM:
+			return 8;
+		}
+		return 32;
+	}
+
+	//--------------------------------------------------------------------------------------
+	// Device memory of a texture, all its levels and slices
+	//--------------------------------------------------------------------------------------
+	UINT Texture::ComputeBytes(const D3D10_TEXTURE2D_DESC& desc)
+	{
+		UINT blockBytes = GetBlockBytes(desc.Format);
+		UINT texelBits = GetTexelBits(desc.Format);
+		UINT bytes = 0;
+		for(UINT i=0; i<desc.MipLevels; i++)
+		{
+			UINT w = max(desc.Width>>i, 1u);
+			UINT h = max(desc.Height>>i, 1u);
+			if(blockBytes)
+				bytes += ((w+3)/4)*((h+3)/4)*blockBytes;
+			else
+				bytes += (w*h*texelBits)/8;
+		}
+		return bytes*desc.ArraySize;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Drops the largest mip levels.  The rest are copied into a smaller texture on the
+	// device, the file is only read again to get them back.  Returns the bytes left.
+	//--------------------------------------------------------------------------------------
+	UINT Texture::EvictMips(int levels)
+	{
+		if(!m_pTex || levels<=0 || m_MipLevels-levels<1)
+			return GetResidentBytes();
+
+		ID3D10Resource* pRC;
+		m_pTex->GetResource(&pRC);
+		ID3D10Texture2D* pOld = (ID3D10Texture2D*)pRC;
+		D3D10_TEXTURE2D_DESC desc;
+		pOld->GetDesc(&desc);
+		D3D10_TEXTURE2D_DESC newDesc = desc;
+		newDesc.Width = max(desc.Width>>levels, 1u);
+		newDesc.Height = max(desc.Height>>levels, 1u);
+		newDesc.MipLevels = desc.MipLevels-levels;
+		newDesc.Usage = D3D10_USAGE_DEFAULT;
+		newDesc.CPUAccessFlags = 0;
+
+		// Compressed textures have to stay whole blocks
+		ID3D10Texture2D* pNew = NULL;
+		if( (GetBlockBytes(desc.Format) && ((newDesc.Width&3) || (newDesc.Height&3))) ||
+			FAILED(g_pd3dDevice->CreateTexture2D(&newDesc, NULL, &pNew)) )
+		{
+			pRC->Release();
+			return m_Bytes;
+		}
+		for(UINT a=0; a<desc.ArraySize; a++)
+			for(UINT i=0; i<newDesc.MipLevels; i++)
+				g_pd3dDevice->CopySubresourceRegion(pNew, D3D10CalcSubresource(i, a, newDesc.MipLevels), 0, 0, 0,
+													pOld, D3D10CalcSubresource(i+levels, a, desc.MipLevels), NULL);
+		pRC->Release();
+
+		ID3D10ShaderResourceView* pSRV = NULL;
+		HRESULT hr = g_pd3dDevice->CreateShaderResourceView(pNew, NULL, &pSRV);
+		pNew->Release();
+		if(FAILED(hr))
+			return m_Bytes;
+
+		// Swap it in, the width and height stay those of the image
+		g_Materials.ReplaceTextureSRV(m_pTex, pSRV);
+		SAFE_RELEASE(m_pTex);
+		m_pTex = pSRV;
+		m_MipLevels -= levels;
+		m_Bytes = ComputeBytes(newDesc);
+		return m_Bytes;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Frees the texture, materials show the placeholder until it streams back in
+	//--------------------------------------------------------------------------------------
+	void Texture::Evict()
+	{
+		if(!m_pTex)
+			return;
+		g_Materials.ReplaceTextureSRV(m_pTex, GetPlaceholder());
+		Release();
+		m_bResident = false;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Flat grey texture for ones that are not loaded yet
+	//--------------------------------------------------------------------------------------
+	ID3D10ShaderResourceView* Texture::GetPlaceholder()
+	{
+		if(m_pPlaceholder || !g_pd3dDevice)
+			return m_pPlaceholder;
+
+		DWORD texel = 0xff808080;
+		D3D10_TEXTURE2D_DESC desc;
+		desc.Width = desc.Height = 1;
+		desc.MipLevels = desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.SampleDesc.Quality = 0;
+		desc.Usage = D3D10_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D10_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+		D3D10_SUBRESOURCE_DATA InitData;
+		InitData.pSysMem = &texel;
+		InitData.SysMemPitch = sizeof(DWORD);
+		InitData.SysMemSlicePitch = 0;
+		ID3D10Texture2D* pTex = NULL;
+		if(FAILED(g_pd3dDevice->CreateTexture2D(&desc, &InitData, &pTex)))
+			return NULL;
+		g_pd3dDevice->CreateShaderResourceView(pTex, NULL, &m_pPlaceholder);
+		pTex->Release();
+		return m_pPlaceholder;
+	}
+
+	void Texture::ReleasePlaceholder()
+	{
+		SAFE_RELEASE(m_pPlaceholder);
+	}
+
+
 	//--------------------------------------------------------------------------------------
 	// Frees the texture
 	//--------------------------------------------------------------------------------------
@@ -108,6 +390,9 @@ namespace Core
 			pRC->Release();
 		}
 		SAFE_RELEASE( m_pTex );
+		m_FileData.Release();
+		m_MipLevels = 0;
+		m_Bytes = 0;
 	}
 
 }
\ No newline at end of file
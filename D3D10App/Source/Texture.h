@@ -31,25 +31,59 @@ namespace Core
 			// Releases the texture
 			void Release();
 
-			inline ID3D10ShaderResourceView* GetResource(){ return m_pTex; }
+			// The placeholder stands in while the texture is streaming
+			inline ID3D10ShaderResourceView* GetResource(){ return (m_pTex || m_bResident) ? m_pTex : GetPlaceholder(); }
 			inline String GetName(){ return m_szName; }
 
 			// Automatic type convertion
-			inline operator ID3D10ShaderResourceView*() const
+			inline operator ID3D10ShaderResourceView*()
 			{
-				return m_pTex;
+				return GetResource();
 			}
 
 			inline int GetWidth(){ return m_Width; }
 			inline int GetHeight(){ return m_Height; }
 
+			// Streaming
+			inline bool IsResident(){ return m_bResident; }
+			bool StreamDecode(const char* file);
+			UINT GetStreamBytes();
+			bool StreamUpload(const char* file);
+
+			// Residency, mips are dropped by copying the smaller levels to a new texture
+			// and come back by streaming the file in again
+			inline int GetResidencyGroup(){ return RESIDENCY_TEXTURE; }
+			inline UINT GetResidentBytes(){ return m_pTex ? m_Bytes : 0; }
+			inline int GetNumMips(){ return m_pTex ? m_MipLevels : 0; }
+			UINT EvictMips(int levels);
+			void Evict();
+
+			// Flat grey texture for ones that are not loaded yet, made on first use
+			static ID3D10ShaderResourceView* GetPlaceholder();
+			static void ReleasePlaceholder();
+
 	protected:
 			ID3D10ShaderResourceView*		m_pTex;			// The texture pointer
 
 			// Loads a texture from file
 			bool LoadFromFile(const char* file);
 
+			// Takes a new texture
+			void SetResource(ID3D10ShaderResourceView* pTex, const char* file);
+
 			int m_Width,m_Height;
+			int m_MipLevels;		// Levels that can be dropped, 1 for cube maps
+			UINT m_Bytes;			// Device memory of the texture
+
+			// Device memory of a texture
+			static UINT ComputeBytes(const D3D10_TEXTURE2D_DESC& desc);
+
+			// Read by a loader thread while streaming
+			Array<BYTE>			m_FileData;		// The file
+			D3DX10_IMAGE_INFO	m_FileInfo;		// What is in it
+			String				m_szFile;		// Where it was found
+
+			static ID3D10ShaderResourceView*	m_pPlaceholder;
 	};
 
 	// The global texture manager
@@ -10,6 +10,28 @@
 
 ThreadPool g_ThreadPool;
 
+
+//--------------------------------------------------------------------------------------
+// A single band of a ParallelFor call
+//--------------------------------------------------------------------------------------
+class ParallelBand : public WorkerThread
+{
+public:
+	PARALLEL_FUNC	func;
+	void*			pData;
+	int				start;
+	int				end;
+	volatile long*	pRemaining;
+	HANDLE			hDone;
+
+	unsigned virtual ThreadExecute(){
+		func(start, end, pData);
+		if(InterlockedDecrement(pRemaining)==0)
+			SetEvent(hDone);
+		return 0;
+	}
+};
+
 ThreadPool::ThreadPool()
 {
 	m_nMaxNumThreads = MAXTHREADS;
@@ -63,7 +85,7 @@ BOOL ThreadPool::SubmitJob(WorkerThread* cWork)
 	
 	EnterCriticalSection(&CriticalSection); 
 	m_pQueue[m_nTopIndex] = cWork;
-	m_nTopIndex = (m_nTopIndex++) % (MAXQUEUE -1);
+	m_nTopIndex = (m_nTopIndex+1) % MAXQUEUE;
 	ReleaseSemaphore(m_Handles[TH_WORK],1,NULL);
 	LeaveCriticalSection(&CriticalSection);
 
@@ -79,7 +101,7 @@ BOOL ThreadPool::GetWork(WorkerThread** cWork)
 	
 	EnterCriticalSection(&CriticalSection); 
 	*cWork = m_pQueue[m_nBottomIndex];
-	m_nBottomIndex = (m_nBottomIndex++) % (MAXQUEUE -1);
+	m_nBottomIndex = (m_nBottomIndex+1) % MAXQUEUE;
 	ReleaseSemaphore(m_Handles[TH_EMPTY],1,NULL);
 	LeaveCriticalSection(&CriticalSection);
 
@@ -95,3 +117,44 @@ void ThreadPool::DestroyPool(){
 	DeleteCriticalSection(&CriticalSection);
 
 }
+
+
+//Runs a loop across the pool and waits for it to finish
+void ThreadPool::ParallelFor(int count, PARALLEL_FUNC func, void* pData, int minBand)
+{
+	if(count<=0)
+		return;
+	if(minBand<1)
+		minBand=1;
+
+	// One band per worker plus one for the calling thread
+	int numBands = m_nMaxNumThreads+1;
+	if(numBands > count/minBand)
+		numBands = count/minBand;
+	if(numBands<=1)
+	{
+		func(0, count, pData);
+		return;
+	}
+
+	ParallelBand bands[MAXTHREADS+1];
+	volatile long remaining = numBands-1;
+	HANDLE hDone = CreateEvent(NULL,TRUE,FALSE,NULL);
+	for(int i=0;i<numBands;i++)
+	{
+		bands[i].func = func;
+		bands[i].pData = pData;
+		bands[i].start = (int)(((__int64)count*i)/numBands);
+		bands[i].end = (int)(((__int64)count*(i+1))/numBands);
+		bands[i].pRemaining = &remaining;
+		bands[i].hDone = hDone;
+	}
+
+	// Queue up all but the last band, which runs here
+	for(int i=0;i<numBands-1;i++)
+		SubmitJob(&bands[i]);
+	func(bands[numBands-1].start, bands[numBands-1].end, pData);
+
+	WaitForSingleObject(hDone,INFINITE);
+	CloseHandle(hDone);
+}
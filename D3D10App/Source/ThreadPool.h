@@ -27,6 +27,12 @@ public:
 };
 
 
+//--------------------------------------------------------------------------------------
+// Callback for ThreadPool::ParallelFor, processes the range [start, end)
+//--------------------------------------------------------------------------------------
+typedef void (*PARALLEL_FUNC)(int start, int end, void* pData);
+
+
 
 //--------------------------------------------------------------------------------------
 // A pool of worker threads.  When a job is submitted, it is given its own thread.
@@ -44,6 +50,14 @@ public:
 	void DoWork();
 	void DestroyPool();
 
+	// Splits [0, count) into bands of at least minBand items and runs them on the
+	// pool.  The calling thread processes one band itself and blocks until every
+	// band has finished, so the function can simply be used like a loop.
+	void ParallelFor(int count, PARALLEL_FUNC func, void* pData, int minBand=1);
+
+	// Number of worker threads in the pool
+	inline int GetNumThreads(){ return m_nMaxNumThreads; }
+
 
 private:
 	long nWorkInProgress;
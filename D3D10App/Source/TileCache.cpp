@@ -0,0 +1,601 @@
+//--------------------------------------------------------------------------------------
+// File: TileCache.cpp
+//
+// Out-of-core tiled texture storage
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "Log.h"
+#include "TileCache.h"
+#include <float.h>
+
+namespace Core
+{
+
+// Views must start on the system allocation granularity
+#define TILE_ALIGNMENT 65536
+
+
+	//--------------------------------------------------------------------------------------
+	// Constructor
+	//--------------------------------------------------------------------------------------
+	TileCache::TileCache()
+	{
+		memset(&m_Header, 0, sizeof(TileFileHeader));
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+		m_LevelStart = NULL;
+		m_LevelTiles = NULL;
+		m_NumTiles = 0;
+		m_TileSlot = NULL;
+		m_EmptyTile = NULL;
+		m_Slots = NULL;
+		m_MaxSlots = 0;
+		m_UsedSlots = 0;
+		m_Head = m_Tail = -1;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// One level of the pyramid while a tile file is built.  Only a band of rows one
+	// tile high is kept, it is cut into tiles as soon as it fills.
+	//--------------------------------------------------------------------------------------
+	struct TileBuildLevel
+	{
+		int		size;			// Level dimension
+		int		numTiles;		// Tiles per side
+		int		firstTile;		// File slot of its first tile, after the header
+		BYTE*	pBand;			// Rows of the current tile row
+		int		bandRows;		// Rows in the band so far
+		int		bandIndex;		// Tile row the band belongs to
+		int		nextRow;		// Row of the level that arrives next
+		BYTE*	pEven;			// Even row waiting for the odd one below it
+		BYTE*	pDown;			// Row filtered for the next level
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// State for building a tile file
+	//--------------------------------------------------------------------------------------
+	struct TileBuilder
+	{
+		FILE*			fp;
+		TileFileHeader	header;
+		int				tileSize;
+		int				texelSize;
+		bool			average;		// Box filter half floats, otherwise point sample
+		int				numLevels;
+		TileBuildLevel*	pLevels;
+		BYTE*			pTile;
+		float*			pRow0;			// Box filter scratch, one top level row each
+		float*			pRow1;
+		float*			pOut;
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Cuts the band of a level into tiles and writes them to their slots
+	//--------------------------------------------------------------------------------------
+	static void WriteTileRow(TileBuilder& b, TileBuildLevel& l)
+	{
+		const int ts = b.tileSize;
+		const int texelSize = b.texelSize;
+		const size_t rowBytes = (size_t)l.size*texelSize;
+		for(int tx=0; tx<l.numTiles; tx++)
+		{
+			// Edge tiles repeat the last texel
+			for(int y=0; y<ts; y++)
+			{
+				const BYTE* pRow = l.pBand + Math::Min(y, l.bandRows-1)*rowBytes;
+				BYTE* pOut = b.pTile + (size_t)y*ts*texelSize;
+				for(int x=0; x<ts; x++)
+				{
+					int sx = Math::Min(tx*ts+x, l.size-1);
+					memcpy(pOut + x*texelSize, pRow + (size_t)sx*texelSize, texelSize);
+				}
+			}
+
+			__int64 slot = l.firstTile + (__int64)l.bandIndex*l.numTiles + tx;
+			_fseeki64(b.fp, slot*b.header.TileBytes, SEEK_SET);
+			fwrite(b.pTile, b.header.TileBytes, 1, b.fp);
+		}
+		l.bandRows = 0;
+		l.bandIndex++;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Adds the next row of a level.  Rows are filtered into the level below as they
+	// arrive, so the whole pyramid is built in one pass over the top level.
+	//--------------------------------------------------------------------------------------
+	static void AddTileRow(TileBuilder& b, int level, const BYTE* pRow)
+	{
+		TileBuildLevel& l = b.pLevels[level];
+		const size_t rowBytes = (size_t)l.size*b.texelSize;
+		BYTE* pDest = l.pBand + l.bandRows*rowBytes;
+		if(pRow!=pDest)
+			memcpy(pDest, pRow, rowBytes);
+		l.bandRows++;
+		const int r = l.nextRow++;
+
+		// Filter into the next level
+		if(level<b.numLevels-1)
+		{
+			const int nextSize = b.pLevels[level+1].size;
+			if(!b.average || l.size<2)
+			{
+				// Point sample the even texels
+				int step = l.size>1 ? 2 : 1;
+				if(r%step==0 && r/step<nextSize)
+				{
+					for(int x=0; x<nextSize; x++)
+						memcpy(l.pDown + x*b.texelSize, pDest + x*step*b.texelSize, b.texelSize);
+					AddTileRow(b, level+1, l.pDown);
+				}
+			}
+			else if((r&1)==0)
+				memcpy(l.pEven, pDest, rowBytes);
+			else if(r/2<nextSize)
+			{
+				// Box filter the half floats
+				D3DXFloat16To32Array(b.pRow0, (const D3DXFLOAT16*)l.pEven, l.size);
+				D3DXFloat16To32Array(b.pRow1, (const D3DXFLOAT16*)pDest, l.size);
+				for(int x=0; x<nextSize; x++)
+					b.pOut[x] = (b.pRow0[x*2] + b.pRow0[x*2+1] + b.pRow1[x*2] + b.pRow1[x*2+1]) * 0.25f;
+				D3DXFloat32To16Array((D3DXFLOAT16*)l.pDown, b.pOut, nextSize);
+				AddTileRow(b, level+1, l.pDown);
+			}
+		}
+
+		if(l.bandRows==b.tileSize || r==l.size-1)
+			WriteTileRow(b, l);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Reads rows out of an image in memory
+	//--------------------------------------------------------------------------------------
+	struct TileImageSource
+	{
+		const BYTE*	pData;
+		int			pitch;
+		int			rowBytes;
+	};
+
+	static bool ReadImageRows(int y, int count, void* pDest, void* pData)
+	{
+		const TileImageSource& src = *(const TileImageSource*)pData;
+		for(int i=0; i<count; i++)
+			memcpy((BYTE*)pDest + (size_t)i*src.rowBytes, src.pData + (size_t)(y+i)*src.pitch, src.rowBytes);
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Writes a tile file from a full resolution image
+	//--------------------------------------------------------------------------------------
+	bool TileCache::Build(const char* szFile, const void* pData, int pitch, int size, int levels, DXGI_FORMAT format, int tileSize, float scale)
+	{
+		TileImageSource src;
+		src.pData = (const BYTE*)pData;
+		src.pitch = pitch;
+		src.rowBytes = size*(format==DXGI_FORMAT_R16_FLOAT ? 2 : 4);
+		return Build(szFile, ReadImageRows, &src, size, levels, format, tileSize, scale);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Writes a tile file from rows of the top level read a band at a time
+	//--------------------------------------------------------------------------------------
+	bool TileCache::Build(const char* szFile, TILE_READ_FUNC readRows, void* pData, int size, int levels, DXGI_FORMAT format, int tileSize, float scale)
+	{
+		// Only the terrain formats are supported
+		int texelSize;
+		if(format==DXGI_FORMAT_R16_FLOAT)
+			texelSize = 2;
+		else if(format==DXGI_FORMAT_R8G8B8A8_UNORM)
+			texelSize = 4;
+		else
+		{
+			Log::Print("TileCache::Build() unsupported format> %s", szFile);
+			return false;
+		}
+
+		// Don't store levels smaller than a texel
+		int maxLevels = 1;
+		while((size>>maxLevels)>0)
+			maxLevels++;
+		Math::Clamp(levels, 1, maxLevels);
+
+		TileBuilder b;
+		b.fp = fopen(szFile, "wb");
+		if(!b.fp)
+		{
+			Log::Print("TileCache::Build() failed to open> %s", szFile);
+			return false;
+		}
+
+		// The header fills the first tile slot so every tile stays aligned
+		TileFileHeader& header = b.header;
+		header.Magic = TILE_FILE_MAGIC;
+		header.Version = TILE_FILE_VERSION;
+		header.Size = size;
+		header.TileSize = tileSize;
+		header.Levels = levels;
+		header.TexelSize = texelSize;
+		header.Format = format;
+		header.MinValue = header.MaxValue = 0;
+		header.Scale = scale;
+		int dataBytes = tileSize*tileSize*texelSize;
+		header.TileBytes = (dataBytes + TILE_ALIGNMENT-1) & ~(TILE_ALIGNMENT-1);
+
+		// A band for each level
+		b.tileSize = tileSize;
+		b.texelSize = texelSize;
+		b.average = (format==DXGI_FORMAT_R16_FLOAT);
+		b.numLevels = levels;
+		b.pLevels = new TileBuildLevel[levels];
+		int firstTile = 1;
+		for(int i=0; i<levels; i++)
+		{
+			TileBuildLevel& l = b.pLevels[i];
+			l.size = Math::Max(size>>i, 1);
+			l.numTiles = (l.size+tileSize-1) / tileSize;
+			l.firstTile = firstTile;
+			firstTile += l.numTiles*l.numTiles;
+			l.pBand = new BYTE[(size_t)tileSize*l.size*texelSize];
+			l.pEven = new BYTE[(size_t)l.size*texelSize];
+			l.pDown = new BYTE[(size_t)l.size*texelSize];
+			l.bandRows = l.bandIndex = l.nextRow = 0;
+		}
+		b.pTile = new BYTE[header.TileBytes];
+		memset(b.pTile, 0, header.TileBytes);
+		b.pRow0 = new float[size];
+		b.pRow1 = new float[size];
+		b.pOut = new float[size];
+
+		// Read the top level a tile row at a time, the levels below fill as it goes
+		bool ok = true;
+		if(b.average)
+		{
+			header.MinValue = FLT_MAX;
+			header.MaxValue = -FLT_MAX;
+		}
+		const size_t rowBytes = (size_t)size*texelSize;
+		for(int y=0; y<size && ok; y+=tileSize)
+		{
+			int count = Math::Min(tileSize, size-y);
+			TileBuildLevel& top = b.pLevels[0];
+			if(!readRows(y, count, top.pBand, pData))
+			{
+				Log::Print("TileCache::Build() failed reading rows %d-%d> %s", y, y+count, szFile);
+				ok = false;
+				break;
+			}
+
+			// Track the range of the top level
+			if(b.average)
+				for(int i=0; i<count; i++)
+				{
+					D3DXFloat16To32Array(b.pRow0, (const D3DXFLOAT16*)(top.pBand + i*rowBytes), size);
+					for(int x=0; x<size; x++)
+					{
+						header.MinValue = Math::Min(header.MinValue, b.pRow0[x]);
+						header.MaxValue = Math::Max(header.MaxValue, b.pRow0[x]);
+					}
+				}
+
+			for(int i=0; i<count; i++)
+				AddTileRow(b, 0, top.pBand + i*rowBytes);
+		}
+
+		// The header goes last, once the range is known
+		memset(b.pTile, 0, header.TileBytes);
+		memcpy(b.pTile, &header, sizeof(TileFileHeader));
+		_fseeki64(b.fp, 0, SEEK_SET);
+		fwrite(b.pTile, header.TileBytes, 1, b.fp);
+
+		for(int i=0; i<levels; i++)
+		{
+			delete[] b.pLevels[i].pBand;
+			delete[] b.pLevels[i].pEven;
+			delete[] b.pLevels[i].pDown;
+		}
+		delete[] b.pLevels;
+		delete[] b.pTile;
+		delete[] b.pRow0;
+		delete[] b.pRow1;
+		delete[] b.pOut;
+
+		ok = ok && (ferror(b.fp)==0);
+		fclose(b.fp);
+		if(!ok)
+			Log::Print("TileCache::Build() failed writing> %s", szFile);
+		return ok;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Opens a tile file
+	//--------------------------------------------------------------------------------------
+	bool TileCache::Open(const char* szFile, int maxTiles)
+	{
+		Close();
+
+		m_hFile = CreateFileA(szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+		if(m_hFile==INVALID_HANDLE_VALUE)
+		{
+			Log::Print("Tile file failed to open> %s", szFile);
+			return false;
+		}
+
+		// Check the header, version 1 files are the same without the scale
+		DWORD read = 0;
+		if(!ReadFile(m_hFile, &m_Header, sizeof(TileFileHeader), &read, NULL) || read!=sizeof(TileFileHeader) ||
+			m_Header.Magic!=TILE_FILE_MAGIC || m_Header.Version<1 || m_Header.Version>TILE_FILE_VERSION || m_Header.Levels==0)
+		{
+			Log::Print("Invalid tile file> %s", szFile);
+			Close();
+			return false;
+		}
+		if(m_Header.Version<2)
+			m_Header.Scale = 0;
+
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(!m_hMapping)
+		{
+			Log::Print("Tile file failed to map> %s", szFile);
+			Close();
+			return false;
+		}
+
+		// Tile layout
+		m_LevelStart = new int[m_Header.Levels];
+		m_LevelTiles = new int[m_Header.Levels];
+		m_NumTiles = 0;
+		for(UINT i=0; i<m_Header.Levels; i++)
+		{
+			m_LevelStart[i] = m_NumTiles;
+			m_LevelTiles[i] = (GetLevelSize(i)+m_Header.TileSize-1) / m_Header.TileSize;
+			m_NumTiles += m_LevelTiles[i]*m_LevelTiles[i];
+		}
+		m_TileSlot = new int[m_NumTiles];
+		for(int i=0; i<m_NumTiles; i++)
+			m_TileSlot[i] = -1;
+
+		// Residency slots
+		m_MaxSlots = Math::Max(maxTiles, 1);
+		m_Slots = new TileSlot[m_MaxSlots];
+		m_UsedSlots = 0;
+		m_Head = m_Tail = -1;
+
+		int dataBytes = m_Header.TileSize*m_Header.TileSize*m_Header.TexelSize;
+		m_EmptyTile = new BYTE[dataBytes];
+		memset(m_EmptyTile, 0, dataBytes);
+
+		m_Stats = TileCacheStats();
+		m_Stats.MaxTiles = m_MaxSlots;
+		return true;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Unmaps all tiles and closes the file
+	//--------------------------------------------------------------------------------------
+	void TileCache::Close()
+	{
+		for(int i=0; i<m_UsedSlots; i++)
+			UnmapViewOfFile(m_Slots[i].pData);
+		m_UsedSlots = 0;
+		m_Head = m_Tail = -1;
+
+		if(m_hMapping)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+		}
+		if(m_hFile!=INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hFile);
+			m_hFile = INVALID_HANDLE_VALUE;
+		}
+
+		SAFE_DELETE_ARRAY(m_LevelStart);
+		SAFE_DELETE_ARRAY(m_LevelTiles);
+		SAFE_DELETE_ARRAY(m_TileSlot);
+		SAFE_DELETE_ARRAY(m_Slots);
+		SAFE_DELETE_ARRAY(m_EmptyTile);
+		m_NumTiles = 0;
+		m_Stats = TileCacheStats();
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Slot list management
+	//--------------------------------------------------------------------------------------
+	void TileCache::Unlink(int slot)
+	{
+		TileSlot& s = m_Slots[slot];
+		if(s.prev>=0)
+			m_Slots[s.prev].next = s.next;
+		else
+			m_Head = s.next;
+		if(s.next>=0)
+			m_Slots[s.next].prev = s.prev;
+		else
+			m_Tail = s.prev;
+	}
+
+	void TileCache::PushFront(int slot)
+	{
+		TileSlot& s = m_Slots[slot];
+		s.prev = -1;
+		s.next = m_Head;
+		if(m_Head>=0)
+			m_Slots[m_Head].prev = slot;
+		m_Head = slot;
+		if(m_Tail<0)
+			m_Tail = slot;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Returns the mapped data for a tile
+	//--------------------------------------------------------------------------------------
+	const BYTE* TileCache::GetTile(int level, int tx, int ty)
+	{
+		int tile = m_LevelStart[level] + ty*m_LevelTiles[level] + tx;
+
+		// Already resident, just mark it as used
+		int slot = m_TileSlot[tile];
+		if(slot>=0)
+		{
+			m_Stats.Hits++;
+			if(slot!=m_Head)
+			{
+				Unlink(slot);
+				PushFront(slot);
+			}
+			return m_Slots[slot].pData;
+		}
+		m_Stats.Misses++;
+
+		// Grab a free slot or evict the least recently used tile
+		if(m_UsedSlots<m_MaxSlots)
+			slot = m_UsedSlots++;
+		else
+		{
+			slot = m_Tail;
+			Unlink(slot);
+			UnmapViewOfFile(m_Slots[slot].pData);
+			m_TileSlot[m_Slots[slot].tile] = -1;
+			m_Stats.Evictions++;
+		}
+
+		// Map the tile
+		ULONGLONG offset = (ULONGLONG)(tile+1) * m_Header.TileBytes;
+		int dataBytes = m_Header.TileSize*m_Header.TileSize*m_Header.TexelSize;
+		const BYTE* pData = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, (DWORD)(offset>>32), (DWORD)offset, dataBytes);
+		if(!pData)
+		{
+			// Give the slot back
+			Log::Print("TileCache failed to map tile %d", tile);
+			m_Slots[slot] = m_Slots[--m_UsedSlots];
+			if(slot!=m_UsedSlots)
+			{
+				TileSlot& s = m_Slots[slot];
+				m_TileSlot[s.tile] = slot;
+				if(s.prev>=0) m_Slots[s.prev].next = slot; else m_Head = slot;
+				if(s.next>=0) m_Slots[s.next].prev = slot; else m_Tail = slot;
+			}
+			m_Stats.ResidentTiles = m_UsedSlots;
+			m_Stats.ResidentBytes = (ULONGLONG)m_UsedSlots*dataBytes;
+			return m_EmptyTile;
+		}
+
+		m_Slots[slot].pData = pData;
+		m_Slots[slot].tile = tile;
+		m_TileSlot[tile] = slot;
+		PushFront(slot);
+
+		m_Stats.ResidentTiles = m_UsedSlots;
+		m_Stats.ResidentBytes = (ULONGLONG)m_UsedSlots*dataBytes;
+		return pData;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Pages in the tiles around a point
+	//--------------------------------------------------------------------------------------
+	void TileCache::Prefetch(int x, int y, int radius)
+	{
+		if(!IsOpen())
+			return;
+
+		int ts = m_Header.TileSize;
+		for(int level=m_Header.Levels-1; level>=0; level--)
+		{
+			// Tile range covered at this level
+			int lx = Math::FloorDiv(x, 1<<level);
+			int ly = Math::FloorDiv(y, 1<<level);
+			int maxTile = m_LevelTiles[level]-1;
+			int x0 = Math::FloorDiv(lx-radius, ts);
+			int x1 = Math::FloorDiv(lx+radius, ts);
+			int y0 = Math::FloorDiv(ly-radius, ts);
+			int y1 = Math::FloorDiv(ly+radius, ts);
+			Math::Clamp(x0, 0, maxTile);
+			Math::Clamp(x1, 0, maxTile);
+			Math::Clamp(y0, 0, maxTile);
+			Math::Clamp(y1, 0, maxTile);
+			int cx = Math::FloorDiv(lx, ts);
+			int cy = Math::FloorDiv(ly, ts);
+			Math::Clamp(cx, x0, x1);
+			Math::Clamp(cy, y0, y1);
+
+			// Walk the rings from the outside in
+			int rings = Math::Max(Math::Max(cx-x0, x1-cx), Math::Max(cy-y0, y1-cy));
+			for(int r=rings; r>=0; r--)
+			for(int ty=y0; ty<=y1; ty++)
+			for(int tx=x0; tx<=x1; tx++)
+			{
+				if(Math::Max(abs(tx-cx), abs(ty-cy))==r)
+					GetTile(level, tx, ty);
+			}
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Returns a pointer to a single texel
+	//--------------------------------------------------------------------------------------
+	const void* TileCache::GetTexel(int level, int x, int y)
+	{
+		int ts = m_Header.TileSize;
+		int levelSize = GetLevelSize(level);
+		Math::Clamp(x, 0, levelSize-1);
+		Math::Clamp(y, 0, levelSize-1);
+		const BYTE* pTile = GetTile(level, x/ts, y/ts);
+		return pTile + ((y%ts)*ts + x%ts)*m_Header.TexelSize;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Copies a region of a level
+	//--------------------------------------------------------------------------------------
+	void TileCache::ReadRegion(int level, int x, int y, int w, int h, void* pDest, int destPitch)
+	{
+		int ts = m_Header.TileSize;
+		int texelSize = m_Header.TexelSize;
+		int levelSize = GetLevelSize(level);
+		for(int j=0; j<h; j++)
+		{
+			int sy = y+j;
+			Math::Clamp(sy, 0, levelSize-1);
+			int ty = sy/ts;
+			int rowOffset = (sy%ts)*ts;
+			BYTE* pRow = (BYTE*)pDest + j*destPitch;
+			for(int i=0; i<w; )
+			{
+				// Clamped texels repeat the edge
+				int sx = x+i;
+				if(sx<0 || sx>=levelSize)
+				{
+					memcpy(pRow + i*texelSize, GetTexel(level, sx, sy), texelSize);
+					i++;
+					continue;
+				}
+
+				// Copy the run that lies inside this tile
+				int ox = sx%ts;
+				int run = Math::Min(Math::Min(ts-ox, levelSize-sx), w-i);
+				const BYTE* pTile = GetTile(level, sx/ts, ty);
+				memcpy(pRow + i*texelSize, pTile + (rowOffset+ox)*texelSize, run*texelSize);
+				i += run;
+			}
+		}
+	}
+
+}
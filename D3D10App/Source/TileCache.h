@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// File: TileCache.h
+//
+// Out-of-core tiled texture storage.  A tile file holds a full mip pyramid cut into
+// square tiles, and the cache keeps a bounded set of them memory mapped, evicting
+// the least recently used tiles as the camera moves.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "QMath.h"
+
+namespace Core
+{
+
+#define TILE_FILE_MAGIC		0x31545450	// "PTT1"
+#define TILE_FILE_VERSION	2
+#define TILE_DEFAULT_SIZE	256
+
+	// Header at the start of a tile file
+	struct TileFileHeader
+	{
+		DWORD Magic;
+		DWORD Version;
+		DWORD Size;			// Dimension of the top level
+		DWORD TileSize;		// Dimension of each tile
+		DWORD Levels;		// Number of mip levels stored
+		DWORD TexelSize;	// Bytes per texel
+		DWORD TileBytes;	// Stride between tiles, aligned to the mapping granularity
+		DWORD Format;		// DXGI_FORMAT of the texels
+		float MinValue;		// Range of the top level, only set for float formats
+		float MaxValue;
+		float Scale;		// Scale the values are used with, 0 in version 1 files
+	};
+
+	// Reads count rows of an image starting at row y into pDest, tightly packed.
+	// Returns false if they could not be read.
+	typedef bool (*TILE_READ_FUNC)(int y, int count, void* pDest, void* pData);
+
+	// Residency counters
+	struct TileCacheStats
+	{
+		int ResidentTiles;
+		int MaxTiles;
+		ULONGLONG ResidentBytes;
+		int Hits;
+		int Misses;
+		int Evictions;
+		TileCacheStats(){
+			ResidentTiles=MaxTiles=ResidentBytes=Hits=Misses=Evictions=0;
+		}
+	};
+
+
+	class TileCache
+	{
+	public:
+		TileCache();
+		~TileCache(){ Close(); }
+
+		// Writes a tile file from a full resolution image.  Half float images are box
+		// filtered down the pyramid, anything else is point sampled.  scale is stored
+		// in the header for whoever reads the values, such as the terrain height scale.
+		static bool Build(const char* szFile, const void* pData, int pitch, int size, int levels,
+			DXGI_FORMAT format, int tileSize=TILE_DEFAULT_SIZE, float scale=1.0f);
+
+		// Same, reading the image a tile row at a time so only one band of each level
+		// is held in memory
+		static bool Build(const char* szFile, TILE_READ_FUNC readRows, void* pData, int size, int levels,
+			DXGI_FORMAT format, int tileSize=TILE_DEFAULT_SIZE, float scale=1.0f);
+
+		// Opens a tile file, maxTiles is the residency budget
+		bool Open(const char* szFile, int maxTiles);
+
+		// Unmaps all tiles and closes the file
+		void Close();
+
+		// Properties
+		inline bool IsOpen(){ return m_hMapping!=NULL; }
+		inline int GetSize(){ return m_Header.Size; }
+		inline int GetLevelSize(int level){ return Math::Max((int)m_Header.Size>>level, 1); }
+		inline int GetLevels(){ return m_Header.Levels; }
+		inline int GetTileSize(){ return m_Header.TileSize; }
+		inline int GetTexelSize(){ return m_Header.TexelSize; }
+		inline DXGI_FORMAT GetFormat(){ return (DXGI_FORMAT)m_Header.Format; }
+		inline float GetMinValue(){ return m_Header.MinValue; }
+		inline float GetMaxValue(){ return m_Header.MaxValue; }
+		inline float GetScale(){ return m_Header.Scale; }
+		inline const TileCacheStats& GetStats(){ return m_Stats; }
+
+		// Clears the hit, miss and eviction counters
+		inline void ResetCounters(){ m_Stats.Hits=m_Stats.Misses=m_Stats.Evictions=0; }
+
+		// Pages in the tiles around a point given in top level texel coordinates,
+		// nearest tiles are touched last so they are the last to be evicted.
+		// Each level covers radius texels of its own resolution.
+		void Prefetch(int x, int y, int radius);
+
+		// Returns a pointer to a single texel, mapping its tile if needed.
+		// Coordinates are clamped to the level.
+		const void* GetTexel(int level, int x, int y);
+
+		// Copies a region of a level into pDest, coordinates outside the level
+		// are clamped to the edge
+		void ReadRegion(int level, int x, int y, int w, int h, void* pDest, int destPitch);
+
+	private:
+
+		// Resident tile slot, slots form a doubly linked LRU list
+		struct TileSlot
+		{
+			const BYTE*	pData;
+			int			tile;
+			int			prev;
+			int			next;
+		};
+
+		// Returns the mapped data for a tile
+		const BYTE* GetTile(int level, int tx, int ty);
+
+		// Slot list management
+		void Unlink(int slot);
+		void PushFront(int slot);
+
+		TileFileHeader	m_Header;
+		HANDLE			m_hFile;
+		HANDLE			m_hMapping;
+
+		int*			m_LevelStart;		// Index of the first tile in each level
+		int*			m_LevelTiles;		// Tiles per side of each level
+		int				m_NumTiles;
+		int*			m_TileSlot;			// Slot holding each tile, or -1
+
+		BYTE*			m_EmptyTile;		// Returned if a tile can't be mapped
+
+		TileSlot*		m_Slots;
+		int				m_MaxSlots;
+		int				m_UsedSlots;
+		int				m_Head;				// Most recently used
+		int				m_Tail;				// Least recently used
+
+		TileCacheStats	m_Stats;
+	};
+
+}
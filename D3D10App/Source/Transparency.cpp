@@ -48,8 +48,9 @@ namespace Core
 		// World matrix
 		Device::Effect->WorldMatrixVariable->SetMatrix( (float*)mesh.pWorldMatrix );
 
-		// Set the material
+		// Set the material and input layout
 		Device::SetMaterial(*mesh.pMaterial);
+		Device::SetVertexFormat(mesh);
 		
 		// Get the number of lights
 #ifdef PHASE_DEBUG
@@ -16,7 +16,10 @@ namespace Core
 	// Statics
 	ID3D10InputLayout* Vertex::pInputLayout = NULL;
 	ID3D10InputLayout* SkinnedVertex::pInputLayout = NULL;
+	ID3D10InputLayout* CompactVertex::pInputLayout = NULL;
+	ID3D10InputLayout* CompactSkinnedVertex::pInputLayout = NULL;
 	ID3D10InputLayout* PosVertex::pInputLayout = NULL;
+	ID3D10InputLayout* InstanceVertex::pInputLayout = NULL;
 
 	// Vertex format
 	const D3D10_INPUT_ELEMENT_DESC Vertex::Desc[3] = 
@@ -33,13 +36,40 @@ namespace Core
 		{ "WEIGHTS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 32, D3D10_INPUT_PER_VERTEX_DATA, 0 },
 		{ "BONES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 48, D3D10_INPUT_PER_VERTEX_DATA, 0 },
 	};
+	const D3D10_INPUT_ELEMENT_DESC CompactVertex::Desc[3] = 
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D10_INPUT_PER_VERTEX_DATA, 0 },  
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 8, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+	};
+	const D3D10_INPUT_ELEMENT_DESC CompactSkinnedVertex::Desc[5] = 
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D10_INPUT_PER_VERTEX_DATA, 0 },  
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 8, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 12, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "WEIGHTS", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, 16, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "BONES", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, 20, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+	};
 	const D3D10_INPUT_ELEMENT_DESC PosVertex::Desc[1] = 
 	{
 		{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D10_INPUT_PER_VERTEX_DATA, 0 },  
 	};
+	const D3D10_INPUT_ELEMENT_DESC InstanceVertex::Desc[7] = 
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D10_INPUT_PER_VERTEX_DATA, 0 },  
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 12, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 20, D3D10_INPUT_PER_VERTEX_DATA, 0 },
+		{ "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "WORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+		{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 48, D3D10_INPUT_PER_INSTANCE_DATA, 1 },
+	};
 
 	const UINT Vertex::size = sizeof(Vertex);
 	const UINT SkinnedVertex::size = sizeof(SkinnedVertex);
+	const UINT CompactVertex::size = sizeof(CompactVertex);
+	const UINT CompactSkinnedVertex::size = sizeof(CompactSkinnedVertex);
 	const UINT PosVertex::size = sizeof(PosVertex);
+	const UINT InstanceVertex::size = sizeof(InstanceVertex);
 
 }
@@ -40,6 +40,37 @@ namespace Core
 		static const UINT size;
 	};
 
+	//--------------------------------------------------------------------------------------
+	// Compact Vertex, see VertexCompress.h.  The position is a fraction of the mesh
+	// bounds with w at one, and the normal is octahedral.
+	//--------------------------------------------------------------------------------------
+	struct CompactVertex
+	{
+		USHORT pos[4];		// Position
+		USHORT tex[2];		// Half float texture coords
+		SHORT normal[2];	// Normal
+
+		static ID3D10InputLayout* pInputLayout;
+		static const D3D10_INPUT_ELEMENT_DESC Desc[3];
+		static const UINT size;
+	};
+
+	//--------------------------------------------------------------------------------------
+	// Compact SkinnedVertex
+	//--------------------------------------------------------------------------------------
+	struct CompactSkinnedVertex
+	{
+		USHORT pos[4];		// Position
+		USHORT tex[2];		// Half float texture coords
+		SHORT normal[2];	// Normal
+		BYTE weights[4];	// Blend weights
+		UCHAR indices[4];	// Bone indices
+
+		static ID3D10InputLayout* pInputLayout;
+		static const D3D10_INPUT_ELEMENT_DESC Desc[5];
+		static const UINT size;
+	};
+
 	//--------------------------------------------------------------------------------------
 	// Phase Engine vertex with only position
 	//--------------------------------------------------------------------------------------
@@ -53,4 +84,20 @@ namespace Core
 		static const D3D10_INPUT_ELEMENT_DESC Desc[1];
 		static const UINT size;
 	};
+
+	//--------------------------------------------------------------------------------------
+	// Per-instance data for instanced billboards.  The layout reads a standard Vertex
+	// from slot 0 and one of these per instance from slot 1.
+	//--------------------------------------------------------------------------------------
+	struct InstanceVertex
+	{
+		D3DXVECTOR4 world1;	// World transform rows, with the translation in w
+		D3DXVECTOR4 world2;
+		D3DXVECTOR4 world3;
+		D3DXVECTOR4 color;	// Color
+
+		static ID3D10InputLayout* pInputLayout;
+		static const D3D10_INPUT_ELEMENT_DESC Desc[7];
+		static const UINT size;
+	};
 }
@@ -0,0 +1,259 @@
+//--------------------------------------------------------------------------------------
+// File: VertexCompress.cpp
+//
+// Conversion between the full and compact vertex formats
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+
+#include "stdafx.h"
+#include "VertexCompress.h"
+#include <float.h>
+
+namespace Core
+{
+
+	//--------------------------------------------------------------------------------------
+	// Finds the position range
+	//--------------------------------------------------------------------------------------
+	void ComputeQuantization(const void* pVerts, UINT stride, int numVerts, VertexQuantization& quant)
+	{
+		D3DXVECTOR3 vMin(FLT_MAX, FLT_MAX, FLT_MAX), vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(int i=0; i<numVerts; i++)
+		{
+			const D3DXVECTOR3& pos = *(const D3DXVECTOR3*)((const BYTE*)pVerts + i*stride);
+			D3DXVec3Minimize(&vMin, &vMin, &pos);
+			D3DXVec3Maximize(&vMax, &vMax, &pos);
+		}
+		if(numVerts==0)
+			vMin = vMax = D3DXVECTOR3(0, 0, 0);
+		quant.Offset = vMin;
+		quant.Scale = (vMax-vMin) / 65535.0f;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Scalar packing
+	//--------------------------------------------------------------------------------------
+	static inline USHORT QuantizePos(float p, float offset, float scale)
+	{
+		if(scale<=0)
+			return 0;
+		float q = floorf((p-offset)/scale + 0.5f);
+		return (USHORT)(q<0 ? 0 : (q>65535 ? 65535 : q));
+	}
+
+	static inline SHORT ToSnorm16(float f)
+	{
+		float q = floorf(f*32767.0f + 0.5f);
+		return (SHORT)(q<-32767 ? -32767 : (q>32767 ? 32767 : q));
+	}
+
+	static inline float FromSnorm16(SHORT s)
+	{
+		return max(s/32767.0f, -1.0f);
+	}
+
+	static inline float Sign(float f)
+	{
+		return f>=0 ? 1.0f : -1.0f;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Octahedral normals.  The lower half of the octahedron is folded out over the
+	// corners of the square.
+	//--------------------------------------------------------------------------------------
+	void EncodeNormal(const D3DXVECTOR3& normal, SHORT* pOut, int axis)
+	{
+		const float* n = (const float*)&normal;
+		const int u = axis==0 ? 1 : 0;
+		const int v = axis==2 ? 1 : 2;
+		float length = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+		if(length<=0)
+		{
+			pOut[0] = pOut[1] = 0;
+			return;
+		}
+		float x = n[u]/length, y = n[v]/length;
+		if(n[axis]<0)
+		{
+			float fx = (1-fabsf(y))*Sign(x);
+			y = (1-fabsf(x))*Sign(y);
+			x = fx;
+		}
+		pOut[0] = ToSnorm16(x);
+		pOut[1] = ToSnorm16(y);
+	}
+
+	D3DXVECTOR3 DecodeNormal(const SHORT* pIn, int axis)
+	{
+		float x = FromSnorm16(pIn[0]), y = FromSnorm16(pIn[1]);
+		float up = 1 - fabsf(x) - fabsf(y);
+		if(up<0)
+		{
+			float fx = (1-fabsf(y))*Sign(x);
+			y = (1-fabsf(x))*Sign(y);
+			x = fx;
+		}
+		D3DXVECTOR3 normal;
+		float* n = (float*)&normal;
+		n[axis==0 ? 1 : 0] = x;
+		n[axis==2 ? 1 : 2] = y;
+		n[axis] = up;
+		D3DXVec3Normalize(&normal, &normal);
+		return normal;
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Rounds the weights down and hands what is left to the largest remainders
+	//--------------------------------------------------------------------------------------
+	void EncodeWeights(const D3DXVECTOR4& weights, BYTE* pOut)
+	{
+		float w[4] = { max(weights.x, 0.0f), max(weights.y, 0.0f), max(weights.z, 0.0f), max(weights.w, 0.0f) };
+		float sum = w[0] + w[1] + w[2] + w[3];
+		if(sum<=0)
+		{
+			pOut[0] = 255;
+			pOut[1] = pOut[2] = pOut[3] = 0;
+			return;
+		}
+		float remainder[4];
+		int total = 0;
+		for(int i=0; i<4; i++)
+		{
+			float f = w[i]*255.0f/sum;
+			pOut[i] = (BYTE)min(floorf(f), 255.0f);
+			remainder[i] = f - pOut[i];
+			total += pOut[i];
+		}
+		while(total<255)
+		{
+			int best = 0;
+			for(int i=1; i<4; i++)
+				if(remainder[i]>remainder[best])
+					best = i;
+			pOut[best]++;
+			remainder[best] -= 1;
+			total++;
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Members both vertex types share
+	//--------------------------------------------------------------------------------------
+	static inline void CompressCommon(const D3DXVECTOR3& pos, float tu, float tv, const D3DXVECTOR3& normal,
+		const VertexQuantization& quant, USHORT* pPos, USHORT* pTex, SHORT* pNormal)
+	{
+		pPos[0] = QuantizePos(pos.x, quant.Offset.x, quant.Scale.x);
+		pPos[1] = QuantizePos(pos.y, quant.Offset.y, quant.Scale.y);
+		pPos[2] = QuantizePos(pos.z, quant.Offset.z, quant.Scale.z);
+		pPos[3] = 65535;
+		float tex[2] = { tu, tv };
+		D3DXFloat32To16Array((D3DXFLOAT16*)pTex, tex, 2);
+		EncodeNormal(normal, pNormal);
+	}
+
+	static inline void DecompressCommon(const USHORT* pPos, const USHORT* pTex, const SHORT* pNormal,
+		const VertexQuantization& quant, D3DXVECTOR3& pos, float& tu, float& tv, D3DXVECTOR3& normal)
+	{
+		pos.x = quant.Offset.x + pPos[0]*quant.Scale.x;
+		pos.y = quant.Offset.y + pPos[1]*quant.Scale.y;
+		pos.z = quant.Offset.z + pPos[2]*quant.Scale.z;
+		float tex[2];
+		D3DXFloat16To32Array(tex, (const D3DXFLOAT16*)pTex, 2);
+		tu = tex[0];
+		tv = tex[1];
+		normal = DecodeNormal(pNormal);
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Whole arrays
+	//--------------------------------------------------------------------------------------
+	void CompressVertices(const Vertex* pVerts, int numVerts, const VertexQuantization& quant, CompactVertex* pOut)
+	{
+		for(int i=0; i<numVerts; i++)
+			CompressCommon(pVerts[i].pos, pVerts[i].tu, pVerts[i].tv, pVerts[i].normal, quant, pOut[i].pos, pOut[i].tex, pOut[i].normal);
+	}
+
+	void CompressVertices(const SkinnedVertex* pVerts, int numVerts, const VertexQuantization& quant, CompactSkinnedVertex* pOut)
+	{
+		for(int i=0; i<numVerts; i++)
+		{
+			CompressCommon(pVerts[i].pos, pVerts[i].tu, pVerts[i].tv, pVerts[i].normal, quant, pOut[i].pos, pOut[i].tex, pOut[i].normal);
+			EncodeWeights(pVerts[i].weights, pOut[i].weights);
+			memcpy(pOut[i].indices, pVerts[i].indices, sizeof(pOut[i].indices));
+		}
+	}
+
+	void DecompressVertices(const CompactVertex* pVerts, int numVerts, const VertexQuantization& quant, Vertex* pOut)
+	{
+		for(int i=0; i<numVerts; i++)
+			DecompressCommon(pVerts[i].pos, pVerts[i].tex, pVerts[i].normal, quant, pOut[i].pos, pOut[i].tu, pOut[i].tv, pOut[i].normal);
+	}
+
+	void DecompressVertices(const CompactSkinnedVertex* pVerts, int numVerts, const VertexQuantization& quant, SkinnedVertex* pOut)
+	{
+		for(int i=0; i<numVerts; i++)
+		{
+			DecompressCommon(pVerts[i].pos, pVerts[i].tex, pVerts[i].normal, quant, pOut[i].pos, pOut[i].tu, pOut[i].tv, pOut[i].normal);
+			pOut[i].weights = D3DXVECTOR4(pVerts[i].weights[0], pVerts[i].weights[1], pVerts[i].weights[2], pVerts[i].weights[3]) / 255.0f;
+			memcpy(pOut[i].indices, pVerts[i].indices, sizeof(pOut[i].indices));
+		}
+	}
+
+
+	//--------------------------------------------------------------------------------------
+	// Error of the members both vertex types share
+	//--------------------------------------------------------------------------------------
+	static void MeasureCommon(const D3DXVECTOR3& pos0, float tu0, float tv0, const D3DXVECTOR3& normal0,
+		const D3DXVECTOR3& pos1, float tu1, float tv1, const D3DXVECTOR3& normal1, VertexCompressionStats& stats)
+	{
+		stats.PosError = max(stats.PosError, D3DXVec3Length(&(pos1-pos0)));
+		stats.UVError = max(stats.UVError, max(fabsf(tu1-tu0), fabsf(tv1-tv0)));
+		D3DXVECTOR3 n;
+		float length = D3DXVec3Length(&normal0);
+		if(length>0)
+		{
+			D3DXVECTOR3 cross;
+			D3DXVec3Normalize(&n, &normal0);
+			D3DXVec3Cross(&cross, &n, &normal1);
+			float angle = atan2f(D3DXVec3Length(&cross), D3DXVec3Dot(&n, &normal1));
+			stats.NormalError = max(stats.NormalError, D3DXToDegree(angle));
+		}
+	}
+
+	void MeasureCompression(const Vertex* pOriginal, const Vertex* pDecoded, int numVerts, VertexCompressionStats& stats)
+	{
+		memset(&stats, 0, sizeof(VertexCompressionStats));
+		for(int i=0; i<numVerts; i++)
+			MeasureCommon(pOriginal[i].pos, pOriginal[i].tu, pOriginal[i].tv, pOriginal[i].normal,
+				pDecoded[i].pos, pDecoded[i].tu, pDecoded[i].tv, pDecoded[i].normal, stats);
+		stats.FullSize = numVerts*(sizeof(Vertex)+sizeof(PosVertex));
+		stats.CompactSize = numVerts*sizeof(CompactVertex);
+	}
+
+	void MeasureCompression(const SkinnedVertex* pOriginal, const SkinnedVertex* pDecoded, int numVerts, VertexCompressionStats& stats)
+	{
+		memset(&stats, 0, sizeof(VertexCompressionStats));
+		for(int i=0; i<numVerts; i++)
+		{
+			MeasureCommon(pOriginal[i].pos, pOriginal[i].tu, pOriginal[i].tv, pOriginal[i].normal,
+				pDecoded[i].pos, pDecoded[i].tu, pDecoded[i].tv, pDecoded[i].normal, stats);
+
+			// Against the weights as the shader would see them, summing to one
+			const float* w0 = (const float*)&pOriginal[i].weights;
+			const float* w1 = (const float*)&pDecoded[i].weights;
+			float sum = max(w0[0], 0.0f) + max(w0[1], 0.0f) + max(w0[2], 0.0f) + max(w0[3], 0.0f);
+			if(sum>0)
+				for(int k=0; k<4; k++)
+					stats.WeightError = max(stats.WeightError, fabsf(max(w0[k], 0.0f)/sum - w1[k]));
+		}
+		stats.FullSize = numVerts*(sizeof(SkinnedVertex)+sizeof(PosVertex));
+		stats.CompactSize = numVerts*sizeof(CompactSkinnedVertex);
+	}
+}
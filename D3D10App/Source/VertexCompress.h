@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// File: VertexCompress.h
+//
+// Conversion between the full and compact vertex formats.  Positions are stored as
+// 16 bit fractions of the mesh bounds, texture coords as half floats, normals as 16 bit
+// octahedral coords and blend weights as bytes that still add up to one.  The shaders
+// undo the position and normal packing, and the CPU copy a mesh keeps for picking is
+// decoded with the same functions so both see the same geometry.
+//
+// Coded by Nate Orr
+//--------------------------------------------------------------------------------------
+#pragma unmanaged
+#pragma once
+
+#include "Vertex.h"
+
+namespace Core
+{
+
+	// Maps 16 bit positions back into the mesh, pos = Offset + q*Scale
+	struct VertexQuantization
+	{
+		D3DXVECTOR3	Offset;
+		D3DXVECTOR3	Scale;
+	};
+
+	// How far a compressed mesh is from the original and what it saved
+	struct VertexCompressionStats
+	{
+		float	PosError;		// Largest position error in object units
+		float	UVError;		// Largest texture coord error
+		float	NormalError;	// Largest normal error in degrees
+		float	WeightError;	// Largest blend weight error
+		UINT	FullSize;		// Bytes of the full vertex and position buffers
+		UINT	CompactSize;	// Bytes of the compact vertex buffer
+	};
+
+
+	//--------------------------------------------------------------------------------------
+	// Finds the position range of a set of vertices, positions are the first three floats
+	//--------------------------------------------------------------------------------------
+	void ComputeQuantization(const void* pVerts, UINT stride, int numVerts, VertexQuantization& quant);
+
+	//--------------------------------------------------------------------------------------
+	// Octahedral normals, the two coords are snorm16 values.  axis (0, 1 or 2 for x, y or
+	// z) is the hemisphere that lands in the middle of the square, the coords are the
+	// other two components in order.  Meshes use z, the terrain uses y.
+	//--------------------------------------------------------------------------------------
+	void EncodeNormal(const D3DXVECTOR3& normal, SHORT* pOut, int axis=2);
+	D3DXVECTOR3 DecodeNormal(const SHORT* pIn, int axis=2);
+
+	//--------------------------------------------------------------------------------------
+	// Blend weights as bytes that add up to 255
+	//--------------------------------------------------------------------------------------
+	void EncodeWeights(const D3DXVECTOR4& weights, BYTE* pOut);
+
+	//--------------------------------------------------------------------------------------
+	// Converts whole vertex arrays
+	//--------------------------------------------------------------------------------------
+	void CompressVertices(const Vertex* pVerts, int numVerts, const VertexQuantization& quant, CompactVertex* pOut);
+	void CompressVertices(const SkinnedVertex* pVerts, int numVerts, const VertexQuantization& quant, CompactSkinnedVertex* pOut);
+	void DecompressVertices(const CompactVertex* pVerts, int numVerts, const VertexQuantization& quant, Vertex* pOut);
+	void DecompressVertices(const CompactSkinnedVertex* pVerts, int numVerts, const VertexQuantization& quant, SkinnedVertex* pOut);
+
+	//--------------------------------------------------------------------------------------
+	// Compares the original vertices with their decoded copies
+	//--------------------------------------------------------------------------------------
+	void MeasureCompression(const Vertex* pOriginal, const Vertex* pDecoded, int numVerts, VertexCompressionStats& stats);
+	void MeasureCompression(const SkinnedVertex* pOriginal, const SkinnedVertex* pDecoded, int numVerts, VertexCompressionStats& stats);
+
+}
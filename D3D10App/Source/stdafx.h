@@ -131,6 +131,22 @@ inline void Swap(T& a, T& b)
 namespace Core
 {
 
+	//--------------------------------------------------------------------------------------
+	// Names a resource in its manager.  Handles outlive the resource safely, once it is
+	// freed the generation no longer matches and lookups return NULL.
+	//--------------------------------------------------------------------------------------
+	struct ResourceHandle
+	{
+		DWORD Index;		// Slot in the manager
+		DWORD Generation;	// 0 for a null handle
+		inline bool IsNull() const { return Generation==0; }
+		inline bool operator==(const ResourceHandle& h) const { return Index==h.Index && Generation==h.Generation; }
+		inline bool operator!=(const ResourceHandle& h) const { return !(*this==h); }
+	};
+
+	// A resource on its way in from the streamer
+	struct StreamRequest;
+
 	//--------------------------------------------------------------------------------------
 	// An object that can be handled by the resource manager
 	//--------------------------------------------------------------------------------------
@@ -139,14 +155,40 @@ namespace Core
 	private:
 		long m_refCount;
 	protected:
-		EngineResource(){ m_refCount = 0; m_szName = "EngineResource"; }
+		EngineResource(){ m_refCount = 0; m_szName = "EngineResource"; m_Handle.Index = m_Handle.Generation = 0; m_bResident = true; m_pStream = NULL; m_ResidencySlot = -1; }
 	public:
+		virtual ~EngineResource(){}
 		inline void AddRef(){ m_refCount++; }
 		inline void Deref(){ m_refCount--; }
 		inline const char* GetName(){ return m_szName.c_str(); }
 		inline bool IsActive(){ return (m_refCount>0); }
+		inline const ResourceHandle& GetHandle(){ return m_Handle; }
 		virtual void Release() = 0;
+
+		// Streaming, only resources that override these can be loaded async.  Decode
+		// runs on a loader thread so it may only read files and use the CPU, upload
+		// runs on the main thread and puts the result on the device.
+		virtual bool StreamDecode(const char* file){ return true; }
+		virtual UINT GetStreamBytes(){ return 0; }
+		virtual bool StreamUpload(const char* file){ return false; }
+
+		// False while the streamer has it, it is a placeholder until then
+		inline bool IsResident(){ return m_bResident; }
+
+		// Residency, see Residency.h.  Evict frees what is on the device and leaves the
+		// resource to stream back in, EvictMips drops the largest mip levels and returns
+		// the bytes left.
+		virtual int GetResidencyGroup(){ return 0; }
+		virtual UINT GetResidentBytes(){ return 0; }
+		virtual int GetNumMips(){ return 1; }
+		virtual UINT EvictMips(int levels){ return GetResidentBytes(); }
+		virtual void Evict(){}
+
 		String m_szName;
+		ResourceHandle m_Handle;	// Set by the manager holding it
+		bool m_bResident;			// Set by the streamer
+		StreamRequest* m_pStream;	// Its request while streaming
+		int m_ResidencySlot;		// Its entry in the residency manager, -1 if none
 	};
 
 
@@ -8,6 +8,7 @@
 #include "stdafx.h"
 #include "Renderer.h"
 #include "DirectInput.h"
+#include "SelfTest.h"
 
 using namespace Core;
 
@@ -112,33 +113,13 @@ void UpdateCamera(Camera& camera)
 
 
 
-// Particle callback function
-void ParticleProc1(Particle& p, const float& time)
+// Loads an effect, or falls back to a plain spray if the file is missing
+ParticleEmitter* LoadEmitter(Renderer& app, char* file, char* texFile)
 {
-	p.Age += time;
-	p.Position += p.Velocity;
-	p.Velocity.y -= 0.0075f*g_TimeScale;
-}
-
-// Particle callback function
-void ParticleProc2(Particle& p, const float& time)
-{
-	p.Age += time;
-	p.Position += p.Velocity;
-	p.Velocity *= 0.9f;
-}
-
-// Particle callback function
-void ParticleProcCyclone(Particle& p, const float& time)
-{
-	p.Age += time;
-	static float theta=0;
-	const float radius = 0.25;
-	theta += time*0.01f;
-	p.Position.x = cosf(theta)*radius*(p.Age+1);
-	p.Position.y = 2*p.Age;
-	p.Position.z = sinf(theta)*radius*(p.Age+1);
-	//p.Velocity *= 0.9f;
+	ParticleEmitter* pEmitter = app.LoadParticleEmitter(file);
+	if(!pEmitter)
+		pEmitter = app.CreateParticleEmitter(texFile, 10000, 30, 4.0f);
+	return pEmitter;
 }
 
 
@@ -170,12 +151,9 @@ void InitDemo(Renderer& app)
 	//app.AddMesh(Orc1);
 	
 
-	g_Emitters[0] = app.CreateParticleEmitter("Textures\\particle4.jpg", 10000, 50, 4.0f);
-	g_Emitters[0]->SetCallback(&ParticleProc1);
-	g_Emitters[1] = app.CreateParticleEmitter("Textures\\particle2.jpg", 10000, 30, 4.0f);
-	g_Emitters[1]->SetCallback(&ParticleProc2);
-	g_Emitters[2] = app.CreateParticleEmitter("Textures\\particle.jpg", 10000, 10, 10.0f);
-	g_Emitters[2]->SetCallback(&ParticleProcCyclone);
+	g_Emitters[0] = LoadEmitter(app, "Particles\\Fountain.emitter", "Textures\\particle4.jpg");
+	g_Emitters[1] = LoadEmitter(app, "Particles\\Mist.emitter", "Textures\\particle2.jpg");
+	g_Emitters[2] = LoadEmitter(app, "Particles\\Cyclone.emitter", "Textures\\particle.jpg");
 	ActivateEmitter(0);	
 }
 
@@ -276,6 +254,21 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdL
 
 	// Create the renderer
 	Renderer app;
+
+#ifdef PHASE_DEBUG
+	// "-test [filter]" runs the self tests and exits with the number that failed, the
+	// headless ones before there is a window.  "-bench [filter]" runs the benchmarks.
+	int testFailures = 0;
+	if(SelfTest::ParseCommandLine(lpCmdLine))
+	{
+		if(SelfTest::IsBenchmark())
+			return SelfTest::Run(SELFTEST_BENCHMARK);
+		testFailures = SelfTest::Run(SELFTEST_HEADLESS);
+		if(!SelfTest::Count(SELFTEST_DEVICE))
+			return testFailures;
+	}
+#endif
+
 	HWND hWnd = InitWindow( hInstance, nCmdShow, 500, 300 );
 	if(!hWnd)
 		return 0;
@@ -287,11 +280,22 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdL
 	MSG msg = {0};
 	if( app.Create(hWnd, true) )
 	{
+#ifdef PHASE_DEBUG
+		// Device tests run instead of the demo
+		if(SelfTest::IsActive())
+		{
+			testFailures += SelfTest::Run(SELFTEST_DEVICE, &app);
+			Input::Release();
+			app.Destroy();
+			return testFailures;
+		}
+#endif
+
 		// Setup the emitters
 		InitDemo(app);
 
 		// Set the time of day
-		app.SetTimeOfDay(3, 0, 0);
+		app.SetTimeOfDay(9, 0, 0);
 
 		// Position camera
 		app.GetCamera().SetPos(D3DXVECTOR3(0, 5, -50));
@@ -326,6 +330,12 @@ int WINAPI wWinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPWSTR lpCmdL
 	LOG( "Exiting now..." );
 	Input::Release();
 	app.Destroy();
+
+#ifdef PHASE_DEBUG
+	// The renderer could not be created for the device tests
+	if(SelfTest::IsActive())
+		return testFailures+1;
+#endif
 	
 	return ( int )msg.wParam;
 }
@@ -56,11 +56,11 @@ struct PS_INPUT_GBUFFER
 PS_INPUT_GBUFFER VS_GBuffer( VS_INPUT input )
 {
     PS_INPUT_GBUFFER output;
-    output.Pos = mul( input.Pos, g_mWorld );
+    output.Pos = mul( DecodePosition(input.Pos), g_mWorld );
     output.WPos = output.Pos;
     output.Pos = mul( output.Pos, g_mViewProjection );
     output.Tex = input.Tex;
-    output.Norm = normalize(mul(input.Norm, (float3x3)g_mWorld));
+    output.Norm = normalize(mul(DecodeNormal(input.Norm), (float3x3)g_mWorld));
     output.View = g_CameraPos-output.WPos;
     return output;
 }
@@ -120,11 +120,11 @@ DL_Output PS_GBuffer( in PS_INPUT_GBUFFER input )
 PS_INPUT_SHADE_FULL VS_GBufferCube( VS_INPUT input )
 {
     PS_INPUT_SHADE_FULL output;
-    output.Pos = mul( input.Pos, g_mWorld );
+    output.Pos = mul( DecodePosition(input.Pos), g_mWorld );
     output.WPos = output.Pos;
     output.Pos = mul( output.Pos, g_mViewProjection );
     output.Tex = input.Tex;
-    output.Norm = mul(input.Norm, (float3x3)g_mWorld);
+    output.Norm = mul(DecodeNormal(input.Norm), (float3x3)g_mWorld);
 	output.Eye = normalize(g_CameraPos - output.WPos);
     return output;
 }